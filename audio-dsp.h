@@ -0,0 +1,541 @@
+// audio-dsp.h — G.711 μ-law decode/encode, the IAP upsampling FIRs and frame energy.
+//
+// Every inbound frame pays for these first: IAP decodes the RTP payload and
+// upsamples it once per downstream (8 → 16 kHz for VAD, 8 → 24 kHz for
+// Moshi), and the receivers of the compact encodings (pcm-wire.h) run the
+// same two steps again on their side. Both filters are polyphase: the
+// zero-stuffed input samples are never multiplied, so the 15-tap half-band
+// filter costs 8 MACs per input sample (its other phase is a delayed copy)
+// and the 24-tap 3× filter 3 × 8.
+//
+// Each kernel exists as a scalar reference and as SIMD versions (SSE2 and
+// AVX2 on x86, NEON on ARM). dsp_kernels() picks the widest the CPU supports
+// once per process; WHISPERTALK_DSP_ISA=scalar|sse2|avx2|neon forces one
+// (unsupported names are ignored). The SIMD kernels vectorise across output
+// samples and keep the scalar operation order (no FMA), so on x86 they are
+// bit-exact with the reference. That matters: the ULAW and ULAW_UP16K wire
+// formats rely on sender and receiver producing the same floats. On ARM the
+// compiler may contract the scalar reference into FMAs, so only the kernels
+// of one build are guaranteed to agree. sum_squares (VAD's frame energy) has
+// no such contract and sums per lane.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define WHISPERTALK_DSP_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define WHISPERTALK_DSP_NEON 1
+#endif
+
+namespace whispertalk {
+
+// Half-band FIR low-pass filter for 8kHz → 16kHz upsampling.
+// 15-tap Hamming-windowed sinc, cutoff ~3.8kHz, ~40dB stopband attenuation.
+// Used by IAP (inbound-audio-processor.cpp) and the offline codec quality test
+// (frontend.cpp handle_iap_quality_test). Both must use the same filter to
+// ensure test results match real pipeline behaviour.
+static constexpr int IAP_FIR_LEN    = 15;
+static constexpr int IAP_FIR_CENTER = 7;
+static constexpr int IAP_ULAW_FRAME = 160;
+
+// 3-phase polyphase FIR for 8kHz → 24kHz upsampling (3× interpolation).
+// 24-tap Hamming-windowed sinc, cutoff 4kHz, unity output gain.
+// Decomposed into 3 polyphase sub-filters of 8 taps each (each sums to ~1.0).
+// IAP_ULAW_OUT_24K: output samples per 160-sample input frame (160 * 3 = 480).
+static constexpr int IAP_FIR_24K_LEN    = 24;
+static constexpr int IAP_FIR_24K_CENTER = 12;
+static constexpr int IAP_ULAW_OUT_24K   = 480;
+
+inline const float* iap_fir_coeffs() {
+    static const float coeffs[IAP_FIR_LEN] = {
+        -0.0076f, 0.0000f, 0.0527f, 0.0000f, -0.1681f, 0.0000f, 0.6230f,
+         1.0000f,
+         0.6230f, 0.0000f, -0.1681f, 0.0000f, 0.0527f, 0.0000f, -0.0076f
+    };
+    return coeffs;
+}
+
+// G.711 μ-law → float32 in [-1, 1): the table IAP decodes RTP with.
+inline const float* ulaw_float_table() {
+    static const struct Table {
+        float v[256];
+        Table() {
+            for (int i = 0; i < 256; ++i) {
+                int mu = ~i;
+                int sign = mu & 0x80;
+                int segment = (mu >> 4) & 0x07;
+                int quantization = mu & 0x0F;
+                int magnitude = ((quantization << 1) + 33) << (segment + 2);
+                magnitude -= 132;
+                v[i] = (sign ? -magnitude : magnitude) / 32768.0f;
+            }
+        }
+    } table;
+    return table.v;
+}
+
+// int16 → G.711 μ-law, the inverse of ulaw_float_table() (× 32768): every
+// value the table produces encodes back to its own byte.
+inline uint8_t linear_to_ulaw(int16_t sample) {
+    int pcm = sample;
+    int sign = 0;
+    if (pcm < 0) { pcm = -pcm; sign = 0x80; }
+    if (pcm > 32635) pcm = 32635;
+    pcm += 132;
+    int exponent = 7;
+    for (int mask = 0x4000; (pcm & mask) == 0 && exponent > 0; mask >>= 1) exponent--;
+    int mantissa = (pcm >> (exponent + 3)) & 0x0F;
+    return static_cast<uint8_t>(~(sign | (exponent << 4) | mantissa));
+}
+
+namespace dsp {
+
+// Non-zero even taps of the half-band filter (h[0], h[2], h[4], h[6]; the
+// odd ones are zero and the centre tap is 1).
+inline constexpr float H0 = -0.0076f;
+inline constexpr float H2 =  0.0527f;
+inline constexpr float H4 = -0.1681f;
+inline constexpr float H6 =  0.6230f;
+
+// h[n] = sinc((n - 11.5) / 3) * (0.54 - 0.46 * cos(2πn/23)), n = 0..23
+// Symmetric: h[n] == h[23-n]. Phase sums: p0 ≈ 0.997, p1 ≈ 0.996, p2 ≈ 0.997.
+inline constexpr float H24[IAP_FIR_24K_LEN] = {
+    -0.003321f, -0.008827f, -0.007386f,
+     0.012696f,  0.041809f,  0.032792f,
+    -0.049604f, -0.147281f, -0.109854f,
+     0.171281f,  0.612376f,  0.950838f,
+     0.950838f,  0.612376f,  0.171281f,
+    -0.109854f, -0.147281f, -0.049604f,
+     0.032792f,  0.041809f,  0.012696f,
+    -0.007386f, -0.008827f, -0.003321f
+};
+
+// The kernels below work on an extended input: `ext` holds the filter
+// history (IAP_FIR_CENTER or IAP_FIR_24K_CENTER samples) followed by the
+// n new samples. The *_from variants start at input sample `from`, so the
+// SIMD kernels hand their tails to the reference.
+
+inline void ulaw_decode_scalar(const uint8_t* in, size_t n, float* out) {
+    const float* t = ulaw_float_table();
+    for (size_t i = 0; i < n; ++i) out[i] = t[in[i]];
+}
+
+// out[2i] = even phase (8 taps), out[2i+1] = x[i - 3] (the centre tap).
+inline void fir16k_scalar_from(const float* ext, size_t from, size_t n, float* out) {
+    for (size_t i = from; i < n; i++) {
+        const float* x = ext + i;
+        float even = H0 * x[7] + H2 * x[6] + H4 * x[5] + H6 * x[4]
+                   + H6 * x[3] + H4 * x[2] + H2 * x[1] + H0 * x[0];
+        out[2 * i] = even;
+        out[2 * i + 1] = ext[i + 4];
+    }
+}
+
+inline void fir16k_scalar(const float* ext, size_t n, float* out) { fir16k_scalar_from(ext, 0, n, out); }
+
+// Sub-filter p uses h[p], h[p+3], ..., h[p+21] (8 taps each).
+inline void fir24k_scalar_from(const float* ext, size_t from, size_t n, float* out) {
+    for (size_t i = from; i < n; i++) {
+        const float* x = ext + i;
+        for (int p = 0; p < 3; p++) {
+            float acc = 0.0f;
+            for (int k = 0; k < 8; k++) {
+                acc += H24[p + 3 * k] * x[IAP_FIR_24K_CENTER - k];
+            }
+            out[3 * i + p] = acc;
+        }
+    }
+}
+
+inline void fir24k_scalar(const float* ext, size_t n, float* out) { fir24k_scalar_from(ext, 0, n, out); }
+
+// Σ x² (VAD frame energy and chunk RMS). The SIMD versions keep one partial
+// sum per lane, so unlike the filters they agree with this one only to
+// rounding.
+inline float sum_squares_scalar(const float* x, size_t n) {
+    float acc = 0.0f;
+    for (size_t i = 0; i < n; ++i) acc += x[i] * x[i];
+    return acc;
+}
+
+#if defined(WHISPERTALK_DSP_X86)
+
+inline void fir16k_sse2(const float* ext, size_t n, float* out) {
+    const __m128 h0 = _mm_set1_ps(H0), h2 = _mm_set1_ps(H2), h4 = _mm_set1_ps(H4), h6 = _mm_set1_ps(H6);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float* x = ext + i;
+        __m128 e = _mm_mul_ps(h0, _mm_loadu_ps(x + 7));
+        e = _mm_add_ps(e, _mm_mul_ps(h2, _mm_loadu_ps(x + 6)));
+        e = _mm_add_ps(e, _mm_mul_ps(h4, _mm_loadu_ps(x + 5)));
+        e = _mm_add_ps(e, _mm_mul_ps(h6, _mm_loadu_ps(x + 4)));
+        e = _mm_add_ps(e, _mm_mul_ps(h6, _mm_loadu_ps(x + 3)));
+        e = _mm_add_ps(e, _mm_mul_ps(h4, _mm_loadu_ps(x + 2)));
+        e = _mm_add_ps(e, _mm_mul_ps(h2, _mm_loadu_ps(x + 1)));
+        e = _mm_add_ps(e, _mm_mul_ps(h0, _mm_loadu_ps(x)));
+        __m128 o = _mm_loadu_ps(x + 4);
+        _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(e, o));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(e, o));
+    }
+    fir16k_scalar_from(ext, i, n, out);
+}
+
+inline float sum_squares_sse2(const float* x, size_t n) {
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 v0 = _mm_loadu_ps(x + i), v1 = _mm_loadu_ps(x + i + 4);
+        a0 = _mm_add_ps(a0, _mm_mul_ps(v0, v0));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(v1, v1));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(a0, a1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sum_squares_scalar(x + i, n - i);
+}
+
+// a0..a3, b0..b3, c0..c3 → a0 b0 c0 a1 b1 c1 a2 b2 c2 a3 b3 c3.
+inline void store_interleaved3(float* out, __m128 a, __m128 b, __m128 c) {
+    __m128 ab_lo = _mm_unpacklo_ps(a, b);                                   // a0 b0 a1 b1
+    __m128 ab_hi = _mm_unpackhi_ps(a, b);                                   // a2 b2 a3 b3
+    __m128 x = _mm_shuffle_ps(c, ab_lo, _MM_SHUFFLE(2, 2, 0, 0));           // c0 c0 a1 a1
+    __m128 y = _mm_shuffle_ps(ab_lo, c, _MM_SHUFFLE(1, 1, 3, 3));           // b1 b1 c1 c1
+    __m128 z = _mm_shuffle_ps(c, ab_hi, _MM_SHUFFLE(3, 2, 3, 2));           // c2 c3 a3 b3
+    _mm_storeu_ps(out,     _mm_shuffle_ps(ab_lo, x, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(out + 4, _mm_shuffle_ps(y, ab_hi, _MM_SHUFFLE(1, 0, 2, 0)));
+    _mm_storeu_ps(out + 8, _mm_shuffle_ps(z, z, _MM_SHUFFLE(1, 3, 2, 0)));
+}
+
+inline void fir24k_sse2(const float* ext, size_t n, float* out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x[8];
+        for (int k = 0; k < 8; k++) x[k] = _mm_loadu_ps(ext + i + IAP_FIR_24K_CENTER - k);
+        __m128 acc[3];
+        for (int p = 0; p < 3; p++) {
+            acc[p] = _mm_setzero_ps();
+            for (int k = 0; k < 8; k++) {
+                acc[p] = _mm_add_ps(acc[p], _mm_mul_ps(_mm_set1_ps(H24[p + 3 * k]), x[k]));
+            }
+        }
+        store_interleaved3(out + 3 * i, acc[0], acc[1], acc[2]);
+    }
+    fir24k_scalar_from(ext, i, n, out);
+}
+
+// μ-law without the table: magnitude = (2q + 33) · 2^(seg+2) − 132, built in
+// float (every step is exact), negated as an integer so that code 0x7F
+// decodes to +0.0 like the table, then scaled by 2^-15. Four lanes of this
+// lose to the table lookup, so the SSE2 set keeps the scalar decode.
+__attribute__((target("avx2")))
+inline __m256 ulaw8_avx2(__m256i b) {
+    const __m256i mu = _mm256_xor_si256(b, _mm256_set1_epi32(0xFF));
+    const __m256i seg = _mm256_and_si256(_mm256_srli_epi32(mu, 4), _mm256_set1_epi32(7));
+    const __m256i q = _mm256_and_si256(mu, _mm256_set1_epi32(15));
+    const __m256 pow2 = _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_add_epi32(seg, _mm256_set1_epi32(127 + 2)), 23));
+    const __m256 base = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_slli_epi32(q, 1), _mm256_set1_epi32(33)));
+    const __m256i mag = _mm256_cvttps_epi32(_mm256_sub_ps(_mm256_mul_ps(base, pow2), _mm256_set1_ps(132.0f)));
+    const __m256i s = _mm256_srai_epi32(_mm256_slli_epi32(mu, 24), 31);
+    const __m256i v = _mm256_sub_epi32(_mm256_xor_si256(mag, s), s);
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f / 32768.0f));
+}
+
+__attribute__((target("avx2")))
+inline void ulaw_decode_avx2(const uint8_t* in, size_t n, float* out) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm256_storeu_ps(out + i,     ulaw8_avx2(_mm256_cvtepu8_epi32(b)));
+        _mm256_storeu_ps(out + i + 8, ulaw8_avx2(_mm256_cvtepu8_epi32(_mm_srli_si128(b, 8))));
+    }
+    ulaw_decode_scalar(in + i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+inline float sum_squares_avx2(const float* x, size_t n) {
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 v0 = _mm256_loadu_ps(x + i), v1 = _mm256_loadu_ps(x + i + 8);
+        a0 = _mm256_add_ps(a0, _mm256_mul_ps(v0, v0));
+        a1 = _mm256_add_ps(a1, _mm256_mul_ps(v1, v1));
+    }
+    __m256 a = _mm256_add_ps(a0, a1);
+    __m128 q = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, q);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sum_squares_scalar(x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline void fir16k_avx2(const float* ext, size_t n, float* out) {
+    const __m256 h0 = _mm256_set1_ps(H0), h2 = _mm256_set1_ps(H2);
+    const __m256 h4 = _mm256_set1_ps(H4), h6 = _mm256_set1_ps(H6);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const float* x = ext + i;
+        __m256 e = _mm256_mul_ps(h0, _mm256_loadu_ps(x + 7));
+        e = _mm256_add_ps(e, _mm256_mul_ps(h2, _mm256_loadu_ps(x + 6)));
+        e = _mm256_add_ps(e, _mm256_mul_ps(h4, _mm256_loadu_ps(x + 5)));
+        e = _mm256_add_ps(e, _mm256_mul_ps(h6, _mm256_loadu_ps(x + 4)));
+        e = _mm256_add_ps(e, _mm256_mul_ps(h6, _mm256_loadu_ps(x + 3)));
+        e = _mm256_add_ps(e, _mm256_mul_ps(h4, _mm256_loadu_ps(x + 2)));
+        e = _mm256_add_ps(e, _mm256_mul_ps(h2, _mm256_loadu_ps(x + 1)));
+        e = _mm256_add_ps(e, _mm256_mul_ps(h0, _mm256_loadu_ps(x)));
+        __m256 o = _mm256_loadu_ps(x + 4);
+        __m256 lo = _mm256_unpacklo_ps(e, o);   // e0 o0 e1 o1 | e4 o4 e5 o5
+        __m256 hi = _mm256_unpackhi_ps(e, o);   // e2 o2 e3 o3 | e6 o6 e7 o7
+        _mm256_storeu_ps(out + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(out + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    fir16k_scalar_from(ext, i, n, out);
+}
+
+__attribute__((target("avx2")))
+inline void fir24k_avx2(const float* ext, size_t n, float* out) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x[8];
+        for (int k = 0; k < 8; k++) x[k] = _mm256_loadu_ps(ext + i + IAP_FIR_24K_CENTER - k);
+        __m256 acc[3];
+        for (int p = 0; p < 3; p++) {
+            acc[p] = _mm256_setzero_ps();
+            for (int k = 0; k < 8; k++) {
+                acc[p] = _mm256_add_ps(acc[p], _mm256_mul_ps(_mm256_set1_ps(H24[p + 3 * k]), x[k]));
+            }
+        }
+        store_interleaved3(out + 3 * i, _mm256_castps256_ps128(acc[0]), _mm256_castps256_ps128(acc[1]),
+                           _mm256_castps256_ps128(acc[2]));
+        store_interleaved3(out + 3 * i + 12, _mm256_extractf128_ps(acc[0], 1), _mm256_extractf128_ps(acc[1], 1),
+                           _mm256_extractf128_ps(acc[2], 1));
+    }
+    fir24k_scalar_from(ext, i, n, out);
+}
+
+#elif defined(WHISPERTALK_DSP_NEON)
+
+// Same construction as the AVX2 decode (see ulaw8_avx2).
+inline float32x4_t ulaw4_neon(uint32x4_t b) {
+    const uint32x4_t mu = veorq_u32(b, vdupq_n_u32(0xFF));
+    const int32x4_t seg = vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(mu, 4), vdupq_n_u32(7)));
+    const int32x4_t q = vreinterpretq_s32_u32(vandq_u32(mu, vdupq_n_u32(15)));
+    const float32x4_t pow2 = vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(seg, vdupq_n_s32(127 + 2)), 23));
+    const float32x4_t base = vcvtq_f32_s32(vaddq_s32(vshlq_n_s32(q, 1), vdupq_n_s32(33)));
+    const int32x4_t mag = vcvtq_s32_f32(vsubq_f32(vmulq_f32(base, pow2), vdupq_n_f32(132.0f)));
+    const int32x4_t s = vshrq_n_s32(vshlq_n_s32(vreinterpretq_s32_u32(mu), 24), 31);
+    const int32x4_t v = vsubq_s32(veorq_s32(mag, s), s);
+    return vmulq_f32(vcvtq_f32_s32(v), vdupq_n_f32(1.0f / 32768.0f));
+}
+
+inline void ulaw_decode_neon(const uint8_t* in, size_t n, float* out) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t b = vld1q_u8(in + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(b));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(b));
+        vst1q_f32(out + i,      ulaw4_neon(vmovl_u16(vget_low_u16(lo))));
+        vst1q_f32(out + i + 4,  ulaw4_neon(vmovl_u16(vget_high_u16(lo))));
+        vst1q_f32(out + i + 8,  ulaw4_neon(vmovl_u16(vget_low_u16(hi))));
+        vst1q_f32(out + i + 12, ulaw4_neon(vmovl_u16(vget_high_u16(hi))));
+    }
+    ulaw_decode_scalar(in + i, n - i, out + i);
+}
+
+inline float sum_squares_neon(const float* x, size_t n) {
+    float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float32x4_t v0 = vld1q_f32(x + i), v1 = vld1q_f32(x + i + 4);
+        a0 = vaddq_f32(a0, vmulq_f32(v0, v0));
+        a1 = vaddq_f32(a1, vmulq_f32(v1, v1));
+    }
+    return vaddvq_f32(vaddq_f32(a0, a1)) + sum_squares_scalar(x + i, n - i);
+}
+
+inline void fir16k_neon(const float* ext, size_t n, float* out) {
+    const float32x4_t h0 = vdupq_n_f32(H0), h2 = vdupq_n_f32(H2);
+    const float32x4_t h4 = vdupq_n_f32(H4), h6 = vdupq_n_f32(H6);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float* x = ext + i;
+        float32x4_t e = vmulq_f32(h0, vld1q_f32(x + 7));
+        e = vaddq_f32(e, vmulq_f32(h2, vld1q_f32(x + 6)));
+        e = vaddq_f32(e, vmulq_f32(h4, vld1q_f32(x + 5)));
+        e = vaddq_f32(e, vmulq_f32(h6, vld1q_f32(x + 4)));
+        e = vaddq_f32(e, vmulq_f32(h6, vld1q_f32(x + 3)));
+        e = vaddq_f32(e, vmulq_f32(h4, vld1q_f32(x + 2)));
+        e = vaddq_f32(e, vmulq_f32(h2, vld1q_f32(x + 1)));
+        e = vaddq_f32(e, vmulq_f32(h0, vld1q_f32(x)));
+        float32x4x2_t eo = {{e, vld1q_f32(x + 4)}};
+        vst2q_f32(out + 2 * i, eo);
+    }
+    fir16k_scalar_from(ext, i, n, out);
+}
+
+inline void fir24k_neon(const float* ext, size_t n, float* out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x[8];
+        for (int k = 0; k < 8; k++) x[k] = vld1q_f32(ext + i + IAP_FIR_24K_CENTER - k);
+        float32x4x3_t acc;
+        for (int p = 0; p < 3; p++) {
+            float32x4_t a = vdupq_n_f32(0.0f);
+            for (int k = 0; k < 8; k++) a = vaddq_f32(a, vmulq_f32(vdupq_n_f32(H24[p + 3 * k]), x[k]));
+            acc.val[p] = a;
+        }
+        vst3q_f32(out + 3 * i, acc);
+    }
+    fir24k_scalar_from(ext, i, n, out);
+}
+
+#endif
+
+}  // namespace dsp
+
+enum class DspIsa : uint8_t { SCALAR, SSE2, AVX2, NEON };
+
+inline const char* dsp_isa_name(DspIsa isa) {
+    switch (isa) {
+        case DspIsa::SSE2: return "sse2";
+        case DspIsa::AVX2: return "avx2";
+        case DspIsa::NEON: return "neon";
+        default:           return "scalar";
+    }
+}
+
+// One set of kernels. The FIR entries take the extended input described in
+// namespace dsp and write 2n (16 kHz) or 3n (24 kHz) samples.
+struct DspKernels {
+    DspIsa isa;
+    void (*ulaw_decode)(const uint8_t* in, size_t n, float* out);
+    void (*fir16k)(const float* ext, size_t n, float* out);
+    void (*fir24k)(const float* ext, size_t n, float* out);
+    float (*sum_squares)(const float* x, size_t n);
+};
+
+// The kernels for `isa`, or nullptr if this build or CPU cannot run them.
+inline const DspKernels* dsp_kernels_for(DspIsa isa) {
+    static const DspKernels scalar{DspIsa::SCALAR, dsp::ulaw_decode_scalar, dsp::fir16k_scalar,
+                                   dsp::fir24k_scalar, dsp::sum_squares_scalar};
+#if defined(WHISPERTALK_DSP_X86)
+    __builtin_cpu_init();
+#endif
+    switch (isa) {
+        case DspIsa::SCALAR:
+            return &scalar;
+#if defined(WHISPERTALK_DSP_X86)
+        case DspIsa::SSE2: {
+            static const DspKernels k{DspIsa::SSE2, dsp::ulaw_decode_scalar, dsp::fir16k_sse2, dsp::fir24k_sse2,
+                                      dsp::sum_squares_sse2};
+            return __builtin_cpu_supports("sse2") ? &k : nullptr;
+        }
+        case DspIsa::AVX2: {
+            static const DspKernels k{DspIsa::AVX2, dsp::ulaw_decode_avx2, dsp::fir16k_avx2, dsp::fir24k_avx2,
+                                      dsp::sum_squares_avx2};
+            return __builtin_cpu_supports("avx2") ? &k : nullptr;
+        }
+#elif defined(WHISPERTALK_DSP_NEON)
+        case DspIsa::NEON: {
+            static const DspKernels k{DspIsa::NEON, dsp::ulaw_decode_neon, dsp::fir16k_neon, dsp::fir24k_neon,
+                                      dsp::sum_squares_neon};
+            return &k;
+        }
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+// The kernels this process runs: WHISPERTALK_DSP_ISA if set and supported,
+// otherwise the widest available.
+inline const DspKernels& dsp_kernels() {
+    static const DspKernels* selected = []() {
+        const DspIsa order[] = {DspIsa::AVX2, DspIsa::NEON, DspIsa::SSE2, DspIsa::SCALAR};
+        if (const char* v = std::getenv("WHISPERTALK_DSP_ISA")) {
+            for (DspIsa isa : order) {
+                const DspKernels* k = dsp_kernels_for(isa);
+                if (k && std::strcmp(v, dsp_isa_name(isa)) == 0) return k;
+            }
+        }
+        for (DspIsa isa : order) {
+            if (const DspKernels* k = dsp_kernels_for(isa)) return k;
+        }
+        return dsp_kernels_for(DspIsa::SCALAR);
+    }();
+    return *selected;
+}
+
+inline void ulaw_decode(const uint8_t* in, size_t n, float* out) {
+    dsp_kernels().ulaw_decode(in, n, out);
+}
+
+inline float sum_squares(const float* x, size_t n) {
+    return dsp_kernels().sum_squares(x, n);
+}
+
+// Polyphase FIR half-band upsample: 8kHz → 16kHz via 2× zero-stuff + 15-tap filter.
+// Exploits half-band structure: odd taps (1,3,5,9,11,13) are zero, center tap (7) = 1.0.
+//   Odd outputs:  out[2i+1] = x[i - 3]  (delayed passthrough)
+//   Even outputs: out[2i]   = sum of 8 non-zero taps  (8 MACs vs 15 branchy iterations)
+// Each polyphase branch has DC gain = 1.0 (even coeffs sum to 1.0, odd = center tap 1.0).
+// ~3.7× fewer operations than the naive FIR loop.
+// `history` must point to IAP_FIR_CENTER floats that persist across calls.
+// Returns number of output samples written (= in_len * 2).
+inline size_t iap_fir_upsample_frame(const float* in, size_t in_len, float* out, float* history,
+                                     const DspKernels& k = dsp_kernels()) {
+    if (in_len > (size_t)IAP_ULAW_FRAME) in_len = IAP_ULAW_FRAME;
+    if (in_len == 0) return 0;
+
+    float ext[IAP_FIR_CENTER + IAP_ULAW_FRAME];
+    for (int i = 0; i < IAP_FIR_CENTER; i++) ext[i] = history[i];
+    for (size_t i = 0; i < in_len; i++) ext[IAP_FIR_CENTER + i] = in[i];
+
+    k.fir16k(ext, in_len, out);
+
+    if (in_len >= (size_t)IAP_FIR_CENTER) {
+        for (int i = 0; i < IAP_FIR_CENTER; i++)
+            history[i] = in[in_len - IAP_FIR_CENTER + i];
+    } else {
+        int shift = (int)in_len;
+        for (int i = 0; i < IAP_FIR_CENTER - shift; i++) history[i] = history[i + shift];
+        for (int i = 0; i < shift; i++) history[IAP_FIR_CENTER - shift + i] = in[i];
+    }
+    return in_len * 2;
+}
+
+// 3-phase polyphase FIR upsample: 8kHz → 24kHz via 3× zero-stuff + 24-tap filter.
+// Each input sample produces 3 output samples via 3 polyphase sub-filters.
+// Sub-filter p selects coefficients h[p], h[p+3], h[p+6], ..., h[p+21] (8 taps each).
+// Each sub-filter sums to ~1.0 so output amplitude matches input (unity DC gain).
+// `history` must point to IAP_FIR_24K_CENTER floats that persist across calls.
+// Returns number of output samples written (= in_len * 3).
+inline size_t iap_fir_upsample_frame_24k(const float* in, size_t in_len, float* out, float* history,
+                                         const DspKernels& k = dsp_kernels()) {
+    if (in_len > (size_t)IAP_ULAW_FRAME) in_len = IAP_ULAW_FRAME;
+    if (in_len == 0) return 0;
+
+    float ext[IAP_FIR_24K_CENTER + IAP_ULAW_FRAME];
+    for (int i = 0; i < IAP_FIR_24K_CENTER; i++) ext[i] = history[i];
+    for (size_t i = 0; i < in_len; i++) ext[IAP_FIR_24K_CENTER + i] = in[i];
+
+    k.fir24k(ext, in_len, out);
+
+    if (in_len >= (size_t)IAP_FIR_24K_CENTER) {
+        for (int i = 0; i < IAP_FIR_24K_CENTER; i++)
+            history[i] = in[in_len - IAP_FIR_24K_CENTER + i];
+    } else {
+        int shift = (int)in_len;
+        for (int i = 0; i < IAP_FIR_24K_CENTER - shift; i++) history[i] = history[i + shift];
+        for (int i = 0; i < shift; i++) history[IAP_FIR_24K_CENTER - shift + i] = in[i];
+    }
+    return in_len * 3;
+}
+
+}
@@ -0,0 +1,203 @@
+// audio-ring.h — lock-free single-producer / single-consumer sample ring
+// whose every span is contiguous, and a latest-value cell to go with it.
+//
+// VAD keeps each call's 16 kHz audio and its μ-law source in MirroredRings:
+// receiver_loop appends, the call's shard worker reads 50 ms frames and hands
+// whole speech chunks downstream straight out of the ring, and neither takes
+// a lock. head (written up to) and tail (still needed from) are monotonic
+// item positions, each advanced by one side only with release / acquire
+// ordering; everything in [tail, head) is readable and stays put until the
+// consumer moves tail past it.
+//
+// Contiguity: the storage is mapped twice, back to back (an anonymous memfd
+// on Linux, elsewhere a POSIX shm object unlinked at once; mapped at base and
+// base + capacity), so [p, p + capacity) is one run of memory for any
+// position p: a frame or chunk that wraps the end of the ring reads straight
+// on into the second mapping of the same pages. The object's pages are
+// allocated up front (posix_fallocate): a sparse one would only fail on first
+// touch, with SIGBUS, once a size-limited tmpfs such as a container's 64 MB
+// /dev/shm is full. Where any of this is not possible (capacity not a whole
+// number of pages, no memory object, allocation or mmap failing) the ring
+// falls back to a heap buffer of twice the capacity and writes every item to
+// both halves.
+//
+// LatestValue<T> is a triple buffer: the producer publishes whole values
+// and the consumer reads the most recent one, without either waiting.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace whispertalk {
+
+template <typename T>
+class MirroredRing {
+    static_assert(std::is_trivially_copyable<T>::value, "MirroredRing holds plain samples");
+
+public:
+    // capacity: items, a power of two. allow_mapping = false forces the
+    // heap fallback.
+    explicit MirroredRing(size_t capacity, bool allow_mapping = true)
+        : cap_(capacity), mask_(capacity - 1) {
+        if (allow_mapping) map();
+        if (!data_) {
+            heap_.resize(2 * cap_);
+            data_ = heap_.data();
+        }
+    }
+
+    ~MirroredRing() {
+        if (mapped_) munmap(data_, 2 * cap_ * sizeof(T));
+    }
+
+    MirroredRing(const MirroredRing&) = delete;
+    MirroredRing& operator=(const MirroredRing&) = delete;
+
+    size_t capacity() const { return cap_; }
+    bool mapped() const { return mapped_; }
+
+    // --- producer ---
+
+    // Room for n items at the head, or nullptr if the consumer has not freed
+    // enough yet. Nothing is visible to the consumer until commit(n).
+    T* reserve(size_t n) {
+        uint64_t h = head_.load(std::memory_order_relaxed);
+        if (h + n - tail_.load(std::memory_order_acquire) > cap_) return nullptr;
+        return data_ + (h & mask_);
+    }
+
+    void commit(size_t n) {
+        uint64_t h = head_.load(std::memory_order_relaxed);
+        if (!mapped_) {
+            // Keep both halves equal: the part written below cap_ is copied
+            // up, the part that ran past it is copied down.
+            size_t at = h & mask_;
+            size_t low = at + n <= cap_ ? n : cap_ - at;
+            std::memcpy(data_ + cap_ + at, data_ + at, low * sizeof(T));
+            if (low < n) std::memcpy(data_, data_ + cap_, (n - low) * sizeof(T));
+        }
+        head_.store(h + n, std::memory_order_release);
+    }
+
+    // Appends n items; false (and nothing written) if they do not fit.
+    bool push(const T* src, size_t n) {
+        T* dst = reserve(n);
+        if (!dst) return false;
+        std::memcpy(dst, src, n * sizeof(T));
+        commit(n);
+        return true;
+    }
+
+    // --- consumer ---
+
+    uint64_t head() const { return head_.load(std::memory_order_acquire); }
+    uint64_t tail() const { return tail_.load(std::memory_order_relaxed); }
+
+    // Items [pos, pos + n) as one run, for tail <= pos and pos + n <= head.
+    const T* span(uint64_t pos) const { return data_ + (pos & mask_); }
+
+    // Everything before pos is no longer needed; the producer may reuse it.
+    void release(uint64_t pos) { tail_.store(pos, std::memory_order_release); }
+
+private:
+    void map() {
+        const size_t bytes = cap_ * sizeof(T);
+        const long page = sysconf(_SC_PAGESIZE);
+        if (cap_ == 0 || (cap_ & mask_) != 0 || page <= 0 || bytes % static_cast<size_t>(page) != 0) return;
+
+        int fd = memory_object(bytes);
+        if (fd < 0) return;
+        void* base = mmap(nullptr, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (base == MAP_FAILED) {
+            ::close(fd);
+            return;
+        }
+        char* lo = static_cast<char*>(base);
+        void* a = mmap(lo, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        void* b = mmap(lo + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        ::close(fd);
+        if (a != lo || b != lo + bytes) {
+            munmap(base, 2 * bytes);
+            return;
+        }
+        data_ = reinterpret_cast<T*>(lo);
+        mapped_ = true;
+    }
+
+    // A file descriptor for `bytes` of memory, every page allocated; -1 if
+    // that is not possible.
+    static int memory_object(size_t bytes) {
+#if defined(__linux__)
+        int fd = memfd_create("wt-ring", MFD_CLOEXEC);
+        if (fd < 0) return -1;
+        if (posix_fallocate(fd, 0, (off_t)bytes) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+#else
+        static std::atomic<uint32_t> counter{0};
+        char name[32];
+        snprintf(name, sizeof(name), "/wt-ring-%d-%u", (int)getpid(),
+                 counter.fetch_add(1, std::memory_order_relaxed));
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) return -1;
+        shm_unlink(name);
+        // posix_fallocate does not apply to shm objects outside Linux.
+        if (ftruncate(fd, (off_t)bytes) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+#endif
+    }
+
+    size_t cap_;
+    size_t mask_;
+    T* data_ = nullptr;
+    bool mapped_ = false;
+    std::vector<T> heap_;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+};
+
+template <typename T>
+class LatestValue {
+public:
+    // Producer: publishes v; it replaces whatever the consumer has not read.
+    void store(const T& v) {
+        slots_[back_] = v;
+        uint8_t prev = middle_.exchange(static_cast<uint8_t>(back_ | FRESH), std::memory_order_acq_rel);
+        back_ = prev & INDEX;
+    }
+
+    // Consumer: the most recent value published, or the last one read if
+    // nothing new has been.
+    const T& load() {
+        if (middle_.load(std::memory_order_relaxed) & FRESH) {
+            uint8_t prev = middle_.exchange(front_, std::memory_order_acq_rel);
+            front_ = prev & INDEX;
+        }
+        return slots_[front_];
+    }
+
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4;
+
+    T slots_[3] = {};
+    uint8_t back_ = 0;                    // producer's slot
+    std::atomic<uint8_t> middle_{1};      // handed over, FRESH if unread
+    uint8_t front_ = 2;                   // consumer's slot
+};
+
+}
@@ -0,0 +1,126 @@
+// call-job-queue.h — work queue that runs different calls in parallel and
+// each call's jobs in order.
+//
+// Whisper keeps a pool of whisper_states and one worker thread per state.
+// Chunks from many calls share the pool, but two chunks of one call must not
+// be transcribed at once: a final commits or discards the partial before it
+// (speech-partial.h), and a call's transcripts reach LLaMA in speech order.
+// pop() therefore hands a worker the oldest job whose call has no job
+// running, and done() frees the call again. A partial waiting behind a newer
+// job of its call is obsolete and is dropped when that job is pushed
+// (`supersedable`).
+//
+// Each job carries the time it was queued, so the caller can report how long
+// chunks wait for a free state.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+
+namespace whispertalk {
+
+template <typename Job>
+class CallJobQueue {
+public:
+    struct Item {
+        uint32_t call_id = 0;
+        Job job;
+        bool supersedable = false;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+
+    // Queues `job` for the call. Returns the number of waiting supersedable
+    // jobs of the call it replaced.
+    size_t push(uint32_t call_id, Job job, bool supersedable) {
+        size_t dropped = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = waiting_.begin(); it != waiting_.end();) {
+                if (it->call_id == call_id && it->supersedable) {
+                    it = waiting_.erase(it);
+                    dropped++;
+                } else {
+                    ++it;
+                }
+            }
+            waiting_.push_back(Item{call_id, std::move(job), supersedable, std::chrono::steady_clock::now()});
+        }
+        cv_.notify_one();
+        return dropped;
+    }
+
+    // Blocks until a job of a call with none running is waiting, then takes
+    // it and marks the call running. False once close() was called.
+    bool pop(Item& out) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            if (closed_) return false;
+            for (auto it = waiting_.begin(); it != waiting_.end(); ++it) {
+                if (running_.count(it->call_id)) continue;
+                out = std::move(*it);
+                waiting_.erase(it);
+                running_.insert(out.call_id);
+                return true;
+            }
+            cv_.wait(lock);
+        }
+    }
+
+    // The call's running job is finished; its next one may start.
+    void done(uint32_t call_id) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_.erase(call_id);
+        }
+        cv_.notify_all();
+    }
+
+    // Drops the call's waiting jobs (call ended). Returns how many.
+    size_t drop_call(uint32_t call_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t dropped = 0;
+        for (auto it = waiting_.begin(); it != waiting_.end();) {
+            if (it->call_id == call_id) {
+                it = waiting_.erase(it);
+                dropped++;
+            } else {
+                ++it;
+            }
+        }
+        return dropped;
+    }
+
+    // Wakes every pop() for good; waiting jobs are abandoned.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    size_t waiting() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return waiting_.size();
+    }
+
+    size_t running() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return running_.size();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Item> waiting_;
+    std::unordered_set<uint32_t> running_;
+    bool closed_ = false;
+};
+
+}
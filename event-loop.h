@@ -0,0 +1,288 @@
+// event-loop.h — single-threaded reactor for the interconnect.
+//
+// One EventLoop thread per InterconnectNode multiplexes the listen sockets,
+// the upstream mgmt socket, liveness of every data/mgmt connection and the
+// downstream reconnect timers. It sleeps in epoll_wait (Linux) or kevent
+// (macOS/BSD) with no timeout unless a timer is armed, so a connected, idle
+// node does not wake up at all.
+//
+// Registrations are edge-triggered:
+//   READABLE — fd became readable (or accept()able). The callback must drain
+//              it: the next notification only comes with new data.
+//   HANGUP   — peer closed its side or the socket errored. Registering for
+//              HANGUP alone does not wake the loop for ordinary data, so data
+//              sockets read by service threads can be watched for liveness
+//              without costing a wakeup per packet (on kqueue, which has no
+//              hangup-only filter, the wakeup happens but is not delivered).
+//
+// Callbacks, posted tasks and timers all run on the loop thread. watch(),
+// unwatch(), post() and run_after() may be called from any thread, including
+// from inside a callback. A callback never runs for an fd after unwatch() for
+// it returned on another thread, except one already being dispatched; fds are
+// tagged with a generation so a reused fd number never sees a stale callback.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+namespace whispertalk {
+
+class EventLoop {
+public:
+    static constexpr uint32_t READABLE = 1;
+    static constexpr uint32_t HANGUP   = 2;
+
+    using Callback = std::function<void(int fd, uint32_t events)>;
+    using Task = std::function<void()>;
+
+    EventLoop() {
+#if defined(__linux__)
+        poll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+#else
+        poll_fd_ = kqueue();
+        if (poll_fd_ >= 0) fcntl(poll_fd_, F_SETFD, FD_CLOEXEC);
+#endif
+        if (pipe(wake_pipe_) == 0) {
+            for (int fd : wake_pipe_) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+            arm(wake_pipe_[0], READABLE, 0);
+        }
+    }
+
+    ~EventLoop() {
+        stop();
+        if (poll_fd_ >= 0) ::close(poll_fd_);
+        if (wake_pipe_[0] >= 0) ::close(wake_pipe_[0]);
+        if (wake_pipe_[1] >= 0) ::close(wake_pipe_[1]);
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool start() {
+        if (poll_fd_ < 0 || wake_pipe_[0] < 0) return false;
+        if (running_.exchange(true)) return true;
+        thread_ = std::thread(&EventLoop::run, this);
+        return true;
+    }
+
+    // Stops and joins the loop thread. Safe to call from a callback (the
+    // thread is then left to exit on its own) and more than once.
+    void stop() {
+        if (!running_.exchange(false)) return;
+        wake();
+        if (thread_.joinable()) {
+            if (thread_.get_id() == std::this_thread::get_id()) thread_.detach();
+            else thread_.join();
+        }
+    }
+
+    bool in_loop_thread() const { return thread_.get_id() == std::this_thread::get_id(); }
+
+    void watch(int fd, uint32_t events, Callback cb) {
+        if (fd < 0) return;
+        uint32_t gen;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            gen = ++next_gen_;
+            watches_[fd] = Watch{gen, events, std::make_shared<Callback>(std::move(cb))};
+        }
+        arm(fd, events, gen);
+    }
+
+    // Must be called before the fd is closed if it may be reused while the
+    // loop is running (closing alone drops the kernel registration but not
+    // the callback).
+    void unwatch(int fd) {
+        if (fd < 0) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (watches_.erase(fd) == 0) return;
+        }
+#if defined(__linux__)
+        epoll_ctl(poll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+#else
+        struct kevent kev;
+        EV_SET(&kev, fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+        kevent(poll_fd_, &kev, 1, nullptr, 0, nullptr);
+#endif
+    }
+
+    void post(Task task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            posted_.push_back(std::move(task));
+        }
+        wake();
+    }
+
+    void run_after(int delay_ms, Task task) {
+        auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            timers_.emplace(due, std::move(task));
+        }
+        wake();
+    }
+
+    // Number of times the loop thread returned from the kernel wait. An idle
+    // loop with no armed timers stays at the same value.
+    uint64_t wakeups() const { return wakeups_.load(std::memory_order_relaxed); }
+
+private:
+    struct Watch {
+        uint32_t gen;
+        uint32_t events;
+        std::shared_ptr<Callback> cb;
+    };
+
+    static constexpr int MAX_EVENTS = 32;
+
+    static uint64_t make_tag(int fd, uint32_t gen) {
+        return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    void arm(int fd, uint32_t events, uint32_t gen) {
+        uint64_t tag = make_tag(fd, gen);
+#if defined(__linux__)
+        epoll_event ev{};
+        ev.events = EPOLLET | EPOLLRDHUP;
+        if (events & READABLE) ev.events |= EPOLLIN;
+        ev.data.u64 = tag;
+        if (epoll_ctl(poll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0 && errno == EEXIST) {
+            epoll_ctl(poll_fd_, EPOLL_CTL_MOD, fd, &ev);
+        }
+#else
+        (void)events;
+        struct kevent kev;
+        EV_SET(&kev, fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0,
+               reinterpret_cast<void*>(static_cast<uintptr_t>(tag)));
+        kevent(poll_fd_, &kev, 1, nullptr, 0, nullptr);
+#endif
+    }
+
+    void wake() {
+        if (wake_pipe_[1] < 0) return;
+        char b = 1;
+        ssize_t r = ::write(wake_pipe_[1], &b, 1);   // EAGAIN: a wakeup is already pending
+        (void)r;
+    }
+
+    void drain_wake_pipe() {
+        char buf[64];
+        while (::read(wake_pipe_[0], buf, sizeof(buf)) > 0) {}
+    }
+
+    // Milliseconds until the earliest timer, -1 if none.
+    int next_timeout_ms() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!posted_.empty()) return 0;
+        if (timers_.empty()) return -1;
+        auto now = std::chrono::steady_clock::now();
+        auto due = timers_.begin()->first;
+        if (due <= now) return 0;
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count() + 1;
+        return static_cast<int>(ms);
+    }
+
+    void dispatch(uint64_t tag, uint32_t events) {
+        int fd = static_cast<int>(static_cast<uint32_t>(tag));
+        uint32_t gen = static_cast<uint32_t>(tag >> 32);
+        if (fd == wake_pipe_[0] && gen == 0) {
+            drain_wake_pipe();
+            return;
+        }
+        std::shared_ptr<Callback> cb;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = watches_.find(fd);
+            if (it == watches_.end() || it->second.gen != gen) return;
+            events &= it->second.events;
+            cb = it->second.cb;
+        }
+        if (events) (*cb)(fd, events);
+    }
+
+    void run_due_tasks() {
+        std::vector<Task> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready.swap(posted_);
+            auto now = std::chrono::steady_clock::now();
+            while (!timers_.empty() && timers_.begin()->first <= now) {
+                ready.push_back(std::move(timers_.begin()->second));
+                timers_.erase(timers_.begin());
+            }
+        }
+        for (auto& t : ready) t();
+    }
+
+    void run() {
+        while (running_.load(std::memory_order_acquire)) {
+            int timeout_ms = next_timeout_ms();
+#if defined(__linux__)
+            epoll_event evs[MAX_EVENTS];
+            int n = epoll_wait(poll_fd_, evs, MAX_EVENTS, timeout_ms);
+            wakeups_.fetch_add(1, std::memory_order_relaxed);
+            for (int i = 0; i < n && running_; i++) {
+                uint32_t ev = 0;
+                if (evs[i].events & EPOLLIN) ev |= READABLE;
+                if (evs[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) ev |= HANGUP | READABLE;
+                dispatch(evs[i].data.u64, ev);
+            }
+#else
+            struct kevent evs[MAX_EVENTS];
+            timespec ts;
+            timespec* tsp = nullptr;
+            if (timeout_ms >= 0) {
+                ts.tv_sec = timeout_ms / 1000;
+                ts.tv_nsec = static_cast<long>(timeout_ms % 1000) * 1000000L;
+                tsp = &ts;
+            }
+            int n = kevent(poll_fd_, nullptr, 0, evs, MAX_EVENTS, tsp);
+            wakeups_.fetch_add(1, std::memory_order_relaxed);
+            for (int i = 0; i < n && running_; i++) {
+                uint32_t ev = READABLE;
+                if (evs[i].flags & (EV_EOF | EV_ERROR)) ev |= HANGUP;
+                dispatch(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(evs[i].udata)), ev);
+            }
+#endif
+            if (running_) run_due_tasks();
+        }
+    }
+
+    int poll_fd_ = -1;
+    int wake_pipe_[2] = {-1, -1};
+    std::atomic<bool> running_{false};
+    std::atomic<uint64_t> wakeups_{0};
+    std::thread thread_;
+
+    std::mutex mutex_;
+    uint32_t next_gen_ = 0;
+    std::map<int, Watch> watches_;
+    std::vector<Task> posted_;
+    std::multimap<std::chrono::steady_clock::time_point, Task> timers_;
+};
+
+}
@@ -0,0 +1,380 @@
+// flow-control.h — per-call credit windows for interconnect data links.
+//
+// A slow consumer used to be visible only as a DATA_SEND_TIMEOUT_MS send
+// timeout, after which the link was torn down with everything in flight.
+// Credits make the backlog explicit before it gets that far:
+//
+//   • The receiving node counts what it has taken off each call's stream
+//     (CreditLedger) and grants it back as CREDIT mgmt frames
+//       [CREDIT][call_id u32][bytes u32][frames u32]   (big-endian deltas)
+//     on the mgmt connection the sender opened. Grants go out once a call
+//     has CREDIT_GRANT_BYTES pending, and for every pending call whenever
+//     a receive finds the link idle.
+//   • The sender keeps one FlowWindow per downstream link: each data frame
+//     adds to its call's in-flight bytes, each credit takes them off. A call
+//     whose in-flight bytes reach the window is "closed". Sends are never
+//     refused; producers that can shed (IAP) or slow down (the TTS dock)
+//     check the window first.
+//
+// Bytes are the 8-byte packet header plus payload, counted identically on
+// both ends (framing and trace extensions are left out). Credits are deltas
+// and in-flight counts clamp at zero, so a grant for data sent over an
+// earlier connection, or to another replica before a failover, cannot drive
+// a window negative. Reconnecting clears a link's in-flight state; the
+// cumulative counters (stalls, sheds, overruns) survive.
+//
+// Per-call state lives in fixed-size CallTables so the data path never
+// allocates. A table at its load limit evicts a neighbouring call: the
+// sender stops counting that call's bytes, the receiver grants them at once.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+namespace whispertalk {
+
+static constexpr size_t FLOW_WINDOW_BYTES_DEFAULT = 256 * 1024;
+static constexpr size_t CREDIT_GRANT_BYTES = 4096;
+static constexpr uint64_t FLOW_STALL_MIN_US = 1000;   // sends slower than this count as stalls
+static constexpr size_t CREDIT_FRAME_BYTES = 13;
+
+// Per-call window size: WHISPERTALK_IC_WINDOW_KB (default 256 KiB). Only
+// the sending side enforces it.
+inline size_t ic_flow_window_default() {
+    static const size_t bytes = []() {
+        const char* v = std::getenv("WHISPERTALK_IC_WINDOW_KB");
+        long kb = v ? std::atol(v) : 0;
+        return kb > 0 ? static_cast<size_t>(kb) * 1024 : FLOW_WINDOW_BYTES_DEFAULT;
+    }();
+    return bytes;
+}
+
+// Fixed-size open-addressing map call_id → V (linear probing,
+// backward-shift deletion); call_id 0 marks a free slot. Never allocates.
+// Not thread-safe: the owner serialises access.
+template <typename V, size_t N = 1024>
+class CallTable {
+    static_assert((N & (N - 1)) == 0, "CallTable size must be a power of two");
+public:
+    static constexpr size_t MAX_LOAD = N * 3 / 4;
+
+    V* find(uint32_t id) {
+        for (size_t i = home(id);; i = (i + 1) & (N - 1)) {
+            if (keys_[i] == id) return &vals_[i];
+            if (keys_[i] == 0) return nullptr;
+        }
+    }
+    const V* find(uint32_t id) const { return const_cast<CallTable*>(this)->find(id); }
+
+    // Entry for id, claiming a value-initialised slot if needed. At the
+    // load limit the first entry at or after id's home slot is handed to
+    // on_evict(call_id, value) and removed first.
+    template <typename Evict>
+    V& claim(uint32_t id, Evict&& on_evict) {
+        if (V* v = find(id)) return *v;
+        if (size_ >= MAX_LOAD) {
+            size_t i = home(id);
+            while (keys_[i] == 0) i = (i + 1) & (N - 1);
+            on_evict(keys_[i], vals_[i]);
+            erase_at(i);
+        }
+        size_t i = home(id);
+        while (keys_[i] != 0) i = (i + 1) & (N - 1);
+        keys_[i] = id;
+        vals_[i] = V();
+        size_++;
+        return vals_[i];
+    }
+
+    bool erase(uint32_t id) {
+        for (size_t i = home(id);; i = (i + 1) & (N - 1)) {
+            if (keys_[i] == id) {
+                erase_at(i);
+                return true;
+            }
+            if (keys_[i] == 0) return false;
+        }
+    }
+
+    // fn(call_id, value&) for every entry, in slot order.
+    template <typename Fn>
+    void for_each(Fn&& fn) {
+        for (size_t i = 0; i < N; i++) {
+            if (keys_[i] != 0) fn(keys_[i], vals_[i]);
+        }
+    }
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (size_t i = 0; i < N; i++) {
+            if (keys_[i] != 0) fn(keys_[i], vals_[i]);
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i < N; i++) keys_[i] = 0;
+        size_ = 0;
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    static size_t home(uint32_t id) { return (id * 2654435761u) & (N - 1); }
+
+    // Pull later members of the probe run back over the hole so that
+    // find() never stops early at it.
+    void erase_at(size_t i) {
+        for (size_t j = (i + 1) & (N - 1); keys_[j] != 0; j = (j + 1) & (N - 1)) {
+            size_t h = home(keys_[j]);
+            bool reachable = i <= j ? (i < h && h <= j) : (i < h || h <= j);
+            if (reachable) continue;
+            keys_[i] = keys_[j];
+            vals_[i] = vals_[j];
+            i = j;
+        }
+        keys_[i] = 0;
+        size_--;
+    }
+
+    uint32_t keys_[N] = {};
+    V vals_[N] = {};
+    size_t size_ = 0;
+};
+
+class FlowWindow {
+public:
+    struct Stats {
+        uint64_t in_flight_bytes = 0;   // sent, not yet credited (all calls)
+        uint64_t queued_frames = 0;     // frames sent, not yet credited
+        uint64_t calls = 0;             // calls with data in flight
+        uint64_t closed_calls = 0;      // calls currently at or over the window
+        uint64_t peak_in_flight_bytes = 0;
+        uint64_t stall_us = 0;          // time spent in sends that blocked
+        uint64_t stalls = 0;
+        uint64_t overruns = 0;          // frames sent while their window was closed
+        uint64_t shed_frames = 0;       // frames producers dropped instead of sending
+        uint64_t shed_bytes = 0;
+        uint64_t credits = 0;           // CREDIT frames applied
+
+        // Sums two links' stats; the peak is the larger of the two.
+        void add(const Stats& o) {
+            in_flight_bytes += o.in_flight_bytes;
+            queued_frames += o.queued_frames;
+            calls += o.calls;
+            closed_calls += o.closed_calls;
+            if (o.peak_in_flight_bytes > peak_in_flight_bytes) peak_in_flight_bytes = o.peak_in_flight_bytes;
+            stall_us += o.stall_us;
+            stalls += o.stalls;
+            overruns += o.overruns;
+            shed_frames += o.shed_frames;
+            shed_bytes += o.shed_bytes;
+            credits += o.credits;
+        }
+    };
+
+    void on_send(uint32_t call_id, size_t bytes, size_t window, uint64_t send_us) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Call& c = calls_.claim(call_id, [this](uint32_t, const Call& old) { uncount_locked(old); });
+        if (c.bytes >= window) overruns_++;
+        c.bytes += bytes;
+        c.frames++;
+        in_flight_ += bytes;
+        frames_++;
+        if (in_flight_ > peak_) peak_ = in_flight_;
+        if (send_us >= FLOW_STALL_MIN_US) {
+            stall_us_ += send_us;
+            stalls_++;
+        }
+    }
+
+    void on_credit(uint32_t call_id, uint32_t bytes, uint32_t frames) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            credits_++;
+            Call* c = calls_.find(call_id);
+            if (!c) return;
+            uint64_t b = bytes < c->bytes ? bytes : c->bytes;
+            uint64_t f = frames < c->frames ? frames : c->frames;
+            c->bytes -= b;
+            c->frames -= f;
+            in_flight_ -= b;
+            frames_ -= f;
+        }
+        cv_.notify_all();
+    }
+
+    void on_shed(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shed_frames_++;
+        shed_bytes_ += bytes;
+    }
+
+    bool is_open(uint32_t call_id, size_t window) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return open_locked(call_id, window);
+    }
+
+    // Blocks until call_id's window opens, the link is reset or timeout_ms
+    // passes. Returns whether the window is open.
+    bool wait_open(uint32_t call_id, size_t window, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                            [&] { return open_locked(call_id, window); });
+    }
+
+    uint64_t call_in_flight(uint32_t call_id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Call* c = calls_.find(call_id);
+        return c ? c->bytes : 0;
+    }
+
+    void forget(uint32_t call_id) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Call* c = calls_.find(call_id);
+            if (!c) return;
+            uncount_locked(*c);
+            calls_.erase(call_id);
+        }
+        cv_.notify_all();
+    }
+
+    // The link was (re)connected or lost: nothing is in flight any more.
+    void reset() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            calls_.clear();
+            in_flight_ = 0;
+            frames_ = 0;
+        }
+        cv_.notify_all();
+    }
+
+    Stats stats(size_t window) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats s;
+        s.in_flight_bytes = in_flight_;
+        s.queued_frames = frames_;
+        calls_.for_each([&](uint32_t, const Call& c) {
+            if (c.bytes > 0) s.calls++;
+            if (c.bytes >= window) s.closed_calls++;
+        });
+        s.peak_in_flight_bytes = peak_;
+        s.stall_us = stall_us_;
+        s.stalls = stalls_;
+        s.overruns = overruns_;
+        s.shed_frames = shed_frames_;
+        s.shed_bytes = shed_bytes_;
+        s.credits = credits_;
+        return s;
+    }
+
+private:
+    struct Call {
+        uint64_t bytes = 0;
+        uint64_t frames = 0;
+    };
+
+    bool open_locked(uint32_t call_id, size_t window) const {
+        const Call* c = calls_.find(call_id);
+        return !c || c->bytes < window;
+    }
+
+    void uncount_locked(const Call& c) {
+        in_flight_ -= c.bytes;
+        frames_ -= c.frames;
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    CallTable<Call> calls_;
+    uint64_t in_flight_ = 0;
+    uint64_t frames_ = 0;
+    uint64_t peak_ = 0;
+    uint64_t stall_us_ = 0;
+    uint64_t stalls_ = 0;
+    uint64_t overruns_ = 0;
+    uint64_t shed_frames_ = 0;
+    uint64_t shed_bytes_ = 0;
+    uint64_t credits_ = 0;
+};
+
+// Receiver side: bytes and frames consumed per call but not yet granted
+// back to the sender.
+class CreditLedger {
+public:
+    struct Grant {
+        uint32_t call_id = 0;
+        uint32_t bytes = 0;
+        uint32_t frames = 0;
+    };
+
+    static constexpr int FLUSH_BATCH = 32;
+
+    // Records a consumed frame. Fills out with grants that are due now: the
+    // call's own once CREDIT_GRANT_BYTES have accumulated, plus one for a
+    // call evicted to make room. Returns how many (0..2).
+    int consume(uint32_t call_id, size_t bytes, Grant out[2]) {
+        int n = 0;
+        std::lock_guard<std::mutex> lock(mutex_);
+        Pending& p = pending_.claim(call_id, [&](uint32_t id, const Pending& old) {
+            if (old.frames) {
+                out[n++] = Grant{id, old.bytes, old.frames};
+                owed_calls_--;
+            }
+        });
+        if (p.frames == 0) owed_calls_++;
+        p.bytes += static_cast<uint32_t>(bytes);
+        p.frames++;
+        if (p.bytes >= CREDIT_GRANT_BYTES) {
+            out[n++] = Grant{call_id, p.bytes, p.frames};
+            p = Pending();
+            owed_calls_--;
+        }
+        return n;
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return owed_calls_ == 0;
+    }
+
+    // Moves up to FLUSH_BATCH pending grants into out, clearing them.
+    // Returns how many; call until it returns 0 to flush everything.
+    int take(Grant out[FLUSH_BATCH]) {
+        int n = 0;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (owed_calls_ == 0) return 0;
+        pending_.for_each([&](uint32_t id, Pending& p) {
+            if (n == FLUSH_BATCH || p.frames == 0) return;
+            out[n++] = Grant{id, p.bytes, p.frames};
+            p = Pending();
+            owed_calls_--;
+        });
+        return n;
+    }
+
+    void forget(uint32_t call_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Pending* p = pending_.find(call_id);
+        if (!p) return;
+        if (p->frames) owed_calls_--;
+        pending_.erase(call_id);
+    }
+
+private:
+    struct Pending {
+        uint32_t bytes = 0;
+        uint32_t frames = 0;
+    };
+
+    mutable std::mutex mutex_;
+    CallTable<Pending> pending_;
+    size_t owed_calls_ = 0;   // entries with frames > 0
+};
+
+}
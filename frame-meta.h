@@ -0,0 +1,207 @@
+// frame-meta.h — typed, versioned header extension for interconnect frames.
+//
+// A bare data frame only says [call_id][payload_size], so every consumer
+// used to infer what it got from the size or from where it sits in the
+// pipeline. Links that negotiate it (IC_HDR_OFFER at connect time, see
+// InterconnectNode) carry a FrameMeta block with every frame:
+//
+//   [version u8][length u8][type u8][flags u8]
+//   [sample_rate u32][seq u32][capture_us u64]            (big-endian)
+//
+// It sits between the payload and the optional PacketTrace extension and is
+// announced by META_FLAG in the header's payload_size field (TRACE_FLAG
+// announces the trace). `length` is the block size, so a receiver skips
+// fields appended by a later version; a receiver never sees a block newer
+// than the version it agreed to.
+//
+//   type         — PayloadType of the payload bytes.
+//   flags        — FRAME_FLAG_* bits; 0 from senders that predate them.
+//   sample_rate  — Hz for audio payloads, 0 otherwise.
+//   seq          — per-call frame counter stamped by the sending node for
+//                  each link, starting at 1. The receiving node feeds it to a
+//                  SeqTracker, which counts lost and reordered frames per hop.
+//   capture_us   — steady_clock µs at which the first sample (or byte) of the
+//                  payload entered the pipeline. Producers carry it over from
+//                  their input; left 0, the sending node stamps the send time.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "flow-control.h"
+
+namespace whispertalk {
+
+// Typed headers are negotiated unless WHISPERTALK_IC_TYPED_HDR=0 (or "false").
+inline bool ic_typed_hdr_default() {
+    static const bool enabled = []() {
+        const char* v = std::getenv("WHISPERTALK_IC_TYPED_HDR");
+        return !(v && (std::strcmp(v, "0") == 0 || std::strcmp(v, "false") == 0));
+    }();
+    return enabled;
+}
+
+enum class PayloadType : uint8_t {
+    UNSPECIFIED = 0,   // untyped link, or a producer that did not say
+    ULAW        = 1,   // G.711 μ-law bytes, 8 kHz
+    PCM_F32     = 2,   // float32 samples, native endianness
+    PCM_S16     = 3,   // int16 samples, native endianness
+    TEXT        = 4,   // UTF-8 text
+    TTS_AUDIO   = 5,   // tts-common.h: [rate i32][engine_out_us u64][float32 PCM]
+    RTP         = 6,   // RTP datagram (12-byte header + μ-law)
+    ULAW_UP16K  = 7,   // pcm-wire.h: μ-law span the receiver upsamples to 16 kHz float32
+    TEXT_PARTIAL = 8,  // UTF-8 text, the stable start of an utterance still being spoken (speech-partial.h)
+};
+
+// FrameMeta::flags. A receiver that predates a flag ignores it, so a sender
+// sets one only on links whose peer offered it in the handshake
+// (InterconnectNode::accept_frame_flags), in the accept mask's bits from
+// FRAME_FLAGS_ACCEPT_SHIFT up.
+constexpr uint8_t FRAME_FLAG_PARTIAL = 0x01;   // provisional chunk; a later one supersedes it (speech-partial.h)
+constexpr unsigned FRAME_FLAGS_ACCEPT_SHIFT = 24;
+
+inline const char* payload_type_name(PayloadType t) {
+    switch (t) {
+        case PayloadType::ULAW:      return "ulaw";
+        case PayloadType::PCM_F32:   return "pcm_f32";
+        case PayloadType::PCM_S16:   return "pcm_s16";
+        case PayloadType::TEXT:      return "text";
+        case PayloadType::TTS_AUDIO: return "tts_audio";
+        case PayloadType::RTP:       return "rtp";
+        case PayloadType::ULAW_UP16K: return "ulaw_up16k";
+        case PayloadType::TEXT_PARTIAL: return "text_partial";
+        default:                     return "unspecified";
+    }
+}
+
+struct FrameMeta {
+    static constexpr uint8_t VERSION = 1;
+    static constexpr size_t WIRE_BYTES = 20;       // version 1 block
+    static constexpr size_t MAX_WIRE_BYTES = 64;   // largest block a receiver accepts
+
+    PayloadType type = PayloadType::UNSPECIFIED;
+    uint8_t flags = 0;
+    uint32_t sample_rate = 0;
+    uint32_t seq = 0;           // 0: not stamped (untyped link)
+    uint64_t capture_us = 0;
+
+    FrameMeta() = default;
+    FrameMeta(PayloadType t, uint32_t rate = 0, uint64_t capture = 0)
+        : type(t), sample_rate(rate), capture_us(capture) {}
+
+    // Writes WIRE_BYTES.
+    void write_wire(uint8_t* out) const {
+        out[0] = VERSION;
+        out[1] = static_cast<uint8_t>(WIRE_BYTES);
+        out[2] = static_cast<uint8_t>(type);
+        out[3] = flags;
+        put32(out + 4, sample_rate);
+        put32(out + 8, seq);
+        put32(out + 12, static_cast<uint32_t>(capture_us >> 32));
+        put32(out + 16, static_cast<uint32_t>(capture_us));
+    }
+
+    // Parses the block at the front of `in` (avail bytes). Returns the
+    // block's length, or 0 if it is malformed.
+    size_t read_wire(const uint8_t* in, size_t avail) {
+        if (avail < 2) return 0;
+        size_t len = in[1];
+        if (in[0] == 0 || len < WIRE_BYTES || len > MAX_WIRE_BYTES || len > avail) return 0;
+        type = static_cast<PayloadType>(in[2]);
+        flags = in[3];
+        sample_rate = get32(in + 4);
+        seq = get32(in + 8);
+        capture_us = (static_cast<uint64_t>(get32(in + 12)) << 32) | get32(in + 16);
+        return len;
+    }
+
+private:
+    static void put32(uint8_t* p, uint32_t v) {
+        p[0] = static_cast<uint8_t>(v >> 24);
+        p[1] = static_cast<uint8_t>(v >> 16);
+        p[2] = static_cast<uint8_t>(v >> 8);
+        p[3] = static_cast<uint8_t>(v);
+    }
+    static uint32_t get32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+};
+
+// Dispatch on the payload type: what the typed header says, or — on an
+// untyped link — the caller's legacy size/context guess.
+inline bool payload_is(const FrameMeta& meta, PayloadType type, bool legacy_guess) {
+    return meta.type == PayloadType::UNSPECIFIED ? legacy_guess : meta.type == type;
+}
+
+// Sender side: next seq per call on one link. Not thread-safe; the link's
+// data send mutex serialises it.
+class SeqStamper {
+public:
+    uint32_t next(uint32_t call_id) {
+        uint32_t& n = next_.claim(call_id, [](uint32_t, uint32_t) {});
+        if (n == 0) n = 1;
+        return n++;
+    }
+    void forget(uint32_t call_id) { next_.erase(call_id); }
+    void reset() { next_.clear(); }
+
+private:
+    CallTable<uint32_t> next_;
+};
+
+// Receiver side: loss and reordering per call, summed over all upstream
+// links. A frame with seq 1 (re)starts a call's sequence — the sender
+// reconnected, or the call failed over to another replica — and is neither
+// a gap nor a reorder. A gap counts its missing frames as lost; a late frame
+// is counted as reordered and taken back off the loss count (a duplicate is
+// indistinguishable from it here).
+class SeqTracker {
+public:
+    struct Stats {
+        uint64_t frames = 0;      // typed frames seen
+        uint64_t lost = 0;        // frames missing from a call's sequence
+        uint64_t reordered = 0;   // frames older than one already received (incl. duplicates)
+        uint64_t restarts = 0;    // sequences restarted at 1 mid-call
+    };
+
+    void observe(uint32_t call_id, uint32_t seq) {
+        if (seq == 0) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.frames++;
+        uint32_t& last = highest_.claim(call_id, [](uint32_t, uint32_t) {});
+        if (seq == 1) {
+            if (last != 0) stats_.restarts++;
+            last = 1;
+        } else if (last == 0 || seq == last + 1) {
+            last = seq;
+        } else if (seq > last) {
+            stats_.lost += seq - last - 1;
+            last = seq;
+        } else {
+            stats_.reordered++;
+            if (stats_.lost) stats_.lost--;
+        }
+    }
+
+    void forget(uint32_t call_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        highest_.erase(call_id);
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    CallTable<uint32_t> highest_;
+    Stats stats_;
+};
+
+}
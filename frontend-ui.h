@@ -1054,6 +1054,23 @@ Save outgoing audio as WAV</label>
 </div>
 </div>
 
+<div class="wt-card">
+<div class="wt-card-header" style="cursor:pointer" role="button" tabindex="0" aria-expanded="false" onclick="toggleCollapsible(this)" onkeydown="if(event.key==='Enter'||event.key===' ')toggleCollapsible(this)"><span class="wt-card-title">Pipeline Hop Latency</span><span style="margin-left:auto;font-size:12px;color:var(--wt-text-secondary)">&#x25B6;</span></div>
+<div class="wt-collapsible">
+<div style="padding:0 20px 16px">
+<p style="font-size:12px;color:var(--wt-text-secondary);margin-bottom:10px">
+  Mouth-to-ear latency (caller RTP in &rarr; reply audio out at the SIP client) and its per-stage breakdown,
+  from the hop histograms every service keeps for traced interconnect packets.
+</p>
+<div style="display:flex;gap:8px;margin-bottom:8px">
+<button class="wt-btn wt-btn-primary" onclick="loadPipelineLatency()">&#x21BB; Refresh</button>
+</div>
+<div id="pipelineLatencyStatus" style="font-size:12px;margin-bottom:8px"></div>
+<div id="pipelineLatencyResults"></div>
+</div>
+</div>
+</div>
+
 <div class="wt-card">
 <div class="wt-card-header" style="cursor:pointer" role="button" tabindex="0" aria-expanded="false" onclick="toggleCollapsible(this)" onkeydown="if(event.key==='Enter'||event.key===' ')toggleCollapsible(this)"><span class="wt-card-title">Test 5: Multi-Line Command Stress Test</span><span id="prereq-multiline" style="margin-left:8px;font-size:10px;padding:2px 6px;border-radius:4px;background:var(--wt-text-secondary);color:#fff">...</span><span style="margin-left:auto;font-size:12px;color:var(--wt-text-secondary)">&#x25B6;</span></div>
 <div class="wt-collapsible">
@@ -65,8 +65,10 @@
 //     GET  /api/status                      — system uptime, service health summary
 //
 // Log processing flow:
-//   1. UDP recv on port 22022: run_log_server() reads 4096-byte datagrams.
-//   2. process_log_message() parses "<SERVICE> <LEVEL> <CALL_ID> <message>".
+//   1. UDP recv on port 22022: log_receiver_loop() reads datagrams of up to
+//      64 KiB and splits batch datagrams (log-ring.h) into entries.
+//   2. process_log_message() parses "<SERVICE> <LEVEL> <CALL_ID> <message>",
+//      stamped with the time the service logged it (batches) or received.
 //      Malformed datagrams are silently dropped (no crash).
 //   3. LogEntry is enqueued to the async SQLite writer thread (enqueue_log()).
 //   4. Writer thread batch-INSERTs into the `logs` table at high throughput.
@@ -132,7 +134,7 @@
 // Units are indicated by the suffix: _MS (milliseconds), _S (seconds),
 // _US (microseconds), _DAYS (days). Buffer/count limits have no time suffix.
 static constexpr int LOG_FLUSH_INTERVAL_MS = 500;       // batch-INSERT cadence for log writer
-static constexpr int UDP_BUFFER_SIZE = 4096;             // max datagram size for log receiver
+static constexpr int UDP_BUFFER_SIZE = 65536;            // max datagram size for log receiver (batches)
 static constexpr int DB_QUERY_ROW_LIMIT = 10000;         // max rows returned by /api/db/query
 static constexpr int MG_POLL_TIMEOUT_MS = 100;           // mongoose event-loop poll timeout
 static constexpr int LOG_RETENTION_DAYS = 30;             // log rotation: delete entries older than this
@@ -1216,7 +1218,7 @@ private:
 
     void log_receiver_loop();
 
-    void process_log_message(const std::string& msg);
+    void process_log_message(const std::string& msg, uint64_t wall_us = 0);
 
     std::mutex log_queue_mutex_;
     std::vector<LogEntry> log_queue_;
@@ -1510,6 +1512,10 @@ private:
                 handle_tts_roundtrip(c, hm);
             } else if (mg_strcmp(hm->uri, mg_str("/api/pipeline/health")) == 0) {
                 handle_pipeline_health(c, hm);
+            } else if (mg_strcmp(hm->uri, mg_str("/api/pipeline/latency")) == 0) {
+                handle_pipeline_latency(c, hm);
+            } else if (mg_strcmp(hm->uri, mg_str("/api/metrics")) == 0) {
+                handle_metrics(c, hm);
             } else if (mg_strcmp(hm->uri, mg_str("/api/full_loop_test")) == 0) {
                 handle_full_loop_test(c, hm);
             } else if (mg_strcmp(hm->uri, mg_str("/api/multiline_stress")) == 0) {
@@ -3358,7 +3364,7 @@ private:
     //   2. Encode each sample to G.711 mu-law (simulating RTP payload encoding)
     //   3. Decode mu-law to float32 (using ITU-T G.711 compliant lookup)
     //   4. Upsample 8kHz to 16kHz via shared 15-tap FIR half-band filter
-    //      (whispertalk::iap_fir_upsample_frame from interconnect.h — same
+    //      (whispertalk::iap_fir_upsample_frame from audio-dsp.h — same
     //       code path used by the real IAP service)
     //   5. Build a reference 16kHz signal by FIR-upsampling the original 8kHz
     //   6. Compare codec output vs reference to measure distortion
@@ -5014,6 +5020,169 @@ private:
         mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s", json.str().c_str());
     }
 
+    // GET /api/pipeline/latency — Collect the per-hop latency histograms every
+    // pipeline service keeps for traced packets (HOP_LATENCY on its cmd port).
+    // Each pair is reported by the service that received the packet, so the
+    // union over all services is the stage breakdown. mouth_to_ear is the SIP
+    // client's SIP.IN>SIP.ARR pair: caller RTP in → reply audio frame back.
+    void handle_pipeline_latency(struct mg_connection *c, struct mg_http_message *hm) {
+        (void)hm;
+
+        const whispertalk::ServiceType types[] = {
+            whispertalk::ServiceType::SIP_CLIENT,
+            whispertalk::ServiceType::INBOUND_AUDIO_PROCESSOR,
+            whispertalk::ServiceType::MOSHI_SERVICE,
+            whispertalk::ServiceType::VAD_SERVICE,
+            whispertalk::ServiceType::WHISPER_SERVICE,
+            whispertalk::ServiceType::LLAMA_SERVICE,
+            whispertalk::ServiceType::TTS_SERVICE,
+            whispertalk::ServiceType::OUTBOUND_AUDIO_PROCESSOR,
+        };
+
+        std::stringstream json;
+        std::string mouth_to_ear = "null";
+        json << "{\"services\":[";
+        bool first_svc = true;
+        for (auto type : types) {
+            std::string err;
+            std::string resp = tcp_command(whispertalk::service_cmd_port(type), "HOP_LATENCY", err, 1);
+            if (!first_svc) json << ",";
+            first_svc = false;
+            json << "{\"name\":\"" << whispertalk::PacketTrace::service_type_name(static_cast<uint8_t>(type)) << "\"";
+            if (resp.rfind("HOP_LATENCY:", 0) != 0) {
+                json << ",\"reachable\":false,\"pairs\":[]}";
+                continue;
+            }
+            json << ",\"reachable\":true,\"pairs\":[";
+            bool first_pair = true;
+            uint64_t dropped = 0;
+            std::istringstream lines(resp);
+            std::string line;
+            while (std::getline(lines, line)) {
+                std::vector<std::string> f;
+                std::istringstream fields(line);
+                std::string tok;
+                while (std::getline(fields, tok, ':')) f.push_back(tok);
+                if (f.size() >= 6 && f[0] == "HOP_LATENCY") {
+                    dropped = strtoull(f[5].c_str(), nullptr, 10);
+                    continue;
+                }
+                if (f.size() < 14 || f[0] != "HOP") continue;
+                size_t gt = f[1].find('>');
+                if (gt == std::string::npos) continue;
+                std::string pair = "{\"from\":\"" + escape_json(f[1].substr(0, gt)) +
+                    "\",\"to\":\"" + escape_json(f[1].substr(gt + 1)) + "\"";
+                for (size_t i = 2; i + 1 < f.size(); i += 2) {
+                    std::string key = f[i];
+                    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+                    pair += ",\"" + escape_json(key) + "\":" + std::to_string(strtoull(f[i + 1].c_str(), nullptr, 10));
+                }
+                pair += "}";
+                if (type == whispertalk::ServiceType::SIP_CLIENT && f[1] == "SIP.IN>SIP.ARR") {
+                    mouth_to_ear = pair;
+                }
+                if (!first_pair) json << ",";
+                first_pair = false;
+                json << pair;
+            }
+            json << "],\"dropped_pairs\":" << dropped << "}";
+        }
+        json << "],\"mouth_to_ear\":" << mouth_to_ear << "}";
+        mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s", json.str().c_str());
+    }
+
+    // GET /api/metrics[?format=json] — Scrape every pipeline service's
+    // metrics registry (METRICS on its cmd port, see metrics.h) into one
+    // Prometheus text exposition. Series carry a service label; families that
+    // several services export are merged so each HELP/TYPE appears once.
+    // whispertalk_up says which services answered. With format=json the
+    // services' METRICS:JSON replies are returned side by side instead.
+    void handle_metrics(struct mg_connection *c, struct mg_http_message *hm) {
+        char fmt[16] = {0};
+        mg_http_get_var(&hm->query, "format", fmt, sizeof(fmt));
+        const bool as_json = strcmp(fmt, "json") == 0;
+
+        const whispertalk::ServiceType types[] = {
+            whispertalk::ServiceType::SIP_CLIENT,
+            whispertalk::ServiceType::INBOUND_AUDIO_PROCESSOR,
+            whispertalk::ServiceType::MOSHI_SERVICE,
+            whispertalk::ServiceType::VAD_SERVICE,
+            whispertalk::ServiceType::WHISPER_SERVICE,
+            whispertalk::ServiceType::LLAMA_SERVICE,
+            whispertalk::ServiceType::TTS_SERVICE,
+            whispertalk::ServiceType::OUTBOUND_AUDIO_PROCESSOR,
+        };
+
+        if (as_json) {
+            std::stringstream json;
+            json << "{\"services\":[";
+            bool first = true;
+            for (auto type : types) {
+                std::string err;
+                std::string resp = tcp_command(whispertalk::service_cmd_port(type), "METRICS:JSON", err, 1);
+                if (!first) json << ",";
+                first = false;
+                json << "{\"name\":\"" << whispertalk::PacketTrace::service_type_name(static_cast<uint8_t>(type)) << "\"";
+                if (resp.empty() || resp[0] != '{') {
+                    json << ",\"reachable\":false,\"metrics\":null}";
+                    continue;
+                }
+                json << ",\"reachable\":true,\"metrics\":" << resp << "}";
+            }
+            json << "]}";
+            mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s", json.str().c_str());
+            return;
+        }
+
+        struct Family {
+            std::string help;
+            std::string type;
+            std::string samples;
+        };
+        std::vector<std::string> order;
+        std::map<std::string, Family> families;
+        std::string up;
+        for (auto type : types) {
+            const char* name = whispertalk::PacketTrace::service_type_name(static_cast<uint8_t>(type));
+            std::string err;
+            std::string resp = tcp_command(whispertalk::service_cmd_port(type), "METRICS", err, 1);
+            const bool reachable = resp.rfind("# ", 0) == 0;
+            up += std::string("whispertalk_up{service=\"") + name + "\"} " + (reachable ? "1" : "0") + "\n";
+            if (!reachable) continue;
+            // Samples belong to the family of the last TYPE line.
+            Family* fam = nullptr;
+            std::istringstream lines(resp);
+            std::string line;
+            while (std::getline(lines, line)) {
+                if (line.rfind("# HELP ", 0) == 0 || line.rfind("# TYPE ", 0) == 0) {
+                    size_t sp = line.find(' ', 7);
+                    if (sp == std::string::npos) continue;
+                    std::string fname = line.substr(7, sp - 7);
+                    auto it = families.find(fname);
+                    if (it == families.end()) {
+                        order.push_back(fname);
+                        it = families.emplace(fname, Family()).first;
+                    }
+                    fam = &it->second;
+                    if (line[2] == 'H') { if (fam->help.empty()) fam->help = line; }
+                    else if (fam->type.empty()) fam->type = line;
+                } else if (fam && !line.empty() && line[0] != '#') {
+                    fam->samples += line + "\n";
+                }
+            }
+        }
+
+        std::string out;
+        for (const auto& fname : order) {
+            const Family& f = families[fname];
+            if (!f.help.empty()) out += f.help + "\n";
+            if (!f.type.empty()) out += f.type + "\n";
+            out += f.samples;
+        }
+        out += "# HELP whispertalk_up Service answered the metrics scrape\n# TYPE whispertalk_up gauge\n" + up;
+        mg_http_reply(c, 200, "Content-Type: text/plain; version=0.0.4\r\n", "%s", out.c_str());
+    }
+
     // POST /api/tests/tts_roundtrip — End-to-end TTS test: sends text through
     // LLaMA→Kokoro→OAP→SIP and measures audio output latency and quality.
     void handle_tts_roundtrip(struct mg_connection *c, struct mg_http_message *hm) {
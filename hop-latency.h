@@ -0,0 +1,175 @@
+// hop-latency.h — lock-free per-hop latency histograms for the interconnect.
+//
+// Every InterconnectNode that receives a Packet carrying a wire trace (see
+// PacketTrace in interconnect.h) folds the hop timestamps into a small table
+// of histograms, keyed by the (from hop, to hop) pair. A hop is identified by
+// service id and direction (IN = 0, OUT = 1, ARRIVAL = 2 — the latter is the
+// receiving node's own arrival time and never travels on the wire). Barge-in
+// signals use two more: SIGNAL = 3 is the time a speech signal was published,
+// ACTION = 4 the time a receiver finished acting on it.
+//
+// LatencyHistogram is log-linear in the HDR-histogram style: values below
+// 2^SUB_BITS µs get one bucket each, every power of two above that is split
+// into 2^SUB_BITS linear sub-buckets. With SUB_BITS = 4 the relative error is
+// ≤ 6.25% over the whole range (1 µs … ~1 h). Recording is a handful of
+// relaxed atomic increments; reading takes a racy but monotonic snapshot,
+// which is fine for monitoring.
+//
+// HopLatencyTable is a fixed-size open-addressing table of histograms. Slots
+// are claimed with a CAS on the key and never freed, so the hot path takes no
+// lock and never allocates. When the table is full further pairs are counted
+// in dropped_pairs() and otherwise ignored.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace whispertalk {
+
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int MAX_EXP = 42;   // values are clamped to < 2^MAX_EXP µs
+    static constexpr int NUM_BUCKETS = (MAX_EXP - SUB_BITS + 1) * SUB_COUNT;
+
+    void record(uint64_t value_us) {
+        buckets_[bucket_for(value_us)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value_us, std::memory_order_relaxed);
+        uint64_t prev = max_.load(std::memory_order_relaxed);
+        while (value_us > prev &&
+               !max_.compare_exchange_weak(prev, value_us, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t bucket_count(int i) const { return buckets_[i].load(std::memory_order_relaxed); }
+    double mean() const {
+        uint64_t n = count();
+        return n ? static_cast<double>(sum_.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+
+    // Upper bound of the bucket holding the q-quantile (0 < q ≤ 1), capped
+    // at the observed maximum. 0 if nothing has been recorded.
+    uint64_t percentile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total) + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > total) rank = total;
+        uint64_t seen = 0;
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t hi = bucket_upper(i);
+                uint64_t mx = max();
+                return hi < mx ? hi : mx;
+            }
+        }
+        return max();
+    }
+
+    // Zeroes the histogram. Records racing with it may be lost or half
+    // applied; only for series being retired (see metrics.h).
+    void reset() {
+        for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    static int bucket_for(uint64_t v) {
+        if (v < static_cast<uint64_t>(SUB_COUNT)) return static_cast<int>(v);
+        int exp = 63 - __builtin_clzll(v);
+        if (exp >= MAX_EXP) return NUM_BUCKETS - 1;
+        int sub = static_cast<int>((v >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+        return (exp - SUB_BITS + 1) * SUB_COUNT + sub;
+    }
+
+    // Largest value that maps to bucket i.
+    static uint64_t bucket_upper(int i) {
+        if (i < SUB_COUNT) return static_cast<uint64_t>(i);
+        int exp = i / SUB_COUNT + SUB_BITS - 1;
+        uint64_t sub = static_cast<uint64_t>(i % SUB_COUNT);
+        uint64_t step = 1ULL << (exp - SUB_BITS);
+        return (1ULL << exp) + (sub + 1) * step - 1;
+    }
+
+private:
+    std::atomic<uint32_t> buckets_[NUM_BUCKETS] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+class HopLatencyTable {
+public:
+    static constexpr int MAX_PAIRS = 32;
+
+    static constexpr uint8_t DIR_IN = 0;
+    static constexpr uint8_t DIR_OUT = 1;
+    static constexpr uint8_t DIR_ARRIVAL = 2;
+    static constexpr uint8_t DIR_SIGNAL = 3;
+    static constexpr uint8_t DIR_ACTION = 4;
+
+    static uint32_t make_key(uint8_t from_svc, uint8_t from_dir, uint8_t to_svc, uint8_t to_dir) {
+        return (static_cast<uint32_t>(from_svc) << 24) | (static_cast<uint32_t>(from_dir) << 16) |
+               (static_cast<uint32_t>(to_svc) << 8) | to_dir;
+    }
+    static uint8_t key_from_svc(uint32_t k) { return static_cast<uint8_t>(k >> 24); }
+    static uint8_t key_from_dir(uint32_t k) { return static_cast<uint8_t>(k >> 16); }
+    static uint8_t key_to_svc(uint32_t k) { return static_cast<uint8_t>(k >> 8); }
+    static uint8_t key_to_dir(uint32_t k) { return static_cast<uint8_t>(k); }
+
+    // Keys are non-zero because service ids start at 1.
+    void record(uint32_t key, uint64_t value_us) {
+        LatencyHistogram* h = find_or_claim(key);
+        if (h) h->record(value_us);
+        else dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Visit every populated pair in slot order: fn(key, histogram).
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (int i = 0; i < MAX_PAIRS; i++) {
+            uint32_t k = slots_[i].key.load(std::memory_order_acquire);
+            if (k != 0) fn(k, slots_[i].hist);
+        }
+    }
+
+    uint64_t dropped_pairs() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> key{0};
+        LatencyHistogram hist;
+    };
+
+    LatencyHistogram* find_or_claim(uint32_t key) {
+        uint32_t start = (key * 2654435761u) % MAX_PAIRS;
+        for (int n = 0; n < MAX_PAIRS; n++) {
+            Slot& s = slots_[(start + n) % MAX_PAIRS];
+            uint32_t k = s.key.load(std::memory_order_acquire);
+            if (k == key) return &s.hist;
+            if (k == 0) {
+                // The slot's histogram is zero-initialised and never reset, so
+                // the key can be published directly.
+                uint32_t expected = 0;
+                if (s.key.compare_exchange_strong(expected, key, std::memory_order_acq_rel)) {
+                    return &s.hist;
+                }
+                if (expected == key) return &s.hist;
+            }
+        }
+        return nullptr;
+    }
+
+    Slot slots_[MAX_PAIRS];
+    std::atomic<uint64_t> dropped_{0};
+};
+
+}
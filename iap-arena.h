@@ -0,0 +1,143 @@
+// iap-arena.h — IAP per-call state as a slot-indexed structure of arrays.
+//
+// IAP keeps, per call and per downstream target, the FIR history of the
+// upsampler it runs for that target plus a clipping counter. It used to keep
+// these in a std::map of calls holding a std::map of targets, looked up per
+// packet under the calls mutex. IapCallArena gives every call a slot instead:
+// the call_id → slot lookup is done once per call per receive batch, and the
+// state lives in flat arrays indexed by slot (one set per target), so the
+// batch loop in inbound-audio-processor.cpp walks contiguous memory whatever
+// the number of calls. Released slots are reused, so the arrays only grow to
+// the peak number of concurrent calls.
+//
+// Not thread-safe; IAP holds its calls mutex around every use. Pointers into
+// the arrays are invalidated when acquire() grows them, so take them after
+// all of a batch's slots are acquired.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "audio-dsp.h"
+
+namespace whispertalk {
+
+class IapCallArena {
+public:
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    explicit IapCallArena(size_t targets = 1) { set_targets(targets); }
+
+    // Per-target arrays for `targets` downstream targets. Existing calls keep
+    // their state for the first min(old, new) targets; new ones start zeroed.
+    void set_targets(size_t targets) {
+        targets_.resize(targets);
+        for (auto& t : targets_) {
+            t.hist16.resize(capacity_ * IAP_FIR_CENTER, 0.0f);
+            t.hist24.resize(capacity_ * IAP_FIR_24K_CENTER, 0.0f);
+            t.clips.resize(capacity_, 0);
+        }
+    }
+
+    size_t targets() const { return targets_.size(); }
+
+    // Slot of call_id, claiming a fresh (zeroed) one on first sight; *created
+    // says which. Stamps the call's last activity with now_ns.
+    uint32_t acquire(uint32_t call_id, int64_t now_ns, bool* created = nullptr) {
+        auto it = index_.find(call_id);
+        if (it != index_.end()) {
+            last_ns_[it->second] = now_ns;
+            if (created) *created = false;
+            return it->second;
+        }
+        uint32_t slot;
+        if (!free_.empty()) {
+            slot = free_.back();
+            free_.pop_back();
+        } else {
+            if (used_ == capacity_) grow();
+            slot = static_cast<uint32_t>(used_++);
+        }
+        clear_slot(slot);
+        call_id_[slot] = call_id;
+        last_ns_[slot] = now_ns;
+        live_[slot] = 1;
+        index_.emplace(call_id, slot);
+        if (created) *created = true;
+        return slot;
+    }
+
+    uint32_t find(uint32_t call_id) const {
+        auto it = index_.find(call_id);
+        return it == index_.end() ? NO_SLOT : it->second;
+    }
+
+    bool release(uint32_t call_id) {
+        auto it = index_.find(call_id);
+        if (it == index_.end()) return false;
+        live_[it->second] = 0;
+        free_.push_back(it->second);
+        index_.erase(it);
+        return true;
+    }
+
+    // Releases every call idle since before cutoff_ns; fn(call_id) runs for
+    // each first. Returns how many were released.
+    template <typename Fn>
+    size_t release_idle(int64_t cutoff_ns, Fn&& fn) {
+        size_t n = 0;
+        for (uint32_t slot = 0; slot < used_; slot++) {
+            if (!live_[slot] || last_ns_[slot] >= cutoff_ns) continue;
+            fn(call_id_[slot]);
+            release(call_id_[slot]);
+            n++;
+        }
+        return n;
+    }
+
+    size_t size() const { return index_.size(); }
+    // Slots handed out so far (live or free); every slot index is below this.
+    size_t slots() const { return used_; }
+
+    uint32_t call_id(uint32_t slot) const { return call_id_[slot]; }
+    float* hist16(size_t target, uint32_t slot) { return &targets_[target].hist16[slot * IAP_FIR_CENTER]; }
+    float* hist24(size_t target, uint32_t slot) { return &targets_[target].hist24[slot * IAP_FIR_24K_CENTER]; }
+    uint64_t& clips(size_t target, uint32_t slot) { return targets_[target].clips[slot]; }
+
+private:
+    struct TargetState {
+        std::vector<float> hist16;     // capacity_ × IAP_FIR_CENTER
+        std::vector<float> hist24;     // capacity_ × IAP_FIR_24K_CENTER
+        std::vector<uint64_t> clips;   // capacity_
+    };
+
+    void grow() {
+        capacity_ = capacity_ ? capacity_ * 2 : 16;
+        call_id_.resize(capacity_, 0);
+        last_ns_.resize(capacity_, 0);
+        live_.resize(capacity_, 0);
+        set_targets(targets_.size());
+    }
+
+    void clear_slot(uint32_t slot) {
+        for (auto& t : targets_) {
+            std::memset(&t.hist16[slot * IAP_FIR_CENTER], 0, IAP_FIR_CENTER * sizeof(float));
+            std::memset(&t.hist24[slot * IAP_FIR_24K_CENTER], 0, IAP_FIR_24K_CENTER * sizeof(float));
+            t.clips[slot] = 0;
+        }
+    }
+
+    size_t capacity_ = 0;
+    size_t used_ = 0;
+    std::vector<uint32_t> call_id_;
+    std::vector<int64_t> last_ns_;
+    std::vector<uint8_t> live_;
+    std::vector<TargetState> targets_;
+    std::vector<uint32_t> free_;
+    std::unordered_map<uint32_t, uint32_t> index_;
+};
+
+}
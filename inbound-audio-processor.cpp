@@ -3,31 +3,48 @@
 // Pipeline position: SIP_CLIENT → [IAP] → VAD (classic) or MOSHI_SERVICE (moshi-rag)
 //
 // Receives raw RTP packets (G.711 μ-law, 8kHz, 20ms frames = 160 bytes payload)
-// from the SIP_CLIENT via the interconnect data channel. For each packet:
+// from the SIP_CLIENT via the interconnect data channel, in batches of whatever
+// has queued up since the last read. For each batch:
 //   1. Strip RTP header (12 bytes).
-//   2. Decode μ-law bytes → float32 using a precomputed 256-entry LUT (ITU-T G.711).
-//      Each byte maps to a float in [-1.0, 1.0]. The LUT is built in init_g711_tables()
-//      using the standard segment/quantization decode formula.
+//   2. Decode every frame's μ-law bytes → float32 using a precomputed 256-entry LUT (ITU-T G.711).
+//      Each byte maps to a float in [-1.0, 1.0]. The LUT is ulaw_float_table()
+//      (audio-dsp.h), shared with the receivers of the compact encodings;
+//      ulaw_decode() and the upsamplers run SIMD kernels picked at startup.
 //   3. For each registered downstream: upsample to the negotiated sample rate.
 //      Classic mode: 8kHz→16kHz (320 samples, 20ms) via 15-tap half-band FIR → VAD.
 //      Moshi-rag mode: 8kHz→24kHz (480 samples, 20ms) via 3-phase polyphase FIR
-//      → MOSHI_SERVICE only (no VAD/Whisper path). FIR state (fir_history) is per-call
+//      → MOSHI_SERVICE only (no VAD/Whisper path). FIR state is per-call
 //      and per-downstream to avoid
 //      contamination between concurrent calls or between different upsamplers.
-//   4. Forward PCM to each downstream via send_to_downstream(pkt, target).
+//      Steps 2 and 3 run over the whole batch, target by target, before
+//      anything is sent.
+//      A downstream that accepts μ-law frames (VAD, see pcm-wire.h) gets the RTP
+//      payload itself and runs the same upsampler on its side, bit for bit.
+//   4. Forward PCM to each downstream via send_to_downstream(pkt, target),
+//      outside the calls mutex.
+//      Frames from SIP are read in bursts (recv_batch_from_upstream), one recv()
+//      for all the frames waiting instead of a poll + two reads per frame.
+//      RTP frames are received as pooled packets and the FIR writes straight into
+//      the outgoing pooled packet's payload, so the steady-state path is allocation-free.
 //
-// Per-call state (CallState): maintains per-downstream FIR history buffers and output
-// PCM arrays across RTP packets so filters are continuous across frame boundaries.
+// Per-call state (IapCallArena, iap-arena.h): a slot per call in flat per-target
+// arrays of FIR history, so filters are continuous across frame boundaries and
+// the per-frame cost stays flat as calls scale. Slots are looked up once per
+// frame per batch under one lock and reused after the call ends.
 // Inactive calls are cleaned up after 60 seconds with no packets.
 // CALL_END from upstream triggers immediate cleanup.
 //
 // Resilience: If a downstream is disconnected, IAP discards audio for that target only.
 //   A per-target throttled warning is logged once every DISC_WARN_INTERVAL_S (5s).
+// Back-pressure: a frame whose call has a full credit window towards the target
+//   (the consumer is a window's worth of audio behind, see flow-control.h) is
+//   shed instead of queued behind the stale audio, and counted in the FLOW report.
 //
-// Performance logging: Every 500 packets, logs avg/max per-packet processing latency
-// (μs) at DEBUG level so bottlenecks can be identified without constant log spam.
+// Performance logging: Every 500 packets, logs avg/p99/max per-packet processing latency
+// (μs, amortised over its batch) at DEBUG level so bottlenecks can be identified without constant log spam.
 //
-// CMD port (IAP base+2 = 13112): accepts PING, STATUS, SET_LOG_LEVEL commands.
+// CMD port (IAP base+2 = 13112): accepts PING, STATUS, SET_LOG_LEVEL, HOP_LATENCY, FLOW, METRICS,
+//   METRICS:JSON commands.
 //   STATUS returns active call count, upstream/downstream state, avg/max latency.
 #include <iostream>
 #include <vector>
@@ -37,10 +54,13 @@
 #include <map>
 #include <atomic>
 #include <chrono>
+#include <algorithm>
 #include <cstring>
 #include <signal.h>
 #include <getopt.h>
 #include "interconnect.h"
+#include "pcm-wire.h"
+#include "iap-arena.h"
 
 static std::atomic<bool> g_running{true};
 static void sig_handler(int) { g_running = false; }
@@ -49,31 +69,17 @@ static constexpr size_t RTP_HEADER_SIZE = 12;
 static constexpr int CALL_INACTIVITY_TIMEOUT_S = 60;
 static constexpr int LOG_INTERVAL_PKTS = 500;
 static constexpr int UPSTREAM_RECV_TIMEOUT_MS = 100;
+static constexpr size_t RECV_BATCH_MAX = 256;
 static constexpr int CMD_POLL_TIMEOUT_MS = 200;
 static constexpr int CMD_LISTEN_BACKLOG = 4;
 static constexpr int CMD_RECV_TIMEOUT_S = 10;
 static constexpr size_t CMD_BUF_SIZE = 4096;
 
-struct PerDownstreamCallState {
-    float fir_history_16k[whispertalk::IAP_FIR_CENTER] = {};
-    float fir_history_24k[whispertalk::IAP_FIR_24K_CENTER] = {};
-    float pcm_16k[whispertalk::IAP_ULAW_FRAME * 2];
-    float pcm_24k[whispertalk::IAP_ULAW_OUT_24K];
-    uint64_t clip_count = 0;
-};
-
-struct CallState {
-    std::chrono::steady_clock::time_point last_activity;
-    float decoded[whispertalk::IAP_ULAW_FRAME];
-    std::map<whispertalk::ServiceType, PerDownstreamCallState> downstream_state;
-};
-
 static constexpr int DISC_WARN_INTERVAL_S = 5;
 
 class InboundAudioProcessor {
 public:
     InboundAudioProcessor() : running_(true), interconnect_(whispertalk::ServiceType::INBOUND_AUDIO_PROCESSOR) {
-        init_g711_tables();
     }
 
     void set_moshi_rag_mode(bool m) {
@@ -170,6 +176,10 @@ private:
 
     std::string handle_iap_command(const std::string& cmd) {
         if (cmd == "PING") return "PONG\n";
+        if (cmd == "HOP_LATENCY") return interconnect_.hop_latency_report();
+        if (cmd == "FLOW") return interconnect_.flow_report();
+        if (cmd == "METRICS") return interconnect_.metrics_report();
+        if (cmd == "METRICS:JSON") return interconnect_.metrics_report(true);
         if (cmd.rfind("SET_LOG_LEVEL:", 0) == 0) {
             std::string level = cmd.substr(14);
             log_fwd_.set_level(level.c_str());
@@ -181,12 +191,12 @@ private:
             char buf[512];
             snprintf(buf, sizeof(buf),
                 "ACTIVE_CALLS:%zu:MODE:%s:UPSTREAM:%s:PKT_LATENCY_AVG_US:%.1f:PKT_LATENCY_MAX_US:%.1f:PKT_COUNT:%llu",
-                calls_.size(),
+                arena_.size(),
                 moshi_rag_mode_ ? "moshi-rag" : "classic",
                 interconnect_.upstream_state() == whispertalk::ConnectionState::CONNECTED ? "connected" : "disconnected",
-                pkt_count_.load() > 0 ? latency_sum_.load() / pkt_count_.load() : 0.0,
-                latency_max_.load(),
-                (unsigned long long)pkt_count_.load());
+                frame_us_.mean(),
+                static_cast<double>(frame_us_.max()),
+                (unsigned long long)frame_us_.count());
             result = buf;
             auto ds_states = interconnect_.downstream_connection_states();
             for (const auto& [target, state, rate] : ds_states) {
@@ -202,162 +212,244 @@ private:
         return "ERROR:Unknown command\n";
     }
 
-    void init_g711_tables() {
-        for (int i = 0; i < 256; ++i) {
-            int mu = ~i;
-            int sign = mu & 0x80;
-            int segment = (mu >> 4) & 0x07;
-            int quantization = mu & 0x0F;
-            int magnitude = ((quantization << 1) + 33) << (segment + 2);
-            magnitude -= 132;
-            ulaw_table[i] = (sign ? -magnitude : magnitude) / 32768.0f;
-        }
-    }
-
     void processing_loop() {
-        auto ds_targets = interconnect_.downstream_connection_states();
-
-        while (running_ && g_running) {
-            whispertalk::Packet pkt;
-            if (!interconnect_.recv_from_upstream(pkt, UPSTREAM_RECV_TIMEOUT_MS)) {
-                continue;
+        // One entry per replica; each frame goes once per target stage and
+        // the node routes it to the replica owning the call.
+        std::vector<whispertalk::ServiceType> ds_targets;
+        for (const auto& ds_entry : interconnect_.downstream_connection_states()) {
+            auto target = std::get<0>(ds_entry);
+            if (std::find(ds_targets.begin(), ds_targets.end(), target) == ds_targets.end()) {
+                ds_targets.push_back(target);
             }
+        }
 
-            if (!pkt.is_valid() || pkt.payload_size < RTP_HEADER_SIZE) {
+        // SIP forwards every call's RTP as it arrives; whatever has queued up
+        // since the last read is taken in one go.
+        std::vector<whispertalk::PooledPacket> frames;
+        frames.reserve(RECV_BATCH_MAX);
+        while (running_ && g_running) {
+            frames.clear();
+            if (!interconnect_.recv_batch_from_upstream(frames, RECV_BATCH_MAX, UPSTREAM_RECV_TIMEOUT_MS)) {
                 continue;
             }
+            process_batch(frames, ds_targets);
+        }
+    }
 
-            auto t0 = std::chrono::steady_clock::now();
-            pkt.trace.record(whispertalk::ServiceType::INBOUND_AUDIO_PROCESSOR, 0);
-            auto state = get_or_create_call(pkt.call_id, t0);
+    struct BatchFrame {
+        const whispertalk::PooledPacket* pkt;
+        uint32_t slot;
+        size_t len;        // μ-law bytes, at most IAP_ULAW_FRAME
+    };
 
-            size_t payload_len = pkt.payload_size - RTP_HEADER_SIZE;
-            if (payload_len > whispertalk::IAP_ULAW_FRAME) payload_len = whispertalk::IAP_ULAW_FRAME;
-            const uint8_t* rtp_payload = pkt.payload.data() + RTP_HEADER_SIZE;
+    struct Outgoing {
+        whispertalk::PooledPacket pkt;
+        whispertalk::ServiceType target;
+        const whispertalk::PooledPacket* src;
+    };
 
-            for (size_t i = 0; i < payload_len; ++i) {
-                state->decoded[i] = ulaw_table[rtp_payload[i]];
+    // One receive batch: every frame's call slot is resolved, then all frames
+    // are decoded and upsampled for each target in one pass over the arena,
+    // under calls_mutex_ once. The packets are sent afterwards without the
+    // lock, since a send may block on a closed window.
+    void process_batch(std::vector<whispertalk::PooledPacket>& frames,
+                       const std::vector<whispertalk::ServiceType>& ds_targets) {
+        auto t0 = std::chrono::steady_clock::now();
+        const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t0.time_since_epoch()).count();
+        const whispertalk::DspKernels& dsp = whispertalk::dsp_kernels();
+        batch_.clear();
+        outgoing_.clear();
+        {
+            std::lock_guard<std::mutex> lock(calls_mutex_);
+            if (arena_.targets() != ds_targets.size()) arena_.set_targets(ds_targets.size());
+            for (auto& pkt : frames) {
+                if (!pkt.is_valid() || pkt.payload_size < RTP_HEADER_SIZE ||
+                    !whispertalk::payload_is(pkt.meta, whispertalk::PayloadType::RTP, true)) {
+                    continue;
+                }
+                pkt.trace.record(whispertalk::ServiceType::INBOUND_AUDIO_PROCESSOR, 0);
+                bool created = false;
+                uint32_t slot = arena_.acquire(pkt.call_id, now_ns, &created);
+                if (created) on_call_created(pkt.call_id, slot);
+                size_t len = std::min<size_t>(pkt.payload_size - RTP_HEADER_SIZE, whispertalk::IAP_ULAW_FRAME);
+                call_frames_[slot]->inc();
+                call_bytes_[slot]->inc(len);
+                batch_.push_back({&pkt, slot, len});
             }
+            if (batch_.empty()) return;
 
-            float dec_peak = 0;
-            for (size_t i = 0; i < payload_len; ++i) {
-                float a = std::abs(state->decoded[i]);
-                if (a > dec_peak) dec_peak = a;
+            decoded_.resize(batch_.size() * whispertalk::IAP_ULAW_FRAME);
+            for (size_t i = 0; i < batch_.size(); i++) {
+                dsp.ulaw_decode(batch_[i].pkt->payload() + RTP_HEADER_SIZE, batch_[i].len,
+                                &decoded_[i * whispertalk::IAP_ULAW_FRAME]);
             }
 
-            for (const auto& ds_entry : ds_targets) {
-                auto target = std::get<0>(ds_entry);
-                uint32_t rate = interconnect_.negotiated_sample_rate_for(target);
-                auto& ds = state->downstream_state[target];
-
-                size_t out_len;
-                float* out_buf;
-                if (rate == 24000) {
-                    out_len = whispertalk::iap_fir_upsample_frame_24k(state->decoded, payload_len, ds.pcm_24k, ds.fir_history_24k);
-                    out_buf = ds.pcm_24k;
-                } else {
-                    out_len = whispertalk::iap_fir_upsample_frame(state->decoded, payload_len, ds.pcm_16k, ds.fir_history_16k);
-                    out_buf = ds.pcm_16k;
-                }
-
-                float up_peak = 0;
-                for (size_t i = 0; i < out_len; ++i) {
-                    float a = std::abs(out_buf[i]);
-                    if (a > up_peak) up_peak = a;
-                }
-
-                if (up_peak > 1.0f) {
-                    ds.clip_count++;
-                    if ((ds.clip_count % LOG_INTERVAL_PKTS) == 1) {
-                        log_fwd_.forward(whispertalk::LogLevel::WARN, pkt.call_id,
-                            "Upsampler clipping (#%llu, %s): decoded_peak=%.4f upsample_peak=%.4f gain=%.2fx",
-                            (unsigned long long)ds.clip_count,
-                            whispertalk::service_type_to_string(target),
-                            dec_peak, up_peak, dec_peak > 0 ? up_peak / dec_peak : 0.0f);
+            for (size_t t = 0; t < ds_targets.size(); t++) {
+                const auto target = ds_targets[t];
+                const uint32_t rate = interconnect_.negotiated_sample_rate_for(target);
+                // A receiver that upsamples itself gets the μ-law bytes (1/8 of
+                // the float frame); the float path stays for everyone else.
+                const bool ulaw_out = rate != 24000 &&
+                    interconnect_.downstream_accepts(whispertalk::PayloadType::ULAW, target);
+                for (size_t i = 0; i < batch_.size(); i++) {
+                    const BatchFrame& f = batch_[i];
+                    const uint32_t call_id = f.pkt->call_id;
+                    const float* decoded = &decoded_[i * whispertalk::IAP_ULAW_FRAME];
+                    auto out_pkt = interconnect_.make_packet(call_id,
+                        ulaw_out ? f.len : whispertalk::IAP_ULAW_OUT_24K * sizeof(float));
+                    if (ulaw_out) {
+                        memcpy(out_pkt.payload(), f.pkt->payload() + RTP_HEADER_SIZE, f.len);
+                        out_pkt.meta = whispertalk::FrameMeta(whispertalk::PayloadType::ULAW, 8000,
+                                                              f.pkt->meta.capture_us);
+                    } else {
+                        float* out_buf = reinterpret_cast<float*>(out_pkt.payload());
+                        size_t out_len;
+                        if (rate == 24000) {
+                            out_len = whispertalk::iap_fir_upsample_frame_24k(decoded, f.len, out_buf,
+                                                                              arena_.hist24(t, f.slot), dsp);
+                        } else {
+                            out_len = whispertalk::iap_fir_upsample_frame(decoded, f.len, out_buf,
+                                                                          arena_.hist16(t, f.slot), dsp);
+                        }
+                        out_pkt.resize(static_cast<uint32_t>(out_len * sizeof(float)));
+                        out_pkt.meta = whispertalk::FrameMeta(whispertalk::PayloadType::PCM_F32,
+                                                              rate == 24000 ? 24000u : 16000u,
+                                                              f.pkt->meta.capture_us);
+
+                        float up_peak = 0;
+                        for (size_t j = 0; j < out_len; ++j) {
+                            float a = std::abs(out_buf[j]);
+                            if (a > up_peak) up_peak = a;
+                        }
+                        if (up_peak > 1.0f) {
+                            uint64_t& clips = arena_.clips(t, f.slot);
+                            clips++;
+                            if ((clips % LOG_INTERVAL_PKTS) == 1) {
+                                float dec_peak = 0;
+                                for (size_t j = 0; j < f.len; ++j) {
+                                    float a = std::abs(decoded[j]);
+                                    if (a > dec_peak) dec_peak = a;
+                                }
+                                log_fwd_.forward(whispertalk::LogLevel::WARN, call_id,
+                                    "Upsampler clipping (#%llu, %s): decoded_peak=%.4f upsample_peak=%.4f gain=%.2fx",
+                                    (unsigned long long)clips,
+                                    whispertalk::service_type_to_string(target),
+                                    dec_peak, up_peak, dec_peak > 0 ? up_peak / dec_peak : 0.0f);
+                            }
+                        }
                     }
+                    outgoing_.push_back({std::move(out_pkt), target, f.pkt});
                 }
+            }
+        }
 
-                whispertalk::Packet out_pkt(pkt.call_id, out_buf, out_len * sizeof(float));
-                out_pkt.trace = pkt.trace;
-                out_pkt.trace.record(whispertalk::ServiceType::INBOUND_AUDIO_PROCESSOR, 1);
-                if (!interconnect_.send_to_downstream(out_pkt, target)) {
-                    auto now = std::chrono::steady_clock::now();
-                    auto& last_warn = last_disc_warn_per_target_[target];
-                    if (std::chrono::duration_cast<std::chrono::seconds>(now - last_warn).count() >= DISC_WARN_INTERVAL_S) {
-                        log_fwd_.forward(whispertalk::LogLevel::WARN, pkt.call_id,
-                            "Downstream %s disconnected, discarding audio",
-                            whispertalk::service_type_to_string(target));
-                        last_warn = now;
-                    }
+        for (auto& o : outgoing_) {
+            const uint32_t call_id = o.pkt.call_id;
+            if (!interconnect_.downstream_window_open(call_id, o.target)) {
+                interconnect_.note_shed(call_id, 8 + o.pkt.payload_size, o.target);
+                auto now = std::chrono::steady_clock::now();
+                auto& last_warn = last_shed_warn_per_target_[o.target];
+                if (std::chrono::duration_cast<std::chrono::seconds>(now - last_warn).count() >= DISC_WARN_INTERVAL_S) {
+                    log_fwd_.forward(whispertalk::LogLevel::WARN, call_id,
+                        "Downstream %s is a full window behind, shedding audio",
+                        whispertalk::service_type_to_string(o.target));
+                    last_warn = now;
                 }
+                continue;
             }
 
-            auto t1 = std::chrono::steady_clock::now();
-            double pkt_us = std::chrono::duration<double, std::micro>(t1 - t0).count();
-            double old_sum = latency_sum_.load(std::memory_order_relaxed);
-            while (!latency_sum_.compare_exchange_weak(old_sum, old_sum + pkt_us, std::memory_order_relaxed)) {}
-            double cur_max = latency_max_.load(std::memory_order_relaxed);
-            while (pkt_us > cur_max && !latency_max_.compare_exchange_weak(cur_max, pkt_us, std::memory_order_relaxed)) {}
-            uint64_t count = pkt_count_.fetch_add(1, std::memory_order_relaxed) + 1;
-
-            if ((count % LOG_INTERVAL_PKTS) == 0) {
-                double avg_us = latency_sum_.load(std::memory_order_relaxed) / count;
-                char msg[128];
-                snprintf(msg, sizeof(msg), "Per-packet latency: avg=%.1fus max=%.1fus (%llu pkts)",
-                         avg_us, latency_max_.load(std::memory_order_relaxed), (unsigned long long)count);
-                log_fwd_.forward(whispertalk::LogLevel::DEBUG, pkt.call_id, msg);
+            o.pkt.trace = o.src->trace;
+            o.pkt.trace.record(whispertalk::ServiceType::INBOUND_AUDIO_PROCESSOR, 1);
+            if (!interconnect_.send_to_downstream(std::move(o.pkt), o.target)) {
+                auto now = std::chrono::steady_clock::now();
+                auto& last_warn = last_disc_warn_per_target_[o.target];
+                if (std::chrono::duration_cast<std::chrono::seconds>(now - last_warn).count() >= DISC_WARN_INTERVAL_S) {
+                    log_fwd_.forward(whispertalk::LogLevel::WARN, call_id,
+                        "Downstream %s disconnected, discarding audio",
+                        whispertalk::service_type_to_string(o.target));
+                    last_warn = now;
+                }
             }
         }
+
+        // Per-frame cost, amortised over the batch.
+        auto t1 = std::chrono::steady_clock::now();
+        const uint64_t frame_us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count()) / batch_.size();
+        const uint64_t before = frame_us_.count();
+        for (size_t i = 0; i < batch_.size(); i++) frame_us_.record(frame_us);
+        const uint64_t count = before + batch_.size();
+
+        if (count / LOG_INTERVAL_PKTS != before / LOG_INTERVAL_PKTS) {
+            log_fwd_.forward(whispertalk::LogLevel::DEBUG, 0,
+                             "Per-packet latency: avg=%.1fus p99=%lluus max=%lluus (%llu pkts, batch %zu)",
+                             frame_us_.mean(), (unsigned long long)frame_us_.percentile(0.99),
+                             (unsigned long long)frame_us_.max(), (unsigned long long)count, batch_.size());
+        }
     }
 
-    std::shared_ptr<CallState> get_or_create_call(uint32_t cid, std::chrono::steady_clock::time_point now) {
-        std::lock_guard<std::mutex> lock(calls_mutex_);
-        auto it = calls_.find(cid);
-        if (it != calls_.end()) {
-            it->second->last_activity = now;
-            return it->second;
+    // Called with calls_mutex_ held when a call's first frame arrives.
+    void on_call_created(uint32_t cid, uint32_t slot) {
+        if (call_frames_.size() < arena_.slots()) {
+            call_frames_.resize(arena_.slots());
+            call_bytes_.resize(arena_.slots());
         }
-        auto state = std::make_shared<CallState>();
-        state->last_activity = now;
-        calls_[cid] = state;
+        whispertalk::MetricLabels labels{{"call", std::to_string(cid)}};
+        call_frames_[slot] = &whispertalk::metrics().counter("whispertalk_iap_call_frames_total",
+                                                             "RTP frames received per call", labels);
+        call_bytes_[slot] = &whispertalk::metrics().counter("whispertalk_iap_call_bytes_total",
+                                                            "μ-law payload bytes received per call", labels);
         std::cout << "Created call state for call_id " << cid << std::endl;
         log_fwd_.forward(whispertalk::LogLevel::INFO, cid, "Created call state");
-        return state;
     }
 
     void handle_call_end(uint32_t call_id) {
         std::lock_guard<std::mutex> lock(calls_mutex_);
-        auto it = calls_.find(call_id);
-        if (it != calls_.end()) {
+        if (arena_.release(call_id)) {
             std::cout << "Call " << call_id << " ended, cleaning up" << std::endl;
             log_fwd_.forward(whispertalk::LogLevel::INFO, call_id, "Call ended, cleaning up");
-            calls_.erase(it);
+            retire_call_metrics(call_id);
         }
     }
 
+    // Called with calls_mutex_ held as the call's slot is released; its
+    // counters are reassigned when the slot is next claimed.
+    static void retire_call_metrics(uint32_t call_id) {
+        whispertalk::MetricLabels labels{{"call", std::to_string(call_id)}};
+        whispertalk::metrics().retire("whispertalk_iap_call_frames_total", labels);
+        whispertalk::metrics().retire("whispertalk_iap_call_bytes_total", labels);
+    }
+
     void cleanup_inactive_calls() {
         auto now = std::chrono::steady_clock::now();
+        const int64_t cutoff_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            (now - std::chrono::seconds(CALL_INACTIVITY_TIMEOUT_S)).time_since_epoch()).count();
         std::lock_guard<std::mutex> lock(calls_mutex_);
-        for (auto it = calls_.begin(); it != calls_.end(); ) {
-            if (std::chrono::duration_cast<std::chrono::seconds>(now - it->second->last_activity).count() > CALL_INACTIVITY_TIMEOUT_S) {
-                std::cout << "Cleaning up inactive call " << it->first << std::endl;
-                it = calls_.erase(it);
-            } else {
-                ++it;
-            }
-        }
+        arena_.release_idle(cutoff_ns, [](uint32_t call_id) {
+            std::cout << "Cleaning up inactive call " << call_id << std::endl;
+            retire_call_metrics(call_id);
+        });
     }
 
     std::atomic<bool> running_;
     std::atomic<int> cmd_sock_{-1};
     bool moshi_rag_mode_{false};
-    float ulaw_table[256];
     std::mutex calls_mutex_;
-    std::map<uint32_t, std::shared_ptr<CallState>> calls_;
-    std::atomic<uint64_t> pkt_count_{0};
-    std::atomic<double>   latency_sum_{0.0};
-    std::atomic<double>   latency_max_{0.0};
+    whispertalk::IapCallArena arena_;
+    std::vector<whispertalk::Counter*> call_frames_;   // by arena slot
+    std::vector<whispertalk::Counter*> call_bytes_;
+    // processing thread only: the current batch
+    std::vector<BatchFrame> batch_;
+    std::vector<float> decoded_;
+    std::vector<Outgoing> outgoing_;
+    whispertalk::LatencyHistogram& frame_us_ = whispertalk::metrics().histogram(
+        "whispertalk_iap_frame_process_us", "Time to decode, upsample and forward one RTP frame (µs)");
+    whispertalk::MetricsCollector metrics_collector_{[this](whispertalk::MetricsWriter& w) {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        w.gauge("whispertalk_iap_active_calls", "Calls with IAP state", {}, static_cast<double>(arena_.size()));
+    }};
     std::map<whispertalk::ServiceType, std::chrono::steady_clock::time_point> last_disc_warn_per_target_;
+    std::map<whispertalk::ServiceType, std::chrono::steady_clock::time_point> last_shed_warn_per_target_;
     whispertalk::InterconnectNode interconnect_;
     whispertalk::LogForwarder log_fwd_;
 };
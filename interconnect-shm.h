@@ -0,0 +1,329 @@
+// interconnect-shm.h — shared-memory ring transport for co-located InterconnectNode peers.
+//
+// Every data hop of the pipeline normally crosses a loopback TCP socket: one
+// send() and at least two recv() syscalls per Packet, plus kernel copies in
+// both directions. For peers running on the same host, ShmRing replaces the
+// data channel with a single-producer / single-consumer byte ring placed in a
+// POSIX shared-memory segment that both processes map.
+//
+// Segment layout (all offsets from the start of the mapping):
+//   [0, HEADER_BYTES)            Header — magic, capacity, producer/consumer
+//                                cursors on separate cache lines, wake words.
+//   [HEADER_BYTES, +capacity)    Data area; capacity is a power of two.
+//
+// Records are written back to back as a native-endian 4-byte length followed
+// by the record bytes, padded to 8 bytes. Cursors (head/tail) are monotonic
+// 64-bit byte positions; a record may wrap around the end of the data area,
+// in which case it is copied in two parts. The producer publishes a record by
+// advancing head; the consumer releases it by advancing tail.
+//
+// Wakeups: a side that has to wait bumps a "waiting" flag and sleeps on a
+// 32-bit sequence word. The other side only issues a wake syscall when that
+// flag is set, so a busy stream costs no syscalls at all.
+//   Linux:  shared (non-private) futex on the sequence word.
+//   macOS:  no public cross-process futex — bounded spin, then sleep with
+//           exponential backoff (20µs → 1ms).
+//
+// Lifecycle: the sending node creates the segment, offers its name to the
+// receiver over the mgmt channel (see InterconnectNode::negotiate_shm) and
+// unlinks it once the receiver has mapped it (or refused), so nothing is left
+// in /dev/shm after a crash. Either side can close() the ring; the peer then
+// sees closed() and falls back to reconnecting over TCP.
+//
+// Opt-in: set WHISPERTALK_IC_SHM=1 in the environment of the sending service
+// (or call InterconnectNode::set_shm_transport(true)). Receivers always accept
+// offers, so enabling it on one side of a hop is enough.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <ctime>
+#endif
+
+namespace whispertalk {
+
+// Read once per process: WHISPERTALK_IC_SHM=1 makes InterconnectNode offer the
+// shared-memory transport to its downstream neighbour.
+inline bool ic_shm_enabled_default() {
+    static const bool enabled = []() {
+        const char* v = std::getenv("WHISPERTALK_IC_SHM");
+        return v && (std::strcmp(v, "1") == 0 || std::strcmp(v, "true") == 0);
+    }();
+    return enabled;
+}
+
+class ShmRing {
+public:
+    static constexpr uint32_t MAGIC            = 0x57544952;  // "WTIR"
+    static constexpr uint32_t VERSION          = 1;
+    static constexpr size_t   HEADER_BYTES     = 256;
+    static constexpr size_t   DEFAULT_CAPACITY = 4 * 1024 * 1024;  // > 1 MiB max Packet + framing
+    static constexpr int      SPIN_ITERS       = 200;
+    static constexpr int      WAIT_SLICE_MS    = 50;               // bounded futex sleep per slice
+
+    ~ShmRing() {
+        if (base_) munmap(base_, map_len_);
+    }
+
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    // Create a fresh segment owned by the caller (the producer side).
+    // `name_out` receives the shm name to hand to the peer.
+    static std::shared_ptr<ShmRing> create(size_t capacity, std::string& name_out) {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0) return nullptr;
+        static std::atomic<uint32_t> counter{0};
+        // macOS limits shm names to 31 characters (PSHMNAMLEN).
+        char name[32];
+        snprintf(name, sizeof(name), "/wt-ic-%d-%u", (int)getpid(),
+                 counter.fetch_add(1, std::memory_order_relaxed));
+
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) return nullptr;
+        size_t len = HEADER_BYTES + capacity;
+        if (ftruncate(fd, (off_t)len) != 0) {
+            ::close(fd);
+            shm_unlink(name);
+            return nullptr;
+        }
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            shm_unlink(name);
+            return nullptr;
+        }
+
+        Header* h = new (p) Header();
+        h->capacity = capacity;
+        h->version = VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic = MAGIC;
+
+        name_out = name;
+        return std::shared_ptr<ShmRing>(new ShmRing(p, len));
+    }
+
+    // Map a segment created by the peer (the consumer side).
+    static std::shared_ptr<ShmRing> open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size <= HEADER_BYTES) {
+            ::close(fd);
+            return nullptr;
+        }
+        size_t len = (size_t)st.st_size;
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return nullptr;
+
+        const Header* h = static_cast<const Header*>(p);
+        if (h->magic != MAGIC || h->version != VERSION ||
+            h->capacity + HEADER_BYTES != len ||
+            (h->capacity & (h->capacity - 1)) != 0) {
+            munmap(p, len);
+            return nullptr;
+        }
+        return std::shared_ptr<ShmRing>(new ShmRing(p, len));
+    }
+
+    static void unlink(const std::string& name) {
+        shm_unlink(name.c_str());
+    }
+
+    size_t capacity() const { return cap_; }
+
+    bool closed() const {
+        return hdr_->closed.load(std::memory_order_acquire) != 0;
+    }
+
+    // Mark the ring dead and wake whichever side is sleeping on it.
+    void close() {
+        hdr_->closed.store(1, std::memory_order_seq_cst);
+        hdr_->data_seq.fetch_add(1, std::memory_order_seq_cst);
+        hdr_->space_seq.fetch_add(1, std::memory_order_seq_cst);
+        wake(hdr_->data_seq);
+        wake(hdr_->space_seq);
+    }
+
+    // Producer: append one record made of two contiguous parts (typically the
+    // 8-byte Packet header and the payload). Waits up to timeout_ms for space.
+    // Returns false on timeout, if the record can never fit, or if closed.
+    bool push(const void* a, size_t alen, const void* b, size_t blen, int timeout_ms) {
+        return push(a, alen, b, blen, nullptr, 0, timeout_ms);
+    }
+
+    // Three-part variant (header, payload, trace extension).
+    bool push(const void* a, size_t alen, const void* b, size_t blen,
+              const void* c, size_t clen, int timeout_ms) {
+        const size_t body = alen + blen + clen;
+        const size_t need = record_bytes(body);
+        if (body > UINT32_MAX || need > cap_ || closed()) return false;
+
+        const uint64_t head = hdr_->head.load(std::memory_order_relaxed);
+        auto has_space = [&]() {
+            return cap_ - (head - hdr_->tail.load(std::memory_order_acquire)) >= need;
+        };
+        if (!wait_for(has_space, hdr_->space_seq, hdr_->producer_waiting, timeout_ms)) return false;
+
+        uint32_t len32 = static_cast<uint32_t>(body);
+        copy_in(head, &len32, 4);
+        if (alen) copy_in(head + 4, a, alen);
+        if (blen) copy_in(head + 4 + alen, b, blen);
+        if (clen) copy_in(head + 4 + alen + blen, c, clen);
+
+        hdr_->head.store(head + need, std::memory_order_seq_cst);
+        hdr_->data_seq.fetch_add(1, std::memory_order_seq_cst);
+        if (hdr_->consumer_waiting.load(std::memory_order_seq_cst)) wake(hdr_->data_seq);
+        return true;
+    }
+
+    // Consumer: wait up to timeout_ms for a record. The record stays at the
+    // front of the ring until pop_front().
+    bool wait_readable(int timeout_ms) {
+        const uint64_t tail = hdr_->tail.load(std::memory_order_relaxed);
+        auto has_data = [&]() {
+            return hdr_->head.load(std::memory_order_acquire) != tail;
+        };
+        return wait_for(has_data, hdr_->data_seq, hdr_->consumer_waiting, timeout_ms);
+    }
+
+    // Length of the front record. Only valid after wait_readable() returned true.
+    uint32_t front_size() const {
+        uint32_t len32 = 0;
+        copy_out(hdr_->tail.load(std::memory_order_relaxed), &len32, 4);
+        return len32;
+    }
+
+    // Copy `n` bytes of the front record starting at `offset` into dst.
+    void read_front(size_t offset, void* dst, size_t n) const {
+        copy_out(hdr_->tail.load(std::memory_order_relaxed) + 4 + offset, dst, n);
+    }
+
+    // Release the front record back to the producer.
+    void pop_front() {
+        const uint64_t tail = hdr_->tail.load(std::memory_order_relaxed);
+        const size_t len = front_size();
+        hdr_->tail.store(tail + record_bytes(len), std::memory_order_seq_cst);
+        hdr_->space_seq.fetch_add(1, std::memory_order_seq_cst);
+        if (hdr_->producer_waiting.load(std::memory_order_seq_cst)) wake(hdr_->space_seq);
+    }
+
+private:
+    struct Header {
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        uint64_t capacity = 0;
+        alignas(64) std::atomic<uint64_t> head{0};        // producer cursor
+        std::atomic<uint32_t> data_seq{0};                // consumer sleeps here
+        std::atomic<uint32_t> consumer_waiting{0};
+        alignas(64) std::atomic<uint64_t> tail{0};        // consumer cursor
+        std::atomic<uint32_t> space_seq{0};               // producer sleeps here
+        std::atomic<uint32_t> producer_waiting{0};
+        alignas(64) std::atomic<uint32_t> closed{0};
+    };
+    static_assert(sizeof(Header) <= HEADER_BYTES, "ShmRing header overflows reserved area");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ShmRing needs lock-free 64-bit atomics");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "ShmRing needs lock-free 32-bit atomics");
+
+    ShmRing(void* base, size_t map_len)
+        : base_(base), map_len_(map_len),
+          hdr_(static_cast<Header*>(base)),
+          data_(static_cast<uint8_t*>(base) + HEADER_BYTES),
+          cap_(static_cast<size_t>(hdr_->capacity)), mask_(cap_ - 1) {}
+
+    static size_t record_bytes(size_t body) { return (4 + body + 7) & ~size_t(7); }
+
+    void copy_in(uint64_t pos, const void* src, size_t n) {
+        size_t off = (size_t)(pos & mask_);
+        size_t first = std::min(n, cap_ - off);
+        memcpy(data_ + off, src, first);
+        if (n > first) memcpy(data_, static_cast<const uint8_t*>(src) + first, n - first);
+    }
+
+    void copy_out(uint64_t pos, void* dst, size_t n) const {
+        size_t off = (size_t)(pos & mask_);
+        size_t first = std::min(n, cap_ - off);
+        memcpy(dst, data_ + off, first);
+        if (n > first) memcpy(static_cast<uint8_t*>(dst) + first, data_, n - first);
+    }
+
+    // Spin briefly, then sleep on `seq` until ready() or the deadline.
+    // The waiting flag is raised before re-checking ready(), and the other side
+    // bumps `seq` before reading the flag, so a wakeup cannot be lost.
+    template <typename Ready>
+    bool wait_for(Ready ready, std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiting,
+                  int timeout_ms) {
+        if (ready()) return true;
+        for (int i = 0; i < SPIN_ITERS; i++) {
+            if (closed()) return false;
+            if (ready()) return true;
+            std::this_thread::yield();
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        int backoff_us = 20;
+        while (!closed()) {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) return ready();
+
+            waiting.store(1, std::memory_order_seq_cst);
+            uint32_t s = seq.load(std::memory_order_seq_cst);
+            if (ready()) {
+                waiting.store(0, std::memory_order_relaxed);
+                return true;
+            }
+#ifdef __linux__
+            (void)backoff_us;
+            long slice_us = std::min<long>((long)remaining, WAIT_SLICE_MS * 1000L);
+            struct timespec ts;
+            ts.tv_sec = slice_us / 1000000;
+            ts.tv_nsec = (slice_us % 1000000) * 1000;
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAIT, s, &ts, nullptr, 0);
+#else
+            (void)s;
+            long slice_us = std::min<long>((long)remaining, backoff_us);
+            std::this_thread::sleep_for(std::chrono::microseconds(slice_us));
+            backoff_us = std::min(backoff_us * 2, 1000);
+#endif
+            waiting.store(0, std::memory_order_relaxed);
+            if (ready()) return true;
+        }
+        return false;
+    }
+
+    static void wake(std::atomic<uint32_t>& seq) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#else
+        (void)seq;
+#endif
+    }
+
+    void* base_;
+    size_t map_len_;
+    Header* hdr_;
+    uint8_t* data_;
+    size_t cap_;
+    size_t mask_;
+};
+
+}
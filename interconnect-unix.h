@@ -0,0 +1,189 @@
+// interconnect-unix.h — AF_UNIX transport for InterconnectNode links.
+//
+// Every node listens on Unix domain sockets next to its TCP ports: the port
+// map is reused, each port becomes a socket path in WHISPERTALK_IC_UNIX_DIR
+// (default /tmp/whispertalk-ic, created 0700):
+//
+//   <dir>/ic-<port>.sock   SOCK_STREAM     same framing as TCP
+//   <dir>/ic-<port>.seq    SOCK_SEQPACKET  (Linux) one frame per message
+//
+// A SOCK_SEQPACKET message keeps its boundaries, so frames on such sockets
+// drop the 4-byte length prefix and a receiver takes a whole frame with one
+// recvmsg(). A message must fit the sender's socket buffer, so a data socket
+// only stays on SEQPACKET if it can reserve room for the largest frame
+// (SO_SNDBUFFORCE, else SO_SNDBUF up to net.core.wmem_max); otherwise the
+// link uses the stream socket.
+//
+// The sender picks the transport: WHISPERTALK_IC_UNIX=seqpacket (or 1) or
+// =stream, read once per process, or InterconnectNode::set_unix_transport().
+// A peer without the socket path is reached over TCP as before. kTLS is TCP
+// only; userspace IC encryption works on every transport.
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace whispertalk {
+
+enum class IcUnixMode : uint8_t {
+    OFF       = 0,   // TCP
+    STREAM    = 1,
+    SEQPACKET = 2,
+};
+
+#ifdef __linux__
+static constexpr bool IC_UNIX_SEQPACKET_SUPPORTED = true;
+#else
+static constexpr bool IC_UNIX_SEQPACKET_SUPPORTED = false;
+#endif
+
+inline const char* ic_unix_mode_name(IcUnixMode mode) {
+    switch (mode) {
+        case IcUnixMode::STREAM:    return "unix";
+        case IcUnixMode::SEQPACKET: return "unix-seqpacket";
+        default:                    return "tcp";
+    }
+}
+
+inline IcUnixMode ic_unix_mode_default() {
+    static const IcUnixMode mode = []() {
+        const char* v = std::getenv("WHISPERTALK_IC_UNIX");
+        if (!v) return IcUnixMode::OFF;
+        if (std::strcmp(v, "stream") == 0) return IcUnixMode::STREAM;
+        if (std::strcmp(v, "seqpacket") == 0 || std::strcmp(v, "1") == 0 ||
+            std::strcmp(v, "true") == 0) {
+            return IC_UNIX_SEQPACKET_SUPPORTED ? IcUnixMode::SEQPACKET : IcUnixMode::STREAM;
+        }
+        return IcUnixMode::OFF;
+    }();
+    return mode;
+}
+
+inline std::string ic_unix_socket_dir() {
+    const char* v = std::getenv("WHISPERTALK_IC_UNIX_DIR");
+    return (v && *v) ? v : "/tmp/whispertalk-ic";
+}
+
+inline std::string ic_unix_socket_path(uint16_t port, IcUnixMode mode) {
+    return ic_unix_socket_dir() + "/ic-" + std::to_string(port) +
+           (mode == IcUnixMode::SEQPACKET ? ".seq" : ".sock");
+}
+
+inline bool ic_unix_address(uint16_t port, IcUnixMode mode, sockaddr_un& addr) {
+    std::string path = ic_unix_socket_path(port, mode);
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+inline int ic_unix_socket_type(IcUnixMode mode) {
+#ifdef __linux__
+    if (mode == IcUnixMode::SEQPACKET) return SOCK_SEQPACKET;
+#endif
+    (void)mode;
+    return SOCK_STREAM;
+}
+
+// Non-blocking listener. The caller must already own the TCP port: a socket
+// file left behind by a crashed process is unlinked first.
+inline int ic_unix_listen(uint16_t port, IcUnixMode mode, int backlog) {
+    if (mode == IcUnixMode::OFF || (mode == IcUnixMode::SEQPACKET && !IC_UNIX_SEQPACKET_SUPPORTED)) {
+        return -1;
+    }
+    sockaddr_un addr;
+    if (!ic_unix_address(port, mode, addr)) return -1;
+    mkdir(ic_unix_socket_dir().c_str(), 0700);
+    int sock = socket(AF_UNIX, ic_unix_socket_type(mode), 0);
+    if (sock < 0) return -1;
+    unlink(addr.sun_path);
+    if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(sock, backlog) < 0) {
+        ::close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    return sock;
+}
+
+inline void ic_unix_unlink(uint16_t port, IcUnixMode mode) {
+    sockaddr_un addr;
+    if (ic_unix_address(port, mode, addr)) unlink(addr.sun_path);
+}
+
+// Blocking-mode socket connected to the peer's listener, or -1 (no such
+// path, nobody listening, or timeout).
+inline int ic_unix_connect(uint16_t port, IcUnixMode mode, int timeout_ms) {
+    if (mode == IcUnixMode::OFF || (mode == IcUnixMode::SEQPACKET && !IC_UNIX_SEQPACKET_SUPPORTED)) {
+        return -1;
+    }
+    sockaddr_un addr;
+    if (!ic_unix_address(port, mode, addr)) return -1;
+    int sock = socket(AF_UNIX, ic_unix_socket_type(mode), 0);
+    if (sock < 0) return -1;
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    int ret = connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    if (ret < 0 && (errno == EINPROGRESS || errno == EAGAIN)) {
+        pollfd pfd = {sock, POLLOUT, 0};
+        int error = 0;
+        socklen_t errlen = sizeof(error);
+        if (poll(&pfd, 1, timeout_ms) > 0 &&
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &errlen) == 0 && error == 0) {
+            ret = 0;
+        }
+    }
+    if (ret < 0) {
+        ::close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, flags);
+#ifdef SO_NOSIGPIPE
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
+#endif
+    return sock;
+}
+
+// Grows the send buffer so one message of `bytes` fits. True if it does.
+inline bool ic_unix_reserve_sndbuf(int sock, size_t bytes) {
+    // The kernel doubles the request and keeps some of it for bookkeeping.
+    int want = static_cast<int>(bytes);
+#ifdef SO_SNDBUFFORCE
+    if (setsockopt(sock, SOL_SOCKET, SO_SNDBUFFORCE, &want, sizeof(want)) < 0)
+#endif
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &want, sizeof(want));
+    int have = 0;
+    socklen_t len = sizeof(have);
+    if (getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &have, &len) < 0) return false;
+    return static_cast<size_t>(have) >= bytes + 1024;
+}
+
+// Transport of a connected socket: TCP, or the Unix socket type.
+inline IcUnixMode ic_socket_transport(int sock) {
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    if (getsockname(sock, reinterpret_cast<sockaddr*>(&ss), &len) < 0 || ss.ss_family != AF_UNIX) {
+        return IcUnixMode::OFF;
+    }
+    int type = 0;
+    len = sizeof(type);
+    getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &len);
+#ifdef __linux__
+    if (type == SOCK_SEQPACKET) return IcUnixMode::SEQPACKET;
+#endif
+    return IcUnixMode::STREAM;
+}
+
+}
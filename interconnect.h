@@ -15,17 +15,41 @@
 //   InterconnectNode encapsulates both directions for a single service:
 //     • Listen sockets accept the upstream neighbor's connections.
 //     • Outbound sockets connect to the downstream neighbor's listen ports.
-//     • A background reconnect loop retries downstream connections every
-//       DOWNSTREAM_RECONNECT_MS (200ms) until the neighbor is reachable.
+//     • One reactor thread (event-loop.h: epoll / kqueue) accepts upstream
+//       connections, dispatches upstream mgmt messages and notices peer
+//       hangups the moment they happen. Lost downstream connections are
+//       retried from a reactor timer every DOWNSTREAM_RECONNECT_MS (200ms)
+//       until the neighbor is reachable; a connected idle node never wakes.
+//     • Optional shared-memory data path (interconnect-shm.h): when enabled
+//       on the sender, Packets to the downstream neighbor go through an SPSC
+//       ring in a shm segment instead of the data socket. Negotiated over the
+//       mgmt channel at connect time; any failure falls back to TCP.
+//     • Optional Unix domain sockets (interconnect-unix.h): the same port
+//       map as socket paths. On SOCK_SEQPACKET links every frame is one
+//       message and travels without the 4-byte length prefix.
+//     • Optional IC encryption (tls_cert.h): frames are sealed with
+//       AES-256-GCM by a long-lived per-thread cipher context, or — where
+//       both kernels support it and the sender opts in — a data socket is
+//       handed to kernel TLS, negotiated over mgmt like the shm path.
+//     • Typed frame headers (frame-meta.h): links that negotiate them carry
+//       payload type, sample rate, a per-call sequence number and a capture
+//       timestamp with every frame; receivers count per-hop loss from it.
+//     • Speech bus (speech-bus.h): SPEECH_ACTIVE/IDLE are also published on
+//       a loopback multicast group every node subscribes to, so barge-in
+//       reaches LLaMA, the TTS engines and OAP in one kernel hop instead of
+//       one mgmt relay per stage.
 //
 //   LogForwarder sends structured log entries as UDP datagrams to the
-//   frontend log server (port 22022). Each datagram is a plain-text line:
+//   frontend log server (port 22022). Each entry is a plain-text line:
 //     "<SERVICE> <LEVEL> <CALL_ID> <message>"
-//   The log_level_ gate filters below-threshold messages before send.
+//   The log_level_ gate filters below-threshold messages on the calling
+//   thread; the rest are recorded in a per-thread ring (log-ring.h) and
+//   formatted and sent in batch datagrams by a drain thread.
 //
 //   Shared utilities (also used by frontend.cpp for the offline IAP quality
-//   test) include the G.711 μ-law → float32 LUT and the polyphase FIR
-//   half-band upsample kernel (iap_fir_upsample_frame).
+//   test): the G.711 μ-law decoder and the polyphase FIR upsample kernels
+//   (iap_fir_upsample_frame, with SIMD versions picked at runtime) live in
+//   audio-dsp.h; the compact PCM wire encodings built on both in pcm-wire.h.
 //
 // Port map (all on 127.0.0.1):
 //   SIP_CLIENT (13100/13101/13102), IAP (13110/13111/13112)
@@ -37,20 +61,27 @@
 //
 // Usage pattern for a service:
 //   1. Construct InterconnectNode(ServiceType::MY_SERVICE)
-//   2. Call initialize() — binds listen ports and starts background threads.
-//   3. Call connect_to_downstream() — non-blocking; reconnect loop handles retries.
+//   2. Call initialize() — binds listen ports and starts the reactor.
+//   3. Call connect_to_downstream() — one attempt; the reactor handles retries.
 //   4. Register call_end_handler / speech_signal_handler as needed.
 //   5. In processing loop: recv_from_upstream() / send_to_downstream().
+//      Hot paths use the PooledPacket overloads (make_packet(), packet-pool.h),
+//      which frame and encrypt in place and allocate nothing in steady state.
+//      Per-tick producers and consumers of small frames (OAP, SIP, IAP) use
+//      send_batch_to_downstream() / recv_batch_from_upstream(), which move a
+//      whole tick in one or two syscalls per hop.
 //   6. On shutdown: call shutdown() (or let destructor do it).
 
 #pragma once
 
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <string>
 #include <vector>
 #include <map>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
 #include <atomic>
 #include <optional>
@@ -60,6 +91,7 @@
 #include <algorithm>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
@@ -71,132 +103,22 @@
 #include <cstdarg>
 
 #include "tls_cert.h"
+#include "interconnect-shm.h"
+#include "interconnect-unix.h"
+#include "packet-pool.h"
+#include "hop-latency.h"
+#include "metrics.h"
+#include "flow-control.h"
+#include "frame-meta.h"
+#include "speech-bus.h"
+#include "event-loop.h"
+#include "log-ring.h"
+#include "audio-dsp.h"
 
 namespace whispertalk {
 
 static constexpr uint16_t FRONTEND_LOG_PORT = 22022;
 
-// Half-band FIR low-pass filter for 8kHz → 16kHz upsampling.
-// 15-tap Hamming-windowed sinc, cutoff ~3.8kHz, ~40dB stopband attenuation.
-// Used by IAP (inbound-audio-processor.cpp) and the offline codec quality test
-// (frontend.cpp handle_iap_quality_test). Both must use the same filter to
-// ensure test results match real pipeline behaviour.
-static constexpr int IAP_FIR_LEN    = 15;
-static constexpr int IAP_FIR_CENTER = 7;
-static constexpr int IAP_ULAW_FRAME = 160;
-
-// 3-phase polyphase FIR for 8kHz → 24kHz upsampling (3× interpolation).
-// 24-tap Hamming-windowed sinc, cutoff 4kHz, unity output gain.
-// Decomposed into 3 polyphase sub-filters of 8 taps each (each sums to ~1.0).
-// IAP_ULAW_OUT_24K: output samples per 160-sample input frame (160 * 3 = 480).
-static constexpr int IAP_FIR_24K_LEN    = 24;
-static constexpr int IAP_FIR_24K_CENTER = 12;
-static constexpr int IAP_ULAW_OUT_24K   = 480;
-
-inline const float* iap_fir_coeffs() {
-    static const float coeffs[IAP_FIR_LEN] = {
-        -0.0076f, 0.0000f, 0.0527f, 0.0000f, -0.1681f, 0.0000f, 0.6230f,
-         1.0000f,
-         0.6230f, 0.0000f, -0.1681f, 0.0000f, 0.0527f, 0.0000f, -0.0076f
-    };
-    return coeffs;
-}
-
-// Polyphase FIR half-band upsample: 8kHz → 16kHz via 2× zero-stuff + 15-tap filter.
-// Exploits half-band structure: odd taps (1,3,5,9,11,13) are zero, center tap (7) = 1.0.
-//   Odd outputs:  out[2i+1] = x[i - 3]  (delayed passthrough)
-//   Even outputs: out[2i]   = sum of 8 non-zero taps  (8 MACs vs 15 branchy iterations)
-// Each polyphase branch has DC gain = 1.0 (even coeffs sum to 1.0, odd = center tap 1.0).
-// ~3.7× fewer operations than the naive FIR loop.
-// `history` must point to IAP_FIR_CENTER floats that persist across calls.
-// Returns number of output samples written (= in_len * 2).
-inline size_t iap_fir_upsample_frame(const float* in, size_t in_len,
-                                      float* out, float* history) {
-    if (in_len > (size_t)IAP_ULAW_FRAME) in_len = IAP_ULAW_FRAME;
-    if (in_len == 0) return 0;
-
-    static constexpr float H0 = -0.0076f;
-    static constexpr float H2 =  0.0527f;
-    static constexpr float H4 = -0.1681f;
-    static constexpr float H6 =  0.6230f;
-
-    float ext[IAP_FIR_CENTER + IAP_ULAW_FRAME];
-    for (int i = 0; i < IAP_FIR_CENTER; i++) ext[i] = history[i];
-    for (size_t i = 0; i < in_len; i++) ext[IAP_FIR_CENTER + i] = in[i];
-
-    size_t out_len = in_len * 2;
-    const int N = (int)in_len;
-
-    for (int i = 0; i < N; i++) {
-        const float* x = ext + i;
-        float even = H0 * x[7] + H2 * x[6] + H4 * x[5] + H6 * x[4]
-                   + H6 * x[3] + H4 * x[2] + H2 * x[1] + H0 * x[0];
-        out[2 * i] = even;
-        out[2 * i + 1] = ext[i + 4];
-    }
-
-    if (in_len >= (size_t)IAP_FIR_CENTER) {
-        for (int i = 0; i < IAP_FIR_CENTER; i++)
-            history[i] = in[in_len - IAP_FIR_CENTER + i];
-    } else {
-        int shift = (int)in_len;
-        for (int i = 0; i < IAP_FIR_CENTER - shift; i++) history[i] = history[i + shift];
-        for (int i = 0; i < shift; i++) history[IAP_FIR_CENTER - shift + i] = in[i];
-    }
-    return out_len;
-}
-
-// 3-phase polyphase FIR upsample: 8kHz → 24kHz via 3× zero-stuff + 24-tap filter.
-// Each input sample produces 3 output samples via 3 polyphase sub-filters.
-// Sub-filter p selects coefficients h[p], h[p+3], h[p+6], ..., h[p+21] (8 taps each).
-// Each sub-filter sums to ~1.0 so output amplitude matches input (unity DC gain).
-// `history` must point to IAP_FIR_24K_CENTER floats that persist across calls.
-// Returns number of output samples written (= in_len * 3).
-inline size_t iap_fir_upsample_frame_24k(const float* in, size_t in_len,
-                                          float* out, float* history) {
-    if (in_len > (size_t)IAP_ULAW_FRAME) in_len = IAP_ULAW_FRAME;
-    if (in_len == 0) return 0;
-
-    // h[n] = sinc((n - 11.5) / 3) * (0.54 - 0.46 * cos(2πn/23)), n = 0..23
-    // Symmetric: h[n] == h[23-n]. Phase sums: p0 ≈ 0.997, p1 ≈ 0.996, p2 ≈ 0.997.
-    static constexpr float H[IAP_FIR_24K_LEN] = {
-        -0.003321f, -0.008827f, -0.007386f,
-         0.012696f,  0.041809f,  0.032792f,
-        -0.049604f, -0.147281f, -0.109854f,
-         0.171281f,  0.612376f,  0.950838f,
-         0.950838f,  0.612376f,  0.171281f,
-        -0.109854f, -0.147281f, -0.049604f,
-         0.032792f,  0.041809f,  0.012696f,
-        -0.007386f, -0.008827f, -0.003321f
-    };
-
-    float ext[IAP_FIR_24K_CENTER + IAP_ULAW_FRAME];
-    for (int i = 0; i < IAP_FIR_24K_CENTER; i++) ext[i] = history[i];
-    for (size_t i = 0; i < in_len; i++) ext[IAP_FIR_24K_CENTER + i] = in[i];
-
-    const int N = (int)in_len;
-    for (int i = 0; i < N; i++) {
-        const float* x = ext + i;
-        for (int p = 0; p < 3; p++) {
-            float acc = 0.0f;
-            for (int k = 0; k < 8; k++) {
-                acc += H[p + 3 * k] * x[IAP_FIR_24K_CENTER - k];
-            }
-            out[3 * i + p] = acc;
-        }
-    }
-
-    if (in_len >= (size_t)IAP_FIR_24K_CENTER) {
-        for (int i = 0; i < IAP_FIR_24K_CENTER; i++)
-            history[i] = in[in_len - IAP_FIR_24K_CENTER + i];
-    } else {
-        int shift = (int)in_len;
-        for (int i = 0; i < IAP_FIR_24K_CENTER - shift; i++) history[i] = history[i + shift];
-        for (int i = 0; i < shift; i++) history[IAP_FIR_24K_CENTER - shift + i] = in[i];
-    }
-    return in_len * 3;
-}
-
 // ServiceType — identifies each process in the Prodigy system.
 //
 // Pipeline services (is_pipeline_service() == true):
@@ -290,8 +212,41 @@ inline ServiceType downstream_of(ServiceType type) {
     }
 }
 
+// True if a speech signal published by `origin` is meant for `svc`: the
+// services the mgmt relay would have carried it to (downstream of origin,
+// up to and including OAP).
+inline bool speech_signal_reaches(ServiceType origin, ServiceType svc) {
+    ServiceType t = origin;
+    for (int i = 0; i < 8; i++) {
+        t = downstream_of(t);
+        if (t == svc) return true;
+        if (t == ServiceType::OUTBOUND_AUDIO_PROCESSOR || t == ServiceType::SIP_CLIENT) break;
+    }
+    return false;
+}
+
+// Wire trace propagation is on unless WHISPERTALK_IC_TRACE=0 (or "false").
+inline bool ic_trace_wire_default() {
+    static const bool enabled = []() {
+        const char* v = std::getenv("WHISPERTALK_IC_TRACE");
+        return !(v && (std::strcmp(v, "0") == 0 || std::strcmp(v, "false") == 0));
+    }();
+    return enabled;
+}
+
+// Per-packet hop log. Services record (service, 0) when a packet enters and
+// (service, 1) when it leaves. Timestamps come from steady_clock, which is a
+// host-wide monotonic clock, so hops recorded by different processes on the
+// same machine are directly comparable.
+//
+// On the wire the trace is an optional extension that follows the payload
+// (see InterconnectNode::set_trace_propagation):
+//   [hop_count u8][hop_count × (service_id u8, direction u8, timestamp_us u64 BE)]
+// and is announced by TRACE_FLAG in the header's payload_size field.
 struct PacketTrace {
-    static constexpr int MAX_HOPS = 8;
+    static constexpr int MAX_HOPS = 16;
+    static constexpr size_t WIRE_HOP_BYTES = 10;
+    static constexpr size_t MAX_WIRE_BYTES = 1 + MAX_HOPS * WIRE_HOP_BYTES;
     struct Hop {
         uint8_t service_id;
         uint8_t direction;
@@ -338,6 +293,40 @@ struct PacketTrace {
         std::fprintf(stderr, " = %.2fms total\n", total_ms());
     }
 
+    size_t wire_size() const { return hop_count ? 1 + hop_count * WIRE_HOP_BYTES : 0; }
+
+    // Writes wire_size() bytes.
+    void write_wire(uint8_t* out) const {
+        out[0] = hop_count;
+        uint8_t* p = out + 1;
+        for (int i = 0; i < hop_count; i++) {
+            p[0] = hops[i].service_id;
+            p[1] = hops[i].direction;
+            uint64_t ts = hops[i].timestamp_us;
+            for (int b = 7; b >= 0; b--) { p[2 + b] = static_cast<uint8_t>(ts); ts >>= 8; }
+            p += WIRE_HOP_BYTES;
+        }
+    }
+
+    // Parses a wire extension of exactly `len` bytes.
+    bool read_wire(const uint8_t* in, size_t len) {
+        hop_count = 0;
+        if (len == 0) return true;
+        uint8_t n = in[0];
+        if (n > MAX_HOPS || len != 1 + n * WIRE_HOP_BYTES) return false;
+        const uint8_t* p = in + 1;
+        for (int i = 0; i < n; i++) {
+            hops[i].service_id = p[0];
+            hops[i].direction = p[1];
+            uint64_t ts = 0;
+            for (int b = 0; b < 8; b++) ts = (ts << 8) | p[2 + b];
+            hops[i].timestamp_us = ts;
+            p += WIRE_HOP_BYTES;
+        }
+        hop_count = n;
+        return true;
+    }
+
     static const char* service_type_name(uint8_t id) {
         switch (id) {
             case 1: return "SIP";
@@ -373,6 +362,17 @@ struct PacketTrace {
 //
 // Data flow example: SIP sends data to IAP by connecting to IAP's data_listen (13111).
 // IAP sends management msgs to SIP by connecting to SIP's mgmt_listen (13100).
+//
+// Replicas: a stage can run as up to MAX_STAGE_REPLICAS processes (e.g.
+// WHISPER#0..#3). Instance 0 keeps the port above; instance i > 0 gets its
+// own block of 4 ports (mgmt, data, cmd, engine) at
+//   REPLICA_PORT_BASE + type * 32 + i * 4      (13400 .. 13751)
+// so every replica's cmd port is derived the same way as the primary's.
+static constexpr int MAX_STAGE_REPLICAS = 8;
+static constexpr uint16_t REPLICA_PORT_BASE = 13400;
+
+inline uint16_t service_base_port(ServiceType type, uint8_t instance);
+
 inline uint16_t service_base_port(ServiceType type) {
     switch (type) {
         case ServiceType::SIP_CLIENT:                return 13100;
@@ -389,11 +389,24 @@ inline uint16_t service_base_port(ServiceType type) {
     }
 }
 
-inline uint16_t service_mgmt_port(ServiceType type) { return service_base_port(type); }
-inline uint16_t service_data_port(ServiceType type) { return service_base_port(type) + 1; }
+inline uint16_t service_base_port(ServiceType type, uint8_t instance) {
+    if (instance == 0 || instance >= MAX_STAGE_REPLICAS || service_base_port(type) == 0) {
+        return service_base_port(type);
+    }
+    return static_cast<uint16_t>(REPLICA_PORT_BASE + static_cast<uint16_t>(type) * 32 + instance * 4);
+}
+
+inline uint16_t service_mgmt_port(ServiceType type, uint8_t instance = 0) {
+    return service_base_port(type, instance);
+}
+inline uint16_t service_data_port(ServiceType type, uint8_t instance = 0) {
+    return service_base_port(type, instance) + 1;
+}
 // Command port: for out-of-band text commands from the frontend (e.g., ADD_LINE, GET_STATS).
 // Only services that need frontend commands use this (+2 offset).
-inline uint16_t service_cmd_port(ServiceType type) { return service_base_port(type) + 2; }
+inline uint16_t service_cmd_port(ServiceType type, uint8_t instance = 0) {
+    return service_base_port(type, instance) + 2;
+}
 // Engine-dock port: TTS_SERVICE only. TTS engines (kokoro, neutts, ...) open a local
 // TCP connection to this port and send a HELLO line to dock with the generic TTS
 // stage. Returns 0 for services that do not expose an engine-dock listener.
@@ -404,13 +417,46 @@ inline uint16_t service_engine_port(ServiceType type) {
     }
 }
 
+// Replica count of a pipeline stage: WHISPERTALK_REPLICAS_<STAGE>=N with
+// STAGE one of IAP, VAD, WHISPER, LLAMA, TTS, OAP, MOSHI (default 1, at most
+// MAX_STAGE_REPLICAS). The stage's upstream shards calls across that many
+// instances and its downstream accepts that many upstream peers, so every
+// process of the pipeline must see the same setting.
+inline int stage_replica_count(ServiceType type) {
+    const char* var = nullptr;
+    switch (type) {
+        case ServiceType::INBOUND_AUDIO_PROCESSOR:  var = "WHISPERTALK_REPLICAS_IAP"; break;
+        case ServiceType::VAD_SERVICE:              var = "WHISPERTALK_REPLICAS_VAD"; break;
+        case ServiceType::WHISPER_SERVICE:          var = "WHISPERTALK_REPLICAS_WHISPER"; break;
+        case ServiceType::LLAMA_SERVICE:            var = "WHISPERTALK_REPLICAS_LLAMA"; break;
+        case ServiceType::TTS_SERVICE:              var = "WHISPERTALK_REPLICAS_TTS"; break;
+        case ServiceType::OUTBOUND_AUDIO_PROCESSOR: var = "WHISPERTALK_REPLICAS_OAP"; break;
+        case ServiceType::MOSHI_SERVICE:            var = "WHISPERTALK_REPLICAS_MOSHI"; break;
+        default: return 1;
+    }
+    const char* v = std::getenv(var);
+    int n = v ? std::atoi(v) : 1;
+    if (n < 1) return 1;
+    return n < MAX_STAGE_REPLICAS ? n : MAX_STAGE_REPLICAS;
+}
+
+inline bool read_extensions(uint32_t wire_size, const uint8_t* ext, size_t len,
+                            FrameMeta& meta, PacketTrace& trace);
+
 struct Packet {
     static constexpr uint32_t MAX_PAYLOAD_SIZE = 1024 * 1024;
+    // Set in the wire payload_size field when a PacketTrace extension
+    // (TRACE_FLAG) or a FrameMeta block (META_FLAG, frame-meta.h) follows
+    // the payload. Never set in Packet::payload_size itself.
+    static constexpr uint32_t TRACE_FLAG = 0x80000000u;
+    static constexpr uint32_t META_FLAG  = 0x40000000u;
+    static constexpr uint32_t SIZE_MASK  = ~(TRACE_FLAG | META_FLAG);
     
     uint32_t call_id;
     uint32_t payload_size;
     std::vector<uint8_t> payload;
     PacketTrace trace;
+    FrameMeta meta;   // travels only on links that negotiated typed headers
 
     Packet() : call_id(0), payload_size(0) {}
     
@@ -448,6 +494,9 @@ struct Packet {
 
     size_t serialized_size() const { return 8 + payload_size; }
 
+    // serialize()/serialize_into() never include the extensions; extensions
+    // in the input (META_FLAG, TRACE_FLAG) are decoded into out.meta and
+    // out.trace.
     static bool deserialize(const void* data, size_t len, Packet& out) {
         if (len < 8) return false;
         
@@ -457,7 +506,8 @@ struct Packet {
         memcpy(&net_size, ptr + 4, 4);
         
         out.call_id = ntohl(net_call_id);
-        out.payload_size = ntohl(net_size);
+        uint32_t wire_size = ntohl(net_size);
+        out.payload_size = wire_size & SIZE_MASK;
         
         if (out.call_id == 0 || out.payload_size > MAX_PAYLOAD_SIZE) {
             return false;
@@ -467,6 +517,14 @@ struct Packet {
             return false;
         }
         
+        out.trace = PacketTrace();
+        out.meta = FrameMeta();
+        if ((wire_size & (TRACE_FLAG | META_FLAG)) &&
+            !read_extensions(wire_size, ptr + 8 + out.payload_size, len - 8 - out.payload_size,
+                             out.meta, out.trace)) {
+            return false;
+        }
+
         out.payload.resize(out.payload_size);
         if (out.payload_size > 0) {
             memcpy(out.payload.data(), ptr + 8, out.payload_size);
@@ -476,6 +534,91 @@ struct Packet {
     }
 };
 
+// Header extensions follow the payload in wire order FrameMeta (META_FLAG),
+// then PacketTrace (TRACE_FLAG). These are shared by every transport (TCP
+// frames, shm ring records, Packet::deserialize).
+static constexpr size_t MAX_EXT_BYTES = FrameMeta::MAX_WIRE_BYTES + PacketTrace::MAX_WIRE_BYTES;
+
+// Most extension bytes a header with wire_size's flags may announce.
+inline size_t max_ext_bytes(uint32_t wire_size) {
+    return ((wire_size & Packet::META_FLAG) ? FrameMeta::MAX_WIRE_BYTES : 0) +
+           ((wire_size & Packet::TRACE_FLAG) ? PacketTrace::MAX_WIRE_BYTES : 0);
+}
+
+// Writes the extensions for meta (if non-null) and trace (if non-null and
+// non-empty) to out (MAX_EXT_BYTES), ORs their flags into flags and
+// returns the bytes written.
+inline size_t write_extensions(uint8_t* out, const FrameMeta* meta, const PacketTrace* trace,
+                               uint32_t& flags) {
+    size_t n = 0;
+    if (meta) {
+        meta->write_wire(out);
+        n += FrameMeta::WIRE_BYTES;
+        flags |= Packet::META_FLAG;
+    }
+    if (trace && trace->hop_count) {
+        trace->write_wire(out + n);
+        n += trace->wire_size();
+        flags |= Packet::TRACE_FLAG;
+    }
+    return n;
+}
+
+// Parses exactly len extension bytes announced by wire_size's flags.
+inline bool read_extensions(uint32_t wire_size, const uint8_t* ext, size_t len,
+                            FrameMeta& meta, PacketTrace& trace) {
+    meta = FrameMeta();
+    if (wire_size & Packet::META_FLAG) {
+        size_t n = meta.read_wire(ext, len);
+        if (n == 0) return false;
+        ext += n;
+        len -= n;
+    }
+    if (len && !(wire_size & Packet::TRACE_FLAG)) return false;
+    return trace.read_wire(ext, len);
+}
+
+// PooledPacket — Packet variant backed by a pooled, refcounted PacketBuf
+// (packet-pool.h). The buffer reserves head- and tailroom so framing and
+// encryption happen in place, and a received payload is handed over without
+// a copy. Obtain one from InterconnectNode::make_packet() or the PooledPacket
+// overload of recv_from_upstream(). Copies share the buffer; the send
+// overloads take the packet by rvalue and clone only if the buffer is shared.
+struct PooledPacket {
+    uint32_t call_id = 0;
+    uint32_t payload_size = 0;
+    PacketBufRef buf;
+    PacketTrace trace;
+    FrameMeta meta;
+
+    uint8_t* payload() { return buf ? buf->payload() : nullptr; }
+    const uint8_t* payload() const { return buf ? buf->payload() : nullptr; }
+    size_t capacity() const { return buf ? buf->payload_capacity() : 0; }
+
+    // Set the payload length within the buffer's capacity, e.g. after
+    // recvfrom() straight into payload().
+    bool resize(uint32_t size) {
+        if (size > capacity() || size > Packet::MAX_PAYLOAD_SIZE) return false;
+        payload_size = size;
+        return true;
+    }
+
+    bool is_valid() const {
+        return call_id != 0 && buf && payload_size <= Packet::MAX_PAYLOAD_SIZE &&
+               payload_size <= capacity();
+    }
+
+    Packet to_packet() const {
+        Packet p(call_id, payload(), payload_size);
+        p.trace = trace;
+        p.meta = meta;
+        return p;
+    }
+};
+
+inline const uint8_t* packet_payload_ptr(const Packet& p) { return p.payload.data(); }
+inline const uint8_t* packet_payload_ptr(const PooledPacket& p) { return p.payload(); }
+
 enum class ConnectionState {
     DISCONNECTED,
     CONNECTING,
@@ -487,37 +630,63 @@ enum class ConnectionState {
 // Format: 1-byte type, then type-specific payload.
 enum class MgmtMsgType : uint8_t {
     CALL_END       = 1,   // payload: 4 bytes call_id
-    SPEECH_ACTIVE  = 2,   // payload: 4 bytes call_id
-    SPEECH_IDLE    = 3,   // payload: 4 bytes call_id
+    SPEECH_ACTIVE  = 2,   // payload: 4 bytes call_id [, 8 bytes ts_us, 1 byte origin]
+    SPEECH_IDLE    = 3,   // payload: 4 bytes call_id [, 8 bytes ts_us, 1 byte origin]
     PING           = 4,   // no payload (keepalive probe)
     PONG           = 5,   // no payload (keepalive response)
+    CREDIT         = 6,   // receiver → sender: call_id, bytes, frames consumed (flow-control.h)
     CUSTOM         = 10,  // payload: 2-byte len + string
 };
 
 // InterconnectNode — per-service TCP communication hub.
 //
 // Lifecycle:
-//   initialize()              → bind listen sockets, start 3 background threads.
-//   connect_to_downstream()   → one-shot attempt; reconnect_loop retries forever.
+//   initialize()              → bind listen sockets, start the reactor and connector.
+//   connect_to_downstream()   → one-shot attempt; the reactor retries forever.
 //   send_to_downstream(pkt)   → send data packet to next service in pipeline.
 //   recv_from_upstream(pkt)   → blocking receive from previous service (with timeout).
 //   broadcast_call_end(id)    → notify downstream chain that a call has terminated.
-//   broadcast_speech_signal() → propagate VAD SPEECH_ACTIVE/IDLE downstream.
+//   broadcast_speech_signal() → publish VAD SPEECH_ACTIVE/IDLE on the speech
+//                               bus and propagate it downstream.
 //   shutdown()                → close all sockets, join threads (idempotent).
 //
-// Thread model (3 background threads per node):
-//   accept_thread_:              waits for upstream to connect on our listen ports;
-//                                polls for dead connections and resets them.
-//   downstream_connect_thread_:  polls downstream state; reconnects every 200ms on failure.
-//   mgmt_recv_thread_:           reads typed messages from upstream mgmt socket;
-//                                dispatches call_end / speech / ping / custom handlers.
+// Thread model (2 background threads per node, both asleep while idle):
+//   loop_ (EventLoop):   edge-triggered readiness on the listen sockets (accept),
+//                        the upstream mgmt socket (reads typed messages and
+//                        dispatches call_end / speech / ping / custom handlers,
+//                        so handlers run on this thread) and hangup of every
+//                        data/mgmt connection. Downstream reconnects are
+//                        armed as loop timers.
+//   connector_thread_:   performs the blocking connect + shm / sample-rate
+//                        negotiation the loop hands it, so a slow or cyclic
+//                        peer never stalls mgmt dispatch.
+// recv_from_upstream() waits on a condition variable while disconnected and
+// returns as soon as the upstream connection is accepted. Service code can
+// put its own fds on the node's loop via event_loop().
+//
+// Replicated stages (stage_replica_count > 1): the upstream node holds one
+// DownstreamConnection per replica and route_call() pins every call to one
+// of them by rendezvous hash; data and CALL_END/SPEECH signals for the call
+// only go there, and the call fails over if that replica drops. The stage
+// after the replicas accepts one upstream peer per replica (fan-in) and
+// recv_from_upstream() reads from whichever has a frame.
+//
+// Flow control (flow-control.h): recv_from_upstream() grants consumed bytes
+// back to the sender as CREDIT frames on the mgmt connection, which the
+// sender's loop reads, so every downstream link knows its per-call bytes in
+// flight. downstream_window_open() lets producers shed or hold back before a
+// slow consumer turns into a send timeout; flow_report() exports the
+// per-link in-flight bytes, queue depth and stall time.
 //
 // Safety: All socket accesses are guarded by per-direction mutexes. Sockets are
 // closed with shutdown(SHUT_RDWR) before close() so blocked threads unblock.
 class InterconnectNode {
 public:
-    InterconnectNode(ServiceType type) 
+    // instance > 0 runs this node as a replica of its stage on that
+    // instance's ports (see service_base_port(type, instance)).
+    InterconnectNode(ServiceType type, uint8_t instance = 0)
         : type_(type), 
+          instance_(instance < MAX_STAGE_REPLICAS ? instance : 0),
           running_(false),
           max_known_call_id_(0),
           mgmt_listen_sock_(-1),
@@ -531,6 +700,7 @@ public:
 
     ~InterconnectNode() {
         shutdown();
+        pool_->release();
     }
 
     bool initialize() {
@@ -539,11 +709,17 @@ public:
             return true;
         }
 
-        uint16_t mgmt_port = service_mgmt_port(type_);
-        uint16_t data_port = service_data_port(type_);
+        uint16_t mgmt_port = service_mgmt_port(type_, instance_);
+        uint16_t data_port = service_data_port(type_, instance_);
+        if (max_upstream_peers_ == 0) max_upstream_peers_ = stage_replica_count(upstream_of(type_));
+
+        // Unix listeners first: a peer that finds the TCP port open while
+        // they are missing would fall back to TCP for the whole link.
+        open_unix_listeners(mgmt_port, data_port);
 
         mgmt_listen_sock_ = create_listen_socket(mgmt_port);
         if (mgmt_listen_sock_ < 0) {
+            close_unix_listeners();
             std::fprintf(stderr, "[%s] Failed to bind mgmt port %u\n",
                         service_type_to_string(type_), mgmt_port);
             return false;
@@ -552,6 +728,7 @@ public:
         data_listen_sock_ = create_listen_socket(data_port);
         if (data_listen_sock_ < 0) {
             close_socket(mgmt_listen_sock_);
+            close_unix_listeners();
             std::fprintf(stderr, "[%s] Failed to bind data port %u\n",
                         service_type_to_string(type_), data_port);
             return false;
@@ -559,42 +736,112 @@ public:
 
         running_ = true;
 
-        accept_thread_ = std::thread(&InterconnectNode::accept_loop, this);
+        if (!loop_.start()) {
+            running_ = false;
+            close_socket(mgmt_listen_sock_);
+            close_socket(data_listen_sock_);
+            close_unix_listeners();
+            std::fprintf(stderr, "[%s] Failed to start event loop\n", service_type_to_string(type_));
+            return false;
+        }
+        loop_.watch(mgmt_listen_sock_, EventLoop::READABLE,
+                    [this](int, uint32_t) { accept_upstream(true); });
+        loop_.watch(data_listen_sock_, EventLoop::READABLE,
+                    [this](int, uint32_t) { accept_upstream(false); });
+        watch_unix_listeners();
+        if (speech_bus_enabled_.load(std::memory_order_relaxed)) open_speech_bus();
+        connector_thread_ = std::thread(&InterconnectNode::connector_loop, this);
         if (downstream_connections_.empty() && !connect_disabled_) {
-            downstream_connect_thread_ = std::thread(&InterconnectNode::downstream_connect_loop, this);
+            ServiceType ds;
+            bool overridden;
+            {
+                std::lock_guard<std::mutex> lock(state_mutex_);
+                overridden = downstream_override_.has_value();
+                ds = downstream_override_.value_or(downstream_of(type_));
+            }
+            int replicas = stage_replica_count(ds);
+            if (!overridden && replicas > 1) {
+                // Replicated downstream: the default send/signal path shards
+                // calls over the replicas instead of one fixed connection.
+                add_downstream_replicas(ds, replicas);
+                routed_target_ = ds;
+                routed_default_ = true;
+                connect_all_downstreams();
+            } else {
+                schedule_connect(nullptr, 0);
+            }
         }
-        mgmt_recv_thread_ = std::thread(&InterconnectNode::mgmt_recv_loop, this);
 
-        std::fprintf(stderr, "[%s] Interconnect ready: mgmt=%u data=%u\n",
-                    service_type_to_string(type_), mgmt_port, data_port);
+        std::fprintf(stderr, "[%s] Interconnect ready: mgmt=%u data=%u%s\n",
+                    service_type_to_string(type_), mgmt_port, data_port,
+                    instance_ ? (" instance=" + std::to_string(instance_)).c_str() : "");
         return true;
     }
 
     void shutdown() {
         if (!running_.exchange(false)) return;
 
-        close_socket(upstream_mgmt_accepted_);
-        close_socket(upstream_data_accepted_);
-        close_socket(downstream_mgmt_sock_);
-        close_socket(downstream_data_sock_);
+        close_unix_listeners();
         close_socket(mgmt_listen_sock_);
         close_socket(data_listen_sock_);
 
-        for (auto& dc : downstream_connections_) {
-            close_socket(dc->data_sock);
-            close_socket(dc->mgmt_sock);
+        // Under the link mutexes: a connect or accept still in flight either
+        // published its sockets before this, or sees running_ false and
+        // closes them itself. Otherwise the peer would never see a hangup.
+        {
+            std::lock_guard<std::mutex> lock(upstream_mutex_);
+            close_socket(upstream_mgmt_accepted_);
+            close_socket(upstream_data_accepted_);
+            reset_shm(upstream_shm_);
+            for (int& fd : extra_upstream_mgmt_) close_socket(fd);
+            for (int& fd : extra_upstream_data_) close_socket(fd);
+            extra_upstream_mgmt_.clear();
+            extra_upstream_data_.clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(downstream_mutex_);
+            close_socket(downstream_mgmt_sock_);
+            close_socket(downstream_data_sock_);
+            reset_shm(downstream_shm_);
         }
 
         for (auto& dc : downstream_connections_) {
-            if (dc->reconnect_thread.joinable()) dc->reconnect_thread.join();
+            {
+                std::lock_guard<std::mutex> lock(dc->data_send_mutex);
+                close_socket(dc->data_sock);
+                reset_shm(dc->shm);
+            }
+            std::lock_guard<std::mutex> lock(dc->mgmt_send_mutex);
+            close_socket(dc->mgmt_sock);
         }
 
-        if (accept_thread_.joinable()) accept_thread_.join();
-        if (downstream_connect_thread_.joinable()) downstream_connect_thread_.join();
-        if (mgmt_recv_thread_.joinable()) mgmt_recv_thread_.join();
+        loop_.stop();
+        loop_.unwatch(speech_bus_.fd());
+        speech_bus_.close();
+        {
+            std::lock_guard<std::mutex> lock(connect_mutex_);
+            connect_queue_.clear();
+        }
+        connect_cv_.notify_all();
+        upstream_cv_.notify_all();
+        downstream_cv_.notify_all();
+        if (connector_thread_.joinable()) connector_thread_.join();
     }
 
     ServiceType type() const { return type_; }
+    uint8_t instance() const { return instance_; }
+
+    // Upstream peers accepted at once: >1 lets the replicas of the upstream
+    // stage all feed this node (fan-in). Defaults to
+    // stage_replica_count(upstream_of(type)); call before initialize().
+    void set_max_upstream_peers(int n) {
+        max_upstream_peers_ = n < 1 ? 1 : (n < MAX_STAGE_REPLICAS ? n : MAX_STAGE_REPLICAS);
+    }
+
+    size_t upstream_peer_count() const {
+        std::lock_guard<std::mutex> lock(upstream_mutex_);
+        return (upstream_data_accepted_ >= 0 ? 1 : 0) + extra_upstream_data_.size();
+    }
 
     void set_downstream_override(ServiceType override_type) {
         std::lock_guard<std::mutex> lock(state_mutex_);
@@ -612,6 +859,14 @@ public:
     }
 
     ConnectionState downstream_state() const {
+        if (routed_default_) {
+            for (const auto& dc : downstream_connections_) {
+                if (dc->state.load(std::memory_order_relaxed) == ConnectionState::CONNECTED) {
+                    return ConnectionState::CONNECTED;
+                }
+            }
+            return ConnectionState::DISCONNECTED;
+        }
         std::lock_guard<std::mutex> lock(state_mutex_);
         return downstream_state_;
     }
@@ -622,6 +877,10 @@ public:
     bool connect_to_downstream() {
         if (!is_pipeline_service(type_)) return false;
         if (connect_disabled_) return false;
+        if (routed_default_) {
+            connect_all_downstreams();
+            return downstream_state() == ConnectionState::CONNECTED;
+        }
 
         ServiceType ds;
         {
@@ -636,60 +895,98 @@ public:
             downstream_state_ = ConnectionState::CONNECTING;
         }
 
-        int mgmt_sock = connect_to_port_with_timeout("127.0.0.1", ds_mgmt, CONNECT_TIMEOUT_MS);
+        int mgmt_sock = connect_channel(ds_mgmt, false);
         if (mgmt_sock < 0) {
             std::lock_guard<std::mutex> lock(state_mutex_);
             downstream_state_ = ConnectionState::DISCONNECTED;
             return false;
         }
 
-        int data_sock = connect_to_port_with_timeout("127.0.0.1", ds_data, CONNECT_TIMEOUT_MS);
+        int data_sock = connect_channel(ds_data, true);
         if (data_sock < 0) {
-            ::close(mgmt_sock);
+            close_socket(mgmt_sock);
             std::lock_guard<std::mutex> lock(state_mutex_);
             downstream_state_ = ConnectionState::DISCONNECTED;
             return false;
         }
+        IcUnixMode transport = ic_socket_transport(data_sock);
 
-        setup_socket_options(mgmt_sock);
-        setup_socket_options(data_sock);
+        // Negotiated before the sockets are published, so no data frame can
+        // have been sent over TCP yet when the ring takes over.
+        auto shm = negotiate_shm(mgmt_sock, data_sock);
+        bool ktls = !shm && transport == IcUnixMode::OFF && negotiate_ktls(mgmt_sock, data_sock);
+        uint32_t accepts = 0;
+        bool typed = negotiate_typed_header(mgmt_sock, accepts);
 
         {
             std::lock_guard<std::mutex> lock(downstream_mutex_);
+            if (!running_) {
+                close_socket(mgmt_sock);
+                close_socket(data_sock);
+                std::lock_guard<std::mutex> sl(state_mutex_);
+                downstream_state_ = ConnectionState::DISCONNECTED;
+                return false;
+            }
             close_socket(downstream_mgmt_sock_);
             close_socket(downstream_data_sock_);
+            reset_shm(downstream_shm_);
             downstream_mgmt_sock_ = mgmt_sock;
             downstream_data_sock_ = data_sock;
+            downstream_shm_ = shm;
+            downstream_typed_hdr_ = typed;
+            downstream_accepts_.store(accepts, std::memory_order_relaxed);
+            downstream_seq_reset_ = true;
+            downstream_flow_.reset();
+            // CONNECTED before the watches are armed: a hangup reported from
+            // here on marks the link failed and is not overwritten.
+            {
+                std::lock_guard<std::mutex> sl(state_mutex_);
+                downstream_state_ = ConnectionState::CONNECTED;
+            }
+            loop_.watch(mgmt_sock, EventLoop::READABLE | EventLoop::HANGUP,
+                        [this](int fd, uint32_t) { on_downstream_mgmt_readable(fd); });
+            loop_.watch(data_sock, EventLoop::HANGUP,
+                        [this](int fd, uint32_t) { on_downstream_hangup(fd); });
         }
+        downstream_cv_.notify_all();
 
-        {
-            std::lock_guard<std::mutex> lock(state_mutex_);
-            downstream_state_ = ConnectionState::CONNECTED;
-        }
-
-        std::fprintf(stderr, "[%s] Connected to downstream %s (mgmt=%u data=%u)\n",
+        std::fprintf(stderr, "[%s] Connected to downstream %s (mgmt=%u data=%u via %s)\n",
                     service_type_to_string(type_),
-                    service_type_to_string(ds), ds_mgmt, ds_data);
+                    service_type_to_string(ds), ds_mgmt, ds_data,
+                    shm ? "shm" : ktls ? "kTLS" : ic_unix_mode_name(transport));
         return true;
     }
 
     // Send a data packet to our downstream neighbor (next in pipeline).
     // SIP -> IAP: SIP calls send_to_downstream, which writes to IAP's data_listen.
+    // With a replicated downstream stage the packet goes to the replica that
+    // owns its call (see route_call()).
     bool send_to_downstream(const Packet& pkt) {
-        std::lock_guard<std::mutex> lock(send_downstream_mutex_);
-        int sock;
-        {
-            std::lock_guard<std::mutex> dl(downstream_mutex_);
-            sock = downstream_data_sock_;
-        }
-        if (sock < 0) return false;
+        if (routed_default_) return send_downstream_impl(pkt, routed_target_);
+        return send_downstream_impl(pkt);
+    }
 
-        auto data = pkt.serialize();
-        if (!send_encrypted(sock, data.data(), data.size(), DATA_SEND_TIMEOUT_MS)) {
-            mark_downstream_failed();
-            return false;
+    // Pooled variant: frames (and encrypts) in the packet's own buffer.
+    bool send_to_downstream(PooledPacket&& pkt) {
+        PooledPacket p(std::move(pkt));
+        if (routed_default_) return send_downstream_impl(p, routed_target_);
+        return send_downstream_impl(p);
+    }
+
+    // Sends a tick's worth of frames (e.g. OAP's 20 ms frame for every
+    // active call) on the default downstream link with as few syscalls as
+    // the transport allows: gathered stream writes, sendmmsg() on SEQPACKET,
+    // ring pushes on shm. Each packet is stamped and accounted as
+    // send_to_downstream() would, and framed in place, so the packets are
+    // spent either way. Returns how many were sent; a routed default link
+    // sends them one by one.
+    size_t send_batch_to_downstream(std::vector<PooledPacket>& pkts) {
+        if (routed_default_) {
+            size_t sent = 0;
+            for (auto& p : pkts) sent += send_downstream_impl(p, routed_target_) ? 1 : 0;
+            return sent;
         }
-        return true;
+        return send_batch_impl(pkts);
     }
 
     // Send a data packet back to upstream neighbor (reverse direction, e.g. OAP -> SIP).
@@ -702,8 +999,7 @@ public:
         }
         if (sock < 0) return false;
 
-        auto data = pkt.serialize();
-        if (!send_encrypted(sock, data.data(), data.size(), DATA_SEND_TIMEOUT_MS)) {
+        if (!send_frame(sock, pkt, nullptr, false, DATA_SEND_TIMEOUT_MS)) {
             mark_upstream_failed();
             return false;
         }
@@ -711,38 +1007,70 @@ public:
     }
 
     // Receive data from upstream neighbor (they connected to our data_listen port).
+    // Every frame returned counts as consumed for flow control; a receive
+    // that times out flushes the grants still pending.
     bool recv_from_upstream(Packet& pkt, int timeout_ms = 100) {
-        int sock;
-        {
-            std::lock_guard<std::mutex> lock(upstream_mutex_);
-            sock = upstream_data_accepted_;
-        }
-        if (sock < 0) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
-            return false;
-        }
-        bool ok = recv_packet(sock, pkt, timeout_ms);
-        if (!ok) {
-            std::lock_guard<std::mutex> lock(upstream_mutex_);
-            if (upstream_data_accepted_ == sock && is_socket_dead(sock)) {
-                mark_upstream_failed_locked();
-            }
-        }
+        bool ok = recv_upstream_impl(pkt, timeout_ms);
+        if (ok) on_upstream_frame(pkt.call_id, pkt.payload_size, pkt.meta);
+        else flush_credits();
+        return ok;
+    }
+
+    // Pooled variant: the frame is read straight into a pool buffer and the
+    // payload is handed over without a copy.
+    bool recv_from_upstream(PooledPacket& pkt, int timeout_ms = 100) {
+        bool ok = recv_upstream_impl(pkt, timeout_ms);
+        if (ok) on_upstream_frame(pkt.call_id, pkt.payload_size, pkt.meta);
+        else flush_credits();
         return ok;
     }
 
+    // Batched receive for hops of small frames (OAP -> SIP, SIP -> IAP):
+    // waits up to timeout_ms for the first frame, then appends every frame
+    // already waiting behind it, up to `max`. On a stream socket one poll()
+    // and one recv() pick up the whole burst; the frames are copied out of a
+    // read-ahead buffer into pool buffers (see RxStage). shm and SEQPACKET
+    // links are drained frame by frame, a fan-in stage takes one frame. The
+    // single-frame recv_from_upstream() calls may be mixed in freely.
+    // Returns the number of packets appended to out.
+    size_t recv_batch_from_upstream(std::vector<PooledPacket>& out, size_t max, int timeout_ms = 100) {
+        const size_t before = out.size();
+        recv_upstream_batch_impl(out, max, timeout_ms);
+        for (size_t i = before; i < out.size(); i++) {
+            on_upstream_frame(out[i].call_id, out[i].payload_size, out[i].meta);
+        }
+        if (out.size() == before) flush_credits();
+        return out.size() - before;
+    }
+
+    // Allocate a pooled packet with room for `payload_size` bytes. Returns an
+    // invalid packet (no buffer) if the size exceeds Packet::MAX_PAYLOAD_SIZE.
+    PooledPacket make_packet(uint32_t call_id, size_t payload_size) {
+        PooledPacket p;
+        p.call_id = call_id;
+        if (payload_size > Packet::MAX_PAYLOAD_SIZE) return p;
+        p.buf = pool_->acquire(payload_size);
+        if (p.buf) p.payload_size = static_cast<uint32_t>(payload_size);
+        return p;
+    }
+
+    PacketPool& packet_pool() { return *pool_; }
+
+    // The node's reactor; running between initialize() and shutdown().
+    EventLoop& event_loop() { return loop_; }
+
     // Receive data from downstream neighbor (we connected to their data_listen, they reply).
     bool recv_from_downstream(Packet& pkt, int timeout_ms = 100) {
         int sock;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
         {
-            std::lock_guard<std::mutex> lock(downstream_mutex_);
+            std::unique_lock<std::mutex> lock(downstream_mutex_);
+            downstream_cv_.wait_until(lock, deadline,
+                [this] { return downstream_data_sock_ >= 0 || !running_; });
             sock = downstream_data_sock_;
         }
-        if (sock < 0) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
-            return false;
-        }
-        bool ok = recv_packet(sock, pkt, timeout_ms);
+        if (sock < 0) return false;
+        bool ok = recv_frame(sock, pkt, remaining_ms(deadline));
         if (!ok) {
             std::lock_guard<std::mutex> lock(downstream_mutex_);
             if (downstream_data_sock_ == sock && is_socket_dead(sock)) {
@@ -777,6 +1105,7 @@ public:
         {
             std::lock_guard<std::mutex> lock(speech_mutex_);
             speech_active_calls_.erase(call_id);
+            speech_signal_ts_.erase(call_id);
         }
 
         if (!already_ended && call_end_handler_) {
@@ -790,25 +1119,60 @@ public:
         call_end_handler_ = handler;
     }
 
+    // Publishes on the speech bus first, so every subscribed stage starts
+    // flushing before the mgmt relay has left this node. Both copies carry
+    // the same timestamp; receivers act on whichever arrives first.
     void broadcast_speech_signal(uint32_t call_id, bool active) {
+        SpeechSignal sig;
+        sig.call_id = call_id;
+        sig.active = active;
+        sig.origin = static_cast<uint8_t>(type_);
+        sig.ts_us = PacketTrace::now_us();
         {
             std::lock_guard<std::mutex> lock(speech_mutex_);
             if (active) speech_active_calls_.insert(call_id);
             else speech_active_calls_.erase(call_id);
+            if (!speech_signal_ts_.count(call_id)) prune_speech_signal_ts_locked();
+            speech_signal_ts_[call_id] = {sig.ts_us, sig.origin};
         }
+        speech_bus_.publish(sig);
 
         if (speech_signal_handler_) {
             speech_signal_handler_(call_id, active);
         }
 
         MgmtMsgType msg_type = active ? MgmtMsgType::SPEECH_ACTIVE : MgmtMsgType::SPEECH_IDLE;
-        send_mgmt_to_downstream(msg_type, call_id);
+        send_mgmt_to_downstream(msg_type, call_id, sig.ts_us, sig.origin);
+    }
+
+    // Records <origin>.SIG > <this>.ACT for the last speech signal applied
+    // to call_id: the time from the publisher's broadcast to this service
+    // having acted on it (OAP: stale audio flushed, i.e. interrupt-to-
+    // silence). Call from the speech signal handler once the action is done.
+    void mark_speech_handled(uint32_t call_id) {
+        SignalStamp stamp;
+        {
+            std::lock_guard<std::mutex> lock(speech_mutex_);
+            auto it = speech_signal_ts_.find(call_id);
+            if (it == speech_signal_ts_.end()) return;
+            stamp = it->second;
+        }
+        PacketTrace::Hop from{stamp.origin, HopLatencyTable::DIR_SIGNAL, stamp.ts_us};
+        record_hop(from, static_cast<uint8_t>(type_), HopLatencyTable::DIR_ACTION, PacketTrace::now_us());
     }
 
     void register_speech_signal_handler(std::function<void(uint32_t, bool)> handler) {
         speech_signal_handler_ = handler;
     }
 
+    // Subscribe to and publish on the speech bus (default on, see
+    // speech-bus.h for WHISPERTALK_SPEECH_BUS). Call before initialize().
+    void set_speech_bus(bool enabled) {
+        speech_bus_enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool speech_bus_active() const { return speech_bus_.fd() >= 0; }
+
     void register_custom_negotiation_handler(std::function<std::string(const std::string&)> handler) {
         custom_handler_ = handler;
     }
@@ -837,6 +1201,7 @@ public:
 
     // Send a custom command to our downstream's mgmt channel and wait for response.
     std::string send_custom_to_downstream(const std::string& msg, int timeout_ms = CUSTOM_MSG_TIMEOUT_MS) {
+        if (routed_default_) return send_custom_to_downstream(msg, routed_target_, timeout_ms);
         int sock;
         {
             std::lock_guard<std::mutex> lock(downstream_mutex_);
@@ -844,96 +1209,76 @@ public:
         }
         if (sock < 0) return "";
 
-        uint16_t len = static_cast<uint16_t>(std::min(msg.size(), (size_t)65535));
-        std::vector<uint8_t> buf(3 + len);
-        buf[0] = static_cast<uint8_t>(MgmtMsgType::CUSTOM);
-        uint16_t net_len = htons(len);
-        memcpy(buf.data() + 1, &net_len, 2);
-        memcpy(buf.data() + 3, msg.data(), len);
-
         std::lock_guard<std::mutex> lock(send_downstream_mgmt_mutex_);
-        if (!send_encrypted(sock, buf.data(), buf.size(), timeout_ms)) return "";
+        return exchange_custom(sock, msg, timeout_ms, &downstream_flow_);
+    }
 
-        std::vector<uint8_t> resp_plain;
-        if (!recv_encrypted(sock, resp_plain, timeout_ms)) return "";
-        if (resp_plain.size() < 3) return "";
-        if (resp_plain[0] != static_cast<uint8_t>(MgmtMsgType::CUSTOM)) return "";
-        uint16_t resp_len;
-        memcpy(&resp_len, resp_plain.data() + 1, 2);
-        resp_len = ntohs(resp_len);
-        if (resp_len == 0 || resp_plain.size() < (size_t)(3 + resp_len)) return "";
+    // Adds one connection per replica of the target stage
+    // (stage_replica_count); per-call routing picks among them.
+    void add_downstream_target(ServiceType target) {
+        add_downstream_replicas(target, stage_replica_count(target));
+    }
 
-        return std::string(reinterpret_cast<char*>(resp_plain.data() + 3), resp_len);
+    void add_downstream_replicas(ServiceType target, int count) {
+        if (count < 1) count = 1;
+        if (count > MAX_STAGE_REPLICAS) count = MAX_STAGE_REPLICAS;
+        for (int i = 0; i < count; i++) {
+            downstream_connections_.push_back(
+                std::make_unique<DownstreamConnection>(target, static_cast<uint8_t>(i)));
+        }
     }
 
-    void add_downstream_target(ServiceType target) {
-        downstream_connections_.push_back(std::make_unique<DownstreamConnection>(target));
+    // Calls moved to another replica because their owner went away.
+    uint64_t call_failovers() const { return call_failovers_.load(std::memory_order_relaxed); }
+
+    // Replica instance currently owning call_id towards target, -1 if none.
+    int routed_instance(ServiceType target, uint32_t call_id) const {
+        std::lock_guard<std::mutex> lock(route_mutex_);
+        auto it = call_routes_.find(route_key(target, call_id));
+        return it == call_routes_.end() ? -1 : it->second->instance;
     }
 
     void connect_all_downstreams() {
         for (auto& dc : downstream_connections_) {
-            dc->reconnect_thread = std::thread(&InterconnectNode::connect_to_downstream_dc, this, std::ref(*dc));
+            schedule_connect(dc.get(), 0);
         }
     }
 
     bool send_to_downstream(const Packet& pkt, ServiceType target) {
-        for (auto& dc : downstream_connections_) {
-            if (dc->target != target) continue;
-            if (dc->state.load(std::memory_order_relaxed) != ConnectionState::CONNECTED) return false;
-
-            std::lock_guard<std::mutex> lock(dc->data_send_mutex);
-            int sock = dc->data_sock;
-            if (sock < 0) return false;
+        return send_downstream_impl(pkt, target);
+    }
 
-            auto data = pkt.serialize();
-            if (!send_encrypted(sock, data.data(), data.size(), DATA_SEND_TIMEOUT_MS)) {
-                close_socket(dc->data_sock);
-                dc->state.store(ConnectionState::DISCONNECTED, std::memory_order_relaxed);
-                return false;
-            }
-            return true;
-        }
-        return false;
+    bool send_to_downstream(PooledPacket&& pkt, ServiceType target) {
+        PooledPacket p(std::move(pkt));
+        return send_downstream_impl(p, target);
     }
 
     void broadcast_mgmt_to_all_downstreams(MgmtMsgType msg_type, uint32_t call_id) {
         send_mgmt_to_downstream(msg_type, call_id);
     }
 
+    // Replicated targets: goes to the first connected replica.
     std::string send_custom_to_downstream(const std::string& msg, ServiceType target, int timeout_ms = CUSTOM_MSG_TIMEOUT_MS) {
         for (auto& dc : downstream_connections_) {
             if (dc->target != target) continue;
-            if (dc->state.load(std::memory_order_relaxed) != ConnectionState::CONNECTED) return "";
-
-            uint16_t len = static_cast<uint16_t>(std::min(msg.size(), (size_t)65535));
-            std::vector<uint8_t> buf(3 + len);
-            buf[0] = static_cast<uint8_t>(MgmtMsgType::CUSTOM);
-            uint16_t net_len = htons(len);
-            memcpy(buf.data() + 1, &net_len, 2);
-            memcpy(buf.data() + 3, msg.data(), len);
+            if (dc->state.load(std::memory_order_relaxed) != ConnectionState::CONNECTED) continue;
 
             std::lock_guard<std::mutex> lock(dc->mgmt_send_mutex);
             int sock = dc->mgmt_sock;
             if (sock < 0) return "";
-            if (!send_encrypted(sock, buf.data(), buf.size(), timeout_ms)) {
+            if (!send_custom_frame(sock, msg, timeout_ms)) {
                 close_socket(dc->mgmt_sock);
-                dc->state.store(ConnectionState::DISCONNECTED, std::memory_order_relaxed);
+                mark_dc_failed(*dc);
                 return "";
             }
 
             std::vector<uint8_t> resp_plain;
-            if (!recv_encrypted(sock, resp_plain, timeout_ms)) {
+            if (!recv_custom_reply(sock, resp_plain, timeout_ms, &dc->flow)) {
                 close_socket(dc->mgmt_sock);
-                dc->state.store(ConnectionState::DISCONNECTED, std::memory_order_relaxed);
+                mark_dc_failed(*dc);
                 return "";
             }
-            if (resp_plain.size() < 3) return "";
-            if (resp_plain[0] != static_cast<uint8_t>(MgmtMsgType::CUSTOM)) return "";
-            uint16_t resp_len;
-            memcpy(&resp_len, resp_plain.data() + 1, 2);
-            resp_len = ntohs(resp_len);
-            if (resp_len == 0 || resp_plain.size() < (size_t)(3 + resp_len)) return "";
-            return std::string(reinterpret_cast<char*>(resp_plain.data() + 3), resp_len);
+            return parse_custom_frame(resp_plain);
         }
         return "";
     }
@@ -942,68 +1287,403 @@ public:
         connect_disabled_ = true;
     }
 
-    uint32_t negotiated_sample_rate_for(ServiceType target) const {
-        for (const auto& dc : downstream_connections_) {
-            if (dc->target == target) {
-                uint32_t rate = dc->negotiated_sample_rate.load(std::memory_order_relaxed);
-                if (rate != 0) return rate;
-                if (target == ServiceType::VAD_SERVICE) return 16000;
-                if (target == ServiceType::MOSHI_SERVICE) return 24000;
-                return 0;
-            }
-        }
-        if (target == ServiceType::VAD_SERVICE) return 16000;
-        if (target == ServiceType::MOSHI_SERVICE) return 24000;
-        return 0;
+    // Offer the shared-memory data path to downstream peers on the next
+    // (re)connect. Defaults to ic_shm_enabled_default() (WHISPERTALK_IC_SHM).
+    // Ignored while IC encryption is enabled: the ring carries plaintext.
+    void set_shm_transport(bool enabled) {
+        shm_enabled_ = enabled;
     }
 
-    std::vector<std::tuple<ServiceType, ConnectionState, uint32_t>> downstream_connection_states() const {
-        std::vector<std::tuple<ServiceType, ConnectionState, uint32_t>> result;
+    bool downstream_shm_active() const {
+        std::lock_guard<std::mutex> lock(downstream_mutex_);
+        return downstream_shm_ != nullptr;
+    }
+
+    // Offer kernel TLS for the data socket on the next (re)connect while IC
+    // encryption is enabled. Defaults to ic_ktls_enabled_default()
+    // (WHISPERTALK_IC_KTLS). Falls back to userspace AES-GCM when either
+    // kernel lacks the tls module or the peer declines.
+    void set_ktls_transport(bool enabled) {
+        ktls_enabled_ = enabled;
+    }
+
+    // Transport for downstream links opened from now on (defaults to
+    // ic_unix_mode_default(), WHISPERTALK_IC_UNIX). OFF keeps TCP.
+    void set_unix_transport(IcUnixMode mode) {
+        if (mode == IcUnixMode::SEQPACKET && !IC_UNIX_SEQPACKET_SUPPORTED) mode = IcUnixMode::STREAM;
+        unix_mode_ = mode;
+    }
+
+    // Transport of the current downstream data socket (OFF: TCP or none).
+    IcUnixMode downstream_transport() const {
+        std::lock_guard<std::mutex> lock(downstream_mutex_);
+        return downstream_data_sock_ >= 0 ? ic_socket_transport(downstream_data_sock_) : IcUnixMode::OFF;
+    }
+
+    bool downstream_ktls_active() const {
+        std::lock_guard<std::mutex> lock(downstream_mutex_);
+        return downstream_data_sock_ >= 0 && ktls_socks_.contains(downstream_data_sock_);
+    }
+
+    bool downstream_shm_active(ServiceType target) const {
         for (const auto& dc : downstream_connections_) {
-            result.emplace_back(
-                dc->target,
-                dc->state.load(std::memory_order_relaxed),
-                dc->negotiated_sample_rate.load(std::memory_order_relaxed)
-            );
+            if (dc->target != target) continue;
+            std::lock_guard<std::mutex> lock(dc->data_send_mutex);
+            return dc->shm != nullptr;
         }
-        return result;
+        return false;
     }
 
-private:
-    ServiceType type_;
-    std::atomic<bool> running_;
-    std::optional<ServiceType> downstream_override_;
-    static constexpr size_t SEND_BUF_SIZE = 65536;
-    static constexpr int DOWNSTREAM_RECONNECT_MS = 200;
-    static constexpr size_t MAX_ENDED_CALL_IDS = 1000;
-    static constexpr int ACCEPT_POLL_TIMEOUT_MS = 50;
-    static constexpr int IDLE_POLL_MS = 100;
-    static constexpr int MGMT_RECV_TIMEOUT_MS = 500;
-    static constexpr int MGMT_SEND_TIMEOUT_MS = 100;
-    static constexpr int DATA_SEND_TIMEOUT_MS = 100;
-    static constexpr int CONNECT_TIMEOUT_MS = 2000;
-    static constexpr int CUSTOM_MSG_TIMEOUT_MS = 2000;
-    static constexpr int PAYLOAD_RECV_TIMEOUT_MS = 5000;
-    static constexpr int LISTEN_BACKLOG = 4;
-    static constexpr int TCP_KEEPALIVE_IDLE_S = 2;
-    static constexpr int TCP_KEEPALIVE_INTVL_S = 1;
-    static constexpr int TCP_KEEPALIVE_CNT = 2;
+    bool upstream_shm_active() const {
+        std::lock_guard<std::mutex> lock(upstream_mutex_);
+        return upstream_shm_ != nullptr;
+    }
 
-    mutable std::mutex call_id_mutex_;
-    uint32_t max_known_call_id_;
-    std::set<uint32_t> active_call_ids_;
-    std::set<uint32_t> ended_call_ids_;
+    // Append each packet's PacketTrace to outgoing data frames (default on,
+    // WHISPERTALK_IC_TRACE=0 turns it off). Both ends of a hop must run a
+    // build that understands TRACE_FLAG.
+    void set_trace_propagation(bool enabled) {
+        trace_wire_.store(enabled, std::memory_order_relaxed);
+    }
 
-    int mgmt_listen_sock_;
-    int data_listen_sock_;
+    // Per-hop latency histograms fed by the traces of received packets.
+    const HopLatencyTable& hop_latency() const { return hop_latency_; }
+
+    // Reply for the HOP_LATENCY cmd-port command (all values in µs):
+    //   HOP_LATENCY:<SVC>:PAIRS:<n>:DROPPED:<n>
+    //   HOP:<from>><to>:N:<count>:P50_US:<v>:P95_US:<v>:P99_US:<v>:MAX_US:<v>:MEAN_US:<v>
+    //   ...
+    // Hops are named <SVC>.<IN|OUT|ARR>, e.g. "SIP.IN>IAP.ARR". Speech
+    // signals add <SVC>.SIG (published) > <SVC>.ARR (delivered here) and
+    // > <SVC>.ACT (acted on, see mark_speech_handled()).
+    std::string hop_latency_report() const {
+        std::string lines;
+        int pairs = 0;
+        hop_latency_.for_each([&](uint32_t key, const LatencyHistogram& h) {
+            char buf[256];
+            snprintf(buf, sizeof(buf),
+                "HOP:%s.%s>%s.%s:N:%llu:P50_US:%llu:P95_US:%llu:P99_US:%llu:MAX_US:%llu:MEAN_US:%.0f\n",
+                PacketTrace::service_type_name(HopLatencyTable::key_from_svc(key)),
+                hop_dir_name(HopLatencyTable::key_from_dir(key)),
+                PacketTrace::service_type_name(HopLatencyTable::key_to_svc(key)),
+                hop_dir_name(HopLatencyTable::key_to_dir(key)),
+                (unsigned long long)h.count(),
+                (unsigned long long)h.percentile(0.50),
+                (unsigned long long)h.percentile(0.95),
+                (unsigned long long)h.percentile(0.99),
+                (unsigned long long)h.max(),
+                h.mean());
+            lines += buf;
+            pairs++;
+        });
+        char head[128];
+        snprintf(head, sizeof(head), "HOP_LATENCY:%s:PAIRS:%d:DROPPED:%llu\n",
+                 PacketTrace::service_type_name(static_cast<uint8_t>(type_)), pairs,
+                 (unsigned long long)hop_latency_.dropped_pairs());
+        return head + lines;
+    }
+
+    // Per-call credit window in bytes (defaults to ic_flow_window_default(),
+    // WHISPERTALK_IC_WINDOW_KB). Only this, the sending side, enforces it.
+    void set_flow_window(size_t bytes) {
+        flow_window_.store(bytes > 0 ? bytes : 1, std::memory_order_relaxed);
+    }
+
+    size_t flow_window() const { return flow_window_.load(std::memory_order_relaxed); }
+
+    // Whether call_id has less than a window of data in flight towards the
+    // default downstream (or target's replica owning the call). Sends are
+    // never refused; producers that can drop or delay data check this first.
+    bool downstream_window_open(uint32_t call_id) {
+        FlowWindow* flow = default_flow_for(call_id);
+        return !flow || flow->is_open(call_id, flow_window());
+    }
+
+    bool downstream_window_open(uint32_t call_id, ServiceType target) {
+        DownstreamConnection* dc = route_call(target, call_id);
+        return !dc || dc->flow.is_open(call_id, flow_window());
+    }
+
+    // Blocks for up to timeout_ms until call_id's window towards the default
+    // downstream opens. Returns whether it did.
+    bool wait_downstream_window(uint32_t call_id, int timeout_ms) {
+        FlowWindow* flow = default_flow_for(call_id);
+        return !flow || flow->wait_open(call_id, flow_window(), timeout_ms);
+    }
+
+    // Producers report frames they dropped because the window was closed,
+    // so shedding shows up in the link's telemetry.
+    void note_shed(uint32_t call_id, size_t bytes) {
+        FlowWindow* flow = default_flow_for(call_id);
+        if (flow) flow->on_shed(bytes);
+    }
+
+    void note_shed(uint32_t call_id, size_t bytes, ServiceType target) {
+        DownstreamConnection* dc = route_call(target, call_id);
+        if (dc) dc->flow.on_shed(bytes);
+    }
+
+    // Flow telemetry of the default downstream link, summed over the
+    // replicas when that stage is replicated.
+    FlowWindow::Stats downstream_flow_stats() const {
+        size_t window = flow_window();
+        if (!routed_default_) return downstream_flow_.stats(window);
+        FlowWindow::Stats sum;
+        for (const auto& dc : downstream_connections_) {
+            if (dc->target == routed_target_) sum.add(dc->flow.stats(window));
+        }
+        return sum;
+    }
+
+    FlowWindow::Stats downstream_flow_stats(ServiceType target, uint8_t instance = 0) const {
+        for (const auto& dc : downstream_connections_) {
+            if (dc->target == target && dc->instance == instance) return dc->flow.stats(flow_window());
+        }
+        return FlowWindow::Stats();
+    }
+
+    // Reply for the FLOW cmd-port command:
+    //   FLOW:<SVC>:LINKS:<n>:WINDOW:<bytes>
+    //   LINK:<TARGET>#<i>:STATE:<connected|disconnected>:INFLIGHT:<bytes>:QUEUED:<frames>
+    //        :CALLS:<n>:CLOSED:<n>:PEAK:<bytes>:STALL_US:<us>:STALLS:<n>:OVERRUNS:<n>
+    //        :SHED:<frames>:SHED_BYTES:<bytes>:CREDITS:<n>:TYPED:<0|1>   (one line per link)
+    //   RX:FRAMES:<n>:LOST:<n>:REORDERED:<n>:RESTARTS:<n>
+    // CLOSED counts calls at or over the window right now; OVERRUNS counts
+    // frames sent while their window was already closed. TYPED says whether
+    // the link negotiated typed headers; RX sums the sequence checks of
+    // typed frames received from upstream (see frame_seq_stats()).
+    std::string flow_report() const {
+        size_t window = flow_window();
+        std::string lines;
+        int links = 0;
+        for_each_link([&](ServiceType target, uint8_t instance, bool connected, const FlowWindow::Stats& s,
+                          bool typed) {
+            char buf[512];
+            snprintf(buf, sizeof(buf),
+                "LINK:%s#%u:STATE:%s:INFLIGHT:%llu:QUEUED:%llu:CALLS:%llu:CLOSED:%llu:PEAK:%llu"
+                ":STALL_US:%llu:STALLS:%llu:OVERRUNS:%llu:SHED:%llu:SHED_BYTES:%llu:CREDITS:%llu"
+                ":TYPED:%d\n",
+                PacketTrace::service_type_name(static_cast<uint8_t>(target)), instance,
+                connected ? "connected" : "disconnected",
+                (unsigned long long)s.in_flight_bytes, (unsigned long long)s.queued_frames,
+                (unsigned long long)s.calls, (unsigned long long)s.closed_calls,
+                (unsigned long long)s.peak_in_flight_bytes, (unsigned long long)s.stall_us,
+                (unsigned long long)s.stalls, (unsigned long long)s.overruns,
+                (unsigned long long)s.shed_frames, (unsigned long long)s.shed_bytes,
+                (unsigned long long)s.credits, typed ? 1 : 0);
+            lines += buf;
+            links++;
+        });
+        SeqTracker::Stats rx = seq_tracker_.stats();
+        char head[128], tail[160];
+        snprintf(head, sizeof(head), "FLOW:%s:LINKS:%d:WINDOW:%zu\n",
+                 PacketTrace::service_type_name(static_cast<uint8_t>(type_)), links, window);
+        snprintf(tail, sizeof(tail), "RX:FRAMES:%llu:LOST:%llu:REORDERED:%llu:RESTARTS:%llu\n",
+                 (unsigned long long)rx.frames, (unsigned long long)rx.lost,
+                 (unsigned long long)rx.reordered, (unsigned long long)rx.restarts);
+        return head + lines + tail;
+    }
+
+    // Reply for the METRICS (Prometheus text) and METRICS:JSON cmd-port
+    // commands: the process-wide registry of metrics.h plus this node's hop
+    // latency histograms, downstream links and upstream sequence checks, all
+    // labelled service="<SVC>". Link series carry link="<TARGET>#<i>".
+    std::string metrics_report(bool json = false) const {
+        MetricsWriter w(json, {{"service", PacketTrace::service_type_name(static_cast<uint8_t>(type_))}});
+        metrics().collect(w);
+        hop_latency_.for_each([&](uint32_t key, const LatencyHistogram& h) {
+            std::string from = std::string(PacketTrace::service_type_name(HopLatencyTable::key_from_svc(key))) +
+                               "." + hop_dir_name(HopLatencyTable::key_from_dir(key));
+            std::string to = std::string(PacketTrace::service_type_name(HopLatencyTable::key_to_svc(key))) +
+                             "." + hop_dir_name(HopLatencyTable::key_to_dir(key));
+            w.histogram("whispertalk_hop_latency_us", "Latency between two pipeline hops (µs)",
+                        {{"from", from}, {"to", to}}, h);
+        });
+        w.counter("whispertalk_hop_dropped_pairs_total", "Hop pairs not tracked because the table was full", {},
+                  static_cast<double>(hop_latency_.dropped_pairs()));
+        w.gauge("whispertalk_ic_window_bytes", "Per-call credit window", {}, static_cast<double>(flow_window()));
+        for_each_link([&](ServiceType target, uint8_t instance, bool connected, const FlowWindow::Stats& s,
+                          bool typed) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s#%u", PacketTrace::service_type_name(static_cast<uint8_t>(target)),
+                     instance);
+            MetricLabels l{{"link", name}};
+            w.gauge("whispertalk_ic_link_up", "Downstream link connected", l, connected ? 1 : 0);
+            w.gauge("whispertalk_ic_link_typed", "Downstream link negotiated typed headers", l, typed ? 1 : 0);
+            w.gauge("whispertalk_ic_inflight_bytes", "Bytes sent and not yet credited", l,
+                    static_cast<double>(s.in_flight_bytes));
+            w.gauge("whispertalk_ic_queued_frames", "Frames sent and not yet credited", l,
+                    static_cast<double>(s.queued_frames));
+            w.gauge("whispertalk_ic_calls", "Calls with data in flight", l, static_cast<double>(s.calls));
+            w.gauge("whispertalk_ic_closed_calls", "Calls at or over their window", l,
+                    static_cast<double>(s.closed_calls));
+            w.gauge("whispertalk_ic_peak_inflight_bytes", "Peak bytes in flight", l,
+                    static_cast<double>(s.peak_in_flight_bytes));
+            w.counter("whispertalk_ic_stalls_total", "Sends that blocked on a closed window", l,
+                      static_cast<double>(s.stalls));
+            w.counter("whispertalk_ic_stall_us_total", "Time spent in blocked sends (µs)", l,
+                      static_cast<double>(s.stall_us));
+            w.counter("whispertalk_ic_overruns_total", "Frames sent while their window was closed", l,
+                      static_cast<double>(s.overruns));
+            w.counter("whispertalk_ic_shed_frames_total", "Frames dropped by producers instead of sent", l,
+                      static_cast<double>(s.shed_frames));
+            w.counter("whispertalk_ic_shed_bytes_total", "Bytes dropped by producers instead of sent", l,
+                      static_cast<double>(s.shed_bytes));
+            w.counter("whispertalk_ic_credits_total", "CREDIT frames applied", l, static_cast<double>(s.credits));
+        });
+        SeqTracker::Stats rx = seq_tracker_.stats();
+        w.counter("whispertalk_ic_rx_frames_total", "Typed frames received from upstream", {},
+                  static_cast<double>(rx.frames));
+        w.counter("whispertalk_ic_rx_lost_total", "Frames missing from their call's sequence", {},
+                  static_cast<double>(rx.lost));
+        w.counter("whispertalk_ic_rx_reordered_total", "Frames received out of sequence", {},
+                  static_cast<double>(rx.reordered));
+        w.counter("whispertalk_ic_rx_restarts_total", "Sequence restarts (sender reconnected)", {},
+                  static_cast<double>(rx.restarts));
+        return w.finish();
+    }
+
+    // Sequence checks over the typed frames received from upstream: frames
+    // missing from, or arriving out of, their call's per-hop sequence.
+    SeqTracker::Stats frame_seq_stats() const { return seq_tracker_.stats(); }
+
+    // Negotiate typed frame headers (frame-meta.h) with downstream peers on
+    // the next (re)connect. Defaults to ic_typed_hdr_default()
+    // (WHISPERTALK_IC_TYPED_HDR, on unless "0"). A peer that predates them
+    // keeps the link untyped.
+    void set_typed_headers(bool enabled) {
+        typed_hdr_enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool downstream_typed_headers() const {
+        std::lock_guard<std::mutex> lock(downstream_mutex_);
+        return downstream_typed_hdr_;
+    }
+
+    // Receiver side: this node decodes payload type `t` on top of the ones
+    // every service handles (e.g. the compact encodings of pcm-wire.h).
+    // Offered to upstream peers in the typed-header handshake, so call it
+    // before initialize().
+    void accept_payload_type(PayloadType t) {
+        accepted_types_.fetch_or(1u << static_cast<uint8_t>(t), std::memory_order_relaxed);
+    }
+
+    // Receiver side: this node understands FrameMeta flags `f`
+    // (FRAME_FLAG_*). Offered like the payload types, so call it before
+    // initialize().
+    void accept_frame_flags(uint8_t f) {
+        accepted_types_.fetch_or(static_cast<uint32_t>(f) << FRAME_FLAGS_ACCEPT_SHIFT, std::memory_order_relaxed);
+    }
+
+    // Sender side: whether the downstream peer offered `t` when it last
+    // connected. For a target with replicas, every replica must have.
+    bool downstream_accepts(PayloadType t) const {
+        return downstream_accepts_bits(1u << static_cast<uint8_t>(t));
+    }
+
+    bool downstream_accepts(PayloadType t, ServiceType target) const {
+        return downstream_accepts_bits(1u << static_cast<uint8_t>(t), target);
+    }
+
+    // Same for FrameMeta flags: true only if the peer offered all of `f`.
+    bool downstream_accepts_flags(uint8_t f) const {
+        return downstream_accepts_bits(static_cast<uint32_t>(f) << FRAME_FLAGS_ACCEPT_SHIFT);
+    }
+
+    bool downstream_accepts_bits(uint32_t bits) const {
+        if (routed_default_) return downstream_accepts_bits(bits, routed_target_);
+        return (downstream_accepts_.load(std::memory_order_relaxed) & bits) == bits;
+    }
+
+    bool downstream_accepts_bits(uint32_t bits, ServiceType target) const {
+        bool any = false;
+        for (const auto& dc : downstream_connections_) {
+            if (dc->target != target) continue;
+            if ((dc->accepts.load(std::memory_order_relaxed) & bits) != bits) return false;
+            any = true;
+        }
+        return any;
+    }
+
+    uint32_t negotiated_sample_rate_for(ServiceType target) const {
+        for (const auto& dc : downstream_connections_) {
+            if (dc->target == target) {
+                uint32_t rate = dc->negotiated_sample_rate.load(std::memory_order_relaxed);
+                if (rate != 0) return rate;
+                if (target == ServiceType::VAD_SERVICE) return 16000;
+                if (target == ServiceType::MOSHI_SERVICE) return 24000;
+                return 0;
+            }
+        }
+        if (target == ServiceType::VAD_SERVICE) return 16000;
+        if (target == ServiceType::MOSHI_SERVICE) return 24000;
+        return 0;
+    }
+
+    std::vector<std::tuple<ServiceType, ConnectionState, uint32_t>> downstream_connection_states() const {
+        std::vector<std::tuple<ServiceType, ConnectionState, uint32_t>> result;
+        for (const auto& dc : downstream_connections_) {
+            result.emplace_back(
+                dc->target,
+                dc->state.load(std::memory_order_relaxed),
+                dc->negotiated_sample_rate.load(std::memory_order_relaxed)
+            );
+        }
+        return result;
+    }
+
+private:
+    ServiceType type_;
+    uint8_t instance_;
+    std::atomic<bool> running_;
+    std::optional<ServiceType> downstream_override_;
+    static constexpr size_t SEND_BUF_SIZE = 65536;
+    static constexpr int DOWNSTREAM_RECONNECT_MS = 200;
+    static constexpr size_t MAX_ENDED_CALL_IDS = 1000;
+    static constexpr size_t MAX_ROUTED_CALLS = 4096;
+    static constexpr int FAN_IN_SHM_SLICE_MS = 2;
+    static constexpr int MGMT_RECV_TIMEOUT_MS = 500;
+    static constexpr int MGMT_SEND_TIMEOUT_MS = 100;
+    static constexpr int MGMT_BUSY_RETRY_MS = 5;
+    static constexpr int DATA_SEND_TIMEOUT_MS = 100;
+    static constexpr int CONNECT_TIMEOUT_MS = 2000;
+    static constexpr int CUSTOM_MSG_TIMEOUT_MS = 2000;
+    static constexpr int PAYLOAD_RECV_TIMEOUT_MS = 5000;
+    static constexpr int LISTEN_BACKLOG = 4;
+    static constexpr int TCP_KEEPALIVE_IDLE_S = 2;
+    static constexpr int TCP_KEEPALIVE_INTVL_S = 1;
+    static constexpr int TCP_KEEPALIVE_CNT = 2;
+
+    mutable std::mutex call_id_mutex_;
+    uint32_t max_known_call_id_;
+    std::set<uint32_t> active_call_ids_;
+    std::set<uint32_t> ended_call_ids_;
+
+    int mgmt_listen_sock_;
+    int data_listen_sock_;
 
     mutable std::mutex upstream_mutex_;
     int upstream_mgmt_accepted_;
     int upstream_data_accepted_;
+    // Fan-in: further upstream peers beyond the primary slots above (TCP
+    // only; the shm ring is bound to the primary data slot). When a primary
+    // slot frees up the oldest extra is promoted into it.
+    int max_upstream_peers_ = 0;   // 0 = stage_replica_count(upstream_of(type_))
+    std::vector<int> extra_upstream_mgmt_;
+    std::vector<int> extra_upstream_data_;
+    std::atomic<uint32_t> upstream_rr_{0};
 
     mutable std::mutex downstream_mutex_;
     int downstream_mgmt_sock_;
     int downstream_data_sock_;
+    FlowWindow downstream_flow_;   // the single-downstream link's window
+    // Typed headers on the single-downstream link. The flags are guarded by
+    // downstream_mutex_; downstream_seq_ by send_downstream_mutex_, and a
+    // (re)connect only flags it for reset by the next send.
+    bool downstream_typed_hdr_ = false;
+    bool downstream_seq_reset_ = false;
+    std::atomic<uint32_t> downstream_accepts_{0};
+    SeqStamper downstream_seq_;
 
     std::mutex send_downstream_mutex_;
     std::mutex send_upstream_mutex_;
@@ -1014,97 +1694,218 @@ private:
     ConnectionState upstream_state_;
     ConnectionState downstream_state_;
 
-    std::thread accept_thread_;
-    std::thread downstream_connect_thread_;
-    std::thread mgmt_recv_thread_;
+    // loop_ is declared before every socket member's user and destroyed
+    // after shutdown() has stopped it. upstream_cv_ pairs with
+    // upstream_mutex_, downstream_cv_ with downstream_mutex_.
+    EventLoop loop_;
+    std::condition_variable upstream_cv_;
+    std::condition_variable downstream_cv_;
+
+    static constexpr int MAX_FRAME_IOV = 4;   // segments per sendmsg/readv frame
+    static constexpr int MAX_BATCH_IOV = 512; // segments per batched sendmsg (< IOV_MAX)
+    static constexpr size_t RX_STAGE_BYTES = 64 * 1024;
+    // Largest length prefix accepted: header, payload, extensions and the
+    // AES-GCM IV and tag.
+    static constexpr uint32_t MAX_FRAME_BYTES = Packet::MAX_PAYLOAD_SIZE + 8 + MAX_EXT_BYTES +
+        prodigy_tls::IC_GCM_IV_LEN + prodigy_tls::IC_GCM_TAG_LEN;
+
+    // Shared-memory data path (interconnect-shm.h). downstream_shm_ is guarded
+    // by downstream_mutex_, upstream_shm_ by upstream_mutex_; each is dropped
+    // whenever the matching data socket is closed.
+    static constexpr int SHM_OFFER_ATTEMPTS = 10;
+    static constexpr int SHM_OFFER_RETRY_MS = 50;
+    bool shm_enabled_ = ic_shm_enabled_default();
+
+    PacketPool* pool_ = PacketPool::create();   // released in ~InterconnectNode
+    std::shared_ptr<ShmRing> downstream_shm_;
+    std::shared_ptr<ShmRing> upstream_shm_;
+
+    // Upstream bytes read ahead by recv_batch_from_upstream(): whole frames
+    // of `sock` only, handed out before the socket is read again. Owned by
+    // the receiving thread, like the data socket reads themselves.
+    struct RxStage {
+        int sock = -1;
+        std::vector<uint8_t> buf;
+        size_t head = 0;
+        size_t tail = 0;
+        bool has_frames(int s) const { return sock == s && head < tail; }
+    };
+    RxStage rx_stage_;
+
+    // A small fd set, looked up lock-free on each frame. Sockets are
+    // registered before their first frame and dropped in close_socket().
+    class SocketSet {
+    public:
+        static constexpr int SLOTS = 32;
+        SocketSet() { for (auto& s : slots_) s.store(-1, std::memory_order_relaxed); }
+        bool add(int fd) {
+            for (auto& s : slots_) {
+                int expected = -1;
+                if (s.compare_exchange_strong(expected, fd)) {
+                    count_.fetch_add(1);
+                    return true;
+                }
+            }
+            return false;
+        }
+        void remove(int fd) {
+            if (count_.load() == 0) return;
+            for (auto& s : slots_) {
+                int expected = fd;
+                if (s.compare_exchange_strong(expected, -1)) count_.fetch_sub(1);
+            }
+        }
+        bool contains(int fd) const {
+            if (count_.load() == 0) return false;
+            for (const auto& s : slots_) {
+                if (s.load() == fd) return true;
+            }
+            return false;
+        }
+    private:
+        std::atomic<int> slots_[SLOTS];
+        std::atomic<int> count_{0};
+    };
+    static constexpr int KTLS_OFFER_ATTEMPTS = 10;
+    static constexpr int KTLS_OFFER_RETRY_MS = 50;
+    bool ktls_enabled_ = prodigy_tls::ic_ktls_enabled_default();
+    // Kernel TLS (tls_cert.h): data sockets whose stream the kernel seals.
+    // Frames on them skip userspace AES-GCM.
+    SocketSet ktls_socks_;
+
+    // Unix domain transport (interconnect-unix.h). Frames on SOCK_SEQPACKET
+    // sockets carry no length prefix.
+    IcUnixMode unix_mode_ = ic_unix_mode_default();
+    int unix_listen_socks_[2][2] = {{-1, -1}, {-1, -1}};   // [mgmt, data][stream, seqpacket]
+    SocketSet seqpacket_socks_;
+
+    std::atomic<bool> trace_wire_{ic_trace_wire_default()};
+    HopLatencyTable hop_latency_;
+
+    std::vector<uint8_t> mgmt_plain_;   // loop thread only; capacity persists across messages
+    std::vector<uint8_t> downstream_mgmt_plain_;   // loop thread only
+
+    // Flow control: flow_window_ is the per-call window this node enforces
+    // as a sender; credit_ledger_ holds grants owed to upstream peers.
+    std::atomic<size_t> flow_window_{ic_flow_window_default()};
+    CreditLedger credit_ledger_;
+
+    std::atomic<bool> typed_hdr_enabled_{ic_typed_hdr_default()};
+    std::atomic<uint32_t> accepted_types_{0};
+    SeqTracker seq_tracker_;
 
     std::function<void(uint32_t)> call_end_handler_;
     std::function<void(uint32_t, bool)> speech_signal_handler_;
     std::function<std::string(const std::string&)> custom_handler_;
     mutable std::mutex speech_mutex_;
     std::set<uint32_t> speech_active_calls_;
+    struct SignalStamp {
+        uint64_t ts_us = 0;
+        uint8_t origin = 0;
+    };
+    std::map<uint32_t, SignalStamp> speech_signal_ts_;   // last applied signal per call
+    std::atomic<bool> speech_bus_enabled_{speech_bus_default()};
+    SpeechBus speech_bus_;
 
     struct DownstreamConnection {
         ServiceType target;
+        uint8_t instance = 0;
         int mgmt_sock = -1;
         int data_sock = -1;
         std::atomic<ConnectionState> state{ConnectionState::DISCONNECTED};
         std::atomic<uint32_t> negotiated_sample_rate{0};
-        std::mutex data_send_mutex;
+        std::shared_ptr<ShmRing> shm;          // guarded by data_send_mutex
+        bool typed_hdr = false;                // guarded by data_send_mutex
+        std::atomic<uint32_t> accepts{0};      // payload types the peer decodes
+        SeqStamper seq;                        // guarded by data_send_mutex
+        FlowWindow flow;
+        mutable std::mutex data_send_mutex;
         std::mutex mgmt_send_mutex;
-        std::thread reconnect_thread;
 
-        explicit DownstreamConnection(ServiceType t) : target(t) {}
+        DownstreamConnection(ServiceType t, uint8_t i) : target(t), instance(i) {}
     };
 
     std::vector<std::unique_ptr<DownstreamConnection>> downstream_connections_;
     bool connect_disabled_ = false;
 
-    // Accept incoming connections from upstream on our mgmt + data listen ports.
-    void accept_loop() {
-        while (running_) {
-            bool need_mgmt = false, need_data = false;
-            {
-                std::lock_guard<std::mutex> lock(upstream_mutex_);
-                need_mgmt = (upstream_mgmt_accepted_ < 0);
-                need_data = (upstream_data_accepted_ < 0);
-            }
-
-            if (need_mgmt && mgmt_listen_sock_ >= 0) {
-                pollfd pfd = {mgmt_listen_sock_, POLLIN, 0};
-                if (poll(&pfd, 1, ACCEPT_POLL_TIMEOUT_MS) > 0 && (pfd.revents & POLLIN)) {
-                    sockaddr_in addr;
-                    socklen_t len = sizeof(addr);
-                    int accepted = accept(mgmt_listen_sock_, (sockaddr*)&addr, &len);
-                    if (accepted >= 0) {
-                        setup_socket_options(accepted);
-                        std::lock_guard<std::mutex> lock(upstream_mutex_);
-                        close_socket(upstream_mgmt_accepted_);
-                        upstream_mgmt_accepted_ = accepted;
-                        update_upstream_state();
-                        std::fprintf(stderr, "[%s] Upstream mgmt connected\n",
-                                    service_type_to_string(type_));
-                    }
-                }
-            }
+    // Default downstream stage is replicated: send_to_downstream(pkt) and
+    // the mgmt signals go through downstream_connections_ (set in initialize).
+    bool routed_default_ = false;
+    ServiceType routed_target_ = ServiceType::SIP_CLIENT;
+
+    // Sticky call -> replica placement, keyed by route_key(target, call_id).
+    mutable std::mutex route_mutex_;
+    std::map<uint64_t, DownstreamConnection*> call_routes_;
+    std::atomic<uint64_t> call_failovers_{0};
+
+    // Downstream (re)connect requests for connector_thread_; nullptr stands
+    // for the single-downstream connection, anything else for that dc.
+    std::thread connector_thread_;
+    std::mutex connect_mutex_;
+    std::condition_variable connect_cv_;
+    std::vector<DownstreamConnection*> connect_queue_;
+
+    // Accept one waiting upstream connection into a free slot. An occupied
+    // slot leaves the connection in the backlog; it is picked up as soon as
+    // the current one goes away (mark_upstream_failed_locked, hangup). With
+    // fan-in (max_upstream_peers_ > 1) later peers go into the extra slots.
+    void accept_upstream(bool mgmt) {
+        // Edge-triggered listener: keep accepting until the slots are full
+        // or the backlog is empty, or queued peers would wait for a new edge.
+        while (accept_one_upstream(mgmt)) {}
+    }
 
-            if (need_data && data_listen_sock_ >= 0) {
-                pollfd pfd = {data_listen_sock_, POLLIN, 0};
-                if (poll(&pfd, 1, ACCEPT_POLL_TIMEOUT_MS) > 0 && (pfd.revents & POLLIN)) {
-                    sockaddr_in addr;
-                    socklen_t len = sizeof(addr);
-                    int accepted = accept(data_listen_sock_, (sockaddr*)&addr, &len);
-                    if (accepted >= 0) {
-                        setup_socket_options(accepted);
-                        std::lock_guard<std::mutex> lock(upstream_mutex_);
-                        close_socket(upstream_data_accepted_);
-                        upstream_data_accepted_ = accepted;
-                        update_upstream_state();
-                        std::fprintf(stderr, "[%s] Upstream data connected\n",
-                                    service_type_to_string(type_));
-                    }
-                }
+    bool accept_one_upstream(bool mgmt) {
+        int listen_sock = mgmt ? mgmt_listen_sock_ : data_listen_sock_;
+        if (listen_sock < 0 || !running_) return false;
+        {
+            std::lock_guard<std::mutex> lock(upstream_mutex_);
+            if (!running_) return false;
+            int& slot = mgmt ? upstream_mgmt_accepted_ : upstream_data_accepted_;
+            std::vector<int>& extra = mgmt ? extra_upstream_mgmt_ : extra_upstream_data_;
+            if (slot >= 0 && extra.size() + 1 >= static_cast<size_t>(max_upstream_peers_)) return false;
+            // TCP first, then the Unix listeners (stream, seqpacket).
+            const int* unix_listen = unix_listen_socks_[mgmt ? 0 : 1];
+            int accepted = accept(listen_sock, nullptr, nullptr);
+            IcUnixMode transport = IcUnixMode::OFF;
+            for (int i = 0; accepted < 0 && i < 2; i++) {
+                if (unix_listen[i] < 0) continue;
+                accepted = accept(unix_listen[i], nullptr, nullptr);
+                transport = i == 0 ? IcUnixMode::STREAM : IcUnixMode::SEQPACKET;
             }
-
-            if (!need_mgmt && !need_data) {
-                {
-                    std::lock_guard<std::mutex> lock(upstream_mutex_);
-                    if (upstream_mgmt_accepted_ >= 0 && is_socket_dead(upstream_mgmt_accepted_)) {
-                        std::fprintf(stderr, "[%s] Upstream mgmt peer disconnected\n",
-                                    service_type_to_string(type_));
-                        close_socket(upstream_mgmt_accepted_);
-                        update_upstream_state();
-                    }
-                    if (upstream_data_accepted_ >= 0 && is_socket_dead(upstream_data_accepted_)) {
-                        std::fprintf(stderr, "[%s] Upstream data peer disconnected\n",
-                                    service_type_to_string(type_));
-                        close_socket(upstream_data_accepted_);
-                        update_upstream_state();
-                    }
+            if (accepted < 0) return false;
+            // BSD sockets inherit O_NONBLOCK from the listener; reads and
+            // writes below poll() on their own.
+            fcntl(accepted, F_SETFL, fcntl(accepted, F_GETFL, 0) & ~O_NONBLOCK);
+            if (transport == IcUnixMode::OFF) {
+                setup_socket_options(accepted);
+            } else {
+                // Best effort: only send_to_upstream() writes frames here.
+                if (!mgmt && transport == IcUnixMode::SEQPACKET) ic_unix_reserve_sndbuf(accepted, MAX_FRAME_BYTES);
+                if (!setup_unix_socket(accepted, transport, false)) {
+                    ::close(accepted);
+                    return true;
                 }
-                std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_POLL_MS));
             }
+            if (slot < 0) {
+                slot = accepted;
+                if (!mgmt) reset_shm(upstream_shm_);
+            } else {
+                extra.push_back(accepted);
+            }
+            if (mgmt) {
+                loop_.watch(accepted, EventLoop::READABLE,
+                            [this](int fd, uint32_t) { on_upstream_mgmt_readable(fd); });
+            } else {
+                loop_.watch(accepted, EventLoop::HANGUP,
+                            [this](int fd, uint32_t) { on_upstream_data_hangup(fd); });
+            }
+            update_upstream_state();
         }
+        if (!mgmt) upstream_cv_.notify_all();
+        std::fprintf(stderr, "[%s] Upstream %s connected\n",
+                    service_type_to_string(type_), mgmt ? "mgmt" : "data");
+        return true;
     }
 
     void update_upstream_state() {
@@ -1120,183 +1921,300 @@ private:
         upstream_state_ = new_state;
     }
 
-    // Continuously try to connect to downstream neighbor.
-    void downstream_connect_loop() {
-        if (!is_pipeline_service(type_)) return;
+    // Hangup watches only act on a socket with nothing left to read; if data
+    // is still queued, the thread reading it sees EOF and fails the link.
+    void on_upstream_data_hangup(int fd) {
+        {
+            std::lock_guard<std::mutex> lock(upstream_mutex_);
+            if (fd != upstream_data_accepted_) {
+                if (is_socket_dead(fd)) drop_extra_upstream_locked(fd);
+                return;
+            }
+            if (!is_socket_dead(fd)) return;
+            std::fprintf(stderr, "[%s] Upstream data peer disconnected\n",
+                        service_type_to_string(type_));
+            close_socket(upstream_data_accepted_);
+            reset_shm(upstream_shm_);
+            promote_extra_upstream_locked();
+            update_upstream_state();
+        }
+        accept_upstream(false);
+    }
+
+    // Fan-in slots. Both are called with upstream_mutex_ held.
+    bool drop_extra_upstream_locked(int fd) {
+        for (auto* extra : {&extra_upstream_mgmt_, &extra_upstream_data_}) {
+            auto it = std::find(extra->begin(), extra->end(), fd);
+            if (it == extra->end()) continue;
+            close_socket(*it);
+            extra->erase(it);
+            if (running_) loop_.post([this] { accept_upstream(true); accept_upstream(false); });
+            return true;
+        }
+        return false;
+    }
+
+    void promote_extra_upstream_locked() {
+        if (upstream_mgmt_accepted_ < 0 && !extra_upstream_mgmt_.empty()) {
+            upstream_mgmt_accepted_ = extra_upstream_mgmt_.front();
+            extra_upstream_mgmt_.erase(extra_upstream_mgmt_.begin());
+        }
+        if (upstream_data_accepted_ < 0 && !extra_upstream_data_.empty()) {
+            upstream_data_accepted_ = extra_upstream_data_.front();
+            extra_upstream_data_.erase(extra_upstream_data_.begin());
+        }
+    }
+
+    // A failed primary socket takes the whole primary link down (as with a
+    // single upstream); a failed extra only drops itself.
+    void fail_upstream_sock(int sock) {
+        std::lock_guard<std::mutex> lock(upstream_mutex_);
+        if (sock == upstream_mgmt_accepted_ || sock == upstream_data_accepted_) {
+            mark_upstream_failed_locked();
+        } else {
+            drop_extra_upstream_locked(sock);
+        }
+    }
+
+    // Downstream data sockets are only watched for hangup; their mgmt
+    // sockets are read by on_downstream_mgmt_readable / on_dc_mgmt_readable.
+    void on_downstream_hangup(int fd) {
+        std::lock_guard<std::mutex> lock(downstream_mutex_);
+        if (fd != downstream_data_sock_ || !is_socket_dead(fd)) return;
+        std::fprintf(stderr, "[%s] Downstream data connection lost\n", service_type_to_string(type_));
+        mark_downstream_failed_locked();
+    }
+
+    void on_dc_hangup(DownstreamConnection& dc, int fd) {
+        {
+            std::lock_guard<std::mutex> lock(dc.data_send_mutex);
+            if (fd != dc.data_sock || !is_socket_dead(fd)) return;
+        }
+        fail_dc(dc, "data");
+    }
+
+    // The sender's end of a mgmt connection carries CREDIT grants back from
+    // the downstream, and the replies to CUSTOM requests, which the
+    // requester reads itself while holding the mgmt send mutex (skipping
+    // and applying any grant queued ahead of the reply). So the loop only
+    // reads while it holds that mutex; when it is taken it retries shortly
+    // instead of blocking. EOF or a broken frame fails the link.
+    void on_downstream_mgmt_readable(int fd) {
+        std::unique_lock<std::mutex> ml(send_downstream_mgmt_mutex_, std::try_to_lock);
+        if (!ml.owns_lock()) {
+            loop_.run_after(MGMT_BUSY_RETRY_MS, [this, fd] { on_downstream_mgmt_readable(fd); });
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(downstream_mutex_);
+            if (fd != downstream_mgmt_sock_) return;
+        }
+        if (drain_downstream_mgmt(fd, downstream_flow_)) return;
+        ml.unlock();
+        std::lock_guard<std::mutex> lock(downstream_mutex_);
+        if (fd != downstream_mgmt_sock_) return;
+        std::fprintf(stderr, "[%s] Downstream mgmt connection lost\n", service_type_to_string(type_));
+        mark_downstream_failed_locked();
+    }
+
+    void on_dc_mgmt_readable(DownstreamConnection& dc, int fd) {
+        std::unique_lock<std::mutex> ml(dc.mgmt_send_mutex, std::try_to_lock);
+        if (!ml.owns_lock()) {
+            DownstreamConnection* dcp = &dc;
+            loop_.run_after(MGMT_BUSY_RETRY_MS, [this, dcp, fd] { on_dc_mgmt_readable(*dcp, fd); });
+            return;
+        }
+        if (fd != dc.mgmt_sock || drain_downstream_mgmt(fd, dc.flow)) return;
+        ml.unlock();
+        fail_dc(dc, "mgmt");
+    }
 
+    // Reads every complete frame queued on a downstream mgmt socket and
+    // applies the CREDIT grants among them. False on EOF or a broken frame.
+    bool drain_downstream_mgmt(int fd, FlowWindow& flow) {
         while (running_) {
-            ConnectionState ds;
+            pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 0) <= 0) return true;
+            if (!(pfd.revents & POLLIN)) return false;
+            if (!recv_encrypted(fd, downstream_mgmt_plain_, MGMT_RECV_TIMEOUT_MS)) return false;
+            apply_credit(downstream_mgmt_plain_, &flow);
+        }
+        return true;
+    }
+
+    void fail_dc(DownstreamConnection& dc, const char* which) {
+        std::fprintf(stderr, "[%s] Downstream %s#%u %s connection lost\n",
+                    service_type_to_string(type_), service_type_to_string(dc.target),
+                    dc.instance, which);
+        {
+            std::lock_guard<std::mutex> lock(dc.data_send_mutex);
+            close_socket(dc.data_sock);
+            reset_shm(dc.shm);
+        }
+        {
+            std::lock_guard<std::mutex> lock(dc.mgmt_send_mutex);
+            close_socket(dc.mgmt_sock);
+        }
+        mark_dc_failed(dc);
+    }
+
+    // Queue a connect attempt for the connector thread, now or after delay_ms
+    // (via a loop timer). dc == nullptr is the single-downstream connection.
+    void schedule_connect(DownstreamConnection* dc, int delay_ms) {
+        if (delay_ms > 0) {
+            loop_.run_after(delay_ms, [this, dc] { schedule_connect(dc, 0); });
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(connect_mutex_);
+            if (std::find(connect_queue_.begin(), connect_queue_.end(), dc) != connect_queue_.end()) return;
+            connect_queue_.push_back(dc);
+        }
+        connect_cv_.notify_one();
+    }
+
+    void connector_loop() {
+        while (true) {
+            DownstreamConnection* dc;
             {
-                std::lock_guard<std::mutex> lock(state_mutex_);
-                ds = downstream_state_;
+                std::unique_lock<std::mutex> lock(connect_mutex_);
+                connect_cv_.wait(lock, [this] { return !running_ || !connect_queue_.empty(); });
+                if (!running_) return;
+                dc = connect_queue_.front();
+                connect_queue_.erase(connect_queue_.begin());
             }
+            if (connect_disabled_) continue;
 
-            if (ds == ConnectionState::DISCONNECTED || ds == ConnectionState::FAILED) {
-                connect_to_downstream();
+            bool ok;
+            if (dc) {
+                ok = connect_to_downstream_dc(*dc);
             } else {
-                bool dead = false;
-                {
-                    std::lock_guard<std::mutex> lock(downstream_mutex_);
-                    if (downstream_data_sock_ >= 0 && is_socket_dead(downstream_data_sock_)) {
-                        std::fprintf(stderr, "[%s] Downstream data connection lost\n",
-                                    service_type_to_string(type_));
-                        close_socket(downstream_data_sock_);
-                        close_socket(downstream_mgmt_sock_);
-                        dead = true;
-                    }
-                    if (downstream_mgmt_sock_ >= 0 && is_socket_dead(downstream_mgmt_sock_)) {
-                        std::fprintf(stderr, "[%s] Downstream mgmt connection lost\n",
-                                    service_type_to_string(type_));
-                        close_socket(downstream_mgmt_sock_);
-                        close_socket(downstream_data_sock_);
-                        dead = true;
-                    }
-                }
-                if (dead) {
-                    std::lock_guard<std::mutex> sl(state_mutex_);
-                    downstream_state_ = ConnectionState::DISCONNECTED;
-                }
+                ok = !downstream_needs_connect() || connect_to_downstream();
             }
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(DOWNSTREAM_RECONNECT_MS));
+            if (!ok && running_) schedule_connect(dc, DOWNSTREAM_RECONNECT_MS);
         }
     }
 
-    void connect_to_downstream_dc(DownstreamConnection& dc) {
-        if (connect_disabled_) return;
-
-        uint16_t ds_mgmt = service_mgmt_port(dc.target);
-        uint16_t ds_data = service_data_port(dc.target);
-
-        while (running_) {
-            auto st = dc.state.load(std::memory_order_relaxed);
+    // Single downstream link: false while it is up or being connected. A
+    // link marked CONNECTED whose sockets are gone is failed, and needs one.
+    bool downstream_needs_connect() {
+        std::lock_guard<std::mutex> lock(downstream_mutex_);
+        std::lock_guard<std::mutex> sl(state_mutex_);
+        if (downstream_state_ == ConnectionState::CONNECTED &&
+            (downstream_data_sock_ < 0 || downstream_mgmt_sock_ < 0)) {
+            downstream_state_ = ConnectionState::DISCONNECTED;
+        }
+        return downstream_state_ == ConnectionState::DISCONNECTED ||
+               downstream_state_ == ConnectionState::FAILED;
+    }
 
-            if (st == ConnectionState::DISCONNECTED || st == ConnectionState::FAILED) {
-                int mgmt_sock = connect_to_port_with_timeout("127.0.0.1", ds_mgmt, CONNECT_TIMEOUT_MS);
-                if (mgmt_sock < 0) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(DOWNSTREAM_RECONNECT_MS));
-                    continue;
-                }
-                int data_sock = connect_to_port_with_timeout("127.0.0.1", ds_data, CONNECT_TIMEOUT_MS);
-                if (data_sock < 0) {
-                    ::close(mgmt_sock);
-                    std::this_thread::sleep_for(std::chrono::milliseconds(DOWNSTREAM_RECONNECT_MS));
-                    continue;
-                }
+    bool connect_to_downstream_dc(DownstreamConnection& dc) {
+        auto st = dc.state.load(std::memory_order_relaxed);
+        if (st == ConnectionState::CONNECTED) {
+            std::lock_guard<std::mutex> lock(dc.data_send_mutex);
+            if (dc.data_sock < 0) {
+                dc.state.store(ConnectionState::DISCONNECTED, std::memory_order_relaxed);
+                st = ConnectionState::DISCONNECTED;
+            }
+        }
+        if (st != ConnectionState::DISCONNECTED && st != ConnectionState::FAILED) return true;
 
-                setup_socket_options(mgmt_sock);
-                setup_socket_options(data_sock);
+        uint16_t ds_mgmt = service_mgmt_port(dc.target, dc.instance);
+        uint16_t ds_data = service_data_port(dc.target, dc.instance);
 
-                {
-                    std::lock_guard<std::mutex> lock(dc.data_send_mutex);
-                    close_socket(dc.data_sock);
-                    dc.data_sock = data_sock;
-                }
-                {
-                    std::lock_guard<std::mutex> lock(dc.mgmt_send_mutex);
-                    close_socket(dc.mgmt_sock);
-                    dc.mgmt_sock = mgmt_sock;
-                }
+        int mgmt_sock = connect_channel(ds_mgmt, false);
+        if (mgmt_sock < 0) return false;
+        int data_sock = connect_channel(ds_data, true);
+        if (data_sock < 0) {
+            close_socket(mgmt_sock);
+            return false;
+        }
+        IcUnixMode transport = ic_socket_transport(data_sock);
 
-                dc.state.store(ConnectionState::CONNECTED, std::memory_order_relaxed);
-
-                {
-                    std::lock_guard<std::mutex> lock(dc.mgmt_send_mutex);
-                    std::string query = "SAMPLE_RATE_QUERY";
-                    uint16_t len = static_cast<uint16_t>(query.size());
-                    std::vector<uint8_t> buf(3 + len);
-                    buf[0] = static_cast<uint8_t>(MgmtMsgType::CUSTOM);
-                    uint16_t net_len = htons(len);
-                    memcpy(buf.data() + 1, &net_len, 2);
-                    memcpy(buf.data() + 3, query.data(), len);
-
-                    if (send_encrypted(dc.mgmt_sock, buf.data(), buf.size(), CUSTOM_MSG_TIMEOUT_MS)) {
-                        std::vector<uint8_t> resp_plain;
-                        if (recv_encrypted(dc.mgmt_sock, resp_plain, CUSTOM_MSG_TIMEOUT_MS)) {
-                            if (resp_plain.size() >= 3 && resp_plain[0] == static_cast<uint8_t>(MgmtMsgType::CUSTOM)) {
-                                uint16_t resp_len;
-                                memcpy(&resp_len, resp_plain.data() + 1, 2);
-                                resp_len = ntohs(resp_len);
-                                if (resp_len > 0 && resp_plain.size() >= (size_t)(3 + resp_len)) {
-                                    std::string resp(reinterpret_cast<char*>(resp_plain.data() + 3), resp_len);
-                                    auto pos = resp.find("SAMPLE_RATE:");
-                                    if (pos != std::string::npos) {
-                                        try {
-                                            uint32_t rate = static_cast<uint32_t>(std::stoul(resp.substr(pos + 12)));
-                                            dc.negotiated_sample_rate.store(rate, std::memory_order_relaxed);
-                                        } catch (...) {}
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+        auto shm = negotiate_shm(mgmt_sock, data_sock);
+        if (!shm && transport == IcUnixMode::OFF) negotiate_ktls(mgmt_sock, data_sock);
+        uint32_t accepts = 0;
+        bool typed = negotiate_typed_header(mgmt_sock, accepts);
 
-                std::fprintf(stderr, "[%s] Connected to downstream %s (mgmt=%u data=%u rate=%u)\n",
-                            service_type_to_string(type_),
-                            service_type_to_string(dc.target), ds_mgmt, ds_data,
-                            dc.negotiated_sample_rate.load(std::memory_order_relaxed));
-            } else {
-                bool data_dead = false;
-                bool mgmt_dead = false;
-                {
-                    std::lock_guard<std::mutex> lock(dc.data_send_mutex);
-                    if (dc.data_sock >= 0 && is_socket_dead(dc.data_sock)) {
-                        data_dead = true;
-                    }
-                }
-                if (!data_dead) {
-                    std::lock_guard<std::mutex> lock(dc.mgmt_send_mutex);
-                    if (dc.mgmt_sock >= 0 && is_socket_dead(dc.mgmt_sock)) {
-                        mgmt_dead = true;
-                    }
-                }
-                if (data_dead || mgmt_dead) {
-                    std::fprintf(stderr, "[%s] Downstream %s %s connection lost\n",
-                                service_type_to_string(type_), service_type_to_string(dc.target),
-                                data_dead ? "data" : "mgmt");
-                    {
-                        std::lock_guard<std::mutex> lock(dc.data_send_mutex);
-                        close_socket(dc.data_sock);
-                    }
-                    {
-                        std::lock_guard<std::mutex> lock(dc.mgmt_send_mutex);
-                        close_socket(dc.mgmt_sock);
-                    }
-                    dc.state.store(ConnectionState::DISCONNECTED, std::memory_order_relaxed);
-                }
+        DownstreamConnection* dcp = &dc;
+        {
+            std::lock_guard<std::mutex> lock(dc.data_send_mutex);
+            if (!running_) {
+                close_socket(mgmt_sock);
+                close_socket(data_sock);
+                return false;
+            }
+            close_socket(dc.data_sock);
+            reset_shm(dc.shm);
+            dc.data_sock = data_sock;
+            dc.shm = shm;
+            dc.typed_hdr = typed;
+            dc.accepts.store(accepts, std::memory_order_relaxed);
+            dc.seq.reset();
+            dc.flow.reset();
+            // As in connect_to_downstream: CONNECTED before any watch, so a
+            // failure reported by one sticks (fail_dc → mark_dc_failed).
+            dc.state.store(ConnectionState::CONNECTED, std::memory_order_relaxed);
+            loop_.watch(data_sock, EventLoop::HANGUP,
+                        [this, dcp](int fd, uint32_t) { on_dc_hangup(*dcp, fd); });
+        }
+        {
+            std::lock_guard<std::mutex> lock(dc.mgmt_send_mutex);
+            close_socket(dc.mgmt_sock);
+            if (!running_) {
+                close_socket(mgmt_sock);
+                return false;
             }
+            dc.mgmt_sock = mgmt_sock;
+            loop_.watch(mgmt_sock, EventLoop::READABLE | EventLoop::HANGUP,
+                        [this, dcp](int fd, uint32_t) { on_dc_mgmt_readable(*dcp, fd); });
+        }
+        if (dc.state.load(std::memory_order_relaxed) != ConnectionState::CONNECTED) return false;
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(DOWNSTREAM_RECONNECT_MS));
+        {
+            std::lock_guard<std::mutex> lock(dc.mgmt_send_mutex);
+            std::string resp = exchange_custom(dc.mgmt_sock, "SAMPLE_RATE_QUERY", CUSTOM_MSG_TIMEOUT_MS, &dc.flow);
+            auto pos = resp.find("SAMPLE_RATE:");
+            if (pos != std::string::npos) {
+                try {
+                    uint32_t rate = static_cast<uint32_t>(std::stoul(resp.substr(pos + 12)));
+                    dc.negotiated_sample_rate.store(rate, std::memory_order_relaxed);
+                } catch (...) {}
+            }
         }
+
+        std::fprintf(stderr, "[%s] Connected to downstream %s#%u (mgmt=%u data=%u rate=%u via %s)\n",
+                    service_type_to_string(type_),
+                    service_type_to_string(dc.target), dc.instance, ds_mgmt, ds_data,
+                    dc.negotiated_sample_rate.load(std::memory_order_relaxed),
+                    shm ? "shm" : ic_unix_mode_name(transport));
+        return true;
     }
 
-    void mgmt_recv_loop() {
+    // Edge-triggered: drain every complete message queued on the upstream
+    // mgmt socket. EOF or a malformed message fails the upstream link.
+    void on_upstream_mgmt_readable(int sock) {
         while (running_) {
-            int sock;
             {
                 std::lock_guard<std::mutex> lock(upstream_mutex_);
-                sock = upstream_mgmt_accepted_;
-            }
-            if (sock < 0) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_POLL_MS));
-                continue;
+                if (sock != upstream_mgmt_accepted_ &&
+                    std::find(extra_upstream_mgmt_.begin(), extra_upstream_mgmt_.end(), sock) ==
+                        extra_upstream_mgmt_.end()) {
+                    return;
+                }
             }
-
             pollfd pfd = {sock, POLLIN, 0};
-            int pr = poll(&pfd, 1, IDLE_POLL_MS);
-            if (pr <= 0) continue;
-            if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) {
-                mark_upstream_failed();
-                continue;
+            if (poll(&pfd, 1, 0) <= 0) return;
+            if (!(pfd.revents & POLLIN)) {
+                fail_upstream_sock(sock);
+                return;
             }
 
-            std::vector<uint8_t> mgmt_plain;
-            if (!recv_encrypted(sock, mgmt_plain, MGMT_RECV_TIMEOUT_MS)) {
-                mark_upstream_failed();
-                continue;
+            if (!recv_encrypted(sock, mgmt_plain_, MGMT_RECV_TIMEOUT_MS) || mgmt_plain_.empty()) {
+                fail_upstream_sock(sock);
+                return;
             }
-            if (mgmt_plain.empty()) { mark_upstream_failed(); continue; }
+            std::vector<uint8_t>& mgmt_plain = mgmt_plain_;
 
             uint8_t type_byte = mgmt_plain[0];
             MgmtMsgType msg_type = static_cast<MgmtMsgType>(type_byte);
@@ -1314,25 +2232,16 @@ private:
                 case MgmtMsgType::SPEECH_ACTIVE:
                 case MgmtMsgType::SPEECH_IDLE: {
                     if (mgmt_plain.size() < 5) { mark_failed = true; break; }
+                    SpeechSignal sig;
                     uint32_t net_cid;
                     memcpy(&net_cid, mgmt_plain.data() + 1, 4);
-                    uint32_t cid = ntohl(net_cid);
-                    bool active = (msg_type == MgmtMsgType::SPEECH_ACTIVE);
-                    bool changed = false;
-                    {
-                        std::lock_guard<std::mutex> lock(speech_mutex_);
-                        if (active) changed = speech_active_calls_.insert(cid).second;
-                        else changed = speech_active_calls_.erase(cid) > 0;
-                    }
-                    if (changed) {
-                        if (speech_signal_handler_) {
-                            speech_signal_handler_(cid, active);
-                        }
-                        if (type_ != ServiceType::OUTBOUND_AUDIO_PROCESSOR &&
-                            type_ != ServiceType::SIP_CLIENT) {
-                            send_mgmt_to_downstream(msg_type, cid);
-                        }
+                    sig.call_id = ntohl(net_cid);
+                    sig.active = (msg_type == MgmtMsgType::SPEECH_ACTIVE);
+                    if (mgmt_plain.size() >= 14) {
+                        for (int i = 0; i < 8; i++) sig.ts_us = (sig.ts_us << 8) | mgmt_plain[5 + i];
+                        sig.origin = mgmt_plain[13];
                     }
+                    apply_speech_signal(sig);
                     break;
                 }
                 case MgmtMsgType::PING: {
@@ -1352,20 +2261,16 @@ private:
                     std::string response;
                     if (len > 0 && mgmt_plain.size() >= (size_t)(3 + len)) {
                         std::string msg(reinterpret_cast<char*>(mgmt_plain.data() + 3), len);
-                        if (custom_handler_) {
+                        if (msg.compare(0, 3, "IC_") == 0) {
+                            response = handle_interconnect_custom(msg);
+                        } else if (custom_handler_) {
                             response = custom_handler_(msg);
                         }
                     }
 
-                    uint16_t resp_len = static_cast<uint16_t>(std::min(response.size(), (size_t)65535));
-                    std::vector<uint8_t> resp_buf(3 + resp_len);
-                    resp_buf[0] = static_cast<uint8_t>(MgmtMsgType::CUSTOM);
-                    uint16_t net_resp_len = htons(resp_len);
-                    memcpy(resp_buf.data() + 1, &net_resp_len, 2);
-                    if (resp_len > 0) memcpy(resp_buf.data() + 3, response.data(), resp_len);
                     {
                         std::lock_guard<std::mutex> lock(send_upstream_mgmt_mutex_);
-                        send_encrypted(sock, resp_buf.data(), 3 + resp_len, CUSTOM_MSG_TIMEOUT_MS);
+                        send_custom_frame(sock, response, CUSTOM_MSG_TIMEOUT_MS);
                     }
                     break;
                 }
@@ -1376,8 +2281,8 @@ private:
                     break;
             }
             if (mark_failed) {
-                mark_upstream_failed();
-                continue;
+                fail_upstream_sock(sock);
+                return;
             }
         }
     }
@@ -1391,6 +2296,7 @@ private:
     }
 
     void handle_remote_call_end(uint32_t call_id) {
+        seq_tracker_.forget(call_id);
         bool already_ended = false;
         {
             std::lock_guard<std::mutex> lock(call_id_mutex_);
@@ -1402,7 +2308,9 @@ private:
         {
             std::lock_guard<std::mutex> lock(speech_mutex_);
             speech_active_calls_.erase(call_id);
+            speech_signal_ts_.erase(call_id);
         }
+        credit_ledger_.forget(call_id);
 
         if (!already_ended) {
             if (call_end_handler_) {
@@ -1412,25 +2320,96 @@ private:
         }
     }
 
-    void send_mgmt_to_downstream(MgmtMsgType msg_type, uint32_t call_id) {
-        uint8_t buf[5];
-        buf[0] = static_cast<uint8_t>(msg_type);
-        uint32_t net_cid = htonl(call_id);
-        memcpy(buf + 1, &net_cid, 4);
-
-        if (!downstream_connections_.empty()) {
+    // Speech signal from the bus or the upstream mgmt channel (loop thread).
+    // A signal carrying a timestamp is applied only if it is newer than the
+    // last one applied to the call, so the second copy of a signal — and
+    // anything overtaken by a later one — is dropped. Untimed signals (older
+    // peers) fall back to the state-change check alone.
+    void apply_speech_signal(const SpeechSignal& sig) {
+        bool changed = false;
+        {
+            std::lock_guard<std::mutex> lock(speech_mutex_);
+            if (sig.ts_us != 0) {
+                auto it = speech_signal_ts_.find(sig.call_id);
+                if (it != speech_signal_ts_.end() && sig.ts_us <= it->second.ts_us) return;
+                if (it == speech_signal_ts_.end()) prune_speech_signal_ts_locked();
+                speech_signal_ts_[sig.call_id] = {sig.ts_us, sig.origin};
+            }
+            if (sig.active) changed = speech_active_calls_.insert(sig.call_id).second;
+            else changed = speech_active_calls_.erase(sig.call_id) > 0;
+        }
+        if (sig.ts_us != 0) {
+            PacketTrace::Hop from{sig.origin, HopLatencyTable::DIR_SIGNAL, sig.ts_us};
+            record_hop(from, static_cast<uint8_t>(type_), HopLatencyTable::DIR_ARRIVAL, PacketTrace::now_us());
+        }
+        if (!changed) return;
+        if (speech_signal_handler_) {
+            speech_signal_handler_(sig.call_id, sig.active);
+        }
+        // The relay stays on as the fallback for stages without the bus.
+        if (type_ != ServiceType::OUTBOUND_AUDIO_PROCESSOR && type_ != ServiceType::SIP_CLIENT) {
+            send_mgmt_to_downstream(sig.active ? MgmtMsgType::SPEECH_ACTIVE : MgmtMsgType::SPEECH_IDLE,
+                                    sig.call_id, sig.ts_us, sig.origin);
+        }
+    }
+
+    // Replicas that do not own a call still hear its signals on the bus but
+    // never see its CALL_END; drop the oldest half of the table (call ids
+    // only grow) when it gets long.
+    void prune_speech_signal_ts_locked() {
+        if (speech_signal_ts_.size() < MAX_ENDED_CALL_IDS) return;
+        auto it = speech_signal_ts_.begin();
+        std::advance(it, speech_signal_ts_.size() / 2);
+        for (auto e = speech_signal_ts_.begin(); e != it; ++e) speech_active_calls_.erase(e->first);
+        speech_signal_ts_.erase(speech_signal_ts_.begin(), it);
+    }
+
+    void open_speech_bus() {
+        speech_bus_.open_publisher();
+        if (!speech_bus_.open_subscriber()) {
+            std::fprintf(stderr, "[%s] Speech bus unavailable, speech signals use the mgmt relay only\n",
+                        service_type_to_string(type_));
+            return;
+        }
+        loop_.watch(speech_bus_.fd(), EventLoop::READABLE,
+                    [this](int, uint32_t) { on_speech_bus_readable(); });
+    }
+
+    // Edge-triggered: drain the subscriber. Signals this stage would not
+    // have received over mgmt (its own, or from a stage downstream of it)
+    // are ignored.
+    void on_speech_bus_readable() {
+        SpeechSignal sig;
+        while (running_ && speech_bus_.receive(sig)) {
+            if (sig.ts_us == 0 ||
+                !speech_signal_reaches(static_cast<ServiceType>(sig.origin), type_)) continue;
+            apply_speech_signal(sig);
+        }
+    }
+
+    // Replicated targets only get the signal on the replica owning the call.
+    // ts_us / origin are only sent with SPEECH_* signals.
+    void send_mgmt_to_downstream(MgmtMsgType msg_type, uint32_t call_id,
+                                 uint64_t ts_us = 0, uint8_t origin = 0) {
+        if (!downstream_connections_.empty()) {
             for (auto& dc : downstream_connections_) {
+                if (route_call(dc->target, call_id) != dc.get()) continue;
                 if (dc->state.load(std::memory_order_relaxed) != ConnectionState::CONNECTED) continue;
                 std::lock_guard<std::mutex> lock(dc->mgmt_send_mutex);
                 int sock = dc->mgmt_sock;
                 if (sock < 0) continue;
-                if (!send_encrypted(sock, buf, 5, MGMT_SEND_TIMEOUT_MS)) {
+                if (!send_mgmt_frame(sock, msg_type, call_id, MGMT_SEND_TIMEOUT_MS, ts_us, origin)) {
                     close_socket(dc->mgmt_sock);
-                    dc->state.store(ConnectionState::DISCONNECTED, std::memory_order_relaxed);
+                    mark_dc_failed(*dc);
                 }
             }
+            if (msg_type == MgmtMsgType::CALL_END) {
+                for (auto& dc : downstream_connections_) dc->flow.forget(call_id);
+                forget_call_routes(call_id);
+            }
             return;
         }
+        if (msg_type == MgmtMsgType::CALL_END) downstream_flow_.forget(call_id);
 
         int sock;
         {
@@ -1440,250 +2419,1734 @@ private:
         if (sock < 0) return;
 
         std::lock_guard<std::mutex> lock(send_downstream_mgmt_mutex_);
-        send_encrypted(sock, buf, 5, MGMT_SEND_TIMEOUT_MS);
+        send_mgmt_frame(sock, msg_type, call_id, MGMT_SEND_TIMEOUT_MS, ts_us, origin);
+    }
+
+    // Lock order: {upstream,downstream}_mutex_ → state_mutex_ (never reversed).
+    // Caller MUST hold the corresponding connection mutex.
+    // Both free a connection slot, so they also kick the loop: a waiting
+    // upstream connection is accepted, the downstream is redialled.
+    void mark_upstream_failed_locked() {
+        close_socket(upstream_mgmt_accepted_);
+        close_socket(upstream_data_accepted_);
+        reset_shm(upstream_shm_);
+        promote_extra_upstream_locked();
+        update_upstream_state();
+        if (running_) loop_.post([this] { accept_upstream(true); accept_upstream(false); });
+    }
+
+    void mark_downstream_failed_locked() {
+        close_socket(downstream_mgmt_sock_);
+        close_socket(downstream_data_sock_);
+        reset_shm(downstream_shm_);
+        downstream_flow_.reset();
+        {
+            std::lock_guard<std::mutex> sl(state_mutex_);
+            downstream_state_ = ConnectionState::DISCONNECTED;
+        }
+        if (!connect_disabled_ && downstream_connections_.empty()) schedule_connect(nullptr, 0);
+    }
+
+    // Caller has already closed whichever of the dc's sockets failed.
+    void mark_dc_failed(DownstreamConnection& dc) {
+        dc.state.store(ConnectionState::DISCONNECTED, std::memory_order_relaxed);
+        dc.flow.reset();
+        schedule_connect(&dc, 0);
+    }
+
+    void mark_upstream_failed() {
+        std::lock_guard<std::mutex> lock(upstream_mutex_);
+        mark_upstream_failed_locked();
+    }
+
+    void mark_downstream_failed() {
+        std::lock_guard<std::mutex> lock(downstream_mutex_);
+        mark_downstream_failed_locked();
+    }
+
+    static int remaining_ms(std::chrono::steady_clock::time_point deadline) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        return left > 0 ? static_cast<int>(left) : 0;
+    }
+
+    static uint64_t elapsed_us(std::chrono::steady_clock::time_point since) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - since).count());
+    }
+
+    bool is_socket_dead(int fd) {
+        if (fd < 0) return false;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, 0);
+        if (ret > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))) return true;
+        if (ret > 0 && (pfd.revents & POLLIN)) {
+            char probe;
+            ssize_t r = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (r == 0) return true;
+        }
+        return false;
+    }
+
+    // Unix listeners beside the TCP ones (interconnect-unix.h). Not fatal:
+    // without them peers reach this node over TCP.
+    void open_unix_listeners(uint16_t mgmt_port, uint16_t data_port) {
+        const uint16_t ports[2] = {mgmt_port, data_port};
+        const IcUnixMode modes[2] = {IcUnixMode::STREAM, IcUnixMode::SEQPACKET};
+        for (int d = 0; d < 2; d++) {
+            for (int m = 0; m < 2; m++) {
+                unix_listen_socks_[d][m] = ic_unix_listen(ports[d], modes[m], LISTEN_BACKLOG);
+            }
+        }
+    }
+
+    // Connections queued before the event loop ran are accepted on its first
+    // pass.
+    void watch_unix_listeners() {
+        for (int d = 0; d < 2; d++) {
+            for (int m = 0; m < 2; m++) {
+                if (unix_listen_socks_[d][m] < 0) continue;
+                loop_.watch(unix_listen_socks_[d][m], EventLoop::READABLE,
+                            [this, d](int, uint32_t) { accept_upstream(d == 0); });
+            }
+        }
+    }
+
+    void close_unix_listeners() {
+        const uint16_t ports[2] = {service_mgmt_port(type_, instance_), service_data_port(type_, instance_)};
+        const IcUnixMode modes[2] = {IcUnixMode::STREAM, IcUnixMode::SEQPACKET};
+        for (int d = 0; d < 2; d++) {
+            for (int m = 0; m < 2; m++) {
+                if (unix_listen_socks_[d][m] < 0) continue;
+                ic_unix_unlink(ports[d], modes[m]);
+                close_socket(unix_listen_socks_[d][m]);
+            }
+        }
+    }
+
+    // Connects one channel of a downstream link over the configured
+    // transport. SEQPACKET falls back to a Unix stream when the data socket
+    // cannot buffer a maximal frame, and any Unix failure (e.g. a peer
+    // without the socket path) falls back to TCP.
+    int connect_channel(uint16_t port, bool data) {
+        IcUnixMode mode = unix_mode_;
+        if (mode == IcUnixMode::SEQPACKET) {
+            int sock = ic_unix_connect(port, mode, CONNECT_TIMEOUT_MS);
+            if (sock >= 0 && setup_unix_socket(sock, mode, data)) return sock;
+            if (sock >= 0) ::close(sock);
+            mode = IcUnixMode::STREAM;
+        }
+        if (mode == IcUnixMode::STREAM) {
+            int sock = ic_unix_connect(port, mode, CONNECT_TIMEOUT_MS);
+            if (sock >= 0) return sock;
+        }
+        int sock = connect_to_port_with_timeout("127.0.0.1", port, CONNECT_TIMEOUT_MS);
+        if (sock >= 0) setup_socket_options(sock);
+        return sock;
+    }
+
+    // SEQPACKET sockets are registered for prefix-less framing; data
+    // sockets also need a send buffer that holds the largest frame.
+    bool setup_unix_socket(int sock, IcUnixMode mode, bool data) {
+#ifdef SO_NOSIGPIPE
+        int opt = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
+#endif
+        if (mode != IcUnixMode::SEQPACKET) return true;
+        if (data && !ic_unix_reserve_sndbuf(sock, MAX_FRAME_BYTES)) return false;
+        return seqpacket_socks_.add(sock);
+    }
+
+    int create_listen_socket(uint16_t port) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0) return -1;
+
+        int opt = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+
+        if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            ::close(sock);
+            return -1;
+        }
+
+        if (listen(sock, LISTEN_BACKLOG) < 0) {
+            ::close(sock);
+            return -1;
+        }
+
+        // accept_upstream() may be called with nothing pending.
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+        return sock;
+    }
+
+    int connect_to_port_with_timeout(const char* host, uint16_t port, int timeout_ms) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0) return -1;
+
+        int flags = fcntl(sock, F_GETFL, 0);
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr(host);
+        addr.sin_port = htons(port);
+
+        int ret = connect(sock, (sockaddr*)&addr, sizeof(addr));
+        if (ret < 0 && errno != EINPROGRESS) {
+            ::close(sock);
+            return -1;
+        }
+
+        if (ret == 0) {
+            fcntl(sock, F_SETFL, flags);
+            return sock;
+        }
+
+        pollfd pfd = {sock, POLLOUT, 0};
+        int poll_ret = poll(&pfd, 1, timeout_ms);
+
+        if (poll_ret <= 0) {
+            ::close(sock);
+            return -1;
+        }
+
+        int error = 0;
+        socklen_t errlen = sizeof(error);
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &errlen);
+        if (error != 0) {
+            ::close(sock);
+            return -1;
+        }
+
+        fcntl(sock, F_SETFL, flags);
+        return sock;
+    }
+
+    void setup_socket_options(int sock) {
+#ifdef SO_NOSIGPIPE
+        int opt = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
+#endif
+        int opt_tcp = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt_tcp, sizeof(opt_tcp));
+
+        // Enable TCP keepalive for fast dead-peer detection.
+        int keepalive = 1;
+        setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+#ifdef TCP_KEEPIDLE
+        int idle = TCP_KEEPALIVE_IDLE_S;
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+#endif
+#ifdef TCP_KEEPINTVL
+        int intvl = TCP_KEEPALIVE_INTVL_S;
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+#endif
+#ifdef TCP_KEEPCNT
+        int cnt = TCP_KEEPALIVE_CNT;
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
+#endif
+    }
+
+    bool send_all_with_timeout(int sock, const void* data, size_t len, int timeout_ms) {
+        iovec iov = {const_cast<void*>(data), len};
+        return send_all_iov(sock, &iov, 1, timeout_ms);
+    }
+
+    // Gather-send up to MAX_FRAME_IOV segments as one stream write. The first
+    // sendmsg is attempted without waiting; poll() is only entered when the
+    // socket buffer is full. Partial writes advance through the iovec array.
+    bool send_all_iov(int sock, const iovec* iov_in, int iovcnt, int timeout_ms) {
+        iovec iov[MAX_FRAME_IOV];
+        int cnt = 0;
+        for (int i = 0; i < iovcnt && cnt < MAX_FRAME_IOV; i++) {
+            if (iov_in[i].iov_len > 0) iov[cnt++] = iov_in[i];
+        }
+        return send_iov_in_place(sock, iov, cnt,
+                                 std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms));
+    }
+
+    // The sendmsg/poll loop of send_all_iov(), advancing the caller's
+    // (non-empty) segments in place.
+    bool send_iov_in_place(int sock, iovec* cur, int cnt, std::chrono::steady_clock::time_point deadline) {
+        int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+        flags |= MSG_NOSIGNAL;
+#endif
+
+        while (cnt > 0) {
+            msghdr msg = {};
+            msg.msg_iov = cur;
+            msg.msg_iovlen = cnt;
+            ssize_t n = sendmsg(sock, &msg, flags);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+                if (remaining <= 0) return false;
+                pollfd pfd = {sock, POLLOUT, 0};
+                int pr = poll(&pfd, 1, static_cast<int>(remaining));
+                if (pr <= 0) return false;
+                if (pfd.revents & (POLLERR | POLLHUP)) return false;
+                continue;
+            }
+            if (n == 0) return false;
+            advance_iov(cur, cnt, static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    static void advance_iov(iovec*& iov, int& cnt, size_t n) {
+        while (cnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0 && n > 0) {
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    // Scatter-read exactly the sum of the iovec lengths (poll + readv).
+    bool recv_exact_iov(int sock, const iovec* iov_in, int iovcnt, int timeout_ms) {
+        iovec iov[MAX_FRAME_IOV];
+        int cnt = 0;
+        for (int i = 0; i < iovcnt && cnt < MAX_FRAME_IOV; i++) {
+            if (iov_in[i].iov_len > 0) iov[cnt++] = iov_in[i];
+        }
+        iovec* cur = iov;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+        while (cnt > 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) return false;
+
+            pollfd pfd = {sock, POLLIN, 0};
+            int pr = poll(&pfd, 1, static_cast<int>(remaining));
+            if (pr <= 0) return false;
+            if (pfd.revents & POLLERR) return false;
+            if (!(pfd.revents & POLLIN)) return false;
+
+            ssize_t n = readv(sock, cur, cnt);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+                return false;
+            }
+            advance_iov(cur, cnt, static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    bool recv_exact(int sock, void* buf, size_t len, int timeout_ms) {
+        uint8_t* ptr = static_cast<uint8_t*>(buf);
+        size_t received = 0;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+        while (received < len) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) return false;
+
+            pollfd pfd = {sock, POLLIN, 0};
+            int pr = poll(&pfd, 1, static_cast<int>(remaining));
+            if (pr <= 0) return false;
+            if (pfd.revents & POLLERR) return false;
+            if (!(pfd.revents & POLLIN)) return false;
+
+            ssize_t n = recv(sock, ptr + received, len - received, 0);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+                return false;
+            }
+            received += n;
+        }
+        return true;
+    }
+
+    bool send_encrypted(int sock, const void* data, size_t len, int timeout_ms) {
+        iovec part = {const_cast<void*>(data), len};
+        return send_encrypted_parts(sock, &part, 1, timeout_ms);
+    }
+
+    // Send one frame whose plaintext is the concatenation of up to
+    // MAX_FRAME_IOV - 1 parts. When IC encryption is disabled (default) the
+    // 4-byte big-endian length prefix and the parts go out as iovecs in a
+    // single sendmsg — nothing is copied. The prefix is the same as on the
+    // encrypted path so both sides stay in framing-lockstep as long as the
+    // flag matches (it's read once per process). Encrypted, each part is
+    // sealed straight into a per-thread frame buffer that grows to the
+    // largest frame sent and is then reused. kTLS sockets take the plaintext
+    // path; the kernel seals the stream. SEQPACKET sockets send the same
+    // frame without the prefix, as one message.
+    bool send_encrypted_parts(int sock, const iovec* parts, int nparts, int timeout_ms) {
+        size_t len = 0;
+        for (int i = 0; i < nparts; i++) len += parts[i].iov_len;
+        const size_t prefix = seqpacket(sock) ? 0 : 4;
+        if (!soft_crypto(sock)) {
+            uint32_t net_len = htonl(static_cast<uint32_t>(len));
+            iovec iov[MAX_FRAME_IOV];
+            iov[0] = {&net_len, prefix};
+            int cnt = 1;
+            for (int i = 0; i < nparts && cnt < MAX_FRAME_IOV; i++) iov[cnt++] = parts[i];
+            return send_all_iov(sock, iov, cnt, timeout_ms);
+        }
+        static thread_local std::vector<uint8_t> frame;
+        size_t frame_len = prodigy_tls::ic_encrypted_size(len);
+        if (frame.size() < 4 + frame_len) frame.resize(4 + frame_len);
+        auto& cipher = prodigy_tls::ic_thread_cipher();
+        uint8_t* out = frame.data() + 4;
+        if (!cipher.begin(out)) return false;
+        size_t off = prodigy_tls::IC_GCM_IV_LEN;
+        for (int i = 0; i < nparts; i++) {
+            if (!cipher.update(static_cast<const uint8_t*>(parts[i].iov_base),
+                               parts[i].iov_len, out + off)) {
+                return false;
+            }
+            off += parts[i].iov_len;
+        }
+        if (!cipher.finish(out + off)) return false;
+        uint32_t net_len = htonl(static_cast<uint32_t>(frame_len));
+        memcpy(frame.data(), &net_len, 4);
+        return send_all_with_timeout(sock, frame.data() + 4 - prefix, prefix + frame_len, timeout_ms);
+    }
+
+    // Userspace AES-GCM applies to every frame while IC encryption is on,
+    // except on data sockets handed to kTLS. Receivers evaluate this only
+    // after the first bytes of a frame arrived: the peer sends nothing on a
+    // kTLS socket before the receiver registered it.
+    bool soft_crypto(int sock) const {
+        return prodigy_tls::ic_encryption_enabled() && !ktls_socks_.contains(sock);
+    }
+
+    bool seqpacket(int sock) const { return seqpacket_socks_.contains(sock); }
+
+    // One SEQPACKET message into iov (poll + recvmsg): a whole frame.
+    // Returns its length; -1 on timeout, EOF, error or a message that did
+    // not fit (which the kernel has discarded, so the link stays in step).
+    ssize_t recv_message(int sock, iovec* iov, int iovcnt, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        for (;;) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining < 0) return -1;
+            pollfd pfd = {sock, POLLIN, 0};
+            int pr = poll(&pfd, 1, static_cast<int>(remaining));
+            if (pr <= 0) return -1;
+            if (pfd.revents & POLLERR) return -1;
+            if (!(pfd.revents & POLLIN)) return -1;
+
+            msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            ssize_t n = recvmsg(sock, &msg, MSG_DONTWAIT);
+            if (n > 0) return (msg.msg_flags & MSG_TRUNC) ? -1 : n;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+            return -1;
+        }
+    }
+
+    // A whole frame into the per-thread landing buffer: one message on a
+    // SEQPACKET socket, length prefix + body otherwise.
+    bool recv_whole_frame(int sock, uint8_t*& frame, uint32_t& frame_len, int timeout_ms) {
+        if (seqpacket(sock)) {
+            frame = sealed_frame_buffer(MAX_FRAME_BYTES);
+            iovec iov = {frame, MAX_FRAME_BYTES};
+            ssize_t n = recv_message(sock, &iov, 1, timeout_ms);
+            if (n < 0) return false;
+            frame_len = static_cast<uint32_t>(n);
+            return true;
+        }
+        uint32_t net_len;
+        if (!recv_exact(sock, &net_len, 4, timeout_ms)) return false;
+        frame_len = ntohl(net_len);
+        if (frame_len > MAX_FRAME_BYTES) return false;
+        frame = sealed_frame_buffer(std::max<size_t>(frame_len, 1));
+        return recv_exact(sock, frame, frame_len, timeout_ms);
+    }
+
+    // Mgmt frames: [type] or [type][call_id] and [CUSTOM][len16][text]. The
+    // fixed head is built on the stack and the text is sent from the string.
+    // A non-zero ts_us appends [ts_us u64 BE][origin u8]; receivers that
+    // predate it only read the call_id.
+    bool send_mgmt_frame(int sock, MgmtMsgType type, uint32_t call_id, int timeout_ms,
+                         uint64_t ts_us = 0, uint8_t origin = 0) {
+        uint8_t buf[14];
+        buf[0] = static_cast<uint8_t>(type);
+        uint32_t net_cid = htonl(call_id);
+        memcpy(buf + 1, &net_cid, 4);
+        if (ts_us == 0) return send_encrypted(sock, buf, 5, timeout_ms);
+        for (int i = 0; i < 8; i++) buf[5 + i] = static_cast<uint8_t>(ts_us >> (56 - 8 * i));
+        buf[13] = origin;
+        return send_encrypted(sock, buf, sizeof(buf), timeout_ms);
+    }
+
+    bool send_custom_frame(int sock, const std::string& msg, int timeout_ms) {
+        uint16_t len = static_cast<uint16_t>(std::min(msg.size(), (size_t)65535));
+        uint8_t head[3];
+        head[0] = static_cast<uint8_t>(MgmtMsgType::CUSTOM);
+        uint16_t net_len = htons(len);
+        memcpy(head + 1, &net_len, 2);
+        iovec parts[2] = {{head, 3}, {const_cast<char*>(msg.data()), len}};
+        return send_encrypted_parts(sock, parts, 2, timeout_ms);
+    }
+
+    // Text of a CUSTOM frame, or "" if the frame is not a well-formed CUSTOM.
+    static std::string parse_custom_frame(const std::vector<uint8_t>& plain) {
+        if (plain.size() < 3 || plain[0] != static_cast<uint8_t>(MgmtMsgType::CUSTOM)) return "";
+        uint16_t len;
+        memcpy(&len, plain.data() + 1, 2);
+        len = ntohs(len);
+        if (len == 0 || plain.size() < (size_t)(3 + len)) return "";
+        return std::string(reinterpret_cast<const char*>(plain.data() + 3), len);
+    }
+
+    bool recv_encrypted(int sock, std::vector<uint8_t>& plaintext, int timeout_ms) {
+        if (seqpacket(sock)) {
+            uint8_t* frame;
+            uint32_t frame_len;
+            if (!recv_whole_frame(sock, frame, frame_len, timeout_ms)) return false;
+            if (!soft_crypto(sock)) {
+                plaintext.assign(frame, frame + frame_len);
+                return true;
+            }
+            plaintext.resize(frame_len);
+            size_t plain_len = 0;
+            if (!prodigy_tls::ic_decrypt(frame, frame_len, plaintext.data(), plain_len)) return false;
+            plaintext.resize(plain_len);
+            return true;
+        }
+        uint32_t net_len;
+        if (!recv_exact(sock, &net_len, 4, timeout_ms)) return false;
+        uint32_t frame_len = ntohl(net_len);
+        if (frame_len > MAX_FRAME_BYTES) return false;
+        if (!soft_crypto(sock)) {
+            plaintext.resize(frame_len);
+            if (frame_len > 0 &&
+                !recv_exact(sock, plaintext.data(), frame_len, timeout_ms)) {
+                return false;
+            }
+            return true;
+        }
+        uint8_t* sealed = sealed_frame_buffer(frame_len);
+        if (!recv_exact(sock, sealed, frame_len, timeout_ms)) return false;
+        plaintext.resize(frame_len);
+        size_t plain_len = 0;
+        if (!prodigy_tls::ic_decrypt(sealed, frame_len, plaintext.data(), plain_len)) {
+            return false;
+        }
+        plaintext.resize(plain_len);
+        return true;
+    }
+
+    // Per-thread landing buffer for encrypted frames; grows to the largest
+    // frame received and is then reused.
+    static uint8_t* sealed_frame_buffer(size_t len) {
+        static thread_local std::vector<uint8_t> buf;
+        if (buf.size() < len) buf.resize(len);
+        return buf.data();
+    }
+
+    // Snapshot of the default downstream link. Caller holds
+    // send_downstream_mutex_ (which also guards downstream_seq_).
+    int default_link(std::shared_ptr<ShmRing>& shm, bool& typed) {
+        std::lock_guard<std::mutex> dl(downstream_mutex_);
+        shm = downstream_shm_;
+        typed = downstream_typed_hdr_;
+        if (downstream_seq_reset_) {
+            downstream_seq_.reset();
+            downstream_seq_reset_ = false;
+        }
+        if (downstream_data_sock_ < 0) {
+            // A link still marked CONNECTED without a socket was lost
+            // unnoticed; fail it so a reconnect gets scheduled.
+            bool stale;
+            {
+                std::lock_guard<std::mutex> sl(state_mutex_);
+                stale = downstream_state_ == ConnectionState::CONNECTED;
+            }
+            if (stale) mark_downstream_failed_locked();
+        }
+        return downstream_data_sock_;
+    }
+
+    template <typename P>
+    bool send_downstream_impl(P& pkt) {
+        std::lock_guard<std::mutex> lock(send_downstream_mutex_);
+        std::shared_ptr<ShmRing> shm;
+        bool typed;
+        int sock = default_link(shm, typed);
+        bool trace = trace_wire_.load(std::memory_order_relaxed);
+        if (sock < 0) return false;
+
+        FrameMeta meta;
+        const FrameMeta* mp = typed ? stamp_meta(pkt, downstream_seq_, meta) : nullptr;
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = shm ? send_packet_shm(*shm, pkt, mp, trace, DATA_SEND_TIMEOUT_MS)
+                      : send_frame(sock, pkt, mp, trace, DATA_SEND_TIMEOUT_MS);
+        if (!ok) {
+            mark_downstream_failed();
+            return false;
+        }
+        downstream_flow_.on_send(pkt.call_id, 8 + static_cast<size_t>(pkt.payload_size),
+                                 flow_window(), elapsed_us(t0));
+        return true;
+    }
+
+    template <typename P>
+    bool send_downstream_impl(P& pkt, ServiceType target) {
+        DownstreamConnection* dc = route_call(target, pkt.call_id);
+        if (!dc) return false;
+        if (dc->state.load(std::memory_order_relaxed) != ConnectionState::CONNECTED) return false;
+
+        std::lock_guard<std::mutex> lock(dc->data_send_mutex);
+        int sock = dc->data_sock;
+        if (sock < 0) {
+            mark_dc_failed(*dc);
+            return false;
+        }
+
+        bool trace = trace_wire_.load(std::memory_order_relaxed);
+        FrameMeta meta;
+        const FrameMeta* mp = dc->typed_hdr ? stamp_meta(pkt, dc->seq, meta) : nullptr;
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = dc->shm ? send_packet_shm(*dc->shm, pkt, mp, trace, DATA_SEND_TIMEOUT_MS)
+                          : send_frame(sock, pkt, mp, trace, DATA_SEND_TIMEOUT_MS);
+        if (!ok) {
+            close_socket(dc->data_sock);
+            reset_shm(dc->shm);
+            mark_dc_failed(*dc);
+            return false;
+        }
+        dc->flow.on_send(pkt.call_id, 8 + static_cast<size_t>(pkt.payload_size),
+                         flow_window(), elapsed_us(t0));
+        return true;
+    }
+
+    // One frame of a batch: the extension block of the plaintext path has to
+    // outlive the framing call, so it lives here rather than on the stack.
+    struct BatchFrame {
+        uint8_t ext[MAX_EXT_BYTES];
+        iovec iov[2];
+        int cnt;
+    };
+
+    static std::vector<BatchFrame>& batch_frames(size_t n) {
+        static thread_local std::vector<BatchFrame> frames;
+        if (frames.size() < n) frames.resize(n);
+        return frames;
+    }
+
+    size_t send_batch_impl(std::vector<PooledPacket>& pkts) {
+        std::lock_guard<std::mutex> lock(send_downstream_mutex_);
+        std::shared_ptr<ShmRing> shm;
+        bool typed;
+        int sock = default_link(shm, typed);
+        bool trace = trace_wire_.load(std::memory_order_relaxed);
+        if (sock < 0) return 0;
+
+        auto t0 = std::chrono::steady_clock::now();
+        if (shm) {
+            size_t sent = 0;
+            for (auto& pkt : pkts) {
+                if (!pkt.is_valid()) continue;
+                FrameMeta meta;
+                const FrameMeta* mp = typed ? stamp_meta(pkt, downstream_seq_, meta) : nullptr;
+                if (!send_packet_shm(*shm, pkt, mp, trace, DATA_SEND_TIMEOUT_MS)) {
+                    mark_downstream_failed();
+                    return sent;
+                }
+                downstream_flow_.on_send(pkt.call_id, 8 + static_cast<size_t>(pkt.payload_size),
+                                         flow_window(), sent == 0 ? elapsed_us(t0) : 0);
+                sent++;
+            }
+            return sent;
+        }
+
+        auto& frames = batch_frames(pkts.size());
+        size_t n = 0;
+        for (auto& pkt : pkts) {
+            FrameMeta meta;
+            const FrameMeta* mp = typed && pkt.is_valid() ? stamp_meta(pkt, downstream_seq_, meta) : nullptr;
+            BatchFrame& f = frames[n];
+            f.cnt = frame_in_place(sock, pkt, mp, trace, f.ext, f.iov);
+            if (f.cnt) n++;
+        }
+        if (n == 0) return 0;
+        if (!send_frames(sock, frames.data(), n, DATA_SEND_TIMEOUT_MS)) {
+            mark_downstream_failed();
+            return 0;
+        }
+        uint64_t us = elapsed_us(t0);
+        for (auto& pkt : pkts) {
+            if (!pkt.is_valid()) continue;
+            downstream_flow_.on_send(pkt.call_id, 8 + static_cast<size_t>(pkt.payload_size),
+                                     flow_window(), us);
+            us = 0;
+        }
+        return n;
+    }
+
+    // Framed batch out on one socket: gathered into MAX_BATCH_IOV-segment
+    // stream writes, or one message per frame via sendmmsg() on SEQPACKET.
+    bool send_frames(int sock, BatchFrame* frames, size_t n, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        if (seqpacket(sock)) return send_messages(sock, frames, n, deadline);
+        iovec iov[MAX_BATCH_IOV];
+        int cnt = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (cnt + frames[i].cnt > MAX_BATCH_IOV) {
+                if (!send_iov_in_place(sock, iov, cnt, deadline)) return false;
+                cnt = 0;
+            }
+            for (int k = 0; k < frames[i].cnt; k++) iov[cnt++] = frames[i].iov[k];
+        }
+        return cnt == 0 || send_iov_in_place(sock, iov, cnt, deadline);
+    }
+
+    bool send_messages(int sock, BatchFrame* frames, size_t n,
+                       std::chrono::steady_clock::time_point deadline) {
+#ifdef __linux__
+        static constexpr size_t CHUNK = 64;
+        mmsghdr msgs[CHUNK];
+        for (size_t base = 0; base < n; ) {
+            size_t cnt = std::min(CHUNK, n - base);
+            for (size_t i = 0; i < cnt; i++) {
+                msgs[i] = {};
+                msgs[i].msg_hdr.msg_iov = frames[base + i].iov;
+                msgs[i].msg_hdr.msg_iovlen = frames[base + i].cnt;
+            }
+            size_t done = 0;
+            while (done < cnt) {
+                int r = sendmmsg(sock, msgs + done, static_cast<unsigned>(cnt - done),
+                                 MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (r > 0) {
+                    done += static_cast<size_t>(r);
+                    continue;
+                }
+                if (r < 0 && errno == EINTR) continue;
+                if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return false;
+                int remaining = remaining_ms(deadline);
+                pollfd pfd = {sock, POLLOUT, 0};
+                if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0 ||
+                    (pfd.revents & (POLLERR | POLLHUP))) {
+                    return false;
+                }
+            }
+            base += cnt;
+        }
+        return true;
+#else
+        for (size_t i = 0; i < n; i++) {
+            if (!send_iov_in_place(sock, frames[i].iov, frames[i].cnt, deadline)) return false;
+        }
+        return true;
+#endif
+    }
+
+    // The FrameMeta a typed link sends with pkt: the producer's fields plus
+    // this link's next seq for the call, and a capture time if none was set.
+    template <typename P>
+    static const FrameMeta* stamp_meta(const P& pkt, SeqStamper& seq, FrameMeta& out) {
+        out = pkt.meta;
+        out.seq = seq.next(pkt.call_id);
+        if (out.capture_us == 0) out.capture_us = PacketTrace::now_us();
+        return &out;
+    }
+
+    static uint64_t route_key(ServiceType target, uint32_t call_id) {
+        return (static_cast<uint64_t>(target) << 32) | call_id;
+    }
+
+    // Rendezvous (highest-random-weight) hash: each call ranks the replicas
+    // independently, so losing or adding one only moves the calls it wins.
+    static uint64_t rendezvous_weight(uint32_t call_id, uint8_t instance) {
+        uint64_t x = (static_cast<uint64_t>(call_id) << 8) | instance;
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    // Connection that carries call_id towards target. Single-instance
+    // targets map straight to their connection. For replicated targets a
+    // call is placed on the highest-weight connected replica the first time
+    // it is routed and stays there (even once a lost replica comes back)
+    // until CALL_END; if its replica is down it fails over to the next
+    // live one. With no replica up the current owner is returned, so the
+    // send fails rather than being misrouted.
+    DownstreamConnection* route_call(ServiceType target, uint32_t call_id) {
+        DownstreamConnection* first = nullptr;
+        int replicas = 0;
+        for (auto& dc : downstream_connections_) {
+            if (dc->target != target) continue;
+            if (!first) first = dc.get();
+            replicas++;
+        }
+        if (replicas <= 1) return first;
+
+        std::lock_guard<std::mutex> lock(route_mutex_);
+        auto it = call_routes_.find(route_key(target, call_id));
+        if (it != call_routes_.end() &&
+            it->second->state.load(std::memory_order_relaxed) == ConnectionState::CONNECTED) {
+            return it->second;
+        }
+        DownstreamConnection* best = nullptr;
+        uint64_t best_weight = 0;
+        for (auto& dc : downstream_connections_) {
+            if (dc->target != target ||
+                dc->state.load(std::memory_order_relaxed) != ConnectionState::CONNECTED) {
+                continue;
+            }
+            uint64_t w = rendezvous_weight(call_id, dc->instance);
+            if (!best || w > best_weight) {
+                best = dc.get();
+                best_weight = w;
+            }
+        }
+        if (!best) return it != call_routes_.end() ? it->second : first;
+        if (it != call_routes_.end()) {
+            call_failovers_.fetch_add(1, std::memory_order_relaxed);
+            std::fprintf(stderr, "[%s] Call %u failed over from %s#%u to #%u\n",
+                        service_type_to_string(type_), call_id, service_type_to_string(target),
+                        it->second->instance, best->instance);
+            it->second = best;
+        } else {
+            call_routes_.emplace(route_key(target, call_id), best);
+            if (call_routes_.size() > MAX_ROUTED_CALLS) call_routes_.erase(call_routes_.begin());
+        }
+        return best;
+    }
+
+    void forget_call_routes(uint32_t call_id) {
+        std::lock_guard<std::mutex> lock(route_mutex_);
+        for (auto& dc : downstream_connections_) call_routes_.erase(route_key(dc->target, call_id));
+    }
+
+    template <typename P>
+    bool recv_upstream_impl(P& pkt, int timeout_ms) {
+        int sock;
+        std::shared_ptr<ShmRing> shm;
+        bool fan_in;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        {
+            std::unique_lock<std::mutex> lock(upstream_mutex_);
+            upstream_cv_.wait_until(lock, deadline,
+                [this] { return upstream_data_accepted_ >= 0 || !running_; });
+            sock = upstream_data_accepted_;
+            shm = upstream_shm_;
+            fan_in = !extra_upstream_data_.empty();
+        }
+        if (sock < 0) return false;
+        if (rx_stage_.has_frames(sock)) {
+            if (!take_staged(sock, pkt)) return false;
+            account_hops(pkt.trace);
+            return true;
+        }
+        if (fan_in) return recv_fan_in(pkt, deadline);
+        timeout_ms = remaining_ms(deadline);
+        if (shm) {
+            // Liveness of the peer is still tracked on the (idle) data socket
+            // by the loop's hangup watch, which drops the ring with the socket.
+            if (recv_packet_shm(*shm, pkt, timeout_ms)) {
+                account_hops(pkt.trace);
+                return true;
+            }
+            if (shm->closed()) {
+                std::lock_guard<std::mutex> lock(upstream_mutex_);
+                if (upstream_shm_ == shm) mark_upstream_failed_locked();
+            }
+            return false;
+        }
+        bool ok = recv_frame(sock, pkt, timeout_ms);
+        if (ok) {
+            account_hops(pkt.trace);
+        } else {
+            std::lock_guard<std::mutex> lock(upstream_mutex_);
+            if (upstream_data_accepted_ == sock && is_socket_dead(sock)) {
+                mark_upstream_failed_locked();
+            }
+        }
+        return ok;
+    }
+
+    void recv_upstream_batch_impl(std::vector<PooledPacket>& out, size_t max, int timeout_ms) {
+        if (max == 0) return;
+        int sock;
+        bool shm, fan_in;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        {
+            std::unique_lock<std::mutex> lock(upstream_mutex_);
+            upstream_cv_.wait_until(lock, deadline,
+                [this] { return upstream_data_accepted_ >= 0 || !running_; });
+            sock = upstream_data_accepted_;
+            shm = upstream_shm_ != nullptr;
+            fan_in = !extra_upstream_data_.empty();
+        }
+        if (sock < 0) return;
+
+        PooledPacket pkt;
+        if (shm || fan_in || seqpacket(sock)) {
+            // The first frame waits; the rest only if already there.
+            for (size_t got = 0; got < max; got++) {
+                if (!recv_upstream_impl(pkt, got == 0 ? remaining_ms(deadline) : 0)) return;
+                out.push_back(std::move(pkt));
+                if (fan_in) return;
+            }
+            return;
+        }
+
+        if (!rx_stage_.has_frames(sock) && !fill_rx_stage(sock, remaining_ms(deadline))) {
+            std::lock_guard<std::mutex> lock(upstream_mutex_);
+            if (upstream_data_accepted_ == sock && is_socket_dead(sock)) mark_upstream_failed_locked();
+            return;
+        }
+        for (size_t got = 0; got < max && rx_stage_.has_frames(sock); ) {
+            if (!take_staged(sock, pkt)) continue;
+            account_hops(pkt.trace);
+            out.push_back(std::move(pkt));
+            got++;
+        }
+    }
+
+    // Reads whatever the socket has — one poll() and one recv() for a burst
+    // of small frames — into the stage, then reads the rest of a frame cut
+    // off at the end, so the stage only ever holds whole frames. A frame
+    // that cannot be completed leaves the stream out of lockstep: the socket
+    // is shut down for the dead-socket check, as recv_frame() does.
+    bool fill_rx_stage(int sock, int timeout_ms) {
+        RxStage& st = rx_stage_;
+        st.sock = sock;
+        st.head = st.tail = 0;
+        if (st.buf.size() < RX_STAGE_BYTES) st.buf.resize(RX_STAGE_BYTES);
+
+        pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0 || !(pfd.revents & POLLIN)) return false;
+        ssize_t n;
+        do {
+            n = recv(sock, st.buf.data(), RX_STAGE_BYTES, MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return false;
+
+        size_t off = 0, end = static_cast<size_t>(n);
+        while (off < end) {
+            size_t need = 4;
+            if (end - off >= 4) {
+                uint32_t net_len;
+                memcpy(&net_len, st.buf.data() + off, 4);
+                uint32_t frame_len = ntohl(net_len);
+                if (frame_len > MAX_FRAME_BYTES) {
+                    ::shutdown(sock, SHUT_RDWR);
+                    break;
+                }
+                need = 4 + static_cast<size_t>(frame_len);
+                if (end - off >= need) {
+                    off += need;
+                    continue;
+                }
+            }
+            if (st.buf.size() < off + need) st.buf.resize(off + need);
+            if (!recv_exact(sock, st.buf.data() + end, off + need - end, PAYLOAD_RECV_TIMEOUT_MS)) {
+                ::shutdown(sock, SHUT_RDWR);
+                break;
+            }
+            end = off + need;   // a completed prefix goes round again for its body
+        }
+        st.tail = off;
+        return off > 0;
+    }
+
+    // Next staged frame into a pool buffer, decrypted there. The frame is
+    // consumed even when it turns out malformed.
+    bool take_staged(int sock, PooledPacket& pkt) {
+        RxStage& st = rx_stage_;
+        uint32_t net_len;
+        memcpy(&net_len, st.buf.data() + st.head, 4);
+        const uint32_t frame_len = ntohl(net_len);
+        const uint8_t* frame = st.buf.data() + st.head + 4;
+        st.head += 4 + static_cast<size_t>(frame_len);
+
+        const bool enc = soft_crypto(sock);
+        const size_t lead = 8 + (enc ? prodigy_tls::IC_GCM_IV_LEN : 0);
+        const size_t overhead = lead + (enc ? prodigy_tls::IC_GCM_TAG_LEN : 0);
+        if (frame_len < overhead) return false;
+        PacketBufRef buf = pool_->acquire(frame_len - overhead);
+        if (!buf) return false;
+        memcpy(buf->payload() - lead, frame, frame_len);
+        return finish_pooled_frame(buf, frame_len, enc, pkt);
+    }
+
+    bool take_staged(int sock, Packet& pkt) {
+        PooledPacket p;
+        if (!take_staged(sock, p)) return false;
+        pkt.call_id = p.call_id;
+        pkt.payload_size = p.payload_size;
+        pkt.payload.assign(p.payload(), p.payload() + p.payload_size);
+        pkt.meta = p.meta;
+        pkt.trace = p.trace;
+        return true;
+    }
+
+    // Several upstream peers: wait on all their data sockets at once (and on
+    // the primary's shm ring, if any, by checking it between short waits)
+    // and read one frame from the first ready one. The scan starts at a
+    // rotating offset so a busy peer cannot starve the others.
+    template <typename P>
+    bool recv_fan_in(P& pkt, std::chrono::steady_clock::time_point deadline) {
+        pollfd pfds[MAX_STAGE_REPLICAS + 1];
+        while (running_) {
+            std::shared_ptr<ShmRing> shm;
+            size_t n = 0;
+            {
+                std::lock_guard<std::mutex> lock(upstream_mutex_);
+                shm = upstream_shm_;
+                if (upstream_data_accepted_ >= 0 && !shm) pfds[n++] = {upstream_data_accepted_, POLLIN, 0};
+                for (int fd : extra_upstream_data_) {
+                    if (n < MAX_STAGE_REPLICAS + 1) pfds[n++] = {fd, POLLIN, 0};
+                }
+            }
+            if (shm && recv_packet_shm(*shm, pkt, 0)) {
+                account_hops(pkt.trace);
+                return true;
+            }
+            int left = remaining_ms(deadline);
+            if (n == 0) {
+                if (!shm || !recv_packet_shm(*shm, pkt, left)) return false;
+                account_hops(pkt.trace);
+                return true;
+            }
+            if (n > 1) {
+                size_t start = upstream_rr_.fetch_add(1, std::memory_order_relaxed) % n;
+                std::rotate(pfds, pfds + start, pfds + n);
+            }
+            int wait = shm ? std::min(left, FAN_IN_SHM_SLICE_MS) : left;
+            int pr = poll(pfds, n, wait);
+            for (size_t i = 0; pr > 0 && i < n; i++) {
+                if (!pfds[i].revents) continue;
+                int sock = pfds[i].fd;
+                if (recv_frame(sock, pkt, std::max(left, 1))) {
+                    account_hops(pkt.trace);
+                    return true;
+                }
+                if (is_socket_dead(sock)) fail_upstream_sock(sock);
+                break;
+            }
+            if (remaining_ms(deadline) <= 0) return false;
+        }
+        return false;
+    }
+
+    // Vector packets go out as [len][hdr][payload][extensions] iovecs
+    // straight from the Packet — no serialize() copy on the plaintext path.
+    // meta is appended on typed links, the trace only when trace propagation
+    // is on (with_trace).
+    bool send_frame(int sock, const Packet& pkt, const FrameMeta* meta, bool with_trace,
+                    int timeout_ms) {
+        uint8_t hdr[8];
+        uint8_t ext[MAX_EXT_BYTES];
+        uint32_t flags = 0;
+        size_t ext_len = write_extensions(ext, meta, with_trace ? &pkt.trace : nullptr, flags);
+        write_packet_header(hdr, pkt.call_id, pkt.payload_size | flags);
+        iovec parts[3] = {
+            {hdr, 8},
+            {const_cast<uint8_t*>(pkt.payload.data()), pkt.payload.size()},
+            {ext, ext_len},
+        };
+        return send_encrypted_parts(sock, parts, 3, timeout_ms);
+    }
+
+    // Plaintext: one readv for [len][hdr], then the payload lands directly in
+    // pkt.payload (whose capacity is reused across calls). A frame whose
+    // length disagrees with its header leaves the stream out of lockstep, so
+    // the socket is shut down and the caller's dead-socket check tears it down.
+    bool recv_frame(int sock, Packet& pkt, int timeout_ms) {
+        if (prodigy_tls::ic_encryption_enabled() || seqpacket(sock)) {
+            return recv_frame_sealed(sock, pkt, timeout_ms);
+        }
+
+        uint32_t net_len;
+        uint8_t hdr[8];
+        iovec iov[2] = {{&net_len, 4}, {hdr, 8}};
+        if (!recv_exact_iov(sock, iov, 2, timeout_ms)) return false;
+
+        uint32_t frame_len = ntohl(net_len);
+        uint32_t net_call_id, net_size;
+        memcpy(&net_call_id, hdr, 4);
+        memcpy(&net_size, hdr + 4, 4);
+        uint32_t call_id = ntohl(net_call_id);
+        uint32_t wire_size = ntohl(net_size);
+        uint32_t payload_size = wire_size & Packet::SIZE_MASK;
+        size_t ext_len = frame_len >= 8 + payload_size ? frame_len - 8 - payload_size : SIZE_MAX;
+        if (frame_len < 8 || payload_size > Packet::MAX_PAYLOAD_SIZE ||
+            ext_len > max_ext_bytes(wire_size)) {
+            ::shutdown(sock, SHUT_RDWR);
+            return false;
+        }
+
+        uint8_t ext[MAX_EXT_BYTES];
+        pkt.payload.resize(payload_size);
+        iovec body[2] = {{pkt.payload.data(), payload_size}, {ext, ext_len}};
+        if (!recv_exact_iov(sock, body, 2, timeout_ms)) return false;
+        pkt.call_id = call_id;
+        pkt.payload_size = payload_size;
+        if (!read_extensions(wire_size, ext, ext_len, pkt.meta, pkt.trace)) return false;
+        return call_id != 0;
+    }
+
+    // Encrypted counterpart: the frame lands whole in the per-thread buffer
+    // and is decrypted piecewise — header to the stack, payload straight
+    // into pkt.payload — so there is no plaintext staging copy. A kTLS
+    // socket delivers plaintext and continues on the plain layout, and so
+    // do plaintext SEQPACKET frames, which arrive whole with one recvmsg.
+    bool recv_frame_sealed(int sock, Packet& pkt, int timeout_ms) {
+        uint8_t* frame;
+        uint32_t frame_len;
+        if (!recv_whole_frame(sock, frame, frame_len, timeout_ms)) return false;
+
+        const bool soft = soft_crypto(sock);
+        const size_t overhead = 8 + (soft ? prodigy_tls::IC_GCM_IV_LEN + prodigy_tls::IC_GCM_TAG_LEN : 0);
+        if (frame_len < overhead) return false;
+        const uint8_t* body = soft ? frame + prodigy_tls::IC_GCM_IV_LEN : frame;
+        const size_t body_len = frame_len - overhead;   // payload + trace extension
+
+        auto& cipher = prodigy_tls::ic_thread_cipher();
+        uint8_t hdr[8];
+        if (!soft) memcpy(hdr, body, 8);
+        else if (!cipher.open_begin(frame) || !cipher.open_update(body, 8, hdr)) return false;
+        uint32_t net_call_id, net_size;
+        memcpy(&net_call_id, hdr, 4);
+        memcpy(&net_size, hdr + 4, 4);
+        uint32_t call_id = ntohl(net_call_id);
+        uint32_t wire_size = ntohl(net_size);
+        uint32_t size = wire_size & Packet::SIZE_MASK;
+        size_t ext_len = body_len >= size ? body_len - size : SIZE_MAX;
+        if (size > Packet::MAX_PAYLOAD_SIZE || ext_len > max_ext_bytes(wire_size)) return false;
+
+        uint8_t ext[MAX_EXT_BYTES];
+        pkt.payload.resize(size);
+        if (!soft) {
+            if (size) memcpy(pkt.payload.data(), body + 8, size);
+            if (ext_len) memcpy(ext, body + 8 + size, ext_len);
+        } else if (!cipher.open_update(body + 8, size, pkt.payload.data()) ||
+                   !cipher.open_update(body + 8 + size, ext_len, ext) ||
+                   !cipher.open_finish(body + 8 + body_len)) {
+            return false;
+        }
+        pkt.call_id = call_id;
+        pkt.payload_size = size;
+        if (!read_extensions(wire_size, ext, ext_len, pkt.meta, pkt.trace)) return false;
+        return call_id != 0;
+    }
+
+    static void write_packet_header(uint8_t* hdr, uint32_t call_id, uint32_t payload_size) {
+        uint32_t net_call_id = htonl(call_id);
+        uint32_t net_size = htonl(payload_size);
+        memcpy(hdr, &net_call_id, 4);
+        memcpy(hdr + 4, &net_size, 4);
+    }
+
+    // In-place framing in the PacketBuf headroom (layout in packet-pool.h):
+    // plaintext sends [len][hdr][payload] from one contiguous region; with
+    // encryption, hdr+payload are encrypted in place between the IV slot and
+    // the tag slot. A shared buffer is cloned first so other holders never
+    // observe the mutation. A trace extension goes out as a second iovec on
+    // the plaintext path; when encrypting it has to sit behind the payload,
+    // so a buffer without room for it is cloned into a larger one. SEQPACKET
+    // sockets get the same bytes without the length prefix.
+    bool send_frame(int sock, PooledPacket& pkt, const FrameMeta* meta, bool with_trace,
+                    int timeout_ms) {
+        uint8_t ext[MAX_EXT_BYTES];
+        iovec iov[2];
+        int cnt = frame_in_place(sock, pkt, meta, with_trace, ext, iov);
+        if (cnt == 0) return false;
+        return send_all_iov(sock, iov, cnt, timeout_ms);
+    }
+
+    // The framing half of send_frame(): leaves the frame in one or two
+    // iovecs (the second is the plaintext extension block in `ext`). 0 if
+    // the packet is invalid or could not be framed.
+    int frame_in_place(int sock, PooledPacket& pkt, const FrameMeta* meta, bool with_trace,
+                       uint8_t* ext, iovec* iov) {
+        if (!pkt.is_valid()) return 0;
+        const bool enc = soft_crypto(sock);
+        const size_t prefix = seqpacket(sock) ? 0 : 4;
+        uint32_t flags = 0;
+        const size_t ext_len = write_extensions(ext, meta, with_trace ? &pkt.trace : nullptr, flags);
+        const size_t need = pkt.payload_size + (enc ? ext_len : 0);
+        if (!pkt.buf.unique() || pkt.capacity() < need) {
+            PacketBufRef fresh = pool_->acquire(need);
+            if (!fresh) return 0;
+            if (pkt.payload_size > 0) memcpy(fresh->payload(), pkt.payload(), pkt.payload_size);
+            pkt.buf = std::move(fresh);
+        }
+        uint8_t* hdr = pkt.payload() - 8;
+        write_packet_header(hdr, pkt.call_id, pkt.payload_size | flags);
+        size_t body = 8 + pkt.payload_size + ext_len;
+
+        uint8_t* frame;
+        size_t frame_len;
+        if (!enc) {
+            frame = hdr - 4;
+            frame_len = body;
+            if (ext_len) {
+                uint32_t net_len = htonl(static_cast<uint32_t>(frame_len));
+                memcpy(frame, &net_len, 4);
+                iov[0] = {frame + 4 - prefix, prefix + 8 + pkt.payload_size};
+                iov[1] = {ext, ext_len};
+                return 2;
+            }
+        } else {
+            if (ext_len) memcpy(pkt.payload() + pkt.payload_size, ext, ext_len);
+            uint8_t* cipher = hdr - prodigy_tls::IC_GCM_IV_LEN;
+            if (!prodigy_tls::ic_encrypt(hdr, body, cipher, frame_len)) return 0;
+            frame = cipher - 4;
+        }
+        uint32_t net_len = htonl(static_cast<uint32_t>(frame_len));
+        memcpy(frame, &net_len, 4);
+        iov[0] = {frame + 4 - prefix, prefix + frame_len};
+        return 1;
+    }
+
+    bool recv_frame(int sock, PooledPacket& pkt, int timeout_ms) {
+        if (seqpacket(sock)) return recv_frame_message(sock, pkt, timeout_ms);
+        uint32_t net_len;
+        if (!recv_exact(sock, &net_len, 4, timeout_ms)) return false;
+        uint32_t frame_len = ntohl(net_len);
+        if (frame_len > MAX_FRAME_BYTES) return false;
+
+        const bool enc = soft_crypto(sock);
+        const size_t overhead = 8 + (enc ? prodigy_tls::IC_GCM_IV_LEN + prodigy_tls::IC_GCM_TAG_LEN : 0);
+        if (frame_len < overhead) {
+            // Consume the runt frame so the stream stays in framing lockstep.
+            uint8_t scratch[64];
+            recv_exact(sock, scratch, frame_len, timeout_ms);
+            return false;
+        }
+        const size_t body_len = frame_len - overhead;   // payload + trace extension
+        PacketBufRef buf = pool_->acquire(body_len);
+        if (!buf) return false;
+
+        uint8_t* hdr = buf->payload() - 8;
+        uint8_t* dst = enc ? hdr - prodigy_tls::IC_GCM_IV_LEN : hdr;
+        if (!recv_exact(sock, dst, frame_len, timeout_ms)) return false;
+        return finish_pooled_frame(buf, frame_len, enc, pkt);
+    }
+
+    // SEQPACKET counterpart: one recvmsg scatters the message into a pooled
+    // buffer sized for typical frames, with the per-thread landing buffer
+    // behind it for the rest. A larger frame is then moved into a buffer of
+    // its own size — a copy only frames above SEQPACKET_RECV_GUESS pay.
+    static constexpr size_t SEQPACKET_RECV_GUESS = 4096 - PacketBuf::HEADROOM - PacketBuf::TAILROOM;
+
+    bool recv_frame_message(int sock, PooledPacket& pkt, int timeout_ms) {
+        const bool enc = soft_crypto(sock);
+        const size_t lead = 8 + (enc ? prodigy_tls::IC_GCM_IV_LEN : 0);
+        const size_t overhead = lead + (enc ? prodigy_tls::IC_GCM_TAG_LEN : 0);
+        PacketBufRef buf = pool_->acquire(SEQPACKET_RECV_GUESS);
+        if (!buf) return false;
+        uint8_t* dst = buf->payload() - lead;
+        uint8_t* spill = sealed_frame_buffer(MAX_FRAME_BYTES);
+        iovec iov[2] = {{dst, lead + buf->payload_capacity() + PacketBuf::TAILROOM},
+                        {spill, MAX_FRAME_BYTES}};
+        ssize_t n = recv_message(sock, iov, 2, timeout_ms);
+        if (n < static_cast<ssize_t>(overhead)) return false;
+        const size_t frame_len = static_cast<size_t>(n);
+        if (frame_len > iov[0].iov_len) {
+            PacketBufRef big = pool_->acquire(frame_len - overhead);
+            if (!big) return false;
+            uint8_t* big_dst = big->payload() - lead;
+            memcpy(big_dst, dst, iov[0].iov_len);
+            memcpy(big_dst + iov[0].iov_len, spill, frame_len - iov[0].iov_len);
+            buf = std::move(big);
+        }
+        return finish_pooled_frame(buf, static_cast<uint32_t>(frame_len), enc, pkt);
+    }
+
+    // Shared tail of the pooled receive paths: the frame sits in buf at
+    // payload() - 8 (minus the IV slot when sealed).
+    bool finish_pooled_frame(PacketBufRef& buf, uint32_t frame_len, bool enc, PooledPacket& pkt) {
+        const size_t overhead = 8 + (enc ? prodigy_tls::IC_GCM_IV_LEN + prodigy_tls::IC_GCM_TAG_LEN : 0);
+        const size_t body_len = frame_len - overhead;
+        uint8_t* hdr = buf->payload() - 8;
+        uint8_t* dst = enc ? hdr - prodigy_tls::IC_GCM_IV_LEN : hdr;
+        if (enc) {
+            size_t plain_len = 0;
+            if (!prodigy_tls::ic_decrypt(dst, frame_len, hdr, plain_len) ||
+                plain_len != 8 + body_len) {
+                return false;
+            }
+        }
+
+        uint32_t net_call_id, net_size;
+        memcpy(&net_call_id, hdr, 4);
+        memcpy(&net_size, hdr + 4, 4);
+        uint32_t call_id = ntohl(net_call_id);
+        uint32_t wire_size = ntohl(net_size);
+        uint32_t size = wire_size & Packet::SIZE_MASK;
+        if (call_id == 0 || size > body_len) return false;
+        size_t ext_len = body_len - size;
+        if (ext_len > max_ext_bytes(wire_size) ||
+            !read_extensions(wire_size, buf->payload() + size, ext_len, pkt.meta, pkt.trace)) {
+            return false;
+        }
+
+        pkt.call_id = call_id;
+        pkt.payload_size = size;
+        pkt.buf = std::move(buf);
+        return true;
+    }
+
+    // One CUSTOM request/response round trip. The caller either owns the mgmt
+    // socket exclusively (during connect) or holds its send mutex.
+    std::string exchange_custom(int sock, const std::string& msg, int timeout_ms,
+                                FlowWindow* flow = nullptr) {
+        if (!send_custom_frame(sock, msg, timeout_ms)) return "";
+        std::vector<uint8_t> resp_plain;
+        if (!recv_custom_reply(sock, resp_plain, timeout_ms, flow)) return "";
+        return parse_custom_frame(resp_plain);
     }
 
-    // Lock order: {upstream,downstream}_mutex_ → state_mutex_ (never reversed).
-    // Caller MUST hold the corresponding connection mutex.
-    void mark_upstream_failed_locked() {
-        close_socket(upstream_mgmt_accepted_);
-        close_socket(upstream_data_accepted_);
-        std::lock_guard<std::mutex> sl(state_mutex_);
-        upstream_state_ = ConnectionState::DISCONNECTED;
+    // Reads the next non-CREDIT frame into plain. Grants that arrive ahead
+    // of the reply are applied to flow (or dropped if there is none yet,
+    // e.g. during the shm handshake of a new connection).
+    bool recv_custom_reply(int sock, std::vector<uint8_t>& plain, int timeout_ms, FlowWindow* flow) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (recv_encrypted(sock, plain, remaining_ms(deadline))) {
+            if (!apply_credit(plain, flow)) return true;
+        }
+        return false;
     }
 
-    void mark_downstream_failed_locked() {
-        close_socket(downstream_mgmt_sock_);
-        close_socket(downstream_data_sock_);
-        std::lock_guard<std::mutex> sl(state_mutex_);
-        downstream_state_ = ConnectionState::DISCONNECTED;
+    // True if plain is a CREDIT frame; its grant goes to flow, if any.
+    static bool apply_credit(const std::vector<uint8_t>& plain, FlowWindow* flow) {
+        if (plain.empty() || plain[0] != static_cast<uint8_t>(MgmtMsgType::CREDIT)) return false;
+        if (flow && plain.size() >= CREDIT_FRAME_BYTES) {
+            uint32_t v[3];
+            memcpy(v, plain.data() + 1, sizeof(v));
+            flow->on_credit(ntohl(v[0]), ntohl(v[1]), ntohl(v[2]));
+        }
+        return true;
     }
 
-    void mark_upstream_failed() {
-        std::lock_guard<std::mutex> lock(upstream_mutex_);
-        mark_upstream_failed_locked();
+    void on_upstream_frame(uint32_t call_id, uint32_t payload_size, const FrameMeta& meta) {
+        seq_tracker_.observe(call_id, meta.seq);
+        grant_credit(call_id, payload_size);
     }
 
-    void mark_downstream_failed() {
-        std::lock_guard<std::mutex> lock(downstream_mutex_);
-        mark_downstream_failed_locked();
+    // Receiver side of flow control: one consumed frame of call_id.
+    void grant_credit(uint32_t call_id, uint32_t payload_size) {
+        CreditLedger::Grant due[2];
+        int n = credit_ledger_.consume(call_id, 8 + static_cast<size_t>(payload_size), due);
+        for (int i = 0; i < n; i++) send_credit(due[i]);
     }
 
-    bool is_socket_dead(int fd) {
-        if (fd < 0) return false;
-        struct pollfd pfd = {fd, POLLIN, 0};
-        int ret = poll(&pfd, 1, 0);
-        if (ret > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))) return true;
-        if (ret > 0 && (pfd.revents & POLLIN)) {
-            char probe;
-            ssize_t r = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
-            if (r == 0) return true;
+    void flush_credits() {
+        if (credit_ledger_.empty()) return;
+        CreditLedger::Grant due[CreditLedger::FLUSH_BATCH];
+        while (int n = credit_ledger_.take(due)) {
+            for (int i = 0; i < n; i++) send_credit(due[i]);
         }
-        return false;
     }
 
-    int create_listen_socket(uint16_t port) {
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (sock < 0) return -1;
-
-        int opt = 1;
-        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Grants go to every upstream peer: with fan-in only the replica that
+    // carried the call has it in flight, and the others ignore it. A failed
+    // send is left to the peer's mgmt reader to notice.
+    void send_credit(const CreditLedger::Grant& g) {
+        uint8_t buf[CREDIT_FRAME_BYTES];
+        buf[0] = static_cast<uint8_t>(MgmtMsgType::CREDIT);
+        uint32_t v[3] = {htonl(g.call_id), htonl(g.bytes), htonl(g.frames)};
+        memcpy(buf + 1, v, sizeof(v));
+        int socks[MAX_STAGE_REPLICAS];
+        size_t n = 0;
+        {
+            std::lock_guard<std::mutex> lock(upstream_mutex_);
+            if (upstream_mgmt_accepted_ >= 0) socks[n++] = upstream_mgmt_accepted_;
+            for (int fd : extra_upstream_mgmt_) {
+                if (n < MAX_STAGE_REPLICAS) socks[n++] = fd;
+            }
+        }
+        std::lock_guard<std::mutex> lock(send_upstream_mgmt_mutex_);
+        for (size_t i = 0; i < n; i++) send_encrypted(socks[i], buf, sizeof(buf), MGMT_SEND_TIMEOUT_MS);
+    }
 
-        sockaddr_in addr{};
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-        addr.sin_port = htons(port);
+    // Window of the default downstream link carrying call_id; nullptr if
+    // there is none (routed default with no replica configured).
+    FlowWindow* default_flow_for(uint32_t call_id) {
+        if (!routed_default_) return &downstream_flow_;
+        DownstreamConnection* dc = route_call(routed_target_, call_id);
+        return dc ? &dc->flow : nullptr;
+    }
 
-        if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
-            ::close(sock);
-            return -1;
+    // Sender side of the shm handshake. Creates a ring and offers it as
+    //   "IC_SHM_OFFER:<shm name>:<local port of data_sock>"
+    // The receiver binds the ring to the data connection whose peer port
+    // matches, replying IC_SHM_OK, or IC_SHM_RETRY if it has not accepted
+    // that connection yet. Any other reply (including an older peer that does
+    // not know the message) leaves the hop on TCP.
+    std::shared_ptr<ShmRing> negotiate_shm(int mgmt_sock, int data_sock) {
+        if (!shm_enabled_ || prodigy_tls::ic_encryption_enabled()) return nullptr;
+
+        sockaddr_in local{};
+        socklen_t slen = sizeof(local);
+        if (getsockname(data_sock, (sockaddr*)&local, &slen) != 0) return nullptr;
+
+        std::string name;
+        auto ring = ShmRing::create(ShmRing::DEFAULT_CAPACITY, name);
+        if (!ring) {
+            std::fprintf(stderr, "[%s] shm ring allocation failed, using TCP\n",
+                        service_type_to_string(type_));
+            return nullptr;
         }
 
-        if (listen(sock, LISTEN_BACKLOG) < 0) {
-            ::close(sock);
-            return -1;
+        std::string offer = "IC_SHM_OFFER:" + name + ":" + std::to_string(ntohs(local.sin_port));
+        bool accepted = false;
+        for (int attempt = 0; attempt < SHM_OFFER_ATTEMPTS && running_; attempt++) {
+            std::string resp = exchange_custom(mgmt_sock, offer, CUSTOM_MSG_TIMEOUT_MS);
+            if (resp == "IC_SHM_OK") { accepted = true; break; }
+            if (resp != "IC_SHM_RETRY") break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(SHM_OFFER_RETRY_MS));
         }
-
-        return sock;
+        ShmRing::unlink(name);
+        return accepted ? ring : nullptr;
     }
 
-    int connect_to_port_with_timeout(const char* host, uint16_t port, int timeout_ms) {
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (sock < 0) return -1;
+    // Interconnect-internal CUSTOM messages ("IC_" prefix); never reach
+    // custom_handler_.
+    std::string handle_interconnect_custom(const std::string& msg) {
+        static const std::string kOffer = "IC_SHM_OFFER:";
+        static const std::string kKtlsOffer = "IC_KTLS_OFFER:";
+        static const std::string kHdrOffer = "IC_HDR_OFFER:";
+        if (msg.compare(0, kKtlsOffer.size(), kKtlsOffer) == 0) return handle_ktls_offer(msg);
+        if (msg.compare(0, kHdrOffer.size(), kHdrOffer) == 0) {
+            int version = std::atoi(msg.c_str() + kHdrOffer.size());
+            if (version < 1) return "IC_HDR_FAIL";
+            std::string ok = "IC_HDR_OK:" + std::to_string(std::min<int>(version, FrameMeta::VERSION));
+            uint32_t accepts = accepted_types_.load(std::memory_order_relaxed);
+            if (accepts) {
+                char mask[16];
+                snprintf(mask, sizeof(mask), "%x", accepts);
+                ok += ":ACCEPT:";
+                ok += mask;
+            }
+            return ok;
+        }
+        if (msg.compare(0, kOffer.size(), kOffer) != 0) return "IC_UNSUPPORTED";
+
+        auto sep = msg.rfind(':');
+        if (sep <= kOffer.size()) return "IC_SHM_FAIL";
+        std::string name = msg.substr(kOffer.size(), sep - kOffer.size());
+        uint16_t peer_port = 0;
+        try {
+            peer_port = static_cast<uint16_t>(std::stoul(msg.substr(sep + 1)));
+        } catch (...) {
+            return "IC_SHM_FAIL";
+        }
 
-        int flags = fcntl(sock, F_GETFL, 0);
-        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+        auto ring = ShmRing::open(name);
+        if (!ring) return "IC_SHM_FAIL";
 
-        sockaddr_in addr{};
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = inet_addr(host);
-        addr.sin_port = htons(port);
+        // The data connection may be waiting in the backlog behind this very
+        // message; take it now instead of making the peer retry.
+        accept_upstream(false);
 
-        int ret = connect(sock, (sockaddr*)&addr, sizeof(addr));
-        if (ret < 0 && errno != EINPROGRESS) {
-            ::close(sock);
-            return -1;
+        std::lock_guard<std::mutex> lock(upstream_mutex_);
+        if (upstream_data_accepted_ < 0) return "IC_SHM_RETRY";
+        if (peer_port_of(upstream_data_accepted_) != peer_port) {
+            // The ring only ever serves the primary data slot; a fan-in
+            // peer stays on TCP.
+            for (int fd : extra_upstream_data_) {
+                if (peer_port_of(fd) == peer_port) return "IC_SHM_FAIL";
+            }
+            return "IC_SHM_RETRY";
         }
+        reset_shm(upstream_shm_);
+        upstream_shm_ = ring;
+        std::fprintf(stderr, "[%s] Upstream data switched to shm ring (%zu KiB)\n",
+                    service_type_to_string(type_), ring->capacity() / 1024);
+        return "IC_SHM_OK";
+    }
 
-        if (ret == 0) {
-            fcntl(sock, F_SETFL, flags);
-            return sock;
+    // Typed-header handshake, run before the data socket is published:
+    //   "IC_HDR_OFFER:<highest version>" → "IC_HDR_OK:<agreed version>[:ACCEPT:<mask hex>]"
+    // ACCEPT lists the extra payload types the peer decodes (bit = type).
+    // A peer that predates it answers IC_UNSUPPORTED and the link stays
+    // untyped (no META_FLAG frames are sent to it).
+    bool negotiate_typed_header(int mgmt_sock, uint32_t& accepts) {
+        accepts = 0;
+        if (!typed_hdr_enabled_.load(std::memory_order_relaxed)) return false;
+        std::string resp = exchange_custom(mgmt_sock, "IC_HDR_OFFER:" + std::to_string(FrameMeta::VERSION),
+                                           CUSTOM_MSG_TIMEOUT_MS);
+        static const std::string kOk = "IC_HDR_OK:";
+        static const std::string kAccept = ":ACCEPT:";
+        if (resp.compare(0, kOk.size(), kOk) != 0 || std::atoi(resp.c_str() + kOk.size()) < 1) return false;
+        auto pos = resp.find(kAccept);
+        if (pos != std::string::npos) {
+            accepts = static_cast<uint32_t>(std::strtoul(resp.c_str() + pos + kAccept.size(), nullptr, 16));
         }
+        return true;
+    }
 
-        pollfd pfd = {sock, POLLOUT, 0};
-        int poll_ret = poll(&pfd, 1, timeout_ms);
-
-        if (poll_ret <= 0) {
-            ::close(sock);
-            return -1;
+    // Sender side of the kTLS handshake, run before the data socket is
+    // published and only while IC encryption is on:
+    //   "IC_KTLS_OFFER:<nonce hex>:<local port of data_sock>"
+    // The receiver installs TLS_RX on the matching data connection and
+    // replies IC_KTLS_OK (IC_KTLS_RETRY if it has not accepted it yet); only
+    // then is TLS_TX installed here. Any other reply leaves the hop on
+    // userspace AES-GCM. Should TX fail after the peer switched, the socket
+    // is shut down so the hangup watch reconnects it.
+    bool negotiate_ktls(int mgmt_sock, int data_sock) {
+        if (!ktls_enabled_ || !prodigy_tls::ic_encryption_enabled()) return false;
+        if (!prodigy_tls::ic_ktls_attach(data_sock)) return false;
+
+        sockaddr_in local{};
+        socklen_t slen = sizeof(local);
+        if (getsockname(data_sock, (sockaddr*)&local, &slen) != 0) return false;
+        uint8_t nonce[prodigy_tls::IC_KTLS_NONCE_LEN];
+        if (RAND_bytes(nonce, sizeof(nonce)) != 1) return false;
+        static const char kHex[] = "0123456789abcdef";
+        std::string offer = "IC_KTLS_OFFER:";
+        for (uint8_t b : nonce) {
+            offer += kHex[b >> 4];
+            offer += kHex[b & 0xF];
+        }
+        offer += ":" + std::to_string(ntohs(local.sin_port));
+
+        bool accepted = false;
+        for (int attempt = 0; attempt < KTLS_OFFER_ATTEMPTS && running_; attempt++) {
+            std::string resp = exchange_custom(mgmt_sock, offer, CUSTOM_MSG_TIMEOUT_MS);
+            if (resp == "IC_KTLS_OK") { accepted = true; break; }
+            if (resp != "IC_KTLS_RETRY") break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(KTLS_OFFER_RETRY_MS));
+        }
+        if (!accepted) return false;
+        if (!ktls_socks_.add(data_sock)) {
+            ::shutdown(data_sock, SHUT_RDWR);
+            return false;
         }
+        if (!prodigy_tls::ic_ktls_install(data_sock, nonce, true)) {
+            ktls_socks_.remove(data_sock);
+            ::shutdown(data_sock, SHUT_RDWR);
+            return false;
+        }
+        return true;
+    }
 
-        int error = 0;
-        socklen_t errlen = sizeof(error);
-        getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &errlen);
-        if (error != 0) {
-            ::close(sock);
+    // Receiver side: any upstream data connection (primary or fan-in) may
+    // switch, as long as nothing has been sent on it yet — the sender holds
+    // it back until the reply.
+    std::string handle_ktls_offer(const std::string& msg) {
+        static const size_t kHexStart = sizeof("IC_KTLS_OFFER:") - 1;
+        auto sep = msg.rfind(':');
+        if (!prodigy_tls::ic_encryption_enabled() ||
+            sep != kHexStart + 2 * prodigy_tls::IC_KTLS_NONCE_LEN) {
+            return "IC_KTLS_FAIL";
+        }
+        uint8_t nonce[prodigy_tls::IC_KTLS_NONCE_LEN];
+        auto nibble = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
             return -1;
+        };
+        for (size_t i = 0; i < sizeof(nonce); i++) {
+            int hi = nibble(msg[kHexStart + 2 * i]);
+            int lo = nibble(msg[kHexStart + 2 * i + 1]);
+            if (hi < 0 || lo < 0) return "IC_KTLS_FAIL";
+            nonce[i] = static_cast<uint8_t>(hi << 4 | lo);
+        }
+        uint16_t peer_port = 0;
+        try {
+            peer_port = static_cast<uint16_t>(std::stoul(msg.substr(sep + 1)));
+        } catch (...) {
+            return "IC_KTLS_FAIL";
         }
 
-        fcntl(sock, F_SETFL, flags);
-        return sock;
-    }
-
-    void setup_socket_options(int sock) {
-#ifdef SO_NOSIGPIPE
-        int opt = 1;
-        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
-#endif
-        int opt_tcp = 1;
-        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt_tcp, sizeof(opt_tcp));
+        accept_upstream(false);
 
-        // Enable TCP keepalive for fast dead-peer detection.
-        int keepalive = 1;
-        setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
-#ifdef TCP_KEEPIDLE
-        int idle = TCP_KEEPALIVE_IDLE_S;
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
-#endif
-#ifdef TCP_KEEPINTVL
-        int intvl = TCP_KEEPALIVE_INTVL_S;
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
-#endif
-#ifdef TCP_KEEPCNT
-        int cnt = TCP_KEEPALIVE_CNT;
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
-#endif
+        std::lock_guard<std::mutex> lock(upstream_mutex_);
+        int fd = -1;
+        for (int candidate : extra_upstream_data_) {
+            if (peer_port_of(candidate) == peer_port) fd = candidate;
+        }
+        if (upstream_data_accepted_ >= 0 && peer_port_of(upstream_data_accepted_) == peer_port) {
+            fd = upstream_data_accepted_;
+        }
+        if (fd < 0) return "IC_KTLS_RETRY";
+        if (!ktls_socks_.add(fd)) return "IC_KTLS_FAIL";
+        if (!prodigy_tls::ic_ktls_attach(fd) || !prodigy_tls::ic_ktls_install(fd, nonce, false)) {
+            ktls_socks_.remove(fd);
+            return "IC_KTLS_FAIL";
+        }
+        std::fprintf(stderr, "[%s] Upstream data switched to kTLS\n",
+                    service_type_to_string(type_));
+        return "IC_KTLS_OK";
     }
 
-    bool send_all_with_timeout(int sock, const void* data, size_t len, int timeout_ms) {
-        const uint8_t* ptr = static_cast<const uint8_t*>(data);
-        size_t sent = 0;
-        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
-
-        while (sent < len) {
-            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
-                deadline - std::chrono::steady_clock::now()).count();
-            if (remaining <= 0) return false;
+    static uint16_t peer_port_of(int fd) {
+        sockaddr_in peer{};
+        socklen_t plen = sizeof(peer);
+        if (getpeername(fd, (sockaddr*)&peer, &plen) != 0) return 0;
+        return ntohs(peer.sin_port);
+    }
 
-            pollfd pfd = {sock, POLLOUT, 0};
-            int pr = poll(&pfd, 1, static_cast<int>(remaining));
-            if (pr <= 0) return false;
-            if (pfd.revents & (POLLERR | POLLHUP)) return false;
+    template <typename P>
+    bool send_packet_shm(ShmRing& ring, const P& pkt, const FrameMeta* meta, bool with_trace,
+                         int timeout_ms) {
+        uint8_t hdr[8];
+        uint8_t ext[MAX_EXT_BYTES];
+        uint32_t flags = 0;
+        size_t ext_len = write_extensions(ext, meta, with_trace ? &pkt.trace : nullptr, flags);
+        write_packet_header(hdr, pkt.call_id, pkt.payload_size | flags);
+        return ring.push(hdr, sizeof(hdr), packet_payload_ptr(pkt), pkt.payload_size,
+                         ext, ext_len, timeout_ms);
+    }
 
-            ssize_t n = send(sock, ptr + sent, len - sent, 0);
-            if (n <= 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue;
-                return false;
-            }
-            sent += n;
+    // Validates the front record, decodes its extensions and returns its
+    // payload size, or -1 after dropping a malformed record (closing the ring
+    // if the length is corrupt).
+    int64_t shm_front_payload(ShmRing& ring, uint32_t& call_id, FrameMeta& meta, PacketTrace& trace) {
+        uint32_t len = ring.front_size();
+        if (len < 8 || len > ring.capacity()) {
+            ring.close();
+            return -1;
         }
-        return true;
+        uint8_t hdr[8];
+        ring.read_front(0, hdr, sizeof(hdr));
+        uint32_t net_call_id, net_size;
+        memcpy(&net_call_id, hdr, 4);
+        memcpy(&net_size, hdr + 4, 4);
+        call_id = ntohl(net_call_id);
+        uint32_t wire_size = ntohl(net_size);
+        uint32_t size = wire_size & Packet::SIZE_MASK;
+        size_t ext_len = len - 8 >= size ? len - 8 - size : SIZE_MAX;
+        bool ok = call_id != 0 && size <= Packet::MAX_PAYLOAD_SIZE &&
+                  ext_len <= max_ext_bytes(wire_size);
+        if (ok) {
+            uint8_t ext[MAX_EXT_BYTES];
+            if (ext_len) ring.read_front(8 + size, ext, ext_len);
+            ok = read_extensions(wire_size, ext, ext_len, meta, trace);
+        }
+        if (!ok) {
+            ring.pop_front();
+            return -1;
+        }
+        return size;
     }
 
-    bool recv_exact(int sock, void* buf, size_t len, int timeout_ms) {
-        uint8_t* ptr = static_cast<uint8_t*>(buf);
-        size_t received = 0;
-        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
-
-        while (received < len) {
-            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
-                deadline - std::chrono::steady_clock::now()).count();
-            if (remaining <= 0) return false;
-
-            pollfd pfd = {sock, POLLIN, 0};
-            int pr = poll(&pfd, 1, static_cast<int>(remaining));
-            if (pr <= 0) return false;
-            if (pfd.revents & POLLERR) return false;
-            if (!(pfd.revents & POLLIN)) return false;
+    // Reads one record straight into pkt.payload (no intermediate frame buffer).
+    bool recv_packet_shm(ShmRing& ring, Packet& pkt, int timeout_ms) {
+        if (!ring.wait_readable(timeout_ms)) return false;
+        uint32_t call_id = 0;
+        int64_t size = shm_front_payload(ring, call_id, pkt.meta, pkt.trace);
+        if (size < 0) return false;
+        pkt.call_id = call_id;
+        pkt.payload_size = static_cast<uint32_t>(size);
+        pkt.payload.resize(pkt.payload_size);
+        if (size > 0) ring.read_front(8, pkt.payload.data(), pkt.payload_size);
+        ring.pop_front();
+        return true;
+    }
 
-            ssize_t n = recv(sock, ptr + received, len - received, 0);
-            if (n <= 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue;
-                return false;
-            }
-            received += n;
+    bool recv_packet_shm(ShmRing& ring, PooledPacket& pkt, int timeout_ms) {
+        if (!ring.wait_readable(timeout_ms)) return false;
+        uint32_t call_id = 0;
+        int64_t size = shm_front_payload(ring, call_id, pkt.meta, pkt.trace);
+        if (size < 0) return false;
+        PacketBufRef buf = pool_->acquire(static_cast<size_t>(size));
+        if (!buf) {
+            ring.pop_front();
+            return false;
         }
+        if (size > 0) ring.read_front(8, buf->payload(), static_cast<size_t>(size));
+        ring.pop_front();
+        pkt.call_id = call_id;
+        pkt.payload_size = static_cast<uint32_t>(size);
+        pkt.buf = std::move(buf);
         return true;
     }
 
-    bool send_encrypted(int sock, const void* data, size_t len, int timeout_ms) {
-        // When IC encryption is disabled (default), send a length-prefixed
-        // plaintext frame. The 4-byte big-endian length prefix is the same
-        // as the encrypted path so both sides stay in framing-lockstep as
-        // long as the flag matches (it's read once per process).
-        if (!prodigy_tls::ic_encryption_enabled()) {
-            std::vector<uint8_t> buf(4 + len);
-            uint32_t net_len = htonl(static_cast<uint32_t>(len));
-            memcpy(buf.data(), &net_len, 4);
-            if (len > 0) memcpy(buf.data() + 4, data, len);
-            return send_all_with_timeout(sock, buf.data(), 4 + len, timeout_ms);
-        }
-        size_t enc_size = prodigy_tls::ic_encrypted_size(len);
-        std::vector<uint8_t> enc_buf(4 + enc_size);
-        size_t actual_enc_len = 0;
-        if (!prodigy_tls::ic_encrypt(static_cast<const uint8_t*>(data), len,
-                                      enc_buf.data() + 4, actual_enc_len)) {
-            return false;
+    // Folds a received trace into hop_latency_. Only the pairs that end at one
+    // of the sending service's own hops are recorded here (pairs further
+    // upstream were recorded by the nodes in between), plus the transfer into
+    // this node and the end-to-end time from the first hop.
+    void account_hops(const PacketTrace& t) {
+        if (t.hop_count == 0) return;
+        const uint64_t now = PacketTrace::now_us();
+        const uint8_t self = static_cast<uint8_t>(type_);
+        const auto& last = t.hops[t.hop_count - 1];
+        for (int i = t.hop_count - 1; i >= 1 && t.hops[i].service_id == last.service_id; i--) {
+            record_hop(t.hops[i - 1], t.hops[i].service_id, t.hops[i].direction, t.hops[i].timestamp_us);
         }
-        uint32_t net_len = htonl(static_cast<uint32_t>(actual_enc_len));
-        memcpy(enc_buf.data(), &net_len, 4);
-        return send_all_with_timeout(sock, enc_buf.data(), 4 + actual_enc_len, timeout_ms);
+        record_hop(last, self, HopLatencyTable::DIR_ARRIVAL, now);
+        if (t.hop_count > 1) record_hop(t.hops[0], self, HopLatencyTable::DIR_ARRIVAL, now);
     }
 
-    bool recv_encrypted(int sock, std::vector<uint8_t>& plaintext, int timeout_ms) {
-        uint32_t net_len;
-        if (!recv_exact(sock, &net_len, 4, timeout_ms)) return false;
-        uint32_t frame_len = ntohl(net_len);
-        if (frame_len > Packet::MAX_PAYLOAD_SIZE + 256) return false;
-        if (!prodigy_tls::ic_encryption_enabled()) {
-            plaintext.resize(frame_len);
-            if (frame_len > 0 &&
-                !recv_exact(sock, plaintext.data(), frame_len, timeout_ms)) {
-                return false;
+    void record_hop(const PacketTrace::Hop& from, uint8_t to_svc, uint8_t to_dir, uint64_t to_us) {
+        if (from.service_id == 0 || to_svc == 0) return;
+        uint64_t dt = to_us > from.timestamp_us ? to_us - from.timestamp_us : 0;
+        hop_latency_.record(HopLatencyTable::make_key(from.service_id, from.direction, to_svc, to_dir), dt);
+    }
+
+    // Visits every downstream link: fn(target, instance, connected, stats,
+    // typed). The single default link counts even before it first connects.
+    template <typename Fn>
+    void for_each_link(Fn&& fn) const {
+        size_t window = flow_window();
+        if (is_pipeline_service(type_) && downstream_connections_.empty() && !connect_disabled_) {
+            ServiceType ds;
+            {
+                std::lock_guard<std::mutex> lock(state_mutex_);
+                ds = downstream_override_.value_or(downstream_of(type_));
             }
-            return true;
+            bool typed;
+            {
+                std::lock_guard<std::mutex> lock(downstream_mutex_);
+                typed = downstream_typed_hdr_;
+            }
+            fn(ds, 0, downstream_state() == ConnectionState::CONNECTED, downstream_flow_.stats(window), typed);
         }
-        std::vector<uint8_t> enc_buf(frame_len);
-        if (!recv_exact(sock, enc_buf.data(), frame_len, timeout_ms)) return false;
-        plaintext.resize(frame_len);
-        size_t plain_len = 0;
-        if (!prodigy_tls::ic_decrypt(enc_buf.data(), frame_len,
-                                      plaintext.data(), plain_len)) {
-            return false;
+        for (const auto& dc : downstream_connections_) {
+            bool typed;
+            {
+                std::lock_guard<std::mutex> lock(dc->data_send_mutex);
+                typed = dc->typed_hdr;
+            }
+            fn(dc->target, dc->instance, dc->state.load(std::memory_order_relaxed) == ConnectionState::CONNECTED,
+               dc->flow.stats(window), typed);
+        }
+    }
+
+    static const char* hop_dir_name(uint8_t dir) {
+        switch (dir) {
+            case HopLatencyTable::DIR_IN: return "IN";
+            case HopLatencyTable::DIR_OUT: return "OUT";
+            case HopLatencyTable::DIR_ARRIVAL: return "ARR";
+            case HopLatencyTable::DIR_SIGNAL: return "SIG";
+            case HopLatencyTable::DIR_ACTION: return "ACT";
+            default: return "?";
         }
-        plaintext.resize(plain_len);
-        return true;
     }
 
-    bool recv_packet(int sock, Packet& pkt, int timeout_ms) {
-        std::vector<uint8_t> plaintext;
-        if (!recv_encrypted(sock, plaintext, timeout_ms)) return false;
-        if (plaintext.size() < 8) return false;
-        return Packet::deserialize(plaintext.data(), plaintext.size(), pkt);
+    // Closing wakes a peer blocked on the ring so it notices the teardown.
+    void reset_shm(std::shared_ptr<ShmRing>& shm) {
+        if (shm) {
+            shm->close();
+            shm.reset();
+        }
     }
 
     void close_socket(int& sock) {
         if (sock >= 0) {
+            loop_.unwatch(sock);
+            ktls_socks_.remove(sock);
+            seqpacket_socks_.remove(sock);
             ::shutdown(sock, SHUT_RDWR);
             ::close(sock);
             sock = -1;
@@ -1728,28 +4191,59 @@ inline LogLevel log_level_from_string(const char* s) {
 // LogForwarder — UDP log sink for all pipeline services.
 //
 // Each service owns one LogForwarder instance. After init(), every call to
-// forward() serializes the message as:
-//   "<SERVICE> <LEVEL> <CALL_ID> <message>\0"
-// and sendto() it to the frontend log server at 127.0.0.1:22022 (FRONTEND_LOG_PORT).
+// forward() produces one entry "<SERVICE> <LEVEL> <CALL_ID> <message>" for
+// the frontend log server at 127.0.0.1:22022 (FRONTEND_LOG_PORT). The
+// frontend process_log_message() parses it, stores entries in SQLite, and
+// exposes them via GET /api/logs for the UI and test scripts.
 //
-// The frontend process_log_message() parses this format, stores entries in SQLite,
-// and exposes them via GET /api/logs for the UI and test scripts.
+// forward() does not format or send on the calling thread. It writes a
+// binary record (format pointer, copied arguments, call_id, level, counter
+// timestamp) into that thread's LogRing (log-ring.h) and returns. A drain
+// thread wakes every LOG_DRAIN_INTERVAL_MS (sooner during a burst), formats
+// the records and sends them as batch datagrams, LOG_SEND_BATCH per
+// sendmmsg(). fmt must therefore
+// be a string literal; __attribute__((format)) checks the arguments. A
+// thread whose ring is full drops the record; the drain thread reports the
+// count as a WARN entry. Pending records are sent by flush() and by the
+// destructor; a process that dies without either loses at most one drain
+// interval of logs — set WHISPERTALK_LOG_SYNC=1 to format and sendto() on
+// the calling thread as before.
 //
 // Thread safety: forward() is safe to call from any thread. set_level() uses an
 // atomic store so level changes take effect immediately without a lock.
 //
-// Buffer sizing:
-//   msg[2048]: max message body; vsnprintf truncates safely at 2047 + null.
-//   buf[2304]: prefix overhead max 41 bytes + 2047 body = 2088 < 2304.
-//   Frontend recv buffer: 4096 bytes — larger than max datagram (2304).
+// Buffer sizing (both paths):
+//   message body: at most 2047 bytes (LOG_MESSAGE_MAX), truncated safely.
+//   entry: prefix overhead max 41 bytes + 2047 body = 2088 < 2304.
+//   Frontend recv buffer: 64 KiB — larger than a batch (LOG_BATCH_DATAGRAM_BYTES).
+static constexpr int LOG_DRAIN_INTERVAL_MS = 10;
+static constexpr size_t LOG_SEND_BATCH = 32;
+static constexpr size_t LOG_BURST_RECORDS = 256;
+
+inline bool log_sync_default() {
+    static const bool sync = []() {
+        const char* v = std::getenv("WHISPERTALK_LOG_SYNC");
+        return v && (std::strcmp(v, "1") == 0 || std::strcmp(v, "true") == 0);
+    }();
+    return sync;
+}
+
 class LogForwarder {
 public:
     LogForwarder() : sock_(-1), port_(0), log_level_(static_cast<int>(LogLevel::INFO)) {}
 
     ~LogForwarder() {
+        stop_drain();
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            for (auto& tr : rings_) tr->orphaned.store(true, std::memory_order_release);
+        }
         if (sock_ >= 0) ::close(sock_);
     }
 
+    LogForwarder(const LogForwarder&) = delete;
+    LogForwarder& operator=(const LogForwarder&) = delete;
+
     void init(uint16_t port, ServiceType svc) {
         init(port, service_type_to_string(svc));
     }
@@ -1764,6 +4258,10 @@ public:
             addr_.sin_family = AF_INET;
             addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
             addr_.sin_port = htons(port_);
+            if (!log_sync_default() && !drain_thread_.joinable()) {
+                drain_stop_ = false;
+                drain_thread_ = std::thread(&LogForwarder::drain_loop, this);
+            }
         }
     }
 
@@ -1779,28 +4277,202 @@ public:
         return static_cast<LogLevel>(log_level_.load(std::memory_order_relaxed));
     }
 
+    __attribute__((format(printf, 4, 5)))
     void forward(LogLevel lvl, uint32_t call_id, const char* fmt, ...) {
         if (sock_ < 0) return;
         if (static_cast<int>(lvl) > log_level_.load(std::memory_order_relaxed)) return;
         va_list args;
         va_start(args, fmt);
-        vforward(log_level_string(lvl), call_id, fmt, args);
+        vforward(lvl, call_id, fmt, args);
         va_end(args);
     }
 
+    __attribute__((format(printf, 4, 5)))
     void forward(const char* level, uint32_t call_id, const char* fmt, ...) {
         if (sock_ < 0) return;
-        if (static_cast<int>(log_level_from_string(level)) > log_level_.load(std::memory_order_relaxed)) return;
+        LogLevel lvl = log_level_from_string(level);
+        if (static_cast<int>(lvl) > log_level_.load(std::memory_order_relaxed)) return;
         va_list args;
         va_start(args, fmt);
-        vforward(level, call_id, fmt, args);
+        vforward(lvl, call_id, fmt, args);
         va_end(args);
     }
 
     bool active() const { return sock_ >= 0 && port_ > 0; }
 
+    // Formats and sends everything logged so far (from any thread).
+    void flush() {
+        if (drain_thread_.joinable()) drain_once();
+    }
+
+    // Records dropped because a thread's ring was full.
+    uint64_t dropped() const { return dropped_total_.load(std::memory_order_relaxed); }
+
+    // Rings registered by threads that logged here and have not exited yet,
+    // or whose records are not drained yet.
+    size_t thread_rings() const {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        return rings_.size();
+    }
+
 private:
-    void vforward(const char* level, uint32_t call_id, const char* fmt, va_list args) {
+    struct ThreadRing {
+        LogRing ring;
+        std::atomic<uint64_t> dropped{0};   // written by the owning thread
+        uint64_t dropped_reported = 0;      // drain thread only
+        std::atomic<bool> retired{false};   // the owning thread has exited
+        std::atomic<bool> orphaned{false};  // the forwarder is gone
+        std::atomic<bool> wake_sent{false}; // early drain requested, cleared by the drain
+    };
+
+    void vforward(LogLevel lvl, uint32_t call_id, const char* fmt, va_list args) {
+        if (!drain_thread_.joinable()) {
+            send_now(lvl, call_id, fmt, args);
+            return;
+        }
+        ThreadRing* tr = thread_ring();
+        if (!log_ring_write(tr->ring, static_cast<uint8_t>(lvl), call_id, fmt, args)) {
+            tr->dropped.store(tr->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        // A burst: wake the drain thread early, once per half ring.
+        if (tr->ring.used() > tr->ring.capacity() / 2 && !tr->wake_sent.exchange(true, std::memory_order_relaxed)) {
+            drain_wake_.notify_one();
+        }
+    }
+
+    // The calling thread's ring for this forwarder. A thread keeps one ring
+    // per forwarder it logs to, so alternating between forwarders does not
+    // allocate. Rings of destroyed forwarders are released on the next miss.
+    ThreadRing* thread_ring() {
+        struct Slot {
+            uint64_t owner;
+            std::shared_ptr<ThreadRing> ring;
+        };
+        struct Slots {
+            std::vector<Slot> slots;
+            ~Slots() {
+                for (auto& s : slots) s.ring->retired.store(true, std::memory_order_release);
+            }
+        };
+        thread_local Slots mine;
+        for (auto& s : mine.slots) {
+            if (s.owner == id_) return s.ring.get();
+        }
+        mine.slots.erase(std::remove_if(mine.slots.begin(), mine.slots.end(), [](const Slot& s) {
+            return s.ring->orphaned.load(std::memory_order_acquire);
+        }), mine.slots.end());
+        auto ring = std::make_shared<ThreadRing>();
+        mine.slots.push_back({id_, ring});
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(ring);
+        return ring.get();
+    }
+
+    // Drains every LOG_DRAIN_INTERVAL_MS, every millisecond while a pass
+    // finds a burst (LOG_BURST_RECORDS or more).
+    void drain_loop() {
+        std::unique_lock<std::mutex> lock(drain_wake_mutex_);
+        size_t drained = 0;
+        while (!drain_stop_) {
+            drain_wake_.wait_for(lock, std::chrono::milliseconds(
+                drained >= LOG_BURST_RECORDS ? 1 : LOG_DRAIN_INTERVAL_MS));
+            lock.unlock();
+            drained = drain_once();
+            lock.lock();
+        }
+    }
+
+    void stop_drain() {
+        if (!drain_thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(drain_wake_mutex_);
+            drain_stop_ = true;
+        }
+        drain_wake_.notify_all();
+        drain_thread_.join();
+        drain_once();
+    }
+
+    size_t drain_once() {
+        std::lock_guard<std::mutex> drain(drain_mutex_);
+        size_t records = 0;
+        clock_.update();
+        std::vector<std::shared_ptr<ThreadRing>> rings;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings = rings_;
+        }
+        char msg[LOG_MESSAGE_MAX + 1];
+        for (auto& tr : rings) {
+            bool retired = tr->retired.load(std::memory_order_acquire);
+            tr->wake_sent.store(false, std::memory_order_relaxed);
+            records += tr->ring.drain([&](const LogRecordHeader& hdr, const uint8_t* args) {
+                log_render(msg, sizeof(msg), hdr.fmt, args, hdr.args_len);
+                queue_entry(clock_.wall_us(hdr.ticks), static_cast<LogLevel>(hdr.level), hdr.call_id, msg);
+            });
+            uint64_t dropped = tr->dropped.load(std::memory_order_relaxed);
+            if (dropped != tr->dropped_reported) {
+                uint64_t n = dropped - tr->dropped_reported;
+                tr->dropped_reported = dropped;
+                dropped_total_.fetch_add(n, std::memory_order_relaxed);
+                snprintf(msg, sizeof(msg), "Log ring full: dropped %llu records", static_cast<unsigned long long>(n));
+                queue_entry(log_wall_us(), LogLevel::WARN, 0, msg);
+            }
+            if (retired && tr->ring.empty()) {
+                std::lock_guard<std::mutex> lock(rings_mutex_);
+                rings_.erase(std::remove(rings_.begin(), rings_.end(), tr), rings_.end());
+            }
+        }
+        send_batches();
+        return records;
+    }
+
+    void queue_entry(uint64_t wall_us, LogLevel lvl, uint32_t call_id, const char* msg) {
+        char buf[2304];
+        int blen = snprintf(buf, sizeof(buf), "%s %s %u %s", svc_name_, log_level_string(lvl), call_id, msg);
+        if (blen <= 0) return;
+        size_t len = std::min(static_cast<size_t>(blen), sizeof(buf) - 1);
+        if (batches_.empty()) batches_.emplace_back();
+        if (!log_batch_append(batches_.back(), wall_us, buf, len)) {
+            if (batches_.size() == LOG_SEND_BATCH) send_batches();
+            batches_.emplace_back();
+            log_batch_append(batches_.back(), wall_us, buf, len);
+        }
+    }
+
+    void send_batches() {
+        size_t n = batches_.size();
+        if (n == 0 || batches_[0].empty()) {
+            batches_.clear();
+            return;
+        }
+#ifdef __linux__
+        mmsghdr msgs[LOG_SEND_BATCH];
+        iovec iovs[LOG_SEND_BATCH];
+        for (size_t i = 0; i < n; i++) {
+            iovs[i] = {batches_[i].data(), batches_[i].size()};
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_name = &addr_;
+            msgs[i].msg_hdr.msg_namelen = sizeof(addr_);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        for (size_t sent = 0; sent < n;) {
+            int r = sendmmsg(sock_, msgs + sent, static_cast<unsigned>(n - sent), 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            sent += static_cast<size_t>(r);
+        }
+#else
+        for (auto& b : batches_) {
+            sendto(sock_, b.data(), b.size(), 0, (struct sockaddr*)&addr_, sizeof(addr_));
+        }
+#endif
+        batches_.clear();
+    }
+
+    // WHISPERTALK_LOG_SYNC=1: format and send on the calling thread.
+    void send_now(LogLevel lvl, uint32_t call_id, const char* fmt, va_list args) {
         // msg[2048]: max log message body. vsnprintf truncates safely at 2047 chars + null.
         char msg[2048];
         int mlen = vsnprintf(msg, sizeof(msg), fmt, args);
@@ -1810,10 +4482,9 @@ private:
         // buf[2304]: format is "<SERVICE> <LEVEL> <CALL_ID> <message>"
         // Max prefix overhead: 23 (service) + 1 + 5 (level) + 1 + 10 (uint32) + 1 = 41 chars
         // Max total: 41 + 2047 = 2088 < 2304 — no overflow possible.
-        // recv buffer on frontend side is 4096, well above this maximum.
         char buf[2304];
         int blen = snprintf(buf, sizeof(buf), "%s %s %u %.*s",
-                            svc_name_, level, call_id, mlen, msg);
+                            svc_name_, log_level_string(lvl), call_id, mlen, msg);
         if (blen > 0) {
             if (blen >= (int)sizeof(buf)) blen = (int)sizeof(buf) - 1;
             sendto(sock_, buf, static_cast<size_t>(blen), 0,
@@ -1821,11 +4492,28 @@ private:
         }
     }
 
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> counter{0};
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
     int sock_;
     uint16_t port_;
     const char* svc_name_ = "UNKNOWN";
     struct sockaddr_in addr_;
     std::atomic<int> log_level_;
+
+    const uint64_t id_ = next_id();
+    mutable std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<ThreadRing>> rings_;
+    std::mutex drain_mutex_;                         // one drain at a time; guards the fields below
+    LogClock clock_;
+    std::vector<std::vector<uint8_t>> batches_;
+    std::atomic<uint64_t> dropped_total_{0};
+    std::thread drain_thread_;
+    std::mutex drain_wake_mutex_;
+    std::condition_variable drain_wake_;
+    bool drain_stop_ = false;
 };
 
 }
@@ -0,0 +1,361 @@
+// io-batch.h — batched datagram sends for the per-tick audio fan-out.
+//
+// The SIP client sends one RTP datagram per active call every 20 ms, each on
+// that call's own UDP socket. Sent one by one that is a sendto() per frame,
+// i.e. thousands of syscalls per second at 100 calls. SendBatch collects a
+// tick's datagrams and hands them to the kernel together:
+//
+//   io_uring   (Linux, opt-in) one IORING_OP_SENDMSG per datagram, all of
+//              them submitted — and reaped — with a single io_uring_enter().
+//              The ring is set up with raw syscalls; no liburing needed.
+//   fallback   sendmmsg() per run of datagrams on the same socket (Linux),
+//              sendmsg() per datagram elsewhere: the pre-batching path.
+//
+// Datagrams are sent with MSG_DONTWAIT on both paths; one that does not fit
+// the socket buffer is dropped, as a blocking-free UDP send would be.
+//
+// Opt-in: WHISPERTALK_IO_URING=1 (read once per process), or
+// SendBatch::set_uring(true). When the kernel refuses io_uring (old kernel,
+// seccomp, io_uring_disabled sysctl) the batch stays on the fallback.
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    define WHISPERTALK_HAVE_IO_URING 1
+#  endif
+#endif
+
+namespace whispertalk {
+
+inline bool io_uring_enabled_default() {
+    static const bool enabled = []() {
+        const char* v = std::getenv("WHISPERTALK_IO_URING");
+        return v && (std::strcmp(v, "1") == 0 || std::strcmp(v, "true") == 0);
+    }();
+    return enabled;
+}
+
+#ifdef WHISPERTALK_HAVE_IO_URING
+
+// Minimal io_uring: one submission and one completion ring, SQEs filled in
+// order and submitted together. Not thread-safe; owned by one SendBatch.
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring() { close(); }
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool open(unsigned entries) {
+        if (fd_ >= 0) return true;
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd < 0) return false;
+        sq_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_bytes_ = cq_bytes_ = std::max(sq_bytes_, cq_bytes_);
+        sq_ring_ = mmap(nullptr, sq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_SQ_RING);
+        cq_ring_ = single ? sq_ring_
+                          : mmap(nullptr, cq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 fd, IORING_OFF_CQ_RING);
+        sqe_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqe_bytes_, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            fd_ = fd;
+            close();
+            return false;
+        }
+        auto* sq = static_cast<uint8_t*>(sq_ring_);
+        auto* cq = static_cast<uint8_t*>(cq_ring_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        entries_ = p.sq_entries;
+        fd_ = fd;
+        return true;
+    }
+
+    void close() {
+        if (sqes_ && sqes_ != MAP_FAILED) munmap(sqes_, sqe_bytes_);
+        if (cq_ring_ && cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_bytes_);
+        if (sq_ring_ && sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_bytes_);
+        sqes_ = nullptr;
+        sq_ring_ = cq_ring_ = nullptr;
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+    unsigned entries() const { return entries_; }
+
+    // Queues a sendmsg; user_data comes back in the completion.
+    void prep_sendmsg(int fd, const msghdr* msg, unsigned flags, uint64_t user_data) {
+        unsigned tail = *sq_tail_;
+        unsigned idx = tail & sq_mask_;
+        io_uring_sqe* sqe = &sqes_[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(msg);
+        sqe->len = 1;
+        sqe->msg_flags = flags;
+        sqe->user_data = user_data;
+        sq_array_[idx] = idx;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        pending_++;
+    }
+
+    // Submits everything queued and calls fn(user_data, res) for each
+    // completion, returning once all of them are in. Normally that is one
+    // io_uring_enter(); a short submit or an interrupted wait takes another.
+    // `enters` counts the calls. False if the kernel refused the ring.
+    template <typename Fn>
+    bool submit_and_reap(Fn&& fn, uint64_t& enters) {
+        unsigned to_submit = pending_;
+        unsigned outstanding = pending_;
+        pending_ = 0;
+        while (outstanding > 0) {
+            enters++;
+            int r = static_cast<int>(syscall(__NR_io_uring_enter, fd_, to_submit, outstanding,
+                                             IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (r < 0 && errno != EINTR) return false;
+            if (r > 0) to_submit -= std::min(to_submit, static_cast<unsigned>(r));
+            outstanding -= reap(fn);
+        }
+        return true;
+    }
+
+private:
+    // Completions available now; returns how many.
+    template <typename Fn>
+    unsigned reap(Fn& fn) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned n = tail - head;
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            fn(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    int fd_ = -1;
+    unsigned entries_ = 0;
+    unsigned pending_ = 0;
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sq_bytes_ = 0, cq_bytes_ = 0, sqe_bytes_ = 0;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
+
+#endif  // WHISPERTALK_HAVE_IO_URING
+
+// One tick's datagrams. add() copies the destination but not the data, which
+// must stay valid until flush(). Full batches flush themselves.
+class SendBatch {
+public:
+    struct Stats {
+        uint64_t flushes = 0;     // non-empty flush() calls
+        uint64_t syscalls = 0;    // io_uring_enter / sendmmsg / sendmsg calls
+        uint64_t datagrams = 0;   // datagrams handed to the kernel
+        uint64_t failed = 0;      // datagrams the kernel refused or dropped
+    };
+
+    explicit SendBatch(size_t capacity = 256) : entries_(capacity ? capacity : 1) {
+        set_uring(io_uring_enabled_default());
+    }
+
+    // True if io_uring is now in use.
+    bool set_uring(bool enabled) {
+#ifdef WHISPERTALK_HAVE_IO_URING
+        if (!enabled) {
+            uring_.close();
+            return false;
+        }
+        return uring_.open(static_cast<unsigned>(entries_.size()));
+#else
+        (void)enabled;
+        return false;
+#endif
+    }
+
+    bool uring_active() const {
+#ifdef WHISPERTALK_HAVE_IO_URING
+        return uring_.is_open();
+#else
+        return false;
+#endif
+    }
+
+    size_t size() const { return count_; }
+
+    // Index of the datagram in this batch, for result().
+    size_t add(int fd, const void* data, size_t len, const sockaddr* to, socklen_t to_len) {
+        if (count_ == entries_.size()) flush();
+        size_t i = count_++;
+        Entry& e = entries_[i];
+        e.fd = fd;
+        e.iov = {const_cast<void*>(data), len};
+        std::memset(&e.msg, 0, sizeof(e.msg));
+        e.msg.msg_iov = &e.iov;
+        e.msg.msg_iovlen = 1;
+        if (to && to_len <= sizeof(e.to)) {
+            std::memcpy(&e.to, to, to_len);
+            e.msg.msg_name = &e.to;
+            e.msg.msg_namelen = to_len;
+        }
+        e.result = -1;
+        return i;
+    }
+
+    // Bytes sent for datagram i of the last flush, or -1.
+    ssize_t result(size_t i) const { return i < entries_.size() ? entries_[i].result : -1; }
+
+    // Sends everything added since the last flush. Returns the number of
+    // datagrams the kernel accepted.
+    size_t flush() {
+        if (count_ == 0) return 0;
+        stats_.flushes++;
+        stats_.datagrams += count_;
+        size_t ok = uring_active() ? flush_uring() : flush_fallback();
+        stats_.failed += count_ - ok;
+        count_ = 0;
+        return ok;
+    }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Entry {
+        int fd = -1;
+        iovec iov{};
+        msghdr msg{};
+        sockaddr_storage to{};
+        ssize_t result = -1;
+    };
+
+    static int send_flags() {
+        int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+        flags |= MSG_NOSIGNAL;
+#endif
+        return flags;
+    }
+
+    size_t flush_fallback() {
+        size_t ok = 0;
+        size_t i = 0;
+        while (i < count_) {
+#ifdef __linux__
+            size_t run = 1;
+            while (i + run < count_ && entries_[i + run].fd == entries_[i].fd) run++;
+            if (run > 1) {
+                ok += send_run(i, run);
+                i += run;
+                continue;
+            }
+#endif
+            Entry& e = entries_[i++];
+            stats_.syscalls++;
+            ssize_t n;
+            do {
+                n = sendmsg(e.fd, &e.msg, send_flags());
+            } while (n < 0 && errno == EINTR);
+            e.result = n;
+            if (n >= 0) ok++;
+        }
+        return ok;
+    }
+
+#ifdef __linux__
+    // Datagrams i..i+run share a socket: sendmmsg() takes them in one call.
+    size_t send_run(size_t i, size_t run) {
+        mmsg_.resize(run);
+        for (size_t k = 0; k < run; k++) {
+            mmsg_[k].msg_hdr = entries_[i + k].msg;
+            mmsg_[k].msg_len = 0;
+        }
+        size_t done = 0;
+        while (done < run) {
+            stats_.syscalls++;
+            int n = sendmmsg(entries_[i].fd, mmsg_.data() + done, static_cast<unsigned>(run - done),
+                             send_flags());
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                // The datagram at `done` was refused; skip it like sendmsg would.
+                done++;
+                continue;
+            }
+            for (int k = 0; k < n; k++) {
+                entries_[i + done + k].result = static_cast<ssize_t>(mmsg_[done + k].msg_len);
+            }
+            done += static_cast<size_t>(n);
+        }
+        size_t ok = 0;
+        for (size_t k = 0; k < run; k++) ok += entries_[i + k].result >= 0;
+        return ok;
+    }
+#endif
+
+    size_t flush_uring() {
+#ifdef WHISPERTALK_HAVE_IO_URING
+        // add() never queues more than entries_.size() == ring entries.
+        for (size_t i = 0; i < count_; i++) {
+            uring_.prep_sendmsg(entries_[i].fd, &entries_[i].msg, static_cast<unsigned>(send_flags()), i);
+        }
+        size_t ok = 0;
+        bool live = uring_.submit_and_reap([&](uint64_t i, int res) {
+            if (i < count_) entries_[i].result = res;
+            if (res >= 0) ok++;
+        }, stats_.syscalls);
+        // A refused ring (e.g. io_uring disabled under us) loses what it had
+        // not sent of this batch; later batches take the fallback.
+        if (!live) uring_.close();
+        return ok;
+#else
+        return flush_fallback();
+#endif
+    }
+
+    std::vector<Entry> entries_;
+    size_t count_ = 0;
+    Stats stats_;
+#ifdef __linux__
+    std::vector<mmsghdr> mmsg_;
+#endif
+#ifdef WHISPERTALK_HAVE_IO_URING
+    IoUring uring_;
+#endif
+};
+
+}
@@ -2291,6 +2291,34 @@ function stopPipelineHealthAutoRefresh(){
   if(btn){btn.textContent='Auto-Refresh (10s)';btn.onclick=startPipelineHealthAutoRefresh;}
 }
 
+function loadPipelineLatency(){
+  const status=document.getElementById('pipelineLatencyStatus');
+  const results=document.getElementById('pipelineLatencyResults');
+  if(status) status.innerHTML='<span style="color:var(--wt-accent)">Querying services...</span>';
+  fetch('/api/pipeline/latency').then(r=>r.json()).then(d=>{
+const ms=us=>(us/1000).toFixed(1);
+const m=d.mouth_to_ear;
+if(status) status.innerHTML=m
+  ?`Mouth-to-ear: p50 <b>${ms(m.p50_us)} ms</b> &nbsp; p95 <b>${ms(m.p95_us)} ms</b> &nbsp; p99 <b>${ms(m.p99_us)} ms</b> &nbsp; (n=${m.n})`
+  :'<span style="color:var(--wt-text-secondary)">No complete round trip traced yet</span>';
+let html='<table class="wt-table"><tr><th>Reported by</th><th>Stage</th><th>N</th><th>p50 ms</th><th>p95 ms</th><th>p99 ms</th><th>max ms</th></tr>';
+(d.services||[]).forEach(s=>{
+  if(!s.reachable){
+    html+=`<tr><td>${escapeHtml(s.name)}</td><td colspan="6" style="color:var(--wt-danger)">offline</td></tr>`;
+    return;
+  }
+  (s.pairs||[]).forEach(p=>{
+    html+=`<tr><td>${escapeHtml(s.name)}</td><td>${escapeHtml(p.from)} &rarr; ${escapeHtml(p.to)}</td>`
+         +`<td>${p.n}</td><td>${ms(p.p50_us)}</td><td>${ms(p.p95_us)}</td><td>${ms(p.p99_us)}</td><td>${ms(p.max_us)}</td></tr>`;
+  });
+});
+html+='</table>';
+if(results) results.innerHTML=html;
+  }).catch(e=>{
+if(status) status.innerHTML=`<span style="color:var(--wt-danger)">Error: ${escapeHtml(String(e))}</span>`;
+  });
+}
+
 let stressPollInterval=null;
 function runMultilineStress(){
   if(stressPollInterval){clearInterval(stressPollInterval);stressPollInterval=null;}
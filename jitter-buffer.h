@@ -0,0 +1,432 @@
+// jitter-buffer.h — per-call adaptive RTP jitter buffer with packet-loss concealment.
+//
+// SIP_CLIENT used to forward RTP to IAP in arrival order, and IAP strips the
+// header without looking at it, so a reordered packet was played out of
+// place and a lost one simply vanished; both reach VAD and Whisper as clicks
+// and time jumps. RtpJitterBuffer runs in each call's rtp_receiver_loop
+// (sip-client-main.cpp) between the socket and the interconnect:
+//
+//   push()  files an arriving PCMU packet by sequence number. Packets for a
+//           slot already played (late), duplicates and other payload types
+//           (telephone-event, comfort noise) are dropped and counted.
+//   pop()   hands out one frame per packet time on a playout clock that
+//           starts `delay` after the first packet, always as a plain 12-byte
+//           RTP header + μ-law payload, in sequence order with no gaps; the
+//           output is numbered as one continuous stream.
+//
+// Delay: the interarrival jitter J of RFC 3550 §6.4.1 is tracked per packet
+// and the target delay is clamp(3·J, 10 ms, 200 ms), so a clean link adds
+// 10 ms. Every WINDOW packets the smallest slack seen (playout time minus
+// arrival) is compared with the target: a frame's worth too much and the
+// next quiet frame is dropped; too little and a concealment frame is
+// inserted before the next one. Waiting for a quiet frame (or at most
+// ADJUST_FORCE_FRAMES) keeps the adjustments out of speech where possible.
+//
+// Concealment: a frame whose packet is missing at its playout time is
+// synthesised by repeating the last pitch period of the audio before it
+// (autocorrelation over 2.5–15 ms lags), at full level for 10 ms and then
+// fading to silence by 60 ms, as G.711 Appendix I does. The first 4 ms of the
+// next real frame are cross-faded with the continuation to avoid a click.
+// After MAX_CONCEAL_FRAMES with nothing buffered the stream is taken to have
+// paused (hold, DTX, hang-up) and playout stops until the next packet, which
+// starts it again with the current target delay.
+//
+// Not thread-safe; one instance per call thread.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "audio-dsp.h"
+
+namespace whispertalk {
+
+struct JitterBufferStats {
+    uint64_t received = 0;     // PCMU packets accepted
+    uint64_t played = 0;       // frames played from a packet
+    uint64_t concealed = 0;    // frames synthesised for a missing packet
+    uint64_t late = 0;         // packets that arrived after their playout time
+    uint64_t duplicate = 0;
+    uint64_t ignored = 0;      // not RTP v2, or not payload type 0
+    uint64_t dropped = 0;      // frames dropped to shrink the delay
+    uint64_t stretched = 0;    // frames inserted to grow the delay
+    uint64_t rebuffers = 0;    // playout restarts after the stream paused
+    int64_t jitter_us = 0;     // RFC 3550 interarrival jitter
+    int64_t target_us = 0;     // target playout delay
+    int64_t delay_us = 0;      // playout time − arrival of the last played packet
+
+    // Share of played frames that had to be concealed.
+    double loss_ratio() const {
+        uint64_t total = played + concealed;
+        return total ? static_cast<double>(concealed) / total : 0.0;
+    }
+};
+
+class RtpJitterBuffer {
+public:
+    static constexpr size_t RTP_HEADER = 12;
+    static constexpr size_t MAX_PAYLOAD = 480;               // 60 ms of μ-law
+    static constexpr size_t MAX_PACKET = RTP_HEADER + MAX_PAYLOAD;
+    static constexpr uint32_t SLOTS = 64;                    // 1.28 s of 20 ms frames
+    static constexpr int64_t MIN_DELAY_US = 10000;
+    static constexpr int64_t MAX_DELAY_US = 200000;
+    static constexpr int JITTER_MULT = 3;
+    static constexpr int WINDOW = 50;
+    static constexpr int ADJUST_FORCE_FRAMES = 25;
+    static constexpr int MAX_CONCEAL_FRAMES = 3;
+    static constexpr size_t PLC_FULL_SAMPLES = 80;           // 10 ms at full level
+    static constexpr size_t PLC_FADE_SAMPLES = 400;          // then silent 50 ms later
+    static constexpr size_t OLA_SAMPLES = 32;
+    static constexpr float QUIET_PEAK = 0.01f;               // about -40 dBFS
+
+    struct Frame {
+        size_t bytes = 0;          // header + payload written to out; 0 if none is due
+        bool concealed = false;
+        int64_t arrival_us = 0;    // the packet's arrival, or the playout time if concealed
+    };
+
+    RtpJitterBuffer() : slots_(SLOTS) {}
+
+    // Files one RTP datagram that arrived at arrival_us. Returns false if it
+    // was dropped.
+    bool push(const uint8_t* rtp, size_t len, int64_t arrival_us) {
+        if (len < RTP_HEADER || (rtp[0] >> 6) != 2 || (rtp[1] & 0x7F) != 0) {
+            stats_.ignored++;
+            return false;
+        }
+        size_t hdr = RTP_HEADER + 4 * (rtp[0] & 0x0F);
+        if ((rtp[0] & 0x10) && hdr + 4 <= len) {
+            hdr += 4 + 4 * ((static_cast<size_t>(rtp[hdr + 2]) << 8) | rtp[hdr + 3]);
+        }
+        if (rtp[0] & 0x20) len -= std::min<size_t>(rtp[len - 1], len);
+        if (hdr >= len) {
+            stats_.ignored++;
+            return false;
+        }
+        const size_t plen = std::min(len - hdr, MAX_PAYLOAD);
+        const uint16_t seq = static_cast<uint16_t>((rtp[2] << 8) | rtp[3]);
+        const uint32_t ts = (static_cast<uint32_t>(rtp[4]) << 24) | (rtp[5] << 16) | (rtp[6] << 8) | rtp[7];
+        const uint32_t ssrc = (static_cast<uint32_t>(rtp[8]) << 24) | (rtp[9] << 16) | (rtp[10] << 8) | rtp[11];
+
+        if (have_prev_ && ssrc != ssrc_) {
+            // A new stream (re-INVITE, transfer): start over on its numbering.
+            reset_playout();
+            have_prev_ = false;
+        }
+        ssrc_ = ssrc;
+        update_jitter(ts, arrival_us);
+
+        if (!playing_) {
+            if (!have_played_ || static_cast<int16_t>(seq - next_seq_) >= 0) {
+                anchor(seq, plen, arrival_us);
+            }
+        } else if (fresh_ && static_cast<int16_t>(seq - next_seq_) < 0 &&
+                   static_cast<int16_t>(seq - next_seq_) > -static_cast<int>(SLOTS / 2)) {
+            // Reordered ahead of the first packet, before anything played.
+            next_seq_ = seq;
+        }
+
+        int ahead = static_cast<int16_t>(seq - next_seq_);
+        if (ahead < 0) {
+            if (ahead > -static_cast<int>(SLOTS)) note_slack(due_us_ + ahead * frame_us_ - arrival_us);
+            stats_.late++;
+            return false;
+        }
+        if (ahead >= static_cast<int>(SLOTS)) {
+            // A gap longer than the ring: resynchronise on this packet.
+            reset_playout();
+            anchor(seq, plen, arrival_us);
+            ahead = 0;
+        }
+        Slot& s = slots_[seq % SLOTS];
+        if (s.full && s.seq == seq) {
+            stats_.duplicate++;
+            return false;
+        }
+        if (!s.full) buffered_++;
+        s.full = true;
+        s.seq = seq;
+        s.len = static_cast<uint16_t>(plen);
+        s.arrival_us = arrival_us;
+        std::memcpy(s.data, rtp + hdr, plen);
+        stats_.received++;
+        note_slack(due_us_ + ahead * frame_us_ - arrival_us);
+        return true;
+    }
+
+    bool playing() const { return playing_; }
+    int64_t next_due_us() const { return due_us_; }
+    bool ready(int64_t now_us) const { return playing_ && now_us >= due_us_; }
+
+    // Writes the frame due at now_us into out (at least MAX_PACKET bytes).
+    Frame pop(int64_t now_us, uint8_t* out) {
+        Frame f;
+        if (!ready(now_us)) return f;
+
+        Slot* s = &slots_[next_seq_ % SLOTS];
+        bool have = s->full && s->seq == next_seq_;
+        if (adjust_ != 0) adjust_wait_++;
+        const bool forced = adjust_wait_ >= ADJUST_FORCE_FRAMES;
+
+        if (adjust_ < 0 && have && buffered_ > 1 && (forced || quiet(*s))) {
+            take(*s);
+            next_seq_++;
+            stats_.dropped++;
+            adjust_ = 0;
+            adjust_wait_ = 0;
+            s = &slots_[next_seq_ % SLOTS];
+            have = s->full && s->seq == next_seq_;
+        } else if (adjust_ > 0 && have_played_ && (forced || last_quiet_)) {
+            // Grow the delay by one frame: play a concealment frame and leave
+            // the packet for the next tick.
+            write_header(out, frame_len_);
+            conceal(out + RTP_HEADER, frame_len_);
+            stats_.stretched++;
+            adjust_ = 0;
+            adjust_wait_ = 0;
+            f.bytes = RTP_HEADER + frame_len_;
+            f.concealed = true;
+            f.arrival_us = due_us_;
+            due_us_ += frame_us_;
+            return f;
+        }
+
+        if (have) {
+            write_header(out, s->len);
+            std::memcpy(out + RTP_HEADER, s->data, s->len);
+            if (conceal_run_ > 0) cross_fade(out + RTP_HEADER, s->len);
+            remember(out + RTP_HEADER, s->len);
+            frame_len_ = s->len;
+            frame_us_ = static_cast<int64_t>(s->len) * 125;
+            stats_.played++;
+            stats_.delay_us = due_us_ - s->arrival_us;
+            f.bytes = RTP_HEADER + s->len;
+            f.arrival_us = s->arrival_us;
+            take(*s);
+            conceal_run_ = 0;
+            conceal_samples_ = 0;
+            have_played_ = true;
+        } else {
+            if (buffered_ == 0 && conceal_run_ >= MAX_CONCEAL_FRAMES) {
+                playing_ = false;
+                stats_.rebuffers++;
+                return f;
+            }
+            write_header(out, frame_len_);
+            conceal(out + RTP_HEADER, frame_len_);
+            stats_.concealed++;
+            f.bytes = RTP_HEADER + frame_len_;
+            f.concealed = true;
+            f.arrival_us = due_us_;
+        }
+        fresh_ = false;
+        next_seq_++;
+        due_us_ += frame_us_;
+        return f;
+    }
+
+    const JitterBufferStats& stats() const { return stats_; }
+
+private:
+    struct Slot {
+        bool full = false;
+        uint16_t seq = 0;
+        uint16_t len = 0;
+        int64_t arrival_us = 0;
+        uint8_t data[MAX_PAYLOAD];
+    };
+
+    static constexpr size_t HIST = IAP_ULAW_FRAME;
+    static constexpr int MIN_PERIOD = 20;
+    static constexpr int MAX_PERIOD = 120;
+    static constexpr int CORR_WINDOW = HIST - MAX_PERIOD;
+
+    void update_jitter(uint32_t ts, int64_t arrival_us) {
+        if (have_prev_) {
+            int64_t d = (arrival_us - prev_arrival_us_) -
+                        static_cast<int64_t>(static_cast<int32_t>(ts - prev_ts_)) * 125;
+            if (d < 0) d = -d;
+            jitter_us_ += (static_cast<double>(d) - jitter_us_) / 16.0;
+        }
+        have_prev_ = true;
+        prev_arrival_us_ = arrival_us;
+        prev_ts_ = ts;
+        stats_.jitter_us = static_cast<int64_t>(jitter_us_);
+        stats_.target_us = std::clamp(static_cast<int64_t>(JITTER_MULT * jitter_us_), MIN_DELAY_US, MAX_DELAY_US);
+    }
+
+    // slack: how long before its playout time a packet arrived (negative if
+    // late). Decides the next adjustment once per WINDOW packets.
+    void note_slack(int64_t slack) {
+        if (slack < window_min_slack_) window_min_slack_ = slack;
+        if (++window_n_ < WINDOW) return;
+        if (window_min_slack_ > stats_.target_us + frame_us_) {
+            adjust_ = -1;
+        } else if (window_min_slack_ + frame_us_ < stats_.target_us) {
+            adjust_ = 1;
+        }
+        window_n_ = 0;
+        window_min_slack_ = INT64_MAX;
+    }
+
+    void anchor(uint16_t seq, size_t plen, int64_t arrival_us) {
+        playing_ = true;
+        fresh_ = true;
+        next_seq_ = seq;
+        frame_len_ = plen;
+        frame_us_ = static_cast<int64_t>(plen) * 125;
+        due_us_ = arrival_us + stats_.target_us;
+        adjust_ = 0;
+        adjust_wait_ = 0;
+        window_n_ = 0;
+        window_min_slack_ = INT64_MAX;
+    }
+
+    void reset_playout() {
+        for (auto& s : slots_) s.full = false;
+        buffered_ = 0;
+        playing_ = false;
+        have_played_ = false;
+    }
+
+    void take(Slot& s) {
+        s.full = false;
+        buffered_--;
+    }
+
+    static bool quiet(const uint8_t* ulaw, size_t n) {
+        const float* t = ulaw_float_table();
+        for (size_t i = 0; i < n; i++) {
+            if (std::fabs(t[ulaw[i]]) >= QUIET_PEAK) return false;
+        }
+        return true;
+    }
+    static bool quiet(const Slot& s) { return quiet(s.data, s.len); }
+
+    // Output headers are numbered afresh: one sequence number per frame
+    // played and a timestamp advancing by its samples, whatever the input did.
+    void write_header(uint8_t* out, size_t samples) {
+        out[0] = 0x80;
+        out[1] = 0;
+        out[2] = static_cast<uint8_t>(out_seq_ >> 8);
+        out[3] = static_cast<uint8_t>(out_seq_);
+        for (int i = 0; i < 4; i++) {
+            out[4 + i] = static_cast<uint8_t>(out_ts_ >> (24 - 8 * i));
+            out[8 + i] = static_cast<uint8_t>(ssrc_ >> (24 - 8 * i));
+        }
+        out_seq_++;
+        out_ts_ += static_cast<uint32_t>(samples);
+    }
+
+    // Keeps the last HIST samples of played audio for concealment.
+    void remember(const uint8_t* ulaw, size_t n) {
+        const float* t = ulaw_float_table();
+        if (n >= HIST) {
+            for (size_t i = 0; i < HIST; i++) hist_[i] = t[ulaw[n - HIST + i]];
+        } else {
+            std::memmove(hist_, hist_ + n, (HIST - n) * sizeof(float));
+            for (size_t i = 0; i < n; i++) hist_[HIST - n + i] = t[ulaw[i]];
+        }
+        last_quiet_ = quiet(ulaw, n);
+    }
+
+    // Lag in [MIN_PERIOD, MAX_PERIOD] whose past best matches the most
+    // recent CORR_WINDOW samples (normalised cross-correlation).
+    int pitch_period() const {
+        const float* x = hist_ + HIST - CORR_WINDOW;
+        int best = MAX_PERIOD;
+        float best_score = 0.0f;
+        for (int lag = MIN_PERIOD; lag <= MAX_PERIOD; lag++) {
+            const float* y = x - lag;
+            float xy = 0.0f, yy = 0.0f;
+            for (int i = 0; i < CORR_WINDOW; i++) {
+                xy += x[i] * y[i];
+                yy += y[i] * y[i];
+            }
+            if (yy <= 0.0f || xy <= 0.0f) continue;
+            float score = xy / std::sqrt(yy);
+            if (score > best_score) {
+                best_score = score;
+                best = lag;
+            }
+        }
+        return best;
+    }
+
+    float plc_sample() {
+        float g = 1.0f;
+        if (conceal_samples_ >= PLC_FULL_SAMPLES) {
+            g = 1.0f - static_cast<float>(conceal_samples_ - PLC_FULL_SAMPLES) / PLC_FADE_SAMPLES;
+            if (g < 0.0f) g = 0.0f;
+        }
+        float v = hist_[HIST - period_ + (plc_pos_ % period_)] * g;
+        plc_pos_++;
+        conceal_samples_++;
+        return v;
+    }
+
+    static uint8_t encode(float v) {
+        float s = v * 32768.0f;
+        if (s > 32767.0f) s = 32767.0f;
+        if (s < -32768.0f) s = -32768.0f;
+        return linear_to_ulaw(static_cast<int16_t>(std::lrint(s)));
+    }
+
+    void conceal(uint8_t* out, size_t n) {
+        if (conceal_run_ == 0) {
+            period_ = pitch_period();
+            plc_pos_ = 0;
+            conceal_samples_ = 0;
+        }
+        for (size_t i = 0; i < n; i++) out[i] = encode(plc_sample());
+        conceal_run_++;
+    }
+
+    void cross_fade(uint8_t* ulaw, size_t n) {
+        const float* t = ulaw_float_table();
+        size_t m = std::min(n, OLA_SAMPLES);
+        for (size_t i = 0; i < m; i++) {
+            float w = static_cast<float>(i + 1) / (m + 1);
+            ulaw[i] = encode(t[ulaw[i]] * w + plc_sample() * (1.0f - w));
+        }
+    }
+
+    std::vector<Slot> slots_;
+    uint32_t buffered_ = 0;
+    uint32_t ssrc_ = 0;
+
+    bool playing_ = false;
+    bool fresh_ = false;        // anchored, nothing played since
+    bool have_played_ = false;
+    uint16_t next_seq_ = 0;
+    uint16_t out_seq_ = 0;
+    uint32_t out_ts_ = 0;
+    size_t frame_len_ = IAP_ULAW_FRAME;
+    int64_t frame_us_ = 20000;
+    int64_t due_us_ = 0;
+
+    bool have_prev_ = false;
+    int64_t prev_arrival_us_ = 0;
+    uint32_t prev_ts_ = 0;
+    double jitter_us_ = 0.0;
+
+    int window_n_ = 0;
+    int64_t window_min_slack_ = INT64_MAX;
+    int adjust_ = 0;
+    int adjust_wait_ = 0;
+    bool last_quiet_ = false;
+
+    float hist_[HIST] = {};
+    int conceal_run_ = 0;
+    size_t conceal_samples_ = 0;
+    size_t plc_pos_ = 0;
+    int period_ = MAX_PERIOD;
+
+    JitterBufferStats stats_;
+};
+
+}
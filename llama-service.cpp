@@ -29,12 +29,30 @@
 //   generation. Active generation is aborted by setting generating=false on
 //   the current LlamaCall. Interrupt latency: ~5-13ms.
 //
+// Early start on partial text (speech-partial.h):
+//   Whisper sends TEXT_PARTIAL frames, the settled start of an utterance still
+//   being spoken, to a LLaMA that offered the type. prefetch_loop runs the RAG
+//   caller lookup and context query on the newest one per call and then
+//   prefills the prompt process_call would build for it. There is one KV
+//   sequence (n_seq_max=1), so the prefill runs only while no other call
+//   needs it: no final queued or being worked on, nothing generating, and
+//   the cache empty or already this call's. When the final text arrives, process_call takes the RAG context if
+//   the final begins with the prefetched words and covers no more than twice
+//   as many, and decodes only the prompt tokens past the longest prefix the KV
+//   cache already holds for the call (kv_tokens_) — the system prompt, the
+//   history, and with a prefill the start of the caller's turn.
+//
 // Tokenizer resilience:
 //   llama_tokenize() can return negative values if the output buffer is too small.
 //   The service retries with a progressively larger buffer (up to 4× initial size).
 //
-// CMD port (LLaMA base+2 = 13132): PING, STATUS, SET_LOG_LEVEL commands.
+// CMD port (LLaMA base+2 = 13132): PING, STATUS, SET_LOG_LEVEL, HOP_LATENCY, FLOW, METRICS,
+//   METRICS:JSON commands.
 //   STATUS returns: model name, active calls, upstream/downstream state, speech state.
+//
+// Replicas: --instance N (1..7) runs this process as LLAMA#N on that instance's
+//   ports. Whisper shards calls across WHISPERTALK_REPLICAS_LLAMA instances and
+//   TTS accepts all of them as upstream peers.
 #include <iostream>
 #include <vector>
 #include <string>
@@ -61,6 +79,7 @@
 #include <cstdio>
 #include <climits>
 #include "interconnect.h"
+#include "speech-partial.h"
 #include "llama.h"
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -111,28 +130,41 @@ struct LlamaCall {
     uint32_t id;
     uint32_t seq_id;
     int n_past = 0;
-    bool greeted = false;
-    int patient_id = -1;
+    std::atomic<bool> greeted{false};     // read by prefetch_loop
+    std::atomic<int> patient_id{-1};
     std::vector<LlamaChatMessage> messages;
     std::chrono::steady_clock::time_point last_activity;
     std::chrono::steady_clock::time_point last_response_sent;
     std::atomic<bool> generating{false};
 };
 
+// RAG results for a call's stable prefix (TEXT_PARTIAL), waiting for the
+// final. The caller lookup does not depend on the text and is used either way.
+struct LlamaPrefetch {
+    std::string text;
+    bool caller_done = false;
+    std::string greeting_hint;
+    int patient_id = -1;
+    bool rag_done = false;
+    std::string rag_ctx;
+};
+
 struct WorkItem {
     uint32_t call_id;
     std::string text;
+    whispertalk::PacketTrace trace;   // hop trace of the newest transcription
 };
 
 class LlamaService {
 public:
     LlamaService(const std::string& model_path,
                  const std::string& rag_host = "127.0.0.1",
-                 int rag_port = 13181) 
+                 int rag_port = 13181,
+                 uint8_t instance = 0)
         : running_(true),
           rag_host_(rag_host),
           rag_port_(rag_port),
-          interconnect_(whispertalk::ServiceType::LLAMA_SERVICE) {
+          interconnect_(whispertalk::ServiceType::LLAMA_SERVICE, instance) {
         prodigy_tls::ensure_certs();
         rag_ssl_ctx_ = SSL_CTX_new(TLS_client_method());
         if (rag_ssl_ctx_) {
@@ -189,6 +221,7 @@ public:
     }
 
     bool init() {
+        interconnect_.accept_payload_type(whispertalk::PayloadType::TEXT_PARTIAL);
         if (!interconnect_.initialize()) {
             std::cerr << "Failed to initialize interconnect" << std::endl;
             return false;
@@ -251,7 +284,7 @@ public:
                 if (!pending_text.empty()) {
                     {
                         std::lock_guard<std::mutex> wlock(work_mutex_);
-                        work_queue_.push({call_id, std::move(pending_text)});
+                        work_queue_.push({call_id, std::move(pending_text), {}});
                     }
                     work_cv_.notify_one();
                     log_fwd_.forward(whispertalk::LogLevel::INFO, call_id,
@@ -276,6 +309,7 @@ public:
     void run() {
         std::thread receiver_thread(&LlamaService::receiver_loop, this);
         std::thread worker_thread(&LlamaService::worker_loop, this);
+        std::thread prefetch_thread(&LlamaService::prefetch_loop, this);
         std::thread cmd_thread(&LlamaService::command_listener_loop, this);
         
         std::cout << "LLaMA German Service running" << std::endl;
@@ -296,8 +330,13 @@ public:
         
         running_ = false;
         work_cv_.notify_all();
+        // Under the mutex, so prefetch_loop cannot miss it between its
+        // predicate check and the wait.
+        { std::lock_guard<std::mutex> lock(prefetch_mutex_); }
+        prefetch_cv_.notify_all();
         if (receiver_thread.joinable()) receiver_thread.join();
         if (worker_thread.joinable()) worker_thread.join();
+        if (prefetch_thread.joinable()) prefetch_thread.join();
         int sock = cmd_sock_.exchange(-1);
         if (sock >= 0) ::close(sock);
         if (cmd_thread.joinable()) cmd_thread.join();
@@ -315,12 +354,26 @@ private:
             if (!pkt.is_valid() || pkt.payload_size == 0) {
                 continue;
             }
+            if (pkt.meta.type == whispertalk::PayloadType::TEXT_PARTIAL) {
+                // Only the newest prefix of a call is worth working on.
+                {
+                    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+                    prefetch_pending_[pkt.call_id].assign(
+                        reinterpret_cast<const char*>(pkt.payload.data()), pkt.payload_size);
+                }
+                prefetch_cv_.notify_one();
+                continue;
+            }
+            if (!whispertalk::payload_is(pkt.meta, whispertalk::PayloadType::TEXT, true)) {
+                continue;
+            }
 
             std::string text(reinterpret_cast<const char*>(pkt.payload.data()), pkt.payload_size);
+            pkt.trace.record(whispertalk::ServiceType::LLAMA_SERVICE, 0);
             
             {
                 std::lock_guard<std::mutex> lock(work_mutex_);
-                work_queue_.push({pkt.call_id, text});
+                work_queue_.push({pkt.call_id, text, pkt.trace});
             }
             work_cv_.notify_one();
         }
@@ -331,12 +384,14 @@ private:
             WorkItem item;
             {
                 std::unique_lock<std::mutex> lock(work_mutex_);
+                work_busy_ = false;
                 work_cv_.wait_for(lock, std::chrono::milliseconds(100),
                     [this]{ return !work_queue_.empty() || !running_; });
                 if (!running_ && work_queue_.empty()) break;
                 if (work_queue_.empty()) continue;
                 item = std::move(work_queue_.front());
                 work_queue_.pop();
+                work_busy_ = true;
 
                 std::queue<WorkItem> keep;
                 size_t merged = 0;
@@ -347,6 +402,7 @@ private:
                         continue;
                     } else if (qi.call_id == item.call_id) {
                         item.text += " " + qi.text;
+                        item.trace = qi.trace;
                         merged++;
                     } else {
                         keep.push(std::move(qi));
@@ -421,14 +477,16 @@ private:
                 }
             }
 
+            // The first sentence of the reply continues the transcription's
+            // hop trace (time to first sentence); later ones start fresh.
             bool tts_sent = false;
-            auto stream_cb = [this, &tts_sent](uint32_t cid, const std::string& sentence) {
-                send_to_tts(cid, sentence);
+            auto stream_cb = [this, &tts_sent, &item](uint32_t cid, const std::string& sentence) {
+                send_to_tts(cid, sentence, tts_sent ? nullptr : &item.trace);
                 tts_sent = true;
             };
             std::string response = process_call(item.call_id, item.text, stream_cb);
             if (!response.empty()) {
-                send_to_tts(item.call_id, response);
+                send_to_tts(item.call_id, response, tts_sent ? nullptr : &item.trace);
                 tts_sent = true;
             }
             if (tts_sent) {
@@ -441,6 +499,85 @@ private:
         }
     }
 
+    void prefetch_loop() {
+        while (running_) {
+            uint32_t cid;
+            std::string text;
+            {
+                std::unique_lock<std::mutex> lock(prefetch_mutex_);
+                prefetch_cv_.wait(lock, [this]{ return !prefetch_pending_.empty() || !running_; });
+                if (!running_) break;
+                auto it = prefetch_pending_.begin();
+                cid = it->first;
+                text = std::move(it->second);
+                prefetch_pending_.erase(it);
+            }
+            if (interconnect_.has_ended(cid)) continue;
+            prefetch(cid, text);
+        }
+    }
+
+    // Stable prefix `text` of the call's current utterance: RAG for it, then
+    // the prompt prefill.
+    void prefetch(uint32_t cid, const std::string& text) {
+        auto call = get_or_create_call(cid);
+        LlamaPrefetch pf;
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex_);
+            auto it = prefetched_.find(cid);
+            if (it != prefetched_.end()) pf = it->second;
+        }
+        pf.text = text;
+        pf.rag_done = false;
+        pf.rag_ctx.clear();
+        if (is_rag_available()) {
+            bool rag_ok = true;
+            if (!call->greeted && !pf.caller_done) {
+                rag_ok = rag_lookup_caller(cid, pf.greeting_hint, pf.patient_id);
+                pf.caller_done = rag_ok;
+            }
+            if (rag_ok && is_rag_available()) {
+                rag_ok = rag_context(cid, text, pf.caller_done ? pf.patient_id : call->patient_id.load(), pf.rag_ctx);
+                pf.rag_done = rag_ok;
+            }
+            if (rag_ok) rag_record_success();
+        }
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex_);
+            prefetched_[cid] = pf;
+        }
+        log_fwd_.forward(whispertalk::LogLevel::DEBUG, cid, "Prefetched for partial text: %s", text.c_str());
+        prefill(cid, *call, pf);
+    }
+
+    // Decodes the prompt process_call would build if `pf` were the whole
+    // turn, so the final only decodes what it changes. Skipped unless the
+    // context is idle: the worker has no final queued or in hand (it would
+    // wait for the decode), and the cache holds nothing or this call's own
+    // prefix (another call's would be evicted).
+    void prefill(uint32_t cid, LlamaCall& call, const LlamaPrefetch& pf) {
+        {
+            std::lock_guard<std::mutex> lock(work_mutex_);
+            if (work_busy_ || !work_queue_.empty()) return;
+        }
+        std::unique_lock<std::mutex> lock(llama_mutex_, std::try_to_lock);
+        if (!lock.owns_lock() || call.generating) return;
+        if (!kv_tokens_.empty() && kv_call_ != cid) return;
+        std::vector<LlamaChatMessage> messages = call.messages;
+        messages.push_back({"user", pf.text});
+        trim_history(messages);
+        std::string prompt = chat_prompt(call.greeted ? "" : pf.greeting_hint, pf.rag_ctx, messages);
+        if (prompt.empty()) return;
+        std::vector<llama_token> tokens = tokenize(prompt, true);
+        if (tokens.empty()) return;
+        size_t reused = 0;
+        if (decode_prompt(cid, call.seq_id, tokens, reused)) {
+            call.n_past = tokens.size();
+            log_fwd_.forward(whispertalk::LogLevel::DEBUG, cid,
+                "Prefilled %zu prompt tokens (%zu reused)", tokens.size() - reused, reused);
+        }
+    }
+
     int sentence_end_count_ = 0;
 
     bool is_sentence_punctuation(const std::string& s) {
@@ -771,6 +908,140 @@ private:
         return rag_http_get(path);
     }
 
+    // Caller lookup for the first turn. False (failure recorded) if RAG did
+    // not answer; otherwise `greeting_hint` and `patient_id` are set if the
+    // caller is known.
+    bool rag_lookup_caller(uint32_t cid, std::string& greeting_hint, int& patient_id) {
+        std::string caller_json = rag_get_caller(cid);
+        if (caller_json.empty()) {
+            rag_record_failure(cid);
+            return false;
+        }
+        std::string status = extract_json_string(caller_json, "status");
+        if (status == "found") {
+            std::string name = extract_json_string(caller_json, "name");
+            int pid = extract_json_int(caller_json, "patient_id", -1);
+            patient_id = pid;
+            if (!name.empty()) {
+                greeting_hint = "Der Anrufer heißt " + name + ".";
+                log_fwd_.forward(whispertalk::LogLevel::INFO, cid,
+                    "Caller identified: %s (patient_id=%d)", name.c_str(), pid);
+            }
+        }
+        return true;
+    }
+
+    // Practice context for `text`. False (failure recorded) if RAG did not
+    // answer.
+    bool rag_context(uint32_t cid, const std::string& text, int patient_id, std::string& rag_ctx) {
+        std::string rag_body = rag_query(text, 3, patient_id);
+        if (rag_body.empty()) {
+            rag_record_failure(cid);
+            return false;
+        }
+        rag_ctx = extract_rag_text(rag_body);
+        if (!rag_ctx.empty()) {
+            log_fwd_.forward(whispertalk::LogLevel::DEBUG, cid,
+                "RAG context retrieved (%zu bytes)", rag_ctx.size());
+        } else {
+            log_fwd_.forward(whispertalk::LogLevel::DEBUG, cid, "RAG returned no matching chunks");
+        }
+        return true;
+    }
+
+    // The call's prefetch, if any; it is used up either way.
+    bool take_prefetch(uint32_t cid, LlamaPrefetch& pf) {
+        std::lock_guard<std::mutex> lock(prefetch_mutex_);
+        prefetch_pending_.erase(cid);
+        auto it = prefetched_.find(cid);
+        if (it == prefetched_.end()) return false;
+        pf = std::move(it->second);
+        prefetched_.erase(it);
+        return true;
+    }
+
+    static constexpr size_t MAX_HISTORY_MESSAGES = 10;
+
+    static void trim_history(std::vector<LlamaChatMessage>& messages) {
+        while (messages.size() > MAX_HISTORY_MESSAGES) {
+            messages.erase(messages.begin(), messages.begin() + 2);
+        }
+    }
+
+    // The chat-template prompt for a turn, or "" if the template fails.
+    std::string chat_prompt(const std::string& greeting_hint, const std::string& rag_ctx,
+                            const std::vector<LlamaChatMessage>& messages) {
+        std::string sys_prompt = SYSTEM_PROMPT;
+        if (!greeting_hint.empty()) sys_prompt += "\n\n" + greeting_hint;
+        if (!rag_ctx.empty()) sys_prompt += "\n\nKontextinformation aus Praxissystem:\n" + rag_ctx;
+
+        std::vector<llama_chat_message> chat_msgs;
+        chat_msgs.reserve(messages.size() + 1);
+        chat_msgs.push_back({"system", sys_prompt.c_str()});
+        
+        for (const auto& m : messages) {
+            chat_msgs.push_back({m.role.c_str(), m.content.c_str()});
+        }
+
+        const char* tmpl = llama_model_chat_template(model_, nullptr);
+        std::vector<char> formatted(4096);
+        int32_t len = llama_chat_apply_template(tmpl, chat_msgs.data(), chat_msgs.size(), true, formatted.data(), formatted.size());
+        if (len > (int32_t)formatted.size()) {
+            formatted.resize(len + 1);
+            len = llama_chat_apply_template(tmpl, chat_msgs.data(), chat_msgs.size(), true, formatted.data(), formatted.size());
+        }
+        if (len <= 0) return "";
+        return std::string(formatted.data(), len);
+    }
+
+    // Brings sequence `seq` to `tokens` for call `cid`, decoding only what
+    // follows the longest prefix the cache holds for that call. The last
+    // token is always decoded, for the logits. `reused` receives the number
+    // of tokens kept. Caller holds llama_mutex_.
+    bool decode_prompt(uint32_t cid, uint32_t seq, const std::vector<llama_token>& tokens, size_t& reused) {
+        llama_memory_t mem = llama_get_memory(ctx_);
+        size_t keep = 0;
+        if (kv_call_ == cid) {
+            while (keep < kv_tokens_.size() && keep < tokens.size() && kv_tokens_[keep] == tokens[keep]) keep++;
+        }
+        if (keep >= tokens.size()) keep = tokens.size() - 1;
+        kv_tokens_.clear();
+        if (keep == 0 || !llama_memory_seq_rm(mem, seq, keep, -1)) {
+            llama_memory_seq_rm(mem, seq, -1, -1);
+            keep = 0;
+        }
+
+        const size_t n = tokens.size() - keep;
+        llama_batch batch = llama_batch_init(n, 0, 1);
+        batch.n_tokens = n;
+        for (size_t i = 0; i < n; ++i) {
+            batch.token[i] = tokens[keep + i];
+            batch.pos[i] = keep + i;
+            batch.n_seq_id[i] = 1;
+            batch.seq_id[i][0] = seq;
+            batch.logits[i] = (i == n - 1);
+        }
+        int rc = llama_decode(ctx_, batch);
+        llama_batch_free(batch);
+        if (rc != 0) {
+            llama_memory_seq_rm(mem, seq, -1, -1);
+            return false;
+        }
+        kv_call_ = cid;
+        kv_tokens_ = tokens;
+        reused = keep;
+        prompt_tokens_reused_.inc(keep);
+        prompt_tokens_decoded_.inc(n);
+        return true;
+    }
+
+    // Empties sequence `seq`, which every call shares. Caller holds
+    // llama_mutex_.
+    void clear_kv(uint32_t seq) {
+        llama_memory_seq_rm(llama_get_memory(ctx_), seq, -1, -1);
+        kv_tokens_.clear();
+    }
+
     static bool is_empty_pleasantry(const std::string& response) {
         std::string lower = normalize_lower(response);
         static const char* pleasantries[] = {
@@ -799,42 +1070,35 @@ private:
 
         std::string greeting_hint;
         std::string rag_ctx;
-        if (is_rag_available()) {
+        bool have_rag_ctx = false;
+        LlamaPrefetch pf;
+        if (take_prefetch(cid, pf)) {
+            if (pf.caller_done && !call->greeted) {
+                greeting_hint = pf.greeting_hint;
+                call->patient_id = pf.patient_id;
+                call->greeted = true;
+            }
+            // The prefix's context stands in for the final's if the final
+            // goes on from it without doubling it.
+            size_t words = whispertalk::transcript_prefix_words(pf.text, text);
+            if (pf.rag_done && words > 0 && 2 * words >= whispertalk::transcript_words(text).size()) {
+                rag_ctx = std::move(pf.rag_ctx);
+                have_rag_ctx = true;
+            }
+            (have_rag_ctx ? prefetch_used_ : prefetch_stale_).inc();
+        }
+        if (!have_rag_ctx && is_rag_available()) {
             bool rag_ok = true;
             if (!call->greeted) {
-                std::string caller_json = rag_get_caller(cid);
-                if (caller_json.empty()) {
-                    rag_record_failure(cid);
-                    rag_ok = false;
-                } else {
-                    std::string status = extract_json_string(caller_json, "status");
-                    if (status == "found") {
-                        std::string name = extract_json_string(caller_json, "name");
-                        int pid = extract_json_int(caller_json, "patient_id", -1);
-                        call->patient_id = pid;
-                        if (!name.empty()) {
-                            greeting_hint = "Der Anrufer heißt " + name + ".";
-                            log_fwd_.forward(whispertalk::LogLevel::INFO, cid,
-                                "Caller identified: %s (patient_id=%d)", name.c_str(), pid);
-                        }
-                    }
+                int pid = call->patient_id;
+                rag_ok = rag_lookup_caller(cid, greeting_hint, pid);
+                if (rag_ok) {
+                    call->patient_id = pid;
                     call->greeted = true;
                 }
             }
             if (rag_ok && is_rag_available()) {
-                std::string rag_body = rag_query(text, 3, call->patient_id);
-                if (rag_body.empty()) {
-                    rag_record_failure(cid);
-                    rag_ok = false;
-                } else {
-                    rag_ctx = extract_rag_text(rag_body);
-                    if (!rag_ctx.empty()) {
-                        log_fwd_.forward(whispertalk::LogLevel::DEBUG, cid,
-                            "RAG context retrieved (%zu bytes)", rag_ctx.size());
-                    } else {
-                        log_fwd_.forward(whispertalk::LogLevel::DEBUG, cid, "RAG returned no matching chunks");
-                    }
-                }
+                rag_ok = rag_context(cid, text, call->patient_id, rag_ctx);
             }
             if (rag_ok) rag_record_success();
         }
@@ -851,39 +1115,16 @@ private:
         call->generating = true;
 
         call->messages.push_back({"user", text});
+        trim_history(call->messages);
 
-        static constexpr size_t MAX_HISTORY_MESSAGES = 10;
-        while (call->messages.size() > MAX_HISTORY_MESSAGES) {
-            call->messages.erase(call->messages.begin(), call->messages.begin() + 2);
-        }
-
-        std::string sys_prompt = SYSTEM_PROMPT;
-        if (!greeting_hint.empty()) sys_prompt += "\n\n" + greeting_hint;
-        if (!rag_ctx.empty()) sys_prompt += "\n\nKontextinformation aus Praxissystem:\n" + rag_ctx;
-
-        std::vector<llama_chat_message> chat_msgs;
-        chat_msgs.reserve(call->messages.size() + 1);
-        chat_msgs.push_back({"system", sys_prompt.c_str()});
-        
-        for (const auto& m : call->messages) {
-            chat_msgs.push_back({m.role.c_str(), m.content.c_str()});
-        }
-
-        const char* tmpl = llama_model_chat_template(model_, nullptr);
-        std::vector<char> formatted(4096);
-        int32_t len = llama_chat_apply_template(tmpl, chat_msgs.data(), chat_msgs.size(), true, formatted.data(), formatted.size());
-        if (len > (int32_t)formatted.size()) {
-            formatted.resize(len + 1);
-            len = llama_chat_apply_template(tmpl, chat_msgs.data(), chat_msgs.size(), true, formatted.data(), formatted.size());
-        }
-        if (len < 0) {
+        std::string prompt = chat_prompt(greeting_hint, rag_ctx, call->messages);
+        if (prompt.empty()) {
             log_fwd_.forward(whispertalk::LogLevel::ERROR, cid, "Chat template application failed");
             call->messages.pop_back();
             call->generating = false;
             return "";
         }
         
-        std::string prompt(formatted.data(), len);
         std::vector<llama_token> tokens = tokenize(prompt, true);
 
         if (tokens.empty()) {
@@ -893,30 +1134,21 @@ private:
             return "";
         }
 
-        llama_memory_t mem = llama_get_memory(ctx_);
-        llama_memory_seq_rm(mem, call->seq_id, -1, -1);
         call->n_past = 0;
         llama_sampler_reset(sampler_);
 
-        llama_batch batch = llama_batch_init(tokens.size(), 0, 1);
-        batch.n_tokens = tokens.size();
-        for (size_t i = 0; i < tokens.size(); ++i) {
-            batch.token[i] = tokens[i];
-            batch.pos[i] = i;
-            batch.n_seq_id[i] = 1;
-            batch.seq_id[i][0] = call->seq_id;
-            batch.logits[i] = (i == tokens.size() - 1);
-        }
-
-        if (llama_decode(ctx_, batch) != 0) {
-            llama_batch_free(batch);
+        size_t reused = 0;
+        if (!decode_prompt(cid, call->seq_id, tokens, reused)) {
             log_fwd_.forward(whispertalk::LogLevel::ERROR, cid, "Prompt decode failed");
             call->messages.pop_back();
             call->generating = false;
             return "";
         }
         call->n_past = tokens.size();
-        llama_batch_free(batch);
+        if (reused > 0) {
+            log_fwd_.forward(whispertalk::LogLevel::DEBUG, cid,
+                "Prompt: %zu tokens, %zu reused from the KV cache", tokens.size(), reused);
+        }
 
         auto gen_start = std::chrono::steady_clock::now();
         std::string response;
@@ -952,7 +1184,7 @@ private:
                             std::chrono::steady_clock::now() - gen_start).count();
                         log_fwd_.forward(whispertalk::LogLevel::INFO, cid,
                             "Streaming sentence %d to TTS (%lldms): %s",
-                            sentences_streamed + 1, stream_ms, trimmed.c_str());
+                            sentences_streamed + 1, (long long)stream_ms, trimmed.c_str());
                         on_sentence(cid, trimmed);
                         full_response += trimmed + " ";
                         response.clear();
@@ -972,9 +1204,11 @@ private:
             if (llama_decode(ctx_, single_batch) != 0) {
                 log_fwd_.forward(whispertalk::LogLevel::ERROR, cid,
                     "llama_decode failed at token %d (n_past=%d, seq=%u)", i, call->n_past, call->seq_id);
+                kv_tokens_.clear();
                 break;
             }
             call->n_past++;
+            kv_tokens_.push_back(id);
         }
         llama_batch_free(single_batch);
 
@@ -994,7 +1228,7 @@ private:
                 call->messages.push_back({"assistant", combined});
             }
             log_fwd_.forward(whispertalk::LogLevel::INFO, cid, "Response (%lldms, %d streamed): %s",
-                gen_ms, sentences_streamed, combined.c_str());
+                (long long)gen_ms, sentences_streamed, combined.c_str());
             return response;
         }
 
@@ -1005,7 +1239,7 @@ private:
             if (response.size() < MIN_RESPONSE_CHARS || wc < MIN_RESPONSE_WORDS) {
                 log_fwd_.forward(whispertalk::LogLevel::WARN, cid,
                     "Discarding fragment response (%lldms, %zu chars, %d words): %s",
-                    gen_ms, response.size(), wc, response.c_str());
+                    (long long)gen_ms, response.size(), wc, response.c_str());
                 response.clear();
             } else {
                 float sim = text_similarity(text, response);
@@ -1040,7 +1274,7 @@ private:
         if (!response.empty()) {
             call->messages.push_back({"assistant", response});
         }
-        log_fwd_.forward(whispertalk::LogLevel::INFO, cid, "Response (%lldms): %s", gen_ms, response.c_str());
+        log_fwd_.forward(whispertalk::LogLevel::INFO, cid, "Response (%lldms): %s", (long long)gen_ms, response.c_str());
         return response;
     }
 
@@ -1057,9 +1291,12 @@ private:
         return res;
     }
 
-    void send_to_tts(uint32_t cid, const std::string& text) {
+    void send_to_tts(uint32_t cid, const std::string& text,
+                     const whispertalk::PacketTrace* trace = nullptr) {
         whispertalk::Packet pkt(cid, text.c_str(), text.length());
-        pkt.trace.record(whispertalk::ServiceType::LLAMA_SERVICE, 0);
+        pkt.meta = whispertalk::FrameMeta(whispertalk::PayloadType::TEXT);
+        if (trace && trace->hop_count > 0) pkt.trace = *trace;
+        else pkt.trace.record(whispertalk::ServiceType::LLAMA_SERVICE, 0);
         pkt.trace.record(whispertalk::ServiceType::LLAMA_SERVICE, 1);
         if (!interconnect_.send_to_downstream(pkt)) {
             if (interconnect_.downstream_state() != whispertalk::ConnectionState::CONNECTED) {
@@ -1095,9 +1332,12 @@ private:
         for (uint32_t cid : stale) {
             auto it = calls_.find(cid);
             if (it != calls_.end()) {
-                llama_memory_t mem = llama_get_memory(ctx_);
-                llama_memory_seq_rm(mem, it->second->seq_id, -1, -1);
+                clear_kv(it->second->seq_id);
                 calls_.erase(it);
+                {
+                    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+                    prefetched_.erase(cid);
+                }
                 log_fwd_.forward(whispertalk::LogLevel::INFO, cid, "Stale session cleaned up (%ds idle)", STALE_SESSION_SEC);
             }
         }
@@ -1122,16 +1362,21 @@ private:
             std::lock_guard<std::mutex> lock(pending_mutex_);
             pending_transcriptions_.erase(call_id);
         }
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex_);
+            prefetch_pending_.erase(call_id);
+            prefetched_.erase(call_id);
+        }
         if (call_to_clean) {
             std::lock_guard<std::mutex> llama_lock(llama_mutex_);
-            llama_memory_t mem = llama_get_memory(ctx_);
-            llama_memory_seq_rm(mem, call_to_clean->seq_id, -1, -1);
+            clear_kv(call_to_clean->seq_id);
             log_fwd_.forward(whispertalk::LogLevel::INFO, call_id, "Call ended, clearing conversation context");
         }
     }
 
     void command_listener_loop() {
-        uint16_t cmd_port = whispertalk::service_cmd_port(whispertalk::ServiceType::LLAMA_SERVICE);
+        uint16_t cmd_port = whispertalk::service_cmd_port(whispertalk::ServiceType::LLAMA_SERVICE,
+                                                          interconnect_.instance());
         int server_fd = socket(AF_INET, SOCK_STREAM, 0);
         if (server_fd < 0) return;
         int opt = 1;
@@ -1227,8 +1472,7 @@ private:
                 std::lock_guard<std::mutex> calls_lock(calls_mutex_);
                 auto it = calls_.find(test_cid);
                 if (it != calls_.end()) {
-                    llama_memory_t mem = llama_get_memory(ctx_);
-                    llama_memory_seq_rm(mem, it->second->seq_id, -1, -1);
+                    clear_kv(it->second->seq_id);
                     calls_.erase(it);
                 }
             }
@@ -1277,8 +1521,7 @@ private:
                 std::lock_guard<std::mutex> calls_lock(calls_mutex_);
                 auto it = calls_.find(test_cid);
                 if (it != calls_.end()) {
-                    llama_memory_t mem = llama_get_memory(ctx_);
-                    llama_memory_seq_rm(mem, it->second->seq_id, -1, -1);
+                    clear_kv(it->second->seq_id);
                     calls_.erase(it);
                 }
             }
@@ -1307,6 +1550,18 @@ private:
         if (cmd == "PING") {
             return "PONG\n";
         }
+        if (cmd == "HOP_LATENCY") {
+            return interconnect_.hop_latency_report();
+        }
+        if (cmd == "FLOW") {
+            return interconnect_.flow_report();
+        }
+        if (cmd == "METRICS") {
+            return interconnect_.metrics_report();
+        }
+        if (cmd == "METRICS:JSON") {
+            return interconnect_.metrics_report(true);
+        }
         if (cmd == "STATUS") {
             std::lock_guard<std::mutex> lock(calls_mutex_);
             return "ACTIVE_CALLS:" + std::to_string(calls_.size())
@@ -1342,12 +1597,32 @@ private:
     std::queue<WorkItem> work_queue_;
     std::mutex work_mutex_;
     std::condition_variable work_cv_;
+    bool work_busy_ = false;   // worker holds a popped item; guarded by work_mutex_
     std::atomic<uint64_t> idle_prewarm_count_{0};
     std::mutex speech_time_mutex_;
     std::map<uint32_t, std::chrono::steady_clock::time_point> speech_active_since_;
     std::map<uint32_t, std::string> pending_transcriptions_;
     std::mutex pending_mutex_;
     std::atomic<uint32_t> topic_change_idx_{0};
+    std::mutex prefetch_mutex_;
+    std::condition_variable prefetch_cv_;
+    std::map<uint32_t, std::string> prefetch_pending_;   // newest TEXT_PARTIAL per call, not yet worked on
+    std::map<uint32_t, LlamaPrefetch> prefetched_;
+    // Tokens sequence 0 holds, prompt then reply, and the call they belong
+    // to. Guarded by llama_mutex_.
+    uint32_t kv_call_ = 0;
+    std::vector<llama_token> kv_tokens_;
+    static whispertalk::Counter& prefetch_counter(const char* outcome) {
+        return whispertalk::metrics().counter("whispertalk_llama_prefetch_total",
+                                              "Final transcripts by use of the RAG context prefetched for their partial",
+                                              {{"outcome", outcome}});
+    }
+    whispertalk::Counter& prefetch_used_ = prefetch_counter("used");
+    whispertalk::Counter& prefetch_stale_ = prefetch_counter("stale");
+    whispertalk::Counter& prompt_tokens_reused_ = whispertalk::metrics().counter(
+        "whispertalk_llama_prompt_tokens_reused_total", "Prompt tokens kept in the KV cache instead of decoded");
+    whispertalk::Counter& prompt_tokens_decoded_ = whispertalk::metrics().counter(
+        "whispertalk_llama_prompt_tokens_decoded_total", "Prompt tokens decoded");
     whispertalk::InterconnectNode interconnect_;
     whispertalk::LogForwarder log_fwd_;
 };
@@ -1364,26 +1639,33 @@ int main(int argc, char** argv) {
     std::string log_level = "INFO";
     std::string rag_host = "127.0.0.1";
     int rag_port = 13181;
+    int instance = 0;
 
     static struct option long_opts[] = {
         {"log-level",  required_argument, 0, 'L'},
         {"rag-host",   required_argument, 0, 'H'},
         {"rag-port",   required_argument, 0, 'P'},
+        {"instance",   required_argument, 0, 'i'},
         {0, 0, 0, 0}
     };
     int opt;
-    while ((opt = getopt_long(argc, argv, "L:H:P:", long_opts, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "L:H:P:i:", long_opts, nullptr)) != -1) {
         switch (opt) {
             case 'L': log_level = optarg; break;
             case 'H': rag_host = optarg; break;
             case 'P': rag_port = std::atoi(optarg); break;
+            case 'i': instance = std::atoi(optarg); break;
             default: break;
         }
     }
     if (optind < argc) model_path = argv[optind];
+    if (instance < 0 || instance >= whispertalk::MAX_STAGE_REPLICAS) {
+        std::cerr << "--instance must be 0.." << whispertalk::MAX_STAGE_REPLICAS - 1 << std::endl;
+        return 1;
+    }
 
     try {
-        LlamaService service(model_path, rag_host, rag_port);
+        LlamaService service(model_path, rag_host, rag_port, static_cast<uint8_t>(instance));
         if (!service.init()) {
             return 1;
         }
@@ -0,0 +1,603 @@
+// log-ring.h — deferred log formatting for LogForwarder.
+//
+// A log call on a hot loop used to pay for vsnprintf() and a blocking
+// sendto() on the calling thread. Instead, the calling thread now appends a
+// compact binary record to its own single-producer ring:
+//
+//   [size u32][level u8][0 u8][args_len u16][call_id u32][0 u32]
+//   [ticks u64][fmt pointer][args ...]                   (host order, 8-aligned)
+//
+// `fmt` must be a string with static storage (a literal), which doubles as
+// the format-string id. The arguments are copied as the format string says:
+// one tag byte, then an int64 / uint64 / double / long double / pointer,
+// or a length-prefixed copy of a %s string (the pointer would be dangling
+// by the time the record is formatted). `ticks` is log_ticks(): the TSC on
+// x86, the virtual counter on arm64, steady_clock ns elsewhere.
+//
+// LogForwarder's drain thread renders records with log_render() — one
+// snprintf() per conversion, same output as vsnprintf() — and packs them
+// into batch datagrams for the frontend:
+//
+//   [LOG_BATCH_MAGIC u8][version u8][count u16]
+//   count × { [len u16][wall_us u64][len bytes "<SERVICE> <LEVEL> <CALL_ID> <message>"] }
+//                                                                   (big-endian)
+//
+// wall_us is the wall-clock time of the log call (LogClock maps ticks to
+// it). A plain-text datagram starts with a service name, never with the
+// magic byte, so the frontend takes both.
+
+#pragma once
+
+#include <sys/types.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace whispertalk {
+
+static constexpr size_t LOG_RING_BYTES = 64 * 1024;         // per logging thread
+static constexpr size_t LOG_MESSAGE_MAX = 2047;             // as the vsnprintf path
+static constexpr size_t LOG_ARGS_MAX = 2048;                // captured argument bytes per record
+static constexpr uint8_t LOG_BATCH_MAGIC = 0x1E;
+static constexpr uint8_t LOG_BATCH_VERSION = 1;
+static constexpr size_t LOG_BATCH_DATAGRAM_BYTES = 16 * 1024;
+
+inline uint64_t log_steady_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+inline uint64_t log_wall_us() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+static constexpr bool LOG_TICKS_ARE_COUNTER = true;
+#else
+static constexpr bool LOG_TICKS_ARE_COUNTER = false;
+#endif
+
+inline uint64_t log_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return log_steady_ns();
+#endif
+}
+
+// Maps log_ticks() to wall-clock µs. The counter rate is measured against
+// steady_clock once 100 ms have passed since the anchor; until then (and for
+// ticks from before the anchor) records are stamped with the current time,
+// which is at most one drain interval late. The anchor moves every minute so
+// wall-clock adjustments are picked up. Used by the drain thread only.
+class LogClock {
+public:
+    LogClock() { anchor(); }
+
+    void update() {
+        uint64_t t = log_ticks(), ns = log_steady_ns();
+        if (ns - ns0_ >= 100'000'000ull && t > t0_) {
+            ns_per_tick_ = static_cast<double>(ns - ns0_) / static_cast<double>(t - t0_);
+        }
+        if (ns - ns0_ >= 60'000'000'000ull) anchor();
+    }
+
+    uint64_t wall_us(uint64_t ticks) const {
+        if (ns_per_tick_ <= 0 || ticks < t0_) return log_wall_us();
+        return wall0_ + static_cast<uint64_t>(static_cast<double>(ticks - t0_) * ns_per_tick_ / 1000.0);
+    }
+
+private:
+    void anchor() {
+        t0_ = log_ticks();
+        ns0_ = log_steady_ns();
+        wall0_ = log_wall_us();
+        if (!LOG_TICKS_ARE_COUNTER) ns_per_tick_ = 1.0;
+    }
+
+    uint64_t t0_ = 0, ns0_ = 0, wall0_ = 0;
+    double ns_per_tick_ = 0;
+};
+
+// ---------------------------------------------------------------------------
+// Argument capture and rendering
+
+// One printf conversion: %[flags][width][.precision][length]conv.
+struct LogSpec {
+    char flags[8] = {};
+    int width = -1;          // -1: none
+    int precision = -1;      // -1: none
+    bool width_star = false;
+    bool precision_star = false;
+    char length[3] = {};     // "", "hh", "h", "l", "ll", "j", "z", "t", "L"
+    char conv = 0;           // 0: not a conversion this code understands
+};
+
+// Parses the conversion after a '%'. Returns the character after it.
+inline const char* log_parse_spec(const char* p, LogSpec& s) {
+    size_t nf = 0;
+    while (*p && std::strchr("-+ #0'", *p)) {
+        if (nf + 1 < sizeof(s.flags)) s.flags[nf++] = *p;
+        p++;
+    }
+    if (*p == '*') {
+        s.width_star = true;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        s.width = 0;
+        while (*p >= '0' && *p <= '9') s.width = s.width * 10 + (*p++ - '0');
+    }
+    if (*p == '.') {
+        p++;
+        s.precision = 0;
+        if (*p == '*') {
+            s.precision_star = true;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') s.precision = s.precision * 10 + (*p++ - '0');
+        }
+    }
+    if ((p[0] == 'h' && p[1] == 'h') || (p[0] == 'l' && p[1] == 'l')) {
+        s.length[0] = p[0];
+        s.length[1] = p[1];
+        p += 2;
+    } else if (*p && std::strchr("hljztLq", *p)) {
+        s.length[0] = *p == 'q' ? 'L' : *p;
+        p++;
+    }
+    if (*p && std::strchr("diouxXcsfFeEgGaApn", *p)) s.conv = *p++;
+    return p;
+}
+
+enum LogArgTag : uint8_t {
+    LOG_ARG_INT     = 'i',   // int64
+    LOG_ARG_UINT    = 'u',   // uint64
+    LOG_ARG_DOUBLE  = 'f',
+    LOG_ARG_LDOUBLE = 'L',
+    LOG_ARG_PTR     = 'p',
+    LOG_ARG_STR     = 's',   // u16 length + bytes
+    LOG_ARG_STAR    = 'w',   // int, a '*' width or precision
+};
+
+class LogArgWriter {
+public:
+    LogArgWriter(uint8_t* out, size_t cap) : out_(out), cap_(cap) {}
+
+    template <typename T>
+    bool put(uint8_t tag, T v) {
+        if (len_ + 1 + sizeof(T) > cap_) return false;
+        out_[len_] = tag;
+        std::memcpy(out_ + len_ + 1, &v, sizeof(T));
+        len_ += 1 + sizeof(T);
+        return true;
+    }
+
+    bool put_str(const char* s, int precision) {
+        if (!s) s = "(null)";
+        size_t max = precision >= 0 ? static_cast<size_t>(precision) : LOG_MESSAGE_MAX;
+        if (len_ + 3 > cap_) return false;
+        size_t n = strnlen(s, std::min(max, cap_ - len_ - 3));
+        uint16_t n16 = static_cast<uint16_t>(n);
+        out_[len_] = LOG_ARG_STR;
+        std::memcpy(out_ + len_ + 1, &n16, sizeof(n16));
+        std::memcpy(out_ + len_ + 3, s, n);
+        len_ += 3 + n;
+        return true;
+    }
+
+    size_t size() const { return len_; }
+
+private:
+    uint8_t* out_;
+    size_t cap_;
+    size_t len_ = 0;
+};
+
+// Copies the arguments `fmt` consumes from `ap` into `out`. Returns the bytes
+// written. Stops at a conversion it does not understand, or when `out` is
+// full; log_render() then ends the message there.
+inline size_t log_capture_args(uint8_t* out, size_t cap, const char* fmt, va_list ap) {
+    LogArgWriter w(out, cap);
+    for (const char* p = fmt; *p;) {
+        if (*p++ != '%') continue;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        LogSpec s;
+        p = log_parse_spec(p, s);
+        if (!s.conv) break;
+        int precision = s.precision;
+        if (s.width_star && !w.put(LOG_ARG_STAR, va_arg(ap, int))) break;
+        if (s.precision_star) {
+            precision = va_arg(ap, int);
+            if (!w.put(LOG_ARG_STAR, precision)) break;
+        }
+        const char l0 = s.length[0], l1 = s.length[1];
+        bool ok = true;
+        switch (s.conv) {
+            case 'd': case 'i': {
+                int64_t v;
+                if (l0 == 'l' && l1 == 'l') v = va_arg(ap, long long);
+                else if (l0 == 'l') v = va_arg(ap, long);
+                else if (l0 == 'j') v = va_arg(ap, intmax_t);
+                else if (l0 == 'z') v = va_arg(ap, ssize_t);
+                else if (l0 == 't') v = va_arg(ap, ptrdiff_t);
+                else v = va_arg(ap, int);
+                ok = w.put(LOG_ARG_INT, v);
+                break;
+            }
+            case 'o': case 'u': case 'x': case 'X': {
+                uint64_t v;
+                if (l0 == 'l' && l1 == 'l') v = va_arg(ap, unsigned long long);
+                else if (l0 == 'l') v = va_arg(ap, unsigned long);
+                else if (l0 == 'j') v = va_arg(ap, uintmax_t);
+                else if (l0 == 'z') v = va_arg(ap, size_t);
+                else if (l0 == 't') v = static_cast<uint64_t>(va_arg(ap, ptrdiff_t));
+                else v = va_arg(ap, unsigned int);
+                ok = w.put(LOG_ARG_UINT, v);
+                break;
+            }
+            case 'c':
+                ok = w.put(LOG_ARG_INT, static_cast<int64_t>(va_arg(ap, int)));
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (l0 == 'L') ok = w.put(LOG_ARG_LDOUBLE, va_arg(ap, long double));
+                else ok = w.put(LOG_ARG_DOUBLE, va_arg(ap, double));
+                break;
+            case 's':
+                if (l0 == 'l') {
+                    va_arg(ap, const wchar_t*);
+                    ok = w.put_str("(wide)", -1);
+                } else {
+                    ok = w.put_str(va_arg(ap, const char*), precision);
+                }
+                break;
+            case 'p':
+                ok = w.put(LOG_ARG_PTR, va_arg(ap, void*));
+                break;
+            case 'n':
+                va_arg(ap, void*);   // never written
+                break;
+        }
+        if (!ok) break;
+    }
+    return w.size();
+}
+
+class LogArgReader {
+public:
+    LogArgReader(const uint8_t* in, size_t len) : in_(in), len_(len) {}
+
+    template <typename T>
+    bool get(uint8_t tag, T& v) {
+        if (pos_ + 1 + sizeof(T) > len_ || in_[pos_] != tag) return false;
+        std::memcpy(&v, in_ + pos_ + 1, sizeof(T));
+        pos_ += 1 + sizeof(T);
+        return true;
+    }
+
+    bool get_str(const char*& s, size_t& n) {
+        uint16_t n16;
+        if (pos_ + 3 > len_ || in_[pos_] != LOG_ARG_STR) return false;
+        std::memcpy(&n16, in_ + pos_ + 1, sizeof(n16));
+        if (pos_ + 3 + n16 > len_) return false;
+        s = reinterpret_cast<const char*>(in_ + pos_ + 3);
+        n = n16;
+        pos_ += 3 + n16;
+        return true;
+    }
+
+private:
+    const uint8_t* in_;
+    size_t len_;
+    size_t pos_ = 0;
+};
+
+// Formats `fmt` with arguments captured by log_capture_args() into `out`
+// (always NUL-terminated). Returns the length written, at most cap - 1.
+inline size_t log_render(char* out, size_t cap, const char* fmt, const uint8_t* args, size_t args_len) {
+    if (cap == 0) return 0;
+    LogArgReader r(args, args_len);
+    size_t n = 0;
+    auto room = [&]() { return cap - n; };
+    auto emit = [&](int written) {
+        if (written > 0) n += std::min(static_cast<size_t>(written), room() - 1);
+    };
+    for (const char* p = fmt; *p && room() > 1;) {
+        if (*p != '%') {
+            const char* next = std::strchr(p, '%');
+            size_t lit = next ? static_cast<size_t>(next - p) : std::strlen(p);
+            size_t take = std::min(lit, room() - 1);
+            std::memcpy(out + n, p, take);
+            n += take;
+            p += lit;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+        LogSpec s;
+        p = log_parse_spec(p + 1, s);
+        if (!s.conv) break;
+        int width = s.width, precision = s.precision;
+        int star;
+        if (s.width_star) {
+            if (!r.get(LOG_ARG_STAR, star)) break;
+            width = star;
+        }
+        if (s.precision_star) {
+            if (!r.get(LOG_ARG_STAR, star)) break;
+            precision = star < 0 ? -1 : star;
+        }
+
+        // Rebuild the conversion with literal width/precision and the
+        // length modifier of the captured type.
+        char spec[48];
+        size_t k = 0;
+        spec[k++] = '%';
+        for (const char* f = s.flags; *f; f++) spec[k++] = *f;
+        if (s.width_star && width < 0) {   // printf: a negative '*' width left-justifies
+            spec[k++] = '-';
+            width = -width;
+        }
+        if (width >= 0) k += static_cast<size_t>(std::snprintf(spec + k, sizeof(spec) - k, "%d", width));
+        if (precision >= 0 && s.conv != 's') {
+            k += static_cast<size_t>(std::snprintf(spec + k, sizeof(spec) - k, ".%d", precision));
+        }
+        auto finish = [&](const char* mod) {
+            for (; *mod; mod++) spec[k++] = *mod;
+            spec[k++] = s.conv;
+            spec[k] = '\0';
+        };
+
+        bool ok = true;
+        switch (s.conv) {
+            case 'd': case 'i': case 'c': {
+                int64_t v;
+                if (!(ok = r.get(LOG_ARG_INT, v))) break;
+                if (s.length[0] == 'h') v = s.length[1] == 'h' ? static_cast<signed char>(v) : static_cast<short>(v);
+                if (s.conv == 'c') {
+                    finish("");
+                    emit(std::snprintf(out + n, room(), spec, static_cast<int>(v)));
+                } else {
+                    finish("ll");
+                    emit(std::snprintf(out + n, room(), spec, static_cast<long long>(v)));
+                }
+                break;
+            }
+            case 'o': case 'u': case 'x': case 'X': {
+                uint64_t v;
+                if (!(ok = r.get(LOG_ARG_UINT, v))) break;
+                // Narrow types print their truncated value, as printf does.
+                if (s.length[0] == 'h') v = s.length[1] == 'h' ? static_cast<uint8_t>(v) : static_cast<uint16_t>(v);
+                finish("ll");
+                emit(std::snprintf(out + n, room(), spec, static_cast<unsigned long long>(v)));
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (s.length[0] == 'L') {
+                    long double v;
+                    if (!(ok = r.get(LOG_ARG_LDOUBLE, v))) break;
+                    finish("L");
+                    emit(std::snprintf(out + n, room(), spec, v));
+                } else {
+                    double v;
+                    if (!(ok = r.get(LOG_ARG_DOUBLE, v))) break;
+                    finish("");
+                    emit(std::snprintf(out + n, room(), spec, v));
+                }
+                break;
+            case 's': {
+                const char* str;
+                size_t len;
+                if (!(ok = r.get_str(str, len))) break;
+                k += static_cast<size_t>(std::snprintf(spec + k, sizeof(spec) - k, ".%d", static_cast<int>(len)));
+                finish("");
+                emit(std::snprintf(out + n, room(), spec, str));
+                break;
+            }
+            case 'p': {
+                void* v;
+                if (!(ok = r.get(LOG_ARG_PTR, v))) break;
+                finish("");
+                emit(std::snprintf(out + n, room(), spec, v));
+                break;
+            }
+            default:   // 'n'
+                break;
+        }
+        if (!ok) break;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// Per-thread record ring
+
+struct LogRecordHeader {
+    uint32_t size;        // whole record, 8-aligned; LogRing::PAD_BIT marks a wrap pad
+    uint8_t level;
+    uint8_t reserved0;
+    uint16_t args_len;
+    uint32_t call_id;
+    uint32_t reserved1;
+    uint64_t ticks;
+    const char* fmt;
+};
+
+static constexpr size_t LOG_RECORD_MAX =
+    (sizeof(LogRecordHeader) + LOG_ARGS_MAX + 7) & ~static_cast<size_t>(7);
+
+// Single-producer / single-consumer byte ring of variable-size records. A
+// record never wraps: when it does not fit before the end, the producer
+// fills the rest with a pad record and starts at offset 0.
+class LogRing {
+public:
+    static constexpr uint32_t PAD_BIT = 0x80000000u;
+
+    explicit LogRing(size_t bytes = LOG_RING_BYTES)
+        : buf_(new uint8_t[bytes]), cap_(bytes), mask_(bytes - 1) {}
+
+    // Producer: room for up to `max` bytes (8-aligned), or nullptr when full.
+    uint8_t* reserve(size_t max) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        size_t pos = static_cast<size_t>(head & mask_);
+        size_t contig = cap_ - pos;
+        size_t need = max <= contig ? max : contig + max;
+        if (cap_ - static_cast<size_t>(head - tail) < need) return nullptr;
+        if (max > contig) {
+            uint32_t pad = static_cast<uint32_t>(contig) | PAD_BIT;
+            std::memcpy(buf_.get() + pos, &pad, sizeof(pad));
+            pad_ = contig;
+            return buf_.get();
+        }
+        pad_ = 0;
+        return buf_.get() + pos;
+    }
+
+    // Producer: publishes `len` bytes (8-aligned) of the last reserve().
+    void commit(size_t len) {
+        head_.store(head_.load(std::memory_order_relaxed) + pad_ + len, std::memory_order_release);
+    }
+
+    // Consumer: calls fn(const LogRecordHeader&, const uint8_t* args) for
+    // every published record. Returns the number of records.
+    template <typename Fn>
+    size_t drain(Fn&& fn) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        size_t count = 0;
+        while (tail < head) {
+            const uint8_t* p = buf_.get() + (tail & mask_);
+            uint32_t size;
+            std::memcpy(&size, p, sizeof(size));
+            if (size & PAD_BIT) {
+                tail += size & ~PAD_BIT;
+                continue;
+            }
+            LogRecordHeader hdr;
+            std::memcpy(&hdr, p, sizeof(hdr));
+            fn(hdr, p + sizeof(hdr));
+            tail += size;
+            count++;
+        }
+        tail_.store(tail, std::memory_order_release);
+        return count;
+    }
+
+    bool empty() const {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+    size_t used() const {
+        return static_cast<size_t>(head_.load(std::memory_order_relaxed) -
+                                   tail_.load(std::memory_order_relaxed));
+    }
+
+    size_t capacity() const { return cap_; }
+
+private:
+    std::unique_ptr<uint8_t[]> buf_;
+    size_t cap_;
+    size_t mask_;
+    size_t pad_ = 0;   // producer-only
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+};
+
+// Producer side of a record: captures the arguments straight into the ring.
+// When the ring has no room for a maximum-size record the arguments are
+// captured on the stack first and only their actual size is reserved. False
+// when even that does not fit (the record is dropped; the caller counts it).
+inline bool log_ring_write(LogRing& ring, uint8_t level, uint32_t call_id, const char* fmt, va_list ap) {
+    LogRecordHeader hdr{};
+    hdr.level = level;
+    hdr.call_id = call_id;
+    hdr.ticks = log_ticks();
+    hdr.fmt = fmt;
+    uint8_t* p = ring.reserve(LOG_RECORD_MAX);
+    size_t args;
+    if (p) {
+        args = log_capture_args(p + sizeof(hdr), LOG_ARGS_MAX, fmt, ap);
+    } else {
+        uint8_t staged[LOG_ARGS_MAX];
+        args = log_capture_args(staged, sizeof(staged), fmt, ap);
+        p = ring.reserve((sizeof(hdr) + args + 7) & ~static_cast<size_t>(7));
+        if (!p) return false;
+        std::memcpy(p + sizeof(hdr), staged, args);
+    }
+    hdr.args_len = static_cast<uint16_t>(args);
+    hdr.size = static_cast<uint32_t>((sizeof(hdr) + args + 7) & ~static_cast<size_t>(7));
+    std::memcpy(p, &hdr, sizeof(hdr));
+    ring.commit(hdr.size);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Batch datagrams
+
+// Appends one entry to `dgram` (starting a batch header if it is empty).
+// False if the entry does not fit in LOG_BATCH_DATAGRAM_BYTES.
+inline bool log_batch_append(std::vector<uint8_t>& dgram, uint64_t wall_us, const char* text, size_t len) {
+    if (dgram.empty()) dgram = {LOG_BATCH_MAGIC, LOG_BATCH_VERSION, 0, 0};
+    uint16_t count = static_cast<uint16_t>((dgram[2] << 8) | dgram[3]);
+    if (dgram.size() + 10 + len > LOG_BATCH_DATAGRAM_BYTES || count == 0xFFFF) return false;
+    size_t at = dgram.size();
+    dgram.resize(at + 10 + len);
+    uint8_t* p = dgram.data() + at;
+    p[0] = static_cast<uint8_t>(len >> 8);
+    p[1] = static_cast<uint8_t>(len);
+    for (int i = 0; i < 8; i++) p[2 + i] = static_cast<uint8_t>(wall_us >> (56 - 8 * i));
+    std::memcpy(p + 10, text, len);
+    count++;
+    dgram[2] = static_cast<uint8_t>(count >> 8);
+    dgram[3] = static_cast<uint8_t>(count);
+    return true;
+}
+
+inline bool log_is_batch(const uint8_t* data, size_t len) {
+    return len >= 4 && data[0] == LOG_BATCH_MAGIC;
+}
+
+// Calls fn(wall_us, text, len) for each entry of a batch datagram. False if
+// the datagram is not a batch this code understands or is cut short (the
+// entries before the damage have been delivered).
+template <typename Fn>
+bool log_batch_decode(const uint8_t* data, size_t len, Fn&& fn) {
+    if (!log_is_batch(data, len) || data[1] != LOG_BATCH_VERSION) return false;
+    size_t count = (static_cast<size_t>(data[2]) << 8) | data[3];
+    size_t pos = 4;
+    for (size_t i = 0; i < count; i++) {
+        if (pos + 10 > len) return false;
+        size_t n = (static_cast<size_t>(data[pos]) << 8) | data[pos + 1];
+        uint64_t wall_us = 0;
+        for (int b = 0; b < 8; b++) wall_us = (wall_us << 8) | data[pos + 2 + b];
+        if (pos + 10 + n > len) return false;
+        fn(wall_us, reinterpret_cast<const char*>(data + pos + 10), n);
+        pos += 10 + n;
+    }
+    return true;
+}
+
+}
@@ -25,19 +25,27 @@ inline void FrontendServer::log_receiver_loop() {
     tv.tv_usec = 0;
     setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-    char buffer[UDP_BUFFER_SIZE];
+    // Services send batch datagrams (log-ring.h); plain one-entry datagrams
+    // from older builds are still taken.
+    std::vector<char> buffer(UDP_BUFFER_SIZE);
     while (!s_sigint_received) {
-        ssize_t n = recv(sock, buffer, sizeof(buffer) - 1, 0);
-        if (n > 0) {
-            buffer[n] = '\0';
-            process_log_message(std::string(buffer, n));
+        ssize_t n = recv(sock, buffer.data(), buffer.size() - 1, 0);
+        if (n <= 0) continue;
+        const auto* data = reinterpret_cast<const uint8_t*>(buffer.data());
+        if (whispertalk::log_is_batch(data, static_cast<size_t>(n))) {
+            whispertalk::log_batch_decode(data, static_cast<size_t>(n),
+                [this](uint64_t wall_us, const char* text, size_t len) {
+                    process_log_message(std::string(text, len), wall_us);
+                });
+        } else {
+            process_log_message(std::string(buffer.data(), static_cast<size_t>(n)));
         }
     }
 
     close(sock);
 }
 
-inline void FrontendServer::process_log_message(const std::string& msg) {
+inline void FrontendServer::process_log_message(const std::string& msg, uint64_t wall_us) {
     if (msg.empty()) return;
 
     size_t p1 = msg.find(' ');
@@ -50,7 +58,7 @@ inline void FrontendServer::process_log_message(const std::string& msg) {
 
     LogEntry entry;
 
-    time_t now = time(nullptr);
+    time_t now = wall_us ? static_cast<time_t>(wall_us / 1000000) : time(nullptr);
     char timebuf[64];
     struct tm tm_buf;
     strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &tm_buf));
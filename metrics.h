@@ -0,0 +1,428 @@
+// metrics.h — process-wide counters, gauges and latency histograms.
+//
+// Services register named series once and update them from the hot path:
+//
+//   static Counter& frames = metrics().counter("whispertalk_iap_frames_total",
+//                                              "Audio frames converted");
+//   frames.inc();
+//
+// Counter and Gauge are single relaxed atomics; histograms are the log-linear
+// LatencyHistogram of hop-latency.h (values in µs). Registration takes a mutex
+// and returns a reference that stays valid for the life of the process, so
+// look series up once (per call at most), never per packet.
+//
+// Values that already live elsewhere (queue sizes, maps of active calls) are
+// exported by a collector: a callback that writes them into a MetricsWriter
+// at scrape time, on the scraping thread. MetricsCollector registers one for
+// the lifetime of an object.
+//
+// Per-call series carry a "call" label and are retire()d when the call ends:
+// the series drops out of scrapes, its storage is zeroed and handed to the
+// next registration of the same name, so call churn does not grow the
+// registry. A reference to a retired series must not be used again.
+//
+// render() produces the Prometheus text format (0.0.4) or JSON.
+// InterconnectNode::metrics_report() adds the node's own link telemetry and
+// answers the METRICS and METRICS:JSON cmd-port commands; the frontend merges
+// every service into GET /api/metrics.
+
+#pragma once
+
+#include "hop-latency.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace whispertalk {
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+enum class MetricType : uint8_t { COUNTER, GAUGE, HISTOGRAM };
+
+inline const char* metric_type_name(MetricType t) {
+    switch (t) {
+        case MetricType::COUNTER: return "counter";
+        case MetricType::GAUGE:   return "gauge";
+        default:                  return "histogram";
+    }
+}
+
+class Counter {
+public:
+    void inc(uint64_t n = 1) { v_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return v_.load(std::memory_order_relaxed); }
+    void reset() { v_.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> v_{0};
+};
+
+class Gauge {
+public:
+    void set(int64_t v) { v_.store(v, std::memory_order_relaxed); }
+    void add(int64_t d) { v_.fetch_add(d, std::memory_order_relaxed); }
+    int64_t value() const { return v_.load(std::memory_order_relaxed); }
+    void reset() { set(0); }
+
+private:
+    std::atomic<int64_t> v_{0};
+};
+
+// Accumulates one scrape. Series of the same name are grouped into one
+// family whatever order they are written in, as the text format requires.
+class MetricsWriter {
+public:
+    // Histogram buckets in the text format: le = 2^k - 1 µs for k = 1..26
+    // (values are whole µs, so le="1023" is everything below 1024 µs),
+    // then +Inf.
+    static constexpr int PROM_BUCKETS = 26;
+
+    MetricsWriter(bool json, MetricLabels common) : json_(json), common_(std::move(common)) {}
+
+    void counter(const std::string& name, const std::string& help, const MetricLabels& labels,
+                 double value) {
+        scalar(name, help, MetricType::COUNTER, labels, value);
+    }
+
+    void gauge(const std::string& name, const std::string& help, const MetricLabels& labels,
+               double value) {
+        scalar(name, help, MetricType::GAUGE, labels, value);
+    }
+
+    void histogram(const std::string& name, const std::string& help, const MetricLabels& labels,
+                   const LatencyHistogram& h) {
+        if (json_) {
+            char buf[320];
+            snprintf(buf, sizeof(buf),
+                ",\"count\":%llu,\"sum\":%llu,\"mean\":%.1f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu"
+                ",\"p999\":%llu,\"max\":%llu}",
+                (unsigned long long)h.count(), (unsigned long long)h.sum(), h.mean(),
+                (unsigned long long)h.percentile(0.50), (unsigned long long)h.percentile(0.90),
+                (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999),
+                (unsigned long long)h.max());
+            json_entries_.push_back(json_head(name, MetricType::HISTOGRAM, labels) + buf);
+            return;
+        }
+        std::string& out = family(name, help, MetricType::HISTOGRAM);
+        // One pass over the buckets, cumulated at each power-of-two edge.
+        uint64_t cum = 0;
+        int i = 0;
+        for (int k = 1; k <= PROM_BUCKETS; k++) {
+            uint64_t edge = (1ULL << k) - 1;
+            for (; i < LatencyHistogram::NUM_BUCKETS && LatencyHistogram::bucket_upper(i) <= edge; i++) {
+                cum += h.bucket_count(i);
+            }
+            out += name + "_bucket" + prom_labels(labels, "le", std::to_string(edge)) + " " +
+                   std::to_string(cum) + "\n";
+        }
+        // count() is bumped after the bucket, so a racing record can leave it
+        // briefly behind; keep +Inf ≥ every finite bucket.
+        uint64_t total = h.count();
+        for (; i < LatencyHistogram::NUM_BUCKETS; i++) cum += h.bucket_count(i);
+        if (total < cum) total = cum;
+        out += name + "_bucket" + prom_labels(labels, "le", "+Inf") + " " + std::to_string(total) + "\n";
+        out += name + "_sum" + prom_labels(labels) + " " + std::to_string(h.sum()) + "\n";
+        out += name + "_count" + prom_labels(labels) + " " + std::to_string(total) + "\n";
+    }
+
+    std::string finish() const {
+        std::string out;
+        if (json_) {
+            out = "{";
+            for (const auto& kv : common_) out += "\"" + json_escape(kv.first) + "\":\"" + json_escape(kv.second) + "\",";
+            out += "\"metrics\":[";
+            for (size_t i = 0; i < json_entries_.size(); i++) {
+                if (i) out += ",";
+                out += json_entries_[i];
+            }
+            out += "]}\n";
+            return out;
+        }
+        for (const auto& f : families_) {
+            out += "# HELP " + f.name + " " + f.help + "\n";
+            out += "# TYPE " + f.name + " " + metric_type_name(f.type) + "\n";
+            out += f.body;
+        }
+        return out;
+    }
+
+    static std::string json_escape(const std::string& s) {
+        std::string out;
+        out.reserve(s.size());
+        for (char c : s) {
+            if (c == '"' || c == '\\') { out += '\\'; out += c; }
+            else if (c == '\n') out += "\\n";
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else out += c;
+        }
+        return out;
+    }
+
+private:
+    struct Family {
+        std::string name;
+        std::string help;
+        MetricType type;
+        std::string body;
+    };
+
+    static std::string format_value(double v) {
+        char buf[32];
+        if (std::isfinite(v) && v == std::floor(v) && std::fabs(v) < 1e15) {
+            snprintf(buf, sizeof(buf), "%lld", (long long)v);
+        } else {
+            snprintf(buf, sizeof(buf), "%.6g", v);
+        }
+        return buf;
+    }
+
+    static std::string prom_escape(const std::string& s) {
+        std::string out;
+        out.reserve(s.size());
+        for (char c : s) {
+            if (c == '"' || c == '\\') { out += '\\'; out += c; }
+            else if (c == '\n') out += "\\n";
+            else out += c;
+        }
+        return out;
+    }
+
+    std::string prom_labels(const MetricLabels& labels, const char* extra_key = nullptr,
+                            const std::string& extra_value = std::string()) const {
+        std::string out;
+        auto add = [&](const std::string& k, const std::string& v) {
+            out += out.empty() ? "{" : ",";
+            out += k + "=\"" + prom_escape(v) + "\"";
+        };
+        for (const auto& kv : common_) add(kv.first, kv.second);
+        for (const auto& kv : labels) add(kv.first, kv.second);
+        if (extra_key) add(extra_key, extra_value);
+        if (!out.empty()) out += "}";
+        return out;
+    }
+
+    std::string json_head(const std::string& name, MetricType type, const MetricLabels& labels) const {
+        std::string out = "{\"name\":\"" + json_escape(name) + "\",\"type\":\"" + metric_type_name(type) +
+                          "\",\"labels\":{";
+        for (size_t i = 0; i < labels.size(); i++) {
+            if (i) out += ",";
+            out += "\"" + json_escape(labels[i].first) + "\":\"" + json_escape(labels[i].second) + "\"";
+        }
+        return out + "}";
+    }
+
+    std::string& family(const std::string& name, const std::string& help, MetricType type) {
+        auto it = family_index_.find(name);
+        if (it != family_index_.end()) return families_[it->second].body;
+        family_index_[name] = families_.size();
+        families_.push_back(Family{name, help, type, std::string()});
+        return families_.back().body;
+    }
+
+    void scalar(const std::string& name, const std::string& help, MetricType type,
+                const MetricLabels& labels, double value) {
+        if (json_) {
+            json_entries_.push_back(json_head(name, type, labels) + ",\"value\":" + format_value(value) + "}");
+            return;
+        }
+        family(name, help, type) += name + prom_labels(labels) + " " + format_value(value) + "\n";
+    }
+
+    bool json_;
+    MetricLabels common_;
+    std::vector<Family> families_;
+    std::map<std::string, size_t> family_index_;
+    std::vector<std::string> json_entries_;
+};
+
+class MetricsRegistry {
+public:
+    using CollectorFn = std::function<void(MetricsWriter&)>;
+
+    Counter& counter(const std::string& name, const std::string& help, const MetricLabels& labels = {}) {
+        Series* s = find_or_add(name, help, MetricType::COUNTER, labels);
+        static Counter unregistered;
+        return s ? s->counter : unregistered;
+    }
+
+    Gauge& gauge(const std::string& name, const std::string& help, const MetricLabels& labels = {}) {
+        Series* s = find_or_add(name, help, MetricType::GAUGE, labels);
+        static Gauge unregistered;
+        return s ? s->gauge : unregistered;
+    }
+
+    LatencyHistogram& histogram(const std::string& name, const std::string& help,
+                                const MetricLabels& labels = {}) {
+        Series* s = find_or_add(name, help, MetricType::HISTOGRAM, labels);
+        static LatencyHistogram unregistered;
+        return s ? *s->hist : unregistered;
+    }
+
+    // Drops a series from scrapes and zeroes it for reuse (see the top of
+    // this file). Unknown series are ignored.
+    void retire(const std::string& name, const MetricLabels& labels) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(series_key(name, labels));
+        if (it == index_.end()) return;
+        Series& s = series_[it->second];
+        s.live = false;
+        s.counter.reset();
+        s.gauge.reset();
+        if (s.hist) s.hist->reset();
+        free_[name].push_back(it->second);
+        index_.erase(it);
+    }
+
+    uint64_t add_collector(CollectorFn fn) {
+        std::lock_guard<std::mutex> lock(collect_mutex_);
+        uint64_t id = ++next_collector_;
+        collectors_[id] = std::move(fn);
+        return id;
+    }
+
+    // Waits for a scrape that is running the collector to finish.
+    void remove_collector(uint64_t id) {
+        std::lock_guard<std::mutex> lock(collect_mutex_);
+        collectors_.erase(id);
+    }
+
+    // Registered series first, then whatever the collectors write.
+    void collect(MetricsWriter& w) const {
+        std::lock_guard<std::mutex> clock(collect_mutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& s : series_) {
+                if (!s.live) continue;
+                switch (s.type) {
+                    case MetricType::COUNTER:
+                        w.counter(s.name, s.help, s.labels, static_cast<double>(s.counter.value()));
+                        break;
+                    case MetricType::GAUGE:
+                        w.gauge(s.name, s.help, s.labels, static_cast<double>(s.gauge.value()));
+                        break;
+                    case MetricType::HISTOGRAM:
+                        w.histogram(s.name, s.help, s.labels, *s.hist);
+                        break;
+                }
+            }
+        }
+        for (const auto& kv : collectors_) kv.second(w);
+    }
+
+    std::string render(bool json, const MetricLabels& common = {}) const {
+        MetricsWriter w(json, common);
+        collect(w);
+        return w.finish();
+    }
+
+    size_t series_count() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return index_.size();
+    }
+
+private:
+    struct Series {
+        std::string name;
+        std::string help;
+        MetricLabels labels;
+        MetricType type = MetricType::COUNTER;
+        bool live = true;
+        Counter counter;
+        Gauge gauge;
+        std::unique_ptr<LatencyHistogram> hist;
+    };
+
+    static std::string series_key(const std::string& name, const MetricLabels& labels) {
+        std::string key = name;
+        for (const auto& kv : labels) {
+            key += '\x1f';
+            key += kv.first;
+            key += '=';
+            key += kv.second;
+        }
+        return key;
+    }
+
+    // nullptr when the name is already registered with another type; the
+    // caller then hands out a dummy that is never scraped.
+    Series* find_or_add(const std::string& name, const std::string& help, MetricType type,
+                        const MetricLabels& labels) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto t = types_.find(name);
+        if (t != types_.end() && t->second != type) {
+            fprintf(stderr, "metrics: %s registered as %s, not %s\n", name.c_str(),
+                    metric_type_name(t->second), metric_type_name(type));
+            return nullptr;
+        }
+        types_[name] = type;
+        std::string key = series_key(name, labels);
+        auto it = index_.find(key);
+        if (it != index_.end()) return &series_[it->second];
+
+        Series* s;
+        auto& spare = free_[name];
+        if (!spare.empty()) {
+            index_[key] = spare.back();
+            s = &series_[spare.back()];
+            spare.pop_back();
+        } else {
+            index_[key] = series_.size();
+            series_.emplace_back();
+            s = &series_.back();
+            if (type == MetricType::HISTOGRAM) s->hist.reset(new LatencyHistogram());
+        }
+        s->name = name;
+        s->help = help;
+        s->labels = labels;
+        s->type = type;
+        s->live = true;
+        return s;
+    }
+
+    mutable std::mutex mutex_;
+    std::deque<Series> series_;                       // never shrinks; references stay valid
+    std::map<std::string, size_t> index_;             // live series by name + labels
+    std::map<std::string, std::vector<size_t>> free_; // retired series by name
+    std::map<std::string, MetricType> types_;
+
+    mutable std::mutex collect_mutex_;
+    std::map<uint64_t, CollectorFn> collectors_;
+    uint64_t next_collector_ = 0;
+};
+
+inline MetricsRegistry& metrics() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+// Registers a collector for the lifetime of the owning object. Declare it
+// after the members the callback reads, so it is removed before they go.
+class MetricsCollector {
+public:
+    explicit MetricsCollector(MetricsRegistry::CollectorFn fn, MetricsRegistry& reg = metrics())
+        : reg_(reg), id_(reg.add_collector(std::move(fn))) {}
+    ~MetricsCollector() { reg_.remove_collector(id_); }
+
+    MetricsCollector(const MetricsCollector&) = delete;
+    MetricsCollector& operator=(const MetricsCollector&) = delete;
+
+private:
+    MetricsRegistry& reg_;
+    uint64_t id_;
+};
+
+}
@@ -51,7 +51,8 @@
 //   Metadata frame (MT=4, JSON) before the first audio frame. This gives
 //   Moshi the patient name and any other context fields available at call start.
 //
-// CMD port (MOSHI base+2 = 13157): PING→PONG, STATUS, SET_LOG_LEVEL.
+// CMD port (MOSHI base+2 = 13157): PING→PONG, STATUS, SET_LOG_LEVEL, HOP_LATENCY, FLOW,
+//   METRICS, METRICS:JSON.
 #include <iostream>
 #include <vector>
 #include <string>
@@ -438,7 +439,9 @@ private:
                 continue;
 
             if (!pkt.is_valid() || pkt.payload_size == 0
-                || (pkt.payload_size % sizeof(float)) != 0)
+                || (pkt.payload_size % sizeof(float)) != 0
+                || !whispertalk::payload_is(pkt.meta, whispertalk::PayloadType::PCM_F32, true)
+                || (pkt.meta.sample_rate != 0 && pkt.meta.sample_rate != 24000))
                 continue;
 
             size_t sample_count = pkt.payload_size / sizeof(float);
@@ -556,6 +559,9 @@ private:
             for (auto& p : pending) {
                 whispertalk::Packet out(p.call_id, p.data.data(),
                     static_cast<uint32_t>(p.data.size() * sizeof(float)));
+                // Bare 24 kHz PCM, no tts-common.h header: OAP tells the two
+                // apart by the frame type.
+                out.meta = whispertalk::FrameMeta(whispertalk::PayloadType::PCM_F32, 24000);
                 interconnect_.send_to_downstream(out);
             }
             for (auto& t : pending_texts) {
@@ -1040,6 +1046,10 @@ private:
 
     std::string handle_command(const std::string& cmd) {
         if (cmd == "PING") return "PONG\n";
+        if (cmd == "HOP_LATENCY") return interconnect_.hop_latency_report();
+        if (cmd == "FLOW") return interconnect_.flow_report();
+        if (cmd == "METRICS") return interconnect_.metrics_report();
+        if (cmd == "METRICS:JSON") return interconnect_.metrics_report(true);
         if (cmd.rfind("SET_LOG_LEVEL:", 0) == 0) {
             log_fwd_.set_level(cmd.substr(14).c_str());
             return "OK\n";
@@ -19,6 +19,8 @@
 //   Each tick sends exactly 160 G.711 bytes to the SIP_CLIENT via the interconnect
 //   data channel. If the TTS buffer is empty (TTS silent or not connected), the
 //   sender emits ULAW_SILENCE frames (0xFF) to maintain RTP clock continuity.
+//   The frames of all calls in a tick go out as one batch
+//   (send_batch_to_downstream): one syscall per tick instead of one per call.
 //
 // Per-call state (CallState):
 //   buffer:    raw G.711 byte queue fed by the TTS receive thread.
@@ -32,7 +34,8 @@
 //   When upstream signals SPEECH_ACTIVE (caller speaking), OAP clears all call buffers
 //   to stop playing stale TTS audio immediately (avoids feedback over the caller).
 //
-// CMD port (OAP base+2 = 13152): PING, STATUS, SET_LOG_LEVEL, SAVE_WAV:ON/OFF/STATUS, SET_SAVE_WAV_DIR.
+// CMD port (OAP base+2 = 13152): PING, STATUS, SET_LOG_LEVEL, HOP_LATENCY, FLOW, METRICS, METRICS:JSON,
+//   SAVE_WAV:ON/OFF/STATUS, SET_SAVE_WAV_DIR.
 //   STATUS returns active calls, buffer lengths, upstream/downstream state.
 #include <iostream>
 #include <vector>
@@ -134,10 +137,16 @@ struct CallState {
     std::vector<int16_t> wav_input_samples;
     float pres_x1=0,pres_x2=0,pres_y1=0,pres_y2=0;
     float dc_x_prev=0, dc_y_prev=0;
+    // Hop trace of the first traced TTS packet still in the buffer, and the
+    // buffer offset where its audio starts. The frame that plays that offset
+    // carries the trace on to the SIP client.
+    whispertalk::PacketTrace pending_trace;
+    size_t pending_trace_pos = 0;
 
     void compact() {
         if (read_pos > COMPACT_THRESHOLD && read_pos > buffer.size() / 2) {
             buffer.erase(buffer.begin(), buffer.begin() + read_pos);
+            pending_trace_pos -= std::min(pending_trace_pos, read_pos);
             read_pos = 0;
         }
     }
@@ -271,6 +280,10 @@ private:
 
     std::string handle_command(const std::string& cmd) {
         if (cmd == "PING") return "PONG\n";
+        if (cmd == "HOP_LATENCY") return interconnect_.hop_latency_report();
+        if (cmd == "FLOW") return interconnect_.flow_report();
+        if (cmd == "METRICS") return interconnect_.metrics_report();
+        if (cmd == "METRICS:JSON") return interconnect_.metrics_report(true);
         if (cmd.rfind("SET_LOG_LEVEL:", 0) == 0) {
             std::string level = cmd.substr(14);
             log_fwd_.set_level(level.c_str());
@@ -481,19 +494,31 @@ private:
                 continue;
             }
 
-            if (!pkt.is_valid() || pkt.payload_size < whispertalk::tts::kTTSAudioHeaderBytes) {
+            // TTS engines send the tts-common.h audio header in front of the
+            // PCM; a typed PCM_F32 frame (Moshi) is bare PCM. Untyped frames
+            // are assumed to carry the header, as before.
+            if (!pkt.is_valid()) continue;
+            const bool bare_pcm = pkt.meta.type == whispertalk::PayloadType::PCM_F32;
+            if (!bare_pcm && !whispertalk::payload_is(pkt.meta, whispertalk::PayloadType::TTS_AUDIO, true)) {
                 continue;
             }
+            if (pkt.meta.sample_rate != 0 && pkt.meta.sample_rate != INPUT_SAMPLE_RATE) continue;
+            const size_t header_bytes = bare_pcm ? 0 : whispertalk::tts::kTTSAudioHeaderBytes;
+            if (pkt.payload_size < header_bytes) continue;
 
             pkt.trace.record(whispertalk::ServiceType::OUTBOUND_AUDIO_PROCESSOR, 0);
             auto state = get_or_create_call(pkt.call_id);
 
             // Decode engine-out timestamp (bytes [4..12), big-endian) and
-            // record per-hop latency for the histogram dump.
-            uint64_t t_engine_out_us = 0;
-            const uint8_t* ts_bytes = pkt.payload.data() + sizeof(int32_t);
-            for (int i = 0; i < 8; ++i) {
-                t_engine_out_us = (t_engine_out_us << 8) | static_cast<uint64_t>(ts_bytes[i]);
+            // record per-hop latency for the histogram dump. Bare PCM has
+            // only the frame's capture time.
+            uint64_t t_engine_out_us = pkt.meta.capture_us;
+            if (!bare_pcm) {
+                t_engine_out_us = 0;
+                const uint8_t* ts_bytes = pkt.payload.data() + sizeof(int32_t);
+                for (int i = 0; i < 8; ++i) {
+                    t_engine_out_us = (t_engine_out_us << 8) | static_cast<uint64_t>(ts_bytes[i]);
+                }
             }
             uint64_t t_oap_in_us = static_cast<uint64_t>(
                 std::chrono::duration_cast<std::chrono::microseconds>(
@@ -502,11 +527,10 @@ private:
                 record_latency_sample(t_oap_in_us - t_engine_out_us);
             }
 
-            size_t audio_bytes = pkt.payload_size - whispertalk::tts::kTTSAudioHeaderBytes;
+            size_t audio_bytes = pkt.payload_size - header_bytes;
             if (audio_bytes == 0 || (audio_bytes % sizeof(float)) != 0) continue;
             size_t sample_count = audio_bytes / sizeof(float);
-            const float* pcm_buf = reinterpret_cast<const float*>(
-                pkt.payload.data() + whispertalk::tts::kTTSAudioHeaderBytes);
+            const float* pcm_buf = reinterpret_cast<const float*>(pkt.payload.data() + header_bytes);
 
             std::lock_guard<std::mutex> lock(state->mutex);
             auto now = std::chrono::steady_clock::now();
@@ -518,11 +542,17 @@ private:
                     state->wav_input_samples.push_back(static_cast<int16_t>(s * PCM_SCALE));
                 }
             }
+            if (pkt.trace.hop_count > 1 && state->pending_trace.hop_count == 0) {
+                state->pending_trace = pkt.trace;
+                state->pending_trace_pos = state->buffer.size();
+            }
             downsample_and_encode_into(pcm_buf, sample_count, *state, state->buffer);
         }
     }
 
     void scheduler_loop() {
+        std::vector<std::shared_ptr<CallState>> active;
+        std::vector<whispertalk::PooledPacket> frames;
         auto next = std::chrono::steady_clock::now();
         auto last_cleanup = std::chrono::steady_clock::now();
         while (running_) {
@@ -546,7 +576,7 @@ private:
                 for (auto it = calls_.begin(); it != calls_.end(); ) {
                     auto age = (now_ns - it->second->last_activity_ns.load(std::memory_order_relaxed)) / 1000000000LL;
                     if (age > STALE_CALL_TIMEOUT_S) {
-                        log_fwd_.forward(whispertalk::LogLevel::WARN, it->first, "Stale call removed after %lds idle", age);
+                        log_fwd_.forward(whispertalk::LogLevel::WARN, it->first, "Stale call removed after %llds idle", (long long)age);
                         it = calls_.erase(it);
                     } else {
                         ++it;
@@ -554,34 +584,48 @@ private:
                 }
             }
 
-            std::vector<std::shared_ptr<CallState>> active;
+            active.clear();
             {
                 std::lock_guard<std::mutex> lock(calls_mutex_);
                 for (auto& p : calls_) active.push_back(p.second);
             }
 
+            // The tick's frames for every call go to SIP as one batch.
+            frames.clear();
+            uint64_t silent = 0;
             for (auto& state : active) {
-                uint8_t frame[ULAW_FRAME_SIZE];
+                auto pkt = interconnect_.make_packet(state->id, ULAW_FRAME_SIZE);
+                pkt.meta = whispertalk::FrameMeta(whispertalk::PayloadType::ULAW, 8000);
+                uint8_t* frame = pkt.payload();
                 {
                     std::lock_guard<std::mutex> lock(state->mutex);
                     size_t avail = state->buffer.size() - state->read_pos;
                     if (avail >= ULAW_FRAME_SIZE) {
                         memcpy(frame, state->buffer.data() + state->read_pos, ULAW_FRAME_SIZE);
+                        if (state->pending_trace.hop_count > 0 &&
+                            state->pending_trace_pos < state->read_pos + ULAW_FRAME_SIZE) {
+                            pkt.trace = state->pending_trace;
+                            state->pending_trace.hop_count = 0;
+                        }
                         state->read_pos += ULAW_FRAME_SIZE;
                         state->compact();
                     } else {
                         memset(frame, ULAW_SILENCE, ULAW_FRAME_SIZE);
+                        silent++;
                         if (avail == 0)
                             state->first_chunk = true;
                     }
                 }
 
-                whispertalk::Packet pkt(state->id, frame, ULAW_FRAME_SIZE);
                 pkt.trace.record(whispertalk::ServiceType::OUTBOUND_AUDIO_PROCESSOR, 1);
-                if (!interconnect_.send_to_downstream(pkt)) {
-                    if (interconnect_.downstream_state() != whispertalk::ConnectionState::CONNECTED) {
-                        log_fwd_.forward(whispertalk::LogLevel::WARN, state->id, "SIP disconnected, discarding audio");
-                    }
+                frames.push_back(std::move(pkt));
+            }
+            audio_frames_.inc(frames.size() - silent);
+            silence_frames_.inc(silent);
+            if (!frames.empty() && interconnect_.send_batch_to_downstream(frames) < frames.size()) {
+                if (interconnect_.downstream_state() != whispertalk::ConnectionState::CONNECTED) {
+                    log_fwd_.forward(whispertalk::LogLevel::WARN, 0,
+                        "SIP disconnected, discarding audio for %zu calls", frames.size());
                 }
             }
 
@@ -652,11 +696,15 @@ private:
         size_t flushed = state->buffer.size() - state->read_pos;
         state->buffer.clear();
         state->read_pos = 0;
+        state->pending_trace.hop_count = 0;
         std::memset(state->fir_history, 0, sizeof(state->fir_history));
         state->first_chunk = true;
         state->dc_x_prev = 0.0f;
         state->dc_y_prev = 0.0f;
         state->pres_x1 = state->pres_x2 = state->pres_y1 = state->pres_y2 = 0.0f;
+        // From here the playout tick sends silence: VAD.SIG>OAP.ACT in
+        // HOP_LATENCY is the caller's interrupt-to-silence time.
+        interconnect_.mark_speech_handled(call_id);
         log_fwd_.forward(whispertalk::LogLevel::WARN, call_id, "SPEECH_ACTIVE — flushed %zu bytes of audio buffer", flushed);
     }
 
@@ -748,6 +796,7 @@ private:
     // we never unbounded-grow. Latency JSON lands in test-results/ for the
     // 60 s loopback run to inspect against the median/p99 budget.
     void record_latency_sample(uint64_t delta_us) {
+        engine_latency_us_.record(delta_us);
         bool should_dump = false;
         {
             std::lock_guard<std::mutex> lock(latency_mutex_);
@@ -826,6 +875,13 @@ private:
     static constexpr size_t kLatencyAutoDumpAt   = 50000;
     std::mutex latency_mutex_;
     std::vector<uint64_t> latency_samples_us_;
+    // The same deltas for the METRICS scrape, never reset.
+    whispertalk::LatencyHistogram& engine_latency_us_ = whispertalk::metrics().histogram(
+        "whispertalk_oap_engine_latency_us", "TTS engine output to OAP arrival (µs)");
+    whispertalk::Counter& audio_frames_ = whispertalk::metrics().counter(
+        "whispertalk_oap_audio_frames_total", "μ-law frames sent to SIP carrying TTS audio");
+    whispertalk::Counter& silence_frames_ = whispertalk::metrics().counter(
+        "whispertalk_oap_silence_frames_total", "Silence frames sent to SIP because a call's buffer ran dry");
 
     std::atomic<bool> running_;
     std::atomic<int> cmd_sock_{-1};
@@ -840,6 +896,21 @@ private:
     std::mutex save_wav_mutex_;
     std::string save_wav_dir_;
     std::atomic<bool> presence_enabled_{false};
+    // Queue depth per call: TTS audio buffered and not yet played out.
+    whispertalk::MetricsCollector metrics_collector_{[this](whispertalk::MetricsWriter& w) {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        w.gauge("whispertalk_oap_active_calls", "Calls with outbound audio state", {},
+                static_cast<double>(calls_.size()));
+        for (const auto& kv : calls_) {
+            size_t bytes;
+            {
+                std::lock_guard<std::mutex> sl(kv.second->mutex);
+                bytes = kv.second->buffer.size() - kv.second->read_pos;
+            }
+            w.gauge("whispertalk_oap_buffered_ms", "TTS audio buffered for playout (ms)",
+                    {{"call", std::to_string(kv.first)}}, static_cast<double>(bytes / 8));
+        }
+    }};
 };
 
 int main(int argc, char** argv) {
@@ -0,0 +1,207 @@
+// packet-pool.h — pooled, reference-counted frame buffers for the interconnect.
+//
+// The vector-backed Packet costs several heap allocations and copies per frame
+// per hop (serialize, framing, receive buffer, deserialize). PacketBuf is a
+// single allocation that holds the whole wire frame, so a PooledPacket can be
+// received, framed, encrypted and forwarded in place:
+//
+//   offset   0            8        12            24       32                    32+N
+//            |  (unused)  | len(4) | GCM IV (12) | hdr(8) | payload (N bytes)  | GCM tag (16) |
+//                                                          ^ data() + HEADROOM
+//
+//   • Plaintext frame on the wire: [len][hdr][payload] — contiguous from +20.
+//   • Encrypted frame on the wire: [len][iv][ct(hdr+payload)][tag] — contiguous
+//     from +8; hdr+payload are encrypted in place, no second buffer.
+//   • The payload always starts 32 bytes into the data area, so float PCM in
+//     the payload is 16-byte aligned.
+//
+// PacketPool keeps per-size-class intrusive free lists (power-of-two classes
+// from 256 B to 2 MiB, i.e. up to Packet::MAX_PAYLOAD_SIZE plus framing).
+// After warm-up, acquire()/release() never touch the heap. Each class keeps
+// at most MAX_FREE_BYTES_PER_CLASS of idle buffers; the excess is freed.
+//
+// Lifetime: the pool is itself reference-counted. The owner (InterconnectNode)
+// holds one reference and every outstanding buffer holds another, so buffers
+// handed to other threads may safely outlive the node that produced them.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace whispertalk {
+
+class PacketPool;
+
+class alignas(16) PacketBuf {
+public:
+    static constexpr size_t HEADROOM = 32;   // len(4) + IV(12) + hdr(8), rounded up for alignment
+    static constexpr size_t TAILROOM = 16;   // GCM tag
+
+    uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+    const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(this + 1); }
+    uint8_t* payload() { return data() + HEADROOM; }
+    const uint8_t* payload() const { return data() + HEADROOM; }
+
+    // Largest payload that fits in this buffer with head- and tailroom.
+    size_t payload_capacity() const { return class_bytes_ - HEADROOM - TAILROOM; }
+
+    uint32_t use_count() const { return refs_.load(std::memory_order_acquire); }
+
+    void retain() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    inline void release();
+
+private:
+    friend class PacketPool;
+    PacketBuf(PacketPool* pool, uint8_t cls, size_t class_bytes)
+        : pool_(pool), class_bytes_(class_bytes), cls_(cls) {}
+
+    std::atomic<uint32_t> refs_{1};
+    PacketPool* pool_;
+    PacketBuf* next_free_ = nullptr;
+    size_t class_bytes_;
+    uint8_t cls_;
+};
+
+// Intrusive smart pointer for PacketBuf (copy = retain, destroy = release).
+class PacketBufRef {
+public:
+    PacketBufRef() = default;
+    explicit PacketBufRef(PacketBuf* b) : buf_(b) {}   // adopts one reference
+    PacketBufRef(const PacketBufRef& o) : buf_(o.buf_) { if (buf_) buf_->retain(); }
+    PacketBufRef(PacketBufRef&& o) noexcept : buf_(o.buf_) { o.buf_ = nullptr; }
+    PacketBufRef& operator=(const PacketBufRef& o) {
+        if (this != &o) { PacketBufRef tmp(o); std::swap(buf_, tmp.buf_); }
+        return *this;
+    }
+    PacketBufRef& operator=(PacketBufRef&& o) noexcept {
+        if (this != &o) { reset(); buf_ = o.buf_; o.buf_ = nullptr; }
+        return *this;
+    }
+    ~PacketBufRef() { reset(); }
+
+    void reset() {
+        if (buf_) { buf_->release(); buf_ = nullptr; }
+    }
+
+    PacketBuf* get() const { return buf_; }
+    PacketBuf* operator->() const { return buf_; }
+    explicit operator bool() const { return buf_ != nullptr; }
+    bool unique() const { return buf_ && buf_->use_count() == 1; }
+
+private:
+    PacketBuf* buf_ = nullptr;
+};
+
+class PacketPool {
+public:
+    static constexpr size_t MIN_CLASS_BYTES = 256;
+    static constexpr int    NUM_CLASSES     = 14;                 // 256 B .. 2 MiB
+    static constexpr size_t MAX_FREE_BYTES_PER_CLASS = 4 * 1024 * 1024;
+
+    // Returns a pool holding one reference for the caller (drop with release()).
+    static PacketPool* create() { return new PacketPool(); }
+
+    void retain() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    // Buffer able to carry `payload_size` bytes plus framing; empty on overflow.
+    PacketBufRef acquire(size_t payload_size) {
+        int cls = class_for(PacketBuf::HEADROOM + payload_size + PacketBuf::TAILROOM);
+        if (cls < 0) return PacketBufRef();
+        FreeList& fl = free_[cls];
+        PacketBuf* b = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(fl.mutex);
+            if (fl.head) {
+                b = fl.head;
+                fl.head = b->next_free_;
+                fl.count--;
+            }
+        }
+        if (b) {
+            b->next_free_ = nullptr;
+            b->refs_.store(1, std::memory_order_relaxed);
+            reused_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            size_t bytes = class_bytes(cls);
+            void* mem = ::operator new(sizeof(PacketBuf) + bytes);
+            b = new (mem) PacketBuf(this, static_cast<uint8_t>(cls), bytes);
+            allocated_.fetch_add(1, std::memory_order_relaxed);
+        }
+        retain();
+        return PacketBufRef(b);
+    }
+
+    uint64_t buffers_allocated() const { return allocated_.load(std::memory_order_relaxed); }
+    uint64_t buffers_reused() const { return reused_.load(std::memory_order_relaxed); }
+
+private:
+    friend class PacketBuf;
+
+    struct FreeList {
+        std::mutex mutex;
+        PacketBuf* head = nullptr;
+        size_t count = 0;
+    };
+
+    PacketPool() = default;
+    ~PacketPool() {
+        for (auto& fl : free_) {
+            while (fl.head) {
+                PacketBuf* b = fl.head;
+                fl.head = b->next_free_;
+                destroy(b);
+            }
+        }
+    }
+
+    static size_t class_bytes(int cls) { return MIN_CLASS_BYTES << cls; }
+
+    static int class_for(size_t bytes) {
+        for (int c = 0; c < NUM_CLASSES; c++) {
+            if (bytes <= class_bytes(c)) return c;
+        }
+        return -1;
+    }
+
+    static void destroy(PacketBuf* b) {
+        b->~PacketBuf();
+        ::operator delete(static_cast<void*>(b));
+    }
+
+    void recycle(PacketBuf* b) {
+        FreeList& fl = free_[b->cls_];
+        size_t max_count = MAX_FREE_BYTES_PER_CLASS / b->class_bytes_;
+        if (max_count < 2) max_count = 2;
+        bool kept = false;
+        {
+            std::lock_guard<std::mutex> lock(fl.mutex);
+            if (fl.count < max_count) {
+                b->next_free_ = fl.head;
+                fl.head = b;
+                fl.count++;
+                kept = true;
+            }
+        }
+        if (!kept) destroy(b);
+        release();
+    }
+
+    std::atomic<uint32_t> refs_{1};
+    std::atomic<uint64_t> allocated_{0};
+    std::atomic<uint64_t> reused_{0};
+    FreeList free_[NUM_CLASSES];
+};
+
+inline void PacketBuf::release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) pool_->recycle(this);
+}
+
+}
@@ -0,0 +1,157 @@
+// pcm-wire.h — compact PCM encodings for the IAP → VAD → Whisper hops.
+//
+// The caller's audio is G.711 μ-law at 8 kHz. IAP used to send it to VAD as
+// 16 kHz float32 (8 bytes per source byte), and VAD forwarded whole speech
+// chunks to Whisper the same way (up to ~384 KB per 6 s chunk). The 16 kHz
+// stream is a pure function of the μ-law bytes — G.711 table lookup followed
+// by the IAP half-band upsampler — so these hops can carry the μ-law bytes
+// instead and the receiver rebuilds the exact same floats:
+//
+//   ULAW        IAP → VAD. One RTP payload per frame. The receiver keeps a
+//               UlawUpsampler16k per call, which owns the FIR history IAP
+//               kept per call and target before.
+//   ULAW_UP16K  VAD → Whisper. One speech chunk per frame:
+//
+//                 [lead u8][reserved u8 ×3][samples u32 BE]
+//                 [IAP_FIR_CENTER warm-up bytes][μ-law span]
+//
+//               The warm-up bytes are the μ-law samples in front of the span
+//               (0xFF — decoded +0.0, the upsampler's initial history — at
+//               call start). A fresh upsampler run over warm-up + span
+//               reproduces the FIR state, its first 2·IAP_FIR_CENTER outputs
+//               are dropped, then `lead` (1 if the chunk starts on an odd
+//               16 kHz sample) and the next `samples` floats are the chunk.
+//
+// Both are bit-exact with the float path: same table, same upsampler, same
+// operation order. A receiver offers them with
+// InterconnectNode::accept_payload_type() (typed links only); senders check
+// downstream_accepts() and fall back to PCM_F32. WHISPERTALK_IC_COMPACT_PCM=0
+// keeps the float path.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "interconnect.h"
+
+namespace whispertalk {
+
+inline bool ic_compact_pcm_default() {
+    static const bool enabled = []() {
+        const char* v = std::getenv("WHISPERTALK_IC_COMPACT_PCM");
+        return !(v && (std::strcmp(v, "0") == 0 || std::strcmp(v, "false") == 0));
+    }();
+    return enabled;
+}
+
+// μ-law bytes → 16 kHz float32, carrying the FIR history across calls.
+// Writes 2·n floats.
+class UlawUpsampler16k {
+public:
+    size_t push(const uint8_t* ulaw, size_t n, float* out) {
+        float decoded[IAP_ULAW_FRAME];
+        size_t written = 0;
+        while (n > 0) {
+            size_t len = n < (size_t)IAP_ULAW_FRAME ? n : (size_t)IAP_ULAW_FRAME;
+            ulaw_decode(ulaw, len, decoded);
+            written += iap_fir_upsample_frame(decoded, len, out + written, history_);
+            ulaw += len;
+            n -= len;
+        }
+        return written;
+    }
+
+    void reset() { std::memset(history_, 0, sizeof(history_)); }
+
+private:
+    float history_[IAP_FIR_CENTER] = {};
+};
+
+// μ-law bytes a ULAW_UP16K payload for 16 kHz samples [pos, pos + count)
+// carries: 8 kHz positions pos/2 − IAP_FIR_CENTER to (pos + count − 1)/2.
+inline size_t ulaw_up16k_source_bytes(uint64_t pos, size_t count) {
+    return static_cast<size_t>((pos + count - 1) / 2 - pos / 2) + IAP_FIR_CENTER + 1;
+}
+
+// Lays out that payload in `out`: the header, then the source bytes read
+// from `src` (the first at 8 kHz position pos/2 − IAP_FIR_CENTER).
+template <typename It>
+void write_ulaw_up16k(uint64_t pos, size_t count, It src, std::vector<uint8_t>& out) {
+    const size_t n = ulaw_up16k_source_bytes(pos, count);
+    out.resize(8 + n);
+    out[0] = static_cast<uint8_t>(pos & 1);
+    out[1] = out[2] = out[3] = 0;
+    uint32_t samples = static_cast<uint32_t>(count);
+    out[4] = static_cast<uint8_t>(samples >> 24);
+    out[5] = static_cast<uint8_t>(samples >> 16);
+    out[6] = static_cast<uint8_t>(samples >> 8);
+    out[7] = static_cast<uint8_t>(samples);
+    std::copy(src, src + static_cast<ptrdiff_t>(n), out.begin() + 8);
+}
+
+// The μ-law source of a 16 kHz stream that was rebuilt by UlawUpsampler16k,
+// kept so a slice of that stream can be re-encoded as ULAW_UP16K. Indices
+// are absolute 16 kHz stream positions; the caller trims what it no longer
+// needs.
+class UlawSource {
+public:
+    static constexpr size_t HEADER_BYTES = 8;
+    static constexpr uint8_t SILENCE = 0xFF;   // decodes to +0.0f
+
+    UlawSource() { reset(); }
+
+    void reset() {
+        bytes_.assign(IAP_FIR_CENTER, SILENCE);
+        origin_ = -IAP_FIR_CENTER;
+    }
+
+    void append(const uint8_t* ulaw, size_t n) { bytes_.insert(bytes_.end(), ulaw, ulaw + n); }
+
+    // Drops bytes no slice starting at or after 16 kHz position `pos` needs.
+    void trim_before(uint64_t pos) {
+        int64_t keep_from = static_cast<int64_t>(pos / 2) - IAP_FIR_CENTER;
+        while (origin_ < keep_from && !bytes_.empty()) {
+            bytes_.pop_front();
+            origin_++;
+        }
+    }
+
+    // Encodes 16 kHz samples [pos, pos + count) as a ULAW_UP16K payload into
+    // `out`. False if the source no longer (or never) covered them.
+    bool encode(uint64_t pos, size_t count, std::vector<uint8_t>& out) const {
+        if (count == 0) return false;
+        int64_t first = static_cast<int64_t>(pos / 2) - IAP_FIR_CENTER;
+        int64_t last = static_cast<int64_t>((pos + count - 1) / 2);
+        if (first < origin_ || last >= origin_ + static_cast<int64_t>(bytes_.size())) return false;
+        write_ulaw_up16k(pos, count, bytes_.begin() + (first - origin_), out);
+        return true;
+    }
+
+private:
+    std::deque<uint8_t> bytes_;
+    int64_t origin_ = 0;   // 8 kHz position of bytes_[0]
+};
+
+// Rebuilds the float chunk from a ULAW_UP16K payload. False if malformed.
+inline bool decode_ulaw_up16k(const uint8_t* in, size_t len, std::vector<float>& out) {
+    if (len < UlawSource::HEADER_BYTES + IAP_FIR_CENTER + 1) return false;
+    size_t lead = in[0];
+    size_t samples = (static_cast<size_t>(in[4]) << 24) | (static_cast<size_t>(in[5]) << 16) |
+                     (static_cast<size_t>(in[6]) << 8) | in[7];
+    size_t n = len - UlawSource::HEADER_BYTES;
+    size_t skip = 2 * IAP_FIR_CENTER + lead;
+    if (lead > 1 || samples == 0 || skip + samples > 2 * n) return false;
+    out.resize(2 * n);
+    UlawUpsampler16k up;
+    up.push(in + UlawSource::HEADER_BYTES, n, out.data());
+    out.erase(out.begin(), out.begin() + static_cast<ptrdiff_t>(skip));
+    out.resize(samples);
+    return true;
+}
+
+}
@@ -19,10 +19,16 @@
 //   Inbound (network → pipeline): Each active call has an rtp_thread that recvfrom()s
 //     RTP packets from the network and forwards them as Packet frames to the IAP
 //     via interconnect send_to_downstream(). Packet includes the full RTP header
-//     (12 bytes) — IAP strips it.
+//     (12 bytes) — IAP strips it. On the way each call's packets pass an
+//     adaptive jitter buffer (jitter-buffer.h) that reorders them by sequence
+//     number, plays them out on a clock set by the measured jitter and
+//     conceals missing ones, so IAP sees one gap-free PCMU stream per call.
 //   Outbound (pipeline → network): OAP connects to SIP_CLIENT's listen port (13100/13101)
 //     and pushes 160-byte G.711 frames. SIP_CLIENT wraps them in RTP headers
-//     (seq, ts, ssrc) and sendto() to the remote caller.
+//     (seq, ts, ssrc) and sendto() to the remote caller. Frames are taken a
+//     tick at a time (recv_batch_from_upstream) and the datagrams leave through
+//     a SendBatch (io-batch.h): one io_uring_enter() for all calls with
+//     WHISPERTALK_IO_URING=1, else sendmsg() per datagram.
 //
 // Session management:
 //   CallSession: tracks call_id, SIP Call-ID, remote IP/port, local RTP socket,
@@ -36,6 +42,10 @@
 //   GET_STATS                                   — JSON stats for all active calls.
 //   PING / STATUS                               — health check / status summary.
 //   SET_LOG_LEVEL:<LEVEL>                       — change log verbosity at runtime.
+//   HOP_LATENCY                                 — per-hop latency histograms (incl. mouth-to-ear).
+//   FLOW                                        — credit-window telemetry of the IAP link.
+//   METRICS / METRICS:JSON                      — metrics.h registry, Prometheus text / JSON
+//                                                 (incl. per-call jitter buffer delay and loss).
 //
 // RTP port allocation: starts at RTP_PORT_BASE (10000), increments by 2 per call.
 #include <iostream>
@@ -61,6 +71,8 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include "interconnect.h"
+#include "io-batch.h"
+#include "jitter-buffer.h"
 
 static std::string detect_local_ip(const std::string& target_ip) {
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
@@ -245,6 +257,8 @@ struct CallSession {
     std::atomic<uint64_t> rtp_tx_bytes{0};     // Total bytes sent
     std::atomic<uint64_t> rtp_fwd_count{0};    // Packets successfully forwarded to IAP
     std::atomic<uint64_t> rtp_discard_count{0}; // Packets discarded (IAP not connected)
+    std::mutex jb_mutex;                       // guards jb_stats
+    whispertalk::JitterBufferStats jb_stats;   // the RTP thread's jitter buffer, for METRICS
     std::chrono::steady_clock::time_point start_time;
     std::string caller_number;
 
@@ -825,74 +839,125 @@ private:
 
     // Receives RTP packets from the network and forwards them to IAP via interconnect.
     // Tracks packet counts: received, forwarded (sent to IAP), and discarded (IAP offline).
+    // Packets go through the call's RtpJitterBuffer (jitter-buffer.h): the
+    // thread sleeps in poll() until the next packet or the next playout time,
+    // and each frame that falls due (a packet, or a concealment frame for a
+    // missing one) is forwarded in sequence order. capture_us is the packet's
+    // arrival, so the buffering delay shows up in the mouth-to-ear hop.
     void rtp_receiver_loop(std::shared_ptr<CallSession> session) {
-        char buf[2048];
+        static constexpr size_t RTP_RECV_BUF_SIZE = 2048;
+        static constexpr int RTP_IDLE_POLL_MS = 100;
+        whispertalk::RtpJitterBuffer jb;
+        uint8_t buf[RTP_RECV_BUF_SIZE];
         struct sockaddr_in sender{};
         socklen_t slen = sizeof(sender);
-        struct timeval tv{0, 100000};
-        setsockopt(session->rtp_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
         while (session->active && running_) {
-            ssize_t n = recvfrom(session->rtp_sock, buf, sizeof(buf), 0, (struct sockaddr*)&sender, &slen);
-            if (n < 12) continue;
-
-            session->rtp_rx_count++;
-            session->rtp_rx_bytes += n;
+            int64_t now = static_cast<int64_t>(whispertalk::PacketTrace::now_us());
+            int timeout_ms = RTP_IDLE_POLL_MS;
+            if (jb.playing()) {
+                int64_t wait_ms = (jb.next_due_us() - now + 999) / 1000;
+                timeout_ms = static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(wait_ms, RTP_IDLE_POLL_MS)));
+            }
+            struct pollfd pfd{session->rtp_sock, POLLIN, 0};
+            if (poll(&pfd, 1, timeout_ms) > 0) {
+                ssize_t n;
+                while ((n = recvfrom(session->rtp_sock, buf, sizeof(buf), MSG_DONTWAIT,
+                                     (struct sockaddr*)&sender, &slen)) >= 0) {
+                    if (n < 12) continue;
+                    session->rtp_rx_count++;
+                    session->rtp_rx_bytes += n;
+                    jb.push(buf, static_cast<size_t>(n),
+                            static_cast<int64_t>(whispertalk::PacketTrace::now_us()));
+                }
+            }
 
-            whispertalk::Packet pkt(session->id, buf, n);
-            pkt.trace.record(whispertalk::ServiceType::SIP_CLIENT, 0);
-            pkt.trace.record(whispertalk::ServiceType::SIP_CLIENT, 1);
-            if (interconnect_.send_to_downstream(pkt)) {
-                session->rtp_fwd_count++;
-            } else {
-                session->rtp_discard_count++;
-                if (interconnect_.downstream_state() != whispertalk::ConnectionState::CONNECTED) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            now = static_cast<int64_t>(whispertalk::PacketTrace::now_us());
+            while (jb.ready(now)) {
+                auto pkt = interconnect_.make_packet(session->id, whispertalk::RtpJitterBuffer::MAX_PACKET);
+                if (!pkt.is_valid()) break;
+                auto frame = jb.pop(now, pkt.payload());
+                if (frame.bytes == 0) break;
+                pkt.resize(static_cast<uint32_t>(frame.bytes));
+                pkt.meta = whispertalk::FrameMeta(whispertalk::PayloadType::RTP, 8000,
+                                                  static_cast<uint64_t>(frame.arrival_us));
+                pkt.trace.record(whispertalk::ServiceType::SIP_CLIENT, 0);
+                pkt.trace.record(whispertalk::ServiceType::SIP_CLIENT, 1);
+                if (interconnect_.send_to_downstream(std::move(pkt))) {
+                    session->rtp_fwd_count++;
+                } else {
+                    session->rtp_discard_count++;
                 }
             }
+
+            std::lock_guard<std::mutex> lock(session->jb_mutex);
+            session->jb_stats = jb.stats();
         }
         close(session->rtp_sock);
     }
 
+    // OAP sends every call's frame for a tick together; they are taken off
+    // the link as one batch and the RTP datagrams leave as one SendBatch.
+    // The packets (whose headroom holds the RTP headers) live until flush().
     void outbound_audio_loop() {
+        static constexpr size_t OUT_BATCH_MAX = 256;
+        std::vector<whispertalk::PooledPacket> frames;
+        std::vector<std::shared_ptr<CallSession>> sent_by;
+        frames.reserve(OUT_BATCH_MAX);
+        sent_by.reserve(OUT_BATCH_MAX);
+        whispertalk::SendBatch rtp_out(OUT_BATCH_MAX);
         while (running_) {
-            whispertalk::Packet pkt;
-            if (!interconnect_.recv_from_upstream(pkt, 100)) {
+            frames.clear();
+            if (!interconnect_.recv_batch_from_upstream(frames, OUT_BATCH_MAX, 100)) {
                 continue;
             }
-
-            if (!pkt.is_valid() || pkt.payload_size != 160) {
-                continue;
-            }
-
-            std::shared_ptr<CallSession> session;
-            {
-                std::lock_guard<std::mutex> lock(calls_mutex_);
-                if (id_to_call_.count(pkt.call_id)) session = id_to_call_[pkt.call_id];
-            }
-
-            if (session && session->active) {
-                uint8_t rtp[12 + 160];
-                rtp[0] = 0x80; rtp[1] = 0x00;
-                uint16_t seq = htons(session->seq++);
-                memcpy(rtp + 2, &seq, 2);
-                uint32_t ts = htonl(session->ts); session->ts += 160;
-                memcpy(rtp + 4, &ts, 4);
-                uint32_t ssrc = htonl(session->ssrc);
-                memcpy(rtp + 8, &ssrc, 4);
-                memcpy(rtp + 12, pkt.payload.data(), 160);
-                struct sockaddr_in dest{};
-                dest.sin_family = AF_INET;
-                dest.sin_port = htons(session->remote_port);
-                dest.sin_addr.s_addr = inet_addr(session->remote_ip.c_str());
-                ssize_t sent = sendto(session->rtp_sock, rtp, sizeof(rtp), 0, (struct sockaddr*)&dest, sizeof(dest));
+            sent_by.clear();
+            for (auto& pkt : frames) queue_rtp_frame(pkt, rtp_out, sent_by);
+            rtp_out.flush();
+            for (size_t i = 0; i < sent_by.size(); i++) {
+                ssize_t sent = rtp_out.result(i);
                 if (sent > 0) {
-                    session->rtp_tx_count++;
-                    session->rtp_tx_bytes += sent;
+                    sent_by[i]->rtp_tx_count++;
+                    sent_by[i]->rtp_tx_bytes += sent;
                 }
             }
         }
     }
 
+    void queue_rtp_frame(whispertalk::PooledPacket& pkt, whispertalk::SendBatch& rtp_out,
+                         std::vector<std::shared_ptr<CallSession>>& sent_by) {
+        // Untyped links only ever carried 20 ms frames; a typed ULAW frame
+        // may be any length and sets the RTP timestamp step.
+        if (!pkt.is_valid() || pkt.payload_size == 0 ||
+            !whispertalk::payload_is(pkt.meta, whispertalk::PayloadType::ULAW, pkt.payload_size == 160)) {
+            return;
+        }
+        const uint32_t samples = pkt.payload_size;
+
+        std::shared_ptr<CallSession> session;
+        {
+            std::lock_guard<std::mutex> lock(calls_mutex_);
+            if (id_to_call_.count(pkt.call_id)) session = id_to_call_[pkt.call_id];
+        }
+        if (!session || !session->active) return;
+
+        // RTP header is built in the pooled buffer's headroom right in
+        // front of the μ-law payload, so the datagram needs no copy.
+        uint8_t* rtp = pkt.payload() - 12;
+        rtp[0] = 0x80; rtp[1] = 0x00;
+        uint16_t seq = htons(session->seq++);
+        memcpy(rtp + 2, &seq, 2);
+        uint32_t ts = htonl(session->ts); session->ts += samples;
+        memcpy(rtp + 4, &ts, 4);
+        uint32_t ssrc = htonl(session->ssrc);
+        memcpy(rtp + 8, &ssrc, 4);
+        struct sockaddr_in dest{};
+        dest.sin_family = AF_INET;
+        dest.sin_port = htons(session->remote_port);
+        dest.sin_addr.s_addr = inet_addr(session->remote_ip.c_str());
+        rtp_out.add(session->rtp_sock, rtp, 12 + samples, (struct sockaddr*)&dest, sizeof(dest));
+        sent_by.push_back(std::move(session));
+    }
+
     void register_sip(std::shared_ptr<SipLine> line, bool with_auth = false) {
         std::string reg_server = line->server_ip.empty() ? server_ : line->server_ip;
         std::string lip = line->local_ip.empty() ? local_ip_ : line->local_ip;
@@ -1017,6 +1082,18 @@ private:
         else if (msg == "PING") {
             return "PONG\n";
         }
+        else if (msg == "HOP_LATENCY") {
+            return interconnect_.hop_latency_report();
+        }
+        else if (msg == "FLOW") {
+            return interconnect_.flow_report();
+        }
+        else if (msg == "METRICS") {
+            return interconnect_.metrics_report();
+        }
+        else if (msg == "METRICS:JSON") {
+            return interconnect_.metrics_report(true);
+        }
         else if (msg == "STATUS") {
             std::lock_guard<std::mutex> lock(calls_mutex_);
             std::lock_guard<std::mutex> llock(lines_mutex_);
@@ -1041,6 +1118,28 @@ private:
     std::vector<std::shared_ptr<SipLine>> lines_;
     whispertalk::InterconnectNode interconnect_;
     whispertalk::LogForwarder log_fwd_;
+    whispertalk::MetricsCollector metrics_collector_{[this](whispertalk::MetricsWriter& w) {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        for (const auto& [id, session] : id_to_call_) {
+            whispertalk::JitterBufferStats st;
+            {
+                std::lock_guard<std::mutex> jlock(session->jb_mutex);
+                st = session->jb_stats;
+            }
+            whispertalk::MetricLabels labels{{"call", std::to_string(id)}};
+            w.gauge("whispertalk_sip_jitter_buffer_delay_ms", "Playout delay of the last played RTP packet",
+                    labels, st.delay_us / 1000.0);
+            w.gauge("whispertalk_sip_jitter_buffer_target_ms", "Jitter buffer target delay (3 x jitter, 10-200 ms)",
+                    labels, st.target_us / 1000.0);
+            w.gauge("whispertalk_sip_rtp_jitter_ms", "RFC 3550 interarrival jitter", labels, st.jitter_us / 1000.0);
+            w.gauge("whispertalk_sip_rtp_loss_ratio", "Share of played frames that were concealed",
+                    labels, st.loss_ratio());
+            w.counter("whispertalk_sip_plc_frames_total", "Frames synthesised for missing RTP packets",
+                      labels, static_cast<double>(st.concealed));
+            w.counter("whispertalk_sip_rtp_late_total", "RTP packets that arrived after their playout time",
+                      labels, static_cast<double>(st.late));
+        }
+    }};
 };
 
 int main(int argc, char** argv) {
@@ -0,0 +1,210 @@
+// speech-bus.h — host-local pub/sub channel for barge-in signals.
+//
+// SPEECH_ACTIVE/IDLE used to travel only over the mgmt channel, relayed hop
+// by hop (VAD → Whisper → LLaMA → TTS dock → engine, TTS → OAP): one reactor
+// wakeup, one GCM open and one GCM seal per hop before OAP flushed the audio
+// the caller was talking over. The speech bus is a UDP multicast group on the
+// loopback interface instead. The service that detects speech publishes one
+// datagram, and every node (and TTS engine) in the process tree receives it
+// straight from the kernel:
+//
+//   ["WTSB"][version u8][active u8][origin service u8][reserved u8]
+//   [call_id u32][ts_us u64]                                (big-endian)
+//
+// ts_us is the publisher's steady_clock time (PacketTrace::now_us(); shared
+// by every process on the host), so receivers can order signals per call and
+// measure delivery latency. With IC encryption on, the datagram is sealed
+// like an mgmt frame (IV + ciphertext + tag); datagrams that do not open or
+// parse are dropped.
+//
+// The bus is an accelerator, not a replacement: the mgmt relay still runs
+// and carries the same ts_us, and receivers drop whichever copy arrives
+// second. WHISPERTALK_SPEECH_BUS=0 (or "false") disables it;
+// WHISPERTALK_SPEECH_BUS=<group>:<port> moves it off the default group.
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "tls_cert.h"
+
+namespace whispertalk {
+
+static constexpr const char* SPEECH_BUS_GROUP = "239.255.77.1";
+static constexpr uint16_t SPEECH_BUS_PORT = 22023;
+
+struct SpeechSignal {
+    uint32_t call_id = 0;
+    bool active = false;
+    uint8_t origin = 0;       // ServiceType of the publisher
+    uint64_t ts_us = 0;       // publisher's steady_clock µs
+};
+
+// Fills `out` with the bus group address. False when the bus is disabled.
+inline bool speech_bus_endpoint(sockaddr_in& out) {
+    std::memset(&out, 0, sizeof(out));
+    out.sin_family = AF_INET;
+    out.sin_port = htons(SPEECH_BUS_PORT);
+    inet_pton(AF_INET, SPEECH_BUS_GROUP, &out.sin_addr);
+    const char* v = std::getenv("WHISPERTALK_SPEECH_BUS");
+    if (!v || !*v || std::strcmp(v, "1") == 0 || std::strcmp(v, "true") == 0) return true;
+    if (std::strcmp(v, "0") == 0 || std::strcmp(v, "false") == 0) return false;
+    std::string spec(v);
+    size_t colon = spec.rfind(':');
+    std::string host = colon == std::string::npos ? spec : spec.substr(0, colon);
+    if (colon != std::string::npos) {
+        int port = std::atoi(spec.c_str() + colon + 1);
+        if (port <= 0 || port > 65535) return false;
+        out.sin_port = htons(static_cast<uint16_t>(port));
+    }
+    if (!host.empty() && inet_pton(AF_INET, host.c_str(), &out.sin_addr) != 1) return false;
+    return IN_MULTICAST(ntohl(out.sin_addr.s_addr));
+}
+
+inline bool speech_bus_default() {
+    static const bool enabled = []() {
+        sockaddr_in addr;
+        return speech_bus_endpoint(addr);
+    }();
+    return enabled;
+}
+
+// One bus endpoint: a publisher, a subscriber, or both. publish() is safe to
+// call from any thread; receive() belongs to the thread that polls fd().
+class SpeechBus {
+public:
+    static constexpr size_t WIRE_BYTES = 20;
+    static constexpr uint8_t VERSION = 1;
+
+    SpeechBus() = default;
+    ~SpeechBus() { close(); }
+    SpeechBus(const SpeechBus&) = delete;
+    SpeechBus& operator=(const SpeechBus&) = delete;
+
+    bool open_publisher() {
+        if (pub_sock_ >= 0) return true;
+        if (!speech_bus_endpoint(group_)) return false;
+        int s = socket(AF_INET, SOCK_DGRAM, 0);
+        if (s < 0) return false;
+        in_addr lo;
+        lo.s_addr = htonl(INADDR_LOOPBACK);
+        unsigned char ttl = 0, loop = 1;   // never leaves the host
+        if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo)) < 0 ||
+            setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+            setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+            ::close(s);
+            return false;
+        }
+        pub_sock_ = s;
+        return true;
+    }
+
+    // Non-blocking socket joined to the group on the loopback interface.
+    bool open_subscriber() {
+        if (sub_sock_ >= 0) return true;
+        if (!speech_bus_endpoint(group_)) return false;
+        int s = socket(AF_INET, SOCK_DGRAM, 0);
+        if (s < 0) return false;
+        int one = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+        setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+        sockaddr_in bind_addr = group_;
+        ip_mreq mreq;
+        mreq.imr_multiaddr = group_.sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(s, reinterpret_cast<sockaddr*>(&bind_addr), sizeof(bind_addr)) < 0 ||
+            setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            ::close(s);
+            return false;
+        }
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+        sub_sock_ = s;
+        return true;
+    }
+
+    void close() {
+        if (pub_sock_ >= 0) { ::close(pub_sock_); pub_sock_ = -1; }
+        if (sub_sock_ >= 0) { ::close(sub_sock_); sub_sock_ = -1; }
+    }
+
+    int fd() const { return sub_sock_; }
+    bool can_publish() const { return pub_sock_ >= 0; }
+
+    bool publish(const SpeechSignal& sig) {
+        if (pub_sock_ < 0) return false;
+        uint8_t plain[WIRE_BYTES];
+        encode(sig, plain);
+        uint8_t sealed[prodigy_tls::IC_GCM_IV_LEN + WIRE_BYTES + prodigy_tls::IC_GCM_TAG_LEN];
+        const uint8_t* out = plain;
+        size_t len = WIRE_BYTES;
+        if (prodigy_tls::ic_encryption_enabled()) {
+            if (!prodigy_tls::ic_thread_cipher().seal(plain, WIRE_BYTES, sealed, len)) return false;
+            out = sealed;
+        }
+        return sendto(pub_sock_, out, len, 0, reinterpret_cast<const sockaddr*>(&group_),
+                      sizeof(group_)) == static_cast<ssize_t>(len);
+    }
+
+    // Next well-formed signal queued on the subscriber. False once the
+    // socket has nothing left (malformed datagrams are skipped).
+    bool receive(SpeechSignal& out) {
+        if (sub_sock_ < 0) return false;
+        uint8_t buf[128];
+        uint8_t plain[sizeof(buf)];
+        for (;;) {
+            ssize_t n = recv(sub_sock_, buf, sizeof(buf), 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            const uint8_t* p = buf;
+            size_t len = static_cast<size_t>(n);
+            if (prodigy_tls::ic_encryption_enabled()) {
+                if (!prodigy_tls::ic_thread_cipher().open(buf, len, plain, len)) continue;
+                p = plain;
+            }
+            if (decode(p, len, out)) return true;
+        }
+    }
+
+    static void encode(const SpeechSignal& sig, uint8_t* out) {
+        std::memcpy(out, "WTSB", 4);
+        out[4] = VERSION;
+        out[5] = sig.active ? 1 : 0;
+        out[6] = sig.origin;
+        out[7] = 0;
+        uint32_t cid = htonl(sig.call_id);
+        std::memcpy(out + 8, &cid, 4);
+        for (int i = 0; i < 8; i++) out[12 + i] = static_cast<uint8_t>(sig.ts_us >> (56 - 8 * i));
+    }
+
+    static bool decode(const uint8_t* in, size_t len, SpeechSignal& out) {
+        if (len < WIRE_BYTES || std::memcmp(in, "WTSB", 4) != 0 || in[4] != VERSION) return false;
+        uint32_t cid;
+        std::memcpy(&cid, in + 8, 4);
+        out.call_id = ntohl(cid);
+        out.active = in[5] != 0;
+        out.origin = in[6];
+        out.ts_us = 0;
+        for (int i = 0; i < 8; i++) out.ts_us = (out.ts_us << 8) | in[12 + i];
+        return out.call_id != 0 && out.origin != 0;
+    }
+
+private:
+    int pub_sock_ = -1;
+    int sub_sock_ = -1;
+    sockaddr_in group_{};
+};
+
+}
@@ -0,0 +1,212 @@
+// speech-partial.h — provisional speech chunks between VAD and Whisper.
+//
+// VAD ends an utterance only after vad_silence_frames_ of trailing silence
+// (700 ms), so Whisper used to start when the caller had already stopped
+// and that silence went straight into the response time. In partial mode
+// (vad-service --vad-partial-ms) VAD also sends the utterance so far,
+// [speech_start, pos), flagged FRAME_FLAG_PARTIAL: after every interval of
+// new speech, and once more as soon as a pause of PARTIAL_PAUSE_FRAMES
+// begins (PartialSchedule). The chunk that ends the utterance is sent as
+// before, unflagged; it is the final marker.
+//
+// Whisper transcribes each partial while the pause runs out and keeps the
+// latest result per call (SpeculativeTranscript). On the final it commits
+// that text if the final is the same audio followed by nothing but silence,
+// and otherwise discards it and transcribes the final as usual. All partials
+// of an utterance start at the same sample and ULAW_UP16K decodes bit for
+// bit, so "the same audio" is an exact prefix check.
+//
+// Partials go only to a peer that offered FRAME_FLAG_PARTIAL in the
+// typed-header handshake (InterconnectNode::accept_frame_flags); any other
+// receiver keeps getting the finals alone.
+//
+// Whisper also forwards what the partials agree on. Each partial re-decodes
+// the whole utterance so far, so the words at its end are still in flux; the
+// words two consecutive transcripts share from the start are taken as settled
+// (StablePrefix, "local agreement"). Whenever that prefix grows it goes to
+// LLaMA as a TEXT_PARTIAL frame, if LLaMA offered the type, and LLaMA starts
+// the RAG lookup and the prompt prefill on it. The TEXT final still carries
+// the whole utterance; LLaMA uses its early work only if the final begins
+// with the prefix (transcript_prefix_words).
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace whispertalk {
+
+// Silent frames (50 ms) after speech at which the utterance so far goes out:
+// 200 ms, well inside German comma pauses, so the last partial usually
+// precedes the final by the rest of the silence window.
+constexpr int PARTIAL_PAUSE_FRAMES = 4;
+
+// VAD side, per call: when the utterance so far is due as a partial.
+// Positions are absolute stream positions.
+class PartialSchedule {
+public:
+    // An utterance (or its continuation after a max-length split) starts at
+    // `start`; nothing of it has been sent.
+    void restart(uint64_t start) {
+        sent_to_ = start;
+        voiced_to_ = start;
+    }
+
+    // Called for each frame in speech, `end` being the position after it.
+    // Due after `interval` samples since the last partial, or once the
+    // silence run reaches pause_frames — in both cases only if there has
+    // been speech since the last partial. interval 0 disables partials.
+    bool due(uint64_t end, bool speech_frame, int silence_count, size_t interval, int pause_frames) {
+        if (speech_frame) voiced_to_ = end;
+        if (interval == 0 || voiced_to_ <= sent_to_) return false;
+        return end - sent_to_ >= interval || silence_count == pause_frames;
+    }
+
+    void sent(uint64_t end) { sent_to_ = end; }
+
+private:
+    uint64_t sent_to_ = 0;
+    uint64_t voiced_to_ = 0;
+};
+
+// Whisper side, per call: the transcript of the latest partial.
+class SpeculativeTranscript {
+public:
+    bool held() const { return samples_ != 0; }
+    size_t samples() const { return samples_; }
+
+    // Keeps `text` as the transcript of audio[0, n); "" if it yielded
+    // nothing to send.
+    void hold(const float* audio, size_t n, std::string text) {
+        samples_ = n;
+        fingerprint_ = fingerprint(audio, n);
+        text_ = std::move(text);
+    }
+
+    // For the final chunk audio[0, n): true, with the held text in `text`, if
+    // it starts with the held audio and the rest has an RMS below
+    // silence_rms. Drops what it held either way.
+    bool commit(const float* audio, size_t n, float silence_rms, std::string& text) {
+        const size_t held_n = samples_;
+        samples_ = 0;
+        if (held_n == 0 || n < held_n || fingerprint(audio, held_n) != fingerprint_) return false;
+        if (n > held_n) {
+            double sum_sq = 0.0;
+            for (size_t i = held_n; i < n; i++) sum_sq += static_cast<double>(audio[i]) * audio[i];
+            if (std::sqrt(sum_sq / static_cast<double>(n - held_n)) >= silence_rms) return false;
+        }
+        text = std::move(text_);
+        return true;
+    }
+
+    void clear() { samples_ = 0; }
+
+private:
+    // 64-bit FNV-1a over the samples' bit patterns, a word at a time.
+    static uint64_t fingerprint(const float* audio, size_t n) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t w;
+            std::memcpy(&w, &audio[i], sizeof(w));
+            h = (h ^ w) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    size_t samples_ = 0;
+    uint64_t fingerprint_ = 0;
+    std::string text_;
+};
+
+// Words of a transcript, split at spaces.
+inline std::vector<std::string> transcript_words(const std::string& text) {
+    std::vector<std::string> words;
+    size_t i = 0;
+    while (i < text.size()) {
+        while (i < text.size() && text[i] == ' ') i++;
+        size_t start = i;
+        while (i < text.size() && text[i] != ' ') i++;
+        if (i > start) words.push_back(text.substr(start, i - start));
+    }
+    return words;
+}
+
+inline bool transcript_punct(char c) {
+    return c == '.' || c == ',' || c == '!' || c == '?' || c == ';' || c == ':';
+}
+
+// A word as transcripts are compared: trailing punctuation dropped and ASCII
+// case folded, since Whisper re-punctuates the end of a growing utterance.
+inline std::string transcript_word_key(const std::string& word) {
+    size_t n = word.size();
+    while (n > 0 && transcript_punct(word[n - 1])) n--;
+    std::string key = word.substr(0, n);
+    for (char& c : key) {
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+    }
+    return key;
+}
+
+// Number of words in `prefix` if `text` starts with them, else 0.
+inline size_t transcript_prefix_words(const std::string& prefix, const std::string& text) {
+    const auto p = transcript_words(prefix);
+    const auto t = transcript_words(text);
+    if (p.size() > t.size()) return 0;
+    for (size_t i = 0; i < p.size(); i++) {
+        if (transcript_word_key(p[i]) != transcript_word_key(t[i])) return 0;
+    }
+    return p.size();
+}
+
+// Whisper side, per call: the settled start of the utterance being spoken.
+// Fed the transcript of every partial, it holds the longest run of leading
+// words the last two agree on. The prefix only grows within an utterance: a
+// transcript that revises settled words holds it back until two transcripts
+// agree past it again.
+class StablePrefix {
+public:
+    // True if `transcript` made the prefix grow; text() then holds it.
+    bool update(const std::string& transcript) {
+        const auto words = transcript_words(transcript);
+        size_t agree = 0;
+        while (agree < words.size() && agree < last_.size() &&
+               transcript_word_key(words[agree]) == last_[agree]) {
+            agree++;
+        }
+        last_.clear();
+        for (const auto& w : words) last_.push_back(transcript_word_key(w));
+        if (agree <= settled_.size()) return false;
+        for (size_t i = 0; i < settled_.size(); i++) {
+            if (last_[i] != settled_[i]) return false;
+        }
+        settled_.assign(last_.begin(), last_.begin() + agree);
+        text_.clear();
+        for (size_t i = 0; i < agree; i++) {
+            if (i) text_ += ' ';
+            text_ += words[i];
+        }
+        while (!text_.empty() && transcript_punct(text_.back())) text_.pop_back();
+        return true;
+    }
+
+    const std::string& text() const { return text_; }
+    size_t words() const { return settled_.size(); }
+
+    // Next utterance.
+    void reset() {
+        last_.clear();
+        settled_.clear();
+        text_.clear();
+    }
+
+private:
+    std::vector<std::string> last_;      // previous transcript, as keys
+    std::vector<std::string> settled_;   // prefix, as keys
+    std::string text_;
+};
+
+}
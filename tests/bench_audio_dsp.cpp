@@ -0,0 +1,233 @@
+// bench_audio_dsp — per-frame cost of the IAP decode and upsampling kernels.
+//
+//   bench_audio_dsp [frames]
+//
+// Times ulaw_decode, the 8 → 16 kHz and 8 → 24 kHz upsamplers and a whole
+// IAP frame (decode + 16 kHz) on 160-byte μ-law frames, for every kernel set
+// of audio-dsp.h this CPU runs. "direct" is the textbook form for
+// comparison: zero-stuff to 16 kHz, then the full 15-tap FIR on every output
+// sample. Each result is the best of 5 runs, in ns per frame, with the
+// speed-up over scalar.
+//
+// The second table is IAP's per-call state at 10, 50 and 200 calls, one frame
+// per call per tick, decode + 16 kHz with the selected kernels: "map" is the
+// previous layout (mutex, std::map of calls, std::map of targets per frame),
+// "arena" the batched pass over IapCallArena (iap-arena.h).
+//
+// The third is VAD frame energy over 200 calls' worth of buffered audio, one
+// 50 ms frame per call in turn: "deque" is the previous std::deque<float>
+// element loop, "ring" sum_squares over a MirroredRing span (audio-ring.h).
+//
+// Built with -DBUILD_BENCHMARKS=ON; not part of ctest.
+
+#include "audio-dsp.h"
+#include "iap-arena.h"
+#include "audio-ring.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace whispertalk;
+
+namespace {
+
+constexpr size_t FRAME = IAP_ULAW_FRAME;
+
+volatile float g_sink;
+
+template <typename Fn>
+double best_ns_per_frame(int frames, Fn&& fn) {
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) fn(f);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        if (ns / frames < best) best = ns / frames;
+    }
+    return best;
+}
+
+// Zero-stuffed 2× input through all 15 taps, as a reference point.
+void direct_upsample_16k(const float* in, size_t n, float* out, float* stuffed_history) {
+    const float* h = iap_fir_coeffs();
+    float z[IAP_FIR_LEN - 1 + 2 * FRAME];
+    for (int i = 0; i < IAP_FIR_LEN - 1; i++) z[i] = stuffed_history[i];
+    for (size_t i = 0; i < n; i++) {
+        z[IAP_FIR_LEN - 1 + 2 * i] = in[i];
+        z[IAP_FIR_LEN - 1 + 2 * i + 1] = 0.0f;
+    }
+    for (size_t j = 0; j < 2 * n; j++) {
+        float acc = 0.0f;
+        for (int k = 0; k < IAP_FIR_LEN; k++) acc += h[k] * z[j + IAP_FIR_LEN - 1 - k];
+        out[j] = acc;
+    }
+    for (int i = 0; i < IAP_FIR_LEN - 1; i++) stuffed_history[i] = z[2 * n + i];
+}
+
+struct MapTargetState {
+    float fir_history_16k[IAP_FIR_CENTER] = {};
+};
+
+struct MapCallState {
+    float decoded[FRAME];
+    std::map<int, MapTargetState> downstream_state;
+};
+
+void bench_call_state(const std::vector<uint8_t>& ulaw, int frames) {
+    const DspKernels& k = dsp_kernels();
+    std::printf("\n%-8s %14s %14s\n", "calls", "map", "arena");
+    for (int calls : {10, 50, 200}) {
+        std::vector<uint32_t> ids(calls);
+        uint32_t x = 99;
+        for (auto& id : ids) {
+            x = x * 1103515245u + 12345u;
+            id = x;
+        }
+        const int ticks = frames / calls > 0 ? frames / calls : 1;
+        float out[2 * FRAME];
+
+        std::mutex mu;
+        std::map<uint32_t, std::shared_ptr<MapCallState>> map_calls;
+        double map_ns = best_ns_per_frame(ticks, [&](int t) {
+            for (int c = 0; c < calls; c++) {
+                std::shared_ptr<MapCallState> st;
+                {
+                    std::lock_guard<std::mutex> lock(mu);
+                    auto& slot = map_calls[ids[c]];
+                    if (!slot) slot = std::make_shared<MapCallState>();
+                    st = slot;
+                }
+                k.ulaw_decode(ulaw.data() + ((t + c) % 64) * FRAME, FRAME, st->decoded);
+                iap_fir_upsample_frame(st->decoded, FRAME, out, st->downstream_state[0].fir_history_16k, k);
+                g_sink = out[0];
+            }
+        }) / calls;
+
+        IapCallArena arena(1);
+        std::vector<uint32_t> slots(calls);
+        std::vector<float> decoded(static_cast<size_t>(calls) * FRAME);
+        double arena_ns = best_ns_per_frame(ticks, [&](int t) {
+            std::lock_guard<std::mutex> lock(mu);
+            for (int c = 0; c < calls; c++) slots[c] = arena.acquire(ids[c], t);
+            for (int c = 0; c < calls; c++) {
+                k.ulaw_decode(ulaw.data() + ((t + c) % 64) * FRAME, FRAME, &decoded[c * FRAME]);
+            }
+            for (int c = 0; c < calls; c++) {
+                iap_fir_upsample_frame(&decoded[c * FRAME], FRAME, out, arena.hist16(0, slots[c]), k);
+                g_sink = out[0];
+            }
+        }) / calls;
+
+        std::printf("%-8d %9.1f ns/f %9.1f ns/f\n", calls, map_ns, arena_ns);
+    }
+}
+
+void bench_vad_energy(int frames) {
+    constexpr int CALLS = 200;
+    constexpr size_t VAD_FRAME = 800;
+    constexpr size_t SECONDS = 4;
+    std::vector<float> pcm(16000 * SECONDS);
+    uint32_t x = 7;
+    for (auto& v : pcm) {
+        x = x * 1103515245u + 12345u;
+        v = static_cast<float>(static_cast<int32_t>(x >> 8) - (1 << 23)) / (1 << 23);
+    }
+    const size_t per_call = pcm.size() / VAD_FRAME;
+
+    std::vector<std::deque<float>> deques(CALLS, std::deque<float>(pcm.begin(), pcm.end()));
+    double deque_ns = best_ns_per_frame(frames, [&](int f) {
+        const std::deque<float>& d = deques[f % CALLS];
+        size_t pos = (f / CALLS % per_call) * VAD_FRAME;
+        float e = 0;
+        for (size_t i = 0; i < VAD_FRAME; i++) {
+            float v = d[pos + i];
+            e += v * v;
+        }
+        g_sink = e;
+    });
+
+    std::vector<std::unique_ptr<MirroredRing<float>>> rings;
+    for (int c = 0; c < CALLS; c++) {
+        rings.push_back(std::make_unique<MirroredRing<float>>(size_t(1) << 16));
+        rings.back()->push(pcm.data(), pcm.size());
+    }
+    std::printf("\n%-8s %14s %14s   (VAD frame energy, %d calls)\n", "kernels", "deque", "ring", CALLS);
+    for (DspIsa isa : {DspIsa::SCALAR, DspIsa::SSE2, DspIsa::AVX2, DspIsa::NEON}) {
+        const DspKernels* k = dsp_kernels_for(isa);
+        if (!k) continue;
+        double ring_ns = best_ns_per_frame(frames, [&](int f) {
+            size_t pos = (f / CALLS % per_call) * VAD_FRAME;
+            g_sink = k->sum_squares(rings[f % CALLS]->span(pos), VAD_FRAME);
+        });
+        std::printf("%-8s %9.1f ns/f %9.1f ns/f\n", dsp_isa_name(isa), deque_ns, ring_ns);
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? std::atoi(argv[1]) : 200000;
+
+    // 64 frames of noise, cycled, so the input stays in L1 like a hot call.
+    std::vector<uint8_t> ulaw(64 * FRAME);
+    uint32_t x = 1;
+    for (auto& b : ulaw) {
+        x = x * 1103515245u + 12345u;
+        b = static_cast<uint8_t>(x >> 16);
+    }
+    std::vector<float> pcm(ulaw.size());
+    dsp_kernels_for(DspIsa::SCALAR)->ulaw_decode(ulaw.data(), ulaw.size(), pcm.data());
+
+    float out[3 * FRAME];
+    float decoded[FRAME];
+    float h16[IAP_FIR_CENTER] = {}, h24[IAP_FIR_24K_CENTER] = {}, hz[IAP_FIR_LEN - 1] = {};
+
+    std::printf("selected: %s (WHISPERTALK_DSP_ISA overrides)\n\n", dsp_isa_name(dsp_kernels().isa));
+    std::printf("%-8s %12s %12s %12s %12s\n", "kernels", "decode", "up16k", "up24k", "iap frame");
+
+    double direct = best_ns_per_frame(frames, [&](int f) {
+        direct_upsample_16k(pcm.data() + (f % 64) * FRAME, FRAME, out, hz);
+        g_sink = out[0];
+    });
+    std::printf("%-8s %12s %9.1f ns %12s %12s\n", "direct", "-", direct, "-", "-");
+
+    double base[4] = {0, 0, 0, 0};
+    for (DspIsa isa : {DspIsa::SCALAR, DspIsa::SSE2, DspIsa::AVX2, DspIsa::NEON}) {
+        const DspKernels* k = dsp_kernels_for(isa);
+        if (!k) continue;
+        double r[4];
+        r[0] = best_ns_per_frame(frames, [&](int f) {
+            k->ulaw_decode(ulaw.data() + (f % 64) * FRAME, FRAME, out);
+            g_sink = out[0];
+        });
+        r[1] = best_ns_per_frame(frames, [&](int f) {
+            iap_fir_upsample_frame(pcm.data() + (f % 64) * FRAME, FRAME, out, h16, *k);
+            g_sink = out[0];
+        });
+        r[2] = best_ns_per_frame(frames, [&](int f) {
+            iap_fir_upsample_frame_24k(pcm.data() + (f % 64) * FRAME, FRAME, out, h24, *k);
+            g_sink = out[0];
+        });
+        r[3] = best_ns_per_frame(frames, [&](int f) {
+            k->ulaw_decode(ulaw.data() + (f % 64) * FRAME, FRAME, decoded);
+            iap_fir_upsample_frame(decoded, FRAME, out, h16, *k);
+            g_sink = out[0];
+        });
+        if (isa == DspIsa::SCALAR) {
+            for (int i = 0; i < 4; i++) base[i] = r[i];
+        }
+        std::printf("%-8s", dsp_isa_name(isa));
+        for (int i = 0; i < 4; i++) std::printf(" %7.1f ns %3.1fx", r[i], base[i] / r[i]);
+        std::printf("\n");
+    }
+
+    bench_call_state(ulaw, frames);
+    bench_vad_energy(frames);
+    return 0;
+}
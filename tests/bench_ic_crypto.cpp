@@ -0,0 +1,141 @@
+// bench_ic_crypto — throughput of the interconnect encryption modes.
+//
+//   bench_ic_crypto [packets] [payload_bytes]
+//
+// Part 1 seals and opens frames in memory: a fresh EVP context per frame
+// (how ic_encrypt/ic_decrypt used to work) against the long-lived
+// per-thread IcCipher. Part 2 pushes packets through a real SIP → IAP hop
+// in three modes: plaintext, userspace AES-256-GCM and kernel TLS (only when
+// the kernel has the tls module; reported as unavailable otherwise). CPU is
+// process user+sys time per packet, which covers both ends of the hop.
+//
+// Built with -DBUILD_BENCHMARKS=ON; not part of ctest.
+
+#include "interconnect.h"
+
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace whispertalk;
+
+namespace {
+
+double now_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double cpu_s() {
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// The pre-IcCipher frame encryption: context allocation and key schedule
+// on every call.
+bool seal_per_frame_ctx(const uint8_t* plain, size_t len, uint8_t* out) {
+    const std::string& key = prodigy_tls::get_interconnect_key();
+    uint8_t iv[prodigy_tls::IC_GCM_IV_LEN];
+    if (RAND_bytes(iv, sizeof(iv)) != 1) return false;
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    int n = 0;
+    bool ok = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr,
+                                 reinterpret_cast<const unsigned char*>(key.data()), iv) == 1 &&
+              EVP_EncryptUpdate(ctx, out + sizeof(iv), &n, plain, static_cast<int>(len)) == 1 &&
+              EVP_EncryptFinal_ex(ctx, out + sizeof(iv) + len, &n) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, prodigy_tls::IC_GCM_TAG_LEN,
+                                  out + sizeof(iv) + len) == 1;
+    memcpy(out, iv, sizeof(iv));
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+void bench_cipher(int frames, size_t len) {
+    std::vector<uint8_t> plain(len, 0x5A);
+    std::vector<uint8_t> sealed(prodigy_tls::ic_encrypted_size(len));
+    std::vector<uint8_t> opened(len);
+    prodigy_tls::IcCipher cipher;
+
+    double t0 = now_s();
+    for (int i = 0; i < frames; i++) seal_per_frame_ctx(plain.data(), len, sealed.data());
+    double per_frame = now_s() - t0;
+
+    size_t sealed_len = 0, plain_len = 0;
+    t0 = now_s();
+    for (int i = 0; i < frames; i++) cipher.seal(plain.data(), len, sealed.data(), sealed_len);
+    double reused = now_s() - t0;
+
+    t0 = now_s();
+    for (int i = 0; i < frames; i++) cipher.open(sealed.data(), sealed_len, opened.data(), plain_len);
+    double open_s = now_s() - t0;
+
+    auto mbps = [&](double s) { return frames * len / s / 1e6; };
+    std::printf("cipher  %6zu B  per-frame ctx seal %8.1f MB/s | IcCipher seal %8.1f MB/s"
+                " (%.1fx) | IcCipher open %8.1f MB/s\n",
+                len, mbps(per_frame), mbps(reused), per_frame / reused, mbps(open_s));
+}
+
+enum class Mode { PLAIN, AES_GCM, KTLS };
+
+void bench_hop(Mode mode, int packets, size_t len) {
+    const char* name = mode == Mode::PLAIN ? "plaintext" : mode == Mode::AES_GCM ? "aes-gcm" : "ktls";
+    prodigy_tls::g_ic_encryption_enabled.store(mode == Mode::PLAIN ? 0 : 1);
+
+    InterconnectNode up(ServiceType::SIP_CLIENT);
+    up.set_shm_transport(false);
+    up.set_ktls_transport(mode == Mode::KTLS);
+    InterconnectNode down(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    if (!up.initialize() || !down.initialize()) {
+        std::printf("hop     %-9s  init failed\n", name);
+        return;
+    }
+    for (int i = 0; i < 50; i++) {
+        if (up.downstream_state() == ConnectionState::CONNECTED &&
+            down.upstream_state() == ConnectionState::CONNECTED) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (mode == Mode::KTLS && !up.downstream_ktls_active()) {
+        std::printf("hop     %-9s  unavailable (no kernel tls support)\n", name);
+        down.shutdown();
+        up.shutdown();
+        return;
+    }
+
+    int received = 0;
+    std::thread rx([&]() {
+        PooledPacket pkt;
+        while (received < packets && down.recv_from_upstream(pkt, 2000)) received++;
+    });
+    double t0 = now_s(), c0 = cpu_s();
+    for (int i = 0; i < packets; i++) {
+        auto pkt = up.make_packet(1 + (i % 8), len);
+        memset(pkt.payload(), static_cast<uint8_t>(i), len);
+        if (!up.send_to_downstream(std::move(pkt))) break;
+    }
+    rx.join();
+    double wall = now_s() - t0, cpu = cpu_s() - c0;
+    std::printf("hop     %-9s  %6zu B  %9.0f pkt/s  %7.1f MB/s  %6.2f us CPU/pkt  (%d/%d)\n",
+                name, len, received / wall, received * len / wall / 1e6,
+                received ? cpu / received * 1e6 : 0.0, received, packets);
+    down.shutdown();
+    up.shutdown();
+}
+
+}
+
+int main(int argc, char** argv) {
+    int packets = argc > 1 ? std::atoi(argv[1]) : 200000;
+    size_t len = argc > 2 ? static_cast<size_t>(std::atol(argv[2])) : 0;
+    prodigy_tls::ic_encryption_enabled();   // run the flag's call_once before overriding it
+
+    std::vector<size_t> sizes = len ? std::vector<size_t>{len} : std::vector<size_t>{172, 1280, 8192};
+    for (size_t s : sizes) bench_cipher(packets, s);
+    for (size_t s : sizes) {
+        for (Mode m : {Mode::PLAIN, Mode::AES_GCM, Mode::KTLS}) bench_hop(m, packets, s);
+    }
+    return 0;
+}
@@ -0,0 +1,447 @@
+// bench_interconnect — throughput and one-way latency of an interconnect hop.
+//
+//   bench_interconnect [--json FILE] [--label NAME] [--fork] [--quick]
+//                      [--transport tcp|shm|unix|seqpacket]
+//                      [--payload NAME[,NAME...]] [--calls N[,N...]]
+//
+// Each case connects a sending and a receiving InterconnectNode on the
+// pipeline hop that carries its payload:
+//
+//   ulaw160    160 B μ-law frame          SIP → IAP
+//   pcm1280    1280 B float32 (20 ms)     IAP → VAD
+//   chunk384k  384000 B float32 (6 s)     VAD → Whisper
+//   text       96 B transcription         Whisper → LLaMA
+//
+// Every payload runs with IC encryption off and on, spread over 1, 16 and
+// 256 call_ids (--calls overrides). A case has two phases:
+//
+//   throughput  the sender writes packets round-robin across the calls as
+//               fast as it can; packets/s and bytes/s are measured from the
+//               first send to the receiver taking the last packet.
+//   latency     the sender writes one packet per call (a tick) and waits
+//               until the receiver has all of them before the next tick.
+//               One-way latency is taken from a steady_clock stamp in the
+//               first 8 payload bytes; p50/p99/p999 are exact (sorted).
+//
+// The receiving node runs on a thread, or with --fork in a child process
+// (steady_clock is CLOCK_MONOTONIC, shared by both). The two sides
+// synchronise over pipes in both modes.
+//
+// Results go to stdout as a table and to FILE (default
+// bench_interconnect.json) as JSON. The file carries the label, the git
+// revision the benchmark was built from, host and kernel, so runs from
+// different releases can be compared.
+//
+// Built with -DBUILD_BENCHMARKS=ON; not part of ctest.
+
+#include "interconnect.h"
+
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <csignal>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef BENCH_GIT_REV
+#define BENCH_GIT_REV "unknown"
+#endif
+
+using namespace whispertalk;
+
+namespace {
+
+constexpr size_t PHASE_BYTES = 256u * 1024 * 1024;   // budget per phase at full scale
+constexpr int RECV_TIMEOUT_MS = 5000;
+
+uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+struct Payload {
+    const char* name;
+    size_t bytes;
+    PayloadType type;
+    uint32_t sample_rate;
+    ServiceType from;
+    ServiceType to;
+};
+
+const Payload PAYLOADS[] = {
+    {"ulaw160",   160,    PayloadType::ULAW,    8000,  ServiceType::SIP_CLIENT,              ServiceType::INBOUND_AUDIO_PROCESSOR},
+    {"pcm1280",   1280,   PayloadType::PCM_F32, 16000, ServiceType::INBOUND_AUDIO_PROCESSOR, ServiceType::VAD_SERVICE},
+    {"chunk384k", 384000, PayloadType::PCM_F32, 16000, ServiceType::VAD_SERVICE,             ServiceType::WHISPER_SERVICE},
+    {"text",      96,     PayloadType::TEXT,    0,     ServiceType::WHISPER_SERVICE,         ServiceType::LLAMA_SERVICE},
+};
+
+enum class Transport { TCP, SHM, UNIX, SEQPACKET };
+
+struct Options {
+    std::string json_path = "bench_interconnect.json";
+    std::string label;
+    bool fork = false;
+    double scale = 1.0;
+    Transport transport = Transport::TCP;
+    std::vector<const Payload*> payloads;
+    std::vector<int> calls = {1, 16, 256};
+};
+
+struct Case {
+    const Payload* payload;
+    bool encrypted;
+    int calls;
+    size_t tput_packets;
+    int ticks;
+};
+
+struct Result {
+    Case c;
+    std::string transport;   // what the link actually used
+    bool ok = false;
+    uint64_t tput_received = 0;
+    double tput_seconds = 0;
+    uint64_t lat_expected = 0;
+    std::vector<uint64_t> lat_ns;
+};
+
+Case make_case(const Payload* p, bool encrypted, int calls, double scale) {
+    Case c{p, encrypted, calls, 0, 0};
+    size_t budget = static_cast<size_t>(PHASE_BYTES * scale);
+    c.tput_packets = std::clamp<size_t>(budget / p->bytes, static_cast<size_t>(calls) * 4,
+                                        static_cast<size_t>(200000 * scale));
+    size_t ticks = std::max<size_t>(static_cast<size_t>(20000 * scale) / calls, 1);
+    ticks = std::min(ticks, std::max<size_t>(budget / (p->bytes * calls), 5));
+    c.ticks = static_cast<int>(std::max<size_t>(ticks, 5));
+    return c;
+}
+
+bool read_all(int fd, void* buf, size_t len) {
+    auto* p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = ::read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool write_all(int fd, const void* buf, size_t len) {
+    auto* p = static_cast<const uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Receiving side. `to_sender` carries, in order: a ready byte, the
+// throughput phase's [count u64][last receive ns u64], one byte per latency
+// tick, then [count u64] and the latency samples.
+void run_receiver(const Case& c, int to_sender) {
+    InterconnectNode node(c.payload->to);
+    node.disable_downstream_connect();
+    uint8_t ready = node.initialize() ? 1 : 0;
+    for (int i = 0; ready && i < 100 && node.upstream_state() != ConnectionState::CONNECTED; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    if (node.upstream_state() != ConnectionState::CONNECTED) ready = 0;
+    write_all(to_sender, &ready, 1);
+    if (!ready) {
+        node.shutdown();
+        return;
+    }
+
+    PooledPacket pkt;
+    uint64_t got = 0, last_ns = 0;
+    while (got < c.tput_packets && node.recv_from_upstream(pkt, RECV_TIMEOUT_MS)) {
+        got++;
+        last_ns = now_ns();
+    }
+    uint64_t tput[2] = {got, last_ns};
+    write_all(to_sender, tput, sizeof(tput));
+
+    std::vector<uint64_t> lat;
+    lat.reserve(static_cast<size_t>(c.ticks) * c.calls);
+    for (int t = 0; t < c.ticks; t++) {
+        int n = 0;
+        while (n < c.calls && node.recv_from_upstream(pkt, RECV_TIMEOUT_MS)) {
+            uint64_t stamp;
+            memcpy(&stamp, pkt.payload(), sizeof(stamp));
+            lat.push_back(now_ns() - stamp);
+            n++;
+        }
+        uint8_t ack = n == c.calls ? 1 : 0;
+        write_all(to_sender, &ack, 1);
+        if (!ack) break;
+    }
+    uint64_t count = lat.size();
+    write_all(to_sender, &count, sizeof(count));
+    write_all(to_sender, lat.data(), lat.size() * sizeof(uint64_t));
+    node.shutdown();
+}
+
+const char* link_transport(InterconnectNode& node) {
+    if (node.downstream_shm_active()) return "shm";
+    return ic_unix_mode_name(node.downstream_transport());
+}
+
+void fill(const Case& c, PooledPacket& pkt, uint64_t i) {
+    uint8_t* d = pkt.payload();
+    if (c.payload->type == PayloadType::TEXT) {
+        static const char TEXT[] = "hello, I would like to move my appointment on friday to next week please ";
+        for (size_t k = 0; k < c.payload->bytes; k++) d[k] = static_cast<uint8_t>(TEXT[k % (sizeof(TEXT) - 1)]);
+    } else {
+        memset(d, static_cast<int>(i & 0x7F), c.payload->bytes);
+    }
+    pkt.meta = FrameMeta(c.payload->type, c.payload->sample_rate);
+}
+
+Result run_case(const Case& c, const Options& opt) {
+    Result r;
+    r.c = c;
+    r.lat_expected = static_cast<uint64_t>(c.ticks) * c.calls;
+    prodigy_tls::g_ic_encryption_enabled.store(c.encrypted ? 1 : 0);
+
+    int fds[2];
+    if (pipe(fds) < 0) return r;
+    pid_t child = -1;
+    std::thread rx;
+    if (opt.fork) {
+        child = fork();
+        if (child == 0) {
+            ::close(fds[0]);
+            run_receiver(c, fds[1]);
+            _exit(0);
+        }
+        if (child < 0) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            return r;
+        }
+        ::close(fds[1]);
+        fds[1] = -1;
+    } else {
+        rx = std::thread(run_receiver, std::cref(c), fds[1]);
+    }
+
+    InterconnectNode node(c.payload->from);
+    node.set_shm_transport(opt.transport == Transport::SHM);
+    node.set_unix_transport(opt.transport == Transport::UNIX ? IcUnixMode::STREAM
+                            : opt.transport == Transport::SEQPACKET ? IcUnixMode::SEQPACKET
+                            : IcUnixMode::OFF);
+    uint8_t ready = 0;
+    if (node.initialize() && read_all(fds[0], &ready, 1) && ready) {
+        for (int i = 0; i < 100 && node.downstream_state() != ConnectionState::CONNECTED; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        // The shm ring is attached shortly after the sockets connect.
+        for (int i = 0; opt.transport == Transport::SHM && !c.encrypted && i < 40 &&
+                        !node.downstream_shm_active(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        r.transport = link_transport(node);
+
+        uint64_t t0 = now_ns();
+        for (uint64_t i = 0; i < c.tput_packets; i++) {
+            auto pkt = node.make_packet(1 + static_cast<uint32_t>(i % c.calls), c.payload->bytes);
+            fill(c, pkt, i);
+            uint64_t stamp = now_ns();
+            memcpy(pkt.payload(), &stamp, sizeof(stamp));
+            if (!node.send_to_downstream(std::move(pkt))) break;
+        }
+        uint64_t tput[2];
+        bool ok = read_all(fds[0], tput, sizeof(tput));
+        if (ok) {
+            r.tput_received = tput[0];
+            r.tput_seconds = tput[0] ? (tput[1] - t0) / 1e9 : 0;
+        }
+
+        for (int t = 0; ok && t < c.ticks; t++) {
+            for (int k = 0; k < c.calls; k++) {
+                auto pkt = node.make_packet(1 + static_cast<uint32_t>(k), c.payload->bytes);
+                fill(c, pkt, k);
+                uint64_t stamp = now_ns();
+                memcpy(pkt.payload(), &stamp, sizeof(stamp));
+                node.send_to_downstream(std::move(pkt));
+            }
+            uint8_t ack = 0;
+            ok = read_all(fds[0], &ack, 1) && ack;
+        }
+        uint64_t count = 0;
+        if (read_all(fds[0], &count, sizeof(count))) {
+            r.lat_ns.resize(count);
+            r.ok = read_all(fds[0], r.lat_ns.data(), count * sizeof(uint64_t));
+        }
+    }
+    ::close(fds[0]);
+    if (rx.joinable()) rx.join();
+    if (fds[1] >= 0) ::close(fds[1]);
+    if (child > 0) waitpid(child, nullptr, 0);
+    node.shutdown();
+    return r;
+}
+
+double percentile_us(const std::vector<uint64_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t rank = static_cast<size_t>(q * sorted.size() + 0.5);
+    rank = std::clamp<size_t>(rank, 1, sorted.size());
+    return sorted[rank - 1] / 1e3;
+}
+
+std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') out += '\\';
+        if (static_cast<unsigned char>(ch) >= 0x20) out += ch;
+    }
+    return out;
+}
+
+bool write_json(const Options& opt, const std::vector<Result>& results) {
+    FILE* f = std::fopen(opt.json_path.c_str(), "w");
+    if (!f) return false;
+    utsname u{};
+    uname(&u);
+    char stamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    const char* transports[] = {"tcp", "shm", "unix", "seqpacket"};
+
+    std::fprintf(f, "{\n  \"benchmark\": \"interconnect\",\n  \"schema\": 1,\n");
+    std::fprintf(f, "  \"label\": \"%s\",\n  \"git_rev\": \"%s\",\n  \"timestamp\": \"%s\",\n",
+                 json_escape(opt.label).c_str(), BENCH_GIT_REV, stamp);
+    std::fprintf(f, "  \"host\": \"%s\",\n  \"kernel\": \"%s %s\",\n  \"cpus\": %u,\n",
+                 json_escape(u.nodename).c_str(), json_escape(u.sysname).c_str(),
+                 json_escape(u.release).c_str(), std::thread::hardware_concurrency());
+    std::fprintf(f, "  \"processes\": \"%s\",\n  \"transport\": \"%s\",\n  \"scale\": %g,\n",
+                 opt.fork ? "fork" : "threads", transports[static_cast<int>(opt.transport)], opt.scale);
+    std::fprintf(f, "  \"results\": [");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        double pps = r.tput_seconds > 0 ? r.tput_received / r.tput_seconds : 0;
+        std::fprintf(f, "%s\n    {\"payload\": \"%s\", \"payload_bytes\": %zu, \"encryption\": %s, "
+                        "\"calls\": %d, \"transport\": \"%s\", \"ok\": %s,\n",
+                     i ? "," : "", r.c.payload->name, r.c.payload->bytes,
+                     r.c.encrypted ? "true" : "false", r.c.calls, r.transport.c_str(),
+                     r.ok ? "true" : "false");
+        std::fprintf(f, "     \"throughput\": {\"packets\": %zu, \"received\": %llu, \"seconds\": %.6f, "
+                        "\"packets_per_s\": %.1f, \"bytes_per_s\": %.1f},\n",
+                     r.c.tput_packets, static_cast<unsigned long long>(r.tput_received), r.tput_seconds,
+                     pps, pps * r.c.payload->bytes);
+        std::fprintf(f, "     \"latency_us\": {\"samples\": %zu, \"expected\": %llu, \"p50\": %.2f, "
+                        "\"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}}",
+                     r.lat_ns.size(), static_cast<unsigned long long>(r.lat_expected),
+                     percentile_us(r.lat_ns, 0.50), percentile_us(r.lat_ns, 0.99),
+                     percentile_us(r.lat_ns, 0.999), percentile_us(r.lat_ns, 1.0));
+    }
+    std::fprintf(f, "\n  ]\n}\n");
+    return std::fclose(f) == 0;
+}
+
+std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == std::string::npos) end = s.size();
+        if (end > start) out.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return out;
+}
+
+int usage() {
+    std::fprintf(stderr,
+                 "usage: bench_interconnect [--json FILE] [--label NAME] [--fork] [--quick]\n"
+                 "                          [--transport tcp|shm|unix|seqpacket]\n"
+                 "                          [--payload ulaw160,pcm1280,chunk384k,text] [--calls 1,16,256]\n");
+    return 2;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (a == "--json" && has_value) {
+            opt.json_path = argv[++i];
+        } else if (a == "--label" && has_value) {
+            opt.label = argv[++i];
+        } else if (a == "--fork") {
+            opt.fork = true;
+        } else if (a == "--quick") {
+            opt.scale = 0.1;
+        } else if (a == "--transport" && has_value) {
+            std::string t = argv[++i];
+            if (t == "tcp") opt.transport = Transport::TCP;
+            else if (t == "shm") opt.transport = Transport::SHM;
+            else if (t == "unix") opt.transport = Transport::UNIX;
+            else if (t == "seqpacket") opt.transport = Transport::SEQPACKET;
+            else return usage();
+        } else if (a == "--payload" && has_value) {
+            for (const std::string& name : split(argv[++i])) {
+                auto it = std::find_if(std::begin(PAYLOADS), std::end(PAYLOADS),
+                                       [&](const Payload& p) { return name == p.name; });
+                if (it == std::end(PAYLOADS)) return usage();
+                opt.payloads.push_back(&*it);
+            }
+        } else if (a == "--calls" && has_value) {
+            opt.calls.clear();
+            for (const std::string& n : split(argv[++i])) {
+                int calls = std::atoi(n.c_str());
+                if (calls < 1 || calls > 1000) return usage();
+                opt.calls.push_back(calls);
+            }
+        } else {
+            return usage();
+        }
+    }
+    if (opt.payloads.empty()) {
+        for (const Payload& p : PAYLOADS) opt.payloads.push_back(&p);
+    }
+    // Run the flag's call_once and load the key before overriding the flag
+    // or forking, so both processes share one key.
+    prodigy_tls::ic_encryption_enabled();
+    prodigy_tls::get_interconnect_key();
+
+    std::vector<Result> results;
+    std::printf("%-10s %-4s %5s %-15s %12s %12s %10s %10s %10s %9s\n", "payload", "enc", "calls",
+                "transport", "pkt/s", "MB/s", "p50 us", "p99 us", "p999 us", "samples");
+    for (const Payload* p : opt.payloads) {
+        for (bool enc : {false, true}) {
+            for (int calls : opt.calls) {
+                Result r = run_case(make_case(p, enc, calls, opt.scale), opt);
+                std::sort(r.lat_ns.begin(), r.lat_ns.end());
+                double pps = r.tput_seconds > 0 ? r.tput_received / r.tput_seconds : 0;
+                std::printf("%-10s %-4s %5d %-15s %12.0f %12.1f %10.1f %10.1f %10.1f %4zu/%-4llu%s\n",
+                            p->name, enc ? "on" : "off", calls,
+                            r.transport.empty() ? "-" : r.transport.c_str(), pps, pps * p->bytes / 1e6,
+                            percentile_us(r.lat_ns, 0.50), percentile_us(r.lat_ns, 0.99),
+                            percentile_us(r.lat_ns, 0.999), r.lat_ns.size(),
+                            static_cast<unsigned long long>(r.lat_expected), r.ok ? "" : "  FAILED");
+                std::fflush(stdout);
+                results.push_back(std::move(r));
+            }
+        }
+    }
+    if (!write_json(opt, results)) {
+        std::fprintf(stderr, "cannot write %s\n", opt.json_path.c_str());
+        return 1;
+    }
+    std::printf("wrote %s\n", opt.json_path.c_str());
+    return 0;
+}
@@ -0,0 +1,207 @@
+// bench_io_batch — syscalls per call-second on the OAP → SIP → RTP hop.
+//
+//   bench_io_batch [ticks]
+//
+// For 1, 10 and 100 calls an OAP node sends one 160-byte μ-law frame per
+// call per tick to a SIP node, which sends each one on as a 172-byte RTP
+// datagram on that call's own UDP socket. Ticks run back to back (the next
+// one starts when SIP has sent the last), so a tick is the 20 ms batch the
+// services see and one call-second is 50 ticks of one call. Modes:
+//
+//   per-frame       send_to_downstream / recv_from_upstream / sendto per frame
+//   batched         send_batch_to_downstream / recv_batch_from_upstream /
+//                   SendBatch on its fallback (sendmsg per datagram)
+//   batched+uring   the same with SendBatch on io_uring (if the kernel allows)
+//
+// Syscalls are counted by wrapping the socket calls at link time (-Wl,--wrap,
+// see CMakeLists.txt) per thread: "oap" is the sending thread, "sip" the
+// receiving and RTP-sending one. CPU is process user+sys time.
+//
+// Built with -DBUILD_BENCHMARKS=ON (Linux only); not part of ctest.
+
+#include "interconnect.h"
+#include "io-batch.h"
+
+#include <sys/resource.h>
+#include <cstdarg>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace whispertalk;
+
+namespace {
+thread_local uint64_t t_syscalls = 0;
+}
+
+#define WRAP(ret, name, params, args)                \
+    extern "C" ret __real_##name params;             \
+    extern "C" ret __wrap_##name params {            \
+        t_syscalls++;                                \
+        return __real_##name args;                   \
+    }
+
+WRAP(ssize_t, send, (int fd, const void* b, size_t n, int f), (fd, b, n, f))
+WRAP(ssize_t, sendto, (int fd, const void* b, size_t n, int f, const sockaddr* a, socklen_t l),
+     (fd, b, n, f, a, l))
+WRAP(ssize_t, sendmsg, (int fd, const msghdr* m, int f), (fd, m, f))
+WRAP(int, sendmmsg, (int fd, mmsghdr* m, unsigned n, int f), (fd, m, n, f))
+WRAP(ssize_t, recv, (int fd, void* b, size_t n, int f), (fd, b, n, f))
+WRAP(ssize_t, recvfrom, (int fd, void* b, size_t n, int f, sockaddr* a, socklen_t* l),
+     (fd, b, n, f, a, l))
+WRAP(ssize_t, recvmsg, (int fd, msghdr* m, int f), (fd, m, f))
+WRAP(ssize_t, readv, (int fd, const iovec* v, int n), (fd, v, n))
+WRAP(ssize_t, writev, (int fd, const iovec* v, int n), (fd, v, n))
+WRAP(int, poll, (pollfd* p, nfds_t n, int t), (p, n, t))
+
+// io_uring_enter (and anything else) goes through syscall(2).
+extern "C" long __real_syscall(long n, ...);
+extern "C" long __wrap_syscall(long n, ...) {
+    va_list ap;
+    va_start(ap, n);
+    long a[6];
+    for (long& x : a) x = va_arg(ap, long);
+    va_end(ap);
+    t_syscalls++;
+    return __real_syscall(n, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+namespace {
+
+constexpr size_t FRAME = 160;
+constexpr int TICKS_PER_SECOND = 50;
+
+double cpu_s() {
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+enum class Mode { PER_FRAME, BATCHED, BATCHED_URING };
+
+const char* mode_name(Mode m) {
+    switch (m) {
+        case Mode::PER_FRAME: return "per-frame";
+        case Mode::BATCHED:   return "batched";
+        default:              return "batched+uring";
+    }
+}
+
+void bench(Mode mode, int calls, int ticks) {
+    InterconnectNode oap(ServiceType::OUTBOUND_AUDIO_PROCESSOR);
+    oap.set_shm_transport(false);
+    InterconnectNode sip(ServiceType::SIP_CLIENT);
+    if (!oap.initialize() || !sip.initialize()) {
+        std::printf("%-14s init failed\n", mode_name(mode));
+        return;
+    }
+    for (int i = 0; i < 50; i++) {
+        if (oap.downstream_state() == ConnectionState::CONNECTED &&
+            sip.upstream_state() == ConnectionState::CONNECTED) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    // RTP: one socket per call towards a sink nobody reads (the kernel drops
+    // what overflows; sends still succeed).
+    int sink = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in dest{};
+    dest.sin_family = AF_INET;
+    dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(sink, reinterpret_cast<sockaddr*>(&dest), sizeof(dest));
+    socklen_t dlen = sizeof(dest);
+    getsockname(sink, reinterpret_cast<sockaddr*>(&dest), &dlen);
+    std::vector<int> rtp(calls);
+    for (int& s : rtp) s = socket(AF_INET, SOCK_DGRAM, 0);
+
+    SendBatch batch(static_cast<size_t>(calls));
+    if (mode == Mode::BATCHED_URING && !batch.set_uring(true)) {
+        std::printf("%-14s %4d calls  unavailable (io_uring refused)\n", mode_name(mode), calls);
+        for (int s : rtp) ::close(s);
+        ::close(sink);
+        sip.shutdown();
+        oap.shutdown();
+        return;
+    }
+    if (mode == Mode::BATCHED) batch.set_uring(false);
+
+    std::atomic<int> done_ticks{0};
+    uint64_t sip_calls = 0;
+    std::thread rx([&]() {
+        std::vector<PooledPacket> frames;
+        PooledPacket pkt;
+        for (int t = 0; t < ticks; t++) {
+            size_t got = 0;
+            if (mode == Mode::PER_FRAME) {
+                for (; got < static_cast<size_t>(calls) && sip.recv_from_upstream(pkt, 2000); got++) {
+                    uint8_t* d = pkt.payload() - 12;
+                    memset(d, 0x80, 12);
+                    sendto(rtp[pkt.call_id - 1], d, 12 + pkt.payload_size, 0,
+                           reinterpret_cast<sockaddr*>(&dest), dlen);
+                }
+            } else {
+                frames.clear();
+                while (got < static_cast<size_t>(calls)) {
+                    size_t n = sip.recv_batch_from_upstream(frames, calls - got, 2000);
+                    if (n == 0) break;
+                    got += n;
+                }
+                for (auto& f : frames) {
+                    uint8_t* d = f.payload() - 12;
+                    memset(d, 0x80, 12);
+                    batch.add(rtp[f.call_id - 1], d, 12 + f.payload_size,
+                              reinterpret_cast<sockaddr*>(&dest), dlen);
+                }
+                batch.flush();
+            }
+            if (got < static_cast<size_t>(calls)) break;
+            done_ticks.store(t + 1, std::memory_order_release);
+        }
+        sip_calls = t_syscalls;
+    });
+
+    double c0 = cpu_s();
+    t_syscalls = 0;
+    std::vector<PooledPacket> tick;
+    for (int t = 0; t < ticks; t++) {
+        while (done_ticks.load(std::memory_order_acquire) < t) std::this_thread::yield();
+        tick.clear();
+        for (int c = 1; c <= calls; c++) {
+            auto p = oap.make_packet(static_cast<uint32_t>(c), FRAME);
+            memset(p.payload(), 0xFF, FRAME);
+            p.meta = FrameMeta(PayloadType::ULAW, 8000);
+            if (mode == Mode::PER_FRAME) oap.send_to_downstream(std::move(p));
+            else tick.push_back(std::move(p));
+        }
+        if (mode != Mode::PER_FRAME) oap.send_batch_to_downstream(tick);
+    }
+    uint64_t oap_calls = t_syscalls;
+    rx.join();
+    double cpu = cpu_s() - c0;
+
+    const double call_seconds = static_cast<double>(done_ticks.load()) * calls / TICKS_PER_SECOND;
+    if (call_seconds <= 0) {
+        std::printf("%-14s %4d calls  no frames arrived\n", mode_name(mode), calls);
+    } else {
+        std::printf("%-14s %4d calls  syscalls/call-s: oap %7.1f  sip %7.1f  total %7.1f"
+                    "   %7.1f us CPU/call-s\n",
+                    mode_name(mode), calls, oap_calls / call_seconds, sip_calls / call_seconds,
+                    (oap_calls + sip_calls) / call_seconds, cpu / call_seconds * 1e6);
+    }
+    for (int s : rtp) ::close(s);
+    ::close(sink);
+    sip.shutdown();
+    oap.shutdown();
+}
+
+}
+
+int main(int argc, char** argv) {
+    int ticks = argc > 1 ? std::atoi(argv[1]) : 500;
+    for (int calls : {1, 10, 100}) {
+        for (Mode m : {Mode::PER_FRAME, Mode::BATCHED, Mode::BATCHED_URING}) bench(m, calls, ticks);
+    }
+    return 0;
+}
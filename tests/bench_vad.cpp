@@ -0,0 +1,304 @@
+// bench_vad — the energy VAD against a neural backend on Testfiles/.
+//
+//   bench_vad [--testfiles DIR] [--backend silero:<model.onnx>] [--calls N]
+//
+// Every Testfiles/*.wav goes down the telephone path (8 kHz μ-law, then the
+// 16 kHz upsampler IAP uses) with 2 s of background before and after the
+// speech, under three backgrounds: codec silence only, steady white noise at
+// −45 dBFS, and "street" (brown noise at −32 dBFS with a 300 ms burst 12 dB
+// louder every 1.5 s). Frames are 50 ms and go through vad-service's onset
+// rule with its defaults: speech after 2 loud frames (gap tolerance 1), over
+// after 14 quiet ones. Per detector and background it reports:
+//
+//   false/min   onsets starting in the background-only stretches, per minute
+//   missed      files whose speech overlaps no speech segment
+//   ns/frame    CPU per frame per call, the neural backend scoring --calls
+//               calls (default 32) together as a shard does
+//
+// Without --backend (or in a build without ONNX Runtime) only the energy
+// rows are printed. Built with -DBUILD_BENCHMARKS=ON; not part of ctest.
+//
+// No Silero rows are recorded yet: the tree does not ship silero_vad.onnx,
+// and neither the model nor an ONNX Runtime build belongs in it. Configure
+// with -DWHISPERTALK_ONNXRUNTIME=ON (plus -DONNXRUNTIME_ROOT=<release> if
+// ORT is not installed), take the v5 model from snakers4/silero-vad
+// (src/silero_vad/data/silero_vad.onnx) and pass it with
+// --backend silero:<path>.
+
+#include "audio-dsp.h"
+#include "pcm-wire.h"
+#include "vad-backend.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace whispertalk;
+
+namespace {
+
+constexpr size_t FRAME = 800;             // 50 ms at 16 kHz
+constexpr size_t PAD = 2 * 16000;         // background before and after
+constexpr size_t TAIL_GRACE = 16000 / 2;  // onsets this soon after speech are not false
+constexpr float THRESH_MULT = 2.0f;
+constexpr int ONSET_FRAMES = 2;
+constexpr int ONSET_GAP = 1;
+constexpr int SILENCE_FRAMES = 14;
+
+// 16-bit PCM WAV, mixed down to mono floats. Empty on anything else.
+std::vector<float> read_wav(const std::string& path, int* rate) {
+    std::vector<float> out;
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) return out;
+    std::vector<uint8_t> b;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) b.insert(b.end(), buf, buf + n);
+    std::fclose(f);
+    if (b.size() < 12 || std::memcmp(b.data(), "RIFF", 4) || std::memcmp(b.data() + 8, "WAVE", 4)) return out;
+    auto u16 = [&](size_t o) { return static_cast<uint32_t>(b[o] | b[o + 1] << 8); };
+    auto u32 = [&](size_t o) { return u16(o) | u16(o + 2) << 16; };
+    int channels = 0, bits = 0;
+    for (size_t o = 12; o + 8 <= b.size();) {
+        uint32_t len = u32(o + 4);
+        if (!std::memcmp(&b[o], "fmt ", 4) && len >= 16) {
+            channels = static_cast<int>(u16(o + 10));
+            *rate = static_cast<int>(u32(o + 12));
+            bits = static_cast<int>(u16(o + 22));
+        } else if (!std::memcmp(&b[o], "data", 4) && channels > 0 && bits == 16) {
+            size_t frames = std::min<size_t>(len, b.size() - o - 8) / (2 * channels);
+            out.resize(frames);
+            for (size_t i = 0; i < frames; i++) {
+                int acc = 0;
+                for (int c = 0; c < channels; c++) {
+                    acc += static_cast<int16_t>(u16(o + 8 + (i * channels + c) * 2));
+                }
+                out[i] = static_cast<float>(acc) / (32768.0f * channels);
+            }
+            return out;
+        }
+        o += 8 + len + (len & 1);
+    }
+    return out;
+}
+
+// To 8 kHz through a 63-tap windowed-sinc low-pass at 3.4 kHz.
+std::vector<float> to_8k(const std::vector<float>& in, int rate) {
+    constexpr int TAPS = 63;
+    float h[TAPS];
+    const double fc = 3400.0 / rate;
+    for (int i = 0; i < TAPS; i++) {
+        double m = i - (TAPS - 1) / 2.0;
+        double sinc = m == 0 ? 2 * fc : std::sin(2 * M_PI * fc * m) / (M_PI * m);
+        h[i] = static_cast<float>(sinc * (0.54 - 0.46 * std::cos(2 * M_PI * i / (TAPS - 1))));
+    }
+    std::vector<float> out(static_cast<size_t>(in.size() * 8000.0 / rate));
+    for (size_t j = 0; j < out.size(); j++) {
+        double t = j * static_cast<double>(rate) / 8000.0;
+        long c = static_cast<long>(t);
+        float acc = 0.0f;
+        for (int k = 0; k < TAPS; k++) {
+            long i = c + k - (TAPS - 1) / 2;
+            if (i >= 0 && i < static_cast<long>(in.size())) acc += h[k] * in[i];
+        }
+        out[j] = acc;
+    }
+    return out;
+}
+
+enum class Background { SILENCE, WHITE, STREET };
+const char* background_name(Background bg) {
+    return bg == Background::SILENCE ? "silence" : bg == Background::WHITE ? "white" : "street";
+}
+
+// Speech padded with background at 8 kHz, through μ-law and the 16 kHz
+// upsampler. *speech_at / *speech_end bound the speech at 16 kHz.
+std::vector<float> telephone_clip(const std::vector<float>& speech8k, Background bg, uint32_t seed,
+                                  size_t* speech_at, size_t* speech_end) {
+    const size_t pad8 = PAD / 2;
+    std::vector<float> x(pad8 + speech8k.size() + pad8, 0.0f);
+    std::copy(speech8k.begin(), speech8k.end(), x.begin() + pad8);
+    uint32_t r = seed;
+    auto uniform = [&] {
+        r = r * 1103515245u + 12345u;
+        return static_cast<float>(static_cast<int32_t>(r >> 8) - (1 << 23)) / (1 << 23);
+    };
+    float brown = 0.0f;
+    for (size_t i = 0; i < x.size(); i++) {
+        if (bg == Background::WHITE) {
+            x[i] += 0.0056f * 1.73f * uniform();   // −45 dBFS RMS
+        } else if (bg == Background::STREET) {
+            brown = 0.995f * brown + 0.1f * uniform();
+            float gain = (i % 12000) < 2400 ? 4.0f : 1.0f;   // +12 dB for 300 ms every 1.5 s
+            x[i] += 0.025f * gain * brown;                  // about −32 dBFS between bursts
+        }
+    }
+    std::vector<uint8_t> ulaw(x.size());
+    for (size_t i = 0; i < x.size(); i++) {
+        float v = std::max(-1.0f, std::min(1.0f, x[i]));
+        ulaw[i] = linear_to_ulaw(static_cast<int16_t>(v * 32767.0f));
+    }
+    std::vector<float> out(2 * x.size());
+    UlawUpsampler16k up;
+    up.push(ulaw.data(), ulaw.size(), out.data());
+    *speech_at = PAD + 2 * IAP_FIR_CENTER;
+    *speech_end = *speech_at + 2 * speech8k.size();
+    return out;
+}
+
+// vad-service's onset rule over per-frame decisions; decide(i, energy,
+// in_speech, idle) classifies frame i. Returns the speech segments as
+// [first frame, end frame).
+using Segments = std::vector<std::pair<size_t, size_t>>;
+template <typename Decide>
+Segments run_fsm(const std::vector<float>& audio, Decide&& decide) {
+    Segments onsets;
+    bool in_speech = false;
+    int onset_count = 0, onset_gap = 0, silence = 0;
+    size_t tentative = 0;
+    for (size_t f = 0; (f + 1) * FRAME <= audio.size(); f++) {
+        float energy = sum_squares(&audio[f * FRAME], FRAME) / FRAME;
+        if (decide(f, energy, in_speech, !in_speech && onset_count == 0)) {
+            silence = 0;
+            if (!in_speech) {
+                if (onset_count++ == 0) tentative = f;
+                onset_gap = 0;
+                if (onset_count >= ONSET_FRAMES) {
+                    in_speech = true;
+                    onsets.push_back({tentative, SIZE_MAX});
+                }
+            }
+        } else if (!in_speech && onset_count > 0) {
+            if (++onset_gap > ONSET_GAP) onset_count = onset_gap = 0;
+        } else if (in_speech && ++silence >= SILENCE_FRAMES) {
+            in_speech = false;
+            onsets.back().second = f + 1;
+            onset_count = onset_gap = silence = 0;
+        }
+    }
+    if (in_speech) onsets.back().second = audio.size() / FRAME;
+    return onsets;
+}
+
+struct Tally {
+    size_t false_onsets = 0;
+    double background_s = 0;
+    size_t missed = 0;
+    double ns = 0;
+    size_t frames = 0;
+};
+
+// A segment starting in the background is a false onset (even if it runs
+// on into the speech); the file is missed if no segment overlaps its speech.
+void score_onsets(const Segments& segments, size_t speech_at, size_t speech_end, size_t total, Tally& t) {
+    bool hit = false;
+    for (auto [first, end] : segments) {
+        size_t pos = first * FRAME;
+        if (pos + FRAME <= speech_at || pos >= speech_end + TAIL_GRACE) t.false_onsets++;
+        if (pos < speech_end && end * FRAME > speech_at) hit = true;
+    }
+    if (!hit) t.missed++;
+    t.background_s += static_cast<double>(speech_at + (total - speech_end)) / 16000.0;
+}
+
+void energy_run(const std::vector<float>& audio, size_t speech_at, size_t speech_end, Tally& t) {
+    float noise_floor = VAD_NOISE_FLOOR_INIT;
+    auto t0 = std::chrono::steady_clock::now();
+    auto onsets = run_fsm(audio, [&](size_t, float energy, bool, bool idle) {
+        if (idle) noise_floor = vad_noise_floor_update(noise_floor, energy);
+        return energy > std::max(noise_floor * THRESH_MULT, VAD_NOISE_FLOOR_INIT);
+    });
+    t.ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    t.frames += audio.size() / FRAME;
+    score_onsets(onsets, speech_at, speech_end, audio.size(), t);
+}
+
+// The clip scored as `calls` calls at once (the probabilities of the first
+// are used), then the onset rule on the model's frame probabilities.
+void neural_run(VadBackend& b, int calls, const std::vector<float>& audio, size_t speech_at, size_t speech_end,
+                Tally& t) {
+    std::vector<VadNeuralStream> streams(calls);
+    std::vector<VadNeuralStream*> ptrs;
+    for (auto& s : streams) {
+        s.reset(b, audio.size());
+        ptrs.push_back(&s);
+    }
+    VadScoreBatch batch;
+    const uint64_t whole = audio.size() / b.window() * b.window();
+    auto t0 = std::chrono::steady_clock::now();
+    vad_score_pending(b, ptrs.data(), ptrs.size(), [&](size_t) { return whole; },
+                      [&](size_t, uint64_t pos) { return audio.data() + pos; }, batch);
+    const VadNeuralStream& s = streams[0];
+    auto onsets = run_fsm(audio, [&](size_t f, float energy, bool in_speech, bool) {
+        if (!s.covers((f + 1) * FRAME)) return false;
+        float need = in_speech ? VAD_NEURAL_THRESHOLD_DEFAULT - VAD_NEURAL_HYSTERESIS : VAD_NEURAL_THRESHOLD_DEFAULT;
+        return energy > VAD_NOISE_FLOOR_INIT && s.frame_prob(f * FRAME, FRAME) >= need;
+    });
+    t.ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / calls;
+    t.frames += audio.size() / FRAME;
+    score_onsets(onsets, speech_at, speech_end, audio.size(), t);
+}
+
+void print_row(const char* detector, Background bg, const Tally& t, size_t files) {
+    std::printf("%-10s %-8s %10.2f %7zu/%-3zu %10.0f\n", detector, background_name(bg),
+                t.false_onsets / (t.background_s / 60.0), t.missed, files, t.ns / t.frames);
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string dir = "Testfiles";
+    std::string backend_spec;
+    int calls = 32;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string a = argv[i];
+        if (a == "--testfiles") dir = argv[i + 1];
+        else if (a == "--backend") backend_spec = argv[i + 1];
+        else if (a == "--calls") calls = std::max(1, std::atoi(argv[i + 1]));
+    }
+
+    std::unique_ptr<VadBackend> backend;
+    if (!backend_spec.empty()) {
+        std::string err;
+        backend = make_vad_backend(backend_spec, &err);
+        if (!err.empty()) std::fprintf(stderr, "backend: %s (energy only)\n", err.c_str());
+    }
+
+    std::vector<std::vector<float>> speech;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() < 4 || name.compare(name.size() - 4, 4, ".wav") != 0) continue;
+            int rate = 0;
+            auto pcm = read_wav(dir + "/" + name, &rate);
+            if (!pcm.empty() && rate >= 8000) speech.push_back(to_8k(pcm, rate));
+        }
+        closedir(d);
+    }
+    if (speech.empty()) {
+        std::fprintf(stderr, "no 16-bit WAV files in %s\n", dir.c_str());
+        return 1;
+    }
+
+    std::printf("%zu files, dsp %s%s\n\n", speech.size(), dsp_isa_name(dsp_kernels().isa),
+                backend ? (std::string(", backend ") + backend->name()).c_str() : "");
+    std::printf("%-10s %-8s %10s %11s %10s\n", "detector", "bg", "false/min", "missed", "ns/frame");
+    for (Background bg : {Background::SILENCE, Background::WHITE, Background::STREET}) {
+        Tally energy, neural;
+        for (size_t i = 0; i < speech.size(); i++) {
+            size_t at, end;
+            auto clip = telephone_clip(speech[i], bg, static_cast<uint32_t>(i * 7919 + 1), &at, &end);
+            energy_run(clip, at, end, energy);
+            if (backend) neural_run(*backend, calls, clip, at, end, neural);
+        }
+        print_row("energy", bg, energy, speech.size());
+        if (backend) print_row(backend->name(), bg, neural, speech.size());
+    }
+    return 0;
+}
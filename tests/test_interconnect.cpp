@@ -1,21 +1,48 @@
 #include <gtest/gtest.h>
 #include "interconnect.h"
+#include "pcm-wire.h"
 #include "tts-engine-client.h"
+#include "io-batch.h"
+#include "iap-arena.h"
+#include "jitter-buffer.h"
+#include "audio-ring.h"
+#include "vad-backend.h"
+#include "speech-partial.h"
+#include "call-job-queue.h"
 #include <thread>
 #include <chrono>
 #include <vector>
 #include <set>
+#include <map>
+#include <memory>
 #include <atomic>
 #include <string>
+#include <algorithm>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <poll.h>
 #include <fcntl.h>
+#include <cstdlib>
+#include <new>
 
 using namespace whispertalk;
 
+// Heap allocation counter for the zero-allocation packet path tests. Counting
+// is switched on per thread, so interconnect background threads and gtest's
+// own bookkeeping never perturb a measurement.
+static std::atomic<size_t> g_counted_allocs{0};
+static thread_local bool g_count_allocs = false;
+
+__attribute__((noinline)) void* operator new(std::size_t n) {
+    if (g_count_allocs) g_counted_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
 TEST(PacketTest, SerializationRoundTrip) {
     const char* test_data = "Hello, World!";
     Packet original(42, test_data, strlen(test_data));
@@ -1486,3 +1513,2695 @@ TEST(MoshiServiceTest, FIR24kCrossFrameContinuity) {
         EXPECT_NEAR(out_split[i], out_whole[i], 1e-5f) << "continuity mismatch at output index " << i;
     }
 }
+
+TEST(ShmRingTest, WrapAroundPreservesRecordOrderAndContent) {
+    std::string name;
+    auto producer = ShmRing::create(4096, name);
+    ASSERT_NE(producer, nullptr);
+    auto consumer = ShmRing::open(name);
+    ShmRing::unlink(name);
+    ASSERT_NE(consumer, nullptr);
+    EXPECT_EQ(consumer->capacity(), 4096u);
+
+    const int COUNT = 5000;
+    std::thread writer([&]() {
+        for (int i = 0; i < COUNT; ++i) {
+            uint32_t seq = static_cast<uint32_t>(i);
+            std::vector<uint8_t> body(1 + (i * 37) % 900, static_cast<uint8_t>(i));
+            ASSERT_TRUE(producer->push(&seq, 4, body.data(), body.size(), 2000));
+        }
+    });
+
+    bool all_correct = true;
+    for (int i = 0; i < COUNT && all_correct; ++i) {
+        if (!consumer->wait_readable(2000)) { all_correct = false; break; }
+        uint32_t len = consumer->front_size();
+        uint32_t seq = 0;
+        consumer->read_front(0, &seq, 4);
+        std::vector<uint8_t> body(len - 4);
+        consumer->read_front(4, body.data(), body.size());
+        consumer->pop_front();
+        if (seq != static_cast<uint32_t>(i) || body.size() != 1 + (size_t)(i * 37) % 900) all_correct = false;
+        for (uint8_t b : body) {
+            if (b != static_cast<uint8_t>(i)) { all_correct = false; break; }
+        }
+    }
+    writer.join();
+    EXPECT_TRUE(all_correct);
+}
+
+TEST(ShmRingTest, CloseWakesConsumerAndRejectsPush) {
+    std::string name;
+    auto producer = ShmRing::create(4096, name);
+    ASSERT_NE(producer, nullptr);
+    auto consumer = ShmRing::open(name);
+    ShmRing::unlink(name);
+    ASSERT_NE(consumer, nullptr);
+
+    std::thread closer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        producer->close();
+    });
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(consumer->wait_readable(5000));
+    auto waited = std::chrono::steady_clock::now() - start;
+    closer.join();
+
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(waited).count(), 2000);
+    EXPECT_TRUE(consumer->closed());
+    uint8_t b = 1;
+    EXPECT_FALSE(producer->push(&b, 1, nullptr, 0, 100));
+}
+
+TEST(ShmTransportTest, PacketsFlowOverShmRing) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(true);
+    EXPECT_TRUE(upstream.initialize());
+
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+
+    for (int i = 0; i < 40; ++i) {
+        if (upstream.downstream_shm_active() && downstream.upstream_shm_active()) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_TRUE(upstream.downstream_shm_active());
+    ASSERT_TRUE(downstream.upstream_shm_active());
+
+    const int NUM_PACKETS = 1000;
+    std::atomic<bool> all_correct(true);
+    std::atomic<int> received(0);
+    std::thread receiver([&]() {
+        for (int i = 0; i < NUM_PACKETS; ++i) {
+            Packet pkt;
+            if (!downstream.recv_from_upstream(pkt, 5000)) { all_correct = false; break; }
+            std::string expect = "frame_" + std::to_string(i);
+            if (pkt.call_id != (uint32_t)(i + 1) ||
+                std::string(pkt.payload.begin(), pkt.payload.end()) != expect) {
+                all_correct = false;
+            }
+            received++;
+        }
+    });
+
+    for (int i = 0; i < NUM_PACKETS; ++i) {
+        std::string data = "frame_" + std::to_string(i);
+        Packet pkt(i + 1, data.c_str(), data.size());
+        EXPECT_TRUE(upstream.send_to_downstream(pkt));
+    }
+    receiver.join();
+
+    EXPECT_EQ(received.load(), NUM_PACKETS);
+    EXPECT_TRUE(all_correct.load());
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(ShmTransportTest, ReceiverRestartFallsBackAndRenegotiates) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(true);
+    EXPECT_TRUE(upstream.initialize());
+
+    {
+        InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+        EXPECT_TRUE(downstream.initialize());
+        for (int i = 0; i < 40 && !downstream.upstream_shm_active(); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        EXPECT_TRUE(downstream.upstream_shm_active());
+    }
+
+    // The receiver's exit closes the mgmt socket; the sender drops the ring
+    // with the link instead of writing into it.
+    for (int i = 0; i < 40 && upstream.downstream_state() == ConnectionState::CONNECTED; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_NE(upstream.downstream_state(), ConnectionState::CONNECTED);
+    EXPECT_FALSE(upstream.downstream_shm_active());
+    Packet lost(1, "x", 1);
+    EXPECT_FALSE(upstream.send_to_downstream(lost));
+
+    InterconnectNode downstream2(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream2.initialize());
+    for (int i = 0; i < 40 && !(downstream2.upstream_shm_active() && upstream.downstream_shm_active() &&
+                                upstream.downstream_state() == ConnectionState::CONNECTED); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_EQ(upstream.downstream_state(), ConnectionState::CONNECTED);
+    EXPECT_TRUE(upstream.downstream_shm_active());
+    EXPECT_TRUE(downstream2.upstream_shm_active());
+
+    const char* data = "after restart";
+    Packet pkt(7, data, strlen(data));
+    EXPECT_TRUE(upstream.send_to_downstream(pkt));
+    Packet recv_pkt;
+    EXPECT_TRUE(downstream2.recv_from_upstream(recv_pkt, 2000));
+    EXPECT_EQ(recv_pkt.call_id, 7u);
+
+    downstream2.shutdown();
+    upstream.shutdown();
+}
+
+TEST(ShmTransportTest, MultiDownstreamTargetUsesShm) {
+    InterconnectNode iap(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    iap.set_shm_transport(true);
+    iap.add_downstream_target(ServiceType::VAD_SERVICE);
+    EXPECT_TRUE(iap.initialize());
+
+    InterconnectNode vad(ServiceType::VAD_SERVICE);
+    EXPECT_TRUE(vad.initialize());
+    iap.connect_all_downstreams();
+
+    for (int i = 0; i < 40; ++i) {
+        if (vad.upstream_shm_active() && iap.downstream_shm_active(ServiceType::VAD_SERVICE)) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_TRUE(iap.downstream_shm_active(ServiceType::VAD_SERVICE));
+    ASSERT_TRUE(vad.upstream_shm_active());
+
+    std::vector<float> frame(320, 0.25f);
+    Packet pkt(3, frame.data(), frame.size() * sizeof(float));
+    EXPECT_TRUE(iap.send_to_downstream(pkt, ServiceType::VAD_SERVICE));
+
+    Packet recv_pkt;
+    EXPECT_TRUE(vad.recv_from_upstream(recv_pkt, 2000));
+    EXPECT_EQ(recv_pkt.call_id, 3u);
+    EXPECT_EQ(recv_pkt.payload, pkt.payload);
+
+    vad.shutdown();
+    iap.shutdown();
+}
+
+TEST(PooledPacketTest, PoolRecyclesBuffersBySizeClass) {
+    PacketPool* pool = PacketPool::create();
+    {
+        PacketBufRef a = pool->acquire(160);
+        ASSERT_TRUE(a);
+        EXPECT_GE(a->payload_capacity(), 160u);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(a->payload()) % 16, 0u);
+        PacketBufRef b = a;
+        EXPECT_EQ(a->use_count(), 2u);
+        EXPECT_FALSE(a.unique());
+    }
+    PacketBufRef c = pool->acquire(100);
+    EXPECT_EQ(pool->buffers_allocated(), 1u);
+    EXPECT_EQ(pool->buffers_reused(), 1u);
+
+    PacketBufRef big = pool->acquire(Packet::MAX_PAYLOAD_SIZE);
+    ASSERT_TRUE(big);
+    EXPECT_GE(big->payload_capacity(), (size_t)Packet::MAX_PAYLOAD_SIZE);
+    EXPECT_FALSE(pool->acquire(4 * 1024 * 1024));
+    EXPECT_EQ(pool->buffers_allocated(), 2u);
+
+    // Buffers outlive the owner's reference; the pool goes away with the last one.
+    pool->release();
+    c.reset();
+    big.reset();
+}
+
+TEST(PooledPacketTest, InteropWithVectorPacket) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+    for (int i = 0; i < 40 && upstream.downstream_state() != ConnectionState::CONNECTED; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    const char* text = "vector to pooled";
+    EXPECT_TRUE(upstream.send_to_downstream(Packet(5, text, strlen(text))));
+    PooledPacket pooled;
+    ASSERT_TRUE(downstream.recv_from_upstream(pooled, 2000));
+    EXPECT_EQ(pooled.call_id, 5u);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(pooled.payload()), pooled.payload_size), text);
+
+    auto out = upstream.make_packet(6, 4);
+    memcpy(out.payload(), "abcd", 4);
+    PooledPacket keep = out;  // shared buffer: send must not touch it
+    EXPECT_TRUE(upstream.send_to_downstream(std::move(out)));
+    Packet vec;
+    ASSERT_TRUE(downstream.recv_from_upstream(vec, 2000));
+    EXPECT_EQ(vec.call_id, 6u);
+    EXPECT_EQ(std::string(vec.payload.begin(), vec.payload.end()), "abcd");
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(keep.payload()), 4), "abcd");
+    EXPECT_TRUE(keep.buf.unique());
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+static void run_pooled_steady_state(bool use_shm) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(use_shm);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+    for (int i = 0; i < 40; ++i) {
+        bool ready = upstream.downstream_state() == ConnectionState::CONNECTED &&
+                     downstream.upstream_state() == ConnectionState::CONNECTED &&
+                     (!use_shm || downstream.upstream_shm_active());
+        if (ready) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_EQ(downstream.upstream_shm_active(), use_shm);
+
+    const int WARMUP = 200;
+    const int MEASURED = 2000;
+    std::atomic<bool> warm(false);
+    std::atomic<int> received(0);
+    std::atomic<bool> all_correct(true);
+    std::atomic<size_t> recv_allocs(0);
+
+    std::thread receiver([&]() {
+        for (int i = 0; i < WARMUP + MEASURED; ++i) {
+            if (i == WARMUP) {
+                warm = true;
+                g_count_allocs = true;
+            }
+            PooledPacket pkt;
+            if (!downstream.recv_from_upstream(pkt, 5000)) { all_correct = false; break; }
+            if (pkt.call_id != (uint32_t)(i + 1) || pkt.payload_size != 172 ||
+                pkt.payload()[171] != static_cast<uint8_t>(i)) {
+                all_correct = false;
+            }
+            received++;
+        }
+        g_count_allocs = false;
+    });
+
+    size_t before = 0;
+    for (int i = 0; i < WARMUP + MEASURED; ++i) {
+        if (i == WARMUP) {
+            while (!warm) std::this_thread::yield();
+            before = g_counted_allocs.load();
+            g_count_allocs = true;
+        }
+        auto pkt = upstream.make_packet(i + 1, 172);
+        memset(pkt.payload(), static_cast<uint8_t>(i), 172);
+        pkt.trace.record(ServiceType::SIP_CLIENT, 0);
+        pkt.trace.record(ServiceType::SIP_CLIENT, 1);
+        if (!upstream.send_to_downstream(std::move(pkt))) all_correct = false;
+    }
+    receiver.join();
+    g_count_allocs = false;
+    size_t allocs = g_counted_allocs.load() - before;
+
+    EXPECT_EQ(received.load(), WARMUP + MEASURED);
+    EXPECT_TRUE(all_correct.load());
+    EXPECT_EQ(allocs, 0u) << "heap allocations in " << MEASURED << " steady-state packets";
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(PooledPacketTest, SteadyStateZeroAllocationsTcp) {
+    run_pooled_steady_state(false);
+}
+
+TEST(PooledPacketTest, SteadyStateZeroAllocationsShm) {
+    run_pooled_steady_state(true);
+}
+
+static void wait_tcp_pair(InterconnectNode& up, InterconnectNode& down) {
+    for (int i = 0; i < 40; ++i) {
+        if (up.downstream_state() == ConnectionState::CONNECTED &&
+            down.upstream_state() == ConnectionState::CONNECTED) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+}
+
+TEST(ScatterGatherTest, LargeVectorPacketSurvivesPartialWrites) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(false);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+
+    // Larger than the socket buffers: sendmsg returns short and the iovec
+    // cursor has to advance across the header/payload boundary.
+    std::vector<uint8_t> big(Packet::MAX_PAYLOAD_SIZE);
+    for (size_t i = 0; i < big.size(); ++i) big[i] = static_cast<uint8_t>(i * 31 + 7);
+    Packet out(11, big.data(), big.size());
+
+    std::thread sender([&]() { EXPECT_TRUE(upstream.send_to_downstream(out)); });
+    Packet in;
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 5000));
+    sender.join();
+    EXPECT_EQ(in.call_id, 11u);
+    EXPECT_EQ(in.payload_size, big.size());
+    EXPECT_TRUE(in.payload == big);
+
+    Packet small(12, "tail", 4);
+    EXPECT_TRUE(upstream.send_to_downstream(small));
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    EXPECT_EQ(in.call_id, 12u);
+    EXPECT_EQ(std::string(in.payload.begin(), in.payload.end()), "tail");
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(ScatterGatherTest, VectorPacketReuseIsAllocationFree) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(false);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+
+    std::vector<uint8_t> frame(160, 0x55);
+    Packet out(1, frame.data(), frame.size());
+    Packet in;
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(upstream.send_to_downstream(out));
+        ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    }
+
+    size_t before = g_counted_allocs.load();
+    g_count_allocs = true;
+    bool ok = true;
+    for (int i = 0; i < 500 && ok; ++i) {
+        ok = upstream.send_to_downstream(out) && downstream.recv_from_upstream(in, 2000) &&
+             in.payload_size == 160 && in.payload[159] == 0x55;
+    }
+    g_count_allocs = false;
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(g_counted_allocs.load() - before, 0u);
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(ScatterGatherTest, CustomMessageRoundTripOnMgmtChannel) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    downstream.register_custom_negotiation_handler([](const std::string& msg) {
+        return "ECHO:" + std::to_string(msg.size()) + ":" + msg.substr(msg.size() - 3);
+    });
+    EXPECT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+
+    std::string msg(40000, 'x');
+    msg += "end";
+    EXPECT_EQ(upstream.send_custom_to_downstream(msg), "ECHO:40003:end");
+    EXPECT_EQ(upstream.send_custom_to_downstream("PING_TEXT"), "ECHO:9:EXT");
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(PacketTraceTest, WireExtensionRoundTrip) {
+    PacketTrace trace;
+    trace.record(ServiceType::SIP_CLIENT, 0);
+    trace.record(ServiceType::SIP_CLIENT, 1);
+    trace.record(ServiceType::INBOUND_AUDIO_PROCESSOR, 0);
+    ASSERT_EQ(trace.wire_size(), 1u + 3 * PacketTrace::WIRE_HOP_BYTES);
+
+    Packet pkt(77, "abc", 3);
+    auto wire = pkt.serialize();
+    uint32_t flagged = htonl(3u | Packet::TRACE_FLAG);
+    memcpy(wire.data() + 4, &flagged, 4);
+    wire.resize(wire.size() + trace.wire_size());
+    trace.write_wire(wire.data() + 11);
+
+    Packet out;
+    ASSERT_TRUE(Packet::deserialize(wire.data(), wire.size(), out));
+    EXPECT_EQ(out.payload_size, 3u);
+    EXPECT_EQ(std::string(out.payload.begin(), out.payload.end()), "abc");
+    ASSERT_EQ(out.trace.hop_count, 3);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(out.trace.hops[i].service_id, trace.hops[i].service_id);
+        EXPECT_EQ(out.trace.hops[i].direction, trace.hops[i].direction);
+        EXPECT_EQ(out.trace.hops[i].timestamp_us, trace.hops[i].timestamp_us);
+    }
+
+    // A truncated extension is rejected.
+    EXPECT_FALSE(Packet::deserialize(wire.data(), wire.size() - 1, out));
+}
+
+TEST(HopLatencyTest, HistogramPercentilesWithinBucketPrecision) {
+    LatencyHistogram h;
+    for (uint64_t v = 1; v <= 10000; ++v) h.record(v);
+    EXPECT_EQ(h.count(), 10000u);
+    EXPECT_EQ(h.max(), 10000u);
+    EXPECT_NEAR(static_cast<double>(h.percentile(0.50)), 5000.0, 5000.0 * 0.0625);
+    EXPECT_NEAR(static_cast<double>(h.percentile(0.99)), 9900.0, 9900.0 * 0.0625);
+    EXPECT_EQ(h.percentile(1.0), 10000u);
+    for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+        EXPECT_EQ(LatencyHistogram::bucket_for(LatencyHistogram::bucket_upper(i)), i);
+    }
+}
+
+static void run_trace_propagation(bool use_shm) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(use_shm);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+    for (int i = 0; i < 40; ++i) {
+        bool ready = upstream.downstream_state() == ConnectionState::CONNECTED &&
+                     downstream.upstream_state() == ConnectionState::CONNECTED &&
+                     (!use_shm || downstream.upstream_shm_active());
+        if (ready) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_EQ(downstream.upstream_shm_active(), use_shm);
+
+    const int N = 50;
+    for (int i = 0; i < N; ++i) {
+        auto pkt = upstream.make_packet(i + 1, 160);
+        memset(pkt.payload(), 0x11, 160);
+        pkt.trace.record(ServiceType::SIP_CLIENT, 0);
+        pkt.trace.record(ServiceType::SIP_CLIENT, 1);
+        uint64_t t0 = pkt.trace.hops[0].timestamp_us;
+        ASSERT_TRUE(upstream.send_to_downstream(std::move(pkt)));
+
+        if (i % 2 == 0) {
+            PooledPacket in;
+            ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+            EXPECT_EQ(in.payload_size, 160u);
+            ASSERT_EQ(in.trace.hop_count, 2);
+            EXPECT_EQ(in.trace.hops[0].timestamp_us, t0);
+        } else {
+            Packet in;
+            ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+            EXPECT_EQ(in.payload_size, 160u);
+            ASSERT_EQ(in.trace.hop_count, 2);
+            EXPECT_EQ(in.trace.hops[0].timestamp_us, t0);
+        }
+    }
+
+    Packet plain(99, "no trace", 8);
+    ASSERT_TRUE(upstream.send_to_downstream(plain));
+    Packet in;
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    EXPECT_EQ(in.trace.hop_count, 0);
+
+    std::string report = downstream.hop_latency_report();
+    EXPECT_NE(report.find("HOP_LATENCY:IAP:PAIRS:3"), std::string::npos) << report;
+    EXPECT_NE(report.find("HOP:SIP.IN>SIP.OUT:N:50:"), std::string::npos) << report;
+    EXPECT_NE(report.find("HOP:SIP.OUT>IAP.ARR:N:50:"), std::string::npos) << report;
+    EXPECT_NE(report.find("HOP:SIP.IN>IAP.ARR:N:50:"), std::string::npos) << report;
+
+    upstream.set_trace_propagation(false);
+    Packet traced(100, "x", 1);
+    traced.trace.record(ServiceType::SIP_CLIENT, 1);
+    ASSERT_TRUE(upstream.send_to_downstream(traced));
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    EXPECT_EQ(in.call_id, 100u);
+    EXPECT_EQ(in.trace.hop_count, 0);
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(TraceTransportTest, TraceCrossesTcpHopAndFeedsHistograms) {
+    run_trace_propagation(false);
+}
+
+TEST(TraceTransportTest, TraceCrossesShmHopAndFeedsHistograms) {
+    run_trace_propagation(true);
+}
+
+TEST(EventLoopTest, DispatchesReadinessTasksAndTimers) {
+    EventLoop loop;
+    ASSERT_TRUE(loop.start());
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+
+    std::atomic<int> bytes_read{0};
+    std::atomic<bool> hung_up{false};
+    loop.watch(fds[0], EventLoop::READABLE, [&](int fd, uint32_t events) {
+        char buf[16];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) bytes_read += static_cast<int>(n);
+        if (n == 0 || (events & EventLoop::HANGUP)) hung_up = true;
+    });
+
+    std::atomic<bool> posted{false};
+    std::atomic<bool> fired{false};
+    auto t0 = std::chrono::steady_clock::now();
+    std::atomic<int64_t> fired_after_ms{0};
+    loop.post([&] { posted = true; });
+    loop.run_after(50, [&] {
+        fired_after_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - t0).count();
+        fired = true;
+    });
+
+    ASSERT_EQ(write(fds[1], "abc", 3), 3);
+    for (int i = 0; i < 100 && !(posted && fired && bytes_read == 3); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_TRUE(posted);
+    EXPECT_TRUE(fired);
+    EXPECT_GE(fired_after_ms.load(), 50);
+    EXPECT_EQ(bytes_read.load(), 3);
+
+    close(fds[1]);
+    for (int i = 0; i < 100 && !hung_up; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_TRUE(hung_up);
+
+    loop.unwatch(fds[0]);
+    close(fds[0]);
+    loop.stop();
+}
+
+TEST(EventLoopTest, IdleConnectedNodeDoesNotWakeUp) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    ASSERT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    downstream.disable_downstream_connect();   // no VAD: keep its reconnect timer out
+    ASSERT_TRUE(downstream.initialize());
+
+    // The receiver sees the link before the sender has finished negotiating.
+    for (int i = 0; i < 40 && !(downstream.upstream_state() == ConnectionState::CONNECTED &&
+                                upstream.downstream_state() == ConnectionState::CONNECTED); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_EQ(downstream.upstream_state(), ConnectionState::CONNECTED);
+    ASSERT_EQ(upstream.downstream_state(), ConnectionState::CONNECTED);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    uint64_t sip_before = upstream.event_loop().wakeups();
+    uint64_t iap_before = downstream.event_loop().wakeups();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT_EQ(upstream.event_loop().wakeups(), sip_before);
+    EXPECT_EQ(downstream.event_loop().wakeups(), iap_before);
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(EventLoopTest, UpstreamHangupDetectedWithoutPolling) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    ASSERT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    downstream.disable_downstream_connect();
+    ASSERT_TRUE(downstream.initialize());
+
+    for (int i = 0; i < 40 && downstream.upstream_state() != ConnectionState::CONNECTED; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_EQ(downstream.upstream_state(), ConnectionState::CONNECTED);
+
+    upstream.shutdown();
+    auto t0 = std::chrono::steady_clock::now();
+    while (downstream.upstream_state() == ConnectionState::CONNECTED &&
+           std::chrono::steady_clock::now() - t0 < std::chrono::seconds(1)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+    EXPECT_NE(downstream.upstream_state(), ConnectionState::CONNECTED);
+    EXPECT_LT(ms, 50);
+
+    downstream.shutdown();
+}
+
+TEST(ReplicaTest, InstancePortsAreDistinct) {
+    const ServiceType stages[] = {
+        ServiceType::SIP_CLIENT, ServiceType::INBOUND_AUDIO_PROCESSOR, ServiceType::VAD_SERVICE,
+        ServiceType::WHISPER_SERVICE, ServiceType::LLAMA_SERVICE, ServiceType::TTS_SERVICE,
+        ServiceType::OUTBOUND_AUDIO_PROCESSOR, ServiceType::MOSHI_SERVICE, ServiceType::FRONTEND,
+    };
+    std::set<uint16_t> ports;
+    size_t expected = 0;
+    for (ServiceType t : stages) {
+        EXPECT_EQ(service_base_port(t, 0), service_base_port(t));
+        for (int i = 0; i < MAX_STAGE_REPLICAS; i++) {
+            uint8_t inst = static_cast<uint8_t>(i);
+            ports.insert(service_mgmt_port(t, inst));
+            ports.insert(service_data_port(t, inst));
+            ports.insert(service_cmd_port(t, inst));
+            expected += 3;
+        }
+    }
+    EXPECT_EQ(ports.size(), expected);
+    EXPECT_EQ(service_cmd_port(ServiceType::WHISPER_SERVICE, 2),
+              service_base_port(ServiceType::WHISPER_SERVICE, 2) + 2);
+}
+
+static int wait_for_packet(std::vector<std::unique_ptr<InterconnectNode>>& replicas,
+                           Packet& out, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+        for (size_t i = 0; i < replicas.size(); i++) {
+            if (replicas[i] && replicas[i]->recv_from_upstream(out, 5)) return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+TEST(ReplicaTest, CallsShardStickyAndFailOver) {
+    constexpr int N = 3;
+    std::vector<std::unique_ptr<InterconnectNode>> whisper;
+    for (int i = 0; i < N; i++) {
+        whisper.push_back(std::make_unique<InterconnectNode>(ServiceType::WHISPER_SERVICE, i));
+        whisper.back()->disable_downstream_connect();
+        ASSERT_TRUE(whisper.back()->initialize());
+    }
+
+    InterconnectNode vad(ServiceType::VAD_SERVICE);
+    vad.add_downstream_replicas(ServiceType::WHISPER_SERVICE, N);
+    ASSERT_TRUE(vad.initialize());
+    vad.connect_all_downstreams();
+    for (int i = 0; i < 40; i++) {
+        size_t up = 0;
+        for (auto& w : whisper) up += w->upstream_state() == ConnectionState::CONNECTED;
+        if (up == N) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    // Each call lands on one replica and stays there.
+    std::map<uint32_t, int> owner;
+    std::set<int> used;
+    for (int round = 0; round < 2; round++) {
+        for (uint32_t cid = 1; cid <= 24; cid++) {
+            Packet pkt(cid, "x", 1);
+            ASSERT_TRUE(vad.send_to_downstream(pkt, ServiceType::WHISPER_SERVICE));
+            Packet got;
+            int r = wait_for_packet(whisper, got, 1000);
+            ASSERT_GE(r, 0);
+            EXPECT_EQ(got.call_id, cid);
+            if (round == 0) owner[cid] = r;
+            else EXPECT_EQ(owner[cid], r) << "call " << cid << " moved";
+            EXPECT_EQ(vad.routed_instance(ServiceType::WHISPER_SERVICE, cid), r);
+            used.insert(r);
+        }
+    }
+    EXPECT_EQ(used.size(), static_cast<size_t>(N));
+
+    // CALL_END reaches the owning replica only.
+    vad.broadcast_call_end(5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (int i = 0; i < N; i++) EXPECT_EQ(whisper[i]->has_ended(5), i == owner[5]) << "replica " << i;
+    EXPECT_EQ(vad.routed_instance(ServiceType::WHISPER_SERVICE, 5), -1);
+
+    // Losing a replica moves its calls and only its calls.
+    int dead = owner[1];
+    whisper[dead]->shutdown();
+    whisper[dead].reset();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (uint32_t cid = 1; cid <= 24; cid++) {
+        if (cid == 5) continue;
+        Packet pkt(cid, "y", 1);
+        ASSERT_TRUE(vad.send_to_downstream(pkt, ServiceType::WHISPER_SERVICE));
+        Packet got;
+        int r = wait_for_packet(whisper, got, 1000);
+        ASSERT_GE(r, 0);
+        EXPECT_EQ(got.call_id, cid);
+        if (owner[cid] == dead) EXPECT_NE(r, dead);
+        else EXPECT_EQ(r, owner[cid]) << "call " << cid << " moved off a live replica";
+    }
+    EXPECT_GT(vad.call_failovers(), 0u);
+
+    vad.shutdown();
+    for (auto& w : whisper) if (w) w->shutdown();
+}
+
+TEST(ReplicaTest, ReplicasFanInToSingleDownstream) {
+    InterconnectNode llama(ServiceType::LLAMA_SERVICE);
+    llama.disable_downstream_connect();
+    llama.set_max_upstream_peers(2);
+    ASSERT_TRUE(llama.initialize());
+
+    InterconnectNode w0(ServiceType::WHISPER_SERVICE, 0);
+    InterconnectNode w1(ServiceType::WHISPER_SERVICE, 1);
+    ASSERT_TRUE(w0.initialize());
+    ASSERT_TRUE(w1.initialize());
+    for (int i = 0; i < 40 && !(w0.downstream_state() == ConnectionState::CONNECTED &&
+                                w1.downstream_state() == ConnectionState::CONNECTED &&
+                                llama.upstream_peer_count() == 2); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_EQ(llama.upstream_peer_count(), 2u);
+
+    std::set<uint32_t> seen;
+    for (uint32_t i = 0; i < 10; i++) {
+        Packet a(100 + i, "a", 1);
+        Packet b(200 + i, "b", 1);
+        EXPECT_TRUE(w0.send_to_downstream(a));
+        EXPECT_TRUE(w1.send_to_downstream(b));
+    }
+    Packet got;
+    while (seen.size() < 20 && llama.recv_from_upstream(got, 1000)) seen.insert(got.call_id);
+    EXPECT_EQ(seen.size(), 20u);
+
+    // A replica going away leaves the other one flowing.
+    w0.shutdown();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(llama.upstream_peer_count(), 1u);
+    Packet c(300, "c", 1);
+    EXPECT_TRUE(w1.send_to_downstream(c));
+    ASSERT_TRUE(llama.recv_from_upstream(got, 1000));
+    EXPECT_EQ(got.call_id, 300u);
+
+    w1.shutdown();
+    llama.shutdown();
+}
+
+TEST(ReplicaTest, ReplicaCountFromEnvironmentDrivesDefaultPath) {
+    setenv("WHISPERTALK_REPLICAS_WHISPER", "2", 1);
+    InterconnectNode vad(ServiceType::VAD_SERVICE);
+    InterconnectNode w0(ServiceType::WHISPER_SERVICE, 0);
+    InterconnectNode w1(ServiceType::WHISPER_SERVICE, 1);
+    InterconnectNode llama(ServiceType::LLAMA_SERVICE);
+    llama.disable_downstream_connect();
+    ASSERT_TRUE(llama.initialize());
+    ASSERT_TRUE(w0.initialize());
+    ASSERT_TRUE(w1.initialize());
+    ASSERT_TRUE(vad.initialize());
+    unsetenv("WHISPERTALK_REPLICAS_WHISPER");
+
+    for (int i = 0; i < 40 && !(w0.upstream_state() == ConnectionState::CONNECTED &&
+                                w1.upstream_state() == ConnectionState::CONNECTED &&
+                                llama.upstream_peer_count() == 2); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    EXPECT_EQ(vad.downstream_state(), ConnectionState::CONNECTED);
+    EXPECT_EQ(llama.upstream_peer_count(), 2u);
+
+    // VAD's plain send_to_downstream shards, each replica forwards to LLaMA.
+    std::set<uint32_t> at_llama;
+    int per_replica[2] = {0, 0};
+    for (uint32_t cid = 1; cid <= 8; cid++) {
+        Packet pkt(cid, "v", 1);
+        ASSERT_TRUE(vad.send_to_downstream(pkt));
+        Packet got;
+        InterconnectNode* ws[2] = {&w0, &w1};
+        bool delivered = false;
+        for (int tries = 0; tries < 100 && !delivered; tries++) {
+            for (int r = 0; r < 2 && !delivered; r++) {
+                if (!ws[r]->recv_from_upstream(got, 5)) continue;
+                per_replica[r]++;
+                EXPECT_TRUE(ws[r]->send_to_downstream(got));
+                delivered = true;
+            }
+        }
+        ASSERT_TRUE(delivered);
+        ASSERT_TRUE(llama.recv_from_upstream(got, 1000));
+        at_llama.insert(got.call_id);
+    }
+    EXPECT_EQ(at_llama.size(), 8u);
+    EXPECT_GT(per_replica[0], 0);
+    EXPECT_GT(per_replica[1], 0);
+
+    vad.shutdown();
+    w0.shutdown();
+    w1.shutdown();
+    llama.shutdown();
+}
+
+TEST(FlowControlTest, CallTableKeepsProbeChainsAcrossEraseAndEvicts) {
+    CallTable<int, 8> t;
+    auto no_evict = [](uint32_t, const int&) { FAIL() << "unexpected eviction"; };
+    for (uint32_t id = 1; id <= 6; id++) t.claim(id, no_evict) = static_cast<int>(id) * 10;
+    EXPECT_EQ(t.size(), 6u);
+    ASSERT_TRUE(t.erase(3));
+    EXPECT_FALSE(t.erase(3));
+    for (uint32_t id = 1; id <= 6; id++) {
+        if (id == 3) { EXPECT_EQ(t.find(id), nullptr); continue; }
+        ASSERT_NE(t.find(id), nullptr) << id;
+        EXPECT_EQ(*t.find(id), static_cast<int>(id) * 10);
+    }
+
+    // At the load limit (6 of 8) a new call evicts exactly one entry.
+    t.claim(3, no_evict) = 30;
+    uint32_t evicted = 0;
+    t.claim(99, [&](uint32_t id, const int& v) { evicted = id; EXPECT_EQ(v, static_cast<int>(id) * 10); });
+    EXPECT_NE(evicted, 0u);
+    EXPECT_EQ(t.size(), 6u);
+    EXPECT_EQ(t.find(evicted), nullptr);
+    EXPECT_NE(t.find(99), nullptr);
+}
+
+TEST(FlowControlTest, CreditsTrackInFlightAndSlowConsumerClosesWindow) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(false);
+    upstream.set_flow_window(16 * 1024);
+    ASSERT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    ASSERT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+
+    std::vector<uint8_t> frame(1000, 0x11);
+    Packet out(7, frame.data(), frame.size());
+    for (int i = 0; i < 10; i++) ASSERT_TRUE(upstream.send_to_downstream(out));
+    auto s = upstream.downstream_flow_stats();
+    EXPECT_EQ(s.in_flight_bytes, 10u * 1008);
+    EXPECT_EQ(s.queued_frames, 10u);
+    EXPECT_EQ(s.calls, 1u);
+    EXPECT_TRUE(upstream.downstream_window_open(7));
+
+    // The consumer is not reading: the window closes, sends still go out.
+    for (int i = 0; i < 10; i++) ASSERT_TRUE(upstream.send_to_downstream(out));
+    EXPECT_FALSE(upstream.downstream_window_open(7));
+    EXPECT_TRUE(upstream.downstream_window_open(8));
+    s = upstream.downstream_flow_stats();
+    EXPECT_EQ(s.closed_calls, 1u);
+    EXPECT_GE(s.overruns, 3u);
+    EXPECT_EQ(s.peak_in_flight_bytes, 20u * 1008);
+
+    // Draining it grants the bytes back; the idle receive flushes the rest.
+    std::atomic<bool> reopened(false);
+    std::thread waiter([&] { reopened = upstream.wait_downstream_window(7, 2000); });
+    Packet in;
+    for (int i = 0; i < 20; i++) ASSERT_TRUE(downstream.recv_from_upstream(in, 1000));
+    EXPECT_FALSE(downstream.recv_from_upstream(in, 20));
+    waiter.join();
+    EXPECT_TRUE(reopened.load());
+    for (int i = 0; i < 100 && upstream.downstream_flow_stats().in_flight_bytes > 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    s = upstream.downstream_flow_stats();
+    EXPECT_EQ(s.in_flight_bytes, 0u);
+    EXPECT_EQ(s.queued_frames, 0u);
+    EXPECT_GE(s.credits, 2u);
+    EXPECT_TRUE(upstream.downstream_window_open(7));
+
+    // Credits queued on the mgmt socket do not confuse a CUSTOM exchange.
+    downstream.register_custom_negotiation_handler([](const std::string& m) { return "ACK:" + m; });
+    ASSERT_TRUE(upstream.send_to_downstream(out));
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 1000));
+    EXPECT_FALSE(downstream.recv_from_upstream(in, 20));
+    EXPECT_EQ(upstream.send_custom_to_downstream("X"), "ACK:X");
+
+    upstream.note_shed(7, 1008);
+    std::string report = upstream.flow_report();
+    EXPECT_EQ(report.rfind("FLOW:SIP:LINKS:1:WINDOW:16384\n", 0), 0u) << report;
+    EXPECT_NE(report.find("LINK:IAP#0:STATE:connected:"), std::string::npos) << report;
+    EXPECT_NE(report.find(":SHED:1:SHED_BYTES:1008:"), std::string::npos) << report;
+    std::string metrics_text = upstream.metrics_report();
+    EXPECT_NE(metrics_text.find("whispertalk_ic_shed_frames_total{service=\"SIP\",link=\"IAP#0\"} 1\n"),
+              std::string::npos) << metrics_text;
+    EXPECT_NE(metrics_text.find("whispertalk_ic_link_up{service=\"SIP\",link=\"IAP#0\"} 1\n"),
+              std::string::npos) << metrics_text;
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(FlowControlTest, CreditsReachTheReplicaOwningTheCall) {
+    InterconnectNode iap(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    iap.add_downstream_replicas(ServiceType::VAD_SERVICE, 2);
+    iap.set_shm_transport(false);
+    std::vector<std::unique_ptr<InterconnectNode>> vads;
+    for (uint8_t i = 0; i < 2; i++) {
+        vads.push_back(std::make_unique<InterconnectNode>(ServiceType::VAD_SERVICE, i));
+        vads.back()->disable_downstream_connect();
+        ASSERT_TRUE(vads.back()->initialize());
+    }
+    ASSERT_TRUE(iap.initialize());
+    iap.connect_all_downstreams();
+    for (int i = 0; i < 40; i++) {
+        size_t up = 0;
+        for (auto& v : vads) up += v->upstream_state() == ConnectionState::CONNECTED;
+        if (up == vads.size()) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    std::vector<uint8_t> frame(640, 0);
+    for (uint32_t cid = 1; cid <= 6; cid++) {
+        Packet pkt(cid, frame.data(), frame.size());
+        for (int k = 0; k < 8; k++) ASSERT_TRUE(iap.send_to_downstream(pkt, ServiceType::VAD_SERVICE));
+    }
+    uint64_t sent = iap.downstream_flow_stats(ServiceType::VAD_SERVICE, 0).in_flight_bytes +
+                    iap.downstream_flow_stats(ServiceType::VAD_SERVICE, 1).in_flight_bytes;
+    EXPECT_EQ(sent, 6u * 8 * 648);
+
+    Packet in;
+    for (auto& v : vads) {
+        while (v->recv_from_upstream(in, 50)) {}
+    }
+    for (int i = 0; i < 100; i++) {
+        if (iap.downstream_flow_stats(ServiceType::VAD_SERVICE, 0).in_flight_bytes == 0 &&
+            iap.downstream_flow_stats(ServiceType::VAD_SERVICE, 1).in_flight_bytes == 0) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(iap.downstream_flow_stats(ServiceType::VAD_SERVICE, 0).in_flight_bytes, 0u);
+    EXPECT_EQ(iap.downstream_flow_stats(ServiceType::VAD_SERVICE, 1).in_flight_bytes, 0u);
+    EXPECT_EQ(iap.flow_report().rfind("FLOW:IAP:LINKS:2:", 0), 0u);
+
+    iap.shutdown();
+    for (auto& v : vads) v->shutdown();
+}
+
+// IC encryption is normally read once per process from ic_encryption.flag;
+// this switches it on for the scope of one test.
+struct ScopedIcEncryption {
+    int saved;
+    ScopedIcEncryption() {
+        prodigy_tls::ic_encryption_enabled();
+        saved = prodigy_tls::g_ic_encryption_enabled.exchange(1);
+    }
+    ~ScopedIcEncryption() { prodigy_tls::g_ic_encryption_enabled.store(saved); }
+};
+
+TEST(IcCipherTest, CounterIvsAndInPlaceRoundTrip) {
+    prodigy_tls::IcCipher cipher;
+    const char* text = "interconnect frame";
+    size_t len = strlen(text);
+    std::vector<uint8_t> a(prodigy_tls::ic_encrypted_size(len)), b(a.size());
+    size_t alen = 0, blen = 0;
+    ASSERT_TRUE(cipher.seal(reinterpret_cast<const uint8_t*>(text), len, a.data(), alen));
+    ASSERT_TRUE(cipher.seal(reinterpret_cast<const uint8_t*>(text), len, b.data(), blen));
+    EXPECT_EQ(alen, a.size());
+    // Same fixed field, consecutive counters.
+    EXPECT_EQ(memcmp(a.data(), b.data(), 8), 0);
+    uint32_t ca = (a[8] << 24) | (a[9] << 16) | (a[10] << 8) | a[11];
+    uint32_t cb = (b[8] << 24) | (b[9] << 16) | (b[10] << 8) | b[11];
+    EXPECT_EQ(cb, ca + 1);
+    EXPECT_NE(memcmp(a.data() + 12, b.data() + 12, len), 0);
+
+    // Sealed in parts, opened in place by an independent context.
+    std::vector<uint8_t> c(prodigy_tls::ic_encrypted_size(len));
+    ASSERT_TRUE(cipher.begin(c.data()));
+    ASSERT_TRUE(cipher.update(reinterpret_cast<const uint8_t*>(text), 5, c.data() + 12));
+    ASSERT_TRUE(cipher.update(reinterpret_cast<const uint8_t*>(text) + 5, len - 5, c.data() + 17));
+    ASSERT_TRUE(cipher.finish(c.data() + 12 + len));
+    prodigy_tls::IcCipher other;
+    size_t plen = 0;
+    ASSERT_TRUE(other.open(c.data(), c.size(), c.data() + 12, plen));
+    EXPECT_EQ(std::string(reinterpret_cast<char*>(c.data() + 12), plen), text);
+
+    b[12 + 3] ^= 1;
+    std::vector<uint8_t> out(len);
+    EXPECT_FALSE(other.open(b.data(), blen, out.data(), plen));
+    ASSERT_TRUE(other.open(a.data(), alen, out.data(), plen));
+    EXPECT_EQ(std::string(out.begin(), out.end()), text);
+}
+
+TEST(EncryptedTransportTest, VectorPooledAndMgmtFramesRoundTrip) {
+    ScopedIcEncryption enc;
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_ktls_transport(true);   // falls back to AES-GCM where kTLS is unavailable
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    downstream.register_custom_negotiation_handler([](const std::string& msg) {
+        return "ECHO:" + msg;
+    });
+    EXPECT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+    EXPECT_FALSE(downstream.upstream_shm_active());
+
+    EXPECT_EQ(upstream.send_custom_to_downstream("sealed"), "ECHO:sealed");
+
+    std::vector<uint8_t> frame(160);
+    for (size_t i = 0; i < frame.size(); ++i) frame[i] = static_cast<uint8_t>(i);
+    Packet out(7, frame.data(), frame.size());
+    out.trace.record(ServiceType::SIP_CLIENT, 0);
+    upstream.set_trace_propagation(true);
+    Packet in;
+    ASSERT_TRUE(upstream.send_to_downstream(out));
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    EXPECT_EQ(in.call_id, 7u);
+    EXPECT_TRUE(in.payload == frame);
+    EXPECT_GE(in.trace.hop_count, 1);
+    upstream.set_trace_propagation(false);
+
+    auto pooled = upstream.make_packet(8, 172);
+    memset(pooled.payload(), 0xA5, 172);
+    ASSERT_TRUE(upstream.send_to_downstream(std::move(pooled)));
+    PooledPacket pin;
+    ASSERT_TRUE(downstream.recv_from_upstream(pin, 2000));
+    EXPECT_EQ(pin.call_id, 8u);
+    ASSERT_EQ(pin.payload_size, 172u);
+    EXPECT_EQ(pin.payload()[171], 0xA5);
+
+    // Cipher contexts and frame buffers are per thread and reused.
+    size_t before = g_counted_allocs.load();
+    g_count_allocs = true;
+    bool ok = true;
+    for (int i = 0; i < 200 && ok; ++i) {
+        ok = upstream.send_to_downstream(out) && downstream.recv_from_upstream(in, 2000) &&
+             in.payload == frame;
+    }
+    g_count_allocs = false;
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(g_counted_allocs.load() - before, 0u);
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(FrameMetaTest, WireBlockRoundTripsAheadOfTraceAndSkipsNewerFields) {
+    FrameMeta meta(PayloadType::PCM_F32, 16000, 0x0102030405060708ull);
+    meta.seq = 42;
+    PacketTrace trace;
+    trace.record(ServiceType::INBOUND_AUDIO_PROCESSOR, 1);
+
+    // A later version's block: 8 more bytes the receiver does not know.
+    for (size_t block : {FrameMeta::WIRE_BYTES, FrameMeta::WIRE_BYTES + 8}) {
+        Packet pkt(5, "pcm!", 4);
+        auto wire = pkt.serialize();
+        uint32_t flagged = htonl(4u | Packet::META_FLAG | Packet::TRACE_FLAG);
+        memcpy(wire.data() + 4, &flagged, 4);
+        size_t at = wire.size();
+        wire.resize(at + block + trace.wire_size(), 0xEE);
+        meta.write_wire(wire.data() + at);
+        wire[at + 1] = static_cast<uint8_t>(block);
+        trace.write_wire(wire.data() + at + block);
+
+        Packet out;
+        ASSERT_TRUE(Packet::deserialize(wire.data(), wire.size(), out)) << block;
+        EXPECT_EQ(std::string(out.payload.begin(), out.payload.end()), "pcm!");
+        EXPECT_EQ(out.meta.type, PayloadType::PCM_F32);
+        EXPECT_EQ(out.meta.sample_rate, 16000u);
+        EXPECT_EQ(out.meta.seq, 42u);
+        EXPECT_EQ(out.meta.capture_us, 0x0102030405060708ull);
+        ASSERT_EQ(out.trace.hop_count, 1);
+        EXPECT_EQ(out.trace.hops[0].timestamp_us, trace.hops[0].timestamp_us);
+
+        // A block claiming less than version 1's fields is malformed.
+        wire[at + 1] = 8;
+        EXPECT_FALSE(Packet::deserialize(wire.data(), wire.size(), out));
+    }
+
+    EXPECT_TRUE(payload_is(FrameMeta(), PayloadType::ULAW, true));
+    EXPECT_FALSE(payload_is(FrameMeta(PayloadType::TEXT), PayloadType::ULAW, true));
+    EXPECT_STREQ(payload_type_name(PayloadType::TTS_AUDIO), "tts_audio");
+}
+
+TEST(FrameMetaTest, SeqTrackerCountsLossReorderAndRestarts) {
+    SeqStamper stamper;
+    EXPECT_EQ(stamper.next(1), 1u);
+    EXPECT_EQ(stamper.next(1), 2u);
+    EXPECT_EQ(stamper.next(2), 1u);
+
+    SeqTracker tracker;
+    for (uint32_t seq : {1u, 2u, 5u, 3u, 6u}) tracker.observe(7, seq);   // 3, 4 missing; 3 late
+    tracker.observe(7, 1);                                               // sender reconnected
+    tracker.observe(7, 2);
+    tracker.observe(8, 0);                                               // untyped: ignored
+    auto s = tracker.stats();
+    EXPECT_EQ(s.frames, 7u);
+    EXPECT_EQ(s.lost, 1u);
+    EXPECT_EQ(s.reordered, 1u);
+    EXPECT_EQ(s.restarts, 1u);
+
+    tracker.forget(7);
+    tracker.observe(7, 1);
+    EXPECT_EQ(tracker.stats().restarts, 1u);
+}
+
+static void run_typed_headers(bool use_shm) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(use_shm);
+    upstream.set_trace_propagation(true);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+    for (int i = 0; i < 40; ++i) {
+        bool ready = upstream.downstream_state() == ConnectionState::CONNECTED &&
+                     downstream.upstream_state() == ConnectionState::CONNECTED &&
+                     (!use_shm || downstream.upstream_shm_active());
+        if (ready) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_EQ(downstream.upstream_shm_active(), use_shm);
+    ASSERT_TRUE(upstream.downstream_typed_headers());
+
+    for (uint32_t i = 1; i <= 3; ++i) {
+        auto pkt = upstream.make_packet(9, 172);
+        memset(pkt.payload(), static_cast<uint8_t>(i), 172);
+        pkt.meta = FrameMeta(PayloadType::RTP, 8000, 1000 + i);
+        pkt.trace.record(ServiceType::SIP_CLIENT, 1);
+        ASSERT_TRUE(upstream.send_to_downstream(std::move(pkt)));
+        PooledPacket in;
+        ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+        ASSERT_EQ(in.payload_size, 172u);
+        EXPECT_EQ(in.payload()[171], static_cast<uint8_t>(i));
+        EXPECT_EQ(in.meta.type, PayloadType::RTP);
+        EXPECT_EQ(in.meta.sample_rate, 8000u);
+        EXPECT_EQ(in.meta.seq, i);
+        EXPECT_EQ(in.meta.capture_us, 1000u + i);
+        EXPECT_EQ(in.trace.hop_count, 1);
+    }
+
+    // An untyped producer still gets a seq and a capture time from the node.
+    Packet text(9, "hello", 5);
+    ASSERT_TRUE(upstream.send_to_downstream(text));
+    Packet in;
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    EXPECT_EQ(std::string(in.payload.begin(), in.payload.end()), "hello");
+    EXPECT_EQ(in.meta.type, PayloadType::UNSPECIFIED);
+    EXPECT_EQ(in.meta.seq, 4u);
+    EXPECT_GT(in.meta.capture_us, 0u);
+
+    auto s = downstream.frame_seq_stats();
+    EXPECT_EQ(s.frames, 4u);
+    EXPECT_EQ(s.lost, 0u);
+    EXPECT_NE(upstream.flow_report().find(":TYPED:1\n"), std::string::npos);
+    EXPECT_NE(downstream.flow_report().find("RX:FRAMES:4:LOST:0:REORDERED:0:RESTARTS:0\n"),
+              std::string::npos) << downstream.flow_report();
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(TypedHeaderTest, MetaAndSequenceCrossTcpHop) {
+    run_typed_headers(false);
+}
+
+TEST(TypedHeaderTest, MetaAndSequenceCrossShmHop) {
+    run_typed_headers(true);
+}
+
+TEST(TypedHeaderTest, DisabledSenderKeepsLegacyFrames) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(false);
+    upstream.set_typed_headers(false);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+    EXPECT_FALSE(upstream.downstream_typed_headers());
+
+    auto pkt = upstream.make_packet(3, 160);
+    memset(pkt.payload(), 0x7F, 160);
+    pkt.meta = FrameMeta(PayloadType::ULAW, 8000);
+    ASSERT_TRUE(upstream.send_to_downstream(std::move(pkt)));
+    PooledPacket in;
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    EXPECT_EQ(in.payload_size, 160u);
+    EXPECT_EQ(in.meta.type, PayloadType::UNSPECIFIED);
+    EXPECT_EQ(in.meta.seq, 0u);
+    EXPECT_EQ(downstream.frame_seq_stats().frames, 0u);
+    EXPECT_NE(upstream.flow_report().find(":TYPED:0\n"), std::string::npos);
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+// The float path IAP used for VAD: decode, then upsample with per-call history.
+static std::vector<float> float_path_16k(const std::vector<uint8_t>& ulaw, size_t frame) {
+    std::vector<float> out;
+    float history[IAP_FIR_CENTER] = {};
+    float decoded[IAP_ULAW_FRAME], up[2 * IAP_ULAW_FRAME];
+    for (size_t at = 0; at < ulaw.size(); at += frame) {
+        size_t n = std::min(frame, ulaw.size() - at);
+        ulaw_decode(ulaw.data() + at, n, decoded);
+        size_t m = iap_fir_upsample_frame(decoded, n, up, history);
+        out.insert(out.end(), up, up + m);
+    }
+    return out;
+}
+
+TEST(PcmWireTest, UlawEncodingsAreBitExactWithFloatPath) {
+    std::vector<uint8_t> ulaw(8000);
+    uint32_t x = 12345;
+    for (auto& b : ulaw) {
+        x = x * 1103515245u + 12345u;
+        b = static_cast<uint8_t>(x >> 16);
+    }
+    EXPECT_EQ(ulaw_float_table()[0xFF], 0.0f);
+    const std::vector<float> ref = float_path_16k(ulaw, IAP_ULAW_FRAME);
+    ASSERT_EQ(ref.size(), 2 * ulaw.size());
+
+    // IAP → VAD: frames of any length rebuild the same stream.
+    UlawUpsampler16k up;
+    UlawSource source;
+    std::vector<float> rebuilt(ref.size());
+    const size_t lens[] = {160, 80, 7, 3, 400, 1};
+    size_t written = 0;
+    for (size_t at = 0, i = 0; at < ulaw.size(); at += lens[i++ % 6]) {
+        size_t len = std::min(lens[i % 6], ulaw.size() - at);
+        written += up.push(ulaw.data() + at, len, rebuilt.data() + written);
+        source.append(ulaw.data() + at, len);
+    }
+    ASSERT_EQ(written, ref.size());
+    EXPECT_EQ(memcmp(rebuilt.data(), ref.data(), ref.size() * sizeof(float)), 0);
+
+    // VAD → Whisper: any slice, odd or even, at call start or mid-stream.
+    std::vector<uint8_t> wire;
+    std::vector<float> chunk;
+    const std::pair<uint64_t, size_t> slices[] = {{0, 16000}, {1, 9999}, {6400, 1}, {777, 3201},
+                                                   {12, 2}, {13, 15987}, {15000, 1000}};
+    for (auto [pos, count] : slices) {
+        ASSERT_TRUE(source.encode(pos, count, wire)) << pos;
+        EXPECT_LE(wire.size(), UlawSource::HEADER_BYTES + IAP_FIR_CENTER + count / 2 + 2);
+        ASSERT_TRUE(decode_ulaw_up16k(wire.data(), wire.size(), chunk)) << pos;
+        ASSERT_EQ(chunk.size(), count);
+        EXPECT_EQ(memcmp(chunk.data(), ref.data() + pos, count * sizeof(float)), 0) << pos << "+" << count;
+    }
+
+    // Trimmed audio can no longer be encoded; what is left still is exact.
+    source.trim_before(10000);
+    EXPECT_FALSE(source.encode(9000, 100, wire));
+    EXPECT_FALSE(source.encode(15999, 2, wire));
+    ASSERT_TRUE(source.encode(10001, 4000, wire));
+    ASSERT_TRUE(decode_ulaw_up16k(wire.data(), wire.size(), chunk));
+    EXPECT_EQ(memcmp(chunk.data(), ref.data() + 10001, 4000 * sizeof(float)), 0);
+
+    wire[0] = 2;
+    EXPECT_FALSE(decode_ulaw_up16k(wire.data(), wire.size(), chunk));
+    EXPECT_FALSE(decode_ulaw_up16k(wire.data(), 10, chunk));
+}
+
+TEST(PcmWireTest, AcceptedPayloadTypesAreOfferedInHandshake) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(false);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    downstream.accept_payload_type(PayloadType::ULAW);
+    downstream.accept_payload_type(PayloadType::ULAW_UP16K);
+    EXPECT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+    EXPECT_TRUE(upstream.downstream_accepts(PayloadType::ULAW));
+    EXPECT_TRUE(upstream.downstream_accepts(PayloadType::ULAW_UP16K));
+    EXPECT_FALSE(upstream.downstream_accepts(PayloadType::PCM_S16));
+    downstream.shutdown();
+    upstream.shutdown();
+
+    // Untyped links never carry them.
+    InterconnectNode legacy(ServiceType::SIP_CLIENT);
+    legacy.set_shm_transport(false);
+    legacy.set_typed_headers(false);
+    EXPECT_TRUE(legacy.initialize());
+    InterconnectNode receiver(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    receiver.accept_payload_type(PayloadType::ULAW);
+    EXPECT_TRUE(receiver.initialize());
+    wait_tcp_pair(legacy, receiver);
+    EXPECT_EQ(legacy.downstream_state(), ConnectionState::CONNECTED);
+    EXPECT_FALSE(legacy.downstream_accepts(PayloadType::ULAW));
+    receiver.shutdown();
+    legacy.shutdown();
+}
+
+// Reads MAX_US of one HOP line from a hop_latency_report(); -1 if absent.
+static long long hop_max_us(const std::string& report, const std::string& pair) {
+    size_t at = report.find("HOP:" + pair + ":");
+    if (at == std::string::npos) return -1;
+    size_t m = report.find(":MAX_US:", at);
+    if (m == std::string::npos) return -1;
+    return std::atoll(report.c_str() + m + 8);
+}
+
+TEST(SpeechBusTest, SignalReachesEveryStageDirectly) {
+    // No mgmt links at all: whatever arrives came over the bus.
+    InterconnectNode vad(ServiceType::VAD_SERVICE);
+    vad.disable_downstream_connect();
+    InterconnectNode iap(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    iap.disable_downstream_connect();
+    InterconnectNode llama(ServiceType::LLAMA_SERVICE);
+    llama.disable_downstream_connect();
+    InterconnectNode oap(ServiceType::OUTBOUND_AUDIO_PROCESSOR);
+    oap.disable_downstream_connect();
+    ASSERT_TRUE(vad.initialize() && iap.initialize() && llama.initialize() && oap.initialize());
+    if (!oap.speech_bus_active()) GTEST_SKIP() << "no multicast on loopback";
+
+    std::atomic<int> llama_events{0}, oap_events{0}, iap_events{0};
+    std::atomic<bool> oap_active{false};
+    llama.register_speech_signal_handler([&](uint32_t, bool) { llama_events++; });
+    iap.register_speech_signal_handler([&](uint32_t, bool) { iap_events++; });
+    oap.register_speech_signal_handler([&](uint32_t cid, bool active) {
+        oap_active = active;
+        if (active) oap.mark_speech_handled(cid);
+        oap_events++;
+    });
+
+    vad.broadcast_speech_signal(7, true);
+    for (int i = 0; i < 200 && (llama_events < 1 || oap_events < 1); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_EQ(llama_events.load(), 1);
+    EXPECT_EQ(oap_events.load(), 1);
+    EXPECT_TRUE(oap_active.load());
+    EXPECT_TRUE(oap.is_speech_active(7));
+    EXPECT_EQ(iap_events.load(), 0);   // upstream of the publisher
+    EXPECT_FALSE(iap.is_speech_active(7));
+
+    std::string report = oap.hop_latency_report();
+    long long delivered = hop_max_us(report, "VAD.SIG>OAP.ARR");
+    long long handled = hop_max_us(report, "VAD.SIG>OAP.ACT");
+    EXPECT_GE(delivered, 0) << report;
+    EXPECT_GE(handled, delivered) << report;
+    EXPECT_LT(handled, 20000) << report;
+
+    // Sealed datagrams when IC encryption is on.
+    {
+        ScopedIcEncryption enc;
+        vad.broadcast_speech_signal(7, false);
+        for (int i = 0; i < 200 && oap_events < 2; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_EQ(oap_events.load(), 2);
+    EXPECT_FALSE(oap_active.load());
+    EXPECT_FALSE(llama.is_speech_active(7));
+
+    oap.shutdown();
+    llama.shutdown();
+    iap.shutdown();
+    vad.shutdown();
+}
+
+TEST(SpeechBusTest, TimestampsDropDuplicateAndStaleSignals) {
+    // Bus and mgmt both deliver: the handler still fires once per signal.
+    InterconnectNode vad(ServiceType::VAD_SERVICE);
+    vad.set_shm_transport(false);
+    InterconnectNode whisper(ServiceType::WHISPER_SERVICE);
+    whisper.disable_downstream_connect();
+    ASSERT_TRUE(vad.initialize() && whisper.initialize());
+    wait_tcp_pair(vad, whisper);
+    std::atomic<int> events{0};
+    whisper.register_speech_signal_handler([&](uint32_t, bool) { events++; });
+    vad.broadcast_speech_signal(9, true);
+    vad.broadcast_speech_signal(9, false);
+    vad.broadcast_speech_signal(9, true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_EQ(events.load(), 3);
+    EXPECT_TRUE(whisper.is_speech_active(9));
+    whisper.shutdown();
+    vad.shutdown();
+
+    // Over mgmt alone, a signal older than the last one applied is dropped;
+    // untimed signals from older peers still apply.
+    InterconnectNode llama(ServiceType::LLAMA_SERVICE);
+    llama.set_speech_bus(false);
+    llama.disable_downstream_connect();
+    ASSERT_TRUE(llama.initialize());
+    std::vector<bool> seen;
+    std::mutex seen_mutex;
+    llama.register_speech_signal_handler([&](uint32_t, bool active) {
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        seen.push_back(active);
+    });
+
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(service_mgmt_port(ServiceType::LLAMA_SERVICE));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    auto send_signal = [&](MgmtMsgType type, uint64_t ts) {
+        uint8_t frame[4 + 14];
+        size_t len = ts ? 14 : 5;
+        uint32_t net_len = htonl(static_cast<uint32_t>(len));
+        memcpy(frame, &net_len, 4);
+        frame[4] = static_cast<uint8_t>(type);
+        uint32_t net_cid = htonl(11);
+        memcpy(frame + 5, &net_cid, 4);
+        for (int i = 0; i < 8; i++) frame[9 + i] = static_cast<uint8_t>(ts >> (56 - 8 * i));
+        frame[17] = static_cast<uint8_t>(ServiceType::VAD_SERVICE);
+        ASSERT_TRUE(send_all_raw(s, frame, 4 + len));
+    };
+    send_signal(MgmtMsgType::SPEECH_ACTIVE, 2000);
+    send_signal(MgmtMsgType::SPEECH_IDLE, 1000);    // overtaken
+    send_signal(MgmtMsgType::SPEECH_ACTIVE, 2000);  // duplicate
+    send_signal(MgmtMsgType::SPEECH_IDLE, 3000);
+    send_signal(MgmtMsgType::SPEECH_ACTIVE, 0);     // legacy
+    for (int i = 0; i < 100; i++) {
+        {
+            std::lock_guard<std::mutex> lock(seen_mutex);
+            if (seen.size() >= 3) break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        EXPECT_EQ(seen, (std::vector<bool>{true, false, true}));
+    }
+    EXPECT_TRUE(llama.is_speech_active(11));
+    ::close(s);
+    llama.shutdown();
+}
+
+TEST(EngineClientTest, SpeechBusSignalsBypassTheDock) {
+    FakeDock dock;
+    ASSERT_TRUE(dock.start());
+    std::atomic<int> speech_events{0};
+    std::atomic<bool> last_active{false};
+    EngineClient client;
+    client.set_name("kokoro-test");
+    client.set_endpoint("127.0.0.1", dock.port);
+    client.register_speech_signal_handler([&](uint32_t, bool a) {
+        speech_events++;
+        last_active = a;
+    });
+    ASSERT_TRUE(client.start());
+    int s1 = dock.accept_one();
+    ASSERT_GE(s1, 0);
+    std::string line;
+    ASSERT_TRUE(read_hello_line(s1, line));
+    ASSERT_TRUE(send_all_raw(s1, "OK\n", 3));
+
+    InterconnectNode vad(ServiceType::VAD_SERVICE);
+    vad.disable_downstream_connect();
+    ASSERT_TRUE(vad.initialize());
+    if (!vad.speech_bus_active()) GTEST_SKIP() << "no multicast on loopback";
+    vad.broadcast_speech_signal(21, true);
+    for (int i = 0; i < 200 && speech_events < 1; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_EQ(speech_events.load(), 1);
+    EXPECT_TRUE(last_active.load());
+
+    // The dock's relayed copy (no timestamp) is now redundant.
+    uint8_t frame[6];
+    frame[0] = 0x02;
+    frame[1] = (uint8_t)MgmtMsgType::SPEECH_IDLE;
+    uint32_t net_cid = htonl(21);
+    memcpy(frame + 2, &net_cid, 4);
+    ASSERT_TRUE(send_all_raw(s1, frame, 6));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(speech_events.load(), 1);
+    EXPECT_TRUE(last_active.load());
+
+    vad.shutdown();
+    ::close(s1);
+    client.shutdown();
+}
+
+static void run_unix_transport(IcUnixMode mode) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(false);
+    upstream.set_unix_transport(mode);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    downstream.register_custom_negotiation_handler([](const std::string& msg) {
+        return "ECHO:" + msg;
+    });
+    EXPECT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+    ASSERT_EQ(upstream.downstream_transport(), mode);
+
+    EXPECT_EQ(upstream.send_custom_to_downstream("unix"), "ECHO:unix");
+
+    std::vector<uint8_t> frame(160);
+    for (size_t i = 0; i < frame.size(); ++i) frame[i] = static_cast<uint8_t>(i);
+    Packet out(3, frame.data(), frame.size());
+    Packet in;
+    ASSERT_TRUE(upstream.send_to_downstream(out));
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    EXPECT_EQ(in.call_id, 3u);
+    EXPECT_TRUE(in.payload == frame);
+
+    // Pooled frames below and above the receive guess, back to back.
+    for (size_t size : {size_t(172), size_t(48000), size_t(200)}) {
+        auto pooled = upstream.make_packet(4, size);
+        for (size_t i = 0; i < size; ++i) pooled.payload()[i] = static_cast<uint8_t>(i * 7);
+        ASSERT_TRUE(upstream.send_to_downstream(std::move(pooled)));
+        PooledPacket pin;
+        ASSERT_TRUE(downstream.recv_from_upstream(pin, 2000));
+        EXPECT_EQ(pin.call_id, 4u);
+        ASSERT_EQ(pin.payload_size, size);
+        bool same = true;
+        for (size_t i = 0; i < size; ++i) same = same && pin.payload()[i] == static_cast<uint8_t>(i * 7);
+        EXPECT_TRUE(same);
+    }
+
+    std::vector<uint8_t> big(Packet::MAX_PAYLOAD_SIZE);
+    for (size_t i = 0; i < big.size(); ++i) big[i] = static_cast<uint8_t>(i * 31 + 7);
+    Packet large(5, big.data(), big.size());
+    std::thread sender([&]() { EXPECT_TRUE(upstream.send_to_downstream(large)); });
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 5000));
+    sender.join();
+    EXPECT_EQ(in.call_id, 5u);
+    EXPECT_TRUE(in.payload == big);
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(UnixTransportTest, FramesCrossSeqpacketLink) {
+    if (!IC_UNIX_SEQPACKET_SUPPORTED) GTEST_SKIP() << "no SOCK_SEQPACKET";
+    run_unix_transport(IcUnixMode::SEQPACKET);
+}
+
+TEST(UnixTransportTest, FramesCrossUnixStreamLink) {
+    run_unix_transport(IcUnixMode::STREAM);
+}
+
+TEST(UnixTransportTest, EncryptedFramesCrossSeqpacketLink) {
+    if (!IC_UNIX_SEQPACKET_SUPPORTED) GTEST_SKIP() << "no SOCK_SEQPACKET";
+    ScopedIcEncryption enc;
+    run_unix_transport(IcUnixMode::SEQPACKET);
+}
+
+TEST(UnixTransportTest, PeerWithoutSocketPathIsReachedOverTcp) {
+    InterconnectNode upstream(ServiceType::SIP_CLIENT);
+    upstream.set_shm_transport(false);
+    upstream.set_unix_transport(IcUnixMode::SEQPACKET);
+    InterconnectNode downstream(ServiceType::INBOUND_AUDIO_PROCESSOR);
+    EXPECT_TRUE(downstream.initialize());
+    for (uint16_t port : {service_mgmt_port(ServiceType::INBOUND_AUDIO_PROCESSOR, 0),
+                          service_data_port(ServiceType::INBOUND_AUDIO_PROCESSOR, 0)}) {
+        ic_unix_unlink(port, IcUnixMode::SEQPACKET);
+        ic_unix_unlink(port, IcUnixMode::STREAM);
+    }
+    EXPECT_TRUE(upstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+    EXPECT_EQ(upstream.downstream_transport(), IcUnixMode::OFF);
+
+    Packet out(9, "tcp", 3);
+    Packet in;
+    ASSERT_TRUE(upstream.send_to_downstream(out));
+    ASSERT_TRUE(downstream.recv_from_upstream(in, 2000));
+    EXPECT_EQ(std::string(in.payload.begin(), in.payload.end()), "tcp");
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+static void run_batched_hop(IcUnixMode mode) {
+    InterconnectNode upstream(ServiceType::OUTBOUND_AUDIO_PROCESSOR);
+    upstream.set_shm_transport(false);
+    upstream.set_unix_transport(mode);
+    EXPECT_TRUE(upstream.initialize());
+    InterconnectNode downstream(ServiceType::SIP_CLIENT);
+    EXPECT_TRUE(downstream.initialize());
+    wait_tcp_pair(upstream, downstream);
+    ASSERT_EQ(upstream.downstream_transport(), mode);
+
+    // One tick for 100 calls, plus a frame larger than the read-ahead buffer.
+    std::vector<PooledPacket> tick;
+    for (uint32_t c = 1; c <= 100; c++) {
+        auto p = upstream.make_packet(c, 160);
+        memset(p.payload(), static_cast<int>(c), 160);
+        p.meta = FrameMeta(PayloadType::ULAW, 8000);
+        tick.push_back(std::move(p));
+    }
+    auto big = upstream.make_packet(101, 100000);
+    for (size_t i = 0; i < 100000; i++) big.payload()[i] = static_cast<uint8_t>(i * 13);
+    tick.push_back(std::move(big));
+    ASSERT_EQ(upstream.send_batch_to_downstream(tick), 101u);
+
+    // Batches of up to 40, then the rest one by one: both read the same stage.
+    std::vector<PooledPacket> got;
+    for (int i = 0; i < 20 && got.size() < 60; i++) downstream.recv_batch_from_upstream(got, 60 - got.size(), 2000);
+    ASSERT_EQ(got.size(), 60u);
+    while (got.size() < 101) {
+        PooledPacket p;
+        ASSERT_TRUE(downstream.recv_from_upstream(p, 2000));
+        got.push_back(std::move(p));
+    }
+    for (uint32_t c = 1; c <= 100; c++) {
+        const PooledPacket& p = got[c - 1];
+        ASSERT_EQ(p.call_id, c);
+        ASSERT_EQ(p.payload_size, 160u);
+        EXPECT_EQ(p.payload()[159], static_cast<uint8_t>(c));
+        EXPECT_EQ(p.meta.type, PayloadType::ULAW);
+        EXPECT_EQ(p.meta.seq, 1u);
+    }
+    ASSERT_EQ(got[100].payload_size, 100000u);
+    bool same = true;
+    for (size_t i = 0; i < 100000; i++) same = same && got[100].payload()[i] == static_cast<uint8_t>(i * 13);
+    EXPECT_TRUE(same);
+    EXPECT_EQ(downstream.frame_seq_stats().lost, 0u);
+
+    // Nothing left over: an idle batch read times out empty.
+    std::vector<PooledPacket> none;
+    EXPECT_EQ(downstream.recv_batch_from_upstream(none, 10, 50), 0u);
+
+    downstream.shutdown();
+    upstream.shutdown();
+}
+
+TEST(BatchTransportTest, TickBatchCrossesTcpHop) {
+    run_batched_hop(IcUnixMode::OFF);
+}
+
+TEST(BatchTransportTest, TickBatchCrossesSeqpacketHop) {
+    if (!IC_UNIX_SEQPACKET_SUPPORTED) GTEST_SKIP() << "no SOCK_SEQPACKET";
+    run_batched_hop(IcUnixMode::SEQPACKET);
+}
+
+TEST(BatchTransportTest, EncryptedTickBatchCrossesTcpHop) {
+    ScopedIcEncryption enc;
+    run_batched_hop(IcUnixMode::OFF);
+}
+
+static void check_send_batch(bool uring) {
+    static constexpr int CALLS = 8;
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(rx, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(rx, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    socklen_t alen = sizeof(addr);
+    getsockname(rx, reinterpret_cast<sockaddr*>(&addr), &alen);
+
+    int tx[CALLS];
+    for (int& s : tx) s = socket(AF_INET, SOCK_DGRAM, 0);
+    SendBatch batch(64);
+    if (batch.set_uring(uring) != uring) {
+        for (int s : tx) ::close(s);
+        ::close(rx);
+        GTEST_SKIP() << "io_uring unavailable";
+    }
+    uint8_t frames[CALLS + 2][172];
+    for (int i = 0; i < CALLS + 2; i++) {
+        memset(frames[i], i, sizeof(frames[i]));
+        // One socket per call, plus two more frames on the last call's socket.
+        int s = tx[std::min(i, CALLS - 1)];
+        EXPECT_EQ(batch.add(s, frames[i], sizeof(frames[i]), reinterpret_cast<sockaddr*>(&addr), alen),
+                  static_cast<size_t>(i));
+    }
+    EXPECT_EQ(batch.flush(), static_cast<size_t>(CALLS + 2));
+    for (int i = 0; i < CALLS + 2; i++) EXPECT_EQ(batch.result(i), 172);
+    // io_uring: one enter. Fallback: a sendmsg per socket, one sendmmsg for
+    // the run on Linux.
+#ifdef __linux__
+    const uint64_t fallback_calls = CALLS;
+#else
+    const uint64_t fallback_calls = CALLS + 2;
+#endif
+    EXPECT_EQ(batch.stats().syscalls, uring ? 1u : fallback_calls);
+    EXPECT_EQ(batch.stats().failed, 0u);
+
+    std::set<int> seen;
+    uint8_t buf[256];
+    pollfd pfd = {rx, POLLIN, 0};
+    while (seen.size() < CALLS + 2 && poll(&pfd, 1, 1000) > 0) {
+        ssize_t n = recv(rx, buf, sizeof(buf), 0);
+        ASSERT_EQ(n, 172);
+        seen.insert(buf[0]);
+    }
+    EXPECT_EQ(seen.size(), static_cast<size_t>(CALLS + 2));
+    for (int s : tx) ::close(s);
+    ::close(rx);
+}
+
+TEST(SendBatchTest, FallbackSendsEveryDatagram) {
+    check_send_batch(false);
+}
+
+TEST(SendBatchTest, IoUringSendsTickInOneEnter) {
+    check_send_batch(true);
+}
+
+// ---------------------------------------------------------------------------
+// Deferred logging (log-ring.h, LogForwarder)
+
+__attribute__((format(printf, 1, 2)))
+static std::string render_deferred(const char* fmt, ...) {
+    uint8_t args[LOG_ARGS_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    size_t len = log_capture_args(args, sizeof(args), fmt, ap);
+    va_end(ap);
+    char out[LOG_MESSAGE_MAX + 1];
+    log_render(out, sizeof(out), fmt, args, len);
+    return out;
+}
+
+template <typename... A>
+static std::string render_direct(const char* fmt, A... a) {
+    char out[LOG_MESSAGE_MAX + 1];
+    snprintf(out, sizeof(out), fmt, a...);
+    return out;
+}
+
+TEST(LogRingTest, DeferredFormattingMatchesSnprintf) {
+    std::string owned = "transient";
+    const char* text = "not terminated here";
+    int x = -42;
+    EXPECT_EQ(render_deferred("call %u: %d frames, %s", 7u, -3, owned.c_str()),
+              render_direct("call %u: %d frames, %s", 7u, -3, owned.c_str()));
+    EXPECT_EQ(render_deferred("[%-8s|%8s|%.3s|%.*s]", "ab", "cd", "efghij", 3, text),
+              render_direct("[%-8s|%8s|%.3s|%.*s]", "ab", "cd", "efghij", 3, text));
+    EXPECT_EQ(render_deferred("%lld %llu %ld %zu %zd %hhd %hu", -1234567890123LL, 18446744073709551615ULL,
+                              -7L, static_cast<size_t>(99), static_cast<ssize_t>(-5), 300, 70000),
+              render_direct("%lld %llu %ld %zu %zd %hhd %hu", -1234567890123LL, 18446744073709551615ULL,
+                            -7L, static_cast<size_t>(99), static_cast<ssize_t>(-5), 300, 70000));
+    EXPECT_EQ(render_deferred("%.1fus %5.2f %e %g %Lf 100%%", 12.345, 3.14159, 1e-9, 0.5, 2.5L),
+              render_direct("%.1fus %5.2f %e %g %Lf 100%%", 12.345, 3.14159, 1e-9, 0.5, 2.5L));
+    EXPECT_EQ(render_deferred("%x %08X %#o %c %+d % d %*d|%-*d|", 255u, 48879u, 8u, 'Z', 5, 6, 6, x, -6, x),
+              render_direct("%x %08X %#o %c %+d % d %*d|%-*d|", 255u, 48879u, 8u, 'Z', 5, 6, 6, x, -6, x));
+    EXPECT_EQ(render_deferred("%p %s", static_cast<void*>(&x), static_cast<const char*>(nullptr)),
+              render_direct("%p %s", static_cast<void*>(&x), static_cast<const char*>(nullptr)));
+
+    // The string is copied at capture time.
+    uint8_t args[LOG_ARGS_MAX];
+    char buf[16] = "before";
+    auto capture = [&](const char* fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        size_t len = log_capture_args(args, sizeof(args), fmt, ap);
+        va_end(ap);
+        return len;
+    };
+    size_t len = capture("value=%s", buf);
+    strcpy(buf, "after");
+    char out[64];
+    log_render(out, sizeof(out), "value=%s", args, len);
+    EXPECT_STREQ(out, "value=before");
+
+    // Output is cut at the buffer, like vsnprintf.
+    log_render(out, 8, "value=%s", args, len);
+    EXPECT_STREQ(out, "value=b");
+}
+
+TEST(LogRingTest, RingWrapsAndReportsFull) {
+    LogRing ring(8 * 1024);
+    auto write = [&](uint32_t call_id, const char* fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        bool ok = log_ring_write(ring, 2, call_id, fmt, ap);
+        va_end(ap);
+        return ok;
+    };
+    // Reserving needs room for a maximum-size record, so a small ring holds
+    // only a few before it reports full.
+    int written = 0;
+    while (write(static_cast<uint32_t>(written), "record %d", written)) written++;
+    EXPECT_GT(written, 0);
+    std::vector<uint32_t> seen;
+    char out[64];
+    for (int round = 0; round < 20; round++) {
+        ring.drain([&](const LogRecordHeader& hdr, const uint8_t* args) {
+            log_render(out, sizeof(out), hdr.fmt, args, hdr.args_len);
+            EXPECT_EQ(std::string(out), "record " + std::to_string(hdr.call_id));
+            seen.push_back(hdr.call_id);
+        });
+        while (write(static_cast<uint32_t>(written), "record %d", written)) written++;
+    }
+    ring.drain([&](const LogRecordHeader& hdr, const uint8_t*) { seen.push_back(hdr.call_id); });
+    ASSERT_EQ(seen.size(), static_cast<size_t>(written));
+    for (size_t i = 0; i < seen.size(); i++) EXPECT_EQ(seen[i], i);
+    EXPECT_TRUE(ring.empty());
+}
+
+TEST(LogForwarderTest, ThreadsLogThroughBatchDatagrams) {
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(rx, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(rx, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    socklen_t alen = sizeof(addr);
+    getsockname(rx, reinterpret_cast<sockaddr*>(&addr), &alen);
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    static constexpr int THREADS = 4, PER_THREAD = 300;
+    {
+        LogForwarder log;
+        log.init(ntohs(addr.sin_port), "TEST_SVC");
+        log.set_level(LogLevel::INFO);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < THREADS; t++) {
+            workers.emplace_back([&log, t]() {
+                for (int i = 0; i < PER_THREAD; i++) {
+                    std::string detail = "frame " + std::to_string(i);
+                    log.forward(LogLevel::INFO, static_cast<uint32_t>(t + 1), "worker %d entry %d (%s) %.2f",
+                                t, i, detail.c_str(), i / 4.0);
+                    log.forward(LogLevel::DEBUG, static_cast<uint32_t>(t + 1), "filtered %d", i);
+                    // Stay under the ring's capacity between drains.
+                    if (i % 100 == 99) std::this_thread::sleep_for(std::chrono::milliseconds(15));
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        log.flush();
+        EXPECT_EQ(log.dropped(), 0u);
+    }
+
+    uint64_t before = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    std::vector<uint8_t> buf(LOG_BATCH_DATAGRAM_BYTES + 1);
+    std::map<uint32_t, int> next;
+    int datagrams = 0, entries = 0;
+    pollfd pfd = {rx, POLLIN, 0};
+    while (entries < THREADS * PER_THREAD && poll(&pfd, 1, 1000) > 0) {
+        ssize_t n = recv(rx, buf.data(), buf.size(), 0);
+        ASSERT_GT(n, 0);
+        datagrams++;
+        ASSERT_TRUE(log_is_batch(buf.data(), static_cast<size_t>(n)));
+        EXPECT_TRUE(log_batch_decode(buf.data(), static_cast<size_t>(n),
+            [&](uint64_t wall_us, const char* text, size_t len) {
+                std::string entry(text, len);
+                unsigned call = 0;
+                int worker = -1, i = -1;
+                ASSERT_EQ(sscanf(entry.c_str(), "TEST_SVC INFO %u worker %d entry %d", &call, &worker, &i), 3)
+                    << entry;
+                EXPECT_EQ(call, static_cast<unsigned>(worker + 1));
+                char expect[128];
+                snprintf(expect, sizeof(expect), "TEST_SVC INFO %u worker %d entry %d (frame %d) %.2f",
+                         call, worker, i, i, i / 4.0);
+                EXPECT_EQ(entry, expect);
+                EXPECT_EQ(i, next[call]++) << "out of order for call " << call;
+                EXPECT_LE(wall_us, before + 1000000);
+                EXPECT_GT(wall_us + 60 * 1000000ull, before);
+                entries++;
+            }));
+    }
+    EXPECT_EQ(entries, THREADS * PER_THREAD);
+    EXPECT_LT(datagrams, entries / 10);
+    ::close(rx);
+}
+
+TEST(LogForwarderTest, ThreadAlternatingForwardersKeepsOneRingEach) {
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(rx, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(rx, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    socklen_t alen = sizeof(addr);
+    getsockname(rx, reinterpret_cast<sockaddr*>(&addr), &alen);
+
+    LogForwarder a, b;
+    a.init(ntohs(addr.sin_port), "TEST_A");
+    b.init(ntohs(addr.sin_port), "TEST_B");
+    std::thread worker([&]() {
+        for (int i = 0; i < 200; i++) {
+            (i % 2 ? b : a).forward(LogLevel::INFO, 1, "entry %d", i);
+        }
+        // Every switch found its ring: one per forwarder, none retired.
+        EXPECT_EQ(a.thread_rings(), 1u);
+        EXPECT_EQ(b.thread_rings(), 1u);
+    });
+    worker.join();
+    // The thread's exit retires both; the drain releases them.
+    a.flush();
+    b.flush();
+    EXPECT_EQ(a.thread_rings(), 0u);
+    EXPECT_EQ(b.thread_rings(), 0u);
+    EXPECT_EQ(a.dropped() + b.dropped(), 0u);
+    ::close(rx);
+}
+
+TEST(MetricsTest, RegistryRendersPrometheusTextAndJson) {
+    MetricsRegistry reg;
+    reg.counter("t_frames_total", "Frames", {{"call", "1"}}).inc(3);
+    reg.counter("t_frames_total", "Frames", {{"call", "2"}}).inc();
+    reg.gauge("t_depth", "Depth").set(-4);
+    LatencyHistogram& h = reg.histogram("t_latency_us", "Latency");
+    for (uint64_t v : {1, 2, 3, 900, 1500, 100000000}) h.record(v);
+    MetricsCollector collector([](MetricsWriter& w) {
+        w.counter("t_frames_total", "Frames", {{"call", "3"}}, 7);
+    }, reg);
+
+    // Registration hands out the same series again; a type clash is refused.
+    EXPECT_EQ(reg.counter("t_frames_total", "Frames", {{"call", "1"}}).value(), 3u);
+    reg.gauge("t_frames_total", "Frames").set(1);
+
+    std::string text = reg.render(false, {{"service", "T"}});
+    EXPECT_EQ(text.rfind("# HELP t_frames_total Frames\n# TYPE t_frames_total counter\n"
+                         "t_frames_total{service=\"T\",call=\"1\"} 3\n"
+                         "t_frames_total{service=\"T\",call=\"2\"} 1\n"
+                         "t_frames_total{service=\"T\",call=\"3\"} 7\n", 0), 0u) << text;
+    EXPECT_NE(text.find("# TYPE t_depth gauge\nt_depth{service=\"T\"} -4\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("# TYPE t_latency_us histogram\n"), std::string::npos);
+    EXPECT_NE(text.find("t_latency_us_bucket{service=\"T\",le=\"1\"} 1\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("t_latency_us_bucket{service=\"T\",le=\"3\"} 3\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("t_latency_us_bucket{service=\"T\",le=\"1023\"} 4\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("t_latency_us_bucket{service=\"T\",le=\"67108863\"} 5\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("t_latency_us_bucket{service=\"T\",le=\"+Inf\"} 6\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("t_latency_us_sum{service=\"T\"} 100002406\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("t_latency_us_count{service=\"T\"} 6\n"), std::string::npos) << text;
+
+    std::string json = reg.render(true, {{"service", "T"}});
+    EXPECT_EQ(json.rfind("{\"service\":\"T\",\"metrics\":[", 0), 0u) << json;
+    EXPECT_NE(json.find("{\"name\":\"t_frames_total\",\"type\":\"counter\",\"labels\":{\"call\":\"1\"},"
+                        "\"value\":3}"), std::string::npos) << json;
+    EXPECT_NE(json.find("\"name\":\"t_latency_us\",\"type\":\"histogram\",\"labels\":{},\"count\":6,"),
+              std::string::npos) << json;
+    EXPECT_NE(json.find("\"max\":100000000}"), std::string::npos) << json;
+}
+
+TEST(MetricsTest, RetiredSeriesLeaveTheScrapeAndAreReused) {
+    MetricsRegistry reg;
+    Counter& a = reg.counter("t_call_frames_total", "Frames", {{"call", "1"}});
+    a.inc(5);
+    reg.counter("t_call_frames_total", "Frames", {{"call", "2"}}).inc();
+    EXPECT_EQ(reg.series_count(), 2u);
+
+    reg.retire("t_call_frames_total", {{"call", "1"}});
+    reg.retire("t_call_frames_total", {{"call", "9"}});
+    EXPECT_EQ(reg.series_count(), 1u);
+    EXPECT_EQ(reg.render(false).find("call=\"1\""), std::string::npos);
+
+    // The next call takes over the retired storage, zeroed.
+    Counter& b = reg.counter("t_call_frames_total", "Frames", {{"call", "3"}});
+    EXPECT_EQ(&a, &b);
+    EXPECT_EQ(b.value(), 0u);
+    std::string text = reg.render(false);
+    EXPECT_NE(text.find("t_call_frames_total{call=\"3\"} 0\n"), std::string::npos) << text;
+    EXPECT_NE(text.find("t_call_frames_total{call=\"2\"} 1\n"), std::string::npos) << text;
+}
+
+// Runs decode + both upsamplers over `ulaw` in frames of `frame` bytes,
+// carrying the FIR history, with one set of kernels.
+static void dsp_path(const DspKernels& k, const std::vector<uint8_t>& ulaw, size_t frame,
+                     std::vector<float>& decoded, std::vector<float>& up16, std::vector<float>& up24) {
+    decoded.assign(ulaw.size(), 0.0f);
+    up16.assign(2 * ulaw.size(), 0.0f);
+    up24.assign(3 * ulaw.size(), 0.0f);
+    float h16[IAP_FIR_CENTER] = {};
+    float h24[IAP_FIR_24K_CENTER] = {};
+    for (size_t at = 0; at < ulaw.size(); at += frame) {
+        size_t n = std::min(frame, ulaw.size() - at);
+        k.ulaw_decode(ulaw.data() + at, n, decoded.data() + at);
+        iap_fir_upsample_frame(decoded.data() + at, n, up16.data() + 2 * at, h16, k);
+        iap_fir_upsample_frame_24k(decoded.data() + at, n, up24.data() + 3 * at, h24, k);
+    }
+}
+
+TEST(DspKernelTest, SimdKernelsMatchScalarReference) {
+    // Every code point, then noise; frame sizes that leave SIMD tails and
+    // frames shorter than the filter history.
+    std::vector<uint8_t> ulaw(4000);
+    uint32_t x = 777;
+    for (size_t i = 0; i < ulaw.size(); i++) {
+        x = x * 1103515245u + 12345u;
+        ulaw[i] = i < 256 ? static_cast<uint8_t>(i) : static_cast<uint8_t>(x >> 16);
+    }
+    const DspKernels* ref = dsp_kernels_for(DspIsa::SCALAR);
+    ASSERT_NE(ref, nullptr);
+    ASSERT_NE(dsp_kernels_for(dsp_kernels().isa), nullptr);
+
+    auto same = [](const std::vector<float>& a, const std::vector<float>& b) {
+#if defined(__x86_64__)
+        return std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+#else
+        for (size_t i = 0; i < a.size(); i++) {
+            if (std::fabs(a[i] - b[i]) > 1e-6f) return false;
+        }
+        return true;
+#endif
+    };
+
+    int tested = 0;
+    for (DspIsa isa : {DspIsa::SSE2, DspIsa::AVX2, DspIsa::NEON}) {
+        const DspKernels* k = dsp_kernels_for(isa);
+        if (!k) continue;
+        tested++;
+        for (size_t frame : {size_t(IAP_ULAW_FRAME), size_t(37), size_t(5)}) {
+            std::vector<float> rd, r16, r24, d, u16, u24;
+            dsp_path(*ref, ulaw, frame, rd, r16, r24);
+            dsp_path(*k, ulaw, frame, d, u16, u24);
+            EXPECT_EQ(std::memcmp(rd.data(), d.data(), rd.size() * sizeof(float)), 0)
+                << dsp_isa_name(isa) << " decode, frame " << frame;
+            EXPECT_TRUE(same(r16, u16)) << dsp_isa_name(isa) << " 16 kHz, frame " << frame;
+            EXPECT_TRUE(same(r24, u24)) << dsp_isa_name(isa) << " 24 kHz, frame " << frame;
+        }
+    }
+#if defined(__x86_64__) || defined(__aarch64__)
+    EXPECT_GT(tested, 0);
+#endif
+}
+
+TEST(DspKernelTest, SumSquaresMatchesScalarWithinRounding) {
+    // Lane-wise sums round differently from the scalar loop; lengths cover
+    // every SIMD tail and a whole VAD frame at an unaligned start.
+    std::vector<float> x(1000);
+    uint32_t r = 4242;
+    for (auto& v : x) {
+        r = r * 1103515245u + 12345u;
+        v = static_cast<float>(static_cast<int32_t>(r >> 8) - (1 << 23)) / (1 << 23);
+    }
+    const DspKernels* ref = dsp_kernels_for(DspIsa::SCALAR);
+    for (DspIsa isa : {DspIsa::SCALAR, DspIsa::SSE2, DspIsa::AVX2, DspIsa::NEON}) {
+        const DspKernels* k = dsp_kernels_for(isa);
+        if (!k) continue;
+        for (size_t n : {size_t(0), size_t(1), size_t(3), size_t(7), size_t(15), size_t(33), size_t(800)}) {
+            float want = ref->sum_squares(x.data() + 1, n);
+            float got = k->sum_squares(x.data() + 1, n);
+            EXPECT_NEAR(got, want, 1e-5f * std::max(1.0f, want)) << dsp_isa_name(isa) << " n=" << n;
+        }
+    }
+    EXPECT_FLOAT_EQ(sum_squares(x.data(), 0), 0.0f);
+}
+
+TEST(IapArenaTest, SlotsKeepPerCallHistoryAndAreReused) {
+    IapCallArena arena(2);
+    // 40 calls interleaved frame by frame (the arena grows past its first
+    // 16 slots mid-stream) match 40 independent upsamplers.
+    constexpr int CALLS = 40;
+    std::vector<std::vector<float>> ref_hist(CALLS, std::vector<float>(IAP_FIR_CENTER, 0.0f));
+    float in[IAP_ULAW_FRAME], out[2 * IAP_ULAW_FRAME], ref_out[2 * IAP_ULAW_FRAME];
+    for (int frame = 0; frame < 3; frame++) {
+        for (int c = 0; c < CALLS; c++) {
+            for (int i = 0; i < IAP_ULAW_FRAME; i++) in[i] = std::sin(0.01f * (c + 1) * (frame * IAP_ULAW_FRAME + i));
+            uint32_t slot = arena.acquire(1000 + c, frame);
+            iap_fir_upsample_frame(in, IAP_ULAW_FRAME, out, arena.hist16(1, slot));
+            iap_fir_upsample_frame(in, IAP_ULAW_FRAME, ref_out, ref_hist[c].data());
+            ASSERT_EQ(std::memcmp(out, ref_out, sizeof(out)), 0) << "call " << c << " frame " << frame;
+        }
+    }
+    EXPECT_EQ(arena.size(), static_cast<size_t>(CALLS));
+    EXPECT_EQ(arena.slots(), static_cast<size_t>(CALLS));
+
+    // A released slot comes back zeroed for the next call.
+    uint32_t slot = arena.find(1005);
+    ASSERT_NE(slot, IapCallArena::NO_SLOT);
+    arena.clips(0, slot) = 3;
+    EXPECT_TRUE(arena.release(1005));
+    EXPECT_FALSE(arena.release(1005));
+    EXPECT_EQ(arena.find(1005), IapCallArena::NO_SLOT);
+    bool created = false;
+    EXPECT_EQ(arena.acquire(2000, 10, &created), slot);
+    EXPECT_TRUE(created);
+    EXPECT_EQ(arena.clips(0, slot), 0u);
+    for (int i = 0; i < IAP_FIR_CENTER; i++) EXPECT_EQ(arena.hist16(1, slot)[i], 0.0f);
+    EXPECT_EQ(arena.slots(), static_cast<size_t>(CALLS));
+
+    // Only calls idle since before the cutoff are released.
+    std::vector<uint32_t> idle;
+    EXPECT_EQ(arena.release_idle(5, [&](uint32_t id) { idle.push_back(id); }), static_cast<size_t>(CALLS - 1));
+    EXPECT_EQ(idle.size(), static_cast<size_t>(CALLS - 1));
+    EXPECT_EQ(arena.size(), 1u);
+    EXPECT_EQ(arena.call_id(arena.find(2000)), 2000u);
+}
+
+namespace {
+
+std::vector<uint8_t> jb_rtp_packet(uint16_t seq, uint32_t ts, const std::vector<uint8_t>& payload, uint8_t pt = 0) {
+    std::vector<uint8_t> p(12 + payload.size());
+    p[0] = 0x80;
+    p[1] = pt;
+    p[2] = seq >> 8;
+    p[3] = seq & 0xFF;
+    for (int i = 0; i < 4; i++) {
+        p[4 + i] = static_cast<uint8_t>(ts >> (24 - 8 * i));
+        p[8 + i] = static_cast<uint8_t>(0x1234abcdu >> (24 - 8 * i));
+    }
+    std::copy(payload.begin(), payload.end(), p.begin() + 12);
+    return p;
+}
+
+// 20 ms of a 200 Hz tone (a 40-sample period) continuing from frame `index`.
+std::vector<uint8_t> jb_tone_frame(int index, float amp = 0.5f) {
+    std::vector<uint8_t> f(IAP_ULAW_FRAME);
+    for (int k = 0; k < IAP_ULAW_FRAME; k++) {
+        float v = amp * std::sin(2.0f * static_cast<float>(M_PI) * (index * IAP_ULAW_FRAME + k) / 40.0f);
+        f[k] = linear_to_ulaw(static_cast<int16_t>(std::lrint(v * 32768.0f)));
+    }
+    return f;
+}
+
+struct JbArrival {
+    int64_t at_us;
+    std::vector<uint8_t> pkt;
+};
+
+struct JbPlayed {
+    RtpJitterBuffer::Frame frame;
+    std::vector<uint8_t> bytes;
+};
+
+// Delivers the packets at their arrival times and plays out on a 1 ms clock
+// until end_us, as rtp_receiver_loop does.
+std::vector<JbPlayed> jb_run(RtpJitterBuffer& jb, std::vector<JbArrival> arrivals, int64_t start_us, int64_t end_us) {
+    std::stable_sort(arrivals.begin(), arrivals.end(),
+                     [](const JbArrival& a, const JbArrival& b) { return a.at_us < b.at_us; });
+    std::vector<JbPlayed> out;
+    size_t next = 0;
+    uint8_t buf[RtpJitterBuffer::MAX_PACKET];
+    for (int64_t now = start_us; now < end_us; now += 1000) {
+        while (next < arrivals.size() && arrivals[next].at_us <= now) {
+            jb.push(arrivals[next].pkt.data(), arrivals[next].pkt.size(), arrivals[next].at_us);
+            next++;
+        }
+        while (jb.ready(now)) {
+            auto f = jb.pop(now, buf);
+            if (f.bytes == 0) break;
+            out.push_back({f, std::vector<uint8_t>(buf, buf + f.bytes)});
+        }
+    }
+    return out;
+}
+
+}
+
+TEST(JitterBufferTest, ReordersAndConcealsOnThePlayoutClock) {
+    // Frames 0-2 arrive together 30 ms late, so the playout clock anchored on
+    // frame 0 leaves the rest 40 ms of slack. Frames 5 and 6 arrive swapped, 10 never
+    // arrives, 20 arrives after its playout time, 3 arrives twice.
+    constexpr int N = 40;
+    std::vector<JbArrival> arrivals;
+    for (int i = 0; i < N; i++) {
+        if (i == 10) continue;
+        int64_t at = i * 20000 + 1000;
+        if (i < 3) at = 31000 + i * 1000;
+        if (i == 5) at += 22000;
+        if (i == 20) at += 60000;
+        arrivals.push_back({at, jb_rtp_packet(static_cast<uint16_t>(65530 + i), 1000 + i * 160, jb_tone_frame(i))});
+    }
+    arrivals.push_back({3 * 20000 + 5000, jb_rtp_packet(65533, 1000 + 3 * 160, jb_tone_frame(3))});
+    arrivals.push_back({50000, jb_rtp_packet(7, 0, std::vector<uint8_t>(4, 0), 101)});
+
+    // Stop just after frame 39's playout time (41 ms + 39 × 20 ms), before
+    // the trailing concealment that follows the end of a stream.
+    RtpJitterBuffer jb;
+    auto played = jb_run(jb, arrivals, 0, N * 20000 + 35000);
+
+    ASSERT_EQ(played.size(), static_cast<size_t>(N));
+    for (int i = 0; i < N; i++) {
+        const auto& p = played[i];
+        ASSERT_EQ(p.frame.bytes, 12u + IAP_ULAW_FRAME) << i;
+        EXPECT_EQ((p.bytes[2] << 8) | p.bytes[3], i) << "output is renumbered without gaps";
+        EXPECT_EQ(p.frame.concealed, i == 10 || i == 20) << i;
+        if (p.frame.concealed) continue;
+        auto want = jb_tone_frame(i);
+        // The frame after a concealed one is cross-faded over its first 4 ms.
+        size_t from = (i == 11 || i == 21) ? RtpJitterBuffer::OLA_SAMPLES : 0;
+        EXPECT_TRUE(std::equal(want.begin() + from, want.end(), p.bytes.begin() + 12 + from)) << i;
+    }
+    // Concealment continues the tone: the first 10 ms stay close to it.
+    const float* t = ulaw_float_table();
+    auto want10 = jb_tone_frame(10);
+    for (int k = 0; k < 80; k++) EXPECT_NEAR(t[played[10].bytes[12 + k]], t[want10[k]], 0.05f) << k;
+
+    const auto& st = jb.stats();
+    EXPECT_EQ(st.received, static_cast<uint64_t>(N - 2));
+    EXPECT_EQ(st.played, static_cast<uint64_t>(N - 2));
+    EXPECT_EQ(st.concealed, 2u);
+    EXPECT_EQ(st.late, 1u);
+    EXPECT_EQ(st.duplicate, 1u);
+    EXPECT_EQ(st.ignored, 1u);
+    EXPECT_EQ(st.target_us, RtpJitterBuffer::MIN_DELAY_US);
+    EXPECT_NEAR(st.loss_ratio(), 2.0 / N, 1e-9);
+}
+
+TEST(JitterBufferTest, ConcealmentFadesOutAndPlayoutRestartsAfterAPause) {
+    for (int b = 0; b < 256; b++) {
+        if (b == 0x7F) continue;   // −0 encodes as +0
+        EXPECT_EQ(linear_to_ulaw(static_cast<int16_t>(std::lrint(ulaw_float_table()[b] * 32768.0f))), b) << b;
+    }
+
+    // 10 frames of tone, silence for 500 ms, then 5 more frames.
+    std::vector<JbArrival> arrivals;
+    for (int i = 0; i < 10; i++) arrivals.push_back({i * 20000, jb_rtp_packet(i, i * 160, jb_tone_frame(i))});
+    for (int i = 35; i < 40; i++) arrivals.push_back({i * 20000, jb_rtp_packet(i, i * 160, jb_tone_frame(i))});
+
+    RtpJitterBuffer jb;
+    auto played = jb_run(jb, arrivals, 0, 800000);
+    ASSERT_EQ(played.size(), 10u + RtpJitterBuffer::MAX_CONCEAL_FRAMES + 5u);
+
+    auto peak = [](const JbPlayed& p, size_t from, size_t to) {
+        float m = 0;
+        for (size_t k = from; k < to; k++) m = std::max(m, std::fabs(ulaw_float_table()[p.bytes[12 + k]]));
+        return m;
+    };
+    EXPECT_GT(peak(played[10], 0, 80), 0.45f);
+    EXPECT_LT(peak(played[11], 0, 160), peak(played[10], 80, 160));
+    EXPECT_LT(peak(played[12], 150, 160), 0.02f);
+    for (int i = 10; i < 13; i++) EXPECT_TRUE(played[i].frame.concealed);
+    EXPECT_EQ(jb.stats().rebuffers, 1u);
+
+    // Playout picks up again one target delay after the stream resumes.
+    EXPECT_FALSE(played[13].frame.concealed);
+    EXPECT_EQ(played[13].frame.arrival_us, 35 * 20000);
+    EXPECT_EQ(jb.stats().played, 15u);
+    EXPECT_EQ(jb.stats().concealed, 3u);
+    EXPECT_EQ(jb.stats().delay_us, RtpJitterBuffer::MIN_DELAY_US);
+}
+
+TEST(JitterBufferTest, DelayFollowsJitter) {
+    // 4 s clean, 10 s with up to 60 ms of random delay, 20 s clean again.
+    std::vector<JbArrival> arrivals;
+    uint32_t x = 7;
+    constexpr int CLEAN1 = 200, JITTERY = 500, CLEAN2 = 1000;
+    for (int i = 0; i < CLEAN1 + JITTERY + CLEAN2; i++) {
+        int64_t at = i * 20000 + 1000;
+        if (i >= CLEAN1 && i < CLEAN1 + JITTERY) {
+            x = x * 1103515245u + 12345u;
+            at += (x >> 16) % 60000;
+        }
+        arrivals.push_back({at, jb_rtp_packet(static_cast<uint16_t>(i), i * 160, jb_tone_frame(i, 0.2f))});
+    }
+
+    RtpJitterBuffer jb;
+    auto clean = jb_run(jb, {arrivals.begin(), arrivals.begin() + CLEAN1}, 0, CLEAN1 * 20000);
+    EXPECT_EQ(jb.stats().target_us, RtpJitterBuffer::MIN_DELAY_US);
+    EXPECT_LE(jb.stats().delay_us, RtpJitterBuffer::MIN_DELAY_US + 1000);
+    EXPECT_EQ(jb.stats().concealed, 0u);
+
+    auto jittery = jb_run(jb, {arrivals.begin() + CLEAN1, arrivals.begin() + CLEAN1 + JITTERY},
+                          CLEAN1 * 20000, (CLEAN1 + JITTERY) * 20000);
+    EXPECT_GE(jb.stats().target_us, 40000);
+    EXPECT_GT(jb.stats().stretched, 0u);
+    // Once the delay has grown, the second half of the jittery stretch loses little.
+    uint64_t concealed_late = 0;
+    for (size_t i = jittery.size() / 2; i < jittery.size(); i++) concealed_late += jittery[i].frame.concealed;
+    EXPECT_LT(concealed_late, jittery.size() / 20);
+
+    jb_run(jb, {arrivals.begin() + CLEAN1 + JITTERY, arrivals.end()},
+           (CLEAN1 + JITTERY) * 20000, (CLEAN1 + JITTERY + CLEAN2) * 20000 + 300000);
+    EXPECT_EQ(jb.stats().target_us, RtpJitterBuffer::MIN_DELAY_US);
+    EXPECT_GT(jb.stats().dropped, 0u);
+    EXPECT_LE(jb.stats().delay_us, RtpJitterBuffer::MIN_DELAY_US + 20000);
+}
+
+// Writes [first, first + n) as consecutive integers through push().
+static bool ring_push_seq(MirroredRing<float>& ring, uint32_t first, size_t n) {
+    std::vector<float> v(n);
+    for (size_t i = 0; i < n; i++) v[i] = static_cast<float>(first + i);
+    return ring.push(v.data(), n);
+}
+
+TEST(AudioRingTest, SpansStayContiguousAcrossTheWrap) {
+    for (bool mapping : {true, false}) {
+        MirroredRing<float> ring(4096, mapping);
+#if defined(__linux__)
+        if (mapping) {
+            EXPECT_TRUE(ring.mapped()) << "memfd_create + posix_fallocate";
+        }
+#endif
+        if (mapping && !ring.mapped()) continue;   // no memory object here: the fallback is tested below
+        ASSERT_EQ(ring.capacity(), 4096u);
+
+        // 3000 in, 2500 consumed, 3000 more: the second run wraps the end.
+        ASSERT_TRUE(ring_push_seq(ring, 0, 3000));
+        ring.release(2500);
+        EXPECT_FALSE(ring_push_seq(ring, 3000, 3597)) << "only 3596 free";
+        ASSERT_TRUE(ring_push_seq(ring, 3000, 3000));
+        EXPECT_EQ(ring.head(), 6000u);
+
+        const float* run = ring.span(2500);
+        bool ok = true;
+        for (uint32_t i = 0; i < 3500; i++) ok &= run[i] == static_cast<float>(2500 + i);
+        EXPECT_TRUE(ok) << (mapping ? "mapped" : "fallback");
+
+        // reserve/commit writes in place, wrapping included.
+        ring.release(6000);
+        float* dst = ring.reserve(4000);
+        ASSERT_NE(dst, nullptr);
+        for (uint32_t i = 0; i < 4000; i++) dst[i] = static_cast<float>(6000 + i);
+        ring.commit(4000);
+        run = ring.span(6000);
+        ok = true;
+        for (uint32_t i = 0; i < 4000; i++) ok &= run[i] == static_cast<float>(6000 + i);
+        EXPECT_TRUE(ok) << (mapping ? "mapped" : "fallback");
+        EXPECT_EQ(ring.reserve(97), nullptr);
+    }
+}
+
+TEST(AudioRingTest, ConsumerSeesEverySampleInOrder) {
+    MirroredRing<float> ring(1 << 14);
+    constexpr uint32_t TOTAL = 1 << 20;
+    std::thread producer([&] {
+        uint32_t next = 0;
+        while (next < TOTAL) {
+            size_t n = std::min<uint32_t>(160 + next % 700, TOTAL - next);
+            if (ring_push_seq(ring, next, n)) next += n;
+            else std::this_thread::yield();
+        }
+    });
+    uint64_t pos = 0;
+    uint32_t bad = 0;
+    while (pos < TOTAL) {
+        uint64_t head = ring.head();
+        if (head == pos) {
+            std::this_thread::yield();
+            continue;
+        }
+        const float* run = ring.span(pos);
+        for (uint64_t i = 0; i < head - pos; i++) bad += run[i] != static_cast<float>(pos + i);
+        pos = head;
+        ring.release(pos);
+    }
+    producer.join();
+    EXPECT_EQ(bad, 0u);
+}
+
+TEST(AudioRingTest, LatestValueHandsOverTheNewestStore) {
+    LatestValue<PacketTrace> cell;
+    EXPECT_EQ(cell.load().hop_count, 0);
+    PacketTrace t;
+    t.hop_count = 1;
+    cell.store(t);
+    t.hop_count = 2;
+    cell.store(t);
+    EXPECT_EQ(cell.load().hop_count, 2);
+    EXPECT_EQ(cell.load().hop_count, 2);   // nothing new: the last value again
+    t.hop_count = 3;
+    cell.store(t);
+    EXPECT_EQ(cell.load().hop_count, 3);
+}
+
+// Window 4 with 2 samples of context; P(speech) is the mean of the window,
+// the state counts steps, and every input is kept for inspection.
+class FakeVadBackend : public VadBackend {
+public:
+    const char* name() const override { return "fake"; }
+    size_t window() const override { return 4; }
+    size_t context() const override { return 2; }
+    size_t state_floats() const override { return 1; }
+    void infer(size_t n, const float* const* in, float* const* state, float* prob) override {
+        batches.push_back(n);
+        for (size_t i = 0; i < n; i++) {
+            inputs.emplace_back(in[i], in[i] + 6);
+            state[i][0] += 1.0f;
+            prob[i] = (in[i][2] + in[i][3] + in[i][4] + in[i][5]) / 4.0f;
+        }
+    }
+    std::vector<size_t> batches;
+    std::vector<std::vector<float>> inputs;
+};
+
+TEST(VadBackendTest, ScoresWindowsBatchedAcrossStreams) {
+    FakeVadBackend b;
+    // Stream 0: 13 samples (3 whole windows); stream 1: 5 samples (1).
+    std::vector<std::vector<float>> audio = {
+        {1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 0, 0, 9},
+        {0.5f, 0.5f, 0.5f, 0.5f, 7}};
+    std::vector<VadNeuralStream> streams(2);
+    for (auto& s : streams) s.reset(b, 64);
+    VadNeuralStream* ptrs[2] = {&streams[0], &streams[1]};
+    VadScoreBatch batch;
+    auto head = [&](size_t i) { return static_cast<uint64_t>(audio[i].size()); };
+    auto span = [&](size_t i, uint64_t pos) { return audio[i].data() + pos; };
+
+    EXPECT_EQ(vad_score_pending(b, ptrs, 2, head, span, batch), 4u);
+    EXPECT_EQ(b.batches, (std::vector<size_t>{2, 1, 1}));
+    EXPECT_EQ(streams[0].scored(), 12u);
+    EXPECT_EQ(streams[1].scored(), 4u);
+    EXPECT_EQ(streams[0].state()[0], 3.0f);
+    EXPECT_EQ(streams[1].state()[0], 1.0f);
+
+    // The first window is zero-padded in front; later ones read their
+    // context from the stream.
+    EXPECT_EQ(b.inputs[0], (std::vector<float>{0, 0, 1, 1, 1, 1}));
+    EXPECT_EQ(b.inputs[2], (std::vector<float>{1, 1, 0, 0, 0, 0}));
+    EXPECT_EQ(streams[0].needed_from(), 10u);
+
+    // Frames weigh the windows they overlap.
+    EXPECT_TRUE(streams[0].covers(12));
+    EXPECT_FALSE(streams[0].covers(13));
+    EXPECT_FLOAT_EQ(streams[0].frame_prob(0, 4), 1.0f);
+    EXPECT_FLOAT_EQ(streams[0].frame_prob(2, 4), 0.5f);
+    EXPECT_FLOAT_EQ(streams[0].frame_prob(6, 6), (2 * 0.0f + 4 * 0.5f) / 6);
+
+    // Nothing new: no calls. One more sample completes stream 1's second window.
+    EXPECT_EQ(vad_score_pending(b, ptrs, 2, head, span, batch), 0u);
+    audio[1].insert(audio[1].end(), {7, 7, 7});
+    EXPECT_EQ(vad_score_pending(b, ptrs, 2, head, span, batch), 1u);
+    EXPECT_FLOAT_EQ(streams[1].frame_prob(4, 4), 7.0f);
+    EXPECT_EQ(b.inputs.back(), (std::vector<float>{0.5f, 0.5f, 7, 7, 7, 7}));
+}
+
+// Stands in for the ONNX session: P(speech) is the window's first sample,
+// h accumulates it and c counts steps, so a stream's state shows which rows
+// it was packed into. Records each batch and the last context sample per row.
+class StubSileroSession : public SileroSession {
+public:
+    void run(size_t n, const float* input, const float* state,
+             const float** prob, const float** state_out) override {
+        constexpr size_t IN = SileroBackend::CONTEXT + SileroBackend::WINDOW;
+        constexpr size_t H = SileroBackend::HIDDEN;
+        batches.push_back(n);
+        p_.resize(n);
+        s_.resize(2 * n * H);
+        for (size_t i = 0; i < n; i++) {
+            const float x = input[i * IN + SileroBackend::CONTEXT];
+            contexts.push_back(input[i * IN + SileroBackend::CONTEXT - 1]);
+            p_[i] = x;
+            for (size_t k = 0; k < H; k++) {
+                s_[i * H + k] = state[i * H + k] + x;
+                s_[(n + i) * H + k] = state[(n + i) * H + k] + 1.0f;
+            }
+        }
+        *prob = p_.data();
+        *state_out = s_.data();
+    }
+    std::vector<size_t> batches;
+    std::vector<float> contexts;
+
+private:
+    std::vector<float> p_, s_;
+};
+
+TEST(VadBackendTest, SileroPacksBatchAndCarriesStatePerStream) {
+    auto owned = std::make_unique<StubSileroSession>();
+    StubSileroSession* session = owned.get();
+    SileroBackend b(std::move(owned));
+    constexpr size_t W = SileroBackend::WINDOW, H = SileroBackend::HIDDEN;
+    // Stream 0: three windows at 0.1, 0.2, 0.3; stream 1: one at 0.9.
+    std::vector<std::vector<float>> audio(2);
+    for (float v : {0.1f, 0.2f, 0.3f}) audio[0].insert(audio[0].end(), W, v);
+    audio[1].assign(W, 0.9f);
+    std::vector<VadNeuralStream> streams(2);
+    for (auto& s : streams) s.reset(b, 4 * W);
+    VadNeuralStream* ptrs[2] = {&streams[0], &streams[1]};
+    VadScoreBatch batch;
+    auto head = [&](size_t i) { return static_cast<uint64_t>(audio[i].size()); };
+    auto span = [&](size_t i, uint64_t pos) { return audio[i].data() + pos; };
+
+    EXPECT_EQ(vad_score_pending(b, ptrs, 2, head, span, batch), 4u);
+    EXPECT_EQ(session->batches, (std::vector<size_t>{2, 1, 1}));
+    // Zero context before each stream's first window, then the stream's own.
+    EXPECT_EQ(session->contexts, (std::vector<float>{0, 0, 0.1f, 0.2f}));
+    EXPECT_FLOAT_EQ(streams[0].frame_prob(W, W), 0.2f);
+    EXPECT_FLOAT_EQ(streams[1].frame_prob(0, W), 0.9f);
+    // h in the first half of the state, c in the second, per stream.
+    for (size_t k = 0; k < H; k++) {
+        ASSERT_FLOAT_EQ(streams[0].state()[k], 0.6f);
+        ASSERT_FLOAT_EQ(streams[0].state()[H + k], 3.0f);
+        ASSERT_FLOAT_EQ(streams[1].state()[k], 0.9f);
+        ASSERT_FLOAT_EQ(streams[1].state()[H + k], 1.0f);
+    }
+
+    // Stream 1 goes on from its own state, alone in the batch.
+    audio[1].insert(audio[1].end(), W, 0.5f);
+    EXPECT_EQ(vad_score_pending(b, ptrs, 2, head, span, batch), 1u);
+    EXPECT_EQ(session->batches.back(), 1u);
+    EXPECT_FLOAT_EQ(streams[1].state()[0], 1.4f);
+    EXPECT_FLOAT_EQ(streams[1].state()[H], 2.0f);
+    EXPECT_FLOAT_EQ(streams[0].state()[H], 3.0f);
+}
+
+TEST(VadBackendTest, FactoryRejectsUnknownAndUnavailableBackends) {
+    std::string err;
+    EXPECT_EQ(make_vad_backend("energy", &err), nullptr);
+    EXPECT_TRUE(err.empty());
+    EXPECT_EQ(make_vad_backend("webrtc", &err), nullptr);
+    EXPECT_NE(err.find("unknown VAD backend"), std::string::npos);
+    EXPECT_EQ(make_vad_backend("silero:/nonexistent/silero_vad.onnx", &err), nullptr);
+    EXPECT_FALSE(err.empty());
+}
+
+TEST(SpeechPartialTest, FlagTravelsInFrameMetaOnlyToPeersThatOfferIt) {
+    FrameMeta meta(PayloadType::ULAW_UP16K, 16000);
+    meta.flags = FRAME_FLAG_PARTIAL;
+    uint8_t wire[FrameMeta::WIRE_BYTES];
+    meta.write_wire(wire);
+    FrameMeta out;
+    ASSERT_EQ(out.read_wire(wire, sizeof(wire)), FrameMeta::WIRE_BYTES);
+    EXPECT_EQ(out.flags, FRAME_FLAG_PARTIAL);
+    EXPECT_EQ(out.type, PayloadType::ULAW_UP16K);
+
+    InterconnectNode vad(ServiceType::VAD_SERVICE);
+    vad.set_shm_transport(false);
+    EXPECT_TRUE(vad.initialize());
+    InterconnectNode whisper(ServiceType::WHISPER_SERVICE);
+    whisper.accept_payload_type(PayloadType::ULAW_UP16K);
+    whisper.accept_frame_flags(FRAME_FLAG_PARTIAL);
+    EXPECT_TRUE(whisper.initialize());
+    wait_tcp_pair(vad, whisper);
+    EXPECT_TRUE(vad.downstream_accepts_flags(FRAME_FLAG_PARTIAL));
+    EXPECT_TRUE(vad.downstream_accepts(PayloadType::ULAW_UP16K));
+    EXPECT_FALSE(vad.downstream_accepts_flags(0x02));
+    whisper.shutdown();
+    vad.shutdown();
+
+    // A Whisper that does not offer the flag gets no partials.
+    InterconnectNode vad2(ServiceType::VAD_SERVICE);
+    vad2.set_shm_transport(false);
+    EXPECT_TRUE(vad2.initialize());
+    InterconnectNode legacy(ServiceType::WHISPER_SERVICE);
+    legacy.accept_payload_type(PayloadType::ULAW_UP16K);
+    EXPECT_TRUE(legacy.initialize());
+    wait_tcp_pair(vad2, legacy);
+    EXPECT_TRUE(vad2.downstream_accepts(PayloadType::ULAW_UP16K));
+    EXPECT_FALSE(vad2.downstream_accepts_flags(FRAME_FLAG_PARTIAL));
+    legacy.shutdown();
+    vad2.shutdown();
+}
+
+TEST(SpeechPartialTest, TextPartialOfferedLikeAnyPayloadType) {
+    EXPECT_STREQ(payload_type_name(PayloadType::TEXT_PARTIAL), "text_partial");
+    InterconnectNode whisper(ServiceType::WHISPER_SERVICE);
+    whisper.set_shm_transport(false);
+    EXPECT_TRUE(whisper.initialize());
+    InterconnectNode llama(ServiceType::LLAMA_SERVICE);
+    llama.accept_payload_type(PayloadType::TEXT_PARTIAL);
+    EXPECT_TRUE(llama.initialize());
+    wait_tcp_pair(whisper, llama);
+    EXPECT_TRUE(whisper.downstream_accepts(PayloadType::TEXT_PARTIAL));
+    llama.shutdown();
+    whisper.shutdown();
+}
+
+TEST(SpeechPartialTest, ScheduleFiresOnIntervalAndAtPauseOnset) {
+    constexpr size_t FRAME = 800, INTERVAL = 16000;
+    PartialSchedule sched;
+    sched.restart(4000);
+    std::vector<uint64_t> fired;
+    uint64_t end = 4000;
+    // 2.5 s of speech, then silence.
+    int silence = 0;
+    for (int f = 0; f < 70; f++) {
+        end += FRAME;
+        bool speech = f < 50;
+        silence = speech ? 0 : silence + 1;
+        if (sched.due(end, speech, silence, INTERVAL, PARTIAL_PAUSE_FRAMES)) {
+            fired.push_back(end);
+            sched.sent(end);
+        }
+    }
+    // Every second of speech, then once when the pause reaches 4 frames;
+    // silence alone never fires again.
+    ASSERT_EQ(fired.size(), 3u);
+    EXPECT_EQ(fired[0], 4000 + INTERVAL);
+    EXPECT_EQ(fired[1], 4000 + 2 * INTERVAL);
+    EXPECT_EQ(fired[2], 4000 + 54 * FRAME);
+
+    PartialSchedule off;
+    off.restart(0);
+    for (int f = 1; f <= 40; f++) EXPECT_FALSE(off.due(f * FRAME, true, 0, 0, PARTIAL_PAUSE_FRAMES));
+}
+
+TEST(SpeechPartialTest, FinalCommitsOnlySameAudioFollowedBySilence) {
+    std::vector<float> speech(16000);
+    for (size_t i = 0; i < speech.size(); i++) speech[i] = 0.3f * std::sin(0.05f * static_cast<float>(i));
+    std::vector<float> final_chunk = speech;
+    final_chunk.resize(speech.size() + 11200, 0.0005f);   // + 700 ms near-silence
+    std::string text;
+
+    SpeculativeTranscript spec;
+    EXPECT_FALSE(spec.commit(final_chunk.data(), final_chunk.size(), 0.005f, text));
+    spec.hold(speech.data(), speech.size(), "Guten Tag");
+    EXPECT_TRUE(spec.held());
+    ASSERT_TRUE(spec.commit(final_chunk.data(), final_chunk.size(), 0.005f, text));
+    EXPECT_EQ(text, "Guten Tag");
+    EXPECT_FALSE(spec.held());
+
+    // Speech after the partial: discard.
+    spec.hold(speech.data(), speech.size(), "Guten");
+    std::vector<float> more = final_chunk;
+    for (size_t i = speech.size() + 3000; i < speech.size() + 6000; i++) more[i] = 0.2f;
+    text.clear();
+    EXPECT_FALSE(spec.commit(more.data(), more.size(), 0.005f, text));
+    EXPECT_TRUE(text.empty());
+
+    // Different audio (another utterance), or shorter than the partial: discard.
+    spec.hold(speech.data(), speech.size(), "Guten Tag");
+    final_chunk[100] += 0.001f;
+    EXPECT_FALSE(spec.commit(final_chunk.data(), final_chunk.size(), 0.005f, text));
+    spec.hold(speech.data(), speech.size(), "Guten Tag");
+    EXPECT_FALSE(spec.commit(speech.data(), speech.size() - 1, 0.005f, text));
+
+    // The final equal to the partial commits, nothing to send included.
+    spec.hold(speech.data(), speech.size(), "");
+    text = "x";
+    EXPECT_TRUE(spec.commit(speech.data(), speech.size(), 0.005f, text));
+    EXPECT_TRUE(text.empty());
+}
+
+TEST(CallJobQueueTest, RunsCallsInParallelAndEachCallInOrder) {
+    CallJobQueue<int> q;
+    q.push(1, 10, false);
+    q.push(1, 11, false);
+    q.push(2, 20, false);
+
+    CallJobQueue<int>::Item a, b, c;
+    ASSERT_TRUE(q.pop(a));
+    ASSERT_TRUE(q.pop(b));
+    // Call 1's second job waits for its first; call 2 does not.
+    EXPECT_EQ(a.call_id, 1u);
+    EXPECT_EQ(a.job, 10);
+    EXPECT_EQ(b.call_id, 2u);
+    EXPECT_EQ(b.job, 20);
+    EXPECT_EQ(q.running(), 2u);
+    EXPECT_EQ(q.waiting(), 1u);
+
+    std::atomic<bool> got{false};
+    std::thread t([&] {
+        ASSERT_TRUE(q.pop(c));
+        got = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(got.load());
+    q.done(2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(got.load());
+    q.done(1);
+    t.join();
+    EXPECT_EQ(c.call_id, 1u);
+    EXPECT_EQ(c.job, 11);
+    EXPECT_LE(a.queued_at, c.queued_at);
+    q.done(1);
+
+    // close() releases a blocked worker.
+    std::thread idle([&] {
+        CallJobQueue<int>::Item none;
+        EXPECT_FALSE(q.pop(none));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.close();
+    idle.join();
+}
+
+TEST(CallJobQueueTest, NewerJobSupersedesWaitingPartialsOfItsCall) {
+    CallJobQueue<int> q;
+    EXPECT_EQ(q.push(7, 1, true), 0u);
+    EXPECT_EQ(q.push(8, 2, true), 0u);
+    EXPECT_EQ(q.push(7, 3, true), 1u);     // partial replaces partial
+    EXPECT_EQ(q.push(7, 4, false), 1u);    // final replaces partial
+    EXPECT_EQ(q.push(7, 5, true), 0u);     // a final is never replaced
+    EXPECT_EQ(q.waiting(), 3u);
+
+    CallJobQueue<int>::Item it;
+    ASSERT_TRUE(q.pop(it));
+    EXPECT_EQ(it.job, 2);
+    ASSERT_TRUE(q.pop(it));
+    EXPECT_EQ(it.job, 4);
+
+    EXPECT_EQ(q.drop_call(7), 1u);
+    EXPECT_EQ(q.waiting(), 0u);
+    q.done(7);
+    q.done(8);
+}
+
+TEST(SpeechPartialTest, StablePrefixGrowsOnlyWhereTranscriptsAgree) {
+    StablePrefix p;
+    EXPECT_FALSE(p.update("Ich hätte gern"));
+    // The end was re-decoded; only what both say counts.
+    ASSERT_TRUE(p.update("Ich hätte gerne einen"));
+    EXPECT_EQ(p.text(), "Ich hätte");
+    ASSERT_TRUE(p.update("Ich hätte gerne einen"));
+    EXPECT_EQ(p.text(), "Ich hätte gerne einen");
+    EXPECT_FALSE(p.update("Ich hätte gerne einen Termin."));
+    // Punctuation and case at the end do not count as a change.
+    ASSERT_TRUE(p.update("ich hätte gerne einen Termin, am Montag"));
+    EXPECT_EQ(p.text(), "ich hätte gerne einen Termin");
+    EXPECT_EQ(p.words(), 5u);
+
+    // A revision of settled words holds the prefix back until two
+    // transcripts agree past it again.
+    EXPECT_FALSE(p.update("Mich hätte gerne einen Termin am Montag"));
+    EXPECT_FALSE(p.update("Mich hätte gerne einen Termin am Montag früh"));
+    EXPECT_FALSE(p.update("Ich hätte gerne einen Termin am Montag früh"));
+    ASSERT_TRUE(p.update("Ich hätte gerne einen Termin am Montag früh."));
+    EXPECT_EQ(p.text(), "Ich hätte gerne einen Termin am Montag früh");
+
+    p.reset();
+    EXPECT_EQ(p.words(), 0u);
+    EXPECT_FALSE(p.update("Danke"));
+    ASSERT_TRUE(p.update("Danke schön"));
+    EXPECT_EQ(p.text(), "Danke");
+}
+
+TEST(SpeechPartialTest, FinalMatchesPrefixWordByWord) {
+    EXPECT_EQ(transcript_words("  Guten  Tag, ich "), (std::vector<std::string>{"Guten", "Tag,", "ich"}));
+    EXPECT_EQ(transcript_prefix_words("Guten Tag", "Guten Tag, ich brauche ein Rezept."), 2u);
+    EXPECT_EQ(transcript_prefix_words("guten tag ich", "Guten Tag. Ich brauche"), 3u);
+    EXPECT_EQ(transcript_prefix_words("Guten Tag", "Guten Abend"), 0u);
+    EXPECT_EQ(transcript_prefix_words("Guten Tag ich", "Guten Tag"), 0u);
+    EXPECT_EQ(transcript_prefix_words("Guten Tag", "Guten Tagen"), 0u);
+}
@@ -3,6 +3,7 @@
 #include <atomic>
 #include <condition_variable>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <mutex>
 #include <string>
@@ -25,6 +26,21 @@
 #include <openssl/x509v3.h>
 #include <openssl/rand.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+
+#if defined(__linux__) && __has_include(<linux/tls.h>)
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/socket.h>
+#  include <linux/tls.h>
+#  ifndef SOL_TLS
+#    define SOL_TLS 282
+#  endif
+#  ifndef TCP_ULP
+#    define TCP_ULP 31
+#  endif
+#  define IC_HAVE_KTLS 1
+#endif
 
 namespace prodigy_tls {
 
@@ -379,73 +395,209 @@ static inline const std::string& get_interconnect_key() {
 static constexpr int IC_GCM_IV_LEN  = 12;
 static constexpr int IC_GCM_TAG_LEN = 16;
 
-static inline bool ic_encrypt(const uint8_t* plaintext, size_t plain_len,
-                               uint8_t* ciphertext, size_t& cipher_len) {
-    const std::string& key = get_interconnect_key();
-    if (key.size() != 32) return false;
+// Long-lived AES-256-GCM state for interconnect frames. The key schedule is
+// set up once per context; each frame only re-seeds the IV. Sealing IVs are
+// deterministic (NIST SP 800-38D §8.2.1): an 8-byte random fixed field per
+// context followed by a 4-byte big-endian frame counter. A context that runs
+// its counter out draws a new fixed field, so an IV never repeats under the
+// key while fixed fields stay distinct (64-bit random, drawn per context).
+//
+// Frame layout: [IV (12)][ciphertext][tag (16)]. Both directions may run in
+// place: pass plaintext == ciphertext + IC_GCM_IV_LEN (GCM is a stream mode,
+// so EVP accepts identical in/out pointers). The pooled interconnect path
+// (packet-pool.h) relies on this to avoid a second buffer.
+//
+// Not thread-safe; ic_thread_cipher() hands every thread its own.
+class IcCipher {
+public:
+    IcCipher() = default;
+    ~IcCipher() {
+        if (enc_) EVP_CIPHER_CTX_free(enc_);
+        if (dec_) EVP_CIPHER_CTX_free(dec_);
+    }
+    IcCipher(const IcCipher&) = delete;
+    IcCipher& operator=(const IcCipher&) = delete;
+
+    // Incremental sealing, for frames gathered from several buffers:
+    // begin() writes the IV at out, update() encrypts one part, finish()
+    // writes the tag. Parts are laid out back to back behind the IV.
+    bool begin(uint8_t* iv_out) {
+        if (!enc_ && !init(enc_, true)) return false;
+        if (counter_ == 0 && !reseed()) return false;
+        memcpy(iv_out, fixed_, sizeof(fixed_));
+        iv_out[8]  = static_cast<uint8_t>(counter_ >> 24);
+        iv_out[9]  = static_cast<uint8_t>(counter_ >> 16);
+        iv_out[10] = static_cast<uint8_t>(counter_ >> 8);
+        iv_out[11] = static_cast<uint8_t>(counter_);
+        counter_++;   // wraps to 0: next begin() draws a new fixed field
+        return EVP_EncryptInit_ex(enc_, nullptr, nullptr, nullptr, iv_out) == 1;
+    }
 
-    uint8_t iv[IC_GCM_IV_LEN];
-    if (RAND_bytes(iv, IC_GCM_IV_LEN) != 1) return false;
+    bool update(const uint8_t* in, size_t len, uint8_t* out) {
+        int n = 0;
+        return len == 0 ||
+               EVP_EncryptUpdate(enc_, out, &n, in, static_cast<int>(len)) == 1;
+    }
 
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) return false;
+    bool finish(uint8_t* tag_out) {
+        int n = 0;
+        return EVP_EncryptFinal_ex(enc_, tag_out, &n) == 1 &&
+               EVP_CIPHER_CTX_ctrl(enc_, EVP_CTRL_GCM_GET_TAG, IC_GCM_TAG_LEN, tag_out) == 1;
+    }
 
-    int len = 0;
-    bool ok = true;
-    ok = ok && (EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr) == 1);
-    ok = ok && (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, IC_GCM_IV_LEN, nullptr) == 1);
-    ok = ok && (EVP_EncryptInit_ex(ctx, nullptr, nullptr,
-                    reinterpret_cast<const unsigned char*>(key.data()), iv) == 1);
-    ok = ok && (EVP_EncryptUpdate(ctx, ciphertext + IC_GCM_IV_LEN,
-                    &len, plaintext, static_cast<int>(plain_len)) == 1);
-    int clen = len;
-    ok = ok && (EVP_EncryptFinal_ex(ctx, ciphertext + IC_GCM_IV_LEN + clen, &len) == 1);
-    clen += len;
-    ok = ok && (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, IC_GCM_TAG_LEN,
-                    ciphertext + IC_GCM_IV_LEN + clen) == 1);
-
-    memcpy(ciphertext, iv, IC_GCM_IV_LEN);
-    cipher_len = IC_GCM_IV_LEN + clen + IC_GCM_TAG_LEN;
-
-    EVP_CIPHER_CTX_free(ctx);
-    return ok;
+    bool seal(const uint8_t* plaintext, size_t plain_len,
+              uint8_t* ciphertext, size_t& cipher_len) {
+        bool ok = begin(ciphertext) &&
+                  update(plaintext, plain_len, ciphertext + IC_GCM_IV_LEN) &&
+                  finish(ciphertext + IC_GCM_IV_LEN + plain_len);
+        cipher_len = IC_GCM_IV_LEN + plain_len + IC_GCM_TAG_LEN;
+        return ok;
+    }
+
+    // Incremental opening, mirroring begin()/update()/finish(). The tag is
+    // only checked by open_finish(); nothing decrypted before it returns
+    // true may be acted on.
+    bool open_begin(const uint8_t* iv) {
+        if (!dec_ && !init(dec_, false)) return false;
+        return EVP_DecryptInit_ex(dec_, nullptr, nullptr, nullptr, iv) == 1;
+    }
+
+    bool open_update(const uint8_t* in, size_t len, uint8_t* out) {
+        int n = 0;
+        return len == 0 ||
+               EVP_DecryptUpdate(dec_, out, &n, in, static_cast<int>(len)) == 1;
+    }
+
+    bool open_finish(const uint8_t* tag) {
+        uint8_t t[IC_GCM_TAG_LEN];
+        memcpy(t, tag, sizeof(t));
+        int n = 0;
+        return EVP_CIPHER_CTX_ctrl(dec_, EVP_CTRL_GCM_SET_TAG, IC_GCM_TAG_LEN, t) == 1 &&
+               EVP_DecryptFinal_ex(dec_, t, &n) == 1;
+    }
+
+    bool open(const uint8_t* ciphertext, size_t cipher_len,
+              uint8_t* plaintext, size_t& plain_len) {
+        if (cipher_len < (size_t)(IC_GCM_IV_LEN + IC_GCM_TAG_LEN)) return false;
+        size_t enc_len = cipher_len - IC_GCM_IV_LEN - IC_GCM_TAG_LEN;
+        // The tag is copied out first so plaintext may overlap the frame.
+        uint8_t tag[IC_GCM_TAG_LEN];
+        memcpy(tag, ciphertext + IC_GCM_IV_LEN + enc_len, IC_GCM_TAG_LEN);
+        plain_len = enc_len;
+        return open_begin(ciphertext) &&
+               open_update(ciphertext + IC_GCM_IV_LEN, enc_len, plaintext) &&
+               open_finish(tag);
+    }
+
+private:
+    static bool init(EVP_CIPHER_CTX*& ctx, bool encrypt) {
+        const std::string& key = get_interconnect_key();
+        if (key.size() != 32) return false;
+        ctx = EVP_CIPHER_CTX_new();
+        if (!ctx) return false;
+        const auto* k = reinterpret_cast<const unsigned char*>(key.data());
+        bool ok = encrypt
+            ? EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, k, nullptr) == 1
+            : EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, k, nullptr) == 1;
+        if (!ok) {
+            EVP_CIPHER_CTX_free(ctx);
+            ctx = nullptr;
+        }
+        return ok;
+    }
+
+    bool reseed() {
+        if (RAND_bytes(fixed_, sizeof(fixed_)) != 1) return false;
+        counter_ = 1;
+        return true;
+    }
+
+    EVP_CIPHER_CTX* enc_ = nullptr;
+    EVP_CIPHER_CTX* dec_ = nullptr;
+    uint8_t  fixed_[8] = {};
+    uint32_t counter_ = 0;
+};
+
+static inline IcCipher& ic_thread_cipher() {
+    static thread_local IcCipher cipher;
+    return cipher;
+}
+
+static inline bool ic_encrypt(const uint8_t* plaintext, size_t plain_len,
+                               uint8_t* ciphertext, size_t& cipher_len) {
+    return ic_thread_cipher().seal(plaintext, plain_len, ciphertext, cipher_len);
 }
 
 static inline bool ic_decrypt(const uint8_t* ciphertext, size_t cipher_len,
                                uint8_t* plaintext, size_t& plain_len) {
-    const std::string& key = get_interconnect_key();
-    if (key.size() != 32) return false;
-    if (cipher_len < (size_t)(IC_GCM_IV_LEN + IC_GCM_TAG_LEN)) return false;
+    return ic_thread_cipher().open(ciphertext, cipher_len, plaintext, plain_len);
+}
+
+static inline size_t ic_encrypted_size(size_t plain_len) {
+    return IC_GCM_IV_LEN + plain_len + IC_GCM_TAG_LEN;
+}
 
-    const uint8_t* iv = ciphertext;
-    size_t enc_len = cipher_len - IC_GCM_IV_LEN - IC_GCM_TAG_LEN;
-    const uint8_t* enc_data = ciphertext + IC_GCM_IV_LEN;
-    const uint8_t* tag = ciphertext + IC_GCM_IV_LEN + enc_len;
+// Kernel TLS offload for interconnect data sockets (Linux, opt-in via
+// WHISPERTALK_IC_KTLS=1). Both peers already share the interconnect key, so
+// there is no handshake: each connection gets a fresh 16-byte nonce from the
+// sender and both sides derive the same TLS 1.2 AES-256-GCM record state
+// from HMAC-SHA256(key, label || nonce). The sender installs TLS_TX and the
+// receiver TLS_RX before the first data byte, after which the kernel seals
+// the stream and the interconnect framing on top travels as plaintext.
+static inline bool ic_ktls_enabled_default() {
+    static const bool enabled = []() {
+        const char* v = std::getenv("WHISPERTALK_IC_KTLS");
+        return v && (std::strcmp(v, "1") == 0 || std::strcmp(v, "true") == 0);
+    }();
+    return enabled;
+}
 
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) return false;
+static constexpr size_t IC_KTLS_NONCE_LEN = 16;
 
-    int len = 0;
-    bool ok = true;
-    ok = ok && (EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr) == 1);
-    ok = ok && (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, IC_GCM_IV_LEN, nullptr) == 1);
-    ok = ok && (EVP_DecryptInit_ex(ctx, nullptr, nullptr,
-                    reinterpret_cast<const unsigned char*>(key.data()), iv) == 1);
-    ok = ok && (EVP_DecryptUpdate(ctx, plaintext, &len,
-                    enc_data, static_cast<int>(enc_len)) == 1);
-    int plen = len;
-    ok = ok && (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, IC_GCM_TAG_LEN,
-                    const_cast<uint8_t*>(tag)) == 1);
-    ok = ok && (EVP_DecryptFinal_ex(ctx, plaintext + plen, &len) == 1);
-    plen += len;
-
-    plain_len = static_cast<size_t>(plen);
-    EVP_CIPHER_CTX_free(ctx);
-    return ok;
+#if defined(__linux__) && defined(IC_HAVE_KTLS)
+static inline bool ic_ktls_derive(const uint8_t* nonce, const char* label,
+                                  uint8_t out[32]) {
+    const std::string& key = get_interconnect_key();
+    if (key.size() != 32) return false;
+    uint8_t msg[32 + IC_KTLS_NONCE_LEN];
+    size_t label_len = strlen(label);
+    if (label_len > 32) return false;
+    memcpy(msg, label, label_len);
+    memcpy(msg + label_len, nonce, IC_KTLS_NONCE_LEN);
+    unsigned int out_len = 0;
+    return HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()),
+                msg, label_len + IC_KTLS_NONCE_LEN, out, &out_len) != nullptr &&
+           out_len == 32;
 }
 
-static inline size_t ic_encrypted_size(size_t plain_len) {
-    return IC_GCM_IV_LEN + plain_len + IC_GCM_TAG_LEN;
+// Attaches the "tls" ULP to fd. Harmless on its own — the stream is
+// unchanged until a direction is installed — so the sender probes with it
+// before offering kTLS to its peer.
+static inline bool ic_ktls_attach(int fd) {
+    return setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
 }
 
+// Installs one direction (TLS_TX on the sender, TLS_RX on the receiver).
+static inline bool ic_ktls_install(int fd, const uint8_t* nonce, bool tx) {
+    tls12_crypto_info_aes_gcm_256 info;
+    memset(&info, 0, sizeof(info));
+    info.info.version = TLS_1_2_VERSION;
+    info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+    uint8_t iv[32];
+    bool ok = ic_ktls_derive(nonce, "whispertalk-ktls-key", info.key) &&
+              ic_ktls_derive(nonce, "whispertalk-ktls-iv", iv);
+    if (ok) {
+        memcpy(info.salt, iv, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+        memcpy(info.iv, iv + TLS_CIPHER_AES_GCM_256_SALT_SIZE, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+        ok = setsockopt(fd, SOL_TLS, tx ? TLS_TX : TLS_RX, &info, sizeof(info)) == 0;
+    }
+    secure_zero_tls(&info, sizeof(info));
+    secure_zero_tls(iv, sizeof(iv));
+    return ok;
+}
+#else
+static inline bool ic_ktls_attach(int) { return false; }
+static inline bool ic_ktls_install(int, const uint8_t*, bool) { return false; }
+#endif
+
 }
@@ -18,6 +18,11 @@
 // Concurrency:
 //   - One background thread owns the socket, runs the connect/HELLO
 //     state machine, and reads frames.
+//   - A second thread listens on the speech bus (speech-bus.h), so
+//     SPEECH_ACTIVE/IDLE from VAD reach the engine without the relay
+//     through the dock. Once the bus has delivered a signal, the dock's
+//     copies (which carry no timestamp) are ignored; until then they are
+//     the fallback. Speech handlers run on either thread, one at a time.
 //   - Text `Packet`s are pushed onto a bounded SPSC queue. `recv_text`
 //     is a blocking pop with timeout called from the engine's main loop.
 //   - Management frames fire user-registered handlers inline on the
@@ -51,6 +56,7 @@
 #include <condition_variable>
 #include <deque>
 #include <functional>
+#include <map>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -106,6 +112,10 @@ public:
 
     void set_audio_format(const EngineAudioFormat& fmt) { fmt_ = fmt; }
 
+    // Listen on the speech bus (default: speech_bus_default()). Set before
+    // start().
+    void set_speech_bus(bool enabled) { speech_bus_enabled_ = enabled; }
+
     // Handlers are invoked on the receive thread. Register before start().
     void register_call_end_handler(std::function<void(uint32_t)> h) {
         call_end_handler_ = std::move(h);
@@ -136,6 +146,9 @@ public:
             return false;
         }
         running_.store(true);
+        if (speech_bus_enabled_ && speech_bus_.open_subscriber()) {
+            bus_thread_ = std::thread(&EngineClient::speech_bus_loop, this);
+        }
         worker_ = std::thread(&EngineClient::run_loop, this);
         return true;
     }
@@ -149,6 +162,8 @@ public:
             queue_cv_.notify_all();
         }
         if (worker_.joinable()) worker_.join();
+        if (bus_thread_.joinable()) bus_thread_.join();
+        speech_bus_.close();
     }
 
     bool is_connected() const { return connected_.load(std::memory_order_relaxed); }
@@ -207,6 +222,14 @@ private:
     std::function<void(uint32_t)> call_end_handler_;
     std::function<void(uint32_t, bool)> speech_signal_handler_;
 
+    // --- speech bus ---
+    bool speech_bus_enabled_ = speech_bus_default();
+    SpeechBus speech_bus_;
+    std::thread bus_thread_;
+    std::mutex speech_mutex_;                      // serialises speech handlers
+    std::map<uint32_t, uint64_t> speech_ts_;       // last bus signal per call
+    std::atomic<bool> bus_live_{false};            // bus has delivered a signal
+
     mutable std::mutex custom_mutex_;
     std::map<std::string, std::function<void()>> custom_handlers_;
 
@@ -310,6 +333,26 @@ private:
         }
     }
 
+    void speech_bus_loop() {
+        while (running_.load()) {
+            pollfd pfd = {speech_bus_.fd(), POLLIN, 0};
+            if (poll(&pfd, 1, RECV_POLL_TIMEOUT_MS) <= 0) continue;
+            SpeechSignal sig;
+            while (speech_bus_.receive(sig)) {
+                if (sig.ts_us == 0 ||
+                    !speech_signal_reaches(static_cast<ServiceType>(sig.origin), ServiceType::TTS_SERVICE)) {
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(speech_mutex_);
+                uint64_t& last = speech_ts_[sig.call_id];
+                if (sig.ts_us <= last) continue;
+                last = sig.ts_us;
+                bus_live_.store(true, std::memory_order_relaxed);
+                if (speech_signal_handler_) speech_signal_handler_(sig.call_id, sig.active);
+            }
+        }
+    }
+
     void enqueue_text(Packet pkt) {
         std::lock_guard<std::mutex> lock(queue_mutex_);
         if (text_queue_.size() >= MAX_TEXT_QUEUE) {
@@ -354,8 +397,13 @@ private:
                 std::memcpy(&net_cid, cid_buf, 4);
                 uint32_t call_id = ntohl(net_cid);
                 if (mt == MgmtMsgType::CALL_END) {
+                    {
+                        std::lock_guard<std::mutex> lock(speech_mutex_);
+                        speech_ts_.erase(call_id);
+                    }
                     if (call_end_handler_) call_end_handler_(call_id);
-                } else if (speech_signal_handler_) {
+                } else if (speech_signal_handler_ && !bus_live_.load(std::memory_order_relaxed)) {
+                    std::lock_guard<std::mutex> lock(speech_mutex_);
                     speech_signal_handler_(call_id, mt == MgmtMsgType::SPEECH_ACTIVE);
                 }
                 return true;
@@ -29,6 +29,12 @@
 // plain TCP (no TLS) because it never leaves 127.0.0.1 and the
 // dock binds to `INADDR_LOOPBACK` only. TCP_NODELAY and a 128 KiB
 // socket buffer are set on every engine socket.
+//
+// Back-pressure: while OAP holds a full credit window of a call's audio
+// (flow-control.h), the dock stops reading that engine for up to
+// kDockWindowWaitMs before forwarding the next packet, so the engine's
+// socket fills and it slows down instead of the excess piling onto the
+// interconnect. The wait stays well inside the engine ping budget.
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -87,6 +93,10 @@ constexpr int kEnginePingMaxMisses      = 3;
 
 constexpr int kEngineSwapGraceMs        = 2000;
 
+// Longest the dock holds an engine back while OAP's window for the call is
+// closed (< kEnginePingIntervalMs * kEnginePingMaxMisses).
+constexpr int kDockWindowWaitMs         = 200;
+
 constexpr size_t kEngineSocketBufBytes  = 128 * 1024;  // ≥ 2 audio frames
 // Application-level cap on CUSTOM mgmt payload (the wire field is 16-bit
 // unsigned; this is a tighter semantic limit so the runtime check is
@@ -324,7 +334,7 @@ public:
             return false;
         }
 
-        // Tee handlers: when the inherited mgmt_recv_loop receives
+        // Tee handlers: when the node's event loop receives
         // CALL_END/SPEECH_ACTIVE/SPEECH_IDLE from LLaMA, it auto-
         // forwards to OAP. We additionally tee to the active engine.
         node_.register_call_end_handler([this](uint32_t cid) {
@@ -377,7 +387,11 @@ public:
                 }
                 continue;
             }
-            pkt.trace.record(ServiceType::TTS_SERVICE, 1);  // 1 = inbound
+            pkt.trace.record(ServiceType::TTS_SERVICE, 0);  // 0 = inbound
+            if (pkt.trace.hop_count > 1) {
+                std::lock_guard<std::mutex> lock(trace_mutex_);
+                pending_traces_.emplace(pkt.call_id, pkt.trace);
+            }
             forward_text_to_engine(pkt);
         }
 
@@ -740,8 +754,26 @@ private:
         Packet pkt;
         if (!Packet::deserialize(full.data(), full.size(), pkt)) return false;
         (void)net_cid;
+        // Engines stamp t_engine_out_us (big-endian, tts-common.h) into the
+        // audio header; it doubles as the frame's capture time downstream.
+        uint64_t t_engine_out_us = 0;
+        if (pkt.payload_size >= tts::kTTSAudioHeaderBytes) {
+            for (size_t i = 0; i < 8; ++i) {
+                t_engine_out_us = (t_engine_out_us << 8) | pkt.payload[sizeof(int32_t) + i];
+            }
+        }
+        pkt.meta = FrameMeta(PayloadType::TTS_AUDIO, kTTSSampleRate, t_engine_out_us);
 
-        pkt.trace.record(ServiceType::TTS_SERVICE, 0);  // 0 = outbound
+        {
+            std::lock_guard<std::mutex> lock(trace_mutex_);
+            auto it = pending_traces_.find(pkt.call_id);
+            if (it != pending_traces_.end()) {
+                pkt.trace = it->second;
+                pending_traces_.erase(it);
+            }
+        }
+        pkt.trace.record(ServiceType::TTS_SERVICE, 1);  // 1 = outbound
+        node_.wait_downstream_window(pkt.call_id, kDockWindowWaitMs);
         node_.send_to_downstream(pkt);
         return true;
     }
@@ -875,6 +907,10 @@ private:
             std::lock_guard<std::mutex> lock(drop_log_mutex_);
             last_drop_log_ms_.erase(call_id);
         }
+        {
+            std::lock_guard<std::mutex> lock(trace_mutex_);
+            pending_traces_.erase(call_id);
+        }
         auto slot = current_slot();
         if (!slot) return;
         send_mgmt_call_id(slot, MgmtMsgType::CALL_END, call_id);
@@ -977,6 +1013,10 @@ private:
 
     std::string handle_command(const std::string& cmd) {
         if (cmd == "PING") return "PONG\n";
+        if (cmd == "HOP_LATENCY") return node_.hop_latency_report();
+        if (cmd == "FLOW") return node_.flow_report();
+        if (cmd == "METRICS") return node_.metrics_report();
+        if (cmd == "METRICS:JSON") return node_.metrics_report(true);
         if (cmd == "STATUS") {
             auto slot = current_slot();
             if (!slot) return "NONE\n";
@@ -1028,6 +1068,11 @@ private:
 
     mutable std::mutex drop_log_mutex_;
     std::map<uint32_t, int64_t> last_drop_log_ms_;
+
+    // Hop trace of the first traced text per call still waiting for audio;
+    // the next audio packet the engine returns for that call continues it.
+    std::mutex trace_mutex_;
+    std::map<uint32_t, PacketTrace> pending_traces_;
 };
 
 static TTSDock* g_dock = nullptr;
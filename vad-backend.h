@@ -0,0 +1,293 @@
+// vad-backend.h — per-frame speech decisions for the VAD FSM.
+//
+// The FSM in vad-service.cpp classifies 50 ms frames as speech or not. By
+// default that is frame energy against an adaptive noise floor (the
+// vad_noise_floor_* rule below). A VadBackend replaces the decision with a
+// neural speech probability: a small model stepped over fixed windows of the
+// 16 kHz stream, carrying recurrent state per call. A shard scores all of its
+// calls together, one infer() per window step across every call that has a
+// whole window buffered (vad_score_pending), so the model runs batched
+// however many calls there are.
+//
+// Windows sit at absolute stream positions (k × window()), independent of the
+// FSM's frames, which shift whenever a chunk is cut. VadNeuralStream keeps a
+// call's model state and the probability of every window still in its ring.
+// A frame's probability is the overlap-weighted mean of the windows it spans,
+// known once the window holding its last sample is scored: at most
+// window() − 1 samples (32 ms for Silero) after the frame itself.
+//
+// Backends (make_vad_backend):
+//   "energy"               no backend; the FSM's own energy rule.
+//   "silero:<model.onnx>"  Silero VAD v5 through ONNX Runtime, CPU, one
+//                          thread per shard. Needs -DWHISPERTALK_ONNXRUNTIME=ON
+//                          (defines WHISPERTALK_HAVE_ONNXRUNTIME).
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if WHISPERTALK_HAVE_ONNXRUNTIME
+#include <onnxruntime_cxx_api.h>
+#endif
+
+namespace whispertalk {
+
+// Energy rule: the noise floor follows frame energy (mean of squares) with an
+// EMA while no speech or onset is pending. α = 0.05 gives a time constant of
+// 20 frames (1 s at 50 ms). The floor never drops below the hard minimum,
+// well above G.711 silence (±0.000885 → energy ~0.00000078), and starts at
+// 10× that so a fresh call does not trigger on codec noise.
+constexpr float VAD_NOISE_FLOOR_INIT = 0.00005f;
+constexpr float VAD_NOISE_FLOOR_HARD_MIN = 0.000005f;
+constexpr float VAD_NOISE_FLOOR_EMA_ALPHA = 0.05f;
+
+inline float vad_noise_floor_update(float noise_floor, float energy) {
+    float nf = noise_floor * (1.0f - VAD_NOISE_FLOOR_EMA_ALPHA) + energy * VAD_NOISE_FLOOR_EMA_ALPHA;
+    return std::max(nf, VAD_NOISE_FLOOR_HARD_MIN);
+}
+
+// Neural rule: a frame is speech at probability >= threshold to start, and
+// stays speech down to threshold − hysteresis (Silero's own neg_threshold).
+constexpr float VAD_NEURAL_THRESHOLD_DEFAULT = 0.5f;
+constexpr float VAD_NEURAL_HYSTERESIS = 0.15f;
+
+class VadBackend {
+public:
+    virtual ~VadBackend() = default;
+
+    virtual const char* name() const = 0;
+    // 16 kHz samples per model step, and how many samples before the window
+    // each step reads as well.
+    virtual size_t window() const = 0;
+    virtual size_t context() const = 0;
+    // Recurrent state per stream, in floats; a new stream starts at zero.
+    virtual size_t state_floats() const = 0;
+
+    // One step for n streams: in[i] holds context() + window() samples,
+    // state[i] is read and updated in place, prob[i] receives P(speech).
+    virtual void infer(size_t n, const float* const* in, float* const* state, float* prob) = 0;
+};
+
+class VadNeuralStream {
+public:
+    // Starts a stream for backend b over an audio ring of ring_samples.
+    void reset(const VadBackend& b, size_t ring_samples) {
+        window_ = b.window();
+        context_ = b.context();
+        state_.assign(b.state_floats(), 0.0f);
+        size_t n = 1;
+        while (n * window_ < ring_samples + 2 * window_) n <<= 1;
+        probs_.assign(n, 0.0f);
+        mask_ = n - 1;
+        lead_.assign(context_ + window_, 0.0f);
+        scored_ = 0;
+    }
+
+    bool active() const { return window_ != 0; }
+    size_t window() const { return window_; }
+
+    // Every window ending at or before scored() has a probability.
+    uint64_t scored() const { return scored_; }
+    // Earliest stream position the next step reads; the ring must keep it.
+    uint64_t needed_from() const { return scored_ > context_ ? scored_ - context_ : 0; }
+
+    bool covers(uint64_t end) const { return end <= scored_; }
+
+    // Probability of [pos, pos + n), for covers(pos + n), pos within the ring.
+    float frame_prob(uint64_t pos, size_t n) const {
+        const uint64_t end = pos + n;
+        float acc = 0.0f;
+        for (uint64_t k = pos / window_; k * window_ < end; k++) {
+            uint64_t lo = std::max<uint64_t>(pos, k * window_);
+            uint64_t hi = std::min<uint64_t>(end, (k + 1) * window_);
+            acc += probs_[k & mask_] * static_cast<float>(hi - lo);
+        }
+        return acc / static_cast<float>(n);
+    }
+
+    // Input for the next step: straight from the ring, or, while the stream
+    // has less than context() samples of history, a zero-padded copy.
+    template <typename Span>
+    const float* next_input(Span&& span) {
+        if (scored_ >= context_) return span(scored_ - context_);
+        const size_t pad = context_ - static_cast<size_t>(scored_);
+        std::fill(lead_.begin(), lead_.begin() + pad, 0.0f);
+        const float* src = span(0);
+        std::copy(src, src + (lead_.size() - pad), lead_.begin() + pad);
+        return lead_.data();
+    }
+
+    float* state() { return state_.data(); }
+
+    void record(float prob) {
+        probs_[(scored_ / window_) & mask_] = prob;
+        scored_ += window_;
+    }
+
+private:
+    size_t window_ = 0;
+    size_t context_ = 0;
+    std::vector<float> state_;
+    std::vector<float> probs_;   // per window, indexed by window number & mask_
+    size_t mask_ = 0;
+    std::vector<float> lead_;
+    uint64_t scored_ = 0;
+};
+
+// Scratch for vad_score_pending, reused across calls.
+struct VadScoreBatch {
+    std::vector<const float*> in;
+    std::vector<float*> state;
+    std::vector<float> prob;
+    std::vector<size_t> index;
+};
+
+// Scores every whole window the streams have buffered: one b.infer() per
+// step across all streams with a window ready, until none has. head(i) is
+// stream i's ring head, span(i, pos) its samples from pos on. Returns the
+// number of windows scored.
+template <typename Head, typename Span>
+size_t vad_score_pending(VadBackend& b, VadNeuralStream* const* streams, size_t n,
+                         Head&& head, Span&& span, VadScoreBatch& batch) {
+    const size_t w = b.window();
+    size_t total = 0;
+    for (;;) {
+        batch.in.clear();
+        batch.state.clear();
+        batch.index.clear();
+        for (size_t i = 0; i < n; i++) {
+            VadNeuralStream& s = *streams[i];
+            if (s.scored() + w > head(i)) continue;
+            batch.in.push_back(s.next_input([&](uint64_t pos) { return span(i, pos); }));
+            batch.state.push_back(s.state());
+            batch.index.push_back(i);
+        }
+        if (batch.index.empty()) return total;
+        batch.prob.resize(batch.index.size());
+        b.infer(batch.index.size(), batch.in.data(), batch.state.data(), batch.prob.data());
+        for (size_t j = 0; j < batch.index.size(); j++) streams[batch.index[j]]->record(batch.prob[j]);
+        total += batch.index.size();
+    }
+}
+
+// Silero VAD v5 (silero_vad.onnx): input [B, 64 + 512], state [2, B, 128]
+// (LSTM h, then c), sr; outputs output [B, 1] and stateN. SileroBackend packs
+// the streams into those tensors and back; a SileroSession runs the model.
+class SileroSession {
+public:
+    virtual ~SileroSession() = default;
+    // One run over n packed streams. *prob ([n]) and *state_out ([2, n, 128])
+    // stay valid until the next run.
+    virtual void run(size_t n, const float* input, const float* state,
+                     const float** prob, const float** state_out) = 0;
+};
+
+class SileroBackend : public VadBackend {
+public:
+    static constexpr size_t WINDOW = 512;
+    static constexpr size_t CONTEXT = 64;
+    static constexpr size_t HIDDEN = 128;
+
+    explicit SileroBackend(std::unique_ptr<SileroSession> session) : session_(std::move(session)) {}
+
+    const char* name() const override { return "silero"; }
+    size_t window() const override { return WINDOW; }
+    size_t context() const override { return CONTEXT; }
+    size_t state_floats() const override { return 2 * HIDDEN; }
+
+    void infer(size_t n, const float* const* in, float* const* state, float* prob) override {
+        constexpr size_t IN = CONTEXT + WINDOW;
+        input_.resize(n * IN);
+        state_.resize(2 * n * HIDDEN);
+        for (size_t i = 0; i < n; i++) {
+            std::memcpy(&input_[i * IN], in[i], IN * sizeof(float));
+            std::memcpy(&state_[i * HIDDEN], state[i], HIDDEN * sizeof(float));
+            std::memcpy(&state_[(n + i) * HIDDEN], state[i] + HIDDEN, HIDDEN * sizeof(float));
+        }
+        const float* p = nullptr;
+        const float* s = nullptr;
+        session_->run(n, input_.data(), state_.data(), &p, &s);
+        for (size_t i = 0; i < n; i++) {
+            prob[i] = p[i];
+            std::memcpy(state[i], &s[i * HIDDEN], HIDDEN * sizeof(float));
+            std::memcpy(state[i] + HIDDEN, &s[(n + i) * HIDDEN], HIDDEN * sizeof(float));
+        }
+    }
+
+private:
+    std::unique_ptr<SileroSession> session_;
+    std::vector<float> input_;
+    std::vector<float> state_;
+};
+
+#if WHISPERTALK_HAVE_ONNXRUNTIME
+class SileroOnnxSession : public SileroSession {
+public:
+    explicit SileroOnnxSession(const std::string& model_path)
+        : env_(ORT_LOGGING_LEVEL_WARNING, "whispertalk-vad"),
+          session_(nullptr),
+          mem_(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)) {
+        Ort::SessionOptions opts;
+        opts.SetIntraOpNumThreads(1);
+        opts.SetInterOpNumThreads(1);
+        opts.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+        session_ = Ort::Session(env_, model_path.c_str(), opts);
+    }
+
+    void run(size_t n, const float* input, const float* state,
+             const float** prob, const float** state_out) override {
+        constexpr size_t IN = SileroBackend::CONTEXT + SileroBackend::WINDOW;
+        constexpr size_t HIDDEN = SileroBackend::HIDDEN;
+        const int64_t in_shape[2] = {static_cast<int64_t>(n), static_cast<int64_t>(IN)};
+        const int64_t state_shape[3] = {2, static_cast<int64_t>(n), static_cast<int64_t>(HIDDEN)};
+        int64_t sr = 16000;
+        Ort::Value inputs[3] = {
+            Ort::Value::CreateTensor<float>(mem_, const_cast<float*>(input), n * IN, in_shape, 2),
+            Ort::Value::CreateTensor<float>(mem_, const_cast<float*>(state), 2 * n * HIDDEN, state_shape, 3),
+            Ort::Value::CreateTensor<int64_t>(mem_, &sr, 1, nullptr, 0)};
+        static const char* in_names[] = {"input", "state", "sr"};
+        static const char* out_names[] = {"output", "stateN"};
+        out_ = session_.Run(Ort::RunOptions{nullptr}, in_names, inputs, 3, out_names, 2);
+        *prob = out_[0].GetTensorData<float>();
+        *state_out = out_[1].GetTensorData<float>();
+    }
+
+private:
+    Ort::Env env_;
+    Ort::Session session_;
+    Ort::MemoryInfo mem_;
+    std::vector<Ort::Value> out_;
+};
+#endif
+
+// Backend for a --vad-backend spec: nullptr with *err empty for "energy",
+// nullptr with *err set if the spec is unknown, unavailable in this build or
+// the model fails to load.
+inline std::unique_ptr<VadBackend> make_vad_backend(const std::string& spec, std::string* err) {
+    err->clear();
+    if (spec.empty() || spec == "energy") return nullptr;
+    if (spec.rfind("silero:", 0) == 0) {
+        const std::string path = spec.substr(7);
+#if WHISPERTALK_HAVE_ONNXRUNTIME
+        try {
+            return std::make_unique<SileroBackend>(std::make_unique<SileroOnnxSession>(path));
+        } catch (const std::exception& e) {
+            *err = "cannot load Silero model " + path + ": " + e.what();
+            return nullptr;
+        }
+#else
+        *err = "built without ONNX Runtime (-DWHISPERTALK_ONNXRUNTIME=ON), cannot load " + path;
+        return nullptr;
+#endif
+    }
+    *err = "unknown VAD backend '" + spec + "' (energy, silero:<model.onnx>)";
+    return nullptr;
+}
+
+}
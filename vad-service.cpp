@@ -2,9 +2,11 @@
 //
 // Pipeline position: IAP → [VAD] → Whisper
 //
-// Receives continuous float32 PCM audio (16kHz) from IAP via interconnect,
-// segments it into speech chunks using energy-based VAD, and forwards only
-// the speech-containing audio segments to Whisper for transcription.
+// Receives each call's continuous audio from IAP via interconnect — μ-law
+// frames upsampled here to 16 kHz (pcm-wire.h), or float32 PCM at 16 kHz from
+// an IAP that does not send the compact format — segments it into speech
+// chunks, and forwards only the speech-containing audio segments to Whisper
+// for transcription.
 //
 // VAD strategy: Energy-based with adaptive pause detection.
 // Instead of waiting for full sentence silence (1500ms), we detect pauses (~700ms)
@@ -19,11 +21,30 @@
 // frame (onset_frame_3), and the split calculation applies an origin correction via
 // energies_sample_origin to map back to absolute buffer positions.
 //
+// Threading: receiver_loop appends each call's audio to its ring; the FSM runs
+// on a pool of shard workers (--vad-threads), each owning the calls hashed
+// onto it. A worker is woken as soon as one of its calls has a whole new
+// frame, so onset detection does not wait for a polling interval.
+//
+// Frame decision: energy against an adaptive noise floor by default, or a
+// neural speech probability from a VadBackend (--vad-backend, vad-backend.h)
+// run batched over each shard's calls. Smart-split, chunk gates and speech
+// signals are the same either way.
+//
+// Partial chunks (--vad-partial-ms, off by default): while speech goes on,
+// the utterance so far is also sent to Whisper flagged partial, every
+// interval of new speech and when a pause begins, so transcription overlaps
+// the trailing silence. The chunk ending the utterance is the final marker
+// (speech-partial.h). Only sent to a Whisper that offered the flag.
+//
 // Speech signal management: Broadcasts SPEECH_ACTIVE/SPEECH_IDLE signals downstream
 // to coordinate with other services (e.g., Kokoro stops TTS playback on speech detect).
 //
 // VadCall per-call state:
-//   audio_buffer:          ring of incoming float32 PCM samples (16kHz).
+//   audio:                 lock-free ring of incoming float32 PCM samples (16kHz,
+//                          audio-ring.h). receiver_loop appends, the call's shard
+//                          worker reads frames and chunks in place; no lock.
+//   wake_at:               ring position at which the next frame completes.
 //   in_speech/silence_count/onset_count: FSM tracking speech vs. silence.
 //   noise_floor:           adaptive estimate; updated each frame during silence.
 //   frame_energies:        per-frame RMS² from the confirmed onset frame onward,
@@ -31,17 +52,23 @@
 //   energies_sample_origin: buffer position at which frame_energies[0] starts.
 //   speech_sum_sq / speech_sample_count: running sum-of-squares for RMS check in
 //                          send_chunk_downstream() without rescanning the buffer.
+//   upsampler / ulaw:      compact wire input (pcm-wire.h). IAP sends μ-law
+//                          frames that are upsampled here; their bytes are kept
+//                          in a second ring so a chunk can go to Whisper as
+//                          μ-law (ULAW_UP16K).
+//   stream_pos:            ring position of buffer index 0; every FSM position
+//                          is relative to it. Audio before it is released.
+//   partial:               when the utterance so far is next due as a partial.
 //
-// CMD port (VAD base+2 = 13117): accepts PING, STATUS, SET_LOG_LEVEL,
-//   SET_VAD_THRESHOLD, SET_VAD_SILENCE_MS, SET_VAD_MAX_CHUNK_MS,
-//   SET_VAD_ONSET_GAP commands.
+// CMD port (VAD base+2 = 13117): accepts PING, STATUS, SET_LOG_LEVEL, HOP_LATENCY, FLOW,
+//   METRICS, METRICS:JSON, SET_VAD_THRESHOLD, SET_VAD_SILENCE_MS, SET_VAD_MAX_CHUNK_MS,
+//   SET_VAD_ONSET_GAP, SET_VAD_NEURAL_THRESHOLD, SET_VAD_PARTIAL_MS commands.
 //   STATUS returns: noise_floor, threshold_mult, silence_frames, max_chunk_ms,
 //   active call count, upstream/downstream state.
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <vector>
-#include <deque>
 #include <string>
 #include <thread>
 #include <mutex>
@@ -55,24 +82,72 @@
 #include <signal.h>
 #include <getopt.h>
 #include "interconnect.h"
+#include "pcm-wire.h"
+#include "audio-ring.h"
+#include "vad-backend.h"
+#include "speech-partial.h"
+#include "metrics.h"
 
 static constexpr int VAD_SAMPLE_RATE = 16000;
 static constexpr int VAD_SAMPLES_PER_MS = VAD_SAMPLE_RATE / 1000;
 static constexpr int DISC_WARN_INTERVAL_S = 5;
-static constexpr float NOISE_FLOOR_INIT = 0.00005f;
-static constexpr float NOISE_FLOOR_HARD_MIN = 0.000005f;
-static constexpr float NOISE_FLOOR_EMA_ALPHA = 0.05f;
+static constexpr float NOISE_FLOOR_INIT = whispertalk::VAD_NOISE_FLOOR_INIT;
 static constexpr float RMS_SILENCE_GATE_DEFAULT = 0.01f;
+// Per-call ring: 2^18 samples = 16.4 s (1 MiB). Bounds max_chunk_ms, see
+// VadService::max_chunk_limit().
+static constexpr size_t VAD_RING_SAMPLES = size_t(1) << 18;
+// Shard workers wake on completed frames; this tick only drives the FSM's
+// timers (inactivity flush, SPEECH_ACTIVE timeout).
+static constexpr int SHARD_TICK_MS = 100;
+static constexpr int MAX_SHARDS = 64;
+
+// Half the cores, 1–4: the FSM is light, and Whisper and LLaMA share the box.
+static int default_worker_threads() {
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    return std::max(1, std::min(4, hw / 2));
+}
 
 static std::atomic<bool> g_running{true};
 static void sig_handler(int) { g_running = false; }
 
 struct VadCall {
+    explicit VadCall(uint32_t cid) : id(cid), audio(VAD_RING_SAMPLES), ulaw(VAD_RING_SAMPLES / 2) {
+        // The upsampler's silent lead-in, as in UlawSource: ulaw ring position
+        // p holds 8 kHz sample p − IAP_FIR_CENTER, so the source bytes of a
+        // chunk at 16 kHz position pos start at ulaw.span(pos / 2).
+        uint8_t lead[whispertalk::IAP_FIR_CENTER];
+        std::memset(lead, whispertalk::UlawSource::SILENCE, sizeof(lead));
+        ulaw.push(lead, sizeof(lead));
+    }
+
     uint32_t id;
-    std::deque<float> audio_buffer;
-    std::mutex mutex;
+
+    // Shared by receiver_loop (producer) and the call's shard worker (consumer).
+    whispertalk::MirroredRing<float> audio;
+    // μ-law input: audio is rebuilt from it bit for bit, so chunks can be
+    // re-encoded from these bytes as long as every frame of the call came in
+    // as μ-law (ulaw_synced).
+    whispertalk::MirroredRing<uint8_t> ulaw;
+    std::atomic<bool> ulaw_synced{true};
+    // Trace of the most recent upstream frame; a chunk inherits the trace of
+    // the frame that completed it so hop latency is measured from speech end.
+    whispertalk::LatestValue<whispertalk::PacketTrace> last_trace;
+    // Read by STATUS.
+    std::atomic<bool> speech_signaled{false};
+
+    // Ring position at which the next frame is complete; the worker sets it
+    // after each pass, the receiver wakes the worker once head reaches it.
+    std::atomic<uint64_t> wake_at{0};
+    size_t shard = 0;   // fixed at creation
+
+    // receiver_loop only.
+    whispertalk::UlawUpsampler16k upsampler;
+    uint64_t woken_at = UINT64_MAX;   // wake_at the shard was last woken for
+
+    // The shard worker only from here on.
+    uint64_t stream_pos = 0;
+    size_t buffered = 0;   // samples in [stream_pos, audio.head()) as of this pass
     bool in_speech = false;
-    bool speech_signaled = false;
     int silence_count = 0;
     int onset_count = 0;
     int onset_gap = 0;
@@ -91,13 +166,35 @@ struct VadCall {
     size_t energies_sample_origin = 0;
     std::chrono::steady_clock::time_point speech_signal_time;
     std::chrono::steady_clock::time_point last_idle_time;
-    size_t last_buffer_size = 0;
+    uint64_t last_head = 0;
     std::chrono::steady_clock::time_point last_buffer_growth;
     std::vector<float> frame_energies;
     // Cumulative sum-of-squares for the current speech segment,
     // tracked during frame processing to avoid re-scanning in send_chunk_downstream.
     float speech_sum_sq = 0.0f;
     size_t speech_sample_count = 0;
+    // Model state and window probabilities when the shard has a backend.
+    whispertalk::VadNeuralStream neural;
+    whispertalk::PartialSchedule partial;
+};
+
+// A worker thread and the calls it owns. Calls arrive through `adopted` and
+// leave through `ended`; `owned` and everything in its VadCalls beyond the
+// ring and the atomics are the worker's alone.
+struct VadShard {
+    std::mutex mutex;   // guards wake, adopted, ended
+    std::condition_variable cv;
+    bool wake = false;
+    std::vector<std::shared_ptr<VadCall>> adopted;
+    // By VadCall, not call id: a late frame after CALL_END may already have
+    // created a new VadCall with the same id, which must stay.
+    std::vector<std::shared_ptr<VadCall>> ended;
+    std::vector<std::shared_ptr<VadCall>> owned;   // worker only
+    // Neural backend (vad-backend.h), if configured; worker only.
+    std::unique_ptr<whispertalk::VadBackend> backend;
+    std::vector<whispertalk::VadNeuralStream*> streams;
+    whispertalk::VadScoreBatch score_batch;
+    std::thread thread;
 };
 
 class VadService {
@@ -134,6 +231,10 @@ class VadService {
     int speech_signal_timeout_s_ = 10;
     std::atomic<int> post_idle_cooldown_ms_{1200};
     std::atomic<float> rms_silence_gate_{RMS_SILENCE_GATE_DEFAULT};
+    // Speech probability a neural backend's frame needs to start speech.
+    std::atomic<float> vad_neural_threshold_{whispertalk::VAD_NEURAL_THRESHOLD_DEFAULT};
+    // vad_partial_samples_: new speech between partial chunks; 0 = no partials.
+    std::atomic<size_t> vad_partial_samples_{0};
     // vad_inactivity_flush_ms_: if no new audio arrives for 1000ms while speech is
     //   active, flush the buffer immediately (handles end-of-stream).
     int vad_inactivity_flush_ms_ = 1000;
@@ -164,7 +265,7 @@ public:
             if (samples < vad_min_speech_samples_ * 2) {
                 samples = vad_min_speech_samples_ * 2;
             }
-            vad_max_speech_samples_.store(samples);
+            vad_max_speech_samples_.store(std::min(samples, max_chunk_limit()));
         }
         print_config();
     }
@@ -180,6 +281,7 @@ public:
                   << " min_chunk=" << (vad_min_speech_samples_ * 1000 / VAD_SAMPLE_RATE) << "ms"
                   << " post_idle_cooldown=" << post_idle_cooldown_ms_.load() << "ms"
                   << " rms_gate=" << rms_silence_gate_.load()
+                  << " partial=" << (vad_partial_samples_.load() / VAD_SAMPLES_PER_MS) << "ms"
                   << std::endl;
     }
 
@@ -195,15 +297,36 @@ public:
         rms_silence_gate_.store(val);
     }
 
+    // Partial chunks every `ms` of new speech (speech-partial.h); 0 = off.
+    void set_partial_ms(int ms) {
+        vad_partial_samples_.store(static_cast<size_t>(VAD_SAMPLES_PER_MS) * ms);
+    }
+
     void set_log_level(const char* level) {
         log_fwd_.set_level(level);
     }
 
     bool init() {
+        for (int i = 0; i < worker_threads_; i++) {
+            auto shard = std::make_unique<VadShard>();
+            std::string err;
+            shard->backend = whispertalk::make_vad_backend(backend_spec_, &err);
+            if (!err.empty()) {
+                std::cerr << "VAD backend: " << err << std::endl;
+                return false;
+            }
+            shards_.push_back(std::move(shard));
+        }
+        std::cout << "VAD workers: " << shards_.size() << ", backend: "
+                  << (shards_[0]->backend ? shards_[0]->backend->name() : "energy") << std::endl;
+
         interconnect_.register_custom_negotiation_handler([](const std::string& msg) -> std::string {
             if (msg == "SAMPLE_RATE_QUERY") return "SAMPLE_RATE:16000";
             return "";
         });
+        if (whispertalk::ic_compact_pcm_default()) {
+            interconnect_.accept_payload_type(whispertalk::PayloadType::ULAW);
+        }
 
         if (!interconnect_.initialize()) {
             std::cerr << "Failed to initialize interconnect" << std::endl;
@@ -227,9 +350,22 @@ public:
         return true;
     }
 
+    // Frame classifier: "energy" or a vad-backend.h spec such as
+    // "silero:<model.onnx>". Set before init(); a bad spec fails init().
+    void set_backend(const std::string& spec, float neural_threshold) {
+        backend_spec_ = spec;
+        if (neural_threshold > 0.0f && neural_threshold < 1.0f) vad_neural_threshold_.store(neural_threshold);
+    }
+
+    // Number of FSM worker threads; calls are hashed onto them by call_id.
+    // Set before init().
+    void set_worker_threads(int n) {
+        if (n >= 1 && n <= MAX_SHARDS) worker_threads_ = n;
+    }
+
     void run() {
+        for (auto& sh : shards_) sh->thread = std::thread(&VadService::shard_loop, this, std::ref(*sh));
         std::thread receiver_thread(&VadService::receiver_loop, this);
-        std::thread processor_thread(&VadService::processing_loop, this);
         std::thread cmd_thread(&VadService::command_listener_loop, this);
 
         std::printf("VAD service fully loaded and ready\n");
@@ -237,23 +373,31 @@ public:
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
         running_ = false;
-        data_cv_.notify_all();
+        for (auto& sh : shards_) wake_shard(*sh);
 
         int sock = cmd_sock_.exchange(-1);
         if (sock >= 0) ::close(sock);
         receiver_thread.join();
-        processor_thread.join();
+        for (auto& sh : shards_) sh->thread.join();
         cmd_thread.join();
         interconnect_.shutdown();
     }
 
 private:
+    // Longest chunk a call's ring can hold: a max-length chunk ends at most a
+    // frame past max_speech, behind up to context + 2 frames of pre-speech
+    // audio, and the receiver must still find room for 2 s of audio arriving
+    // while the chunk is being handed on.
+    size_t max_chunk_limit() const {
+        return VAD_RING_SAMPLES - vad_frame_size_ * (vad_context_frames_ + 2) - 2 * VAD_SAMPLE_RATE;
+    }
+
     // Resets VAD state for a call after a chunk has been emitted.
-    // Does NOT broadcast speech signal — the caller must do so after releasing
-    // call->mutex to avoid holding the mutex during a TCP send.
+    // Does NOT broadcast speech signal — the caller does so once the chunk is
+    // taken, so the FSM pass is never stalled on a TCP send.
     // Returns true if speech_signaled was set (caller should broadcast SPEECH_IDLE).
     bool reset_call_state(VadCall& call) {
-        bool was_signaled = call.speech_signaled;
+        bool was_signaled = call.speech_signaled.load(std::memory_order_relaxed);
         call.in_speech = false;
         call.silence_count = 0;
         call.onset_count = 0;
@@ -273,25 +417,27 @@ private:
     }
 
     // Removes `consumed` samples from the front of the audio buffer and resets
-    // all position-tracking fields. Also refreshes last_buffer_size and
-    // last_buffer_growth so that the inactivity-flush timer restarts from the
+    // all position-tracking fields. Also refreshes last_buffer_growth so that the inactivity-flush timer restarts from the
     // moment of compaction rather than from when audio last arrived — this
     // prevents a premature inactivity flush on the leftover segment after a
     // max-length split where no new audio arrives for >1s.
     void compact_buffer(VadCall& call, size_t consumed) {
-        if (consumed >= call.audio_buffer.size()) {
-            call.audio_buffer.clear();
-        } else if (consumed > 0) {
-            call.audio_buffer.erase(call.audio_buffer.begin(),
-                                    call.audio_buffer.begin() + static_cast<ptrdiff_t>(consumed));
-        }
+        drop_front(call, consumed);
         call.vad_pos = 0;
         call.speech_start = 0;
         call.tentative_speech_start = 0;
-        call.last_buffer_size = call.audio_buffer.size();
         call.last_buffer_growth = std::chrono::steady_clock::now();
     }
 
+    // Removes up to `n` samples from the front of the audio buffer. O(1): only
+    // stream_pos moves; the ring space goes back to the receiver once the
+    // pass is done with any chunk taken from it.
+    static void drop_front(VadCall& call, size_t n) {
+        n = std::min(n, call.buffered);
+        call.stream_pos += n;
+        call.buffered -= n;
+    }
+
     // Finds the best split point near the max-chunk boundary by locating the
     // lowest-energy frame in the last smart_split_window_frames_ (6) frames.
     // This avoids cutting mid-word: energy dips correspond to inter-word silence
@@ -332,7 +478,7 @@ private:
         // energies_sample_origin = buffer position where frame_energies[0] starts.
         // +1 on min_idx: split at the END of the quiet frame (keep it in this chunk).
         size_t split = call.energies_sample_origin + (min_idx + 1) * vad_frame_size_;
-        if (split > call.audio_buffer.size()) split = call.audio_buffer.size();
+        if (split > call.buffered) split = call.buffered;
         if (split <= call.speech_start) split = max_end;
         return split;
     }
@@ -383,6 +529,10 @@ private:
 
     std::string handle_vad_command(const std::string& cmd) {
         if (cmd == "PING") return "PONG\n";
+        if (cmd == "HOP_LATENCY") return interconnect_.hop_latency_report();
+        if (cmd == "FLOW") return interconnect_.flow_report();
+        if (cmd == "METRICS") return interconnect_.metrics_report();
+        if (cmd == "METRICS:JSON") return interconnect_.metrics_report(true);
         if (cmd.rfind("SET_LOG_LEVEL:", 0) == 0) {
             std::string level = cmd.substr(14);
             log_fwd_.set_level(level.c_str());
@@ -421,6 +571,7 @@ private:
                     if (samples < vad_min_speech_samples_ * 2) {
                         samples = vad_min_speech_samples_ * 2;
                     }
+                    samples = std::min(samples, max_chunk_limit());
                     vad_max_speech_samples_.store(samples);
                     int actual_ms = (int)(samples / VAD_SAMPLES_PER_MS);
                     log_fwd_.forward(whispertalk::LogLevel::INFO, 0, "VAD max chunk set to %dms", actual_ms);
@@ -429,6 +580,29 @@ private:
                 return "ERROR:Value must be > 0\n";
             } catch (...) { return "ERROR:Invalid value\n"; }
         }
+        if (cmd.rfind("SET_VAD_NEURAL_THRESHOLD:", 0) == 0) {
+            try {
+                float val = std::stof(cmd.substr(25));
+                if (val >= 0.2f && val <= 0.95f) {
+                    vad_neural_threshold_.store(val);
+                    log_fwd_.forward(whispertalk::LogLevel::INFO, 0, "VAD neural threshold set to %.2f", val);
+                    return "OK\n";
+                }
+                return "ERROR:Value out of range (0.2-0.95)\n";
+            } catch (...) { return "ERROR:Invalid value\n"; }
+        }
+        if (cmd.rfind("SET_VAD_PARTIAL_MS:", 0) == 0) {
+            try {
+                int val = std::stoi(cmd.substr(19));
+                if (val == 0 || (val >= 250 && val <= 5000)) {
+                    set_partial_ms(val);
+                    log_fwd_.forward(whispertalk::LogLevel::INFO, 0, "VAD partial chunks every %dms%s",
+                                     val, val == 0 ? " (off)" : "");
+                    return "OK\n";
+                }
+                return "ERROR:Value out of range (0 or 250-5000)\n";
+            } catch (...) { return "ERROR:Invalid value\n"; }
+        }
         if (cmd.rfind("SET_VAD_ONSET_GAP:", 0) == 0) {
             try {
                 int val = std::stoi(cmd.substr(18));
@@ -466,8 +640,7 @@ private:
             std::lock_guard<std::mutex> lock(calls_mutex_);
             size_t speech_active = 0;
             for (const auto& [id, call] : calls_) {
-                std::lock_guard<std::mutex> cl(call->mutex);
-                if (call->speech_signaled) speech_active++;
+                if (call->speech_signaled.load(std::memory_order_relaxed)) speech_active++;
             }
             int frame_ms = (int)(vad_frame_size_ / VAD_SAMPLES_PER_MS);
             int silence_ms = vad_silence_frames_.load() * frame_ms;
@@ -483,6 +656,9 @@ private:
                 + ":ONSET_GAP:" + std::to_string(vad_onset_gap_tolerance_.load())
                 + ":POST_IDLE_COOLDOWN_MS:" + std::to_string(post_idle_cooldown_ms_.load())
                 + ":RMS_GATE:" + format_threshold(rms_silence_gate_.load())
+                + ":BACKEND:" + (shards_[0]->backend ? shards_[0]->backend->name() : "energy")
+                + ":NEURAL_THRESHOLD:" + format_threshold(vad_neural_threshold_.load())
+                + ":PARTIAL_MS:" + std::to_string(vad_partial_samples_.load() / VAD_SAMPLES_PER_MS)
                 + "\n";
         }
         return "ERROR:Unknown command\n";
@@ -490,364 +666,474 @@ private:
 
     void receiver_loop() {
         while (running_ && g_running) {
-            whispertalk::Packet pkt;
+            whispertalk::PooledPacket pkt;
             if (!interconnect_.recv_from_upstream(pkt, 100)) {
                 continue;
             }
 
-            if (!pkt.is_valid() || pkt.payload_size == 0 || (pkt.payload_size % sizeof(float)) != 0) {
+            if (!pkt.is_valid() || pkt.payload_size == 0) {
+                continue;
+            }
+            const bool ulaw = pkt.meta.type == whispertalk::PayloadType::ULAW;
+            if (ulaw ? (pkt.meta.sample_rate != 0 && pkt.meta.sample_rate != 8000)
+                     : ((pkt.payload_size % sizeof(float)) != 0 ||
+                        !whispertalk::payload_is(pkt.meta, whispertalk::PayloadType::PCM_F32, true) ||
+                        (pkt.meta.sample_rate != 0 && pkt.meta.sample_rate != 16000))) {
                 continue;
             }
 
             auto call = get_or_create_call(pkt.call_id);
 
-            size_t sample_count = pkt.payload_size / sizeof(float);
-            const float* samples = reinterpret_cast<const float*>(pkt.payload.data());
-
-            {
-                std::lock_guard<std::mutex> lock(call->mutex);
-                call->audio_buffer.insert(call->audio_buffer.end(), samples, samples + sample_count);
+            pkt.trace.record(whispertalk::ServiceType::VAD_SERVICE, 0);
+            // A frame that does not fit is dropped whole, before the upsampler
+            // sees it, so the μ-law bytes and the audio stay in step.
+            bool stored;
+            if (ulaw) {
+                const size_t n = pkt.payload_size;
+                const bool synced = call->ulaw_synced.load(std::memory_order_relaxed);
+                float* dst = call->audio.reserve(2 * n);
+                stored = dst && (!synced || call->ulaw.reserve(n));
+                if (stored) {
+                    // Bytes first: the processor encodes a chunk only from audio
+                    // it has seen, and by then the bytes behind it are there.
+                    if (synced) call->ulaw.push(pkt.payload(), n);
+                    call->audio.commit(call->upsampler.push(pkt.payload(), n, dst));
+                }
+            } else {
+                // Unsynced before the audio is published, so no chunk holding
+                // these samples is ever encoded from the μ-law ring.
+                call->ulaw_synced.store(false, std::memory_order_release);
+                stored = call->audio.push(reinterpret_cast<const float*>(pkt.payload()),
+                                          pkt.payload_size / sizeof(float));
+            }
+            if (!stored) {
+                ring_overruns_.inc();
+                continue;
+            }
+            call->last_trace.store(pkt.trace);
+            // Wake the call's worker once the frame it is waiting for is
+            // complete, and only once per frame.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint64_t wake_at = call->wake_at.load(std::memory_order_relaxed);
+            if (call->audio.head() >= wake_at && wake_at != call->woken_at) {
+                call->woken_at = wake_at;
+                wake_shard(*shards_[call->shard]);
             }
-            data_cv_.notify_one();
         }
     }
 
-    void processing_loop() {
+    // One shard worker: sleeps until the receiver reports a completed frame
+    // on one of its calls (or SHARD_TICK_MS passes, for the FSM timers), then
+    // runs the FSM over its calls. A call whose pass stopped at a chunk with
+    // whole frames still buffered gets another pass straight away.
+    void shard_loop(VadShard& shard) {
+        std::vector<std::shared_ptr<VadCall>> adopted;
+        std::vector<std::shared_ptr<VadCall>> ended;
+        bool again = false;
         while (running_ && g_running) {
             {
-                std::unique_lock<std::mutex> lk(data_mutex_);
-                bool has_calls;
-                {
-                    std::lock_guard<std::mutex> cl(calls_mutex_);
-                    has_calls = !calls_.empty();
+                std::unique_lock<std::mutex> lk(shard.mutex);
+                if (!again) {
+                    shard.cv.wait_for(lk, std::chrono::milliseconds(SHARD_TICK_MS),
+                                      [&] { return shard.wake || !running_; });
                 }
-                data_cv_.wait_for(lk, std::chrono::milliseconds(has_calls ? 25 : 50));
+                shard.wake = false;
+                adopted.swap(shard.adopted);
+                ended.swap(shard.ended);
             }
-
-            std::vector<std::shared_ptr<VadCall>> active;
-            {
-                std::lock_guard<std::mutex> lock(calls_mutex_);
-                active.reserve(calls_.size());
-                for (auto& p : calls_) active.push_back(p.second);
+            for (auto& c : adopted) {
+                if (shard.backend) c->neural.reset(*shard.backend, VAD_RING_SAMPLES);
+                shard.owned.push_back(std::move(c));
+            }
+            adopted.clear();
+            for (auto& gone : ended) {
+                shard.owned.erase(std::remove(shard.owned.begin(), shard.owned.end(), gone), shard.owned.end());
             }
+            ended.clear();
+
+            const bool compact_out = interconnect_.downstream_accepts(whispertalk::PayloadType::ULAW_UP16K);
+            const size_t partial_every = interconnect_.downstream_accepts_flags(whispertalk::FRAME_FLAG_PARTIAL)
+                                         ? vad_partial_samples_.load() : 0;
+            again = false;
+            if (shard.backend) score_shard(shard);
+            for (auto& call : shard.owned) {
+                again |= process_call(call, compact_out, partial_every, shard.backend.get());
+            }
+        }
+    }
 
-            for (auto& call : active) {
-                std::vector<float> to_send;
-                float chunk_sum_sq = 0.0f;
-                size_t chunk_sample_count = 0;
-                bool needs_idle_broadcast = false;
-                bool needs_active_broadcast = false;
-                uint32_t call_id = call->id;
-                {
-                    std::lock_guard<std::mutex> lock(call->mutex);
-
-                    // --- VAD finite state machine ---
-                    // Each iteration processes one vad_frame_size_ frame (50ms = 800 samples).
-                    // States:  IDLE (in_speech=false, onset_count=0)
-                    //       → ONSET (in_speech=false, onset_count>0)    [energy above threshold]
-                    //       → SPEECH (in_speech=true)                   [onset_count >= vad_onset_frames_]
-                    //       → back to IDLE                              [silence_count > vad_silence_frames_
-                    //                                                    OR speech_len > vad_max_speech_samples_]
-                    // A single below-threshold frame during ONSET resets onset_count to 0 (→ IDLE).
-                    const float thresh_mult = vad_threshold_mult_.load();
-                    const int silence_frames = vad_silence_frames_.load();
-                    const size_t max_speech = vad_max_speech_samples_.load();
-                    const int onset_gap_tol = vad_onset_gap_tolerance_.load();
-                    size_t pos = call->vad_pos;
-                    while (pos + vad_frame_size_ <= call->audio_buffer.size()) {
-                        // Compute mean energy (mean of squared samples) for this frame.
-                        float energy = 0;
-                        for (size_t i = 0; i < vad_frame_size_; ++i) {
-                            float s = call->audio_buffer[pos + i];
-                            energy += s * s;
-                        }
-                        energy /= static_cast<float>(vad_frame_size_);
-
-                        // Adapt noise floor only when not in speech and no onset pending.
-                        // EMA formula: nf = (1-α)·nf_old + α·energy, α=0.05.
-                        //   α=0.05 → time constant ≈ 1/α = 20 frames = 1 second @ 50ms/frame.
-                        //   This is slow enough to not track speech energy up, but fast enough
-                        //   to adapt to changing background noise within a few seconds.
-                        //   Hard floor 0.000005 prevents drift below G.711 quantization noise
-                        //   (G.711 silence ≈ energy 0.00000078).
-                        if (!call->in_speech && call->onset_count == 0) {
-                            float nf = call->noise_floor * (1.0f - NOISE_FLOOR_EMA_ALPHA) + energy * NOISE_FLOOR_EMA_ALPHA;
-                            call->noise_floor = std::max(nf, NOISE_FLOOR_HARD_MIN);
+    // Runs the shard's backend over every whole window its calls have
+    // buffered, batched across calls (vad-backend.h).
+    void score_shard(VadShard& shard) {
+        shard.streams.clear();
+        for (auto& c : shard.owned) shard.streams.push_back(&c->neural);
+        whispertalk::vad_score_pending(
+            *shard.backend, shard.streams.data(), shard.streams.size(),
+            [&](size_t i) { return shard.owned[i]->audio.head(); },
+            [&](size_t i, uint64_t pos) { return shard.owned[i]->audio.span(pos); },
+            shard.score_batch);
+    }
+
+    // One FSM pass over the call's buffered frames, then any chunk it cut is
+    // sent. Returns true if a whole frame is still waiting (the pass stops at
+    // a chunk boundary). partial_every: samples of new speech between
+    // partial chunks, 0 for none. Runs only on the call's shard worker.
+    bool process_call(const std::shared_ptr<VadCall>& call, bool compact_out, size_t partial_every,
+                      whispertalk::VadBackend* backend) {
+        // The chunk, if any, is buffer[speech_start, end) read in place
+        // from the ring; its space is released only after it is sent. A
+        // partial chunk leaves the FSM where it is.
+        const float* chunk = nullptr;
+        size_t chunk_len = 0;
+        uint64_t chunk_pos = 0;
+        bool chunk_partial = false;
+        std::vector<uint8_t> chunk_ulaw;
+        auto take_chunk = [&](VadCall& c, size_t end) {
+            chunk_pos = c.stream_pos + c.speech_start;
+            chunk_len = end - c.speech_start;
+            chunk = c.audio.span(chunk_pos);
+            chunk_partial = false;
+        };
+        whispertalk::PacketTrace chunk_trace;
+        float chunk_sum_sq = 0.0f;
+        size_t chunk_sample_count = 0;
+        bool needs_idle_broadcast = false;
+        bool needs_active_broadcast = false;
+        uint32_t call_id = call->id;
+        {
+            const uint64_t head = call->audio.head();
+            call->buffered = static_cast<size_t>(head - call->stream_pos);
+
+            // --- VAD finite state machine ---
+            // Each iteration processes one vad_frame_size_ frame (50ms = 800 samples).
+            // States:  IDLE (in_speech=false, onset_count=0)
+            //       → ONSET (in_speech=false, onset_count>0)    [energy above threshold]
+            //       → SPEECH (in_speech=true)                   [onset_count >= vad_onset_frames_]
+            //       → back to IDLE                              [silence_count > vad_silence_frames_
+            //                                                    OR speech_len > vad_max_speech_samples_]
+            // A single below-threshold frame during ONSET resets onset_count to 0 (→ IDLE).
+            const float thresh_mult = vad_threshold_mult_.load();
+            const int silence_frames = vad_silence_frames_.load();
+            const size_t max_speech = vad_max_speech_samples_.load();
+            const int onset_gap_tol = vad_onset_gap_tolerance_.load();
+            const float neural_thresh = vad_neural_threshold_.load();
+            size_t pos = call->vad_pos;
+            while (pos + vad_frame_size_ <= call->buffered &&
+                   (!backend || call->neural.covers(call->stream_pos + pos + vad_frame_size_))) {
+                // Mean energy (mean of squared samples) for this frame;
+                // the frame is one contiguous run even where it wraps.
+                float energy = whispertalk::sum_squares(call->audio.span(call->stream_pos + pos), vad_frame_size_)
+                               / static_cast<float>(vad_frame_size_);
+
+                // Adapt noise floor only when not in speech and no onset pending.
+                // EMA formula: nf = (1-α)·nf_old + α·energy, α=0.05.
+                //   α=0.05 → time constant ≈ 1/α = 20 frames = 1 second @ 50ms/frame.
+                //   This is slow enough to not track speech energy up, but fast enough
+                //   to adapt to changing background noise within a few seconds.
+                //   Hard floor 0.000005 prevents drift below G.711 quantization noise
+                //   (G.711 silence ≈ energy 0.00000078).
+                if (!call->in_speech && call->onset_count == 0) {
+                    call->noise_floor = whispertalk::vad_noise_floor_update(call->noise_floor, energy);
+                }
+                // Speech threshold = max(noise_floor × multiplier, min_energy).
+                // min_energy (0.00005) acts as absolute floor for very quiet environments.
+                float threshold = std::max(call->noise_floor * thresh_mult, vad_min_energy_);
+                // With a neural backend the model decides, with hysteresis once in
+                // speech; min_energy still rules out codec silence.
+                bool speech_frame = energy > threshold;
+                if (backend) {
+                    float prob = call->neural.frame_prob(call->stream_pos + pos, vad_frame_size_);
+                    float need = call->in_speech ? neural_thresh - whispertalk::VAD_NEURAL_HYSTERESIS : neural_thresh;
+                    speech_frame = energy > vad_min_energy_ && prob >= need;
+                }
+
+                if (speech_frame) {
+                    if (!call->in_speech) {
+                        call->onset_count++;
+                        call->onset_gap = 0;
+                        if (call->onset_count == 1) {
+                            size_t context = vad_frame_size_ * vad_context_frames_;
+                            call->tentative_speech_start = (pos > context) ? pos - context : 0;
                         }
-                        // Speech threshold = max(noise_floor × multiplier, min_energy).
-                        // min_energy (0.00005) acts as absolute floor for very quiet environments.
-                        float threshold = std::max(call->noise_floor * thresh_mult, vad_min_energy_);
-
-                        if (energy > threshold) {
-                            if (!call->in_speech) {
-                                call->onset_count++;
-                                call->onset_gap = 0;
-                                if (call->onset_count == 1) {
-                                    size_t context = vad_frame_size_ * vad_context_frames_;
-                                    call->tentative_speech_start = (pos > context) ? pos - context : 0;
-                                }
-                                if (call->onset_count >= vad_onset_frames_) {
-                                    call->in_speech = true;
-                                    call->speech_start = call->tentative_speech_start;
-                                    call->frame_energies.clear();
-                                    call->frame_energies.reserve(max_speech / vad_frame_size_ + 1);
-                                    call->speech_sum_sq = 0.0f;
-                                    call->speech_sample_count = 0;
-                                    call->energies_sample_origin = pos;
+                        if (call->onset_count >= vad_onset_frames_) {
+                            call->in_speech = true;
+                            call->speech_start = call->tentative_speech_start;
+                            call->frame_energies.clear();
+                            call->frame_energies.reserve(max_speech / vad_frame_size_ + 1);
+                            call->speech_sum_sq = 0.0f;
+                            call->speech_sample_count = 0;
+                            call->energies_sample_origin = pos;
+                            call->partial.restart(call->stream_pos + call->speech_start);
+                            if (vad_logging_enabled_) {
+                                log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
+                                    "VAD speech_start at sample %zu (energy=%.6f threshold=%.6f noise_floor=%.6f onset=%d)",
+                                    pos, energy, threshold, call->noise_floor, call->onset_count);
+                            }
+                            if (!call->speech_signaled.load(std::memory_order_relaxed)) {
+                                call->speech_signaled.store(true, std::memory_order_relaxed);
+                                call->speech_signal_time = std::chrono::steady_clock::now();
+                                int cooldown = post_idle_cooldown_ms_.load();
+                                auto ms_since_idle = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                    call->speech_signal_time - call->last_idle_time).count();
+                                if (cooldown > 0 && call->last_idle_time.time_since_epoch().count() > 0
+                                    && ms_since_idle < cooldown) {
                                     if (vad_logging_enabled_) {
                                         log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
-                                            "VAD speech_start at sample %zu (energy=%.6f threshold=%.6f noise_floor=%.6f onset=%d)",
-                                            pos, energy, threshold, call->noise_floor, call->onset_count);
+                                            "SPEECH_ACTIVE suppressed — post-idle cooldown (%lldms since IDLE, cooldown=%dms)",
+                                            (long long)ms_since_idle, cooldown);
                                     }
-                                    if (!call->speech_signaled) {
-                                        call->speech_signaled = true;
-                                        call->speech_signal_time = std::chrono::steady_clock::now();
-                                        int cooldown = post_idle_cooldown_ms_.load();
-                                        auto ms_since_idle = std::chrono::duration_cast<std::chrono::milliseconds>(
-                                            call->speech_signal_time - call->last_idle_time).count();
-                                        if (cooldown > 0 && call->last_idle_time.time_since_epoch().count() > 0
-                                            && ms_since_idle < cooldown) {
-                                            if (vad_logging_enabled_) {
-                                                log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
-                                                    "SPEECH_ACTIVE suppressed — post-idle cooldown (%lldms since IDLE, cooldown=%dms)",
-                                                    (long long)ms_since_idle, cooldown);
-                                            }
-                                        } else {
-                                            needs_active_broadcast = true;
-                                        }
-                                    }
-                                }
-                            }
-                            call->silence_count = 0;
-                        } else {
-                            if (!call->in_speech && call->onset_count > 0) {
-                                call->onset_gap++;
-                                if (call->onset_gap > onset_gap_tol) {
-                                    call->onset_count = 0;
-                                    call->onset_gap = 0;
+                                } else {
+                                    needs_active_broadcast = true;
                                 }
-                            } else {
-                                call->onset_count = 0;
-                                call->onset_gap = 0;
-                            }
-                            if (call->in_speech) {
-                                call->silence_count++;
                             }
                         }
-
-                        if (call->in_speech) {
-                            call->frame_energies.push_back(energy);
-                            // Accumulate sum-of-squares for RMS calculation. energy is
-                            // mean(s²) for this frame, so energy * frame_size = sum(s²).
-                            // This avoids re-scanning the entire chunk in send_chunk_downstream
-                            // just to compute RMS for the energy gate check.
-                            call->speech_sum_sq += energy * static_cast<float>(vad_frame_size_);
-                            call->speech_sample_count += vad_frame_size_;
+                    }
+                    call->silence_count = 0;
+                } else {
+                    if (!call->in_speech && call->onset_count > 0) {
+                        call->onset_gap++;
+                        if (call->onset_gap > onset_gap_tol) {
+                            call->onset_count = 0;
+                            call->onset_gap = 0;
                         }
+                    } else {
+                        call->onset_count = 0;
+                        call->onset_gap = 0;
+                    }
+                    if (call->in_speech) {
+                        call->silence_count++;
+                    }
+                }
 
-                        pos += vad_frame_size_;
-
-                        // Silence-triggered speech end: enough consecutive silent frames detected.
-                        if (call->in_speech && call->silence_count >= silence_frames) {
-                            size_t buf_sz = call->audio_buffer.size();
-                            if (call->speech_start <= pos && pos <= buf_sz) {
-                                to_send.assign(
-                                    call->audio_buffer.begin() + call->speech_start,
-                                    call->audio_buffer.begin() + pos);
-                                chunk_sum_sq = call->speech_sum_sq;
-                                chunk_sample_count = call->speech_sample_count;
-                                if (vad_logging_enabled_) {
-                                    double dur_ms = to_send.size() / (double)VAD_SAMPLES_PER_MS;
-                                    log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
-                                        "VAD speech_end (silence) — %zu samples (%.0fms) queued for transcription",
-                                        to_send.size(), dur_ms);
-                                }
-                            } else {
-                                // Invariant violation: speech_start is out-of-range. Recover
-                                // whatever audio is available from speech_start to buf_sz.
-                                log_fwd_.forward(whispertalk::LogLevel::WARN, call->id,
-                                    "VAD: bounds error at silence end — speech_start=%zu pos=%zu buf=%zu — recovering partial",
-                                    call->speech_start, pos, buf_sz);
-                                if (call->speech_start < buf_sz) {
-                                    to_send.assign(
-                                        call->audio_buffer.begin() + call->speech_start,
-                                        call->audio_buffer.end());
-                                    chunk_sum_sq = call->speech_sum_sq;
-                                    chunk_sample_count = call->speech_sample_count;
-                                }
-                                pos = buf_sz;
-                            }
-                            compact_buffer(*call, pos);
-                            pos = 0;
-                            needs_idle_broadcast = reset_call_state(*call);
-                            break;
-                        }
+                if (call->in_speech) {
+                    call->frame_energies.push_back(energy);
+                    // Accumulate sum-of-squares for RMS calculation. energy is
+                    // mean(s²) for this frame, so energy * frame_size = sum(s²).
+                    // This avoids re-scanning the entire chunk in send_chunk_downstream
+                    // just to compute RMS for the energy gate check.
+                    call->speech_sum_sq += energy * static_cast<float>(vad_frame_size_);
+                    call->speech_sample_count += vad_frame_size_;
+                }
 
-                        // Max-length triggered speech end with smart split.
-                        // Guard against size_t underflow: if speech_start > pos (invariant
-                        // violation from state corruption), reset rather than triggering
-                        // spurious max-length splits from the wrap-around value.
-                        if (call->in_speech && call->speech_start > pos) {
-                            size_t buf_sz = call->audio_buffer.size();
-                            log_fwd_.forward(whispertalk::LogLevel::WARN, call->id,
-                                "VAD: speech_start(%zu) > pos(%zu) buf(%zu) — invariant violation, resetting",
-                                call->speech_start, pos, buf_sz);
-                            if (call->speech_start < buf_sz) {
-                                to_send.assign(
-                                    call->audio_buffer.begin() + call->speech_start,
-                                    call->audio_buffer.end());
-                                chunk_sum_sq = call->speech_sum_sq;
-                                chunk_sample_count = call->speech_sample_count;
-                            }
-                            compact_buffer(*call, buf_sz);
-                            pos = 0;
-                            needs_idle_broadcast = reset_call_state(*call);
-                            break;
+                pos += vad_frame_size_;
+
+                // Silence-triggered speech end: enough consecutive silent frames detected.
+                if (call->in_speech && call->silence_count >= silence_frames) {
+                    size_t buf_sz = call->buffered;
+                    if (call->speech_start <= pos && pos <= buf_sz) {
+                        take_chunk(*call, pos);
+                        chunk_sum_sq = call->speech_sum_sq;
+                        chunk_sample_count = call->speech_sample_count;
+                        if (vad_logging_enabled_) {
+                            double dur_ms = chunk_len / (double)VAD_SAMPLES_PER_MS;
+                            log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
+                                "VAD speech_end (silence) — %zu samples (%.0fms) queued for transcription",
+                                chunk_len, dur_ms);
                         }
-                        size_t speech_len = pos - call->speech_start;
-                        if (call->in_speech && speech_len > max_speech) {
-                            size_t split = find_smart_split_point(*call, pos);
-                            size_t buf_sz = call->audio_buffer.size();
-                            if (call->speech_start <= split && split <= buf_sz) {
-                                to_send.assign(
-                                    call->audio_buffer.begin() + call->speech_start,
-                                    call->audio_buffer.begin() + split);
-                            } else {
-                                // Recover: extract from speech_start to min(pos, buf_sz).
-                                log_fwd_.forward(whispertalk::LogLevel::WARN, call->id,
-                                    "VAD: bounds error at max-length split — speech_start=%zu split=%zu buf=%zu — recovering",
-                                    call->speech_start, split, buf_sz);
-                                split = std::min(pos, buf_sz);
-                                if (call->speech_start < split) {
-                                    to_send.assign(
-                                        call->audio_buffer.begin() + call->speech_start,
-                                        call->audio_buffer.begin() + split);
-                                } else if (call->speech_start < buf_sz) {
-                                    to_send.assign(
-                                        call->audio_buffer.begin() + call->speech_start,
-                                        call->audio_buffer.end());
-                                    split = buf_sz;
-                                }
-                            }
+                    } else {
+                        // Invariant violation: speech_start is out-of-range. Recover
+                        // whatever audio is available from speech_start to buf_sz.
+                        log_fwd_.forward(whispertalk::LogLevel::WARN, call->id,
+                            "VAD: bounds error at silence end — speech_start=%zu pos=%zu buf=%zu — recovering partial",
+                            call->speech_start, pos, buf_sz);
+                        if (call->speech_start < buf_sz) {
+                            take_chunk(*call, call->buffered);
                             chunk_sum_sq = call->speech_sum_sq;
                             chunk_sample_count = call->speech_sample_count;
-                            if (vad_logging_enabled_) {
-                                double dur_ms = to_send.size() / (double)VAD_SAMPLES_PER_MS;
-                                bool was_smart = (split != pos);
-                                log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
-                                    "VAD speech_end (max_length%s) — %zu samples (%.0fms) queued for transcription",
-                                    was_smart ? ", smart-split" : "", to_send.size(), dur_ms);
-                            }
-                            size_t leftover_start = split;
-                            bool has_leftover = (split < pos);
-
-                            compact_buffer(*call, leftover_start);
-                            pos = 0;
-
-                            if (has_leftover && call->audio_buffer.size() > 0) {
-                                // Continue speech from the leftover audio after split.
-                                call->in_speech = true;
-                                call->speech_start = 0;
-                                call->silence_count = 0;
-                                call->onset_count = 0;
-                                call->frame_energies.clear();
-                                call->energies_sample_origin = 0;
-                                // Don't broadcast IDLE — speech is still active.
-                            } else {
-                                needs_idle_broadcast = reset_call_state(*call);
-                            }
-                            break;
                         }
+                        pos = buf_sz;
                     }
-                    call->vad_pos = pos;
+                    compact_buffer(*call, pos);
+                    pos = 0;
+                    needs_idle_broadcast = reset_call_state(*call);
+                    break;
+                }
 
-                    auto now = std::chrono::steady_clock::now();
-                    if (call->audio_buffer.size() != call->last_buffer_size) {
-                        call->last_buffer_size = call->audio_buffer.size();
-                        call->last_buffer_growth = now;
+                // Max-length triggered speech end with smart split.
+                // Guard against size_t underflow: if speech_start > pos (invariant
+                // violation from state corruption), reset rather than triggering
+                // spurious max-length splits from the wrap-around value.
+                if (call->in_speech && call->speech_start > pos) {
+                    size_t buf_sz = call->buffered;
+                    log_fwd_.forward(whispertalk::LogLevel::WARN, call->id,
+                        "VAD: speech_start(%zu) > pos(%zu) buf(%zu) — invariant violation, resetting",
+                        call->speech_start, pos, buf_sz);
+                    if (call->speech_start < buf_sz) {
+                        take_chunk(*call, call->buffered);
+                        chunk_sum_sq = call->speech_sum_sq;
+                        chunk_sample_count = call->speech_sample_count;
                     }
-
-                    // Inactivity flush: no new audio for vad_inactivity_flush_ms_ while
-                    // speech is active — flush remaining buffer (handles end-of-stream).
-                    if (call->in_speech && to_send.empty() && call->last_buffer_size > 0) {
-                        auto inactivity = std::chrono::duration_cast<std::chrono::milliseconds>(
-                            now - call->last_buffer_growth).count();
-                        if (inactivity > vad_inactivity_flush_ms_) {
-                            size_t end = call->audio_buffer.size();
-                            if (end > call->speech_start) {
-                                to_send.assign(
-                                    call->audio_buffer.begin() + call->speech_start,
-                                    call->audio_buffer.end());
-                                chunk_sum_sq = call->speech_sum_sq;
-                                chunk_sample_count = call->speech_sample_count;
-                                call->audio_buffer.clear();
-                                call->vad_pos = 0;
-                                call->last_buffer_size = 0;
-                                needs_idle_broadcast = reset_call_state(*call);
-                                if (vad_logging_enabled_) {
-                                    double dur_ms = to_send.size() / (double)VAD_SAMPLES_PER_MS;
-                                    log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
-                                        "VAD speech_end (inactivity %dms) — %zu samples (%.0fms) queued",
-                                        vad_inactivity_flush_ms_, to_send.size(), dur_ms);
-                                }
-                            }
+                    compact_buffer(*call, buf_sz);
+                    pos = 0;
+                    needs_idle_broadcast = reset_call_state(*call);
+                    break;
+                }
+                size_t speech_len = pos - call->speech_start;
+                if (call->in_speech && speech_len > max_speech) {
+                    size_t split = find_smart_split_point(*call, pos);
+                    size_t buf_sz = call->buffered;
+                    if (call->speech_start <= split && split <= buf_sz) {
+                        take_chunk(*call, split);
+                    } else {
+                        // Recover: extract from speech_start to min(pos, buf_sz).
+                        log_fwd_.forward(whispertalk::LogLevel::WARN, call->id,
+                            "VAD: bounds error at max-length split — speech_start=%zu split=%zu buf=%zu — recovering",
+                            call->speech_start, split, buf_sz);
+                        split = std::min(pos, buf_sz);
+                        if (call->speech_start < split) {
+                            take_chunk(*call, split);
+                        } else if (call->speech_start < buf_sz) {
+                            take_chunk(*call, call->buffered);
+                            split = buf_sz;
                         }
                     }
-
-                    // Trim non-speech buffer, keeping context frames for next onset detection.
-                    // Only trim when accumulated excess exceeds 4x the keep threshold to avoid
-                    // frequent small deque erases (each front-erase is O(elements_removed)).
-                    if (!call->in_speech) {
-                        size_t keep_frames = vad_context_frames_ + 2;
-                        size_t keep = vad_frame_size_ * keep_frames;
-                        size_t min_trim = keep * 4;
-                        if (call->vad_pos > keep + min_trim) {
-                            size_t trim = call->vad_pos - keep;
-                            call->audio_buffer.erase(call->audio_buffer.begin(),
-                                                     call->audio_buffer.begin() + static_cast<ptrdiff_t>(trim));
-                            call->vad_pos = keep;
-                        }
+                    chunk_sum_sq = call->speech_sum_sq;
+                    chunk_sample_count = call->speech_sample_count;
+                    if (vad_logging_enabled_) {
+                        double dur_ms = chunk_len / (double)VAD_SAMPLES_PER_MS;
+                        bool was_smart = (split != pos);
+                        log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
+                            "VAD speech_end (max_length%s) — %zu samples (%.0fms) queued for transcription",
+                            was_smart ? ", smart-split" : "", chunk_len, dur_ms);
+                    }
+                    size_t leftover_start = split;
+                    bool has_leftover = (split < pos);
+
+                    compact_buffer(*call, leftover_start);
+                    pos = 0;
+
+                    if (has_leftover && call->buffered > 0) {
+                        // Continue speech from the leftover audio after split.
+                        call->in_speech = true;
+                        call->speech_start = 0;
+                        call->silence_count = 0;
+                        call->onset_count = 0;
+                        call->frame_energies.clear();
+                        call->energies_sample_origin = 0;
+                        call->partial.restart(call->stream_pos);
+                        // Don't broadcast IDLE — speech is still active.
+                    } else {
+                        needs_idle_broadcast = reset_call_state(*call);
                     }
+                    break;
+                }
 
-                    // Speech signal timeout: force IDLE after speech_signal_timeout_s_ to
-                    // prevent permanent SPEECH_ACTIVE state from stuck sessions.
-                    if (call->speech_signaled) {
-                        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-                            now - call->speech_signal_time).count();
-                        if (elapsed > speech_signal_timeout_s_) {
-                            if (call->in_speech && call->audio_buffer.size() > call->speech_start) {
-                                to_send.assign(
-                                    call->audio_buffer.begin() + call->speech_start,
-                                    call->audio_buffer.end());
-                                chunk_sum_sq = call->speech_sum_sq;
-                                chunk_sample_count = call->speech_sample_count;
-                                call->audio_buffer.clear();
-                                call->vad_pos = 0;
-                                call->last_buffer_size = 0;
-                                log_fwd_.forward(whispertalk::LogLevel::WARN, call->id,
-                                    "SPEECH_ACTIVE timeout (%ds) — forcing SPEECH_IDLE", speech_signal_timeout_s_);
-                            }
-                            needs_idle_broadcast = reset_call_state(*call);
+                // Partial mode: the utterance so far goes out flagged partial;
+                // it stays buffered for the final chunk.
+                if (call->in_speech &&
+                    call->partial.due(call->stream_pos + pos, speech_frame, call->silence_count,
+                                      partial_every, whispertalk::PARTIAL_PAUSE_FRAMES)) {
+                    take_chunk(*call, pos);
+                    chunk_partial = true;
+                    chunk_sum_sq = call->speech_sum_sq;
+                    chunk_sample_count = call->speech_sample_count;
+                    call->partial.sent(call->stream_pos + pos);
+                    break;
+                }
+            }
+            call->vad_pos = pos;
+
+            auto now = std::chrono::steady_clock::now();
+            if (head != call->last_head) {
+                call->last_head = head;
+                call->last_buffer_growth = now;
+            }
+
+            // Inactivity flush: no new audio for vad_inactivity_flush_ms_ while
+            // speech is active — flush remaining buffer (handles end-of-stream).
+            if (call->in_speech && chunk_len == 0 && call->buffered > 0) {
+                auto inactivity = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    now - call->last_buffer_growth).count();
+                if (inactivity > vad_inactivity_flush_ms_) {
+                    size_t end = call->buffered;
+                    if (end > call->speech_start) {
+                        take_chunk(*call, call->buffered);
+                        chunk_sum_sq = call->speech_sum_sq;
+                        chunk_sample_count = call->speech_sample_count;
+                        drop_front(*call, call->buffered);
+                        call->vad_pos = 0;
+                        needs_idle_broadcast = reset_call_state(*call);
+                        if (vad_logging_enabled_) {
+                            double dur_ms = chunk_len / (double)VAD_SAMPLES_PER_MS;
+                            log_fwd_.forward(whispertalk::LogLevel::DEBUG, call->id,
+                                "VAD speech_end (inactivity %dms) — %zu samples (%.0fms) queued",
+                                vad_inactivity_flush_ms_, chunk_len, dur_ms);
                         }
                     }
-                } // release call->mutex
-
-                // Broadcast speech signals outside the mutex to avoid holding the
-                // lock during a TCP send that could block/stall the receiver thread.
-                // speech_signal_time was already set inside the lock at onset detection.
-                if (needs_active_broadcast) {
-                    interconnect_.broadcast_speech_signal(call_id, true);
-                    log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id, "SPEECH_ACTIVE broadcast");
                 }
-                if (needs_idle_broadcast) {
-                    interconnect_.broadcast_speech_signal(call_id, false);
+            }
+
+            // Trim non-speech buffer, keeping context frames for next onset
+            // detection. Trimming is O(1), so it happens every pass and the
+            // ring holds little more than the context outside speech.
+            if (!call->in_speech) {
+                size_t keep_frames = vad_context_frames_ + 2;
+                size_t keep = vad_frame_size_ * keep_frames;
+                if (call->vad_pos > keep) {
+                    size_t trimmed = call->vad_pos - keep;
+                    drop_front(*call, trimmed);
+                    call->vad_pos = keep;
+                    call->tentative_speech_start -= std::min(call->tentative_speech_start, trimmed);
                 }
+            }
 
-                if (!to_send.empty()) {
-                    send_chunk_downstream(call_id, to_send, chunk_sum_sq, chunk_sample_count);
+            // Speech signal timeout: force IDLE after speech_signal_timeout_s_ to
+            // prevent permanent SPEECH_ACTIVE state from stuck sessions.
+            if (call->speech_signaled.load(std::memory_order_relaxed)) {
+                auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+                    now - call->speech_signal_time).count();
+                if (elapsed > speech_signal_timeout_s_) {
+                    if (call->in_speech && call->buffered > call->speech_start) {
+                        take_chunk(*call, call->buffered);
+                        chunk_sum_sq = call->speech_sum_sq;
+                        chunk_sample_count = call->speech_sample_count;
+                        drop_front(*call, call->buffered);
+                        call->vad_pos = 0;
+                        log_fwd_.forward(whispertalk::LogLevel::WARN, call->id,
+                            "SPEECH_ACTIVE timeout (%ds) — forcing SPEECH_IDLE", speech_signal_timeout_s_);
+                    }
+                    needs_idle_broadcast = reset_call_state(*call);
                 }
             }
+            if (chunk_len > 0) {
+                chunk_trace = call->last_trace.load();
+                if (compact_out && call->ulaw_synced.load(std::memory_order_acquire)) {
+                    whispertalk::write_ulaw_up16k(chunk_pos, chunk_len, call->ulaw.span(chunk_pos / 2), chunk_ulaw);
+                }
+            }
+        }
+
+        // speech_signal_time was already set at onset detection.
+        if (needs_active_broadcast) {
+            interconnect_.broadcast_speech_signal(call_id, true);
+            log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id, "SPEECH_ACTIVE broadcast");
         }
+        if (needs_idle_broadcast) {
+            interconnect_.broadcast_speech_signal(call_id, false);
+        }
+
+        if (chunk_len > 0) {
+            send_chunk_downstream(call_id, chunk, chunk_len, chunk_ulaw, chunk_trace, chunk_sum_sq, chunk_sample_count,
+                                  chunk_partial);
+        }
+        // A backend still reads the context before its next window.
+        uint64_t keep_from = call->stream_pos;
+        if (backend) keep_from = std::min(keep_from, call->neural.needed_from());
+        call->audio.release(keep_from);
+        if (call->ulaw_synced.load(std::memory_order_relaxed)) call->ulaw.release(call->stream_pos / 2);
+
+        // Where the next frame completes (with a backend: where the window
+        // holding its last sample does); the receiver wakes this shard when
+        // it writes past it. The fence pairs with the receiver's: either it
+        // sees the new wake_at or this sees its samples.
+        uint64_t next = call->stream_pos + call->vad_pos + vad_frame_size_;
+        if (backend) {
+            const uint64_t w = backend->window();
+            next = (next + w - 1) / w * w;
+        }
+        call->wake_at.store(next, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return call->audio.head() >= next;
     }
 
     // Validates and sends a speech chunk to Whisper via the interconnect.
@@ -856,17 +1142,21 @@ private:
     //      to filter out clicks and noise bursts that passed onset detection.
     //   2. RMS energy gate: reject chunks with RMS < 0.008 (near-silence) to prevent
     //      Whisper hallucinations on effectively-silent audio that passed VAD.
-    //   3. If both pass, wrap the audio in a Packet and send downstream.
+    //   3. If both pass, wrap the audio in a Packet and send downstream — as
+    //      `ulaw` (ULAW_UP16K, pcm-wire.h) when VAD has it, else as float32.
     // pre_sum_sq/pre_count: pre-computed sum-of-squares from the FSM loop, avoiding
     // a full rescan of the audio buffer. Falls back to on-the-fly computation if zero.
-    void send_chunk_downstream(uint32_t call_id, const std::vector<float>& audio,
-                                float pre_sum_sq = 0.0f, size_t pre_count = 0) {
+    // partial: the utterance so far, flagged FRAME_FLAG_PARTIAL (speech-partial.h).
+    void send_chunk_downstream(uint32_t call_id, const float* audio, size_t count,
+                                const std::vector<uint8_t>& ulaw,
+                                const whispertalk::PacketTrace& trace,
+                                float pre_sum_sq = 0.0f, size_t pre_count = 0, bool partial = false) {
         // Gate 1: minimum chunk length (500ms = 8000 samples @ 16kHz).
-        if (audio.size() < vad_min_speech_samples_) {
+        if (count < vad_min_speech_samples_) {
             if (vad_logging_enabled_) {
                 log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id,
                     "Skipping chunk: %zu samples (%.0fms) below minimum %zu",
-                    audio.size(), audio.size() / (double)VAD_SAMPLES_PER_MS, vad_min_speech_samples_);
+                    count, count / (double)VAD_SAMPLES_PER_MS, vad_min_speech_samples_);
             }
             return;
         }
@@ -877,44 +1167,51 @@ private:
         if (pre_count > 0) {
             rms = std::sqrt(pre_sum_sq / static_cast<float>(pre_count));
         } else {
-            float sum_sq = 0.0f;
-            for (size_t i = 0; i < audio.size(); ++i) {
-                float s = audio[i];
-                sum_sq += s * s;
-            }
-            rms = std::sqrt(sum_sq / static_cast<float>(audio.size()));
+            rms = std::sqrt(whispertalk::sum_squares(audio, count) / static_cast<float>(count));
         }
 
         if (rms < rms_silence_gate_.load()) {
             if (vad_logging_enabled_) {
                 log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id,
-                    "Skipping low-energy chunk: RMS=%.6f (%.0fms)", rms, audio.size() / (double)VAD_SAMPLES_PER_MS);
+                    "Skipping low-energy chunk: RMS=%.6f (%.0fms)", rms, count / (double)VAD_SAMPLES_PER_MS);
             }
             return;
         }
 
-        // Peak scan on contiguous vector memory (fast, ~cache-friendly).
+        // Peak scan on the contiguous ring span (fast, ~cache-friendly).
         float peak = 0.0f;
-        for (size_t i = 0; i < audio.size(); ++i) {
+        for (size_t i = 0; i < count; ++i) {
             float a = std::abs(audio[i]);
             if (a > peak) peak = a;
         }
 
         if (vad_logging_enabled_) {
-            log_fwd_.forward(whispertalk::LogLevel::INFO, call_id,
-                "VAD chunk -> Whisper: %zu samples (%.0fms) RMS=%.4f peak=%.4f",
-                audio.size(), audio.size() / (double)VAD_SAMPLES_PER_MS, rms, peak);
+            log_fwd_.forward(partial ? whispertalk::LogLevel::DEBUG : whispertalk::LogLevel::INFO, call_id,
+                "VAD %s -> Whisper: %zu samples (%.0fms) RMS=%.4f peak=%.4f", partial ? "partial" : "chunk",
+                count, count / (double)VAD_SAMPLES_PER_MS, rms, peak);
         }
 
-        whispertalk::Packet pkt(call_id, audio.data(), audio.size() * sizeof(float));
-        pkt.trace.record(whispertalk::ServiceType::VAD_SERVICE, 0);
+        whispertalk::Packet pkt = ulaw.empty()
+            ? whispertalk::Packet(call_id, audio, count * sizeof(float))
+            : whispertalk::Packet(call_id, ulaw.data(), ulaw.size());
+        pkt.meta = whispertalk::FrameMeta(ulaw.empty() ? whispertalk::PayloadType::PCM_F32
+                                                       : whispertalk::PayloadType::ULAW_UP16K, 16000);
+        if (partial) {
+            pkt.meta.flags = whispertalk::FRAME_FLAG_PARTIAL;
+            partial_chunks_.inc();
+        }
+        pkt.trace = trace;
+        if (pkt.trace.hop_count == 0) pkt.trace.record(whispertalk::ServiceType::VAD_SERVICE, 0);
         pkt.trace.record(whispertalk::ServiceType::VAD_SERVICE, 1);
         if (!interconnect_.send_to_downstream(pkt)) {
             if (interconnect_.downstream_state() != whispertalk::ConnectionState::CONNECTED) {
-                auto now = std::chrono::steady_clock::now();
-                if (std::chrono::duration_cast<std::chrono::seconds>(now - last_disc_warn_).count() >= DISC_WARN_INTERVAL_S) {
+                // Shared by all workers: whoever claims the interval logs.
+                int64_t now_s = std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+                int64_t last = last_disc_warn_s_.load(std::memory_order_relaxed);
+                if (now_s - last >= DISC_WARN_INTERVAL_S &&
+                    last_disc_warn_s_.compare_exchange_strong(last, now_s, std::memory_order_relaxed)) {
                     log_fwd_.forward(whispertalk::LogLevel::WARN, call_id, "Whisper disconnected, discarding speech chunk");
-                    last_disc_warn_ = now;
                 }
             }
         }
@@ -924,10 +1221,16 @@ private:
         std::lock_guard<std::mutex> lock(calls_mutex_);
         auto it = calls_.find(cid);
         if (it != calls_.end()) return it->second;
-        auto call = std::make_shared<VadCall>();
-        call->id = cid;
+        auto call = std::make_shared<VadCall>(cid);
         call->last_buffer_growth = std::chrono::steady_clock::now();
+        call->wake_at.store(vad_frame_size_, std::memory_order_relaxed);
+        call->shard = shard_of(cid);
         calls_[cid] = call;
+        {
+            VadShard& sh = *shards_[call->shard];
+            std::lock_guard<std::mutex> sl(sh.mutex);
+            sh.adopted.push_back(call);
+        }
         std::cout << "Created VAD session for call_id " << cid << std::endl;
         log_fwd_.forward(whispertalk::LogLevel::INFO, cid, "Created VAD session");
         return call;
@@ -939,21 +1242,43 @@ private:
         if (it != calls_.end()) {
             std::cout << "Call " << call_id << " ended, closing VAD session" << std::endl;
             log_fwd_.forward(whispertalk::LogLevel::INFO, call_id, "Call ended, closing VAD session");
+            VadShard& sh = *shards_[it->second->shard];
+            {
+                std::lock_guard<std::mutex> sl(sh.mutex);
+                sh.ended.push_back(it->second);
+            }
             calls_.erase(it);
         }
     }
 
+    size_t shard_of(uint32_t call_id) const {
+        return static_cast<size_t>((call_id * 0x9E3779B97F4A7C15ull) >> 32) % shards_.size();
+    }
+
+    static void wake_shard(VadShard& sh) {
+        {
+            std::lock_guard<std::mutex> lk(sh.mutex);
+            sh.wake = true;
+        }
+        sh.cv.notify_one();
+    }
+
     std::atomic<bool> running_;
     std::atomic<int> cmd_sock_{-1};
+    // calls_mutex_ guards calls_, the call_id registry used by receiver_loop,
+    // STATUS and call end. Processing goes through the shards instead.
     std::mutex calls_mutex_;
-    // data_mutex_ + data_cv_: lightweight sleep-interrupt mechanism for the processing
-    // loop. data_mutex_ does not guard any shared state — it exists solely to satisfy
-    // the condition_variable API. The CV is notified by receiver_loop when new audio
-    // arrives, allowing processing_loop to wake immediately instead of fixed-interval polling.
-    std::mutex data_mutex_;
-    std::condition_variable data_cv_;
     std::map<uint32_t, std::shared_ptr<VadCall>> calls_;
-    std::chrono::steady_clock::time_point last_disc_warn_{};
+    int worker_threads_ = default_worker_threads();
+    std::string backend_spec_ = "energy";
+    std::vector<std::unique_ptr<VadShard>> shards_;   // fixed once run() starts
+    std::atomic<int64_t> last_disc_warn_s_{INT64_MIN / 2};
+    // Upstream frames dropped because a call's ring was full (the processing
+    // loop more than a ring behind).
+    whispertalk::Counter& ring_overruns_ = whispertalk::metrics().counter(
+        "whispertalk_vad_ring_overruns_total", "Upstream audio frames dropped on a full VAD call ring");
+    whispertalk::Counter& partial_chunks_ = whispertalk::metrics().counter(
+        "whispertalk_vad_partial_chunks_total", "Partial (provisional) speech chunks sent to Whisper");
     whispertalk::InterconnectNode interconnect_;
     whispertalk::LogForwarder log_fwd_;
 };
@@ -970,6 +1295,10 @@ int main(int argc, char** argv) {
     int vad_onset_gap = -1;
     int post_idle_cooldown_ms = -1;
     float rms_gate = -1.0f;
+    int vad_threads = 0;
+    std::string vad_backend = "energy";
+    float vad_neural_threshold = -1.0f;
+    int vad_partial_ms = 0;
     std::string log_level = "INFO";
 
     static struct option long_opts[] = {
@@ -980,12 +1309,16 @@ int main(int argc, char** argv) {
         {"vad-onset-gap",            required_argument, 0, 'g'},
         {"post-idle-cooldown-ms",    required_argument, 0, 'p'},
         {"rms-gate",                 required_argument, 0, 'r'},
+        {"vad-threads",              required_argument, 0, 'T'},
+        {"vad-backend",              required_argument, 0, 'B'},
+        {"vad-neural-threshold",     required_argument, 0, 'N'},
+        {"vad-partial-ms",           required_argument, 0, 'P'},
         {"log-level",                required_argument, 0, 'L'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "w:t:s:c:g:p:r:L:", long_opts, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "w:t:s:c:g:p:r:T:B:N:P:L:", long_opts, nullptr)) != -1) {
         switch (opt) {
             case 'w': vad_window_ms = atoi(optarg); break;
             case 't': vad_threshold = atof(optarg); break;
@@ -994,6 +1327,10 @@ int main(int argc, char** argv) {
             case 'g': vad_onset_gap = atoi(optarg); break;
             case 'p': post_idle_cooldown_ms = atoi(optarg); break;
             case 'r': rms_gate = atof(optarg); break;
+            case 'T': vad_threads = atoi(optarg); break;
+            case 'B': vad_backend = optarg; break;
+            case 'N': vad_neural_threshold = atof(optarg); break;
+            case 'P': vad_partial_ms = atoi(optarg); break;
             case 'L': log_level = optarg; break;
             default: break;
         }
@@ -1002,6 +1339,8 @@ int main(int argc, char** argv) {
     std::cout << "VAD Service starting..." << std::endl;
 
     VadService service;
+    if (vad_partial_ms >= 250 && vad_partial_ms <= 5000)
+        service.set_partial_ms(vad_partial_ms);
     service.set_vad_params(vad_window_ms, vad_threshold, vad_silence_ms, vad_max_chunk_ms);
     if (vad_onset_gap >= 0 && vad_onset_gap <= 5)
         service.set_onset_gap(vad_onset_gap);
@@ -1009,6 +1348,9 @@ int main(int argc, char** argv) {
         service.set_post_idle_cooldown(post_idle_cooldown_ms);
     if (rms_gate >= 0.0f && rms_gate <= 1.0f)
         service.set_rms_gate(rms_gate);
+    if (vad_threads > 0)
+        service.set_worker_threads(vad_threads);
+    service.set_backend(vad_backend, vad_neural_threshold);
     if (!service.init()) {
         return 1;
     }
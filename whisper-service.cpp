@@ -27,6 +27,23 @@
 // RMS energy check: Rejects chunks with RMS < 0.005 as near-silence to prevent
 //   hallucinations on effectively-silent frames passed by VAD.
 //
+// Partial chunks (speech-partial.h): a VAD running --vad-partial-ms also sends
+//   the utterance so far, flagged partial. Each is transcribed speculatively and
+//   its text held per call; the final chunk commits it when it only adds silence
+//   to the same audio, and is transcribed as usual otherwise. If LLaMA offered
+//   TEXT_PARTIAL, the words the last two partial transcripts agree on go out
+//   as one whenever they grow (StablePrefix), so LLaMA can run RAG and prefill
+//   the prompt while the caller finishes; the TEXT final follows as before.
+//
+// State pool: the model weights are loaded once (no state); each of --states
+//   whisper_states has a worker thread and decodes with --threads threads
+//   (default: one state per 4 cores, up to 4, the cores split between them).
+//   receiver_loop only decodes the wire format and queues the chunk; a free
+//   worker takes the oldest chunk of a call that is not already being
+//   transcribed (call-job-queue.h), so concurrent calls no longer wait on one
+//   context while one call's chunks stay in order. Time spent queued is
+//   whispertalk_whisper_queue_wait_us.
+//
 // Packet buffering: If LLaMA is disconnected, buffers up to MAX_BUFFER_PACKETS (64)
 //   transcription packets and drains them atomically on reconnect.
 //
@@ -35,7 +52,11 @@
 //   changes signal characteristics and degrades model accuracy.
 //
 // CMD port (Whisper base+2 = 13122): PING, STATUS, HALLUCINATION_FILTER:ON/OFF/STATUS,
-//   SET_LOG_LEVEL commands. STATUS returns model name, filter state, connection state.
+//   SET_LOG_LEVEL, HOP_LATENCY, FLOW, METRICS, METRICS:JSON commands. STATUS returns model name, filter state, connection state.
+//
+// Replicas: --instance N (1..7) runs this process as WHISPER#N on that instance's
+//   ports (cmd port included). VAD shards calls across WHISPERTALK_REPLICAS_WHISPER
+//   instances, so each replica decodes its own calls on its own model context.
 #include <iostream>
 #include <vector>
 #include <string>
@@ -44,6 +65,8 @@
 #include <atomic>
 #include <chrono>
 #include <deque>
+#include <algorithm>
+#include <unordered_map>
 #include <cmath>
 #include <signal.h>
 #include <getopt.h>
@@ -52,6 +75,9 @@
 #include <netinet/in.h>
 #include <unistd.h>
 #include "interconnect.h"
+#include "pcm-wire.h"
+#include "speech-partial.h"
+#include "call-job-queue.h"
 #include "whisper-cpp/include/whisper.h"
 
 static std::atomic<bool> g_running{true};
@@ -59,7 +85,9 @@ static void sig_handler(int) { g_running = false; }
 
 static constexpr int WSP_SAMPLE_RATE     = 16000;
 static constexpr int WSP_SAMPLES_PER_MS  = WSP_SAMPLE_RATE / 1000;
-static constexpr int WSP_N_THREADS       = 4;
+static constexpr int WSP_N_THREADS       = 4;    // per state, when cores allow
+static constexpr int WSP_MAX_DEFAULT_STATES = 4;
+static constexpr int WSP_MAX_STATES      = 16;
 static constexpr float RMS_SILENCE_THOLD = 0.005f;
 static constexpr float WSP_TEMP_INC      = 0.2f;
 static constexpr float WSP_ENTROPY_THOLD = 2.4f;
@@ -70,30 +98,73 @@ static constexpr int CMD_POLL_TIMEOUT_MS = 200;
 static constexpr int CMD_RECV_TIMEOUT_S  = 10;
 static constexpr int CMD_BUF_SIZE        = 4096;
 
+// One state per WSP_N_THREADS cores, at least one and at most
+// WSP_MAX_DEFAULT_STATES; states share the cores evenly.
+static int default_states() {
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    return std::max(1, std::min(WSP_MAX_DEFAULT_STATES, hw / WSP_N_THREADS));
+}
+
+static int default_threads_per_state(int states) {
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    return hw > 0 ? std::max(1, hw / states) : WSP_N_THREADS;
+}
+
 class WhisperService {
     static constexpr size_t MAX_BUFFER_PACKETS = 64;
     size_t min_speech_samples_ = WSP_SAMPLE_RATE / 2;
     std::atomic<bool> hallucination_filter_enabled_{false};
 
 public:
-    WhisperService(const std::string& model_path, const std::string& language = "de") 
+    WhisperService(const std::string& model_path, const std::string& language = "de",
+                   uint8_t instance = 0)
         : running_(true), 
           model_path_(model_path),
           language_(language),
-          interconnect_(whispertalk::ServiceType::WHISPER_SERVICE) {
+          interconnect_(whispertalk::ServiceType::WHISPER_SERVICE, instance) {
         whisper_context_params cparams = whisper_context_default_params();
         cparams.use_gpu = true;
-        ctx_ = whisper_init_from_file_with_params(model_path.c_str(), cparams);
+        // Weights only: every decoder runs on a state of its own (init()).
+        ctx_ = whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
         if (!ctx_) {
             throw std::runtime_error("Failed to load Whisper model: " + model_path);
         }
     }
 
     ~WhisperService() {
+        for (auto* st : states_) whisper_free_state(st);
         if (ctx_) whisper_free(ctx_);
     }
 
+    // Size of the whisper_state pool and decoder threads per state; 0 keeps
+    // the default. Set before init().
+    void set_pool(int states, int threads_per_state) {
+        if (states >= 1 && states <= WSP_MAX_STATES) n_states_ = states;
+        threads_per_state_ = threads_per_state >= 1 ? threads_per_state : default_threads_per_state(n_states_);
+    }
+
     bool init() {
+        if (threads_per_state_ == 0) threads_per_state_ = default_threads_per_state(n_states_);
+        for (int i = 0; i < n_states_; i++) {
+            whisper_state* st = whisper_init_state(ctx_);
+            if (!st) break;
+            states_.push_back(st);
+        }
+        if (states_.empty()) {
+            std::cerr << "Failed to allocate a Whisper state" << std::endl;
+            return false;
+        }
+        if ((int)states_.size() < n_states_) {
+            std::cerr << "Whisper: only " << states_.size() << " of " << n_states_
+                      << " states could be allocated" << std::endl;
+        }
+        std::cout << "Whisper states: " << states_.size() << " x " << threads_per_state_ << " threads" << std::endl;
+
+
+        if (whispertalk::ic_compact_pcm_default()) {
+            interconnect_.accept_payload_type(whispertalk::PayloadType::ULAW_UP16K);
+        }
+        interconnect_.accept_frame_flags(whispertalk::FRAME_FLAG_PARTIAL);
         if (!interconnect_.initialize()) {
             std::cerr << "Failed to initialize interconnect" << std::endl;
             return false;
@@ -121,6 +192,8 @@ public:
     }
 
     void run() {
+        std::vector<std::thread> workers;
+        for (auto* st : states_) workers.emplace_back(&WhisperService::worker_loop, this, st);
         std::thread receiver_thread(&WhisperService::receiver_loop, this);
         std::thread cmd_thread(&WhisperService::command_listener_loop, this);
         while (running_ && g_running) {
@@ -131,13 +204,16 @@ public:
         int sock = cmd_sock_.exchange(-1);
         if (sock >= 0) ::close(sock);
         receiver_thread.join();
+        jobs_.close();
+        for (auto& w : workers) w.join();
         cmd_thread.join();
         interconnect_.shutdown();
     }
 
 private:
     void command_listener_loop() {
-        uint16_t port = whispertalk::service_cmd_port(whispertalk::ServiceType::WHISPER_SERVICE);
+        uint16_t port = whispertalk::service_cmd_port(whispertalk::ServiceType::WHISPER_SERVICE,
+                                                      interconnect_.instance());
         int sock = socket(AF_INET, SOCK_STREAM, 0);
         if (sock < 0) return;
         int opt = 1;
@@ -180,6 +256,10 @@ private:
 
     std::string handle_whisper_command(const std::string& cmd) {
         if (cmd == "PING") return "PONG\n";
+        if (cmd == "HOP_LATENCY") return interconnect_.hop_latency_report();
+        if (cmd == "FLOW") return interconnect_.flow_report();
+        if (cmd == "METRICS") return interconnect_.metrics_report();
+        if (cmd == "METRICS:JSON") return interconnect_.metrics_report(true);
         if (cmd.rfind("SET_LOG_LEVEL:", 0) == 0) {
             std::string level = cmd.substr(14);
             log_fwd_.set_level(level.c_str());
@@ -209,13 +289,17 @@ private:
                 + ":UPSTREAM:" + (interconnect_.upstream_state() == whispertalk::ConnectionState::CONNECTED ? "connected" : "disconnected")
                 + ":DOWNSTREAM:" + ds_status
                 + ":HALLUCINATION_FILTER:" + (hallucination_filter_enabled_.load() ? "ON" : "OFF")
+                + ":STATES:" + std::to_string(states_.size())
+                + ":BUSY:" + std::to_string(jobs_.running())
+                + ":QUEUED:" + std::to_string(jobs_.waiting())
                 + "\n";
         }
         return "ERROR:Unknown command\n";
     }
 
-    // Receives pre-segmented audio chunks from VAD and transcribes each immediately.
-    // Each packet from VAD is a complete speech segment ready for transcription.
+    // Receives pre-segmented audio chunks from VAD and queues each for the
+    // state pool. Each packet from VAD is a complete speech segment ready for
+    // transcription, or a partial one (speech-partial.h).
     void receiver_loop() {
         while (running_ && g_running) {
             whispertalk::Packet pkt;
@@ -223,13 +307,87 @@ private:
                 continue;
             }
 
-            if (!pkt.is_valid() || pkt.payload_size == 0 || (pkt.payload_size % sizeof(float)) != 0) {
+            if (!pkt.is_valid() || pkt.payload_size == 0) {
                 continue;
             }
 
-            size_t sample_count = pkt.payload_size / sizeof(float);
-            const float* samples = reinterpret_cast<const float*>(pkt.payload.data());
-            transcribe_and_send(pkt.call_id, samples, sample_count);
+            ChunkJob job;
+            if (pkt.meta.type == whispertalk::PayloadType::ULAW_UP16K) {
+                // Compact chunk from VAD: rebuilds the float chunk bit for bit.
+                if (!whispertalk::decode_ulaw_up16k(pkt.payload.data(), pkt.payload_size, job.audio)) continue;
+            } else {
+                if ((pkt.payload_size % sizeof(float)) != 0 ||
+                    !whispertalk::payload_is(pkt.meta, whispertalk::PayloadType::PCM_F32, true) ||
+                    (pkt.meta.sample_rate != 0 && pkt.meta.sample_rate != 16000)) {
+                    continue;
+                }
+                const float* samples = reinterpret_cast<const float*>(pkt.payload.data());
+                job.audio.assign(samples, samples + pkt.payload_size / sizeof(float));
+            }
+            pkt.trace.record(whispertalk::ServiceType::WHISPER_SERVICE, 0);
+            job.trace = pkt.trace;
+            const bool partial = (pkt.meta.flags & whispertalk::FRAME_FLAG_PARTIAL) != 0;
+            job.partial = partial;
+            if (partial) {
+                // The worker only fills entries that exist, so a partial still
+                // running when its call ends does not leave one behind. A call
+                // is marked ended before handle_call_end erases its entry under
+                // this lock, so a partial arriving after CALL_END is dropped
+                // here rather than recreating it.
+                std::lock_guard<std::mutex> lock(speculative_mutex_);
+                if (interconnect_.has_ended(pkt.call_id)) continue;
+                speculative_[pkt.call_id];
+            }
+            size_t superseded = jobs_.push(pkt.call_id, std::move(job), partial);
+            if (superseded) partials_superseded_.inc(superseded);
+        }
+    }
+
+    // One per whisper_state: transcribes queued chunks on it.
+    void worker_loop(whisper_state* state) {
+        whispertalk::CallJobQueue<ChunkJob>::Item item;
+        while (jobs_.pop(item)) {
+            auto waited = std::chrono::steady_clock::now() - item.queued_at;
+            queue_wait_us_.record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(waited).count()));
+            const ChunkJob& job = item.job;
+            if (job.partial) {
+                speculate(state, item.call_id, job.audio.data(), job.audio.size(), job.trace);
+            } else {
+                transcribe_and_send(state, item.call_id, job.audio.data(), job.audio.size(), job.trace);
+            }
+            jobs_.done(item.call_id);
+        }
+    }
+
+    // Partial chunk: transcribes it now and holds the text for the final.
+    // Sends LLaMA the stable prefix if this transcript extended it.
+    void speculate(whisper_state* state, uint32_t call_id, const float* audio, size_t audio_len,
+                   const whispertalk::PacketTrace& trace) {
+        whispertalk::Counter* outcome = nullptr;
+        std::string text = transcribe(state, call_id, audio, audio_len, outcome, true);
+        const bool stream = !text.empty() &&
+            interconnect_.downstream_accepts(whispertalk::PayloadType::TEXT_PARTIAL);
+        std::string stable;
+        {
+            std::lock_guard<std::mutex> lock(speculative_mutex_);
+            auto it = speculative_.find(call_id);
+            if (it == speculative_.end()) return;
+            if (stream && it->second.prefix.update(text)) stable = it->second.prefix.text();
+            it->second.transcript.hold(audio, audio_len, std::move(text));
+            it->second.outcome = outcome;
+        }
+        if (stable.empty()) return;
+
+        // Superseded by the next one, so never buffered: one that cannot be
+        // sent now is dropped.
+        whispertalk::Packet pkt(call_id, stable.c_str(), stable.length());
+        pkt.meta = whispertalk::FrameMeta(whispertalk::PayloadType::TEXT_PARTIAL);
+        pkt.trace = trace;
+        pkt.trace.record(whispertalk::ServiceType::WHISPER_SERVICE, 1);
+        if (interconnect_.send_to_downstream(pkt)) {
+            partial_texts_sent_.inc();
+            log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id, "Stable prefix to LLaMA: %s", stable.c_str());
         }
     }
 
@@ -339,16 +497,56 @@ private:
         return result;
     }
 
-    // Transcribes a speech chunk and sends the text downstream to LLaMA.
+    // Final chunk: commits the call's speculative transcript if the chunk
+    // only adds silence to its audio, else transcribes the chunk; then sends
+    // the text downstream to LLaMA.
+    // `trace` is the VAD chunk's hop trace; the text packet continues it.
+    void transcribe_and_send(whisper_state* state, uint32_t call_id, const float* audio, size_t audio_len,
+                             const whispertalk::PacketTrace& trace) {
+        std::string text;
+        whispertalk::Counter* outcome = nullptr;
+        bool speculated = false, committed = false;
+        {
+            std::lock_guard<std::mutex> lock(speculative_mutex_);
+            auto it = speculative_.find(call_id);
+            if (it != speculative_.end()) it->second.prefix.reset();
+            if (it != speculative_.end() && it->second.transcript.held()) {
+                speculated = true;
+                committed = it->second.transcript.commit(audio, audio_len, RMS_SILENCE_THOLD, text);
+                outcome = it->second.outcome;
+            }
+        }
+        if (committed) {
+            speculation_committed_.inc();
+            log_fwd_.forward(whispertalk::LogLevel::INFO, call_id, "Transcription (speculative, committed): %s",
+                             text.c_str());
+        } else {
+            if (speculated) speculation_discarded_.inc();
+            text = transcribe(state, call_id, audio, audio_len, outcome, false);
+        }
+        if (outcome) outcome->inc();
+        if (text.empty()) return;
+
+        whispertalk::Packet pkt(call_id, text.c_str(), text.length());
+        pkt.meta = whispertalk::FrameMeta(whispertalk::PayloadType::TEXT);
+        pkt.trace = trace;
+        pkt.trace.record(whispertalk::ServiceType::WHISPER_SERVICE, 1);
+        send_or_buffer_llama(pkt, call_id);
+    }
+
+    // Transcribes a speech chunk on `state`. Returns the text for LLaMA, or ""
+    // if there is none; `outcome` is the chunk counter the result belongs to.
     // Uses GREEDY decoding for speed — on short chunks the accuracy difference vs beam search
     // is negligible, but inference is 3-5x faster. audio_ctx=0 uses full encoder context
     // matching whisper-cli default behavior.
-    void transcribe_and_send(uint32_t call_id, const float* audio, size_t audio_len) {
+    std::string transcribe(whisper_state* state, uint32_t call_id, const float* audio, size_t audio_len,
+                           whispertalk::Counter*& outcome, bool partial) {
         if (audio_len < min_speech_samples_) {
             log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id,
                 "Skipping chunk: %zu samples (%.0fms) below minimum %zu",
                 audio_len, audio_len / (double)WSP_SAMPLES_PER_MS, min_speech_samples_);
-            return;
+            outcome = &chunks_short_;
+            return "";
         }
 
         float sum_sq = 0.0f, peak = 0.0f;
@@ -367,12 +565,13 @@ private:
         if (rms < RMS_SILENCE_THOLD) {
             log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id,
                 "Skipping low-energy chunk: RMS=%.6f (%.0fms)", rms, audio_len / (double)WSP_SAMPLES_PER_MS);
-            return;
+            outcome = &chunks_silent_;
+            return "";
         }
 
         whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
         wparams.language = language_.c_str();
-        wparams.n_threads = WSP_N_THREADS;
+        wparams.n_threads = threads_per_state_;
         wparams.no_timestamps = true;
         wparams.single_segment = false;
         wparams.beam_search.beam_size = 5;
@@ -388,29 +587,33 @@ private:
         wparams.no_context = true;
         wparams.initial_prompt = "Guten Tag, willkommen bei der Telefonzentrale.";
 
-        std::lock_guard<std::mutex> lock(whisper_mutex_);
         auto t0 = std::chrono::steady_clock::now();
-        int result = whisper_full(ctx_, wparams, audio, (int)audio_len);
+        int result = whisper_full_with_state(ctx_, state, wparams, audio, (int)audio_len);
 
         if (result == 0) {
             auto t1 = std::chrono::steady_clock::now();
             auto whisper_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
-            int n_segments = whisper_full_n_segments(ctx_);
+            auto whisper_us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+            inference_us_.record(static_cast<uint64_t>(whisper_us));
+            rtf_permille_.record(static_cast<uint64_t>(whisper_us * WSP_SAMPLES_PER_MS / audio_len));
+            int n_segments = whisper_full_n_segments_from_state(state);
             std::string text;
             for (int i = 0; i < n_segments; ++i) {
-                text += whisper_full_get_segment_text(ctx_, i);
+                text += whisper_full_get_segment_text_from_state(state, i);
             }
             if (!text.empty()) {
                 if (hallucination_filter_enabled_.load(std::memory_order_relaxed)) {
                     if (is_hallucination(text)) {
                         log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id, "Hallucination filtered: %s", text.c_str());
-                        return;
+                        outcome = &chunks_filtered_;
+                        return "";
                     }
 
                     std::string cleaned = strip_trailing_hallucinations(text);
                     if (cleaned.empty() || cleaned.size() < (size_t)MIN_TEXT_LEN) {
                         log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id, "Stripped to empty: %s", text.c_str());
-                        return;
+                        outcome = &chunks_filtered_;
+                        return "";
                     }
                     if (cleaned != text) {
                         log_fwd_.forward(whispertalk::LogLevel::DEBUG, call_id, "Stripped hallucination tail: '%s' -> '%s'", text.c_str(), cleaned.c_str());
@@ -420,18 +623,18 @@ private:
 
                 double audio_dur_ms = audio_len / (double)WSP_SAMPLES_PER_MS;
                 double rtf = whisper_ms / audio_dur_ms;
-                log_fwd_.forward(whispertalk::LogLevel::INFO, call_id,
-                    "Transcription (%lldms, RTF=%.2f): %s", whisper_ms, rtf, text.c_str());
-
-                whispertalk::Packet pkt(call_id, text.c_str(), text.length());
-                pkt.trace.record(whispertalk::ServiceType::WHISPER_SERVICE, 0);
-                pkt.trace.record(whispertalk::ServiceType::WHISPER_SERVICE, 1);
-
-                send_or_buffer_llama(pkt, call_id);
+                log_fwd_.forward(partial ? whispertalk::LogLevel::DEBUG : whispertalk::LogLevel::INFO, call_id,
+                    "Transcription%s (%lldms, RTF=%.2f): %s", partial ? " (speculative)" : "",
+                    (long long)whisper_ms, rtf, text.c_str());
+                outcome = &chunks_transcribed_;
+                return text;
             }
-        } else {
-            log_fwd_.forward(whispertalk::LogLevel::ERROR, call_id, "Whisper transcription failed");
+            outcome = &chunks_empty_;
+            return "";
         }
+        outcome = &chunks_failed_;
+        log_fwd_.forward(whispertalk::LogLevel::ERROR, call_id, "Whisper transcription failed");
+        return "";
     }
 
     void send_or_buffer_llama(whispertalk::Packet& pkt, uint32_t call_id) {
@@ -480,6 +683,11 @@ private:
     }
 
     void handle_call_end(uint32_t call_id) {
+        jobs_.drop_call(call_id);
+        {
+            std::lock_guard<std::mutex> lock(speculative_mutex_);
+            speculative_.erase(call_id);
+        }
         {
             std::lock_guard<std::mutex> buf_lock(buffer_mutex_);
             auto it = buffered_packets_.begin();
@@ -501,15 +709,73 @@ private:
     std::atomic<int> cmd_sock_{-1};
     std::string model_path_;
     std::string language_;
-    struct whisper_context* ctx_ = nullptr;
-    std::mutex whisper_mutex_;
+    struct whisper_context* ctx_ = nullptr;   // weights, shared by all states
+    int n_states_ = default_states();
+    int threads_per_state_ = 0;               // 0 until set_pool() / init()
+    std::vector<whisper_state*> states_;      // one worker each; fixed after init()
     whispertalk::InterconnectNode interconnect_;
     whispertalk::LogForwarder log_fwd_;
+
+    // A chunk as queued for the pool: decoded 16 kHz audio.
+    struct ChunkJob {
+        std::vector<float> audio;
+        whispertalk::PacketTrace trace;
+        bool partial = false;
+    };
+    whispertalk::CallJobQueue<ChunkJob> jobs_;
+
+    // Latest partial chunk's transcript per call, the chunk counter it
+    // lands in if committed, and what the partials so far agree on.
+    struct Speculation {
+        whispertalk::SpeculativeTranscript transcript;
+        whispertalk::Counter* outcome = nullptr;
+        whispertalk::StablePrefix prefix;
+    };
+    std::mutex speculative_mutex_;
+    std::unordered_map<uint32_t, Speculation> speculative_;
     
     std::mutex buffer_mutex_;
     std::deque<whispertalk::Packet> buffered_packets_;
     std::atomic<bool> has_buffered_{false};
 
+    whispertalk::LatencyHistogram& queue_wait_us_ = whispertalk::metrics().histogram(
+        "whispertalk_whisper_queue_wait_us", "Time a chunk waits for a free whisper_state (µs)");
+    whispertalk::Counter& partials_superseded_ = whispertalk::metrics().counter(
+        "whispertalk_whisper_partials_superseded_total", "Queued partial chunks dropped for a newer chunk of the call");
+    whispertalk::LatencyHistogram& inference_us_ = whispertalk::metrics().histogram(
+        "whispertalk_whisper_inference_us", "whisper_full() time per chunk (µs)");
+    // RTF × 1000, so the µs histogram's resolution carries over.
+    whispertalk::LatencyHistogram& rtf_permille_ = whispertalk::metrics().histogram(
+        "whispertalk_whisper_rtf_permille", "Real-time factor per chunk, in thousandths");
+    static whispertalk::Counter& chunk_counter(const char* outcome) {
+        return whispertalk::metrics().counter("whispertalk_whisper_chunks_total",
+                                              "Speech chunks by outcome", {{"outcome", outcome}});
+    }
+    whispertalk::Counter& chunks_short_ = chunk_counter("short");
+    whispertalk::Counter& chunks_silent_ = chunk_counter("silent");
+    whispertalk::Counter& chunks_filtered_ = chunk_counter("hallucination");
+    whispertalk::Counter& chunks_empty_ = chunk_counter("empty");
+    whispertalk::Counter& chunks_failed_ = chunk_counter("failed");
+    whispertalk::Counter& chunks_transcribed_ = chunk_counter("transcribed");
+    static whispertalk::Counter& speculation_counter(const char* outcome) {
+        return whispertalk::metrics().counter("whispertalk_whisper_speculative_total",
+                                              "Final chunks by fate of the partial transcript held for them",
+                                              {{"outcome", outcome}});
+    }
+    whispertalk::Counter& speculation_committed_ = speculation_counter("committed");
+    whispertalk::Counter& speculation_discarded_ = speculation_counter("discarded");
+    whispertalk::Counter& partial_texts_sent_ = whispertalk::metrics().counter(
+        "whispertalk_whisper_partial_texts_total", "Stable-prefix TEXT_PARTIAL frames sent to LLaMA");
+    whispertalk::MetricsCollector metrics_collector_{[this](whispertalk::MetricsWriter& w) {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        w.gauge("whispertalk_whisper_buffered_transcripts", "Transcripts held while LLaMA is unreachable", {},
+                static_cast<double>(buffered_packets_.size()));
+        w.gauge("whispertalk_whisper_queued_chunks", "Chunks waiting for a whisper_state", {},
+                static_cast<double>(jobs_.waiting()));
+        w.gauge("whispertalk_whisper_busy_states", "whisper_states transcribing", {},
+                static_cast<double>(jobs_.running()));
+    }};
+
 };
 
 const char* WhisperService::hallucination_patterns_[] = {
@@ -539,20 +805,29 @@ int main(int argc, char** argv) {
     std::string model_path;
     std::string language = "de";
     std::string log_level = "INFO";
+    int instance = 0;
+    int states = 0;
+    int threads = 0;
 
     static struct option long_opts[] = {
         {"language",       required_argument, 0, 'l'},
         {"model",          required_argument, 0, 'm'},
         {"log-level",      required_argument, 0, 'L'},
+        {"instance",       required_argument, 0, 'i'},
+        {"states",         required_argument, 0, 'S'},
+        {"threads",        required_argument, 0, 't'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "l:m:L:", long_opts, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "l:m:L:i:S:t:", long_opts, nullptr)) != -1) {
         switch (opt) {
             case 'l': language = optarg; break;
             case 'm': model_path = optarg; break;
             case 'L': log_level = optarg; break;
+            case 'i': instance = std::atoi(optarg); break;
+            case 'S': states = std::atoi(optarg); break;
+            case 't': threads = std::atoi(optarg); break;
             default: break;
         }
     }
@@ -574,9 +849,14 @@ int main(int argc, char** argv) {
 
     std::cout << "Whisper model: " << model_path << std::endl;
     std::cout << "Language: " << language << std::endl;
+    if (instance < 0 || instance >= whispertalk::MAX_STAGE_REPLICAS) {
+        std::cerr << "--instance must be 0.." << whispertalk::MAX_STAGE_REPLICAS - 1 << std::endl;
+        return 1;
+    }
 
     try {
-        WhisperService service(model_path, language);
+        WhisperService service(model_path, language, static_cast<uint8_t>(instance));
+        service.set_pool(states, threads);
         if (!service.init()) {
             return 1;
         }